@@ -0,0 +1,62 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "BaseTypes.h"
+#include <stdlib.h>
+#include <Windows.h>
+#include <WinCrypt.h>
+
+// random numbers of the crypto service provider, node ids, tokens and
+// transaction ids must not be guessed, and rand() gives the same numbers
+// in every process
+class CryptRandom : private NotCopyable
+{
+public:
+    CryptRandom()
+        : provider_(0)
+    {
+        if (!::CryptAcquireContext(&provider_, 0, 0, PROV_RSA_FULL,
+                                   CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+            provider_ = 0;
+
+        // rand() is the fallback when there is no provider
+        ::srand(::GetTickCount() ^ (::GetCurrentProcessId() << 16));
+    }
+
+    ~CryptRandom()
+    {
+        if (provider_)
+            ::CryptReleaseContext(provider_, 0);
+    }
+
+    void Fill(void *buffer, std::size_t len)
+    {
+        BYTE *bytes = static_cast<BYTE *>(buffer);
+        if (provider_ && ::CryptGenRandom(provider_, static_cast<DWORD>(len), bytes))
+            return ;
+
+        for (std::size_t i = 0; i < len; ++i)
+            bytes[i] = static_cast<BYTE>(::rand() >> 4);
+    }
+
+private:
+    HCRYPTPROV provider_;
+};
+
+// fill buffer with random bytes
+inline void RandomBytes(void *buffer, std::size_t len)
+{
+    static CryptRandom random;
+    random.Fill(buffer, len);
+}
+
+// a random value of integral type T
+template<typename T>
+inline T RandomValue()
+{
+    T value;
+    RandomBytes(&value, sizeof(value));
+    return value;
+}
+
+#endif // RANDOM_H
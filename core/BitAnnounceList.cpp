@@ -0,0 +1,119 @@
+#include "BitAnnounceList.h"
+#include "BitTrackerConnection.h"
+#include "BitUdpTrackerConnection.h"
+#include "../base/Random.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    using namespace std::tr1::placeholders;
+
+    BitAnnounceList::BitAnnounceList(const BitTrackerTiers::Tiers& tiers,
+                                     const std::tr1::shared_ptr<BitData>& bitdata,
+                                     net::IoService& io_service)
+        : io_service_(io_service),
+          processing_(false)
+    {
+        // trackers of invalid urls are not in tiers
+        BitTrackerTiers::Tiers valid_tiers;
+        for (std::size_t i = 0; i < tiers.size(); ++i)
+        {
+            valid_tiers.push_back(std::vector<std::string>());
+            for (std::size_t j = 0; j < tiers[i].size(); ++j)
+            {
+                const std::string& url = tiers[i][j];
+                if (connections_.find(url) != connections_.end())
+                    continue;
+
+                try
+                {
+                    Connection connection;
+                    if (BitUdpTrackerConnection::IsUdpTracker(url))
+                        connection.udp.reset(new BitUdpTrackerConnection(
+                                    url, bitdata, io_service_,
+                                    std::tr1::bind(&BitAnnounceList::OnAnnounced,
+                                        this, url, _1, _2)));
+                    else
+                        connection.http.reset(new BitTrackerConnection(
+                                    url, bitdata, io_service_,
+                                    std::tr1::bind(&BitAnnounceList::OnAnnounced,
+                                        this, url, _1, _2)));
+
+                    connections_[url] = connection;
+                    valid_tiers.back().push_back(url);
+                }
+                catch (...)
+                {
+                    // we continue create tracker connection
+                }
+            }
+        }
+
+        tiers_.Reset(new BitTrackerTiers(valid_tiers));
+
+        process_timer_.SetCallback(std::tr1::bind(&BitAnnounceList::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&process_timer_);
+        process_timer_.SetDeadline(RandomValue<unsigned int>() % startup_jitter);
+    }
+
+    BitAnnounceList::~BitAnnounceList()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&process_timer_);
+    }
+
+    void BitAnnounceList::SetAnnounceToAllTiers(bool all_tiers)
+    {
+        tiers_->SetAnnounceToAllTiers(all_tiers);
+    }
+
+    void BitAnnounceList::UpdateTrackerInfo()
+    {
+        tiers_->AnnounceNow();
+        Process();
+    }
+
+    void BitAnnounceList::OnTimer()
+    {
+        process_timer_.SetDeadline(process_interval);
+        Process();
+    }
+
+    void BitAnnounceList::OnAnnounced(const std::string& url,
+                                      bool success, int interval)
+    {
+        tiers_->OnAnnounced(url, success, interval,
+                Timer::TimeTraits::now());
+
+        // a failed tracker fails over now, not on the next timer
+        if (!processing_)
+            Process();
+    }
+
+    void BitAnnounceList::Process()
+    {
+        std::vector<std::string> urls;
+        tiers_->GetAnnounces(Timer::TimeTraits::now(), &urls);
+
+        processing_ = true;
+        for (std::size_t i = 0; i < urls.size(); ++i)
+        {
+            Connections::iterator it = connections_.find(urls[i]);
+            assert(it != connections_.end());
+            if (it->second.http)
+                it->second.http->UpdateTrackerInfo();
+            else
+                it->second.udp->UpdateTrackerInfo();
+        }
+        processing_ = false;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,69 @@
+#ifndef BIT_ANNOUNCE_LIST_H
+#define BIT_ANNOUNCE_LIST_H
+
+#include "BitTrackerTiers.h"
+#include "../base/BaseTypes.h"
+#include "../base/ScopePtr.h"
+#include "../net/IoService.h"
+#include "../timer/Timer.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+    class BitTrackerConnection;
+    class BitUdpTrackerConnection;
+
+    // announce a task to http and udp trackers of its announce tiers,
+    // BitTrackerTiers decides which trackers to announce, the result of an
+    // announce is processed at once, so a failed tracker fails over to the
+    // next one without waiting
+    class BitAnnounceList : private NotCopyable
+    {
+    public:
+        static const int process_interval = 1000;
+        // first announces of tasks loaded at startup are spread in this
+        // milliseconds
+        static const int startup_jitter = 15 * 1000;
+
+        BitAnnounceList(const BitTrackerTiers::Tiers& tiers,
+                        const std::tr1::shared_ptr<BitData>& bitdata,
+                        net::IoService& io_service);
+
+        ~BitAnnounceList();
+
+        // announce to a tracker of every tier at the same time, at most
+        // BitTrackerTiers::max_parallel tiers
+        void SetAnnounceToAllTiers(bool all_tiers);
+
+        // announce again now, such as the task is completed
+        void UpdateTrackerInfo();
+
+    private:
+        struct Connection
+        {
+            std::tr1::shared_ptr<BitTrackerConnection> http;
+            std::tr1::shared_ptr<BitUdpTrackerConnection> udp;
+        };
+
+        typedef std::map<std::string, Connection> Connections;
+
+        void OnTimer();
+        void OnAnnounced(const std::string& url, bool success, int interval);
+        void Process();
+
+        net::IoService& io_service_;
+        Timer process_timer_;
+        Connections connections_;
+        ScopePtr<BitTrackerTiers> tiers_;
+        bool processing_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_ANNOUNCE_LIST_H
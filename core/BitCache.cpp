@@ -6,10 +6,14 @@
 #include "BitData.h"
 #include "BitPiece.h"
 #include "BitPieceMap.h"
+#include "BitPeerData.h"
+#include "BitService.h"
 #include "BitDownloadingInfo.h"
+#include "BitMerkleTree.h"
 #include "bencode/MetainfoFile.h"
 #include "../sha1/NetSha1Value.h"
 #include <assert.h>
+#include <algorithm>
 #include <vector>
 
 namespace bitwave {
@@ -22,10 +26,19 @@ namespace core {
           info_hash_(bitdata->GetInfoHash()),
           metainfo_file_(bitdata->GetMetainfoFile()),
           downloading_info_(downloading_info),
-          file_(bitdata)
+          file_(bitdata),
+          piece_sha1_calc_(*BitService::hash_pool)
     {
         const std::size_t total_cache_memory = 50 * 1024 * 1024;
         max_cache_pieces_ = total_cache_memory / piece_length_;
+
+        // prefetch 8MB at most, and not more than half of the cache
+        const std::size_t prefetch_memory = 8 * 1024 * 1024;
+        max_prefetch_pieces_ = prefetch_memory / piece_length_;
+        if (max_prefetch_pieces_ > max_cache_pieces_ / 2)
+            max_prefetch_pieces_ = max_cache_pieces_ / 2;
+        if (max_prefetch_pieces_ == 0)
+            max_prefetch_pieces_ = 1;
     }
 
     void BitCache::Read(std::size_t piece_index,
@@ -39,15 +52,152 @@ namespace core {
             ReadBlock(piece_index, begin_of_piece, length, callback);
     }
 
-    void BitCache::Write(std::size_t piece_index,
+    bool BitCache::Write(std::size_t piece_index,
                          std::size_t begin_of_piece,
                          std::size_t length,
-                         const char *block)
+                         const char *block,
+                         const std::tr1::shared_ptr<BitPeerData>& sender)
     {
         if (piece_map_.IsPieceMark(piece_index))
+            return true;
+
+        return WriteBlock(piece_index, begin_of_piece, length, block, sender);
+    }
+
+    bool BitCache::NeedBlockHashes(std::size_t piece_index)
+    {
+        if (piece_map_.IsPieceMark(piece_index))
+            return false;
+
+        MerkleBlocks *blocks = GetMerkleBlocks(piece_index);
+        if (!blocks || !blocks->expected.empty() || blocks->unaligned)
+            return false;
+
+        // a request without reply is sent to another peer later
+        const NormalTimeType request_time_out = 10 * 1000;
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+        if (blocks->request_time != time_traits<NormalTimeType>::invalid() &&
+            now - blocks->request_time < request_time_out)
+            return false;
+
+        blocks->request_time = now;
+        return true;
+    }
+
+    bool BitCache::SetBlockHashes(std::size_t piece_index,
+                                  const std::vector<Sha256Value>& hashes,
+                                  std::vector<std::size_t>& corrupt_blocks)
+    {
+        MerklePieces::iterator merkle = merkle_pieces_.find(piece_index);
+        if (merkle == merkle_pieces_.end() || !merkle->second.expected.empty())
+            return true;
+
+        MerkleBlocks& blocks = merkle->second;
+        blocks.request_time = time_traits<NormalTimeType>::invalid();
+        if (hashes.size() != blocks.received.size() ||
+            BitMerkleTree::Root(&hashes[0], hashes.size(), hashes.size()) != blocks.hash)
+            return false;
+        blocks.expected = hashes;
+
+        // blocks from other peers before the hashes are verified now,
+        // they are requested again when they do not match, and their
+        // senders are blamed
+        CachePiece::iterator it = cache_piece_.find(piece_index);
+        for (std::size_t i = 0; i < hashes.size(); ++i)
+        {
+            if (!blocks.is_received[i] || blocks.received[i] == hashes[i])
+                continue;
+
+            blocks.is_received[i] = false;
+            std::tr1::shared_ptr<BitPeerData> sender = blocks.senders[i].lock();
+            if (sender)
+                sender->AddCorruptBlock();
+            blocks.senders[i].reset();
+            if (it != cache_piece_.end())
+                it->second->ClearBlock(i * BitMerkleTree::block_size,
+                        BitMerkleTree::block_size);
+            corrupt_blocks.push_back(i * BitMerkleTree::block_size);
+        }
+
+        return true;
+    }
+
+    void BitCache::BlockHashesFailed(std::size_t piece_index)
+    {
+        MerklePieces::iterator merkle = merkle_pieces_.find(piece_index);
+        if (merkle != merkle_pieces_.end())
+            merkle->second.request_time = time_traits<NormalTimeType>::invalid();
+    }
+
+    bool BitCache::GetPieceLeaves(std::size_t piece_index,
+                                  std::vector<Sha256Value>& leaves) const
+    {
+        PieceLeaves::const_iterator it = piece_leaves_.find(piece_index);
+        if (it == piece_leaves_.end())
+            return false;
+
+        leaves = it->second;
+        return true;
+    }
+
+    void BitCache::AddPieceLeaves(std::size_t piece_index,
+                                  const std::vector<Sha256Value>& leaves)
+    {
+        const std::size_t max_leaf_pieces = 64;
+        if (piece_leaves_.find(piece_index) != piece_leaves_.end())
+            return ;
+
+        if (leaf_pieces_.size() >= max_leaf_pieces)
+        {
+            piece_leaves_.erase(leaf_pieces_.front());
+            leaf_pieces_.pop_front();
+        }
+
+        piece_leaves_[piece_index] = leaves;
+        leaf_pieces_.push_back(piece_index);
+    }
+
+    void BitCache::Prefetch(std::size_t piece_index)
+    {
+        if (piece_index >= piece_map_.GetPieceCount() ||
+            !piece_map_.IsPieceMark(piece_index) ||
+            prefetch_pieces_.size() >= max_prefetch_pieces_ ||
+            reading_pieces_.find(piece_index) != reading_pieces_.end() ||
+            cache_piece_.find(piece_index) != cache_piece_.end())
             return ;
 
-        WriteBlock(piece_index, begin_of_piece, length, block);
+        prefetch_pieces_.insert(std::make_pair(piece_index,
+                    time_traits<NormalTimeType>::now()));
+        reading_pieces_.insert(piece_index);
+        file_.ReadPiece(piece_index, FetchNewPiece());
+    }
+
+    bool BitCache::ReadTimeNewer::operator () (
+            CachePiece::const_iterator left,
+            CachePiece::const_iterator right) const
+    {
+        return BitPiece::IsReadTimeOld(*right->second, *left->second);
+    }
+
+    void BitCache::GetHotPieces(const BitPieceMap& exclude,
+                                std::size_t max_count,
+                                std::vector<std::size_t>& pieces) const
+    {
+        std::vector<CachePiece::const_iterator> hot;
+        for (CachePiece::const_iterator it = cache_piece_.begin();
+                it != cache_piece_.end(); ++it)
+        {
+            if (it->second->GetState() == BitPiece::WRITED &&
+                piece_map_.IsPieceMark(it->first) &&
+                !exclude.IsPieceMark(it->first))
+                hot.push_back(it);
+        }
+
+        std::sort(hot.begin(), hot.end(), ReadTimeNewer());
+
+        pieces.clear();
+        for (std::size_t i = 0; i < hot.size() && i < max_count; ++i)
+            pieces.push_back(hot[i]->first);
     }
 
     void BitCache::ProcessCache()
@@ -55,6 +205,7 @@ namespace core {
         ProcessAsyncReadOps();
         ProcessAsyncCheckPiece();
         ProcessAsyncWritePiece();
+        ExpirePrefetchPieces();
         FreeCachePiece();
     }
 
@@ -71,6 +222,7 @@ namespace core {
             if (it != cache_piece_.end())
             {
                 PiecePtr result = it->second;
+                prefetch_pieces_.erase(it->first);
                 cache_piece_.erase(it);
                 result->Clear();
                 return result;
@@ -134,10 +286,10 @@ namespace core {
                                   std::size_t length,
                                   const ReadCallback& callback)
     {
-        AsyncReadOps::iterator it = async_read_ops_.find(piece_index);
-        if (it == async_read_ops_.end())
+        if (reading_pieces_.insert(piece_index).second)
             file_.ReadPiece(piece_index, FetchNewPiece());
 
+        AsyncReadOps::iterator it = async_read_ops_.find(piece_index);
         async_read_ops_.insert(it,
                 std::make_pair(piece_index,
                     AsyncReadData(callback, begin_of_piece, length)));
@@ -151,6 +303,10 @@ namespace core {
         const char *block = it->second->GetRawDataPtr() + begin_of_piece;
         callback(true, block);
         it->second->TouchRead();
+
+        // the prefetched piece is used
+        if (!prefetch_pieces_.empty())
+            prefetch_pieces_.erase(it->first);
     }
 
     void BitCache::ProcessAsyncReadOps()
@@ -161,6 +317,7 @@ namespace core {
         for (CachePiece::iterator it = read_pieces.begin();
                 it != read_pieces.end(); ++it)
         {
+            reading_pieces_.erase(it->first);
             it->second->SetState(BitPiece::WRITED);
             CompleteAsyncReadOps(it);
         }
@@ -182,10 +339,11 @@ namespace core {
         async_read_ops_.erase(it->first);
     }
 
-    void BitCache::WriteBlock(std::size_t piece_index,
+    bool BitCache::WriteBlock(std::size_t piece_index,
                               std::size_t begin_of_piece,
                               std::size_t length,
-                              const char *block)
+                              const char *block,
+                              const std::tr1::shared_ptr<BitPeerData>& sender)
     {
         CachePiece::iterator it = cache_piece_.find(piece_index);
         if (it == cache_piece_.end())
@@ -194,11 +352,121 @@ namespace core {
         // this piece is CHECKING_SHA1 CHECK_SHA1_OK or WRITED,
         // we do not change this piece's data
         if (it->second->GetState() != BitPiece::NOT_CHECKED)
-            return ;
+            return true;
+
+        MerkleBlocks *blocks = GetMerkleBlocks(piece_index);
+        if (blocks && !VerifyMerkleBlock(*blocks, begin_of_piece, length, block, sender))
+            return false;
 
         it->second->WriteBlock(begin_of_piece, length, block);
         if (it->second->IsComplete())
+        {
+            if (blocks)
+                CheckMerklePiece(it);
+            else
+                AsyncCheckPiece(it);
+        }
+        return true;
+    }
+
+    BitCache::MerkleBlocks * BitCache::GetMerkleBlocks(std::size_t piece_index)
+    {
+        MerklePieces::iterator it = merkle_pieces_.find(piece_index);
+        if (it != merkle_pieces_.end())
+            return &it->second;
+
+        bentypes::MetainfoFile::MerklePiece piece;
+        if (!metainfo_file_->HasMerkleTrees() ||
+            !metainfo_file_->GetMerklePiece(piece_index, &piece))
+            return 0;
+
+        MerkleBlocks& blocks = merkle_pieces_[piece_index];
+        blocks.hash = piece.hash;
+        blocks.data_length = piece.data_length;
+        blocks.received.resize(piece.leaf_count);
+        blocks.is_received.resize(piece.leaf_count);
+        blocks.senders.resize(piece.leaf_count);
+
+        // the hash of a piece of one block is the hash of the block
+        if (piece.leaf_count == 1)
+            blocks.expected.push_back(piece.hash);
+        return &blocks;
+    }
+
+    bool BitCache::VerifyMerkleBlock(MerkleBlocks& blocks,
+                                     std::size_t begin_of_piece,
+                                     std::size_t length,
+                                     const char *block,
+                                     const std::tr1::shared_ptr<BitPeerData>& sender)
+    {
+        const std::size_t block_size = BitMerkleTree::block_size;
+        std::size_t data_end = begin_of_piece + length;
+        if (data_end > blocks.data_length)
+            data_end = begin_of_piece < blocks.data_length ?
+                blocks.data_length : begin_of_piece;
+
+        // padding after the file is zeros in pieces of a hybrid torrent
+        for (std::size_t i = data_end - begin_of_piece; i < length; ++i)
+        {
+            if (block[i] != 0)
+                return false;
+        }
+
+        if (data_end == begin_of_piece)
+            return true;
+
+        // a block which is not a leaf is checked with the whole piece
+        if (begin_of_piece % block_size != 0 ||
+            (length != block_size && data_end != blocks.data_length))
+        {
+            blocks.unaligned = true;
+            return true;
+        }
+
+        std::size_t leaf = begin_of_piece / block_size;
+        Sha256Value hash = BitMerkleTree::HashBlock(block, data_end - begin_of_piece);
+        if (!blocks.expected.empty() && blocks.expected[leaf] != hash)
+            return false;
+
+        blocks.received[leaf] = hash;
+        blocks.is_received[leaf] = true;
+        if (blocks.expected.empty())
+            blocks.senders[leaf] = sender;
+        return true;
+    }
+
+    void BitCache::CheckMerklePiece(CachePiece::iterator it)
+    {
+        MerklePieces::iterator merkle = merkle_pieces_.find(it->first);
+        MerkleBlocks& blocks = merkle->second;
+        if (blocks.unaligned)
+        {
+            merkle_pieces_.erase(merkle);
             AsyncCheckPiece(it);
+            return ;
+        }
+
+        // leaves are hashed as blocks arrive, the piece is not hashed
+        // again, leaves after the file are zeros
+        std::size_t count = BitMerkleTree::BlockCount(blocks.data_length);
+        bool hash_ok = BitMerkleTree::Root(&blocks.received[0], count,
+                blocks.received.size()) == blocks.hash;
+
+        // the verified leaves are served to peers without hashing again
+        if (hash_ok)
+            AddPieceLeaves(it->first, blocks.received);
+        merkle_pieces_.erase(merkle);
+
+        if (hash_ok)
+        {
+            it->second->SetState(BitPiece::CHECK_SHA1_OK);
+            AsyncWritePiece(it);
+        }
+        else
+        {
+            it->second->Clear();
+            downloading_info_->DownloadingFailed(it->first);
+        }
     }
 
     void BitCache::AsyncCheckPiece(CachePiece::iterator it)
@@ -266,9 +534,36 @@ namespace core {
         {
             CachePiece::iterator it = GetOldestPiece();
             if (it != cache_piece_.end())
+            {
+                prefetch_pieces_.erase(it->first);
                 cache_piece_.erase(it);
+            }
             else
+            {
                 break;
+            }
+        }
+    }
+
+    void BitCache::ExpirePrefetchPieces()
+    {
+        // prefetched pieces are not read for a long time, the prefetch
+        // is wrong, free them for other prefetch
+        const NormalTimeType prefetch_expire_time = 30 * 1000;
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+
+        PrefetchPieces::iterator it = prefetch_pieces_.begin();
+        while (it != prefetch_pieces_.end())
+        {
+            if (now - it->second < prefetch_expire_time ||
+                reading_pieces_.find(it->first) != reading_pieces_.end())
+            {
+                ++it;
+                continue;
+            }
+
+            cache_piece_.erase(it->first);
+            prefetch_pieces_.erase(it++);
         }
     }
 
@@ -5,9 +5,14 @@
 #include "BitPieceSha1Calc.h"
 #include "../base/BaseTypes.h"
 #include "../sha1/Sha1Value.h"
+#include "../sha256/Sha256Value.h"
+#include "../timer/TimeTraits.h"
+#include <deque>
 #include <functional>
 #include <memory>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace bitwave {
 namespace core {
@@ -19,6 +24,7 @@ namespace core {
     class BitData;
     class BitPiece;
     class BitPieceMap;
+    class BitPeerData;
     class BitDownloadingInfo;
 
     class BitCache : private NotCopyable
@@ -37,15 +43,63 @@ namespace core {
             return info_hash_ == info_hash;
         }
 
+        std::size_t GetPieceLength() const
+        {
+            return piece_length_;
+        }
+
         void Read(std::size_t piece_index,
                   std::size_t begin_of_piece,
                   std::size_t length,
                   const ReadCallback& callback);
 
-        void Write(std::size_t piece_index,
+        // a block of a hybrid torrent is verified by its hash of the
+        // merkle tree as it arrives, return false when it does not match,
+        // then the block is dropped and the sender is blamed. A block
+        // before the hashes are known is kept with its sender, which is
+        // blamed when the hashes come later
+        bool Write(std::size_t piece_index,
                    std::size_t begin_of_piece,
                    std::size_t length,
-                   const char *block);
+                   const char *block,
+                   const std::tr1::shared_ptr<BitPeerData>& sender =
+                       std::tr1::shared_ptr<BitPeerData>());
+
+        // block hashes of a downloading piece of a hybrid torrent are
+        // requested from one peer at a time, return true when they are
+        // not known and not requesting, then the caller requests them
+        bool NeedBlockHashes(std::size_t piece_index);
+
+        // block hashes of the piece are received, return false when they
+        // do not match the piece layer. Blocks received before which do
+        // not match are dropped, their senders are blamed, and their
+        // begins are in corrupt_blocks
+        bool SetBlockHashes(std::size_t piece_index,
+                            const std::vector<Sha256Value>& hashes,
+                            std::vector<std::size_t>& corrupt_blocks);
+
+        // the peer rejects the block hashes request, another peer may
+        // be requested
+        void BlockHashesFailed(std::size_t piece_index);
+
+        // leaves of a downloaded piece of a hybrid torrent, they are kept
+        // when the piece is verified or hashed for a peer, return false
+        // when they are not kept. Leaves of the recent 64 pieces are kept
+        bool GetPieceLeaves(std::size_t piece_index,
+                            std::vector<Sha256Value>& leaves) const;
+        void AddPieceLeaves(std::size_t piece_index,
+                            const std::vector<Sha256Value>& leaves);
+
+        // read the downloaded piece into cache before it is requested,
+        // prefetched pieces which are not read yet are limited by a
+        // budget, and they are dropped if not read in 30 seconds
+        void Prefetch(std::size_t piece_index);
+
+        // downloaded pieces in cache which are not marked in exclude,
+        // the most recently read first, at most max_count pieces
+        void GetHotPieces(const BitPieceMap& exclude,
+                          std::size_t max_count,
+                          std::vector<std::size_t>& pieces) const;
 
         void ProcessCache();
 
@@ -68,9 +122,45 @@ namespace core {
             }
         };
 
+        // block hashes of a downloading piece of a hybrid torrent, the
+        // leaves of the piece in the merkle tree of its file
+        struct MerkleBlocks
+        {
+            MerkleBlocks()
+                : data_length(0),
+                  unaligned(false),
+                  request_time(time_traits<NormalTimeType>::invalid())
+            {
+            }
+
+            // hash of the piece in the tree, and bytes of the file in the
+            // piece, the rest is padding of zeros
+            Sha256Value hash;
+            std::size_t data_length;
+            std::vector<Sha256Value> received;
+            std::vector<bool> is_received;
+            std::vector<std::tr1::weak_ptr<BitPeerData> > senders;
+            // hashes of the tree, empty when they are not known
+            std::vector<Sha256Value> expected;
+            // a block is not a leaf, the piece is checked by sha1
+            bool unaligned;
+            NormalTimeType request_time;
+        };
+
         typedef std::tr1::shared_ptr<BitPiece> PiecePtr;
         typedef std::map<std::size_t, PiecePtr> CachePiece;
         typedef std::multimap<std::size_t, AsyncReadData> AsyncReadOps;
+        // prefetched piece index and its prefetch time
+        typedef std::map<std::size_t, NormalTimeType> PrefetchPieces;
+        typedef std::map<std::size_t, MerkleBlocks> MerklePieces;
+        typedef std::map<std::size_t, std::vector<Sha256Value> > PieceLeaves;
+
+        // the piece read recently is before
+        struct ReadTimeNewer
+        {
+            bool operator () (CachePiece::const_iterator left,
+                              CachePiece::const_iterator right) const;
+        };
 
         PiecePtr FetchNewPiece();
 
@@ -97,10 +187,21 @@ namespace core {
 
         void CompleteAsyncReadOps(CachePiece::iterator it);
 
-        void WriteBlock(std::size_t piece_index,
+        bool WriteBlock(std::size_t piece_index,
                         std::size_t begin_of_piece,
                         std::size_t length,
-                        const char *block);
+                        const char *block,
+                        const std::tr1::shared_ptr<BitPeerData>& sender);
+
+        MerkleBlocks * GetMerkleBlocks(std::size_t piece_index);
+
+        bool VerifyMerkleBlock(MerkleBlocks& blocks,
+                               std::size_t begin_of_piece,
+                               std::size_t length,
+                               const char *block,
+                               const std::tr1::shared_ptr<BitPeerData>& sender);
+
+        void CheckMerklePiece(CachePiece::iterator it);
 
         void AsyncCheckPiece(CachePiece::iterator it);
 
@@ -117,6 +218,8 @@ namespace core {
 
         void FreeCachePiece();
 
+        void ExpirePrefetchPieces();
+
         const std::size_t piece_length_;
         const BitPieceMap& piece_map_;
         const Sha1Value info_hash_;
@@ -127,7 +230,15 @@ namespace core {
 
         BitFile file_;
         AsyncReadOps async_read_ops_;
+        // pieces are reading from file
+        std::set<std::size_t> reading_pieces_;
+        PrefetchPieces prefetch_pieces_;
+        std::size_t max_prefetch_pieces_;
         BitPieceSha1Calc piece_sha1_calc_;
+        MerklePieces merkle_pieces_;
+        PieceLeaves piece_leaves_;
+        // pieces of piece_leaves_, the oldest first
+        std::deque<std::size_t> leaf_pieces_;
     };
 
 } // namespace core
@@ -0,0 +1,217 @@
+#include "BitChoker.h"
+#include "BitData.h"
+#include "../base/Random.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        // rechoke every 10 seconds, and the optimistic unchoke is
+        // rotated every 3 rounds
+        const int choke_interval = 10 * 1000;
+        const std::size_t optimistic_rounds = 3;
+        const int regular_upload_weight = 2;
+
+        typedef std::pair<double, BitChoker::ConnectionPtr> RatePeer;
+
+        struct FasterPeer
+        {
+            bool operator () (const RatePeer& left, const RatePeer& right) const
+            {
+                return left.first > right.first;
+            }
+        };
+
+    } // unnamed namespace
+
+    std::size_t BitChoker::upload_slots_ = 4;
+
+    BitChoker::BitChoker(const std::tr1::shared_ptr<BitData>& bitdata,
+                         net::IoService& io_service)
+        : io_service_(io_service),
+          bitdata_(bitdata),
+          rounds_(0)
+    {
+        choke_timer_.SetCallback(std::tr1::bind(&BitChoker::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&choke_timer_);
+        choke_timer_.SetDeadline(choke_interval);
+    }
+
+    BitChoker::~BitChoker()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&choke_timer_);
+    }
+
+    // static
+    void BitChoker::SetUploadSlots(std::size_t slots)
+    {
+        assert(slots > 0);
+        upload_slots_ = slots;
+    }
+
+    // static
+    std::size_t BitChoker::GetUploadSlots()
+    {
+        return upload_slots_;
+    }
+
+    void BitChoker::AddPeer(const ConnectionPtr& peer)
+    {
+        // new peer is inserted at random position of the rotation, so
+        // it may be optimistic unchoked soon
+        std::size_t pos = RandomValue<unsigned int>() % (peers_.size() + 1);
+        peers_.insert(peers_.begin() + pos, ConnectionWeakPtr(peer));
+    }
+
+    void BitChoker::RemovePeer(const ConnectionPtr& peer)
+    {
+        for (Peers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            if (it->lock() == peer)
+            {
+                peers_.erase(it);
+                break;
+            }
+        }
+    }
+
+    void BitChoker::PeerInterested(const ConnectionPtr& peer)
+    {
+        if (peer->IsChoking() && CountUnchoked() < upload_slots_)
+            peer->SetChoke(false);
+    }
+
+    void BitChoker::OnTimer()
+    {
+        Rechoke();
+        choke_timer_.SetDeadline(choke_interval);
+    }
+
+    void BitChoker::Rechoke()
+    {
+        Connections connections;
+        Peers::iterator peer_it = peers_.begin();
+        while (peer_it != peers_.end())
+        {
+            ConnectionPtr peer = peer_it->lock();
+            if (peer)
+            {
+                connections.push_back(peer);
+                ++peer_it;
+            }
+            else
+            {
+                peer_it = peers_.erase(peer_it);
+            }
+        }
+
+        Connections regular;
+        SelectRegular(connections, regular);
+
+        if (rounds_++ % optimistic_rounds == 0 || !IsOptimisticValid(regular))
+            RotateOptimistic(regular);
+
+        // regular peers upload twice as much as the optimistic one
+        ConnectionPtr optimistic = optimistic_.lock();
+        for (Connections::iterator it = connections.begin();
+                it != connections.end(); ++it)
+        {
+            bool is_regular =
+                std::find(regular.begin(), regular.end(), *it) != regular.end();
+            bool unchoke = is_regular || *it == optimistic;
+            if ((*it)->IsChoking() == unchoke)
+                (*it)->SetChoke(!unchoke);
+            (*it)->SetUploadWeight(is_regular ? regular_upload_weight : 1);
+        }
+    }
+
+    void BitChoker::SelectRegular(const Connections& connections,
+                                  Connections& regular)
+    {
+        // leecher reciprocates the peers upload to us fastest, and
+        // seeder uploads to the peers which download fastest
+        bool seeding = bitdata_->IsDownloadComplete();
+
+        std::vector<RatePeer> candidates;
+        for (Connections::const_iterator it = connections.begin();
+                it != connections.end(); ++it)
+        {
+            const ConnectionPtr& peer = *it;
+            if (!peer->IsPeerInterested() || (!seeding && peer->IsSnubbed()))
+                continue;
+
+            double rate = seeding ? peer->GetUploadRate() :
+                peer->GetDownloadRate();
+            candidates.push_back(RatePeer(rate, peer));
+        }
+
+        std::stable_sort(candidates.begin(), candidates.end(), FasterPeer());
+
+        std::size_t count = std::min(upload_slots_ - 1, candidates.size());
+        for (std::size_t i = 0; i < count; ++i)
+            regular.push_back(candidates[i].second);
+    }
+
+    void BitChoker::RotateOptimistic(const Connections& regular)
+    {
+        ConnectionPtr current = optimistic_.lock();
+        optimistic_.reset();
+        if (peers_.empty())
+            return ;
+
+        std::size_t start = 0;
+        for (std::size_t i = 0; current && i < peers_.size(); ++i)
+        {
+            if (peers_[i].lock() == current)
+            {
+                start = i + 1;
+                break;
+            }
+        }
+
+        // the next interested peer in rotation order which is not
+        // unchoked as regular
+        for (std::size_t i = 0; i < peers_.size(); ++i)
+        {
+            ConnectionPtr peer = peers_[(start + i) % peers_.size()].lock();
+            if (peer && peer->IsPeerInterested() &&
+                std::find(regular.begin(), regular.end(), peer) == regular.end())
+            {
+                optimistic_ = peer;
+                return ;
+            }
+        }
+    }
+
+    bool BitChoker::IsOptimisticValid(const Connections& regular) const
+    {
+        ConnectionPtr optimistic = optimistic_.lock();
+        return optimistic && optimistic->IsPeerInterested() &&
+            std::find(regular.begin(), regular.end(), optimistic) == regular.end();
+    }
+
+    std::size_t BitChoker::CountUnchoked() const
+    {
+        std::size_t count = 0;
+        for (Peers::const_iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            ConnectionPtr peer = it->lock();
+            if (peer && !peer->IsChoking())
+                ++count;
+        }
+        return count;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,88 @@
+#ifndef BIT_CHOKER_H
+#define BIT_CHOKER_H
+
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../timer/Timer.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+
+    // a peer of the choker, BitPeerConnection is one
+    class BitChokePeer
+    {
+    public:
+        virtual bool IsPeerInterested() const = 0;
+        // we are waiting piece data, but the peer sends nothing
+        virtual bool IsSnubbed() const = 0;
+        virtual bool IsChoking() const = 0;
+        virtual void SetChoke(bool choke) = 0;
+        // weight of the peer in upload round robin
+        virtual void SetUploadWeight(int weight) = 0;
+        // bytes per second of piece data from the peer and to the peer
+        virtual double GetDownloadRate() = 0;
+        virtual double GetUploadRate() = 0;
+        virtual ~BitChokePeer() { }
+    };
+
+    // tit-for-tat choker of a task. Every 10 seconds the interested peers
+    // which upload to us fastest (or we upload to fastest when seeding)
+    // get the regular upload slots, snubbed peers get no regular slot,
+    // and one more slot is an optimistic unchoke rotated every 30 seconds
+    class BitChoker : private NotCopyable
+    {
+    public:
+        typedef std::tr1::shared_ptr<BitChokePeer> ConnectionPtr;
+        typedef std::tr1::weak_ptr<BitChokePeer> ConnectionWeakPtr;
+
+        BitChoker(const std::tr1::shared_ptr<BitData>& bitdata,
+                  net::IoService& io_service);
+
+        ~BitChoker();
+
+        // upload slots of every task, including the optimistic one
+        static void SetUploadSlots(std::size_t slots);
+        static std::size_t GetUploadSlots();
+
+        // peer of handshake ok is added, and removed when it is dropped
+        void AddPeer(const ConnectionPtr& peer);
+        void RemovePeer(const ConnectionPtr& peer);
+
+        // the choked peer becomes interested, it is unchoked at once when
+        // there is a free upload slot
+        void PeerInterested(const ConnectionPtr& peer);
+
+        // rechoke at once, the timer rechokes every 10 seconds
+        void Rechoke();
+
+    private:
+        typedef std::vector<ConnectionWeakPtr> Peers;
+        typedef std::vector<ConnectionPtr> Connections;
+
+        void OnTimer();
+        void SelectRegular(const Connections& connections,
+                           Connections& regular);
+        void RotateOptimistic(const Connections& regular);
+        bool IsOptimisticValid(const Connections& regular) const;
+        std::size_t CountUnchoked() const;
+
+        static std::size_t upload_slots_;
+
+        net::IoService& io_service_;
+        Timer choke_timer_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+        // peers in optimistic unchoke rotation order
+        Peers peers_;
+        ConnectionWeakPtr optimistic_;
+        std::size_t rounds_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_CHOKER_H
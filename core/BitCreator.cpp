@@ -2,12 +2,49 @@
 #include "BitController.h"
 #include "BitData.h"
 #include "BitTask.h"
+#include "BitMagnet.h"
+#include "BitMetadataFetcher.h"
 #include "BitRepository.h"
 #include "BitService.h"
+#include "BitException.h"
+#include "../base/StringConv.h"
+#include "../sha1/NetSha1Value.h"
+#include <fstream>
+#include <sstream>
 
 namespace bitwave {
 namespace core{
 
+    namespace {
+
+        // hex string of info hash, it is the torrent file name of a
+        // magnet link task
+        std::string InfoHashHex(const Sha1Value& info_hash)
+        {
+            const char hex[] = "0123456789abcdef";
+            Sha1Value net_sha1 = NetByteOrder(info_hash);
+            const unsigned char *data =
+                reinterpret_cast<const unsigned char *>(net_sha1.GetData());
+
+            std::string result;
+            for (int i = 0; i < net_sha1.GetDataSize(); ++i)
+            {
+                result.push_back(hex[data[i] >> 4]);
+                result.push_back(hex[data[i] & 0x0F]);
+            }
+            return result;
+        }
+
+        std::string RemoveTailSlash(const std::string& path)
+        {
+            std::string result = path;
+            if (!result.empty() && result.back() == '\\')
+                result.pop_back();
+            return result;
+        }
+
+    } // unnamed namespace
+
     BitNewTaskCreator::BitNewTaskCreator(BitController& controller,
                                          net::IoService& io_service)
         : controller_(controller),
@@ -16,19 +53,102 @@ namespace core{
     }
 
     void BitNewTaskCreator::CreateTask(const std::string& torrent_file,
-                                       const std::string& download_path)
+                                       const std::string& download_path,
+                                       bool recheck)
     {
         BitRepository::BitDataPtr bitdata =
             BitService::repository->CreateBitData(torrent_file);
         bitdata->SelectAllFile(true);
 
-        std::string path = download_path;
-        if (path.back() == '\\')
-            path.pop_back();
-        bitdata->SetBasePath(path);
+        bitdata->SetBasePath(RemoveTailSlash(download_path));
 
         BitTask *task = new BitTask(bitdata, io_service_);
         controller_.AddTask(std::tr1::shared_ptr<BitTask>(task));
+
+        if (recheck)
+            task->Recheck();
+    }
+
+    bool BitNewTaskCreator::CreateMagnetTask(const std::string& magnet_link,
+                                             const std::string& download_path)
+    {
+        MagnetLink magnet;
+        if (!ParseMagnetLink(magnet_link, &magnet))
+            return false;
+
+        MagnetTask magnet_task;
+        magnet_task.fetcher.reset(new BitMetadataFetcher(magnet, io_service_));
+        magnet_task.download_path = RemoveTailSlash(download_path);
+        magnet_tasks_.push_back(magnet_task);
+        return true;
+    }
+
+    void BitNewTaskCreator::ProcessMagnetTasks()
+    {
+        MagnetTasks::iterator it = magnet_tasks_.begin();
+        while (it != magnet_tasks_.end())
+        {
+            if (!it->fetcher->IsComplete())
+            {
+                ++it;
+                continue;
+            }
+
+            const MagnetLink& magnet = it->fetcher->GetMagnetLink();
+            if (!controller_.GetTask(magnet.info_hash))
+            {
+                // the task fails when its torrent file can not be saved
+                // or its metadata is invalid, it is removed as well
+                try
+                {
+                    std::string torrent_file = SaveTorrentFile(*it);
+                    CreateTask(torrent_file, it->download_path);
+                }
+                catch (const CreateFileException&)
+                {
+                }
+                catch (const MetainfoFileExeception&)
+                {
+                }
+                catch (const BenTypeException&)
+                {
+                }
+            }
+
+            it = magnet_tasks_.erase(it);
+        }
+    }
+
+    std::string BitNewTaskCreator::SaveTorrentFile(const MagnetTask& magnet_task) const
+    {
+        const MagnetLink& magnet = magnet_task.fetcher->GetMagnetLink();
+
+        // d8:announce<url>13:announce-listll<url>el<url>...ee4:info<metadata>e,
+        // every tracker of the magnet link is a tier
+        std::ostringstream oss;
+        oss << 'd';
+        if (!magnet.trackers.empty())
+        {
+            const std::string& first = magnet.trackers.front();
+            oss << "8:announce" << first.size() << ':' << first;
+            oss << "13:announce-listl";
+            for (std::vector<std::string>::const_iterator tr = magnet.trackers.begin();
+                    tr != magnet.trackers.end(); ++tr)
+                oss << 'l' << tr->size() << ':' << *tr << 'e';
+            oss << 'e';
+        }
+        oss << "4:info" << magnet_task.fetcher->GetMetadata() << 'e';
+
+        std::string torrent_file = magnet_task.download_path + "\\" +
+            InfoHashHex(magnet.info_hash) + ".torrent";
+        std::wstring path = UTF8ToUnicode(torrent_file);
+        std::ofstream fs(path.c_str(), std::ios_base::out | std::ios_base::binary);
+        if (!fs.is_open())
+            throw CreateFileException(PATH_ERROR, torrent_file);
+
+        std::string content = oss.str();
+        fs.write(content.data(), content.size());
+        return torrent_file;
     }
 
 } // namespace core
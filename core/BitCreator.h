@@ -3,12 +3,15 @@
 
 #include "../base/BaseTypes.h"
 #include "../net/IoService.h"
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace bitwave {
 namespace core {
 
     class BitController;
+    class BitMetadataFetcher;
 
     // this class to create a task and add created task to BitController
     class BitNewTaskCreator : private NotCopyable
@@ -18,13 +21,35 @@ namespace core {
         BitNewTaskCreator(BitController& controller,
                           net::IoService& io_service);
 
-        // create a new task from a torrent_file
+        // create a new task from a torrent_file, if recheck is true,
+        // the data already in download_path will be rechecked
         void CreateTask(const std::string& torrent_file,
-                        const std::string& download_path);
+                        const std::string& download_path,
+                        bool recheck = false);
+
+        // create a new task from a magnet link, the task is created after
+        // its metadata is downloaded from peers, and the torrent file is
+        // saved in download_path. Return false if the link is invalid
+        bool CreateMagnetTask(const std::string& magnet_link,
+                              const std::string& download_path);
+
+        // create tasks of magnet links which metadata is downloaded
+        void ProcessMagnetTasks();
 
     private:
+        struct MagnetTask
+        {
+            std::tr1::shared_ptr<BitMetadataFetcher> fetcher;
+            std::string download_path;
+        };
+
+        typedef std::vector<MagnetTask> MagnetTasks;
+
+        std::string SaveTorrentFile(const MagnetTask& magnet_task) const;
+
         BitController& controller_;
         net::IoService& io_service_;
+        MagnetTasks magnet_tasks_;
     };
 
 } // namespace core
@@ -13,13 +13,16 @@ namespace core {
           uploaded_(0),
           downloaded_(0),
           total_size_(0),
-          current_download_(0)
+          current_download_(0),
+          wasted_(0)
     {
         metainfo_file_.Reset(new bentypes::MetainfoFile(torrent_file_.c_str()));
         piece_length_ = metainfo_file_->PieceLength();
         piece_count_ = metainfo_file_->PiecesCount();
 
         downloaded_map_.Reset(new BitPieceMap(piece_count_));
+        availability_.reset(new BitPieceAvailability(piece_count_));
+        piece_priorities_.resize(piece_count_, PRIORITY_COUNT);
 
         std::pair<const char *, const char *> info_data = metainfo_file_->GetRawInfoValue();
         info_hash_ = Sha1Value(info_data.first, info_data.second);
@@ -94,6 +97,16 @@ namespace core {
         current_download_ += inc;
     }
 
+    long long BitData::GetWasted() const
+    {
+        return wasted_;
+    }
+
+    void BitData::IncreaseWasted(long long inc)
+    {
+        wasted_ += inc;
+    }
+
     bool BitData::IsDownloadComplete() const
     {
         return downloaded_ >= total_size_;
@@ -104,6 +117,11 @@ namespace core {
         return *downloaded_map_;
     }
 
+    BitPieceAvailability& BitData::GetPieceAvailability() const
+    {
+        return *availability_;
+    }
+
     const BitData::DownloadFiles& BitData::GetFilesInfo() const
     {
         return download_files_;
@@ -120,21 +138,42 @@ namespace core {
     }
 
     void BitData::SelectFile(std::size_t file_index, bool download)
+    {
+        SetFilePriority(file_index,
+                download ? PRIORITY_NORMAL : PRIORITY_SKIP);
+    }
+
+    void BitData::SelectAllFile(bool download)
+    {
+        DownloadFiles::iterator it = download_files_.begin();
+        DownloadFiles::iterator end = download_files_.end();
+        for (; it != end; ++it)
+            DoSetFilePriority(it, download ? PRIORITY_NORMAL : PRIORITY_SKIP);
+    }
+
+    void BitData::SetFilePriority(std::size_t file_index, BitPriority priority)
     {
         if (file_index < download_files_.size())
         {
             DownloadFiles::iterator it = download_files_.begin();
             std::advance(it, file_index);
-            DoSelectFile(it, download);
+            DoSetFilePriority(it, priority);
         }
     }
 
-    void BitData::SelectAllFile(bool download)
+    void BitData::SetPiecePriority(std::size_t begin, std::size_t end,
+                                   BitPriority priority)
     {
-        DownloadFiles::iterator it = download_files_.begin();
-        DownloadFiles::iterator end = download_files_.end();
-        for (; it != end; ++it)
-            DoSelectFile(it, download);
+        if (end > piece_count_)
+            end = piece_count_;
+        if (begin < end)
+            std::fill(piece_priorities_.begin() + begin,
+                      piece_priorities_.begin() + end, priority);
+    }
+
+    const BitData::PiecePriorities& BitData::GetPiecePriorities() const
+    {
+        return piece_priorities_;
     }
 
     void BitData::AddPeerListenInfo(unsigned long ip, unsigned short port)
@@ -186,7 +225,8 @@ namespace core {
 
     void BitData::DelPeerData(const std::tr1::shared_ptr<BitPeerData>& peer_data)
     {
-        peer_data_set_.erase(peer_data);
+        if (peer_data_set_.erase(peer_data))
+            peer_data->LeaveAvailability();
     }
 
     BitData::PeerDataSet& BitData::GetPeerDataSet()
@@ -196,29 +236,21 @@ namespace core {
 
     void BitData::PrepareDownloadFiles()
     {
-        typedef std::vector<bentypes::MetainfoFile::FileInfo> FilesInfo;
-
-        FilesInfo files_info;
-        metainfo_file_->GetFiles(&files_info);
-
-        for (FilesInfo::iterator it = files_info.begin();
-                it != files_info.end(); ++it)
+        std::size_t count = metainfo_file_->GetFileCount();
+        download_files_.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
         {
-            DownloadFileInfo file(false, it->length);
-            std::vector<std::string>::iterator i = it->path.begin();
-            std::vector<std::string>::iterator end = it->path.end();
-            for (; i != end; ++i)
-            {
-                file.file_path.append("\\");
-                file.file_path.append(*i);
-            }
-
+            DownloadFileInfo file(false, metainfo_file_->GetFileLength(i));
+            file.file_path = "\\" + metainfo_file_->GetFilePath(i, '\\');
             download_files_.push_back(file);
         }
     }
 
-    void BitData::DoSelectFile(DownloadFiles::iterator it, bool download)
+    void BitData::DoSetFilePriority(DownloadFiles::iterator it,
+                                    BitPriority priority)
     {
+        bool download = priority != PRIORITY_SKIP;
+        it->priority = priority;
         if (it->is_download != download)
         {
             it->is_download = download;
@@ -3,6 +3,8 @@
 
 #include "BitPieceMap.h"
 #include "BitPeerData.h"
+#include "BitPieceAvailability.h"
+#include "BitPriority.h"
 #include "bencode/MetainfoFile.h"
 #include "../base/BaseTypes.h"
 #include "../base/ScopePtr.h"
@@ -42,11 +44,13 @@ namespace core {
         {
             DownloadFileInfo(bool download, long long len)
                 : is_download(download),
+                  priority(download ? PRIORITY_NORMAL : PRIORITY_SKIP),
                   length(len)
             {
             }
 
             bool is_download;       // file is download or not
+            BitPriority priority;   // not PRIORITY_SKIP when is_download
             long long length;       // file total length in bytes
             std::string file_path;  // file relative path
         };
@@ -54,6 +58,9 @@ namespace core {
         typedef std::set<PeerListenInfo> ListenInfoSet;
         typedef std::set<std::tr1::shared_ptr<BitPeerData>> PeerDataSet;
         typedef std::vector<DownloadFileInfo> DownloadFiles;
+        // priority of every piece, PRIORITY_COUNT when the piece follows
+        // the priority of its files
+        typedef std::vector<BitPriority> PiecePriorities;
 
         // construct a new BitTask's BitData
         explicit BitData(const std::string& torrent_file);
@@ -94,12 +101,23 @@ namespace core {
 
         void IncreaseCurrentDownload(long long inc);
 
+        // get downloaded bytes which are discarded, such as blocks
+        // received from more than one peer
+        long long GetWasted() const;
+
+        void IncreaseWasted(long long inc);
+
         // download is complete or not
         bool IsDownloadComplete() const;
 
         // get downloaded piece map
         BitPieceMap& GetPieceMap() const;
 
+        // get availability of pieces in connected peers
+        BitPieceAvailability& GetPieceAvailability() const;
+        const BitPeerData::AvailabilityPtr& GetPieceAvailabilityPtr() const
+            { return availability_; }
+
         // get files info
         const DownloadFiles& GetFilesInfo() const;
 
@@ -115,6 +133,19 @@ namespace core {
         // select all files download or not
         void SelectAllFile(bool download);
 
+        // set file download priority, PRIORITY_SKIP unselect the file,
+        // others select the file
+        void SetFilePriority(std::size_t file_index, BitPriority priority);
+
+        // set priority of pieces [begin, end), it overrides priorities
+        // of files and pieces set before. The task size still counts
+        // by selected files, so skip pieces of a selected file will
+        // leave the file incomplete
+        void SetPiecePriority(std::size_t begin, std::size_t end,
+                              BitPriority priority);
+
+        const PiecePriorities& GetPiecePriorities() const;
+
         // manage PeerListenInfo
         void AddPeerListenInfo(unsigned long ip, unsigned short port);
         ListenInfoSet& GetUnusedListenInfo();
@@ -131,7 +162,7 @@ namespace core {
 
     private:
         void PrepareDownloadFiles();
-        void DoSelectFile(DownloadFiles::iterator it, bool download);
+        void DoSetFilePriority(DownloadFiles::iterator it, BitPriority priority);
 
         typedef ScopePtr<bentypes::MetainfoFile> MetaInfoPtr;
         typedef ScopePtr<BitPieceMap> PieceMapPtr;
@@ -146,13 +177,16 @@ namespace core {
         long long downloaded_;
         long long total_size_;
         long long current_download_;
+        long long wasted_;
 
         MetaInfoPtr metainfo_file_;
         PieceMapPtr downloaded_map_;
+        BitPeerData::AvailabilityPtr availability_;
         ListenInfoSet unused_peers_;
         ListenInfoSet used_peers_;
         PeerDataSet peer_data_set_;
         DownloadFiles download_files_;
+        PiecePriorities piece_priorities_;
         std::string base_path_;
     };
 
@@ -0,0 +1,150 @@
+#include "BitDht.h"
+#include "BitService.h"
+#include "BitRepository.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <stdio.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    BitDht::BitDht(net::IoService& io_service, BitUdpSocket *udp_socket,
+                   const dht::NodeId& id)
+        : io_service_(io_service),
+          udp_socket_(udp_socket),
+          node_(id, this)
+    {
+        assert(udp_socket_);
+        udp_socket_->AddReceiver(this);
+
+        process_timer_.SetCallback(std::tr1::bind(&BitDht::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&process_timer_);
+        process_timer_.SetDeadline(process_interval);
+    }
+
+    BitDht::~BitDht()
+    {
+        udp_socket_->RemoveReceiver(this);
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&process_timer_);
+    }
+
+    void BitDht::AddBootstrapHost(const std::string& host, unsigned short port)
+    {
+        net::ServicePtr<net::ResolveService> resolver(io_service_);
+        assert(resolver);
+        net::ResolveHint hint(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+        char servname[8] = { 0 };
+        sprintf(servname, "%u", port);
+        resolver->AsyncResolve(host, servname, hint,
+                std::tr1::bind(&BitDht::ResolveHandler, this,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2,
+                    std::tr1::placeholders::_3));
+    }
+
+    void BitDht::AddBootstrapNode(unsigned long ip, unsigned short port)
+    {
+        node_.AddBootstrapNode(ip, port);
+    }
+
+    void BitDht::Bootstrap()
+    {
+        node_.Bootstrap();
+    }
+
+    void BitDht::GetPeers(const Sha1Value& info_hash, unsigned short announce_port,
+                          const PeerCallback& peer_callback,
+                          const DoneCallback& done_callback)
+    {
+        node_.GetPeers(dht::NodeId(info_hash), announce_port,
+                peer_callback, done_callback);
+    }
+
+    bool BitDht::OnDatagram(const char *data, std::size_t len,
+                            unsigned long ip, unsigned short port)
+    {
+        if (len == 0 || data[0] != 'd')
+            return false;
+
+        node_.OnPacket(data, len, ip, port);
+        return true;
+    }
+
+    void BitDht::SendPacket(const std::string& packet,
+                            unsigned long ip, unsigned short port)
+    {
+        udp_socket_->SendTo(packet.data(), packet.size(), ip, port);
+    }
+
+    NormalTimeType BitDht::Now() const
+    {
+        return time_traits<NormalTimeType>::now();
+    }
+
+    void BitDht::OnTimer()
+    {
+        node_.Process();
+        process_timer_.SetDeadline(process_interval);
+    }
+
+    void BitDht::ResolveHandler(const std::string& nodename,
+                                const std::string& servname,
+                                const net::ResolveResult& result)
+    {
+        for (net::ResolveResult::iterator it = result.begin();
+             it != result.end(); ++it)
+        {
+            if (!it->ai_addr)
+                continue;
+
+            const sockaddr_in *addr = reinterpret_cast<const sockaddr_in *>(it->ai_addr);
+            node_.AddBootstrapNode(net::NetToHostl(addr->sin_addr.s_addr),
+                    net::NetToHosts(addr->sin_port));
+        }
+
+        if (node_.GetNodeCount() == 0 && node_.GetLookupCount() == 0)
+            node_.Bootstrap();
+    }
+
+    BitDhtAnnouncer::BitDhtAnnouncer(const std::tr1::shared_ptr<BitData>& bitdata,
+                                     net::IoService& io_service)
+        : io_service_(io_service),
+          bitdata_(bitdata)
+    {
+        announce_timer_.SetCallback(std::tr1::bind(&BitDhtAnnouncer::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&announce_timer_);
+        announce_timer_.SetDeadline(first_announce_delay);
+    }
+
+    BitDhtAnnouncer::~BitDhtAnnouncer()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&announce_timer_);
+    }
+
+    void BitDhtAnnouncer::OnTimer()
+    {
+        announce_timer_.SetDeadline(announce_interval);
+        if (!BitService::dht)
+            return ;
+
+        // the lookup may outlive us, peers are added to the bitdata
+        unsigned short listen_port = BitService::repository->GetListenPort();
+        BitService::dht->GetPeers(bitdata_->GetInfoHash(), listen_port,
+                std::tr1::bind(&BitData::AddPeerListenInfo, bitdata_,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+
+} // namespace core
+} // namespace bitwave
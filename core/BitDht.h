@@ -0,0 +1,99 @@
+#ifndef BIT_DHT_H
+#define BIT_DHT_H
+
+#include "BitData.h"
+#include "BitUdpSocket.h"
+#include "dht/DhtNode.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../net/ResolveService.h"
+#include "../sha1/Sha1Value.h"
+#include "../timer/Timer.h"
+#include <memory>
+#include <string>
+
+namespace bitwave {
+namespace core {
+
+    // the mainline dht node of us on the shared udp socket. Datagrams of
+    // dht are bencoded dictionaries, so they start with 'd', and other
+    // datagrams are left to other receivers
+    class BitDht : public BitUdpSocket::Receiver,
+                   public dht::DhtNetwork,
+                   private NotCopyable
+    {
+    public:
+        typedef dht::DhtNode::PeerCallback PeerCallback;
+        typedef dht::DhtNode::DoneCallback DoneCallback;
+
+        static const int process_interval = 1000;
+
+        BitDht(net::IoService& io_service, BitUdpSocket *udp_socket,
+               const dht::NodeId& id = dht::NodeId::Random());
+
+        ~BitDht();
+
+        // resolve host and add it as a bootstrap node, the node is
+        // bootstrapped when the host is resolved
+        void AddBootstrapHost(const std::string& host, unsigned short port);
+
+        // ip and port are in host byte order
+        void AddBootstrapNode(unsigned long ip, unsigned short port);
+
+        void Bootstrap();
+
+        // find peers of info hash, and announce us on announce_port when
+        // it is not 0
+        void GetPeers(const Sha1Value& info_hash, unsigned short announce_port,
+                      const PeerCallback& peer_callback,
+                      const DoneCallback& done_callback = DoneCallback());
+
+        std::size_t GetNodeCount() const
+            { return node_.GetNodeCount(); }
+
+        const dht::NodeId& GetId() const
+            { return node_.GetId(); }
+
+        virtual bool OnDatagram(const char *data, std::size_t len,
+                                unsigned long ip, unsigned short port);
+
+        virtual void SendPacket(const std::string& packet,
+                                unsigned long ip, unsigned short port);
+        virtual NormalTimeType Now() const;
+
+    private:
+        void OnTimer();
+        void ResolveHandler(const std::string& nodename,
+                            const std::string& servname,
+                            const net::ResolveResult& result);
+
+        net::IoService& io_service_;
+        BitUdpSocket *udp_socket_;
+        Timer process_timer_;
+        dht::DhtNode node_;
+    };
+
+    // get peers of a task from dht every 15 minutes, and announce us
+    class BitDhtAnnouncer : private NotCopyable
+    {
+    public:
+        static const int first_announce_delay = 5 * 1000;
+        static const int announce_interval = 15 * 60 * 1000;
+
+        BitDhtAnnouncer(const std::tr1::shared_ptr<BitData>& bitdata,
+                        net::IoService& io_service);
+
+        ~BitDhtAnnouncer();
+
+    private:
+        void OnTimer();
+
+        net::IoService& io_service_;
+        Timer announce_timer_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_DHT_H
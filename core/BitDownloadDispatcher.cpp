@@ -3,6 +3,7 @@
 #include "BitPeerData.h"
 #include <assert.h>
 #include <math.h>
+#include <vector>
 
 namespace bitwave {
 namespace core {
@@ -10,74 +11,29 @@ namespace core {
     // 16KB size of one request
     const int request_block_size = 16 * 1024;
 
-    class LinearPieceIndexSearcher :
-        public BitDownloadDispatcher::PieceIndexSearcher
-    {
-    public:
-        explicit LinearPieceIndexSearcher(std::size_t pieces_count)
-            : result_piece_map_(pieces_count),
-              empty_piece_map_(pieces_count)
-        {
-        }
-
-        virtual bool Search(const BitPieceMap& downloaded,
-                            const BitPieceMap& downloading,
-                            const BitPieceMap& need_download,
-                            const BitPieceMap& candidate,
-                            std::size_t *piece_index)
-        {
-            std::size_t size = downloaded.GetMapSize();
-            std::size_t begin = 0;
-            std::size_t end = size;
-            while (begin < end)
-            {
-                std::size_t middle = (begin + end) / 2;
-                middle = middle == begin ? begin + 1 : middle;
-
-                BitPieceMap::Union(downloaded, downloading,
-                        begin, middle, result_piece_map_);
-                BitPieceMap::Difference(need_download, result_piece_map_,
-                        begin, middle, result_piece_map_);
-                BitPieceMap::Intersection(result_piece_map_, candidate,
-                        begin, middle, result_piece_map_);
-                bool is_empty = BitPieceMap::IsEqual(
-                        result_piece_map_, empty_piece_map_, begin, middle);
-
-                if (is_empty)
-                    begin = middle;
-                else
-                    end = end == middle ? middle - 1 : middle;
-            }
-
-            assert(begin == end);
-            if (begin != size)
-                return SearchPieceIndex(begin, piece_index);
-            return false;
-        }
-
-    private:
-        bool SearchPieceIndex(std::size_t index, std::size_t *piece_index)
-        {
-            assert(piece_index);
-            std::size_t begin_piece_index = index * 8;
-            std::size_t end_piece_index = begin_piece_index + 8;
-
-            while (begin_piece_index < end_piece_index &&
-                   !result_piece_map_.IsPieceMark(begin_piece_index))
-                ++begin_piece_index;
-
-            if (begin_piece_index != end_piece_index)
-            {
-                *piece_index = begin_piece_index;
-                return true;
-            }
-
-            return false;
-        }
-
-        BitPieceMap result_piece_map_;
-        BitPieceMap empty_piece_map_;
-    };
+    // streaming deadline window is the next 20 seconds of play, and at
+    // least 4 pieces
+    const long long streaming_window_seconds = 20;
+    const std::size_t streaming_window_min_pieces = 4;
+    // blocks of streaming pieces dispatched to one peer each time, so
+    // a streaming piece is downloaded from several peers in parallel
+    const std::size_t streaming_blocks_per_peer = 4;
+    // a peer is fast when its download rate is not less than half of
+    // the fastest peer
+    const double fast_peer_ratio = 0.5;
+    // a requested block is late when its piece is due in 5 seconds and
+    // the block is not received in 2 seconds, then it is requested from
+    // another fast peer
+    const long long urgent_deadline = 5000;
+    // deadline of a piece after the play position when the bitrate is
+    // unknown, it is never urgent
+    const long long no_deadline = 0x7FFFFFFFFFFFFFFFLL;
+    const NormalTimeType late_request_time = 2000;
+    // in end downloading mode, a fast peer requests a block of another
+    // peer when it is 2 times faster than that peer, or the block is not
+    // received in 5 seconds
+    const double end_game_faster_ratio = 2.0;
+    const NormalTimeType end_game_stuck_time = 5000;
 
     BitDownloadDispatcher::BitDownloadDispatcher(
             const std::tr1::shared_ptr<BitData>& bitdata,
@@ -85,12 +41,18 @@ namespace core {
         : bitdata_(bitdata),
           downloading_info_(downloading_info),
           pieces_count_(bitdata->GetPieceCount()),
-          end_downloading_mode_(false)
+          end_downloading_mode_(false),
+          streaming_(false),
+          streaming_offset_(0),
+          streaming_bitrate_(0),
+          streaming_time_(0),
+          streaming_need_(bitdata->GetPieceCount())
     {
         std::size_t piece_length = bitdata->GetPieceLength();
         block_count_ = piece_length / request_block_size;
 
-        PieceIndexSearcher *pis = new LinearPieceIndexSearcher(pieces_count_);
+        BitPieceIndexSearcher *pis = CreateRarestFirstPieceIndexSearcher(
+                bitdata->GetPieceAvailability());
         piece_index_searcher_.Reset(pis);
 
         downloading_info_->AddInfoObserver(this);
@@ -105,52 +67,212 @@ namespace core {
             const std::tr1::shared_ptr<BitPeerData>& peer_data,
             BitRequestList& request_list)
     {
+        // fast peers download the streaming window first
+        if (streaming_ && IsFastPeer(peer_data))
+        {
+            DispatchStreamingRequest(peer_data, request_list);
+            if (!request_list.Empty())
+                return ;
+        }
+
         // dispatch requests from the scattered_request_ first
+        std::size_t count = 0;
         if (!scattered_request_.Empty())
-            DispatchScatteredRequest(peer_data, request_list);
+            count = DispatchPool(peer_data, scattered_request_,
+                    request_list, block_count_);
+
+        if (count < block_count_)
+            count += DispatchNewRequest(peer_data, request_list);
 
-        if (request_list.Size() < block_count_)
-            DispatchNewRequest(peer_data, request_list);
+        // no block is left to request, race the slow peers
+        if (count == 0 && end_downloading_mode_)
+            DispatchDuplicateRequest(peer_data, request_list,
+                    0, pieces_count_, block_count_);
     }
 
-    void BitDownloadDispatcher::ReturnRequest(BitRequestList& request_list,
-                                              BitRequestList::Iterator it)
+    void BitDownloadDispatcher::DispatchAllowedFastRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList& request_list)
     {
-        if (end_downloading_mode_ &&
-            scattered_request_.IsExistRequest(it->index, it->begin, it->length))
+        const BitPieceMap& allowed = peer_data->GetAllowedFast();
+        if (!scattered_request_.Empty() &&
+            DispatchPool(peer_data, scattered_request_,
+                request_list, block_count_, &allowed) > 0)
+            return ;
+
+        std::size_t piece_index = 0;
+        while (BitPieceMap::FindFirstAndNotOr(
+                    downloading_info_->GetNeedDownload(),
+                    downloading_info_->GetDownloaded(),
+                    downloading_info_->GetDownloading(),
+                    allowed, piece_index, &piece_index))
         {
-            // in end mode and scattered_request_ have the request,
-            // we just Erase it
-            request_list.Erase(it);
+            if (IsNewPieceAllowed(peer_data, piece_index))
+            {
+                BitRequestList piece_blocks;
+                downloading_info_->MarkDownloading(piece_index);
+                ScatterRequestPiece(piece_index, piece_blocks);
+                DispatchPool(peer_data, piece_blocks, request_list, block_count_);
+                return ;
+            }
+            ++piece_index;
         }
-        else
+    }
+
+    void BitDownloadDispatcher::ReturnRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList& request_list,
+            BitRequestList::Iterator it)
+    {
+        RequestedBlocks::iterator block =
+            requested_blocks_.find(std::make_pair(it->index, it->begin));
+        if (block != requested_blocks_.end())
         {
+            block->second.RemovePeer(peer_data.get());
+
+            // the block is received, or another peer is requesting the
+            // block, just Erase it
+            if (block->second.received || block->second.request_count > 0)
+            {
+                request_list.Erase(it);
+                return ;
+            }
+
+            requested_blocks_.erase(block);
+        }
+
+        if (IsStreamingPiece(it->index))
+            streaming_request_.Splice(request_list, it);
+        else
             scattered_request_.Splice(request_list, it);
+    }
+
+    bool BitDownloadDispatcher::CompleteRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            int index, int begin, int length)
+    {
+        if (index < 0 || static_cast<std::size_t>(index) >= pieces_count_ ||
+            downloading_info_->GetDownloaded().IsPieceMark(index))
+        {
+            bitdata_->IncreaseWasted(length);
+            return false;
         }
+
+        RequestedBlocks::iterator it =
+            requested_blocks_.find(std::make_pair(index, begin));
+        if (it == requested_blocks_.end())
+            return true;
+
+        RequestedBlock& block = it->second;
+        if (block.received)
+        {
+            bitdata_->IncreaseWasted(length);
+            return false;
+        }
+
+        block.received = true;
+        block.RemovePeer(peer_data.get());
+        for (int i = 0; i < block.request_count; ++i)
+        {
+            pending_cancels_.insert(std::make_pair(block.peers[i],
+                        BitRequestList::RequestData(index, begin, length)));
+            block.peers[i] = 0;
+        }
+        block.request_count = 0;
+
+        return true;
     }
 
-    void BitDownloadDispatcher::CompleteNewPiece(std::size_t piece_index)
+    void BitDownloadDispatcher::ReturnCorruptBlock(int index, int begin, int length)
     {
-        if (end_downloading_mode_)
-            DeleteScatteredRequest(piece_index);
+        bitdata_->IncreaseWasted(length);
+
+        // other requests of the block are cancelled when it is received,
+        // so it is a new request
+        requested_blocks_.erase(std::make_pair(index, begin));
+
+        if (IsStreamingPiece(index))
+            streaming_request_.AddRequest(index, begin, length);
         else
+            scattered_request_.AddRequest(index, begin, length);
+    }
+
+    void BitDownloadDispatcher::TakeCancels(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList& cancels)
+    {
+        std::pair<PendingCancels::iterator, PendingCancels::iterator> range =
+            pending_cancels_.equal_range(peer_data.get());
+        for (PendingCancels::iterator it = range.first; it != range.second; ++it)
+            cancels.AddRequest(it->second.index, it->second.begin, it->second.length);
+        pending_cancels_.erase(range.first, range.second);
+    }
+
+    void BitDownloadDispatcher::StartStreaming(long long offset,
+                                               long long bytes_per_second)
+    {
+        streaming_ = true;
+        streaming_bitrate_ = bytes_per_second > 0 ? bytes_per_second : 0;
+        UpdateStreamingPosition(offset);
+    }
+
+    void BitDownloadDispatcher::UpdateStreamingPosition(long long offset)
+    {
+        streaming_offset_ = offset;
+        streaming_time_ = TimeTraits::now();
+    }
+
+    void BitDownloadDispatcher::StopStreaming()
+    {
+        streaming_ = false;
+
+        // not requested blocks of started pieces are downloaded as usual
+        scattered_request_.Splice(streaming_request_,
+                streaming_request_.Begin(), streaming_request_.End());
+    }
+
+    bool BitDownloadDispatcher::IsStreamingPiece(std::size_t piece_index) const
+    {
+        if (!streaming_)
+            return false;
+
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        GetStreamingWindow(&begin, &end);
+        return piece_index >= begin && piece_index < end;
+    }
+
+    void BitDownloadDispatcher::CompleteNewPiece(std::size_t piece_index)
+    {
+        DeleteRequestedPiece(piece_index);
+
+        if (!end_downloading_mode_)
             EnterEndDownloadMode();
     }
 
-    void BitDownloadDispatcher::DispatchScatteredRequest(
+    void BitDownloadDispatcher::DownloadingFailed(std::size_t piece_index)
+    {
+        DeleteRequestedPiece(piece_index);
+    }
+
+    std::size_t BitDownloadDispatcher::DispatchPool(
             const std::tr1::shared_ptr<BitPeerData>& peer_data,
-            BitRequestList& request_list)
+            BitRequestList& pool,
+            BitRequestList& request_list,
+            std::size_t max_count,
+            const BitPieceMap *allowed)
     {
         const BitPieceMap& peer_piece_map = peer_data->GetPieceMap();
-        BitRequestList::Iterator it = scattered_request_.Begin();
+        NormalTimeType now = TimeTraits::now();
 
         std::size_t count = 0;
-        BitRequestList dispatched;
-        while (count < block_count_ && it != scattered_request_.End())
+        BitRequestList::Iterator it = pool.Begin();
+        while (count < max_count && it != pool.End())
         {
-            if (peer_piece_map.IsPieceMark(it->index))
+            if (peer_piece_map.IsPieceMark(it->index) &&
+                (!allowed || allowed->IsPieceMark(it->index)))
             {
-                dispatched.Splice(scattered_request_, it++);
+                TrackRequest(peer_data, request_list.Splice(pool, it++), now);
                 ++count;
             }
             else
@@ -159,41 +281,23 @@ namespace core {
             }
         }
 
-        if (end_downloading_mode_)
-        {
-            request_list.AddRequest(dispatched.Begin(), dispatched.End());
-            scattered_request_.Splice(dispatched, dispatched.Begin(), dispatched.End());
-        }
-        else
-        {
-            request_list.Splice(dispatched, dispatched.Begin(), dispatched.End());
-        }
+        return count;
     }
 
-    void BitDownloadDispatcher::DispatchNewRequest(
+    std::size_t BitDownloadDispatcher::DispatchNewRequest(
             const std::tr1::shared_ptr<BitPeerData>& peer_data,
             BitRequestList& request_list)
     {
         std::size_t piece_index = 0;
-        bool is_search = piece_index_searcher_->Search(
-                downloading_info_->GetDownloaded(),
-                downloading_info_->GetDownloading(),
-                downloading_info_->GetNeedDownload(),
-                peer_data->GetPieceMap(), &piece_index);
+        bool is_search = SearchNewPiece(peer_data, &piece_index);
+        if (!is_search || piece_index >= pieces_count_)
+            return 0;
 
-        if (is_search && piece_index < pieces_count_)
-        {
-            downloading_info_->MarkDownloading(piece_index);
-            if (end_downloading_mode_)
-            {
-                ScatterRequestPiece(piece_index, scattered_request_);
-                DispatchScatteredRequest(peer_data, request_list);
-            }
-            else
-            {
-                ScatterRequestPiece(piece_index, request_list);
-            }
-        }
+        // the peer requests all blocks of the new piece
+        BitRequestList piece_blocks;
+        downloading_info_->MarkDownloading(piece_index);
+        ScatterRequestPiece(piece_index, piece_blocks);
+        return DispatchPool(peer_data, piece_blocks, request_list, block_count_);
     }
 
     void BitDownloadDispatcher::ScatterRequestPiece(
@@ -207,18 +311,6 @@ namespace core {
         }
     }
 
-    void BitDownloadDispatcher::DeleteScatteredRequest(std::size_t piece_index)
-    {
-        BitRequestList::Iterator it = scattered_request_.Begin();
-        while (it != scattered_request_.End())
-        {
-            if (it->index == piece_index)
-                scattered_request_.Erase(it++);
-            else
-                ++it;
-        }
-    }
-
     bool BitDownloadDispatcher::EnterEndDownloadMode()
     {
         long long downloaded = bitdata_->GetDownloaded();
@@ -233,5 +325,272 @@ namespace core {
         return end_downloading_mode_;
     }
 
+    void BitDownloadDispatcher::DispatchStreamingRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList& request_list)
+    {
+        const BitPieceMap& peer_piece_map = peer_data->GetPieceMap();
+        std::size_t window_begin = 0;
+        std::size_t window_end = 0;
+        GetStreamingWindow(&window_begin, &window_end);
+
+        std::size_t count = DispatchPool(peer_data, streaming_request_,
+                request_list, streaming_blocks_per_peer);
+
+        // start new pieces of the window by deadline order
+        std::size_t piece_index = window_begin;
+        while (count < streaming_blocks_per_peer)
+        {
+            bool is_find = BitPieceMap::FindFirstAndNotOr(
+                    downloading_info_->GetNeedDownload(),
+                    downloading_info_->GetDownloaded(),
+                    downloading_info_->GetDownloading(),
+                    peer_piece_map, piece_index, &piece_index);
+            if (!is_find || piece_index >= window_end)
+                break;
+
+            downloading_info_->MarkDownloading(piece_index);
+            ScatterRequestPiece(piece_index, streaming_request_);
+            count += DispatchPool(peer_data, streaming_request_,
+                    request_list, streaming_blocks_per_peer - count);
+        }
+
+        if (count < streaming_blocks_per_peer)
+            DispatchDuplicateRequest(peer_data, request_list,
+                    window_begin, window_end, streaming_blocks_per_peer - count);
+    }
+
+    std::size_t BitDownloadDispatcher::DispatchDuplicateRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList& request_list,
+            std::size_t piece_begin,
+            std::size_t piece_end,
+            std::size_t max_count)
+    {
+        NormalTimeType now = TimeTraits::now();
+        bool is_fast_peer = IsFastPeer(peer_data);
+
+        std::size_t count = 0;
+        RequestedBlocks::iterator it = requested_blocks_.lower_bound(
+                std::make_pair(static_cast<int>(piece_begin), 0));
+        RequestedBlocks::iterator end = requested_blocks_.lower_bound(
+                std::make_pair(static_cast<int>(piece_end), 0));
+        for (; count < max_count && it != end; ++it)
+        {
+            RequestedBlock& block = it->second;
+            int index = it->first.first;
+            if (!IsDuplicateAllowed(peer_data, is_fast_peer, index, block, now))
+                continue;
+
+            request_list.AddRequest(index, it->first.second, block.length);
+            block.AddPeer(peer_data.get(), now);
+            ++count;
+        }
+
+        return count;
+    }
+
+    bool BitDownloadDispatcher::IsDuplicateAllowed(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            bool is_fast_peer,
+            int piece_index,
+            const RequestedBlock& block,
+            NormalTimeType now) const
+    {
+        if (block.received ||
+            block.request_count == 0 ||
+            block.request_count >= max_block_requests ||
+            block.HasPeer(peer_data.get()) ||
+            !peer_data->GetPieceMap().IsPieceMark(piece_index))
+            return false;
+
+        NormalTimeType elapsed = now - block.request_time;
+        if (IsStreamingPiece(piece_index) &&
+            elapsed >= late_request_time &&
+            GetPieceDeadline(piece_index) <= urgent_deadline)
+            return true;
+
+        if (!end_downloading_mode_ || !is_fast_peer)
+            return false;
+
+        return elapsed >= end_game_stuck_time ||
+            peer_data->GetDownloadRate() >
+            block.peers[0]->GetDownloadRate() * end_game_faster_ratio;
+    }
+
+    void BitDownloadDispatcher::TrackRequest(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            BitRequestList::Iterator it,
+            NormalTimeType now)
+    {
+        RequestedBlocks::iterator block = requested_blocks_.insert(
+                std::make_pair(std::make_pair(it->index, it->begin),
+                               RequestedBlock(it->length))).first;
+        block->second.AddPeer(peer_data.get(), now);
+    }
+
+    bool BitDownloadDispatcher::SearchNewPiece(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            std::size_t *piece_index)
+    {
+        // search from the highest priority to the lowest, the highest
+        // tier which the peer has pieces of is searched only
+        for (int priority = PRIORITY_HIGH; priority > PRIORITY_SKIP; --priority)
+        {
+            const BitPieceMap *need = &downloading_info_->GetNeedDownload(
+                    static_cast<BitPriority>(priority));
+
+            // pieces of the streaming window are left to fast peers
+            if (streaming_)
+            {
+                BitPieceMap::Union(*need, *need, 0, need->GetMapSize(),
+                        streaming_need_);
+
+                std::size_t window_begin = 0;
+                std::size_t window_end = 0;
+                GetStreamingWindow(&window_begin, &window_end);
+                for (std::size_t i = window_begin; i < window_end; ++i)
+                    streaming_need_.UnMarkPiece(i);
+
+                need = &streaming_need_;
+            }
+
+            std::size_t first = 0;
+            if (!BitPieceMap::FindFirstAndNotOr(*need,
+                        downloading_info_->GetDownloaded(),
+                        downloading_info_->GetDownloading(),
+                        peer_data->GetPieceMap(), 0, &first))
+                continue;
+
+            // suggestions are honoured within the tier
+            if (SearchSuggestedPiece(peer_data, *need, piece_index))
+                return true;
+
+            return piece_index_searcher_->Search(
+                    downloading_info_->GetDownloaded(),
+                    downloading_info_->GetDownloading(),
+                    *need, peer_data->GetPieceMap(), piece_index);
+        }
+
+        return false;
+    }
+
+    bool BitDownloadDispatcher::SearchSuggestedPiece(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            const BitPieceMap& need,
+            std::size_t *piece_index)
+    {
+        // the suggested pieces are in the cache of the peer, it uploads
+        // them without reading disk. Suggestions of pieces out of the
+        // tier are kept for later
+        std::vector<std::size_t> others;
+        bool is_find = false;
+        std::size_t suggested = 0;
+        while (!is_find && peer_data->TakeSuggestedPiece(&suggested))
+        {
+            if (!IsNewPieceAllowed(peer_data, suggested))
+                continue;
+
+            if (need.IsPieceMark(suggested))
+            {
+                *piece_index = suggested;
+                is_find = true;
+            }
+            else
+            {
+                others.push_back(suggested);
+            }
+        }
+
+        for (std::size_t i = 0; i < others.size(); ++i)
+            peer_data->SuggestPiece(static_cast<int>(others[i]));
+        return is_find;
+    }
+
+    bool BitDownloadDispatcher::IsNewPieceAllowed(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data,
+            std::size_t piece_index) const
+    {
+        // pieces of the streaming window are left to fast peers
+        return piece_index < pieces_count_ &&
+            peer_data->GetPieceMap().IsPieceMark(piece_index) &&
+            downloading_info_->GetNeedDownload().IsPieceMark(piece_index) &&
+            !downloading_info_->GetDownloaded().IsPieceMark(piece_index) &&
+            !downloading_info_->GetDownloading().IsPieceMark(piece_index) &&
+            !IsStreamingPiece(piece_index);
+    }
+
+    bool BitDownloadDispatcher::IsFastPeer(
+            const std::tr1::shared_ptr<BitPeerData>& peer_data) const
+    {
+        double max_rate = 0.0;
+        BitData::PeerDataSet& peers = bitdata_->GetPeerDataSet();
+        for (BitData::PeerDataSet::iterator it = peers.begin();
+                it != peers.end(); ++it)
+        {
+            double rate = (*it)->GetDownloadRate();
+            if (rate > max_rate)
+                max_rate = rate;
+        }
+
+        return peer_data->GetDownloadRate() >= max_rate * fast_peer_ratio;
+    }
+
+    long long BitDownloadDispatcher::GetPlayPosition() const
+    {
+        long long elapsed = TimeTraits::now() - streaming_time_;
+        long long position = streaming_offset_ + elapsed * streaming_bitrate_ / 1000;
+        long long total_size = bitdata_->GetTotalSize();
+        return position < total_size ? position : total_size;
+    }
+
+    void BitDownloadDispatcher::GetStreamingWindow(std::size_t *begin,
+                                                   std::size_t *end) const
+    {
+        long long piece_length = bitdata_->GetPieceLength();
+        long long position = GetPlayPosition();
+        long long window_end = position +
+            streaming_bitrate_ * streaming_window_seconds;
+
+        *begin = static_cast<std::size_t>(position / piece_length);
+        *end = static_cast<std::size_t>(window_end / piece_length) + 1;
+        if (*end < *begin + streaming_window_min_pieces)
+            *end = *begin + streaming_window_min_pieces;
+        if (*end > pieces_count_)
+            *end = pieces_count_;
+    }
+
+    long long BitDownloadDispatcher::GetPieceDeadline(std::size_t piece_index) const
+    {
+        // milliseconds from now to the piece begin to play, the piece
+        // is already late when it is negative
+        long long piece_begin =
+            static_cast<long long>(piece_index) * bitdata_->GetPieceLength();
+        long long distance = piece_begin - GetPlayPosition();
+
+        // the play position does not move when the bitrate is unknown,
+        // only the piece of the position is due
+        if (streaming_bitrate_ == 0)
+            return distance > 0 ? no_deadline : 0;
+        return distance * 1000 / streaming_bitrate_;
+    }
+
+    void BitDownloadDispatcher::DeleteRequestedPiece(std::size_t piece_index)
+    {
+        int index = static_cast<int>(piece_index);
+        requested_blocks_.erase(
+                requested_blocks_.lower_bound(std::make_pair(index, 0)),
+                requested_blocks_.lower_bound(std::make_pair(index + 1, 0)));
+
+        BitRequestList::Iterator it = streaming_request_.Begin();
+        while (it != streaming_request_.End())
+        {
+            if (it->index == index)
+                streaming_request_.Erase(it++);
+            else
+                ++it;
+        }
+    }
+
 } // namespace core
 } // namespace bitwave
@@ -4,9 +4,14 @@
 #include "BitPieceMap.h"
 #include "BitRequestList.h"
 #include "BitDownloadingInfo.h"
+#include "BitPieceIndexSearcher.h"
 #include "../base/BaseTypes.h"
 #include "../base/ScopePtr.h"
+#include "../timer/TimeTraits.h"
+#include <assert.h>
+#include <map>
 #include <memory>
+#include <utility>
 
 namespace bitwave {
 namespace core {
@@ -18,17 +23,6 @@ namespace core {
         public BitDownloadingInfo::Observer, private NotCopyable
     {
     public:
-        class PieceIndexSearcher
-        {
-        public:
-            virtual bool Search(const BitPieceMap& downloaded,
-                                const BitPieceMap& downloading,
-                                const BitPieceMap& need_download,
-                                const BitPieceMap& candidate,
-                                std::size_t *piece_index) = 0;
-            virtual ~PieceIndexSearcher() { }
-        };
-
         BitDownloadDispatcher(
                 const std::tr1::shared_ptr<BitData>& bitdata,
                 BitDownloadingInfo *downloading_info);
@@ -39,43 +33,194 @@ namespace core {
                 const std::tr1::shared_ptr<BitPeerData>& peer_data,
                 BitRequestList& request_list);
 
-        void ReturnRequest(BitRequestList& request_list,
+        // the peer chokes us, dispatch blocks of the allowed fast pieces
+        // of the peer only
+        void DispatchAllowedFastRequest(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                BitRequestList& request_list);
+
+        void ReturnRequest(const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                           BitRequestList& request_list,
                            BitRequestList::Iterator it);
 
+        // a requested block is received from the peer, other requests of
+        // the block are pending to cancel. Return false when the block is
+        // received already, then the block is wasted
+        bool CompleteRequest(const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                             int index, int begin, int length);
+
+        // a received block is corrupt by its merkle hash, it is dropped
+        // from the cache and requested again
+        void ReturnCorruptBlock(int index, int begin, int length);
+
+        // requests of the peer need to cancel, they are taken and sent
+        // in one batch by the peer connection
+        bool HasPendingCancels() const
+            { return !pending_cancels_.empty(); }
+        void TakeCancels(const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                         BitRequestList& cancels);
+
         bool IsEndDownloadingMode() const
             { return end_downloading_mode_; }
 
+        // streaming mode, play from offset of the task data at bytes_per_second,
+        // pieces in the deadline window after the play position are
+        // downloaded in order, and in parallel by the fastest peers.
+        // bytes_per_second is 0 when the bitrate is unknown, then the
+        // window is the minimum pieces after offset
+        void StartStreaming(long long offset, long long bytes_per_second);
+        // the player seeks or reads at offset
+        void UpdateStreamingPosition(long long offset);
+        void StopStreaming();
+
+        bool IsStreaming() const
+            { return streaming_; }
+
+        // piece is in the deadline window, its blocks may be requested
+        // from more than one peer
+        bool IsStreamingPiece(std::size_t piece_index) const;
+
     private:
+        typedef time_traits<NormalTimeType> TimeTraits;
+
+        // at most 2 peers request one block at the same time
+        static const int max_block_requests = 2;
+
+        // requested block, a block is requested from one peer, and in
+        // streaming window or end downloading mode it may be requested
+        // from another peer too
+        struct RequestedBlock
+        {
+            explicit RequestedBlock(int l)
+                : length(l),
+                  request_time(0),
+                  request_count(0),
+                  received(false)
+            {
+                peers[0] = 0;
+                peers[1] = 0;
+            }
+
+            bool HasPeer(const BitPeerData *peer) const
+            {
+                return peers[0] == peer || peers[1] == peer;
+            }
+
+            void AddPeer(BitPeerData *peer, NormalTimeType now)
+            {
+                assert(request_count < max_block_requests);
+                peers[request_count++] = peer;
+                request_time = now;
+            }
+
+            void RemovePeer(const BitPeerData *peer)
+            {
+                for (int i = 0; i < request_count; ++i)
+                {
+                    if (peers[i] == peer)
+                    {
+                        peers[i] = peers[--request_count];
+                        peers[request_count] = 0;
+                        return ;
+                    }
+                }
+            }
+
+            int length;
+            NormalTimeType request_time;    // last request time
+            int request_count;
+            bool received;
+            BitPeerData *peers[max_block_requests];     // requesting peers
+        };
+
+        // key is (index, begin) of the block
+        typedef std::map<std::pair<int, int>, RequestedBlock> RequestedBlocks;
+        typedef std::multimap<const BitPeerData *,
+                              BitRequestList::RequestData> PendingCancels;
+
         virtual void DownloadingNewPiece(std::size_t piece_index) { }
         virtual void CompleteNewPiece(std::size_t piece_index);
-        virtual void DownloadingFailed(std::size_t piece_index) { }
+        virtual void DownloadingFailed(std::size_t piece_index);
 
-        void DispatchScatteredRequest(
+        std::size_t DispatchPool(
                 const std::tr1::shared_ptr<BitPeerData>& peer_data,
-                BitRequestList& request_list);
-        void DispatchNewRequest(
+                BitRequestList& pool,
+                BitRequestList& request_list,
+                std::size_t max_count,
+                const BitPieceMap *allowed = 0);
+        std::size_t DispatchNewRequest(
                 const std::tr1::shared_ptr<BitPeerData>& peer_data,
                 BitRequestList& request_list);
+        bool SearchNewPiece(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                std::size_t *piece_index);
+        bool SearchSuggestedPiece(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                const BitPieceMap& need,
+                std::size_t *piece_index);
+        bool IsNewPieceAllowed(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                std::size_t piece_index) const;
         void ScatterRequestPiece(
                 std::size_t piece_index,
                 BitRequestList& list);
-        void DeleteScatteredRequest(std::size_t piece_index);
         bool EnterEndDownloadMode();
 
+        void DispatchStreamingRequest(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                BitRequestList& request_list);
+        std::size_t DispatchDuplicateRequest(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                BitRequestList& request_list,
+                std::size_t piece_begin,
+                std::size_t piece_end,
+                std::size_t max_count);
+        bool IsDuplicateAllowed(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                bool is_fast_peer,
+                int piece_index,
+                const RequestedBlock& block,
+                NormalTimeType now) const;
+        void TrackRequest(
+                const std::tr1::shared_ptr<BitPeerData>& peer_data,
+                BitRequestList::Iterator it,
+                NormalTimeType now);
+        void DeleteRequestedPiece(std::size_t piece_index);
+        bool IsFastPeer(const std::tr1::shared_ptr<BitPeerData>& peer_data) const;
+        long long GetPlayPosition() const;
+        void GetStreamingWindow(std::size_t *begin, std::size_t *end) const;
+        long long GetPieceDeadline(std::size_t piece_index) const;
+
         // bittask's bitdata
         std::tr1::shared_ptr<BitData> bitdata_;
         // task downloading information
         BitDownloadingInfo *downloading_info_;
-        // scattered block requests
+        // scattered block requests which are not requested
         BitRequestList scattered_request_;
-        // PieceIndexSearcher ptr
-        ScopePtr<PieceIndexSearcher> piece_index_searcher_;
+        // blocks of downloading pieces which are requested
+        RequestedBlocks requested_blocks_;
+        // requests to cancel of peers, the blocks are received from
+        // other peers
+        PendingCancels pending_cancels_;
+        // BitPieceIndexSearcher ptr
+        ScopePtr<BitPieceIndexSearcher> piece_index_searcher_;
         // pieces count of total task
         std::size_t pieces_count_;
         // block count of one piece
         std::size_t block_count_;
-        // end downloading mode, every peer will request every left piece
+        // end downloading mode, a block of the left pieces may be
+        // requested by a faster peer too
         bool end_downloading_mode_;
+
+        // streaming mode data
+        bool streaming_;
+        long long streaming_offset_;
+        long long streaming_bitrate_;
+        NormalTimeType streaming_time_;
+        // blocks of started streaming pieces which are not requested
+        BitRequestList streaming_request_;
+        // need download map of one priority without streaming window
+        BitPieceMap streaming_need_;
     };
 
 } // namespace core
@@ -11,6 +11,10 @@ namespace core {
           need_download_(bitdata->GetPieceCount()),
           downloading_(bitdata->GetPieceCount())
     {
+        // every map must own its storage, so do not copy one map
+        for (int i = 0; i < PRIORITY_COUNT; ++i)
+            priority_need_.push_back(BitPieceMap(bitdata->GetPieceCount()));
+
         UpdateNeedDownload(bitdata);
     }
 
@@ -25,6 +29,11 @@ namespace core {
     void BitDownloadingInfo::MarkDownloadComplete(std::size_t piece_index)
     {
         downloading_.UnMarkPiece(piece_index);
+
+        // the piece maybe completed by recheck already
+        if (downloaded_.IsPieceMark(piece_index))
+            return ;
+
         downloaded_.MarkPiece(piece_index);
         std::for_each(observers_.begin(), observers_.end(),
                 std::tr1::bind(&Observer::CompleteNewPiece,
@@ -39,9 +48,21 @@ namespace core {
                     std::tr1::placeholders::_1, piece_index));
     }
 
+    bool BitDownloadingInfo::MarkRecheckFailed(std::size_t piece_index)
+    {
+        if (!downloaded_.IsPieceMark(piece_index))
+            return false;
+
+        downloaded_.UnMarkPiece(piece_index);
+        return true;
+    }
+
     void BitDownloadingInfo::UpdateNeedDownload(
             const std::tr1::shared_ptr<BitData>& bitdata)
     {
+        std::size_t piece_count = bitdata->GetPieceCount();
+        std::vector<BitPriority> priorities(piece_count, PRIORITY_SKIP);
+
         const BitData::DownloadFiles& files = bitdata->GetFilesInfo();
         BitData::DownloadFiles::const_iterator it = files.begin();
         BitData::DownloadFiles::const_iterator end = files.end();
@@ -51,18 +72,43 @@ namespace core {
         for (; it != end; ++it)
         {
             long long file_end = file_begin + it->length;
-            if (it->is_download)
+            // a file of zero length has no piece, the piece it borders
+            // belongs to other files
+            if (it->is_download && it->length > 0)
             {
                 std::size_t piece_index = static_cast<std::size_t>(
                         file_begin / piece_length);
                 std::size_t end_piece_index = static_cast<std::size_t>(
-                        ceil(file_end / static_cast<double>(piece_length)));
+                        (file_end + piece_length - 1) / piece_length);
 
                 for (; piece_index < end_piece_index; ++piece_index)
-                    need_download_.MarkPiece(piece_index);
+                {
+                    if (priorities[piece_index] < it->priority)
+                        priorities[piece_index] = it->priority;
+                }
             }
             file_begin = file_end;
         }
+
+        const BitData::PiecePriorities& pieces = bitdata->GetPiecePriorities();
+        for (std::size_t i = 0; i < piece_count; ++i)
+        {
+            if (pieces[i] != PRIORITY_COUNT)
+                priorities[i] = pieces[i];
+        }
+
+        need_download_.Clear();
+        for (int i = 0; i < PRIORITY_COUNT; ++i)
+            priority_need_[i].Clear();
+
+        for (std::size_t i = 0; i < piece_count; ++i)
+        {
+            if (priorities[i] != PRIORITY_SKIP)
+            {
+                need_download_.MarkPiece(i);
+                priority_need_[priorities[i]].MarkPiece(i);
+            }
+        }
     }
 
 } // namespace core
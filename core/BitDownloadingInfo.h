@@ -2,9 +2,11 @@
 #define BIT_DOWNLOADING_INFO_H
 
 #include "BitPieceMap.h"
+#include "BitPriority.h"
 #include "../base/BaseTypes.h"
 #include <memory>
 #include <set>
+#include <vector>
 
 namespace bitwave {
 namespace core {
@@ -33,8 +35,12 @@ namespace core {
 
         const BitPieceMap& GetDownloaded() const
             { return downloaded_; }
+        // all need download pieces, which priority is not PRIORITY_SKIP
         const BitPieceMap& GetNeedDownload() const
             { return need_download_; }
+        // need download pieces of the priority
+        const BitPieceMap& GetNeedDownload(BitPriority priority) const
+            { return priority_need_[priority]; }
         const BitPieceMap& GetDownloading() const
             { return downloading_; }
 
@@ -42,12 +48,20 @@ namespace core {
         void MarkDownloadComplete(std::size_t piece_index);
         void DownloadingFailed(std::size_t piece_index);
 
-    private:
+        // a downloaded piece failed the recheck, it need download again,
+        // return false when the piece is not downloaded
+        bool MarkRecheckFailed(std::size_t piece_index);
+
+        // update need download maps when priorities of bitdata changed,
+        // a piece spans files has the highest priority of the files,
+        // then piece priorities override in order
         void UpdateNeedDownload(
                 const std::tr1::shared_ptr<BitData>& bitdata);
 
+    private:
         BitPieceMap& downloaded_;
         BitPieceMap need_download_;
+        std::vector<BitPieceMap> priority_need_;
         BitPieceMap downloading_;
 
         std::set<Observer *> observers_;
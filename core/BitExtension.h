@@ -0,0 +1,42 @@
+#ifndef BIT_EXTENSION_H
+#define BIT_EXTENSION_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace bitwave {
+namespace core {
+
+    namespace bentypes {
+        class BenDictionary;
+    } // namespace bentypes
+
+    // extension of the extension protocol (BEP 10). Extensions are added
+    // to a BitPeerConnection before its handshake is sent, local message
+    // ids are given in the added order, and the message ids of the peer
+    // are learned from its extended handshake
+    class BitExtension
+    {
+    public:
+        virtual ~BitExtension() { }
+
+        // name of the extension in "m" dictionary, such as "ut_pex"
+        virtual const char * GetName() const = 0;
+
+        // integer items of this extension in the extended handshake, such
+        // as "metadata_size" of ut_metadata
+        virtual void GetHandshakeItems(std::map<std::string, long long>& items) const { }
+
+        // the extended handshake of the peer is received
+        virtual void OnHandshake(const bentypes::BenDictionary& handshake) { }
+
+        // a message of this extension is received, data is the payload
+        // after the extended message id
+        virtual void OnMessage(const char *data, std::size_t len) = 0;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_EXTENSION_H
@@ -0,0 +1,50 @@
+#include "BitFastExtension.h"
+#include "../net/NetHelper.h"
+#include "../sha1/NetSha1Value.h"
+#include <string.h>
+#include <algorithm>
+
+namespace bitwave {
+namespace core {
+
+    void GenerateAllowedFastSet(unsigned long address,
+                                const Sha1Value& info_hash,
+                                std::size_t piece_count,
+                                std::size_t k,
+                                std::vector<std::size_t>& pieces)
+    {
+        pieces.clear();
+        if (k > piece_count)
+            k = piece_count;
+
+        // x = (ip & 0xFFFFFF00) + info_hash, peers in the same /24 share
+        // one set
+        char x[24];
+        unsigned int ip = static_cast<unsigned int>(address) &
+            net::HostToNeti(0xFFFFFF00u);
+        memcpy(x, &ip, sizeof(ip));
+        Sha1Value net_value = NetByteOrder(info_hash);
+        memcpy(x + sizeof(ip), net_value.GetData(), net_value.GetDataSize());
+
+        const char *data = x;
+        std::size_t size = sizeof(x);
+        while (pieces.size() < k)
+        {
+            // words of Sha1Value are the big endian 4 bytes of the digest
+            Sha1Value hash(data, size);
+            const unsigned *y = reinterpret_cast<const unsigned *>(hash.GetData());
+            for (int i = 0; i < 5 && pieces.size() < k; ++i)
+            {
+                std::size_t index = y[i] % piece_count;
+                if (std::find(pieces.begin(), pieces.end(), index) == pieces.end())
+                    pieces.push_back(index);
+            }
+
+            net_value = NetByteOrder(hash);
+            data = net_value.GetData();
+            size = net_value.GetDataSize();
+        }
+    }
+
+} // namespace core
+} // namespace bitwave
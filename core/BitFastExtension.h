@@ -0,0 +1,22 @@
+#ifndef BIT_FAST_EXTENSION_H
+#define BIT_FAST_EXTENSION_H
+
+#include "../sha1/Sha1Value.h"
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // canonical allowed fast set of BEP 6, k pieces of piece_count are
+    // generated from the ipv4 address (network byte order) of the peer
+    // and the info hash, so both sides know the set of the peer
+    void GenerateAllowedFastSet(unsigned long address,
+                                const Sha1Value& info_hash,
+                                std::size_t piece_count,
+                                std::size_t k,
+                                std::vector<std::size_t>& pieces);
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_FAST_EXTENSION_H
@@ -0,0 +1,112 @@
+#include "BitHashPool.h"
+#include "../thread/Atomic.h"
+
+namespace bitwave {
+namespace core {
+
+    BitHashPool::BitHashPool(std::size_t thread_count)
+        : thread_exit_flag_(0)
+    {
+        if (thread_count == 0)
+        {
+            SYSTEM_INFO system_info;
+            ::GetSystemInfo(&system_info);
+            thread_count = system_info.dwNumberOfProcessors;
+        }
+
+        for (std::size_t i = 0; i < thread_count; ++i)
+        {
+            ThreadPtr ptr(new Thread(
+                        std::tr1::bind(&BitHashPool::WorkThread, this)));
+            threads_.push_back(ptr);
+        }
+    }
+
+    BitHashPool::~BitHashPool()
+    {
+        AtomicAdd(&thread_exit_flag_, 1);
+        job_event_.SetEvent();
+
+        for (std::vector<ThreadPtr>::iterator it = threads_.begin();
+                it != threads_.end(); ++it)
+            (*it)->Join();
+    }
+
+    void BitHashPool::AddJob(const Job& job, Priority priority)
+    {
+        {
+            SpinlocksMutexLocker locker(job_mutex_);
+            if (priority == HIGH)
+                high_jobs_.push_back(job);
+            else
+                low_jobs_.push_back(job);
+        }
+        job_event_.SetEvent();
+    }
+
+    unsigned BitHashPool::WorkThread()
+    {
+        bool low_thread_priority = false;
+        while (true)
+        {
+            if (job_event_.WaitForever())
+            {
+                if (AtomicAdd(&thread_exit_flag_, 0))
+                {
+                    // wake up next thread to exit
+                    job_event_.SetEvent();
+                    break;
+                }
+
+                Job job;
+                Priority priority = HIGH;
+                while (FetchJob(job, priority))
+                {
+                    bool low = priority == LOW;
+                    if (low != low_thread_priority)
+                    {
+                        ::SetThreadPriority(::GetCurrentThread(),
+                                low ? THREAD_PRIORITY_BELOW_NORMAL :
+                                      THREAD_PRIORITY_NORMAL);
+                        low_thread_priority = low;
+                    }
+
+                    job();
+
+                    if (AtomicAdd(&thread_exit_flag_, 0))
+                        break;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    bool BitHashPool::FetchJob(Job& job, Priority& priority)
+    {
+        SpinlocksMutexLocker locker(job_mutex_);
+        if (!high_jobs_.empty())
+        {
+            job = high_jobs_.front();
+            high_jobs_.pop_front();
+            priority = HIGH;
+        }
+        else if (!low_jobs_.empty())
+        {
+            job = low_jobs_.front();
+            low_jobs_.pop_front();
+            priority = LOW;
+        }
+        else
+        {
+            return false;
+        }
+
+        // there are jobs left, wake up another thread to help
+        if (!high_jobs_.empty() || !low_jobs_.empty())
+            job_event_.SetEvent();
+        return true;
+    }
+
+} // namespace core
+} // namespace bitwave
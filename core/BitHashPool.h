@@ -0,0 +1,58 @@
+#ifndef BIT_HASH_POOL_H
+#define BIT_HASH_POOL_H
+
+#include "../base/BaseTypes.h"
+#include "../thread/Thread.h"
+#include "../thread/Event.h"
+#include "../thread/Mutex.h"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // a thread pool shared by all tasks to calculate hash of pieces,
+    // HIGH priority jobs always run before LOW priority jobs, and LOW
+    // priority jobs run in threads with below normal priority
+    class BitHashPool : private NotCopyable
+    {
+    public:
+        enum Priority
+        {
+            HIGH,   // hash of downloaded pieces
+            LOW,    // background jobs, such as recheck
+        };
+
+        typedef std::tr1::function<void ()> Job;
+
+        // thread_count is 0 then create a thread for each processor
+        explicit BitHashPool(std::size_t thread_count = 0);
+
+        ~BitHashPool();
+
+        void AddJob(const Job& job, Priority priority);
+
+        std::size_t GetThreadCount() const
+            { return threads_.size(); }
+
+    private:
+        typedef std::tr1::shared_ptr<Thread> ThreadPtr;
+        typedef std::deque<Job> JobQueue;
+
+        unsigned WorkThread();
+        bool FetchJob(Job& job, Priority& priority);
+
+        volatile long thread_exit_flag_;
+        std::vector<ThreadPtr> threads_;
+        AutoResetEvent job_event_;
+        SpinlocksMutex job_mutex_;
+        JobQueue high_jobs_;
+        JobQueue low_jobs_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_HASH_POOL_H
@@ -0,0 +1,692 @@
+#include "BitHttpTracker.h"
+#include "BitNetProcessor.h"
+#include "../net/Address.h"
+#include "../net/NetHelper.h"
+#include "../net/TimerService.h"
+#include "../protocol/HttpException.h"
+#include "../protocol/URI.h"
+#include "../protocol/Request.h"
+#include "../sha1/NetSha1Value.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    using namespace std::tr1::placeholders;
+
+    namespace {
+
+        const char * const default_http_port = "80";
+
+        NormalTimeType Now()
+        {
+            return time_traits<NormalTimeType>::now();
+        }
+
+        const char * EventName(int event)
+        {
+            switch (event)
+            {
+            case HttpAnnounceRequest::COMPLETED: return "completed";
+            case HttpAnnounceRequest::STARTED: return "started";
+            case HttpAnnounceRequest::STOPPED: return "stopped";
+            default: return 0;
+            }
+        }
+
+        bool ParseAnnounceResponse(const http::Response *response,
+                                   HttpTrackerResponse *result)
+        {
+            if (!response ||
+                response->GetStatusCodeType() != http::Response::SUCCESS ||
+                response->GetContentSize() == 0)
+                return false;
+
+            try
+            {
+                bentypes::TrackerResponse response_info(
+                        response->GetContentBufPointer(),
+                        response->GetContentSize());
+                if (response_info.IsFailure())
+                {
+                    result->failure_reason = response_info.GetFailureReason();
+                    return false;
+                }
+
+                response_info.GetPeerInfo(result->peers);
+                result->interval = response_info.GetInterval();
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+
+        bool ParseScrapeResponse(const http::Response *response,
+                                 bentypes::ScrapeResponse::FilesInfo *files_info)
+        {
+            if (!response ||
+                response->GetStatusCodeType() != http::Response::SUCCESS ||
+                response->GetContentSize() == 0)
+                return false;
+
+            try
+            {
+                bentypes::ScrapeResponse response_info(
+                        response->GetContentBufPointer(),
+                        response->GetContentSize());
+                if (response_info.IsFailure())
+                    return false;
+
+                response_info.GetFilesInfo(*files_info);
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+
+    } // unnamed namespace
+
+    std::string EncodeHttpAnnounceRequest(const std::string& url,
+                                          const HttpAnnounceRequest& request)
+    {
+        assert(request.peer_id.size() == 20);
+        http::URI uri(url);
+        Sha1Value net_sha1 = NetByteOrder(request.info_hash);
+
+        uri.AddQuery("info_hash", net_sha1.GetData(), net_sha1.GetDataSize());
+        uri.AddQuery("peer_id", request.peer_id.c_str(), 20);
+        uri.AddQuery("port", request.port);
+        uri.AddQuery("uploaded", request.uploaded);
+        uri.AddQuery("downloaded", request.downloaded);
+        uri.AddQuery("left", request.left);
+        uri.AddQuery("compact", 1);
+        uri.AddQuery("numwant", request.num_want);
+
+        const char *event = EventName(request.event);
+        if (event)
+            uri.AddQuery("event", event);
+
+        return http::Request(uri).GetRequestText();
+    }
+
+    std::string EncodeHttpScrapeRequest(const std::string& scrape_url,
+                                        const std::vector<Sha1Value>& info_hashes)
+    {
+        http::URI uri(scrape_url);
+        for (std::size_t i = 0; i < info_hashes.size(); ++i)
+        {
+            Sha1Value net_sha1 = NetByteOrder(info_hashes[i]);
+            uri.AddQuery("info_hash", net_sha1.GetData(), net_sha1.GetDataSize());
+        }
+        return http::Request(uri).GetRequestText();
+    }
+
+    std::string GetScrapeUrl(const std::string& announce_url)
+    {
+        const char announce[] = "announce";
+        std::string path = announce_url.substr(0, announce_url.find('?'));
+        std::string::size_type slash = path.rfind('/');
+        if (slash == std::string::npos ||
+            path.compare(slash + 1, sizeof(announce) - 1, announce) != 0)
+            return std::string();
+
+        std::string scrape_url = announce_url;
+        scrape_url.replace(slash + 1, sizeof(announce) - 1, "scrape");
+        return scrape_url;
+    }
+
+    // a kept alive connection to a tracker host, it has at most one
+    // request in flight
+    class BitHttpTracker::Connection : private NotCopyable
+    {
+    public:
+        typedef BitNetProcessor<http::ResponseUnpackRuler, Connection> NetProcessor;
+
+        Connection(BitHttpTracker& tracker, const std::string& host_key)
+            : tracker_(tracker),
+              host_key_(host_key),
+              connected_(false),
+              served_count_(0),
+              request_time_(0),
+              idle_time_(Now())
+        {
+        }
+
+        ~Connection()
+        {
+            Close();
+        }
+
+        void Connect(unsigned long ip, unsigned short port,
+                     const RequestIds& request_ids, const std::string& text)
+        {
+            request_ids_ = request_ids;
+            pending_text_ = text;
+            request_time_ = Now();
+
+            net_processor_.reset(new NetProcessor(tracker_.io_service_, this));
+            net_processor_->Connect(net::Address(ip), net::Port(port));
+        }
+
+        void SendRequest(const RequestIds& request_ids, const std::string& text)
+        {
+            assert(IsIdle());
+            request_ids_ = request_ids;
+            request_time_ = Now();
+            net_processor_->Send(text.data(), text.size());
+        }
+
+        RequestIds TakeRequests()
+        {
+            RequestIds request_ids;
+            request_ids.swap(request_ids_);
+            return request_ids;
+        }
+
+        void Close()
+        {
+            if (net_processor_)
+            {
+                net_processor_->ClearConnection();
+                net_processor_->Close();
+                net_processor_.reset();
+            }
+        }
+
+        bool IsIdle() const
+            { return connected_ && request_ids_.empty(); }
+        bool IsConnected() const
+            { return connected_; }
+        bool HasRequest() const
+            { return !request_ids_.empty(); }
+        int GetServedCount() const
+            { return served_count_; }
+        NormalTimeType GetRequestTime() const
+            { return request_time_; }
+        NormalTimeType GetIdleTime() const
+            { return idle_time_; }
+        const std::string& GetHostKey() const
+            { return host_key_; }
+
+        void ProcessProtocol(const char *data, std::size_t size)
+        {
+            ++served_count_;
+            idle_time_ = Now();
+            tracker_.OnResponse(this, data, size);
+        }
+
+        void OnConnect()
+        {
+            connected_ = true;
+            idle_time_ = Now();
+            net_processor_->Send(pending_text_.data(), pending_text_.size());
+            pending_text_.clear();
+        }
+
+        void OnDisconnect()
+        {
+            tracker_.OnClosed(this);
+        }
+
+    private:
+        BitHttpTracker& tracker_;
+        std::string host_key_;
+        std::tr1::shared_ptr<NetProcessor> net_processor_;
+        bool connected_;
+        // responses received on this connection
+        int served_count_;
+        RequestIds request_ids_;
+        // request text sent after connected
+        std::string pending_text_;
+        NormalTimeType request_time_;
+        NormalTimeType idle_time_;
+    };
+
+    BitHttpTracker::BitHttpTracker(net::IoService& io_service)
+        : io_service_(io_service),
+          next_request_id_(1),
+          dispatching_(false)
+    {
+        process_timer_.SetCallback(std::tr1::bind(&BitHttpTracker::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&process_timer_);
+        process_timer_.SetDeadline(process_interval);
+    }
+
+    BitHttpTracker::~BitHttpTracker()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&process_timer_);
+
+        for (Hosts::iterator it = hosts_.begin(); it != hosts_.end(); ++it)
+        {
+            Connections& connections = it->second.connections;
+            for (Connections::iterator c = connections.begin(); c != connections.end(); ++c)
+                (*c)->Close();
+        }
+    }
+
+    unsigned long BitHttpTracker::Announce(const std::string& url,
+                                           const HttpAnnounceRequest& request,
+                                           const AnnounceCallback& callback)
+    {
+        RequestState state;
+        state.text = EncodeHttpAnnounceRequest(url, request);
+        state.announce_callback = callback;
+        return AddRequest(url, state);
+    }
+
+    unsigned long BitHttpTracker::Scrape(const std::string& url,
+                                         const std::vector<Sha1Value>& info_hashes,
+                                         const ScrapeCallback& callback)
+    {
+        std::string scrape_url = GetScrapeUrl(url);
+        if (scrape_url.empty() || info_hashes.empty())
+            return 0;
+
+        RequestState state;
+        state.is_scrape = true;
+        state.text = scrape_url;
+        state.info_hashes = info_hashes;
+        state.scrape_callback = callback;
+        return AddRequest(url, state);
+    }
+
+    void BitHttpTracker::Cancel(unsigned long request_id)
+    {
+        // the id in host queue or connection is skipped when it is not
+        // in requests_
+        requests_.erase(request_id);
+    }
+
+    std::size_t BitHttpTracker::GetConnectionCount() const
+    {
+        std::size_t count = 0;
+        for (Hosts::const_iterator it = hosts_.begin(); it != hosts_.end(); ++it)
+            count += it->second.connections.size();
+        return count;
+    }
+
+    unsigned long BitHttpTracker::AddRequest(const std::string& url,
+                                             RequestState& state)
+    {
+        http::URI uri(url);
+        std::string service = uri.GetPort();
+        if (service.empty())
+            service = default_http_port;
+        state.host_key = uri.GetHost() + ":" + service;
+
+        unsigned long request_id = next_request_id_++;
+        if (next_request_id_ == 0)
+            next_request_id_ = 1;
+        requests_[request_id] = state;
+
+        HostState& host = hosts_[state.host_key];
+        if (host.host.empty())
+        {
+            host.host = uri.GetHost();
+            host.service = service;
+        }
+
+        host.queue.push_back(request_id);
+        Dispatch(state.host_key);
+        return request_id;
+    }
+
+    void BitHttpTracker::OnTimer()
+    {
+        process_timer_.SetDeadline(process_interval);
+        closed_connections_.clear();
+
+        RequestIds failed_requests;
+        failed_requests.swap(failed_requests_);
+        for (std::size_t i = 0; i < failed_requests.size(); ++i)
+            FailRequest(failed_requests[i]);
+
+        NormalTimeType now = Now();
+        std::vector<std::string> timeout_hosts;
+        for (Hosts::iterator it = hosts_.begin(); it != hosts_.end(); ++it)
+        {
+            Connections& connections = it->second.connections;
+            bool timeout = false;
+            for (Connections::iterator c = connections.begin(); c != connections.end(); ++c)
+            {
+                if (((*c)->HasRequest() && now - (*c)->GetRequestTime() >= request_timeout) ||
+                    (!(*c)->HasRequest() && now - (*c)->GetIdleTime() >= idle_timeout))
+                    timeout = true;
+            }
+
+            if (timeout)
+                timeout_hosts.push_back(it->first);
+        }
+
+        for (std::size_t i = 0; i < timeout_hosts.size(); ++i)
+        {
+            // copy the list, callbacks of failed requests may change it
+            Connections connections = hosts_[timeout_hosts[i]].connections;
+            for (Connections::iterator c = connections.begin(); c != connections.end(); ++c)
+            {
+                Connection *connection = c->get();
+                if (connection->HasRequest())
+                {
+                    if (now - connection->GetRequestTime() < request_timeout)
+                        continue;
+
+                    RequestIds ids = connection->TakeRequests();
+                    CloseConnection(timeout_hosts[i], connection);
+                    for (std::size_t j = 0; j < ids.size(); ++j)
+                        FailRequest(ids[j]);
+                }
+                else if (now - connection->GetIdleTime() >= idle_timeout)
+                {
+                    CloseConnection(timeout_hosts[i], connection);
+                }
+            }
+
+            Dispatch(timeout_hosts[i]);
+        }
+    }
+
+    void BitHttpTracker::Resolve(HostState& host)
+    {
+        net::ServicePtr<net::ResolveService> address_resolver_ptr(io_service_);
+        assert(address_resolver_ptr);
+        net::ResolveHint hint(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        host.resolving = true;
+        address_resolver_ptr->AsyncResolve(host.host, host.service, hint,
+                std::tr1::bind(&BitHttpTracker::ResolveHandler, this, _1, _2, _3));
+    }
+
+    void BitHttpTracker::ResolveHandler(const std::string& nodename,
+                                        const std::string& servname,
+                                        const net::ResolveResult& result)
+    {
+        std::string host_key = nodename + ":" + servname;
+        Hosts::iterator hit = hosts_.find(host_key);
+        if (hit == hosts_.end())
+            return ;
+
+        HostState& host = hit->second;
+        host.resolving = false;
+
+        std::vector<unsigned long> ips;
+        unsigned short port = 0;
+        for (net::ResolveResult::iterator it = result.begin(); it != result.end(); ++it)
+        {
+            if (!it->ai_addr)
+                continue;
+
+            const sockaddr_in *addr = reinterpret_cast<const sockaddr_in *>(it->ai_addr);
+            ips.push_back(net::NetToHostl(addr->sin_addr.s_addr));
+            port = net::NetToHosts(addr->sin_port);
+        }
+
+        if (!ips.empty())
+        {
+            host.ips.swap(ips);
+            host.ip_index = 0;
+            host.port = port;
+            if (host.port == 0)
+                host.port = static_cast<unsigned short>(atoi(host.service.c_str()));
+            host.resolve_time = Now();
+        }
+        else if (host.ips.empty())
+        {
+            // the host can not be resolved, fail all requests of it
+            std::deque<unsigned long> queue;
+            queue.swap(host.queue);
+            for (std::size_t i = 0; i < queue.size(); ++i)
+                FailRequest(queue[i]);
+            return ;
+        }
+
+        Dispatch(host_key);
+    }
+
+    void BitHttpTracker::Dispatch(const std::string& host_key)
+    {
+        // a connection may be closed or a request may be added in
+        // dispatching, the loop sees them
+        if (dispatching_)
+            return ;
+        dispatching_ = true;
+
+        for (;;)
+        {
+            HostState& host = hosts_[host_key];
+            if (host.queue.empty())
+                break;
+
+            // an expired address is used until the host is resolved again
+            if (!host.resolving &&
+                (host.ips.empty() || Now() - host.resolve_time >= resolve_timeout))
+                Resolve(host);
+            if (host.ips.empty())
+                break;
+
+            Connection *idle = 0;
+            for (Connections::iterator it = host.connections.begin();
+                    it != host.connections.end(); ++it)
+            {
+                if ((*it)->IsIdle())
+                {
+                    idle = it->get();
+                    break;
+                }
+            }
+
+            if (!idle && host.connections.size() >= max_host_connections)
+                break;
+
+            std::string text;
+            RequestIds ids = TakeNextRequest(host, &text);
+            if (ids.empty())
+                continue;
+
+            if (idle)
+            {
+                idle->SendRequest(ids, text);
+            }
+            else
+            {
+                ConnectionPtr connection(new Connection(*this, host_key));
+                host.connections.push_back(connection);
+                connection->Connect(host.ips[host.ip_index], host.port, ids, text);
+            }
+        }
+
+        dispatching_ = false;
+    }
+
+    BitHttpTracker::RequestIds BitHttpTracker::TakeNextRequest(HostState& host,
+                                                               std::string *text)
+    {
+        RequestIds ids;
+        Requests::iterator it = requests_.end();
+        while (!host.queue.empty() && it == requests_.end())
+        {
+            it = requests_.find(host.queue.front());
+            host.queue.pop_front();
+        }
+
+        if (it == requests_.end())
+            return ids;
+
+        ids.push_back(it->first);
+        if (!it->second.is_scrape)
+        {
+            *text = it->second.text;
+            return ids;
+        }
+
+        // merge queued scrapes of the same scrape url
+        const std::string& scrape_url = it->second.text;
+        std::vector<Sha1Value> info_hashes = it->second.info_hashes;
+        std::deque<unsigned long>::iterator q = host.queue.begin();
+        while (q != host.queue.end())
+        {
+            Requests::iterator other = requests_.find(*q);
+            if (other != requests_.end() && other->second.is_scrape &&
+                other->second.text == scrape_url &&
+                info_hashes.size() + other->second.info_hashes.size() <= max_scrape_hashes)
+            {
+                ids.push_back(other->first);
+                info_hashes.insert(info_hashes.end(),
+                        other->second.info_hashes.begin(),
+                        other->second.info_hashes.end());
+                q = host.queue.erase(q);
+            }
+            else
+            {
+                ++q;
+            }
+        }
+
+        *text = EncodeHttpScrapeRequest(scrape_url, info_hashes);
+        return ids;
+    }
+
+    void BitHttpTracker::OnResponse(Connection *connection,
+                                    const char *data, std::size_t size)
+    {
+        RequestIds ids = connection->TakeRequests();
+        std::string host_key = connection->GetHostKey();
+
+        std::tr1::shared_ptr<http::Response> response;
+        try
+        {
+            response.reset(new http::Response(data, size));
+        }
+        catch (const http::ResponseException&)
+        {
+        }
+
+        if (!response || !response->IsKeepAlive())
+            CloseConnection(host_key, connection);
+
+        CompleteRequests(ids, response.get());
+        Dispatch(host_key);
+    }
+
+    void BitHttpTracker::OnClosed(Connection *connection)
+    {
+        std::string host_key = connection->GetHostKey();
+        RequestIds ids = connection->TakeRequests();
+        // the tracker closes a kept alive connection when we send a
+        // request on it, the request is sent again on a new connection
+        bool reused = connection->GetServedCount() > 0;
+        bool connected = connection->IsConnected();
+        CloseConnection(host_key, connection);
+
+        // the address can not be connected, next connection tries the
+        // next address of the host
+        HostState& host = hosts_[host_key];
+        if (!connected && !host.ips.empty())
+            host.ip_index = (host.ip_index + 1) % host.ips.size();
+        for (RequestIds::reverse_iterator it = ids.rbegin(); it != ids.rend(); ++it)
+        {
+            Requests::iterator request = requests_.find(*it);
+            if (request == requests_.end())
+                continue;
+
+            if (reused && !request->second.retried)
+            {
+                request->second.retried = true;
+                host.queue.push_front(*it);
+            }
+            else
+            {
+                failed_requests_.push_back(*it);
+            }
+        }
+
+        Dispatch(host_key);
+    }
+
+    void BitHttpTracker::CompleteRequests(const RequestIds& ids,
+                                          const http::Response *response)
+    {
+        bool scrape_parsed = false;
+        bool scrape_success = false;
+        bentypes::ScrapeResponse::FilesInfo files_info;
+
+        for (std::size_t i = 0; i < ids.size(); ++i)
+        {
+            Requests::iterator it = requests_.find(ids[i]);
+            if (it == requests_.end())
+                continue;
+
+            RequestState state = it->second;
+            requests_.erase(it);
+
+            if (state.is_scrape)
+            {
+                if (!scrape_parsed)
+                {
+                    scrape_success = ParseScrapeResponse(response, &files_info);
+                    scrape_parsed = true;
+                }
+
+                if (state.scrape_callback)
+                    state.scrape_callback(scrape_success, files_info);
+            }
+            else
+            {
+                HttpTrackerResponse result;
+                bool success = ParseAnnounceResponse(response, &result);
+                if (state.announce_callback)
+                    state.announce_callback(success, result);
+            }
+        }
+    }
+
+    void BitHttpTracker::FailRequest(unsigned long request_id)
+    {
+        Requests::iterator it = requests_.find(request_id);
+        if (it == requests_.end())
+            return ;
+
+        RequestState state = it->second;
+        requests_.erase(it);
+
+        if (state.is_scrape)
+        {
+            if (state.scrape_callback)
+                state.scrape_callback(false, bentypes::ScrapeResponse::FilesInfo());
+        }
+        else
+        {
+            if (state.announce_callback)
+                state.announce_callback(false, HttpTrackerResponse());
+        }
+    }
+
+    void BitHttpTracker::CloseConnection(const std::string& host_key,
+                                         Connection *connection)
+    {
+        connection->Close();
+
+        Connections& connections = hosts_[host_key].connections;
+        for (Connections::iterator it = connections.begin(); it != connections.end(); ++it)
+        {
+            if (it->get() == connection)
+            {
+                closed_connections_.push_back(*it);
+                connections.erase(it);
+                break;
+            }
+        }
+    }
+
+} // namespace core
+} // namespace bitwave
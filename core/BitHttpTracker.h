@@ -0,0 +1,206 @@
+#ifndef BIT_HTTP_TRACKER_H
+#define BIT_HTTP_TRACKER_H
+
+#include "bencode/TrackerResponse.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../net/ResolveService.h"
+#include "../protocol/Response.h"
+#include "../sha1/Sha1Value.h"
+#include "../timer/Timer.h"
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    struct HttpAnnounceRequest
+    {
+        enum Event
+        {
+            NONE,
+            COMPLETED,
+            STARTED,
+            STOPPED
+        };
+
+        HttpAnnounceRequest()
+            : downloaded(0),
+              left(0),
+              uploaded(0),
+              event(NONE),
+              num_want(200),
+              port(0)
+        {
+        }
+
+        Sha1Value info_hash;
+        std::string peer_id;
+        long long downloaded;
+        long long left;
+        long long uploaded;
+        int event;
+        int num_want;
+        unsigned short port;
+    };
+
+    struct HttpTrackerResponse
+    {
+        HttpTrackerResponse()
+            : interval(0)
+        {
+        }
+
+        int interval;
+        std::vector<bentypes::TrackerResponse::PeerInfo> peers;
+        std::string failure_reason;
+    };
+
+    // text of a GET request of the announce url
+    std::string EncodeHttpAnnounceRequest(const std::string& url,
+                                          const HttpAnnounceRequest& request);
+    // text of a GET request to scrape all info hashes in one request
+    std::string EncodeHttpScrapeRequest(const std::string& scrape_url,
+                                        const std::vector<Sha1Value>& info_hashes);
+    // scrape url of an announce url, the last path component "announce"
+    // is replaced by "scrape", return an empty string when the tracker
+    // does not support scrape
+    std::string GetScrapeUrl(const std::string& announce_url);
+
+    // http tracker client of all tasks. Connections are kept alive and
+    // pooled per tracker host, at most max_host_connections of a host, and
+    // announces to the same host are queued and sent one by one on them,
+    // so starting many tasks does not connect to a tracker many times.
+    // Addresses of a host are resolved once and cached for all tasks, the
+    // next address is used when a connect fails. Queued scrapes of the
+    // same scrape url are sent in one request of many info hashes, at
+    // most max_scrape_hashes
+    class BitHttpTracker : private NotCopyable
+    {
+    public:
+        // response is valid when success is true, the failure reason is in
+        // response when the tracker returns a failure
+        typedef std::tr1::function<void (bool, const HttpTrackerResponse&)> AnnounceCallback;
+        // files info has all info hashes of the request when success
+        typedef std::tr1::function<void (bool,
+                const bentypes::ScrapeResponse::FilesInfo&)> ScrapeCallback;
+
+        static const std::size_t max_host_connections = 2;
+        static const std::size_t max_scrape_hashes = 64;
+        static const NormalTimeType request_timeout = 30 * 1000;
+        static const NormalTimeType idle_timeout = 60 * 1000;
+        static const NormalTimeType resolve_timeout = 30 * 60 * 1000;
+        static const int process_interval = 1000;
+
+        explicit BitHttpTracker(net::IoService& io_service);
+        ~BitHttpTracker();
+
+        // announce to the url, return an id of the request to cancel it
+        unsigned long Announce(const std::string& url,
+                               const HttpAnnounceRequest& request,
+                               const AnnounceCallback& callback);
+
+        // scrape info hashes of the tracker of the announce url, return 0
+        // when the tracker does not support scrape
+        unsigned long Scrape(const std::string& url,
+                             const std::vector<Sha1Value>& info_hashes,
+                             const ScrapeCallback& callback);
+
+        // the callback of the request will not be called
+        void Cancel(unsigned long request_id);
+
+        std::size_t GetPendingCount() const
+            { return requests_.size(); }
+
+        // connections of all hosts, for statistic and test
+        std::size_t GetConnectionCount() const;
+
+    private:
+        class Connection;
+        friend class Connection;
+        typedef std::tr1::shared_ptr<Connection> ConnectionPtr;
+        typedef std::list<ConnectionPtr> Connections;
+        typedef std::vector<unsigned long> RequestIds;
+
+        struct RequestState
+        {
+            RequestState()
+                : is_scrape(false),
+                  retried(false)
+            {
+            }
+
+            std::string host_key;
+            bool is_scrape;
+            // a request on a kept alive connection may be closed by the
+            // tracker at the same time, it is sent again once
+            bool retried;
+            // request text of announce, or scrape url of scrape
+            std::string text;
+            std::vector<Sha1Value> info_hashes;
+            AnnounceCallback announce_callback;
+            ScrapeCallback scrape_callback;
+        };
+
+        struct HostState
+        {
+            HostState()
+                : ip_index(0),
+                  port(0),
+                  resolving(false),
+                  resolve_time(0)
+            {
+            }
+
+            std::string host;
+            std::string service;
+            // resolved addresses in host byte order, connections use the
+            // address of ip_index, it is empty when the host is unresolved
+            std::vector<unsigned long> ips;
+            std::size_t ip_index;
+            unsigned short port;
+            bool resolving;
+            NormalTimeType resolve_time;
+            std::deque<unsigned long> queue;
+            Connections connections;
+        };
+
+        typedef std::map<unsigned long, RequestState> Requests;
+        typedef std::map<std::string, HostState> Hosts;
+
+        unsigned long AddRequest(const std::string& url, RequestState& state);
+        void OnTimer();
+        void Resolve(HostState& host);
+        void ResolveHandler(const std::string& nodename,
+                            const std::string& servname,
+                            const net::ResolveResult& result);
+        void Dispatch(const std::string& host_key);
+        RequestIds TakeNextRequest(HostState& host, std::string *text);
+        void OnResponse(Connection *connection, const char *data, std::size_t size);
+        void OnClosed(Connection *connection);
+        void CompleteRequests(const RequestIds& ids, const http::Response *response);
+        void FailRequest(unsigned long request_id);
+        void CloseConnection(const std::string& host_key, Connection *connection);
+
+        net::IoService& io_service_;
+        Timer process_timer_;
+        Requests requests_;
+        Hosts hosts_;
+        // connections are closed in their callbacks, they are freed on timer
+        std::vector<ConnectionPtr> closed_connections_;
+        // a connect may fail in Announce, requests of closed connections
+        // fail on timer, so a callback is not called before Announce returns
+        RequestIds failed_requests_;
+        unsigned long next_request_id_;
+        bool dispatching_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_HTTP_TRACKER_H
@@ -0,0 +1,195 @@
+#include "BitMagnet.h"
+#include "../sha1/NetSha1Value.h"
+#include <assert.h>
+#include <stdlib.h>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        const char magnet_prefix[] = "magnet:?";
+        const char btih_prefix[] = "urn:btih:";
+        const std::size_t info_hash_size = 20;
+
+        int HexValue(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        }
+
+        int Base32Value(char c)
+        {
+            if (c >= 'A' && c <= 'Z')
+                return c - 'A';
+            if (c >= 'a' && c <= 'z')
+                return c - 'a';
+            if (c >= '2' && c <= '7')
+                return c - '2' + 26;
+            return -1;
+        }
+
+        // decode %XX and '+' of a parameter value
+        std::string UrlDecode(const std::string& value)
+        {
+            std::string result;
+            result.reserve(value.size());
+            for (std::size_t i = 0; i < value.size(); ++i)
+            {
+                if (value[i] == '%' && i + 2 < value.size() &&
+                    HexValue(value[i + 1]) >= 0 && HexValue(value[i + 2]) >= 0)
+                {
+                    result.push_back(static_cast<char>(
+                        HexValue(value[i + 1]) * 16 + HexValue(value[i + 2])));
+                    i += 2;
+                }
+                else if (value[i] == '+')
+                {
+                    result.push_back(' ');
+                }
+                else
+                {
+                    result.push_back(value[i]);
+                }
+            }
+            return result;
+        }
+
+        bool DecodeHex(const std::string& hex, char *bytes)
+        {
+            if (hex.size() != 2 * info_hash_size)
+                return false;
+
+            for (std::size_t i = 0; i < info_hash_size; ++i)
+            {
+                int high = HexValue(hex[2 * i]);
+                int low = HexValue(hex[2 * i + 1]);
+                if (high < 0 || low < 0)
+                    return false;
+                bytes[i] = static_cast<char>(high * 16 + low);
+            }
+            return true;
+        }
+
+        bool DecodeBase32(const std::string& base32, char *bytes)
+        {
+            // 32 characters of 5 bits are 20 bytes
+            if (base32.size() * 5 != info_hash_size * 8)
+                return false;
+
+            unsigned int bits = 0;
+            int bit_count = 0;
+            std::size_t index = 0;
+            for (std::size_t i = 0; i < base32.size(); ++i)
+            {
+                int value = Base32Value(base32[i]);
+                if (value < 0)
+                    return false;
+
+                bits = (bits << 5) | value;
+                bit_count += 5;
+                if (bit_count >= 8)
+                {
+                    bit_count -= 8;
+                    bytes[index++] = static_cast<char>(bits >> bit_count);
+                }
+            }
+            assert(index == info_hash_size);
+            return true;
+        }
+
+        // "a.b.c.d:port" to host byte order ip and port
+        bool ParsePeerAddress(const std::string& value,
+                              MagnetLink::PeerAddress *address)
+        {
+            unsigned long ip = 0;
+            const char *p = value.c_str();
+            for (int i = 0; i < 4; ++i)
+            {
+                char *end = 0;
+                long part = strtol(p, &end, 10);
+                if (end == p || part < 0 || part > 255)
+                    return false;
+                if (*end != (i == 3 ? ':' : '.'))
+                    return false;
+                ip = (ip << 8) | part;
+                p = end + 1;
+            }
+
+            char *end = 0;
+            long port = strtol(p, &end, 10);
+            if (end == p || *end != '\0' || port <= 0 || port > 65535)
+                return false;
+
+            address->first = ip;
+            address->second = static_cast<unsigned short>(port);
+            return true;
+        }
+
+    } // unnamed namespace
+
+    bool ParseMagnetLink(const std::string& uri, MagnetLink *magnet)
+    {
+        assert(magnet);
+        const std::size_t prefix_len = sizeof(magnet_prefix) - 1;
+        if (uri.compare(0, prefix_len, magnet_prefix) != 0)
+            return false;
+
+        bool has_info_hash = false;
+        std::size_t begin = prefix_len;
+        while (begin < uri.size())
+        {
+            std::size_t end = uri.find('&', begin);
+            if (end == std::string::npos)
+                end = uri.size();
+
+            std::string param = uri.substr(begin, end - begin);
+            begin = end + 1;
+
+            std::size_t equal = param.find('=');
+            if (equal == std::string::npos)
+                continue;
+
+            std::string key = param.substr(0, equal);
+            std::string value = UrlDecode(param.substr(equal + 1));
+
+            if (key == "xt")
+            {
+                const std::size_t btih_len = sizeof(btih_prefix) - 1;
+                if (value.compare(0, btih_len, btih_prefix) != 0)
+                    continue;
+
+                std::string hash = value.substr(btih_len);
+                char bytes[info_hash_size];
+                if (!DecodeHex(hash, bytes) && !DecodeBase32(hash, bytes))
+                    return false;
+
+                magnet->info_hash = NetStreamToSha1Value(bytes);
+                has_info_hash = true;
+            }
+            else if (key == "dn")
+            {
+                magnet->name = value;
+            }
+            else if (key == "tr")
+            {
+                magnet->trackers.push_back(value);
+            }
+            else if (key == "x.pe")
+            {
+                MagnetLink::PeerAddress address;
+                if (ParsePeerAddress(value, &address))
+                    magnet->peers.push_back(address);
+            }
+        }
+
+        return has_info_hash;
+    }
+
+} // namespace core
+} // namespace bitwave
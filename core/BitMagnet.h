@@ -0,0 +1,33 @@
+#ifndef BIT_MAGNET_H
+#define BIT_MAGNET_H
+
+#include "../sha1/Sha1Value.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // a magnet link of BitTorrent (BEP 9), such as
+    // magnet:?xt=urn:btih:<info hash>&dn=<name>&tr=<tracker>&x.pe=<ip:port>
+    struct MagnetLink
+    {
+        // ip and port in host byte order
+        typedef std::pair<unsigned long, unsigned short> PeerAddress;
+
+        Sha1Value info_hash;
+        std::string name;
+        std::vector<std::string> trackers;
+        std::vector<PeerAddress> peers;
+    };
+
+    // parse a magnet uri, info hash is 40 hex digits or 32 base32
+    // characters, return false when the uri is not a BitTorrent magnet
+    // link. Unknown parameters are ignored
+    bool ParseMagnetLink(const std::string& uri, MagnetLink *magnet);
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_MAGNET_H
@@ -0,0 +1,82 @@
+#include "BitMappedFile.h"
+#include "../base/StringConv.h"
+
+namespace bitwave {
+namespace core {
+
+    BitMappedFile::BitMappedFile(const std::string& path)
+        : open_(false),
+          file_(INVALID_HANDLE_VALUE),
+          mapping_(0),
+          data_(0),
+          size_(0)
+    {
+        Map(path);
+    }
+
+    BitMappedFile::~BitMappedFile()
+    {
+        Unmap();
+    }
+
+    void BitMappedFile::Map(const std::string& path)
+    {
+        if (path.empty())
+            return ;
+
+        file_ = ::CreateFileW(UTF8ToUnicode(path).c_str(), GENERIC_READ,
+                FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return ;
+
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(file_, &size) || size.QuadPart < 0 ||
+            static_cast<unsigned long long>(size.QuadPart) > static_cast<std::size_t>(-1))
+        {
+            Unmap();
+            return ;
+        }
+
+        // a mapping of an empty file can not be created
+        if (size.QuadPart == 0)
+        {
+            open_ = true;
+            return ;
+        }
+
+        mapping_ = ::CreateFileMapping(file_, 0, PAGE_READONLY, 0, 0, 0);
+        if (!mapping_)
+        {
+            Unmap();
+            return ;
+        }
+
+        data_ = static_cast<const char *>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_)
+        {
+            Unmap();
+            return ;
+        }
+
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        open_ = true;
+    }
+
+    void BitMappedFile::Unmap()
+    {
+        if (data_)
+            ::UnmapViewOfFile(data_);
+        if (mapping_)
+            ::CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            ::CloseHandle(file_);
+
+        open_ = false;
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = 0;
+        data_ = 0;
+        size_ = 0;
+    }
+
+} // namespace core
+} // namespace bitwave
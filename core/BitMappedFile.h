@@ -0,0 +1,44 @@
+#ifndef BIT_MAPPED_FILE_H
+#define BIT_MAPPED_FILE_H
+
+#include "../base/BaseTypes.h"
+#include <string>
+#include <Windows.h>
+
+namespace bitwave {
+namespace core {
+
+    // a read only view of a whole file mapped into memory, pages are read
+    // by the system when they are touched and no copy of the file is
+    // made. An empty file is open with no data
+    class BitMappedFile : private NotCopyable
+    {
+    public:
+        // path is encoded by UTF-8
+        explicit BitMappedFile(const std::string& path);
+        ~BitMappedFile();
+
+        bool IsOpen() const
+            { return open_; }
+
+        const char * GetData() const
+            { return data_; }
+
+        std::size_t GetSize() const
+            { return size_; }
+
+    private:
+        void Map(const std::string& path);
+        void Unmap();
+
+        bool open_;
+        HANDLE file_;
+        HANDLE mapping_;
+        const char *data_;
+        std::size_t size_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_MAPPED_FILE_H
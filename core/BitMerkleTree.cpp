@@ -0,0 +1,125 @@
+#include "BitMerkleTree.h"
+#include <assert.h>
+#include <string.h>
+
+namespace bitwave {
+namespace core {
+
+    // static
+    Sha256Value BitMerkleTree::HashBlock(const char *data, std::size_t length)
+    {
+        assert(length <= block_size);
+        return Sha256Value(data, length);
+    }
+
+    // static
+    Sha256Value BitMerkleTree::HashPair(const Sha256Value& left,
+                                        const Sha256Value& right)
+    {
+        char pair[64];
+        memcpy(pair, left.GetData(), 32);
+        memcpy(pair + 32, right.GetData(), 32);
+        return Sha256Value(pair, sizeof(pair));
+    }
+
+    // static
+    Sha256Value BitMerkleTree::PadHash(std::size_t layer)
+    {
+        Sha256Value pad;
+        for (std::size_t i = 0; i < layer; ++i)
+            pad = HashPair(pad, pad);
+        return pad;
+    }
+
+    // static
+    Sha256Value BitMerkleTree::Root(const Sha256Value *hashes,
+                                    std::size_t count,
+                                    std::size_t width,
+                                    std::size_t layer)
+    {
+        assert(count <= width && RoundUpPower2(width) == width);
+        Sha256Value pad = PadHash(layer);
+        if (count == 0)
+        {
+            for (; width > 1; width /= 2)
+                pad = HashPair(pad, pad);
+            return pad;
+        }
+
+        // hashes of the next layer are made in place, only the hashes
+        // which are not padding are kept
+        std::vector<Sha256Value> current(hashes, hashes + count);
+        for (; width > 1; width /= 2)
+        {
+            std::size_t next = (current.size() + 1) / 2;
+            for (std::size_t i = 0; i < next; ++i)
+            {
+                const Sha256Value& right = 2 * i + 1 < current.size() ?
+                    current[2 * i + 1] : pad;
+                current[i] = HashPair(current[2 * i], right);
+            }
+            current.resize(next);
+            pad = HashPair(pad, pad);
+        }
+
+        return current[0];
+    }
+
+    // static
+    void BitMerkleTree::GetProof(const std::vector<Sha256Value>& hashes,
+                                 std::size_t width,
+                                 std::size_t layer,
+                                 std::size_t index,
+                                 std::size_t proof_layers,
+                                 std::vector<Sha256Value>& proof)
+    {
+        assert(hashes.size() <= width && index < width);
+        Sha256Value pad = PadHash(layer);
+        std::vector<Sha256Value> current(hashes);
+        for (; proof_layers > 0 && width > 1; --proof_layers, width /= 2)
+        {
+            std::size_t uncle = index ^ 1;
+            proof.push_back(uncle < current.size() ? current[uncle] : pad);
+
+            std::size_t next = (current.size() + 1) / 2;
+            for (std::size_t i = 0; i < next; ++i)
+            {
+                const Sha256Value& right = 2 * i + 1 < current.size() ?
+                    current[2 * i + 1] : pad;
+                current[i] = HashPair(current[2 * i], right);
+            }
+            current.resize(next);
+            pad = HashPair(pad, pad);
+            index /= 2;
+        }
+    }
+
+    // static
+    std::size_t BitMerkleTree::BlockCount(long long length)
+    {
+        return static_cast<std::size_t>((length + block_size - 1) / block_size);
+    }
+
+    // static
+    std::size_t BitMerkleTree::RoundUpPower2(std::size_t count)
+    {
+        std::size_t power2 = 1;
+        while (power2 < count)
+            power2 *= 2;
+        return power2;
+    }
+
+    // static
+    std::size_t BitMerkleTree::Log2(std::size_t power2)
+    {
+        std::size_t log = 0;
+        while (power2 > 1)
+        {
+            power2 /= 2;
+            ++log;
+        }
+        return log;
+    }
+
+} // namespace core
+} // namespace bitwave
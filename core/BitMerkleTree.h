@@ -0,0 +1,57 @@
+#ifndef BIT_MERKLE_TREE_H
+#define BIT_MERKLE_TREE_H
+
+#include "../sha256/Sha256Value.h"
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // merkle trees of files of BEP 52. Leaves are SHA-256 of 16KB blocks
+    // of a file, leaves beyond the end of the file are zeros, then a
+    // layer is the hash of pairs of the layer below. Layer 0 is the
+    // leaves, the piece layer is log2(piece length / 16KB)
+    class BitMerkleTree
+    {
+    public:
+        static const std::size_t block_size = 16 * 1024;
+
+        // hash of a block, the last block of a file may be short
+        static Sha256Value HashBlock(const char *data, std::size_t length);
+
+        static Sha256Value HashPair(const Sha256Value& left,
+                                    const Sha256Value& right);
+
+        // root of a subtree of all padding hashes whose height is layer
+        static Sha256Value PadHash(std::size_t layer);
+
+        // root of count hashes of layer, they are padded to width which is
+        // a power of 2 and not less than count
+        static Sha256Value Root(const Sha256Value *hashes,
+                                std::size_t count,
+                                std::size_t width,
+                                std::size_t layer = 0);
+
+        // uncle hashes of the subtree at index of layer up proof_layers
+        // layers, hashes are the whole layer and padded to width
+        static void GetProof(const std::vector<Sha256Value>& hashes,
+                             std::size_t width,
+                             std::size_t layer,
+                             std::size_t index,
+                             std::size_t proof_layers,
+                             std::vector<Sha256Value>& proof);
+
+        // blocks of length bytes
+        static std::size_t BlockCount(long long length);
+
+        // the least power of 2 which is not less than count
+        static std::size_t RoundUpPower2(std::size_t count);
+
+        // log2 of a power of 2
+        static std::size_t Log2(std::size_t power2);
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_MERKLE_TREE_H
@@ -0,0 +1,250 @@
+#include "BitMetadataConnection.h"
+#include "BitMetadataFetcher.h"
+#include "BitException.h"
+#include "BitUtMetadata.h"
+#include "bencode/BenTypes.h"
+#include "../net/NetHelper.h"
+#include "../sha1/NetSha1Value.h"
+#include <assert.h>
+#include <string.h>
+#include <sstream>
+
+namespace {
+
+    const char protocol_string[] = "BitTorrent protocol";
+    const std::size_t protocol_string_len = sizeof(protocol_string) - 1;
+    const std::size_t protocol_reserved = 8;
+    const std::size_t handshake_size = 49 + protocol_string_len;
+    // extension protocol bit of the sixth reserved byte
+    const std::size_t extension_protocol_byte = 5;
+    const char extension_protocol_flag = 0x10;
+
+    // EXTENDED message, id of extended handshake, and local message id
+    // of ut_metadata
+    const char extended_message = 20;
+    const char extended_handshake_id = 0;
+    const char ut_metadata_local_id = 1;
+
+} // unnamed namespace
+
+namespace bitwave {
+namespace core {
+
+    BitMetadataConnection::BitMetadataConnection(const Sha1Value& info_hash,
+                                                 const std::string& peer_id,
+                                                 net::IoService& io_service,
+                                                 BitMetadataFetcher *fetcher)
+        : info_hash_(info_hash),
+          peer_id_(peer_id),
+          fetcher_(fetcher),
+          is_handshaked_(false),
+          ut_metadata_id_(0)
+    {
+        assert(fetcher_);
+        net_processor_.reset(new NetProcessor(io_service, this));
+    }
+
+    BitMetadataConnection::~BitMetadataConnection()
+    {
+        Close();
+    }
+
+    void BitMetadataConnection::Connect(const net::Address& remote_address,
+                                        const net::Port& remote_listen_port)
+    {
+        net_processor_->Connect(remote_address, remote_listen_port);
+    }
+
+    void BitMetadataConnection::RequestPiece(int piece)
+    {
+        assert(ut_metadata_id_ != 0);
+        UtMetadataMessage request;
+        request.type = UtMetadataMessage::REQUEST;
+        request.piece = piece;
+        SendExtendedMessage(ut_metadata_id_, EncodeUtMetadataMessage(request));
+    }
+
+    void BitMetadataConnection::Close()
+    {
+        if (net_processor_)
+        {
+            net_processor_->ClearConnection();
+            net_processor_->Close();
+            net_processor_.reset();
+        }
+    }
+
+    void BitMetadataConnection::ProcessProtocol(const char *data, std::size_t size)
+    {
+        assert(data);
+        if (!net_processor_)
+            return ;
+
+        if (!is_handshaked_)
+        {
+            if (size != handshake_size || !ProcessHandshake(data))
+                DropConnection();
+            return ;
+        }
+
+        assert(size >= sizeof(long));
+        unsigned long length_prefix = net::NetToHostl(
+                *reinterpret_cast<const unsigned long *>(data));
+        data += sizeof(long);
+
+        // only EXTENDED message is processed
+        if (length_prefix > 0 && *data == extended_message)
+            ProcessExtended(data + 1, length_prefix - 1);
+    }
+
+    void BitMetadataConnection::OnConnect()
+    {
+        SendHandshake();
+    }
+
+    void BitMetadataConnection::OnDisconnect()
+    {
+        DropConnection();
+    }
+
+    bool BitMetadataConnection::ProcessHandshake(const char *data)
+    {
+        if (*data != protocol_string_len ||
+            memcmp(data + 1, protocol_string, protocol_string_len) != 0)
+            return false;
+
+        const char *reserved_ptr = data + 1 + protocol_string_len;
+        const char *info_hash_ptr = reserved_ptr + protocol_reserved;
+        if (NetStreamToSha1Value(info_hash_ptr) != info_hash_)
+            return false;
+
+        // metadata can be downloaded by extension protocol only
+        if ((reserved_ptr[extension_protocol_byte] & extension_protocol_flag) == 0)
+            return false;
+
+        is_handshaked_ = true;
+        SendExtendedHandshake();
+        return true;
+    }
+
+    void BitMetadataConnection::ProcessExtended(const char *data, std::size_t len)
+    {
+        if (len == 0)
+        {
+            DropConnection();
+            return ;
+        }
+
+        char id = *data++;
+        --len;
+        if (id == extended_handshake_id)
+        {
+            ProcessExtendedHandshake(data, len);
+        }
+        else if (id == ut_metadata_local_id)
+        {
+            UtMetadataMessage message;
+            if (!ParseUtMetadataMessage(data, len, &message))
+                return ;
+
+            if (message.type == UtMetadataMessage::DATA)
+                fetcher_->OnPieceData(this, message.piece, message.total_size,
+                        message.data, message.data_len);
+            else if (message.type == UtMetadataMessage::REJECT)
+                fetcher_->OnPieceReject(this, message.piece);
+            // we have no metadata, requests are ignored
+        }
+    }
+
+    void BitMetadataConnection::ProcessExtendedHandshake(const char *data,
+                                                         std::size_t len)
+    {
+        using namespace bentypes;
+        if (len == 0)
+        {
+            DropConnection();
+            return ;
+        }
+
+        try
+        {
+            BenTypesStreamBuf buf(data, len);
+            std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+            BenDictionary *handshake = dynamic_cast<BenDictionary *>(object.get());
+            if (!handshake)
+            {
+                DropConnection();
+                return ;
+            }
+
+            BenDictionary *m = handshake->ValueBenTypeCast<BenDictionary>("m");
+            BenInteger *id = m ? m->ValueBenTypeCast<BenInteger>("ut_metadata") : 0;
+            BenInteger *size = handshake->ValueBenTypeCast<BenInteger>("metadata_size");
+            if (!id || id->GetValue() <= 0 || id->GetValue() > 255 ||
+                !size || size->GetValue() <= 0)
+            {
+                // the peer can not give us metadata
+                DropConnection();
+                return ;
+            }
+
+            ut_metadata_id_ = static_cast<char>(id->GetValue());
+            fetcher_->OnPeerReady(this, size->GetValue());
+        }
+        catch (const BenTypeException&)
+        {
+            DropConnection();
+        }
+    }
+
+    void BitMetadataConnection::SendHandshake()
+    {
+        Buffer buffer = net_processor_->GetBuffer(handshake_size);
+
+        char *data = buffer.GetBuffer();
+        memset(data, 0, handshake_size);
+        *data++ = protocol_string_len;
+
+        memcpy(data, protocol_string, protocol_string_len);
+        data += protocol_string_len;
+        data[extension_protocol_byte] |= extension_protocol_flag;
+        data += protocol_reserved;
+
+        Sha1Value info_hash = NetByteOrder(info_hash_);
+        memcpy(data, info_hash.GetData(), info_hash.GetDataSize());
+        data += info_hash.GetDataSize();
+
+        memcpy(data, peer_id_.data(), peer_id_.size());
+        net_processor_->Send(buffer);
+    }
+
+    void BitMetadataConnection::SendExtendedHandshake()
+    {
+        std::ostringstream oss;
+        oss << "d1:md11:ut_metadatai" << static_cast<int>(ut_metadata_local_id) << "eee";
+        SendExtendedMessage(extended_handshake_id, oss.str());
+    }
+
+    void BitMetadataConnection::SendExtendedMessage(char id,
+                                                    const std::string& payload)
+    {
+        std::size_t size = sizeof(int) + 2 * sizeof(char) + payload.size();
+        Buffer buffer = net_processor_->GetBuffer(size);
+        char *data = buffer.GetBuffer();
+        int length_prefix = 2 * sizeof(char) + payload.size();
+        *reinterpret_cast<int *>(data) = net::HostToNeti(length_prefix);
+        data += sizeof(int);
+        *data++ = extended_message;
+        *data++ = id;
+        memcpy(data, payload.data(), payload.size());
+        net_processor_->Send(buffer);
+    }
+
+    void BitMetadataConnection::DropConnection()
+    {
+        Close();
+        fetcher_->OnPeerClosed(this);
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,71 @@
+#ifndef BIT_METADATA_CONNECTION_H
+#define BIT_METADATA_CONNECTION_H
+
+#include "BitNetProcessor.h"
+#include "BitPeerConnection.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../sha1/Sha1Value.h"
+#include <memory>
+#include <string>
+
+namespace bitwave {
+namespace core {
+
+    class BitMetadataFetcher;
+
+    // a connection to a peer of a magnet link task, it only downloads
+    // metadata of the task by ut_metadata (BEP 9). Handshake and extended
+    // handshake are sent after connected, messages of peer wire protocol
+    // are ignored, and ut_metadata messages are passed to the fetcher
+    class BitMetadataConnection : private NotCopyable
+    {
+    public:
+        BitMetadataConnection(const Sha1Value& info_hash,
+                              const std::string& peer_id,
+                              net::IoService& io_service,
+                              BitMetadataFetcher *fetcher);
+
+        ~BitMetadataConnection();
+
+        void Connect(const net::Address& remote_address,
+                     const net::Port& remote_listen_port);
+
+        // request a metadata piece, the peer must be ready
+        void RequestPiece(int piece);
+
+        // close the connection, the fetcher is not notified
+        void Close();
+
+        bool IsClosed() const
+            { return !net_processor_; }
+
+        void ProcessProtocol(const char *data, std::size_t size);
+        void OnConnect();
+        void OnDisconnect();
+
+    private:
+        typedef BitNetProcessor<BitPeerConnection::PeerProtocolUnpackRuler,
+                                BitMetadataConnection> NetProcessor;
+
+        bool ProcessHandshake(const char *data);
+        void ProcessExtended(const char *data, std::size_t len);
+        void ProcessExtendedHandshake(const char *data, std::size_t len);
+        void SendHandshake();
+        void SendExtendedHandshake();
+        void SendExtendedMessage(char id, const std::string& payload);
+        void DropConnection();
+
+        Sha1Value info_hash_;
+        std::string peer_id_;
+        BitMetadataFetcher *fetcher_;
+        bool is_handshaked_;
+        // ut_metadata message id of the peer, 0 is not supported
+        char ut_metadata_id_;
+        std::tr1::shared_ptr<NetProcessor> net_processor_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_METADATA_CONNECTION_H
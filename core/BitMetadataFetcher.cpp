@@ -0,0 +1,402 @@
+#include "BitMetadataFetcher.h"
+#include "BitDht.h"
+#include "BitMetadataConnection.h"
+#include "BitService.h"
+#include "BitTrackerConnection.h"
+#include "BitUdpTrackerConnection.h"
+#include "BitUtMetadata.h"
+#include "../net/Address.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <string.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        const int fetch_interval = 1000;
+        // peers connected at the same time, and pieces requested from a
+        // peer at the same time
+        const std::size_t max_fetch_peers = 8;
+        const std::size_t max_peer_requests = 2;
+        // a peer which sends no metadata_size, or no requested piece in
+        // time is closed
+        const NormalTimeType ready_time_out = 30 * 1000;
+        const NormalTimeType request_time_out = 20 * 1000;
+        // metadata larger than this is not accepted
+        const long long max_metadata_size = 16 * 1024 * 1024;
+        const NormalTimeType dht_lookup_interval = 5 * 60 * 1000;
+        // a peer gave pieces of wrong metadata this times is banned
+        const int max_suspect_times = 2;
+
+        void AddDhtPeer(const std::tr1::shared_ptr<
+                            std::vector<MagnetLink::PeerAddress> >& peers,
+                        unsigned long ip, unsigned short port)
+        {
+            peers->push_back(MagnetLink::PeerAddress(ip, port));
+        }
+
+    } // unnamed namespace
+
+    BitMetadataFetcher::BitMetadataFetcher(const MagnetLink& magnet,
+                                           net::IoService& io_service)
+        : io_service_(io_service),
+          magnet_(magnet),
+          peer_id_("-AT0001-000000000000"),
+          dht_peers_(new DhtPeers),
+          dht_lookup_time_(0),
+          dht_looked_up_(false),
+          metadata_size_(0),
+          received_count_(0),
+          complete_(false)
+    {
+        for (std::size_t i = 0; i < magnet_.peers.size(); ++i)
+            AddPeer(magnet_.peers[i].first, magnet_.peers[i].second);
+
+        CreateTrackerConnection();
+
+        fetch_timer_.SetCallback(std::tr1::bind(&BitMetadataFetcher::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&fetch_timer_);
+        fetch_timer_.SetDeadline(fetch_interval);
+
+        ConnectPeers();
+    }
+
+    BitMetadataFetcher::~BitMetadataFetcher()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&fetch_timer_);
+
+        for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+            it->connection->Close();
+    }
+
+    void BitMetadataFetcher::AddPeer(unsigned long ip, unsigned short port)
+    {
+        BitData::PeerListenInfo info(ip, port);
+        if (used_peers_.find(info) == used_peers_.end() &&
+            banned_peers_.find(info) == banned_peers_.end())
+            unused_peers_.insert(info);
+    }
+
+    void BitMetadataFetcher::OnPeerReady(BitMetadataConnection *connection,
+                                         long long metadata_size)
+    {
+        FetchPeer *peer = FindPeer(connection);
+        if (!peer || complete_)
+            return ;
+
+        if (metadata_size > max_metadata_size)
+        {
+            connection->Close();
+            return ;
+        }
+
+        if (metadata_size_ == 0)
+        {
+            metadata_size_ = static_cast<std::size_t>(metadata_size);
+            metadata_.assign(metadata_size_, '\0');
+            pieces_.assign(GetMetadataPieceCount(metadata_size_), PieceState());
+            received_count_ = 0;
+        }
+        else if (metadata_size_ != metadata_size)
+        {
+            // a peer of other metadata_size has a different torrent, or
+            // gives wrong metadata_size
+            connection->Close();
+            return ;
+        }
+
+        peer->is_ready = true;
+        RequestPieces(connection);
+    }
+
+    void BitMetadataFetcher::OnPieceData(BitMetadataConnection *connection,
+                                         int piece, long long total_size,
+                                         const char *data, std::size_t len)
+    {
+        if (complete_ || static_cast<std::size_t>(piece) >= pieces_.size())
+            return ;
+
+        PieceState& state = pieces_[piece];
+        if (state.requester != connection || state.is_received)
+            return ;
+
+        std::size_t begin = piece * UtMetadataMessage::piece_size;
+        std::size_t length = metadata_size_ - begin;
+        if (length > UtMetadataMessage::piece_size)
+            length = UtMetadataMessage::piece_size;
+
+        if (total_size != metadata_size_ || len != length)
+        {
+            connection->Close();
+            ReturnPieces(connection);
+            return ;
+        }
+
+        memcpy(&metadata_[begin], data, len);
+        FetchPeer *peer = FindPeer(connection);
+        if (peer)
+            senders_.insert(peer->info);
+        state.is_received = true;
+        state.requester = 0;
+        ++received_count_;
+
+        if (received_count_ == pieces_.size())
+            VerifyMetadata();
+        else
+            RequestPieces(connection);
+    }
+
+    void BitMetadataFetcher::OnPieceReject(BitMetadataConnection *connection,
+                                           int piece)
+    {
+        // the peer does not give us metadata, pieces are requested from
+        // other peers
+        connection->Close();
+        ReturnPieces(connection);
+    }
+
+    void BitMetadataFetcher::OnPeerClosed(BitMetadataConnection *connection)
+    {
+        ReturnPieces(connection);
+    }
+
+    void BitMetadataFetcher::CreateTrackerConnection()
+    {
+        for (std::vector<std::string>::const_iterator it = magnet_.trackers.begin();
+                it != magnet_.trackers.end(); ++it)
+        {
+            try
+            {
+                if (BitUdpTrackerConnection::IsUdpTracker(*it))
+                {
+                    UdpTrackerConnPtr ptr(new BitUdpTrackerConnection(
+                                *it, magnet_.info_hash, peer_id_,
+                                std::tr1::bind(&BitMetadataFetcher::AddPeer, this,
+                                    std::tr1::placeholders::_1,
+                                    std::tr1::placeholders::_2),
+                                io_service_));
+                    udp_trackers_.push_back(ptr);
+                    continue;
+                }
+
+                BitTrackerConnection *btc = new BitTrackerConnection(
+                        *it, magnet_.info_hash, peer_id_,
+                        std::tr1::bind(&BitMetadataFetcher::AddPeer, this,
+                            std::tr1::placeholders::_1,
+                            std::tr1::placeholders::_2),
+                        io_service_);
+                trackers_.push_back(TrackerConnPtr(btc));
+            }
+            catch (...)
+            {
+                // we continue create tracker connection
+            }
+        }
+    }
+
+    void BitMetadataFetcher::OnTimer()
+    {
+        if (complete_)
+            return ;
+
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+        CheckTimeOut(now);
+        RemoveClosedPeers();
+
+        // the dht may have no node when we start, wait for it
+        if (BitService::dht && BitService::dht->GetNodeCount() > 0 &&
+            (!dht_looked_up_ || now - dht_lookup_time_ >= dht_lookup_interval))
+            LookupDht(now);
+        AddDhtPeers();
+        ConnectPeers();
+
+        // pieces returned by closed peers are requested again
+        for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            if (it->is_ready)
+                RequestPieces(it->connection.get());
+        }
+
+        fetch_timer_.SetDeadline(fetch_interval);
+    }
+
+    void BitMetadataFetcher::LookupDht(NormalTimeType now)
+    {
+        dht_looked_up_ = true;
+        dht_lookup_time_ = now;
+        BitService::dht->GetPeers(magnet_.info_hash, 0,
+                std::tr1::bind(AddDhtPeer, dht_peers_,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+
+    void BitMetadataFetcher::AddDhtPeers()
+    {
+        for (std::size_t i = 0; i < dht_peers_->size(); ++i)
+            AddPeer((*dht_peers_)[i].first, (*dht_peers_)[i].second);
+        dht_peers_->clear();
+    }
+
+    void BitMetadataFetcher::ConnectPeers()
+    {
+        while (peers_.size() < max_fetch_peers && !unused_peers_.empty())
+        {
+            BitData::PeerListenInfo info = *unused_peers_.begin();
+            unused_peers_.erase(unused_peers_.begin());
+            used_peers_.insert(info);
+
+            ConnectionPtr connection(new BitMetadataConnection(
+                        magnet_.info_hash, peer_id_, io_service_, this));
+            peers_.push_back(FetchPeer(connection, info,
+                        time_traits<NormalTimeType>::now()));
+
+            net::Address address(info.ip);
+            net::Port port(info.port);
+            connection->Connect(address, port);
+        }
+    }
+
+    void BitMetadataFetcher::CheckTimeOut(NormalTimeType now)
+    {
+        for (PieceStates::iterator it = pieces_.begin(); it != pieces_.end(); ++it)
+        {
+            if (it->requester && now - it->request_time >= request_time_out)
+            {
+                BitMetadataConnection *connection = it->requester;
+                connection->Close();
+                ReturnPieces(connection);
+            }
+        }
+
+        for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            if (!it->is_ready && now - it->connect_time >= ready_time_out)
+                it->connection->Close();
+        }
+    }
+
+    void BitMetadataFetcher::RemoveClosedPeers()
+    {
+        FetchPeers::iterator it = peers_.begin();
+        while (it != peers_.end())
+        {
+            if (it->connection->IsClosed())
+            {
+                ReturnPieces(it->connection.get());
+                it = peers_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    BitMetadataFetcher::FetchPeer * BitMetadataFetcher::FindPeer(
+            BitMetadataConnection *connection)
+    {
+        for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            if (it->connection.get() == connection)
+                return &*it;
+        }
+        return 0;
+    }
+
+    void BitMetadataFetcher::RequestPieces(BitMetadataConnection *connection)
+    {
+        if (connection->IsClosed())
+            return ;
+
+        std::size_t requesting = 0;
+        for (PieceStates::iterator it = pieces_.begin(); it != pieces_.end(); ++it)
+        {
+            if (it->requester == connection)
+                ++requesting;
+        }
+
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+        for (std::size_t i = 0;
+                i < pieces_.size() && requesting < max_peer_requests; ++i)
+        {
+            PieceState& state = pieces_[i];
+            if (state.is_received || state.requester)
+                continue;
+
+            state.requester = connection;
+            state.request_time = now;
+            connection->RequestPiece(static_cast<int>(i));
+            ++requesting;
+        }
+    }
+
+    void BitMetadataFetcher::ReturnPieces(BitMetadataConnection *connection)
+    {
+        for (PieceStates::iterator it = pieces_.begin(); it != pieces_.end(); ++it)
+        {
+            if (it->requester == connection)
+                it->requester = 0;
+        }
+    }
+
+    void BitMetadataFetcher::VerifyMetadata()
+    {
+        Sha1Value info_hash(metadata_.data(), metadata_.size());
+        if (info_hash == magnet_.info_hash)
+        {
+            complete_ = true;
+            for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+                it->connection->Close();
+        }
+        else
+        {
+            BanSenders();
+            ResetMetadata();
+        }
+    }
+
+    void BitMetadataFetcher::BanSenders()
+    {
+        // the only sender gave the wrong metadata, otherwise we do not
+        // know which one, a peer is banned when it is a sender of wrong
+        // metadata again
+        for (BitData::ListenInfoSet::iterator it = senders_.begin();
+                it != senders_.end(); ++it)
+        {
+            if (senders_.size() == 1 ||
+                ++suspect_peers_[*it] >= max_suspect_times)
+                banned_peers_.insert(*it);
+        }
+    }
+
+    void BitMetadataFetcher::ResetMetadata()
+    {
+        // all peers are closed, the peers not banned are connected again
+        // later
+        for (FetchPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+            it->connection->Close();
+
+        for (BitData::ListenInfoSet::iterator it = used_peers_.begin();
+                it != used_peers_.end(); ++it)
+        {
+            if (banned_peers_.find(*it) == banned_peers_.end())
+                unused_peers_.insert(*it);
+        }
+        used_peers_.clear();
+        senders_.clear();
+
+        metadata_size_ = 0;
+        metadata_.clear();
+        pieces_.clear();
+        received_count_ = 0;
+    }
+
+} // namespace core
+} // namespace bitwave
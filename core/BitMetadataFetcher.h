@@ -0,0 +1,149 @@
+#ifndef BIT_METADATA_FETCHER_H
+#define BIT_METADATA_FETCHER_H
+
+#include "BitData.h"
+#include "BitMagnet.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../sha1/Sha1Value.h"
+#include "../timer/Timer.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitMetadataConnection;
+    class BitTrackerConnection;
+    class BitUdpTrackerConnection;
+
+    // download metadata of a magnet link. Peers come from the trackers,
+    // dht and peer addresses of the magnet link, metadata pieces are
+    // requested from several peers in parallel, and the metadata is
+    // verified by the info hash when all pieces are received
+    class BitMetadataFetcher : private NotCopyable
+    {
+    public:
+        BitMetadataFetcher(const MagnetLink& magnet,
+                           net::IoService& io_service);
+
+        ~BitMetadataFetcher();
+
+        const MagnetLink& GetMagnetLink() const
+            { return magnet_; }
+
+        // metadata is downloaded and verified
+        bool IsComplete() const
+            { return complete_; }
+
+        // the bencoded info dictionary, it is valid when IsComplete
+        const std::string& GetMetadata() const
+            { return metadata_; }
+
+        // ip and port in host byte order
+        void AddPeer(unsigned long ip, unsigned short port);
+
+        // notifications of BitMetadataConnection
+        void OnPeerReady(BitMetadataConnection *connection,
+                         long long metadata_size);
+        void OnPieceData(BitMetadataConnection *connection, int piece,
+                         long long total_size, const char *data,
+                         std::size_t len);
+        void OnPieceReject(BitMetadataConnection *connection, int piece);
+        void OnPeerClosed(BitMetadataConnection *connection);
+
+    private:
+        typedef std::tr1::shared_ptr<BitMetadataConnection> ConnectionPtr;
+        typedef std::tr1::shared_ptr<BitTrackerConnection> TrackerConnPtr;
+        typedef std::tr1::shared_ptr<BitUdpTrackerConnection> UdpTrackerConnPtr;
+
+        struct FetchPeer
+        {
+            FetchPeer(const ConnectionPtr& conn,
+                      const BitData::PeerListenInfo& listen_info,
+                      NormalTimeType now)
+                : connection(conn),
+                  info(listen_info),
+                  connect_time(now),
+                  is_ready(false)
+            {
+            }
+
+            ConnectionPtr connection;
+            BitData::PeerListenInfo info;
+            NormalTimeType connect_time;
+            // metadata_size of the peer is accepted
+            bool is_ready;
+        };
+
+        struct PieceState
+        {
+            PieceState()
+                : is_received(false),
+                  requester(0),
+                  request_time(0)
+            {
+            }
+
+            bool is_received;
+            // the requesting connection, 0 is not requested
+            BitMetadataConnection *requester;
+            NormalTimeType request_time;
+        };
+
+        typedef std::vector<FetchPeer> FetchPeers;
+        typedef std::vector<PieceState> PieceStates;
+
+        typedef std::vector<MagnetLink::PeerAddress> DhtPeers;
+        typedef std::map<BitData::PeerListenInfo, int> SuspectPeers;
+
+        void CreateTrackerConnection();
+        void LookupDht(NormalTimeType now);
+        void AddDhtPeers();
+        void OnTimer();
+        void ConnectPeers();
+        void CheckTimeOut(NormalTimeType now);
+        void RemoveClosedPeers();
+        FetchPeer * FindPeer(BitMetadataConnection *connection);
+        void RequestPieces(BitMetadataConnection *connection);
+        void ReturnPieces(BitMetadataConnection *connection);
+        void VerifyMetadata();
+        void BanSenders();
+        void ResetMetadata();
+
+        net::IoService& io_service_;
+        Timer fetch_timer_;
+        MagnetLink magnet_;
+        std::string peer_id_;
+        std::vector<TrackerConnPtr> trackers_;
+        std::vector<UdpTrackerConnPtr> udp_trackers_;
+        // peers found by dht lookups, they are shared with the lookups
+        // which may outlive us
+        std::tr1::shared_ptr<DhtPeers> dht_peers_;
+        NormalTimeType dht_lookup_time_;
+        bool dht_looked_up_;
+
+        BitData::ListenInfoSet unused_peers_;
+        BitData::ListenInfoSet used_peers_;
+        // peers gave wrong metadata are never connected again
+        BitData::ListenInfoSet banned_peers_;
+        // peers gave pieces of the metadata which is being received, and
+        // times of every peer gave pieces of wrong metadata
+        BitData::ListenInfoSet senders_;
+        SuspectPeers suspect_peers_;
+        FetchPeers peers_;
+
+        // metadata_size of the first ready peer, 0 is unknown
+        std::size_t metadata_size_;
+        std::string metadata_;
+        PieceStates pieces_;
+        std::size_t received_count_;
+        bool complete_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_METADATA_FETCHER_H
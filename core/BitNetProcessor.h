@@ -144,6 +144,11 @@ namespace core {
             return connecting_;
         }
 
+        unsigned long GetRemoteAddress() const
+        {
+            return net::GetRemoteAddress(socket_.GetImplement());
+        }
+
     private:
         virtual void OnUnpackOne(const char *data, std::size_t size)
         {
@@ -190,6 +195,10 @@ namespace core {
             else
             {
                 buffer_cache_.FreeBuffer(receive_buffer_);
+                // the connection is closed by the remote, the last pack
+                // may end with the stream
+                if (received == 0 && connection_)
+                    StreamEnd();
                 Close();
             }
         }
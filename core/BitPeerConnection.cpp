@@ -2,24 +2,54 @@
 #include "BitData.h"
 #include "BitCache.h"
 #include "BitPeerData.h"
+#include "BitChoker.h"
 #include "BitUploadDispatcher.h"
 #include "BitDownloadDispatcher.h"
+#include "BitFastExtension.h"
+#include "BitRepository.h"
+#include "BitService.h"
+#include "BitException.h"
+#include "BitMerkleTree.h"
+#include "bencode/BenEncoder.h"
+#include "bencode/BenTypes.h"
+#include "bencode/MetainfoFile.h"
 #include "../net/NetHelper.h"
 #include "../sha1/NetSha1Value.h"
 #include <string.h>
+#include <algorithm>
 #include <functional>
 
 namespace {
 
-    // max outstanding requests
-    const std::size_t max_outstanding_requests = 3;
-
     // protocol string
     const char protocol_string[] = "BitTorrent protocol";
     const std::size_t protocol_string_len = sizeof(protocol_string) - 1;
     const std::size_t protocol_reserved = 8;
+    // fast extension bit of the last reserved byte, and extension
+    // protocol bit of the sixth reserved byte
+    const char fast_extension_flag = 0x04;
+    const std::size_t extension_protocol_byte = 5;
+    const char extension_protocol_flag = 0x10;
+    // v2 bit of BEP 52 of the last reserved byte, hash messages are
+    // used when both sides have merkle trees
+    const char merkle_hashes_flag = 0x10;
+    // client name in extended handshake
+    const char client_version[] = "BitWave";
+    // pieces of allowed fast set, and pieces suggested to a peer
+    const std::size_t allowed_fast_set_size = 10;
+    const std::size_t suggest_piece_count = 4;
     // handshake protocol size
     const std::size_t handshake_size = 49 + protocol_string_len;
+    // pieces root and 4 integers of hash messages
+    const std::size_t hash_request_size = 32 + 4 * sizeof(int);
+    // hashes of a hash request, the leaves of a 128MB piece
+    const int max_request_hashes = 8192;
+    // a peer sends so many corrupt blocks is dropped
+    const std::size_t max_corrupt_blocks = 8;
+    // pieces of block hashes requested from a peer and not replied
+    const std::size_t max_hash_request_pieces = 64;
+    // hash requests of a peer which read pieces, more are rejected
+    const std::size_t max_peer_hash_requests = 4;
 
     enum PEER_MESSAGE
     {
@@ -33,9 +63,24 @@ namespace {
         REQUEST,
         PIECE,
         CANCEL,
-        PORT
+        PORT,
+        // fast extension
+        SUGGEST_PIECE = 0x0D,
+        HAVE_ALL,
+        HAVE_NONE,
+        REJECT_REQUEST,
+        ALLOWED_FAST,
+        // extension protocol
+        EXTENDED = 20,
+        // merkle hashes of BEP 52
+        HASH_REQUEST,
+        HASHES,
+        HASH_REJECT
     };
 
+    // id of extended handshake in EXTENDED message
+    const char extended_handshake_id = 0;
+
     void ParseRequestData(const char *data, int *index, int *begin, int *length)
     {
         const int *net_int = reinterpret_cast<const int *>(data);
@@ -44,6 +89,18 @@ namespace {
         *length = bitwave::net::NetToHosti(*net_int);
     }
 
+    void ParseHashRequest(const char *data, bitwave::Sha256Value *pieces_root,
+                          int *base_layer, int *index, int *length,
+                          int *proof_layers)
+    {
+        *pieces_root = bitwave::StreamToSha256Value(data);
+        const int *net_int = reinterpret_cast<const int *>(data + 32);
+        *base_layer = bitwave::net::NetToHosti(*net_int++);
+        *index = bitwave::net::NetToHosti(*net_int++);
+        *length = bitwave::net::NetToHosti(*net_int++);
+        *proof_layers = bitwave::net::NetToHosti(*net_int);
+    }
+
 } // unnamed namespace
 
 namespace bitwave {
@@ -83,7 +140,15 @@ namespace core {
     BitPeerConnection::BitPeerConnection(const net::AsyncSocket& socket,
                                          PeerConnectionOwner *owner)
         : owner_(owner),
-          request_timeouter_(socket.GetService())
+          request_timeouter_(socket.GetService()),
+          receive_piece_time_(0),
+          download_throttled_(false),
+          last_request_index_(-1),
+          upload_weight_(1),
+          fast_extension_(false),
+          extension_protocol_(false),
+          merkle_hashes_(false),
+          remote_listen_port_(0)
     {
         assert(owner_);
         net_processor_.reset(new NetProcessor(socket, this));
@@ -95,6 +160,14 @@ namespace core {
                                          PeerConnectionOwner *owner)
         : owner_(owner),
           request_timeouter_(io_service),
+          receive_piece_time_(0),
+          download_throttled_(false),
+          last_request_index_(-1),
+          upload_weight_(1),
+          fast_extension_(false),
+          extension_protocol_(false),
+          merkle_hashes_(false),
+          remote_listen_port_(0),
           bitdata_(bitdata)
     {
         assert(owner_);
@@ -111,9 +184,67 @@ namespace core {
         ReturnAllRequests();
     }
 
+    void BitPeerConnection::SetTaskLimiters(
+            const std::tr1::shared_ptr<BitTokenBucket>& upload,
+            const std::tr1::shared_ptr<BitTokenBucket>& download)
+    {
+        task_upload_limiter_ = upload;
+        task_download_limiter_ = download;
+        upload_limiter_.SetParent(upload.get());
+        download_limiter_.SetParent(download.get());
+    }
+
+    void BitPeerConnection::ResumeDownload()
+    {
+        if (download_throttled_)
+        {
+            download_throttled_ = false;
+            RequestPieceBlock();
+        }
+    }
+
+    void BitPeerConnection::AddExtension(
+            const std::tr1::shared_ptr<BitExtension>& extension)
+    {
+        assert(extensions_.size() < 255);
+        extensions_.push_back(extension);
+    }
+
+    bool BitPeerConnection::SendExtensionMessage(const BitExtension *extension,
+                                                 const std::string& payload)
+    {
+        if (!net_processor_)
+            return false;
+
+        std::map<std::string, char>::const_iterator it =
+            peer_extension_ids_.find(extension->GetName());
+        if (it == peer_extension_ids_.end())
+            return false;
+
+        SendExtendedMessage(it->second, payload);
+        return true;
+    }
+
+    bool BitPeerConnection::GetListenInfo(unsigned long *ip,
+                                          unsigned short *port) const
+    {
+        if (!net_processor_ || remote_listen_port_ == 0)
+            return false;
+
+        unsigned long address = net_processor_->GetRemoteAddress();
+        if (address == 0)
+            return false;
+
+        *ip = net::NetToHostl(address);
+        *port = remote_listen_port_;
+        return true;
+    }
+
     void BitPeerConnection::Connect(const net::Address& remote_address,
                                     const net::Port& remote_listen_port)
     {
+        remote_listen_port_ = net::NetToHosts(
+                static_cast<unsigned short>(remote_listen_port));
         net_processor_->Connect(remote_address, remote_listen_port);
     }
 
@@ -132,6 +263,12 @@ namespace core {
             peer_request_.DelRequest(index, begin, length);
             send_ok = true;
         }
+        else if (!read_ok && fast_extension_ &&
+                 peer_request_.IsExistRequest(index, begin, length))
+        {
+            SendRejectRequest(index, begin, length);
+            peer_request_.DelRequest(index, begin, length);
+        }
 
         // pending next peer request
         PendingUploadRequest();
@@ -180,41 +317,57 @@ namespace core {
         SetInterested(false);
 
         // cancel all outstanding requests
-        BitRequestList::Iterator it = requesting_list_.Begin();
-        while (it != requesting_list_.End())
-            CancelRequest(it++);
+        SendCancels(requesting_list_);
+        RefundDownload(requesting_list_);
+        requesting_list_.Clear();
 
         // clear all waiting requests
         wait_request_.Clear();
     }
 
-    void BitPeerConnection::CompleteNewPiece(std::size_t piece_index)
+    void BitPeerConnection::FlushCancels()
     {
-        HavePiece(piece_index);
+        // handshake is not complete, we do nothing
+        if (!peer_data_ || !download_dispatcher_)
+            return ;
 
-        if (download_dispatcher_->IsEndDownloadingMode())
-        {
-            BitRequestList::Iterator it = requesting_list_.Begin();
-            while (it != requesting_list_.End())
-            {
-                if (it->index == piece_index)
-                    CancelRequest(it++);
-                else
-                    ++it;
-            }
+        if (SendPendingCancels())
+            RequestPieceBlock();
+    }
 
-            it = wait_request_.Begin();
-            while (it != wait_request_.End())
-            {
-                if (it->index == piece_index)
-                    wait_request_.Erase(it++);
-                else
-                    ++it;
-            }
+    bool BitPeerConnection::SendPendingCancels()
+    {
+        BitRequestList cancels;
+        download_dispatcher_->TakeCancels(peer_data_, cancels);
+        if (cancels.Empty())
+            return false;
 
-            // it maybe cancel all requests, so we need request new ones
-            RequestPieceBlock();
+        // outstanding requests are cancelled in one send, and waiting
+        // requests are not sent yet, just Erase them
+        BitRequestList outstanding;
+        for (BitRequestList::Iterator it = cancels.Begin();
+                it != cancels.End(); ++it)
+        {
+            BitRequestList::Iterator request =
+                requesting_list_.FindRequest(it->index, it->begin, it->length);
+            if (request != requesting_list_.End())
+                outstanding.Splice(requesting_list_, request);
+            else
+                wait_request_.DelRequest(it->index, it->begin, it->length);
         }
+
+        // the connection is closed, the requests are gone with it
+        if (net_processor_)
+            SendCancels(outstanding);
+        RefundDownload(outstanding);
+        return true;
+    }
+
+    void BitPeerConnection::CompleteNewPiece(std::size_t piece_index)
+    {
+        // requests of the piece blocks which are received from other
+        // peers are cancelled by FlushCancels
+        HavePiece(piece_index);
     }
 
     void BitPeerConnection::DownloadingFailed(std::size_t piece_index)
@@ -238,7 +391,8 @@ namespace core {
             memcmp(data + 1, protocol_string, protocol_string_len) != 0)
             return false;
 
-        const char *info_hash_ptr = data + 1 + protocol_string_len + protocol_reserved;
+        const char *reserved_ptr = data + 1 + protocol_string_len;
+        const char *info_hash_ptr = reserved_ptr + protocol_reserved;
         const char *peer_id_ptr = info_hash_ptr + 20;
 
         Sha1Value info_hash = NetStreamToSha1Value(info_hash_ptr);
@@ -264,6 +418,15 @@ namespace core {
             SendHandshake();
         }
 
+        // we always support fast extension and extension protocol
+        fast_extension_ =
+            (reserved_ptr[protocol_reserved - 1] & fast_extension_flag) != 0;
+        extension_protocol_ =
+            (reserved_ptr[extension_protocol_byte] & extension_protocol_flag) != 0;
+        merkle_hashes_ =
+            (reserved_ptr[protocol_reserved - 1] & merkle_hashes_flag) != 0 &&
+            bitdata_->GetMetainfoFile()->HasMerkleTrees();
+
         PreparePeerData(peer_id);
         OnHandshake();
         return true;
@@ -274,16 +437,25 @@ namespace core {
         int message = len == 0 ? KEEP_ALIVE : *data++;
         switch (message)
         {
-        case KEEP_ALIVE:     ProcessKeepAlive();             break;
-        case CHOKE:          ProcessChoke(true);             break;
-        case UNCHOKE:        ProcessChoke(false);            break;
-        case INTERESTED:     ProcessInterested(true);        break;
-        case NOT_INTERESTED: ProcessInterested(false);       break;
-        case HAVE:           ProcessHave(data, len - 1);     break;
-        case BITFIELD:       ProcessBitfield(data, len - 1); break;
-        case REQUEST:        ProcessRequest(data, len - 1);  break;
-        case PIECE:          ProcessPiece(data, len - 1);    break;
-        case CANCEL:         ProcessCancel(data, len - 1);   break;
+        case KEEP_ALIVE:     ProcessKeepAlive();                  break;
+        case CHOKE:          ProcessChoke(true);                  break;
+        case UNCHOKE:        ProcessChoke(false);                 break;
+        case INTERESTED:     ProcessInterested(true);             break;
+        case NOT_INTERESTED: ProcessInterested(false);            break;
+        case HAVE:           ProcessHave(data, len - 1);          break;
+        case BITFIELD:       ProcessBitfield(data, len - 1);      break;
+        case REQUEST:        ProcessRequest(data, len - 1);       break;
+        case PIECE:          ProcessPiece(data, len - 1);         break;
+        case CANCEL:         ProcessCancel(data, len - 1);        break;
+        case SUGGEST_PIECE:  ProcessSuggestPiece(data, len - 1);  break;
+        case HAVE_ALL:       ProcessHaveAll(true, len - 1);       break;
+        case HAVE_NONE:      ProcessHaveAll(false, len - 1);      break;
+        case REJECT_REQUEST: ProcessRejectRequest(data, len - 1); break;
+        case ALLOWED_FAST:   ProcessAllowedFast(data, len - 1);   break;
+        case EXTENDED:       ProcessExtended(data, len - 1);      break;
+        case HASH_REQUEST:   ProcessHashRequest(data, len - 1);   break;
+        case HASHES:         ProcessHashes(data, len - 1);        break;
+        case HASH_REJECT:    ProcessHashReject(data, len - 1);    break;
         case PORT:
         default:
             // PORT message and other messages are not supported, do nothing
@@ -302,17 +474,34 @@ namespace core {
     {
         connection_state_.peer_choking = choke;
 
-        if (choke)
-            ReturnAllRequests();
-        else
+        if (!choke)
+        {
             RequestPieceBlock();
+            return ;
+        }
+
+        if (!fast_extension_)
+        {
+            ReturnAllRequests();
+            return ;
+        }
+
+        // with fast extension, choke does not reject outstanding requests,
+        // the peer sends REJECT_REQUEST of the requests it drops, and
+        // allowed fast pieces can be requested still
+        ReturnWaitRequests();
+        RequestPieceBlock();
     }
 
     void BitPeerConnection::ProcessInterested(bool interested)
     {
+        // suggest our hot pieces when the peer begins to be interested
+        if (interested && !connection_state_.peer_interested && fast_extension_)
+            SendSuggestPieces();
+
         connection_state_.peer_interested = interested;
-        if (interested)
-            SetChoke(false);
+        if (interested && choker_)
+            choker_->PeerInterested(shared_from_this());
     }
 
     void BitPeerConnection::ProcessHave(const char *data, std::size_t len)
@@ -341,23 +530,44 @@ namespace core {
 
     void BitPeerConnection::ProcessRequest(const char *data, std::size_t len)
     {
-        // TODO check choke or not
         if (len != 3 * sizeof(int))
         {
             DropConnection();
             return ;
         }
 
-        // too many request, we do not accept
-        if (peer_request_.Size() >= 5)
-            return ;
-
         int index = 0;
         int begin = 0;
         int length = 0;
         ParseRequestData(data, &index, &begin, &length);
+
+        // we do not accept when the peer is choked and the piece is not
+        // allowed fast, or too many requests, or we do not have the piece,
+        // or the block is out of the piece or too large, then the request
+        // is rejected with fast extension
+        bool accept =
+            (!connection_state_.am_choking || IsAllowedFastPiece(index)) &&
+            peer_request_.Size() < 5 &&
+            BitUploadDispatcher::IsValidRequest(begin, length,
+                bitdata_->GetPieceLength()) &&
+            index >= 0 &&
+            static_cast<std::size_t>(index) < bitdata_->GetPieceCount() &&
+            bitdata_->GetPieceMap().IsPieceMark(index);
+        if (!accept)
+        {
+            if (fast_extension_)
+                SendRejectRequest(index, begin, length);
+            return ;
+        }
+
         peer_request_.AddRequest(index, begin, length);
 
+        // requests in the same piece or the next piece are sequential
+        bool sequential = index == last_request_index_ ||
+                          index == last_request_index_ + 1;
+        last_request_index_ = index;
+        upload_dispatcher_->Prefetch(index, begin, length, sequential);
+
         // we start upload when the first request is arrived
         if (peer_request_.Size() == 1)
             PendingUploadRequest();
@@ -378,12 +588,36 @@ namespace core {
         data += 2 * sizeof(int);
 
         bitdata_->IncreaseCurrentDownload(length);
+        peer_data_->AddDownloaded(length);
+        receive_piece_time_ = time_traits<NormalTimeType>::now();
 
         BitRequestList::Iterator it = requesting_list_.FindRequest(index, begin, length);
         if (it != requesting_list_.End())
         {
+            request_pipeline_.BlockArrived(length,
+                    request_timeouter_.GetApplyTime(it));
             DeleteOutStandingRequest(it);
-            cache_->Write(index, begin, length, data);
+            if (download_dispatcher_->CompleteRequest(peer_data_, index, begin, length) &&
+                !cache_->Write(index, begin, length, data, peer_data_))
+            {
+                // the block does not match its merkle hash, it is requested
+                // again
+                download_dispatcher_->ReturnCorruptBlock(index, begin, length);
+                peer_data_->AddCorruptBlock();
+            }
+        }
+        else
+        {
+            // the request is cancelled or time out
+            bitdata_->IncreaseWasted(length);
+        }
+
+        // the peer sends corrupt blocks again and again is dropped, its
+        // blocks may be found corrupt when hashes come from other peers
+        if (peer_data_->GetCorruptBlocks() >= max_corrupt_blocks)
+        {
+            DropConnection();
+            return ;
         }
 
         RequestPieceBlock();
@@ -404,9 +638,270 @@ namespace core {
         peer_request_.DelRequest(index, begin, length);
     }
 
+    void BitPeerConnection::ProcessSuggestPiece(const char *data, std::size_t len)
+    {
+        if (!fast_extension_ || len != sizeof(int) || !peer_data_)
+        {
+            DropConnection();
+            return ;
+        }
+
+        int piece_index = net::NetToHosti(*reinterpret_cast<const int *>(data));
+        peer_data_->SuggestPiece(piece_index);
+    }
+
+    void BitPeerConnection::ProcessHaveAll(bool have_all, std::size_t len)
+    {
+        if (!fast_extension_ || len != 0 || !peer_data_)
+        {
+            DropConnection();
+            return ;
+        }
+
+        if (have_all)
+            peer_data_->PeerHaveAll();
+        RequestPieceBlock();
+    }
+
+    void BitPeerConnection::ProcessRejectRequest(const char *data, std::size_t len)
+    {
+        if (!fast_extension_ || len != 3 * sizeof(int))
+        {
+            DropConnection();
+            return ;
+        }
+
+        int index = 0;
+        int begin = 0;
+        int length = 0;
+        ParseRequestData(data, &index, &begin, &length);
+
+        BitRequestList::Iterator it = requesting_list_.FindRequest(index, begin, length);
+        if (it == requesting_list_.End())
+            return ;
+
+        // the peer rejects the allowed fast piece, do not request it
+        // again until the peer unchokes us
+        if (connection_state_.peer_choking)
+            peer_data_->DisallowFastPiece(index);
+
+        BitRequestList temp;
+        temp.Splice(requesting_list_, it);
+        RefundDownload(temp);
+        // request new piece block first to avoid get the rejected request
+        RequestPieceBlock();
+        download_dispatcher_->ReturnRequest(peer_data_, temp, temp.Begin());
+    }
+
+    void BitPeerConnection::ProcessAllowedFast(const char *data, std::size_t len)
+    {
+        if (!fast_extension_ || len != sizeof(int) || !peer_data_)
+        {
+            DropConnection();
+            return ;
+        }
+
+        int piece_index = net::NetToHosti(*reinterpret_cast<const int *>(data));
+        peer_data_->AllowFastPiece(piece_index);
+        RequestPieceBlock();
+    }
+
+    void BitPeerConnection::ProcessExtended(const char *data, std::size_t len)
+    {
+        if (!extension_protocol_ || len < sizeof(char))
+        {
+            DropConnection();
+            return ;
+        }
+
+        unsigned char id = *data++;
+        --len;
+        if (id == extended_handshake_id)
+        {
+            ProcessExtendedHandshake(data, len);
+        }
+        else if (id <= extensions_.size())
+        {
+            extensions_[id - 1]->OnMessage(data, len);
+        }
+        // messages of unknown id are ignored
+    }
+
+    void BitPeerConnection::ProcessExtendedHandshake(const char *data,
+                                                     std::size_t len)
+    {
+        using namespace bentypes;
+        if (len == 0)
+        {
+            DropConnection();
+            return ;
+        }
+
+        try
+        {
+            BenTypesStreamBuf buf(data, len);
+            std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+            BenDictionary *handshake = dynamic_cast<BenDictionary *>(object.get());
+            if (!handshake)
+            {
+                DropConnection();
+                return ;
+            }
+
+            // message ids of the peer, id 0 disables the extension
+            BenDictionary *m = handshake->ValueBenTypeCast<BenDictionary>("m");
+            if (m)
+            {
+                for (BenDictionary::const_iterator it = m->begin();
+                        it != m->end(); ++it)
+                {
+                    BenInteger *id = dynamic_cast<BenInteger *>(it->second.get());
+                    if (!id)
+                        continue;
+
+                    if (id->GetValue() > 0 && id->GetValue() < 256)
+                        peer_extension_ids_[it->first] =
+                            static_cast<char>(id->GetValue());
+                    else
+                        peer_extension_ids_.erase(it->first);
+                }
+            }
+
+            BenInteger *p = handshake->ValueBenTypeCast<BenInteger>("p");
+            if (p && remote_listen_port_ == 0 &&
+                p->GetValue() > 0 && p->GetValue() < 65536)
+                remote_listen_port_ = static_cast<unsigned short>(p->GetValue());
+
+            for (std::size_t i = 0; i < extensions_.size(); ++i)
+                extensions_[i]->OnHandshake(*handshake);
+        }
+        catch (const BenTypeException&)
+        {
+            DropConnection();
+        }
+    }
+
+    void BitPeerConnection::ProcessHashRequest(const char *data, std::size_t len)
+    {
+        if (!merkle_hashes_ || len != hash_request_size)
+        {
+            DropConnection();
+            return ;
+        }
+
+        HashRequest request;
+        ParseHashRequest(data, &request.pieces_root, &request.base_layer,
+                &request.index, &request.length, &request.proof_layers);
+
+        // leaves of a piece are hashed from the piece data, hashes of the
+        // piece layer and above are from the metainfo
+        std::size_t piece_index = 0;
+        bool have_piece = false;
+        if (request.base_layer == 0)
+        {
+            // files of the root have the same leaves, any piece we have
+            std::vector<std::size_t> piece_indexes;
+            GetHashRequestPieces(request, piece_indexes);
+            for (std::size_t i = 0; i < piece_indexes.size() && !have_piece; ++i)
+            {
+                piece_index = piece_indexes[i];
+                have_piece = bitdata_->GetPieceMap().IsPieceMark(piece_index);
+            }
+        }
+
+        std::vector<Sha256Value> hashes;
+        if (have_piece && cache_->GetPieceLeaves(piece_index, hashes))
+        {
+            SendPieceLeaves(request, piece_index, hashes);
+        }
+        else if (have_piece)
+        {
+            // leaves are hashed from the piece data, it costs a piece
+            // read as an upload, so requests of a peer are limited
+            if (peer_hash_requests_.size() >= max_peer_hash_requests)
+            {
+                SendHashMessage(HASH_REJECT, request, hashes);
+                return ;
+            }
+
+            PieceHashRequest piece_request;
+            piece_request.request = request;
+            piece_request.piece_index = piece_index;
+            peer_hash_requests_.push_back(piece_request);
+            if (peer_hash_requests_.size() == 1)
+                ReadHashRequestPiece();
+        }
+        else if (GetLayerHashes(request, hashes))
+        {
+            SendHashMessage(HASHES, request, hashes);
+        }
+        else
+        {
+            SendHashMessage(HASH_REJECT, request, hashes);
+        }
+    }
+
+    void BitPeerConnection::ProcessHashes(const char *data, std::size_t len)
+    {
+        if (!merkle_hashes_ || len < hash_request_size ||
+            (len - hash_request_size) % 32 != 0)
+        {
+            DropConnection();
+            return ;
+        }
+
+        HashRequest request;
+        ParseHashRequest(data, &request.pieces_root, &request.base_layer,
+                &request.index, &request.length, &request.proof_layers);
+
+        // we request leaves of a piece without proof only
+        std::size_t piece_index = 0;
+        std::size_t count = (len - hash_request_size) / 32;
+        if (request.base_layer != 0 || request.proof_layers != 0 ||
+            count != static_cast<std::size_t>(request.length) ||
+            !TakeHashRequestPiece(request, &piece_index))
+            return ;
+
+        std::vector<Sha256Value> hashes;
+        hashes.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+            hashes.push_back(StreamToSha256Value(data + hash_request_size + i * 32));
+
+        std::vector<std::size_t> corrupt_blocks;
+        if (!cache_->SetBlockHashes(piece_index, hashes, corrupt_blocks))
+        {
+            DropConnection();
+            return ;
+        }
+
+        for (std::size_t i = 0; i < corrupt_blocks.size(); ++i)
+            download_dispatcher_->ReturnCorruptBlock(piece_index,
+                    corrupt_blocks[i], BitMerkleTree::block_size);
+        if (!corrupt_blocks.empty())
+            RequestPieceBlock();
+    }
+
+    void BitPeerConnection::ProcessHashReject(const char *data, std::size_t len)
+    {
+        if (!merkle_hashes_ || len != hash_request_size)
+        {
+            DropConnection();
+            return ;
+        }
+
+        HashRequest request;
+        ParseHashRequest(data, &request.pieces_root, &request.base_layer,
+                &request.index, &request.length, &request.proof_layers);
+
+        std::size_t piece_index = 0;
+        if (request.base_layer == 0 && TakeHashRequestPiece(request, &piece_index))
+            cache_->BlockHashesFailed(piece_index);
+    }
+
     void BitPeerConnection::PreparePeerData(const std::string& peer_id)
     {
-        peer_data_.reset(new BitPeerData(peer_id, bitdata_->GetPieceCount()));
+        peer_data_.reset(new BitPeerData(peer_id, bitdata_->GetPieceCount(),
+                    bitdata_->GetPieceAvailabilityPtr()));
         bitdata_->AddPeerData(peer_data_);
     }
 
@@ -425,7 +920,12 @@ namespace core {
         *data++ = protocol_string_len;
 
         memcpy(data, protocol_string, protocol_string_len);
-        data += protocol_string_len + protocol_reserved;
+        data += protocol_string_len;
+        data[extension_protocol_byte] |= extension_protocol_flag;
+        data[protocol_reserved - 1] |= fast_extension_flag;
+        if (bitdata_->GetMetainfoFile()->HasMerkleTrees())
+            data[protocol_reserved - 1] |= merkle_hashes_flag;
+        data += protocol_reserved;
 
         Sha1Value info_hash = NetByteOrder(bitdata_->GetInfoHash());
         memcpy(data, info_hash.GetData(), info_hash.GetDataSize());
@@ -456,18 +956,41 @@ namespace core {
         SetKeepAliveTimer();
     }
 
-    void BitPeerConnection::SendHave(int piece_index)
+    void BitPeerConnection::SendPieceIndexMessage(char id, int piece_index)
     {
         Buffer buffer = net_processor_->GetBuffer(2 * sizeof(int) + sizeof(char));
         char *data = buffer.GetBuffer();
         *reinterpret_cast<int *>(data) = net::HostToNeti(5);
         data += sizeof(int);
-        *data++ = HAVE;
+        *data++ = id;
         *reinterpret_cast<int *>(data) = net::HostToNeti(piece_index);
         net_processor_->Send(buffer);
         SetKeepAliveTimer();
     }
 
+    void BitPeerConnection::SendPieceMap()
+    {
+        // with fast extension, a seed or a task has no piece sends
+        // HAVE_ALL or HAVE_NONE instead of the bitfield
+        if (fast_extension_)
+        {
+            std::size_t count = bitdata_->GetPieceMap().Count();
+            if (count == bitdata_->GetPieceCount())
+            {
+                SendNoPayloadMessage(HAVE_ALL);
+                return ;
+            }
+
+            if (count == 0)
+            {
+                SendNoPayloadMessage(HAVE_NONE);
+                return ;
+            }
+        }
+
+        SendBitfield();
+    }
+
     void BitPeerConnection::SendBitfield()
     {
         const BitPieceMap& map = bitdata_->GetPieceMap();
@@ -484,6 +1007,38 @@ namespace core {
         SetKeepAliveTimer();
     }
 
+    void BitPeerConnection::SendAllowedFast()
+    {
+        unsigned long address = net_processor_->GetRemoteAddress();
+        if (address == 0)
+            return ;
+
+        GenerateAllowedFastSet(address, bitdata_->GetInfoHash(),
+                bitdata_->GetPieceCount(), allowed_fast_set_size,
+                allowed_fast_set_);
+
+        // pieces we do not have are sent when they are downloaded
+        const BitPieceMap& map = bitdata_->GetPieceMap();
+        for (std::size_t i = 0; i < allowed_fast_set_.size(); ++i)
+        {
+            if (map.IsPieceMark(allowed_fast_set_[i]))
+                SendPieceIndexMessage(ALLOWED_FAST, allowed_fast_set_[i]);
+        }
+    }
+
+    void BitPeerConnection::SendSuggestPieces()
+    {
+        if (!cache_ || !peer_data_)
+            return ;
+
+        // pieces in our cache are uploaded without reading disk
+        std::vector<std::size_t> pieces;
+        cache_->GetHotPieces(peer_data_->GetPieceMap(),
+                suggest_piece_count, pieces);
+        for (std::size_t i = 0; i < pieces.size(); ++i)
+            SendPieceIndexMessage(SUGGEST_PIECE, pieces[i]);
+    }
+
     void BitPeerConnection::SendRequest(int index, int begin, int length)
     {
         Buffer buffer = net_processor_->GetBuffer(4 * sizeof(int) + sizeof(char));
@@ -501,6 +1056,88 @@ namespace core {
         SetKeepAliveTimer();
     }
 
+    void BitPeerConnection::SendRejectRequest(int index, int begin, int length)
+    {
+        Buffer buffer = net_processor_->GetBuffer(4 * sizeof(int) + sizeof(char));
+        char *data = buffer.GetBuffer();
+        int length_prefix = 3 * sizeof(int) + sizeof(char);
+        *reinterpret_cast<int *>(data) = net::HostToNeti(length_prefix);
+        data += sizeof(int);
+        *data++ = REJECT_REQUEST;
+
+        int *net_int = reinterpret_cast<int *>(data);
+        *net_int++ = net::HostToNeti(index);
+        *net_int++ = net::HostToNeti(begin);
+        *net_int = net::HostToNeti(length);
+        net_processor_->Send(buffer);
+        SetKeepAliveTimer();
+    }
+
+    void BitPeerConnection::SendExtendedHandshake()
+    {
+        // d1:md<name>i<id>e...e1:pi<port>e1:v<client>e and integer items
+        // of extensions, keys of bencoded dictionary are sorted
+        std::map<std::string, std::size_t> names;
+        std::map<std::string, long long> integers;
+        for (std::size_t i = 0; i < extensions_.size(); ++i)
+        {
+            names[extensions_[i]->GetName()] = i + 1;
+            extensions_[i]->GetHandshakeItems(integers);
+        }
+
+        if (BitService::repository)
+        {
+            unsigned short port = static_cast<unsigned short>(
+                    BitService::repository->GetListenPort());
+            integers["p"] = port;
+        }
+
+        // m and v are written here, not items of extensions
+        integers.erase("m");
+        integers.erase("v");
+
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter handshake(writer);
+            std::map<std::string, long long>::iterator it = integers.begin();
+            for (; it != integers.end() && it->first < "m"; ++it)
+                handshake.Add(it->first.c_str(), it->second);
+
+            {
+                bentypes::BenDictionaryWriter m(handshake.Key("m"));
+                for (std::map<std::string, std::size_t>::iterator name = names.begin();
+                        name != names.end(); ++name)
+                    m.Add(name->first.c_str(), static_cast<long long>(name->second));
+            }
+
+            for (; it != integers.end() && it->first < "v"; ++it)
+                handshake.Add(it->first.c_str(), it->second);
+
+            handshake.Add("v", client_version, sizeof(client_version) - 1);
+
+            for (; it != integers.end(); ++it)
+                handshake.Add(it->first.c_str(), it->second);
+        }
+
+        SendExtendedMessage(extended_handshake_id, writer.GetString());
+    }
+
+    void BitPeerConnection::SendExtendedMessage(char id, const std::string& payload)
+    {
+        std::size_t size = sizeof(int) + 2 * sizeof(char) + payload.size();
+        Buffer buffer = net_processor_->GetBuffer(size);
+        char *data = buffer.GetBuffer();
+        int length_prefix = 2 * sizeof(char) + payload.size();
+        *reinterpret_cast<int *>(data) = net::HostToNeti(length_prefix);
+        data += sizeof(int);
+        *data++ = EXTENDED;
+        *data++ = id;
+        memcpy(data, payload.data(), payload.size());
+        net_processor_->Send(buffer);
+        SetKeepAliveTimer();
+    }
+
     void BitPeerConnection::SendPiece(int index, int begin, int length, const char *block)
     {
         Buffer buffer = net_processor_->GetBuffer(3 * sizeof(int) + sizeof(char) + length);
@@ -519,21 +1156,60 @@ namespace core {
         SetKeepAliveTimer();
 
         bitdata_->IncreaseUploaded(length);
+        peer_data_->AddUploaded(length);
     }
 
-    void BitPeerConnection::SendCancel(int index, int begin, int length)
+    void BitPeerConnection::SendCancels(const BitRequestList& cancels)
     {
-        Buffer buffer = net_processor_->GetBuffer(4 * sizeof(int) + sizeof(char));
+        if (cancels.Empty())
+            return ;
+
+        const std::size_t message_size = 4 * sizeof(int) + sizeof(char);
+        Buffer buffer = net_processor_->GetBuffer(message_size * cancels.Size());
         char *data = buffer.GetBuffer();
-        int length_prefix = 3 * sizeof(int) + sizeof(char);
-        *reinterpret_cast<int *>(data) = net::HostToNeti(length_prefix);
+        for (BitRequestList::Const_Iterator it = cancels.Begin();
+                it != cancels.End(); ++it)
+        {
+            int length_prefix = 3 * sizeof(int) + sizeof(char);
+            *reinterpret_cast<int *>(data) = net::HostToNeti(length_prefix);
+            data += sizeof(int);
+            *data++ = CANCEL;
+
+            int *net_int = reinterpret_cast<int *>(data);
+            *net_int++ = net::HostToNeti(it->index);
+            *net_int++ = net::HostToNeti(it->begin);
+            *net_int = net::HostToNeti(it->length);
+            data += 3 * sizeof(int);
+        }
+
+        net_processor_->Send(buffer);
+        SetKeepAliveTimer();
+    }
+
+    void BitPeerConnection::SendHashMessage(char id, const HashRequest& request,
+                                            const std::vector<Sha256Value>& hashes)
+    {
+        std::size_t size = sizeof(int) + sizeof(char) +
+            hash_request_size + hashes.size() * 32;
+        Buffer buffer = net_processor_->GetBuffer(size);
+        char *data = buffer.GetBuffer();
+        *reinterpret_cast<int *>(data) = net::HostToNeti(
+                static_cast<int>(size - sizeof(int)));
         data += sizeof(int);
-        *data++ = CANCEL;
+        *data++ = id;
 
+        memcpy(data, request.pieces_root.GetData(), 32);
+        data += 32;
         int *net_int = reinterpret_cast<int *>(data);
-        *net_int++ = net::HostToNeti(index);
-        *net_int++ = net::HostToNeti(begin);
-        *net_int = net::HostToNeti(length);
+        *net_int++ = net::HostToNeti(request.base_layer);
+        *net_int++ = net::HostToNeti(request.index);
+        *net_int++ = net::HostToNeti(request.length);
+        *net_int = net::HostToNeti(request.proof_layers);
+        data += 4 * sizeof(int);
+
+        for (std::size_t i = 0; i < hashes.size(); ++i, data += 32)
+            memcpy(data, hashes[i].GetData(), 32);
+
         net_processor_->Send(buffer);
         SetKeepAliveTimer();
     }
@@ -541,7 +1217,13 @@ namespace core {
     void BitPeerConnection::OnHandshake()
     {
         owner_->NotifyHandshakeOk(shared_from_this());
-        SendBitfield();
+        SendPieceMap();
+
+        if (fast_extension_)
+            SendAllowedFast();
+
+        if (extension_protocol_)
+            SendExtendedHandshake();
 
         if (!bitdata_->IsDownloadComplete())
             SetInterested(true);
@@ -557,6 +1239,26 @@ namespace core {
     {
         SendNoPayloadMessage(choke ? CHOKE : UNCHOKE);
         connection_state_.am_choking = choke;
+
+        if (choke)
+            RejectPeerRequests();
+    }
+
+    bool BitPeerConnection::IsSnubbed() const
+    {
+        const NormalTimeType snub_time = 60 * 1000;
+        return !requesting_list_.Empty() &&
+            time_traits<NormalTimeType>::now() - receive_piece_time_ >= snub_time;
+    }
+
+    double BitPeerConnection::GetDownloadRate()
+    {
+        return peer_data_->GetDownloadRate();
+    }
+
+    double BitPeerConnection::GetUploadRate()
+    {
+        return peer_data_->GetUploadRate();
     }
 
     void BitPeerConnection::HavePiece(std::size_t piece_index)
@@ -564,31 +1266,99 @@ namespace core {
         // handshake is not complete, we do not send HAVE message
         if (!peer_data_)
             return ;
-        SendHave(piece_index);
+        SendPieceIndexMessage(HAVE, piece_index);
+
+        // the piece of allowed fast set is downloaded now
+        if (IsAllowedFastPiece(piece_index))
+            SendPieceIndexMessage(ALLOWED_FAST, piece_index);
     }
 
-    void BitPeerConnection::RequestPieceBlock()
+    bool BitPeerConnection::IsAllowedFastPiece(int piece_index) const
+    {
+        return piece_index >= 0 &&
+            std::find(allowed_fast_set_.begin(), allowed_fast_set_.end(),
+                    static_cast<std::size_t>(piece_index)) != allowed_fast_set_.end();
+    }
+
+    void BitPeerConnection::RejectPeerRequests()
     {
-        if (!connection_state_.am_interested ||
-            connection_state_.peer_choking)
+        // requests of the choked peer are discarded
+        if (!fast_extension_)
+        {
+            peer_request_.Clear();
             return ;
+        }
+
+        // with fast extension, the peer is told by REJECT_REQUEST, and
+        // requests of allowed fast pieces are kept
+        BitRequestList::Iterator it = peer_request_.Begin();
+        while (it != peer_request_.End())
+        {
+            if (IsAllowedFastPiece(it->index))
+            {
+                ++it;
+            }
+            else
+            {
+                SendRejectRequest(it->index, it->begin, it->length);
+                peer_request_.Erase(it++);
+            }
+        }
+    }
 
-        std::size_t requesting_count = requesting_list_.Size();
-        if (requesting_count >= max_outstanding_requests)
+    void BitPeerConnection::RequestPieceBlock()
+    {
+        if (!connection_state_.am_interested)
             return ;
 
-        if (wait_request_.Empty())
-            download_dispatcher_->DispatchRequestList(peer_data_, wait_request_);
+        // the peer chokes us, only allowed fast pieces can be requested
+        bool allowed_fast_only = connection_state_.peer_choking;
+        if (allowed_fast_only &&
+            (!fast_extension_ || !peer_data_->HasAllowedFast()))
+            return ;
 
-        std::size_t count = 0;
-        std::size_t max_request = max_outstanding_requests - requesting_count;
-        BitRequestList::Iterator it = wait_request_.Begin();
-        while (count < max_request && it != wait_request_.End())
+        // keep the outstanding requests as many as the pipeline depth
+        std::size_t depth = request_pipeline_.GetDepth();
+        bool is_dispatched = false;
+        bool is_posted = false;
+        while (requesting_list_.Size() < depth)
         {
-            BitRequestList::Iterator it_of_requesting =
-                requesting_list_.Splice(wait_request_, it++);
-            PostRequest(it_of_requesting);
-            ++count;
+            if (wait_request_.Empty())
+            {
+                // requests of last dispatch are all outstanding already,
+                // the dispatcher has no more requests for the peer
+                if (is_dispatched && !is_posted)
+                    break;
+
+                if (allowed_fast_only)
+                    download_dispatcher_->DispatchAllowedFastRequest(
+                            peer_data_, wait_request_);
+                else
+                    download_dispatcher_->DispatchRequestList(
+                            peer_data_, wait_request_);
+                if (wait_request_.Empty())
+                    break;
+
+                is_dispatched = true;
+                is_posted = false;
+            }
+
+            BitRequestList::Iterator it = wait_request_.Begin();
+            if (requesting_list_.IsExistRequest(it->index, it->begin, it->length))
+            {
+                wait_request_.Erase(it);
+            }
+            else if (!download_limiter_.Consume(it->length))
+            {
+                // no download tokens, the task resumes us later
+                download_throttled_ = true;
+                break;
+            }
+            else
+            {
+                PostRequest(requesting_list_.Splice(wait_request_, it));
+                is_posted = true;
+            }
         }
     }
 
@@ -603,35 +1373,264 @@ namespace core {
         }
     }
 
+    void BitPeerConnection::RequestBlockHashes(std::size_t piece_index)
+    {
+        if (!cache_->NeedBlockHashes(piece_index))
+            return ;
+
+        bentypes::MetainfoFile::MerklePiece piece;
+        if (!bitdata_->GetMetainfoFile()->GetMerklePiece(piece_index, &piece))
+            return ;
+
+        HashRequest request;
+        request.pieces_root = piece.pieces_root;
+        request.base_layer = 0;
+        request.index = static_cast<int>(piece.first_leaf);
+        request.length = static_cast<int>(piece.leaf_count);
+        request.proof_layers = 0;
+        SendHashMessage(HASH_REQUEST, request, std::vector<Sha256Value>());
+
+        if (hash_request_pieces_.size() >= max_hash_request_pieces)
+            hash_request_pieces_.pop_front();
+        hash_request_pieces_.push_back(piece_index);
+    }
+
+    void BitPeerConnection::GetHashRequestPieces(
+            const HashRequest& request,
+            std::vector<std::size_t>& piece_indexes) const
+    {
+        // the request is the leaves of one piece, of every file of the root
+        const bentypes::MetainfoFile *metainfo_file = bitdata_->GetMetainfoFile();
+        if (request.index < 0 || request.length <= 0)
+            return ;
+
+        std::vector<std::size_t> file_indexes;
+        metainfo_file->FindMerkleFiles(request.pieces_root, &file_indexes);
+
+        std::size_t leaves_per_piece = bitdata_->GetPieceLength() / BitMerkleTree::block_size;
+        std::size_t index = static_cast<std::size_t>(request.index);
+        std::size_t piece_of_file = index / leaves_per_piece;
+        for (std::size_t i = 0; i < file_indexes.size(); ++i)
+        {
+            bentypes::MetainfoFile::MerkleFile file;
+            bentypes::MetainfoFile::MerklePiece piece;
+            if (!metainfo_file->GetMerkleFile(file_indexes[i], &file) ||
+                piece_of_file >= file.piece_count ||
+                !metainfo_file->GetMerklePiece(file.first_piece + piece_of_file, &piece) ||
+                piece.first_leaf != index ||
+                piece.leaf_count != static_cast<std::size_t>(request.length))
+                continue;
+
+            piece_indexes.push_back(file.first_piece + piece_of_file);
+        }
+    }
+
+    bool BitPeerConnection::TakeHashRequestPiece(const HashRequest& request,
+                                                 std::size_t *piece_index)
+    {
+        // the reply is for the piece we requested, not other files of
+        // the same root
+        std::vector<std::size_t> piece_indexes;
+        GetHashRequestPieces(request, piece_indexes);
+        for (std::deque<std::size_t>::iterator it = hash_request_pieces_.begin();
+                it != hash_request_pieces_.end(); ++it)
+        {
+            if (std::find(piece_indexes.begin(), piece_indexes.end(), *it) !=
+                piece_indexes.end())
+            {
+                *piece_index = *it;
+                hash_request_pieces_.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool BitPeerConnection::GetLayerHashes(const HashRequest& request,
+                                           std::vector<Sha256Value>& hashes) const
+    {
+        // files of the root have the same piece layer, any of them
+        const bentypes::MetainfoFile *metainfo_file = bitdata_->GetMetainfoFile();
+        std::vector<std::size_t> file_indexes;
+        metainfo_file->FindMerkleFiles(request.pieces_root, &file_indexes);
+
+        bentypes::MetainfoFile::MerkleFile file;
+        if (file_indexes.empty() ||
+            !metainfo_file->GetMerkleFile(file_indexes[0], &file) ||
+            file.piece_count < 2 || request.index < 0 ||
+            request.length <= 0 || request.length > max_request_hashes ||
+            request.proof_layers < 0)
+            return false;
+
+        // hashes of the piece layer, the proof is the uncles above the
+        // subtree of the hashes
+        std::size_t piece_layer = BitMerkleTree::Log2(
+                bitdata_->GetPieceLength() / BitMerkleTree::block_size);
+        std::size_t index = static_cast<std::size_t>(request.index);
+        std::size_t length = static_cast<std::size_t>(request.length);
+        std::size_t width = BitMerkleTree::RoundUpPower2(file.piece_count);
+        if (static_cast<std::size_t>(request.base_layer) != piece_layer ||
+            BitMerkleTree::RoundUpPower2(length) != length ||
+            index % length != 0 || index + length > width)
+            return false;
+
+        std::vector<Sha256Value> layer;
+        metainfo_file->GetPieceLayer(file_indexes[0], &layer);
+        Sha256Value pad = BitMerkleTree::PadHash(piece_layer);
+        for (std::size_t i = index; i < index + length; ++i)
+            hashes.push_back(i < layer.size() ? layer[i] : pad);
+
+        std::size_t subtree_layers = BitMerkleTree::Log2(length);
+        std::size_t proof_layers = static_cast<std::size_t>(request.proof_layers);
+        if (proof_layers > subtree_layers)
+        {
+            std::vector<Sha256Value> proof;
+            BitMerkleTree::GetProof(layer, width, piece_layer, index, proof_layers, proof);
+            if (proof.size() > subtree_layers)
+                hashes.insert(hashes.end(), proof.begin() + subtree_layers, proof.end());
+        }
+        return true;
+    }
+
+    void BitPeerConnection::ReadHashRequestPiece()
+    {
+        while (!peer_hash_requests_.empty())
+        {
+            // only the data of the file in the piece is read, the piece
+            // read is charged to upload tokens of the peer
+            const PieceHashRequest& front = peer_hash_requests_.front();
+            bentypes::MetainfoFile::MerklePiece merkle;
+            if (bitdata_->GetMetainfoFile()->GetMerklePiece(front.piece_index, &merkle) &&
+                upload_limiter_.Consume(merkle.data_length))
+            {
+                cache_->Read(front.piece_index, 0, merkle.data_length,
+                        std::tr1::bind(&BitPeerConnection::CompleteReadBlockHashes,
+                            shared_from_this(),
+                            std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+                return ;
+            }
+
+            SendHashMessage(HASH_REJECT, front.request, std::vector<Sha256Value>());
+            peer_hash_requests_.pop_front();
+        }
+    }
+
+    void BitPeerConnection::CompleteReadBlockHashes(bool read_ok, const char *piece)
+    {
+        // connection is drop
+        if (!net_processor_ || peer_hash_requests_.empty())
+            return ;
+
+        PieceHashRequest front = peer_hash_requests_.front();
+        peer_hash_requests_.pop_front();
+
+        bentypes::MetainfoFile::MerklePiece merkle;
+        if (!read_ok ||
+            !bitdata_->GetMetainfoFile()->GetMerklePiece(front.piece_index, &merkle))
+        {
+            SendHashMessage(HASH_REJECT, front.request, std::vector<Sha256Value>());
+        }
+        else
+        {
+            // leaves after the file are zeros
+            std::vector<Sha256Value> leaves(merkle.leaf_count);
+            for (std::size_t begin = 0, i = 0; begin < merkle.data_length;
+                    begin += BitMerkleTree::block_size, ++i)
+            {
+                std::size_t length = merkle.data_length - begin;
+                if (length > BitMerkleTree::block_size)
+                    length = BitMerkleTree::block_size;
+                leaves[i] = BitMerkleTree::HashBlock(piece + begin, length);
+            }
+
+            // other peers request the same leaves often
+            cache_->AddPieceLeaves(front.piece_index, leaves);
+            SendPieceLeaves(front.request, front.piece_index, leaves);
+        }
+
+        ReadHashRequestPiece();
+    }
+
+    void BitPeerConnection::SendPieceLeaves(const HashRequest& request,
+                                            std::size_t piece_index,
+                                            std::vector<Sha256Value>& leaves)
+    {
+        const bentypes::MetainfoFile *metainfo_file = bitdata_->GetMetainfoFile();
+        bentypes::MetainfoFile::MerkleFile file;
+        bentypes::MetainfoFile::MerklePiece merkle;
+        if (request.proof_layers < 0 ||
+            !metainfo_file->GetMerklePiece(piece_index, &merkle) ||
+            !metainfo_file->GetMerkleFile(merkle.file_index, &file))
+        {
+            SendHashMessage(HASH_REJECT, request, std::vector<Sha256Value>());
+            return ;
+        }
+
+        // uncles above the piece are from the piece layer
+        std::size_t subtree_layers = BitMerkleTree::Log2(merkle.leaf_count);
+        std::size_t proof_layers = static_cast<std::size_t>(request.proof_layers);
+        if (proof_layers > subtree_layers && file.piece_count > 1)
+        {
+            std::vector<Sha256Value> layer;
+            metainfo_file->GetPieceLayer(merkle.file_index, &layer);
+            BitMerkleTree::GetProof(layer, BitMerkleTree::RoundUpPower2(file.piece_count),
+                    subtree_layers, piece_index - file.first_piece,
+                    proof_layers - subtree_layers, leaves);
+        }
+
+        SendHashMessage(HASHES, request, leaves);
+    }
+
     void BitPeerConnection::PostRequest(BitRequestList::Iterator it)
     {
+        // the hashes are received before the blocks from the same peer,
+        // then the blocks are verified as they arrive
+        if (merkle_hashes_)
+            RequestBlockHashes(it->index);
+
         SendRequest(it->index, it->begin, it->length);
-        request_timeouter_.ApplyTimeOut(it,
-                std::tr1::bind(&BitPeerConnection::RequestTimeOut, this, it));
+        request_timeouter_.ApplyTimeOut(it);
+
+        // requests become outstanding, snubbed time is counted from now
+        if (requesting_list_.Size() == 1)
+            receive_piece_time_ = request_timeouter_.GetApplyTime(it);
     }
 
-    void BitPeerConnection::RequestTimeOut(BitRequestList::Iterator it)
+    void BitPeerConnection::CheckRequestTimeOut()
     {
-        request_timeouter_.CancelTimeOut(it);
+        request_timeouter_.NextCheck();
+
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+        while (!requesting_list_.Empty() &&
+               request_timeouter_.IsTimeOut(requesting_list_.Begin(), now))
+            RequestTimeOut(requesting_list_.Begin());
+    }
 
+    void BitPeerConnection::RequestTimeOut(BitRequestList::Iterator it)
+    {
         BitRequestList temp;
         temp.Splice(requesting_list_, it);
+        RefundDownload(temp);
         // we request new piece block first to avoid get the new request
         // which is just the time out request
         RequestPieceBlock();
-        download_dispatcher_->ReturnRequest(temp, temp.Begin());
+        download_dispatcher_->ReturnRequest(peer_data_, temp, temp.Begin());
     }
 
     void BitPeerConnection::DeleteOutStandingRequest(BitRequestList::Iterator it)
     {
-        request_timeouter_.CancelTimeOut(it);
         requesting_list_.Erase(it);
     }
 
-    void BitPeerConnection::CancelRequest(BitRequestList::Iterator it)
+    void BitPeerConnection::ReturnWaitRequests()
     {
-        SendCancel(it->index, it->begin, it->length);
-        DeleteOutStandingRequest(it);
+        // have no download_dispatcher_, we do nothing
+        if (!download_dispatcher_)
+            return ;
+
+        BitRequestList::Iterator it = wait_request_.Begin();
+        while (it != wait_request_.End())
+            download_dispatcher_->ReturnRequest(peer_data_, wait_request_, it++);
     }
 
     void BitPeerConnection::ReturnAllRequests()
@@ -640,15 +1639,26 @@ namespace core {
         if (!download_dispatcher_)
             return ;
 
+        // blocks received from other peers are cancelled, not returned
+        SendPendingCancels();
+        RefundDownload(requesting_list_);
+
         BitRequestList::Iterator it = requesting_list_.Begin();
         while (it != requesting_list_.End())
-            download_dispatcher_->ReturnRequest(requesting_list_, it++);
+            download_dispatcher_->ReturnRequest(peer_data_, requesting_list_, it++);
 
-        it = wait_request_.Begin();
-        while (it != wait_request_.End())
-            download_dispatcher_->ReturnRequest(wait_request_, it++);
+        ReturnWaitRequests();
+    }
+
+    void BitPeerConnection::RefundDownload(const BitRequestList& requests)
+    {
+        long long bytes = 0;
+        for (BitRequestList::Const_Iterator it = requests.Begin();
+                it != requests.End(); ++it)
+            bytes += it->length;
 
-        request_timeouter_.Reset();
+        if (bytes > 0)
+            download_limiter_.Refund(bytes);
     }
 
     void BitPeerConnection::InitTimers()
@@ -660,6 +1670,8 @@ namespace core {
 
         request_timeouter_.AddToTimerService(&keep_alive_timer_);
         request_timeouter_.AddToTimerService(&disconnect_timer_);
+        request_timeouter_.SetCheckCallback(
+                std::tr1::bind(&BitPeerConnection::CheckRequestTimeOut, this));
 
         SetKeepAliveTimer();
         SetDisconnectTimer();
@@ -681,6 +1693,7 @@ namespace core {
     {
         request_timeouter_.RemoveFromTimerService(&keep_alive_timer_);
         request_timeouter_.RemoveFromTimerService(&disconnect_timer_);
+        request_timeouter_.ClearCheck();
     }
 
 } // namespace core
@@ -3,15 +3,25 @@
 
 #include "BitNetProcessor.h"
 #include "BitRequestList.h"
+#include "BitRequestPipeline.h"
+#include "BitTokenBucket.h"
 #include "BitDownloadingInfo.h"
+#include "BitUploadDispatcher.h"
+#include "BitChoker.h"
+#include "BitExtension.h"
+#include "BitPex.h"
 #include "../base/BaseTypes.h"
 #include "../net/TimerService.h"
 #include "../sha1/Sha1Value.h"
+#include "../sha256/Sha256Value.h"
 #include "../timer/Timer.h"
 #include <assert.h>
+#include <deque>
 #include <memory>
 #include <string>
 #include <list>
+#include <map>
+#include <vector>
 
 namespace bitwave {
 namespace core {
@@ -20,7 +30,6 @@ namespace core {
     class BitCache;
     class BitPeerData;
     class BitPeerConnection;
-    class BitUploadDispatcher;
     class BitDownloadDispatcher;
 
     // BitPeerConnection's parent interface
@@ -36,9 +45,26 @@ namespace core {
     class BitPeerConnection :
         private NotCopyable,
         public BitDownloadingInfo::Observer,
+        public BitUploadPeer,
+        public BitChokePeer,
+        public BitPexPeer,
         public std::tr1::enable_shared_from_this<BitPeerConnection>
     {
     public:
+        // peer wire protocol unpack ruler, BitMetadataConnection uses it
+        // too
+        class PeerProtocolUnpackRuler
+        {
+        public:
+            static bool CanUnpack(const char *stream,
+                    std::size_t size, std::size_t *pack_len);
+
+            // a message is never ended by the close of the stream
+            static bool CanUnpackAtEnd(const char *stream,
+                    std::size_t size, std::size_t *pack_len)
+                { return false; }
+        };
+
         BitPeerConnection(const net::AsyncSocket& socket,
                           PeerConnectionOwner *owner);
 
@@ -58,6 +84,43 @@ namespace core {
             { download_dispatcher_ = dispatcher; }
         void SetUploadDispatcher(const std::tr1::shared_ptr<BitUploadDispatcher>& dispatcher)
             { upload_dispatcher_ = dispatcher; }
+        void SetChoker(const std::tr1::shared_ptr<BitChoker>& choker)
+            { choker_ = choker; }
+
+        // limiters of the task are parents of the connection limiters
+        void SetTaskLimiters(const std::tr1::shared_ptr<BitTokenBucket>& upload,
+                             const std::tr1::shared_ptr<BitTokenBucket>& download);
+
+        // limiters of the connection, peer rate limits are set on them
+        BitTokenBucket& GetUploadLimiter()
+            { return upload_limiter_; }
+        BitTokenBucket& GetDownloadLimiter()
+            { return download_limiter_; }
+
+        // request blocks again if requesting stopped for no download tokens
+        void ResumeDownload();
+
+        // weight of the peer in upload round robin, set by the choker
+        void SetUploadWeight(int weight)
+            { upload_weight_ = weight; }
+        int GetUploadWeight() const
+            { return upload_weight_; }
+
+        const std::tr1::shared_ptr<BitPeerData>& GetPeerData() const
+            { return peer_data_; }
+
+        // add an extension of extension protocol, it must be added before
+        // the handshake is sent
+        void AddExtension(const std::tr1::shared_ptr<BitExtension>& extension);
+
+        // send the payload of the extension, return false when the peer
+        // does not support the extension
+        bool SendExtensionMessage(const BitExtension *extension,
+                                  const std::string& payload);
+
+        // ip and listen port of the peer in host byte order, listen port
+        // of an accepted peer is known from its extended handshake
+        bool GetListenInfo(unsigned long *ip, unsigned short *port) const;
 
         void Connect(const net::Address& remote_address,
                      const net::Port& remote_listen_port);
@@ -71,15 +134,26 @@ namespace core {
         void OnDisconnect();
         void Complete();
 
-    private:
-        // peer wire protocol unpack ruler
-        class PeerProtocolUnpackRuler
-        {
-        public:
-            static bool CanUnpack(const char *stream,
-                    std::size_t size, std::size_t *pack_len);
-        };
+        // send CANCEL of the requests which are received from other peers
+        void FlushCancels();
+
+        // choke or unchoke the peer, requests of the peer are discarded
+        // when it is choked
+        void SetChoke(bool choke);
+        bool IsChoking() const
+            { return connection_state_.am_choking; }
+        bool IsPeerInterested() const
+            { return connection_state_.peer_interested; }
 
+        // we are waiting piece data, but the peer sends nothing in 60
+        // seconds
+        bool IsSnubbed() const;
+
+        // rates of piece data of the peer data
+        double GetDownloadRate();
+        double GetUploadRate();
+
+    private:
         struct ConnectionState
         {
             ConnectionState()
@@ -101,10 +175,14 @@ namespace core {
             bool peer_interested;
         };
 
+        // requests of requesting list are in the sent order, so time out
+        // is checked every second from the front of the list, and cancel
+        // a request need nothing
         class RequestTimeouter : private NotCopyable
         {
         public:
             static const int time_out_millisecond = 60 * 1000;
+            static const int check_millisecond = 1000;
 
             explicit RequestTimeouter(net::IoService& io_service)
                 : timer_service(io_service)
@@ -114,73 +192,76 @@ namespace core {
 
             ~RequestTimeouter()
             {
-                Reset();
+                ClearCheck();
             }
 
-            template<typename TimeOutCallback>
-            void ApplyTimeOut(BitRequestList::Iterator it,
-                              const TimeOutCallback& callback)
+            template<typename CheckCallback>
+            void SetCheckCallback(const CheckCallback& callback)
             {
-                Timer *timer = new Timer(time_out_millisecond);
-                TimeOutPair time_out(it, timer);
-                time_out_list_.push_back(time_out);
-                timer->SetCallback(callback);
-                AddToTimerService(timer);
+                check_timer_.SetCallback(callback);
+                NextCheck();
+                AddToTimerService(&check_timer_);
             }
 
-            void CancelTimeOut(BitRequestList::Iterator it)
+            void NextCheck()
             {
-                TimeOutList::iterator i = time_out_list_.begin();
+                check_timer_.SetDeadline(check_millisecond);
+            }
 
-                while (i != time_out_list_.end() && i->it != it)
-                    ++i;
+            void ClearCheck()
+            {
+                RemoveFromTimerService(&check_timer_);
+            }
 
-                if (i != time_out_list_.end())
-                {
-                    RemoveFromTimerService(i->timer.get());
-                    time_out_list_.erase(i);
-                }
+            // the request is sent now
+            void ApplyTimeOut(BitRequestList::Iterator it)
+            {
+                it->time = time_traits<NormalTimeType>::now();
             }
 
-            void AddToTimerService(Timer *timer)
+            bool IsTimeOut(BitRequestList::Iterator it, NormalTimeType now) const
             {
-                timer_service->AddTimer(timer);
+                return now - it->time >= time_out_millisecond;
             }
 
-            void RemoveFromTimerService(Timer *timer)
+            // the time of ApplyTimeOut, it is the request sent time
+            NormalTimeType GetApplyTime(BitRequestList::Iterator it) const
             {
-                timer_service->DelTimer(timer);
+                return it->time;
             }
 
-            void Reset()
+            void AddToTimerService(Timer *timer)
             {
-                TimeOutList::iterator it = time_out_list_.begin();
-                while (it != time_out_list_.end())
-                {
-                    RemoveFromTimerService(it->timer.get());
-                    ++it;
-                }
-
-                time_out_list_.clear();
+                timer_service->AddTimer(timer);
             }
 
-        private:
-            struct TimeOutPair
+            void RemoveFromTimerService(Timer *timer)
             {
-                TimeOutPair(BitRequestList::Iterator i, Timer *t)
-                    : it(i),
-                      timer(t)
-                {
-                }
+                timer_service->DelTimer(timer);
+            }
 
-                BitRequestList::Iterator it;
-                std::tr1::shared_ptr<Timer> timer;
-            };
+        private:
+            net::ServicePtr<net::TimerService> timer_service;
+            Timer check_timer_;
+        };
 
-            typedef std::list<TimeOutPair> TimeOutList;
+        // hash request, hashes and hash reject of BEP 52 have the same
+        // header, hashes of a layer of the merkle tree of a file
+        struct HashRequest
+        {
+            Sha256Value pieces_root;
+            int base_layer;
+            int index;
+            int length;
+            int proof_layers;
+        };
 
-            net::ServicePtr<net::TimerService> timer_service;
-            TimeOutList time_out_list_;
+        // a hash request of leaves of a piece we have, the piece is read
+        // to hash its leaves
+        struct PieceHashRequest
+        {
+            HashRequest request;
+            std::size_t piece_index;
         };
 
         typedef BitNetProcessor<PeerProtocolUnpackRuler,
@@ -201,30 +282,66 @@ namespace core {
         void ProcessRequest(const char *data, std::size_t len);
         void ProcessPiece(const char *data, std::size_t len);
         void ProcessCancel(const char *data, std::size_t len);
+        void ProcessSuggestPiece(const char *data, std::size_t len);
+        void ProcessHaveAll(bool have_all, std::size_t len);
+        void ProcessRejectRequest(const char *data, std::size_t len);
+        void ProcessAllowedFast(const char *data, std::size_t len);
+        void ProcessExtended(const char *data, std::size_t len);
+        void ProcessExtendedHandshake(const char *data, std::size_t len);
+        void ProcessHashRequest(const char *data, std::size_t len);
+        void ProcessHashes(const char *data, std::size_t len);
+        void ProcessHashReject(const char *data, std::size_t len);
 
         void PreparePeerData(const std::string& peer_id);
         void DropConnection();
         void SendHandshake();
         void SendKeepAlive();
         void SendNoPayloadMessage(char id);
-        void SendHave(int piece_index);
+        void SendPieceIndexMessage(char id, int piece_index);
+        void SendPieceMap();
         void SendBitfield();
+        void SendAllowedFast();
+        void SendSuggestPieces();
         void SendRequest(int index, int begin, int length);
+        void SendRejectRequest(int index, int begin, int length);
+        void SendExtendedHandshake();
+        void SendExtendedMessage(char id, const std::string& payload);
         void SendPiece(int index, int begin, int length, const char *block);
-        void SendCancel(int index, int begin, int length);
+        void SendCancels(const BitRequestList& cancels);
+        void SendHashMessage(char id, const HashRequest& request,
+                             const std::vector<Sha256Value>& hashes);
         void OnHandshake();
 
         void SetInterested(bool interested);
-        void SetChoke(bool choke);
         void HavePiece(std::size_t piece_index);
+        bool IsAllowedFastPiece(int piece_index) const;
+        void RejectPeerRequests();
         void RequestPieceBlock();
+        void RequestBlockHashes(std::size_t piece_index);
+        void GetHashRequestPieces(const HashRequest& request,
+                                  std::vector<std::size_t>& piece_indexes) const;
+        bool TakeHashRequestPiece(const HashRequest& request,
+                                  std::size_t *piece_index);
+        bool GetLayerHashes(const HashRequest& request,
+                            std::vector<Sha256Value>& hashes) const;
+        void ReadHashRequestPiece();
+        void CompleteReadBlockHashes(bool read_ok, const char *piece);
+        void SendPieceLeaves(const HashRequest& request,
+                             std::size_t piece_index,
+                             std::vector<Sha256Value>& leaves);
 
         void PendingUploadRequest();
         void PostRequest(BitRequestList::Iterator it);
+        void CheckRequestTimeOut();
         void RequestTimeOut(BitRequestList::Iterator it);
         void DeleteOutStandingRequest(BitRequestList::Iterator it);
-        void CancelRequest(BitRequestList::Iterator it);
+        void ReturnWaitRequests();
         void ReturnAllRequests();
+        // take the pending cancels of the peer, return false when none
+        bool SendPendingCancels();
+        // outstanding requests are gone without data, give back their
+        // download tokens
+        void RefundDownload(const BitRequestList& requests);
 
         void InitTimers();
         void SetKeepAliveTimer();
@@ -239,12 +356,46 @@ namespace core {
         BitRequestList wait_request_;
         BitRequestList requesting_list_;
         RequestTimeouter request_timeouter_;
+        BitRequestPipeline request_pipeline_;
+        // time of last piece received, or requests become outstanding
+        NormalTimeType receive_piece_time_;
+        BitTokenBucket upload_limiter_;
+        BitTokenBucket download_limiter_;
+        // requesting is stopped for no download tokens
+        bool download_throttled_;
+        // piece index of the last request of the peer
+        int last_request_index_;
+        int upload_weight_;
+        // both sides support fast extension
+        bool fast_extension_;
+        // allowed fast set of the peer, it can request these pieces when
+        // it is choked
+        std::vector<std::size_t> allowed_fast_set_;
+        // both sides support extension protocol
+        bool extension_protocol_;
+        // extensions of local message id 1, 2, ...
+        std::vector<std::tr1::shared_ptr<BitExtension> > extensions_;
+        // extension name to message id of the peer
+        std::map<std::string, char> peer_extension_ids_;
+        // both sides support hash messages of BEP 52
+        bool merkle_hashes_;
+        // pieces of block hashes requested from the peer and not replied,
+        // the request does not tell the piece when files share a root
+        std::deque<std::size_t> hash_request_pieces_;
+        // hash requests of the peer which read pieces, one piece is read
+        // at a time
+        std::deque<PieceHashRequest> peer_hash_requests_;
+        // listen port of the peer in host byte order, 0 is unknown
+        unsigned short remote_listen_port_;
         std::tr1::shared_ptr<BitCache> cache_;
         std::tr1::shared_ptr<BitData> bitdata_;
         std::tr1::shared_ptr<BitPeerData> peer_data_;
         std::tr1::shared_ptr<NetProcessor> net_processor_;
         std::tr1::shared_ptr<BitUploadDispatcher> upload_dispatcher_;
         std::tr1::shared_ptr<BitDownloadDispatcher> download_dispatcher_;
+        std::tr1::shared_ptr<BitChoker> choker_;
+        std::tr1::shared_ptr<BitTokenBucket> task_upload_limiter_;
+        std::tr1::shared_ptr<BitTokenBucket> task_download_limiter_;
     };
 
 } // namespace core
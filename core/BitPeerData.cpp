@@ -1,23 +1,46 @@
 #include "BitPeerData.h"
+#include "BitPieceAvailability.h"
 
 namespace bitwave {
 namespace core {
 
     BitPeerData::BitPeerData(const std::string& peer_id,
-                             std::size_t piece_count)
+                             std::size_t piece_count,
+                             const AvailabilityPtr& availability)
         : peer_id_(peer_id),
-          piece_map_(piece_count)
+          piece_count_(piece_count),
+          piece_map_(piece_count),
+          allowed_fast_(piece_count),
+          allowed_fast_count_(0),
+          availability_(availability),
+          corrupt_blocks_(0)
     {
     }
 
     void BitPeerData::PeerHavePiece(int piece_index)
     {
+        if (piece_index < 0 ||
+            static_cast<std::size_t>(piece_index) >= piece_count_ ||
+            piece_map_.IsPieceMark(piece_index))
+            return ;
+
         piece_map_.MarkPiece(piece_index);
+        AvailabilityPtr availability = availability_.lock();
+        if (availability)
+            availability->IncreasePiece(piece_index);
     }
 
     bool BitPeerData::SetPeerBitfield(const char *bit_field, std::size_t size)
     {
-        return piece_map_.MarkPieceFromBitfield(bit_field, size);
+        AvailabilityPtr availability = availability_.lock();
+        if (availability)
+            availability->DecreasePieceMap(piece_map_);
+
+        bool result = piece_map_.MarkPieceFromBitfield(bit_field, size);
+
+        if (availability)
+            availability->IncreasePieceMap(piece_map_);
+        return result;
     }
 
     const BitPieceMap& BitPeerData::GetPieceMap() const
@@ -25,5 +48,102 @@ namespace core {
         return piece_map_;
     }
 
+    void BitPeerData::PeerHaveAll()
+    {
+        AvailabilityPtr availability = availability_.lock();
+        if (availability)
+            availability->DecreasePieceMap(piece_map_);
+
+        for (std::size_t i = 0; i < piece_count_; ++i)
+            piece_map_.MarkPiece(i);
+
+        if (availability)
+            availability->IncreasePieceMap(piece_map_);
+    }
+
+    void BitPeerData::AllowFastPiece(int piece_index)
+    {
+        if (piece_index < 0 ||
+            static_cast<std::size_t>(piece_index) >= piece_count_ ||
+            allowed_fast_.IsPieceMark(piece_index))
+            return ;
+
+        allowed_fast_.MarkPiece(piece_index);
+        ++allowed_fast_count_;
+    }
+
+    void BitPeerData::DisallowFastPiece(int piece_index)
+    {
+        if (piece_index < 0 ||
+            static_cast<std::size_t>(piece_index) >= piece_count_ ||
+            !allowed_fast_.IsPieceMark(piece_index))
+            return ;
+
+        allowed_fast_.UnMarkPiece(piece_index);
+        --allowed_fast_count_;
+    }
+
+    void BitPeerData::SuggestPiece(int piece_index)
+    {
+        // keep the latest suggestions
+        const std::size_t max_suggested_pieces = 16;
+
+        if (piece_index < 0 ||
+            static_cast<std::size_t>(piece_index) >= piece_count_)
+            return ;
+
+        if (suggested_pieces_.size() >= max_suggested_pieces)
+            suggested_pieces_.pop_front();
+        suggested_pieces_.push_back(piece_index);
+    }
+
+    bool BitPeerData::TakeSuggestedPiece(std::size_t *piece_index)
+    {
+        if (suggested_pieces_.empty())
+            return false;
+
+        *piece_index = suggested_pieces_.front();
+        suggested_pieces_.pop_front();
+        return true;
+    }
+
+    void BitPeerData::LeaveAvailability()
+    {
+        AvailabilityPtr availability = availability_.lock();
+        if (availability)
+            availability->DecreasePieceMap(piece_map_);
+        availability_.reset();
+    }
+
+    void BitPeerData::AddDownloaded(long long bytes)
+    {
+        download_rate_.AddBytes(bytes);
+    }
+
+    double BitPeerData::GetDownloadRate()
+    {
+        return download_rate_.GetRate();
+    }
+
+    void BitPeerData::AddUploaded(long long bytes)
+    {
+        upload_rate_.AddBytes(bytes);
+    }
+
+    double BitPeerData::GetUploadRate()
+    {
+        return upload_rate_.GetRate();
+    }
+
+    void BitPeerData::AddCorruptBlock()
+    {
+        ++corrupt_blocks_;
+    }
+
+    std::size_t BitPeerData::GetCorruptBlocks() const
+    {
+        return corrupt_blocks_;
+    }
+
 } // namespace core
 } // namespace bitwave
@@ -2,25 +2,77 @@
 #define BIT_PEER_DATA_H
 
 #include "BitPieceMap.h"
+#include "BitRateMeter.h"
 #include "../base/BaseTypes.h"
+#include <deque>
+#include <memory>
 #include <string>
 
 namespace bitwave {
 namespace core {
 
+    class BitPieceAvailability;
+
     class BitPeerData : private NotCopyable
     {
     public:
-        explicit BitPeerData(const std::string& peer_id,
-                             std::size_t piece_count);
+        typedef std::tr1::shared_ptr<BitPieceAvailability> AvailabilityPtr;
+
+        // pieces of the peer are counted in availability, if it is not
+        // null. The peer data maybe outlive the task, so availability is
+        // only weakly referenced
+        BitPeerData(const std::string& peer_id,
+                    std::size_t piece_count,
+                    const AvailabilityPtr& availability = AvailabilityPtr());
 
         void PeerHavePiece(int piece_index);
         bool SetPeerBitfield(const char *bit_field, std::size_t size);
         const BitPieceMap& GetPieceMap() const;
 
+        // the peer has all pieces, HAVE_ALL of fast extension
+        void PeerHaveAll();
+
+        // pieces the peer allows us to request when it chokes us
+        void AllowFastPiece(int piece_index);
+        void DisallowFastPiece(int piece_index);
+        const BitPieceMap& GetAllowedFast() const
+            { return allowed_fast_; }
+        bool HasAllowedFast() const
+            { return allowed_fast_count_ > 0; }
+
+        // pieces the peer suggests, they are in the cache of the peer,
+        // a suggestion is taken once
+        void SuggestPiece(int piece_index);
+        bool TakeSuggestedPiece(std::size_t *piece_index);
+
+        // remove pieces of the peer from availability, when peer leave
+        void LeaveAvailability();
+
+        // piece data bytes received from the peer
+        void AddDownloaded(long long bytes);
+        // bytes per second of piece data received from the peer
+        double GetDownloadRate();
+
+        // piece data bytes sent to the peer
+        void AddUploaded(long long bytes);
+        // bytes per second of piece data sent to the peer
+        double GetUploadRate();
+
+        // blocks of the peer which do not match their merkle hashes
+        void AddCorruptBlock();
+        std::size_t GetCorruptBlocks() const;
+
     private:
         std::string peer_id_;
+        std::size_t piece_count_;
         BitPieceMap piece_map_;
+        BitPieceMap allowed_fast_;
+        std::size_t allowed_fast_count_;
+        std::deque<std::size_t> suggested_pieces_;
+        std::tr1::weak_ptr<BitPieceAvailability> availability_;
+        BitRateMeter download_rate_;
+        BitRateMeter upload_rate_;
+        std::size_t corrupt_blocks_;
     };
 
 } // namespace core
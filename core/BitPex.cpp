@@ -0,0 +1,237 @@
+#include "BitPex.h"
+#include "BitException.h"
+#include "BitPeerConnection.h"
+#include "bencode/BenEncoder.h"
+#include "bencode/BenTypes.h"
+#include "../net/NetHelper.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <string.h>
+#include <functional>
+#include <string>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        // deltas are sent to a peer once a minute, and a message has at
+        // most 50 added and 50 dropped peers
+        const int pex_interval = 60 * 1000;
+        const std::size_t max_pex_peers = 50;
+        // messages of a peer faster than this are ignored
+        const NormalTimeType min_receive_interval = 30 * 1000;
+        // bytes of a compact peer, 4 bytes ip and 2 bytes port
+        const std::size_t compact_peer_size = 6;
+
+        typedef std::vector<BitData::PeerListenInfo> PeerList;
+
+        // compact peers, 6 bytes of each peer
+        std::string CompactPeers(const PeerList& peers)
+        {
+            std::string compact;
+            compact.reserve(peers.size() * compact_peer_size);
+            for (PeerList::const_iterator it = peers.begin();
+                    it != peers.end(); ++it)
+            {
+                unsigned int ip = net::HostToNeti(
+                        static_cast<unsigned int>(it->ip));
+                unsigned short port = net::HostToNets(it->port);
+                compact.append(reinterpret_cast<const char *>(&ip), sizeof(ip));
+                compact.append(reinterpret_cast<const char *>(&port), sizeof(port));
+            }
+            return compact;
+        }
+
+    } // unnamed namespace
+
+    BitUtPex::BitUtPex(BitPexPeer *peer,
+                       const std::tr1::shared_ptr<BitData>& bitdata)
+        : peer_(peer),
+          bitdata_(bitdata),
+          receive_time_(0),
+          send_time_(0),
+          is_received_(false),
+          is_sent_(false)
+    {
+    }
+
+    void BitUtPex::OnMessage(const char *data, std::size_t len)
+    {
+        Receive(data, len, time_traits<NormalTimeType>::now());
+    }
+
+    void BitUtPex::Receive(const char *data, std::size_t len, NormalTimeType now)
+    {
+        using namespace bentypes;
+        if (len == 0 ||
+            (is_received_ && now - receive_time_ < min_receive_interval))
+            return ;
+
+        receive_time_ = now;
+        is_received_ = true;
+
+        try
+        {
+            BenTypesStreamBuf buf(data, len);
+            std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+            BenDictionary *message = dynamic_cast<BenDictionary *>(object.get());
+            if (message)
+                AddPeers(message->ValueBenTypeCast<BenString>("added"));
+        }
+        catch (const BenTypeException&)
+        {
+            // invalid message is ignored
+        }
+    }
+
+    void BitUtPex::AddPeers(const bentypes::BenString *peers)
+    {
+        if (!peers)
+            return ;
+
+        std::size_t count = peers->length() / compact_peer_size;
+        if (count > max_pex_peers)
+            count = max_pex_peers;
+
+        const char *data = peers->data();
+        for (std::size_t i = 0; i < count; ++i, data += compact_peer_size)
+        {
+            unsigned int ip = 0;
+            unsigned short port = 0;
+            memcpy(&ip, data, sizeof(ip));
+            memcpy(&port, data + sizeof(ip), sizeof(port));
+
+            ip = net::NetToHosti(ip);
+            port = net::NetToHosts(port);
+            if (ip != 0 && port != 0)
+                bitdata_->AddPeerListenInfo(ip, port);
+        }
+    }
+
+    void BitUtPex::SendDelta(const BitData::ListenInfoSet& connected,
+                             NormalTimeType now)
+    {
+        if (is_sent_ &&
+            now - send_time_ < static_cast<NormalTimeType>(pex_interval))
+            return ;
+
+        BitData::PeerListenInfo self(0, 0);
+        peer_->GetListenInfo(&self.ip, &self.port);
+
+        PeerList added;
+        for (BitData::ListenInfoSet::const_iterator it = connected.begin();
+                it != connected.end() && added.size() < max_pex_peers; ++it)
+        {
+            if (sent_.find(*it) == sent_.end() &&
+                (it->ip != self.ip || it->port != self.port))
+                added.push_back(*it);
+        }
+
+        PeerList dropped;
+        for (BitData::ListenInfoSet::const_iterator it = sent_.begin();
+                it != sent_.end() && dropped.size() < max_pex_peers; ++it)
+        {
+            if (connected.find(*it) == connected.end())
+                dropped.push_back(*it);
+        }
+
+        if (added.empty() && dropped.empty())
+            return ;
+
+        // d5:added<peers>7:added.f<flags>7:dropped<peers>e
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter message(writer);
+            message.Add("added", CompactPeers(added));
+            message.Add("added.f", std::string(added.size(), '\0'));
+            message.Add("dropped", CompactPeers(dropped));
+        }
+
+        // the peer does not support ut_pex
+        if (!peer_->SendExtensionMessage(this, writer.GetString()))
+            return ;
+
+        send_time_ = now;
+        is_sent_ = true;
+        sent_.insert(added.begin(), added.end());
+        for (PeerList::iterator it = dropped.begin(); it != dropped.end(); ++it)
+            sent_.erase(*it);
+    }
+
+    BitPex::BitPex(const std::tr1::shared_ptr<BitData>& bitdata,
+                   net::IoService& io_service)
+        : io_service_(io_service),
+          bitdata_(bitdata)
+    {
+        pex_timer_.SetCallback(std::tr1::bind(&BitPex::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&pex_timer_);
+        pex_timer_.SetDeadline(pex_interval);
+    }
+
+    BitPex::~BitPex()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&pex_timer_);
+    }
+
+    void BitPex::AddPeer(const ConnectionPtr& peer)
+    {
+        std::tr1::shared_ptr<BitUtPex> ut_pex(new BitUtPex(peer.get(), bitdata_));
+        peer->AddExtension(ut_pex);
+        peers_.push_back(PexPeer(peer, ut_pex));
+    }
+
+    void BitPex::RemovePeer(const ConnectionPtr& peer)
+    {
+        for (PexPeers::iterator it = peers_.begin(); it != peers_.end(); ++it)
+        {
+            if (it->connection.lock() == peer)
+            {
+                peers_.erase(it);
+                break;
+            }
+        }
+    }
+
+    void BitPex::OnTimer()
+    {
+        // connections and extensions are kept, peers_ may be changed
+        // when a connection is dropped in sending
+        std::vector<ConnectionPtr> connections;
+        std::vector<std::tr1::shared_ptr<BitUtPex> > extensions;
+        BitData::ListenInfoSet connected;
+
+        PexPeers::iterator it = peers_.begin();
+        while (it != peers_.end())
+        {
+            ConnectionPtr peer = it->connection.lock();
+            if (!peer)
+            {
+                it = peers_.erase(it);
+                continue;
+            }
+
+            BitData::PeerListenInfo info(0, 0);
+            if (peer->GetListenInfo(&info.ip, &info.port))
+                connected.insert(info);
+
+            connections.push_back(peer);
+            extensions.push_back(it->extension);
+            ++it;
+        }
+
+        NormalTimeType now = time_traits<NormalTimeType>::now();
+        for (std::size_t i = 0; i < extensions.size(); ++i)
+            extensions[i]->SendDelta(connected, now);
+
+        pex_timer_.SetDeadline(pex_interval);
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,119 @@
+#ifndef BIT_PEX_H
+#define BIT_PEX_H
+
+#include "BitData.h"
+#include "BitExtension.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../timer/Timer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitPeerConnection;
+
+    namespace bentypes {
+        class BenString;
+    } // namespace bentypes
+
+    // a peer of peer exchange, BitPeerConnection is one
+    class BitPexPeer
+    {
+    public:
+        // ip and listen port of the peer in host byte order
+        virtual bool GetListenInfo(unsigned long *ip, unsigned short *port) const = 0;
+        // return false when the peer does not support the extension
+        virtual bool SendExtensionMessage(const BitExtension *extension,
+                                          const std::string& payload) = 0;
+        virtual ~BitPexPeer() { }
+    };
+
+    // ut_pex extension of one peer connection. A message of the peer is
+    // received at most every 30 seconds and a message is sent to the peer
+    // at most every minute, a message has at most 50 added and 50 dropped
+    // peers
+    class BitUtPex : public BitExtension
+    {
+    public:
+        BitUtPex(BitPexPeer *peer, const std::tr1::shared_ptr<BitData>& bitdata);
+
+        virtual const char * GetName() const
+        {
+            return "ut_pex";
+        }
+
+        virtual void OnMessage(const char *data, std::size_t len);
+
+        // the message is received at now, added peers of it are added to
+        // the task
+        void Receive(const char *data, std::size_t len, NormalTimeType now);
+
+        // send peers added and dropped since the last message at now, the
+        // peer must be alive
+        void SendDelta(const BitData::ListenInfoSet& connected, NormalTimeType now);
+
+    private:
+        void AddPeers(const bentypes::BenString *peers);
+
+        // the connection owns this extension
+        BitPexPeer *peer_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+        // connected peers which are sent to the peer
+        BitData::ListenInfoSet sent_;
+        NormalTimeType receive_time_;
+        NormalTimeType send_time_;
+        bool is_received_;
+        bool is_sent_;
+    };
+
+    // peer exchange (ut_pex, BEP 11) of a task. Every minute, the peers
+    // which support ut_pex are sent the connected peers added and dropped
+    // since the last message to them, and peers received from them are
+    // added to the task as peers from tracker
+    class BitPex : private NotCopyable
+    {
+    public:
+        typedef std::tr1::shared_ptr<BitPeerConnection> ConnectionPtr;
+        typedef std::tr1::weak_ptr<BitPeerConnection> ConnectionWeakPtr;
+
+        BitPex(const std::tr1::shared_ptr<BitData>& bitdata,
+               net::IoService& io_service);
+
+        ~BitPex();
+
+        // the ut_pex extension is added to the peer, so the peer must be
+        // added before its handshake is sent
+        void AddPeer(const ConnectionPtr& peer);
+        void RemovePeer(const ConnectionPtr& peer);
+
+    private:
+        struct PexPeer
+        {
+            PexPeer(const ConnectionPtr& peer,
+                    const std::tr1::shared_ptr<BitUtPex>& ut_pex)
+                : connection(peer),
+                  extension(ut_pex)
+            {
+            }
+
+            ConnectionWeakPtr connection;
+            std::tr1::shared_ptr<BitUtPex> extension;
+        };
+
+        typedef std::vector<PexPeer> PexPeers;
+
+        void OnTimer();
+
+        net::IoService& io_service_;
+        Timer pex_timer_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+        PexPeers peers_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_PEX_H
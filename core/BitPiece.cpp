@@ -19,6 +19,35 @@ namespace core {
         MarkWriteBlock(begin, begin + length);
     }
 
+    void BitPiece::ClearBlock(std::size_t begin,
+                              std::size_t length)
+    {
+        if (state_ != NOT_CHECKED || begin >= data_.size())
+            return ;
+
+        std::size_t end = begin + length;
+        if (end > data_.size())
+            end = data_.size();
+        memset(&data_[begin], 0, end - begin);
+
+        // cut [begin, end) out of the written ranges
+        std::vector<std::pair<std::size_t, std::size_t>> writed;
+        for (std::size_t i = 0; i < writed_.size(); ++i)
+        {
+            if (writed_[i].second <= begin || writed_[i].first >= end)
+            {
+                writed.push_back(writed_[i]);
+                continue;
+            }
+
+            if (writed_[i].first < begin)
+                writed.push_back(std::make_pair(writed_[i].first, begin));
+            if (writed_[i].second > end)
+                writed.push_back(std::make_pair(end, writed_[i].second));
+        }
+        writed_.swap(writed);
+    }
+
     bool BitPiece::IsComplete() const
     {
         if (writed_.empty())
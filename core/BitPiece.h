@@ -73,6 +73,10 @@ namespace core {
                         std::size_t length,
                         const char *block);
 
+        // drop a written block, it is zeros and not written again
+        void ClearBlock(std::size_t begin,
+                        std::size_t length);
+
         bool IsComplete() const;
 
         static bool IsReadTimeOld(const BitPiece& left,
@@ -0,0 +1,138 @@
+#include "BitPieceAvailability.h"
+#include "BitPieceMap.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace bitwave {
+namespace core {
+
+    BitPieceAvailability::BitPieceAvailability(std::size_t piece_count)
+        : counts_(piece_count),
+          pieces_(piece_count),
+          position_(piece_count)
+    {
+        for (std::size_t i = 0; i < piece_count; ++i)
+        {
+            pieces_[i] = i;
+            position_[i] = i;
+        }
+
+        // only the bucket of availability 0, contains all pieces
+        bucket_begin_.push_back(0);
+        bucket_begin_.push_back(piece_count);
+    }
+
+    void BitPieceAvailability::IncreasePiece(std::size_t piece_index)
+    {
+        if (piece_index >= counts_.size())
+            return ;
+
+        std::size_t count = counts_[piece_index]++;
+        if (IsPieceRemoved(piece_index))
+            return ;
+
+        // add a new empty bucket at the end
+        if (count + 2 >= bucket_begin_.size())
+            bucket_begin_.push_back(pieces_.size());
+
+        // move the piece to the last of its bucket, then it becomes
+        // the first of next bucket
+        std::size_t last = bucket_begin_[count + 1] - 1;
+        SwapPosition(position_[piece_index], last);
+        --bucket_begin_[count + 1];
+    }
+
+    void BitPieceAvailability::DecreasePiece(std::size_t piece_index)
+    {
+        if (piece_index >= counts_.size() || counts_[piece_index] == 0)
+            return ;
+
+        std::size_t count = counts_[piece_index]--;
+        if (IsPieceRemoved(piece_index))
+            return ;
+
+        // move the piece to the first of its bucket, then it becomes
+        // the last of previous bucket
+        std::size_t first = bucket_begin_[count];
+        SwapPosition(position_[piece_index], first);
+        ++bucket_begin_[count];
+
+        // drop empty buckets at the end
+        while (bucket_begin_.size() > 2 &&
+               bucket_begin_[bucket_begin_.size() - 2] == pieces_.size())
+            bucket_begin_.pop_back();
+    }
+
+    void BitPieceAvailability::IncreasePieceMap(const BitPieceMap& piece_map)
+    {
+        std::size_t index = 0;
+        while (piece_map.FindFirstMark(index, &index))
+            IncreasePiece(index++);
+    }
+
+    void BitPieceAvailability::DecreasePieceMap(const BitPieceMap& piece_map)
+    {
+        std::size_t index = 0;
+        while (piece_map.FindFirstMark(index, &index))
+            DecreasePiece(index++);
+    }
+
+    void BitPieceAvailability::RemovePiece(std::size_t piece_index)
+    {
+        if (piece_index >= counts_.size() || IsPieceRemoved(piece_index))
+            return ;
+
+        // move down bucket by bucket to bucket 0, the cost is paid by
+        // the increases before
+        for (std::size_t count = counts_[piece_index]; count > 0; --count)
+        {
+            std::size_t first = bucket_begin_[count];
+            SwapPosition(position_[piece_index], first);
+            ++bucket_begin_[count];
+        }
+
+        std::size_t first = bucket_begin_[0];
+        SwapPosition(position_[piece_index], first);
+        ++bucket_begin_[0];
+
+        while (bucket_begin_.size() > 2 &&
+               bucket_begin_[bucket_begin_.size() - 2] == pieces_.size())
+            bucket_begin_.pop_back();
+    }
+
+    void BitPieceAvailability::RestorePiece(std::size_t piece_index)
+    {
+        if (piece_index >= counts_.size() || !IsPieceRemoved(piece_index))
+            return ;
+
+        // the last removed piece becomes the first of bucket 0
+        std::size_t last = bucket_begin_[0] - 1;
+        SwapPosition(position_[piece_index], last);
+        --bucket_begin_[0];
+
+        // move up bucket by bucket to the bucket of its availability
+        for (std::size_t count = 0; count < counts_[piece_index]; ++count)
+        {
+            if (count + 2 >= bucket_begin_.size())
+                bucket_begin_.push_back(pieces_.size());
+
+            last = bucket_begin_[count + 1] - 1;
+            SwapPosition(position_[piece_index], last);
+            --bucket_begin_[count + 1];
+        }
+    }
+
+    void BitPieceAvailability::SwapPosition(std::size_t pos1, std::size_t pos2)
+    {
+        if (pos1 == pos2)
+            return ;
+
+        std::size_t piece1 = pieces_[pos1];
+        std::size_t piece2 = pieces_[pos2];
+        std::swap(pieces_[pos1], pieces_[pos2]);
+        position_[piece1] = pos2;
+        position_[piece2] = pos1;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,78 @@
+#ifndef BIT_PIECE_AVAILABILITY_H
+#define BIT_PIECE_AVAILABILITY_H
+
+#include "../base/BaseTypes.h"
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitPieceMap;
+
+    // count how many peers have each piece. Pieces are kept in an array
+    // ordered by availability, every availability value is a bucket of
+    // the array, so increase and decrease one piece are O(1). Removed
+    // pieces (already downloaded) are moved out of all buckets.
+    class BitPieceAvailability : private NotCopyable
+    {
+    public:
+        explicit BitPieceAvailability(std::size_t piece_count);
+
+        void IncreasePiece(std::size_t piece_index);
+        void DecreasePiece(std::size_t piece_index);
+
+        // increase or decrease all pieces marked in piece_map
+        void IncreasePieceMap(const BitPieceMap& piece_map);
+        void DecreasePieceMap(const BitPieceMap& piece_map);
+
+        // remove the piece from buckets, it is not picked any more,
+        // but its availability still counted
+        void RemovePiece(std::size_t piece_index);
+
+        // put a removed piece back to the bucket of its availability, the
+        // piece is lost after downloaded, it is picked again
+        void RestorePiece(std::size_t piece_index);
+
+        bool IsPieceRemoved(std::size_t piece_index) const
+            { return position_[piece_index] < bucket_begin_[0]; }
+
+        std::size_t GetAvailability(std::size_t piece_index) const
+            { return counts_[piece_index]; }
+
+        std::size_t GetPieceCount() const
+            { return counts_.size(); }
+
+        // count of buckets, max availability is GetBucketCount() - 1
+        std::size_t GetBucketCount() const
+            { return bucket_begin_.size() - 1; }
+
+        // get range [begin, end) of the bucket pieces whose availability
+        // is availability, use GetPieceAt to get the pieces
+        void GetBucketRange(std::size_t availability,
+                            std::size_t& begin, std::size_t& end) const
+        {
+            begin = bucket_begin_[availability];
+            end = bucket_begin_[availability + 1];
+        }
+
+        std::size_t GetPieceAt(std::size_t position) const
+            { return pieces_[position]; }
+
+    private:
+        void SwapPosition(std::size_t pos1, std::size_t pos2);
+
+        // availability of each piece
+        std::vector<std::size_t> counts_;
+        // pieces ordered by availability, removed pieces at front
+        std::vector<std::size_t> pieces_;
+        // position of each piece in pieces_
+        std::vector<std::size_t> position_;
+        // begin position of each bucket in pieces_, the last one is
+        // the end of the max availability bucket
+        std::vector<std::size_t> bucket_begin_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_PIECE_AVAILABILITY_H
@@ -0,0 +1,175 @@
+#include "BitPieceIndexSearcher.h"
+#include "BitPieceMap.h"
+#include "BitPieceAvailability.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    namespace searcher {
+
+        class LinearPieceIndexSearcher : public BitPieceIndexSearcher
+        {
+        public:
+            virtual bool Search(const BitPieceMap& downloaded,
+                                const BitPieceMap& downloading,
+                                const BitPieceMap& need_download,
+                                const BitPieceMap& candidate,
+                                std::size_t *piece_index)
+            {
+                return BitPieceMap::FindFirstAndNotOr(need_download,
+                        downloaded, downloading, candidate, 0, piece_index);
+            }
+        };
+
+        class RarestFirstPieceIndexSearcher : public BitPieceIndexSearcher
+        {
+        public:
+            explicit RarestFirstPieceIndexSearcher(BitPieceAvailability& availability)
+                : availability_(availability),
+                  selectable_(availability.GetPieceCount())
+            {
+            }
+
+            virtual bool Search(const BitPieceMap& downloaded,
+                                const BitPieceMap& downloading,
+                                const BitPieceMap& need_download,
+                                const BitPieceMap& candidate,
+                                std::size_t *piece_index)
+            {
+                assert(piece_index);
+
+                // pieces we can select by one pass of whole words, then
+                // a piece is checked by one map only
+                BitPieceMap::AndNotOr(need_download, downloaded,
+                        downloading, candidate, selectable_);
+                std::size_t count = selectable_.Count();
+                if (count == 0)
+                    return false;
+
+                // buckets meet a selectable piece about every
+                // piece_count / count pieces, walk the selectable pieces
+                // instead when they are so sparse
+                bool found = false;
+                if (count * count <= availability_.GetPieceCount())
+                    found = SearchSelectable(piece_index);
+                else
+                    found = SearchBuckets(downloaded, piece_index);
+
+                // downloaded pieces will never be selected again
+                for (std::vector<std::size_t>::iterator it = downloaded_pieces_.begin();
+                        it != downloaded_pieces_.end(); ++it)
+                    availability_.RemovePiece(*it);
+                downloaded_pieces_.clear();
+
+                return found;
+            }
+
+        private:
+            bool SearchBuckets(const BitPieceMap& downloaded, std::size_t *piece_index)
+            {
+                bool found = false;
+                std::size_t bucket_count = availability_.GetBucketCount();
+
+                // candidate have the piece, so start at availability 1
+                for (std::size_t i = 1; i < bucket_count && !found; ++i)
+                {
+                    std::size_t begin = 0;
+                    std::size_t end = 0;
+                    availability_.GetBucketRange(i, begin, end);
+                    if (begin == end)
+                        continue;
+
+                    // start at random position of the bucket, so peers do
+                    // not converge on the same piece
+                    std::size_t start = begin + Random() % (end - begin);
+                    found = SearchRange(start, end, downloaded, piece_index) ||
+                            SearchRange(begin, start, downloaded, piece_index);
+                }
+
+                return found;
+            }
+
+            bool SearchRange(std::size_t begin, std::size_t end,
+                             const BitPieceMap& downloaded,
+                             std::size_t *piece_index)
+            {
+                for (; begin < end; ++begin)
+                {
+                    std::size_t index = availability_.GetPieceAt(begin);
+                    if (selectable_.IsPieceMark(index))
+                    {
+                        *piece_index = index;
+                        return true;
+                    }
+
+                    if (downloaded.IsPieceMark(index))
+                        downloaded_pieces_.push_back(index);
+                }
+
+                return false;
+            }
+
+            // the rarest selectable piece, from a random position, so
+            // peers do not converge on the same piece
+            bool SearchSelectable(std::size_t *piece_index)
+            {
+                std::size_t start = Random() % selectable_.GetPieceCount();
+                std::size_t rarest = static_cast<std::size_t>(-1);
+                bool found = SearchSelectable(start, selectable_.GetPieceCount(),
+                                              piece_index, &rarest);
+                if (rarest > 1)
+                    found = SearchSelectable(0, start, piece_index, &rarest) || found;
+                return found;
+            }
+
+            bool SearchSelectable(std::size_t begin, std::size_t end,
+                                  std::size_t *piece_index, std::size_t *rarest)
+            {
+                bool found = false;
+                std::size_t index = begin;
+                while (selectable_.FindFirstMark(index, &index) && index < end)
+                {
+                    // candidate have the piece, so 1 is the rarest
+                    std::size_t availability = availability_.GetAvailability(index);
+                    if (availability < *rarest)
+                    {
+                        *piece_index = index;
+                        *rarest = availability;
+                        found = true;
+                        if (availability <= 1)
+                            break;
+                    }
+                    ++index;
+                }
+
+                return found;
+            }
+
+            static std::size_t Random()
+            {
+                return (static_cast<std::size_t>(rand()) << 15) ^ rand();
+            }
+
+            BitPieceAvailability& availability_;
+            BitPieceMap selectable_;
+            std::vector<std::size_t> downloaded_pieces_;
+        };
+
+    } // namespace searcher
+
+    BitPieceIndexSearcher * CreateLinearPieceIndexSearcher()
+    {
+        return new searcher::LinearPieceIndexSearcher;
+    }
+
+    BitPieceIndexSearcher * CreateRarestFirstPieceIndexSearcher(
+            BitPieceAvailability& availability)
+    {
+        return new searcher::RarestFirstPieceIndexSearcher(availability);
+    }
+
+} // namespace core
+} // namespace bitwave
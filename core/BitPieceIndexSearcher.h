@@ -0,0 +1,37 @@
+#ifndef BIT_PIECE_INDEX_SEARCHER_H
+#define BIT_PIECE_INDEX_SEARCHER_H
+
+#include <cstddef>
+
+namespace bitwave {
+namespace core {
+
+    class BitPieceMap;
+    class BitPieceAvailability;
+
+    // base class of strategy to select next downloading piece
+    class BitPieceIndexSearcher
+    {
+    public:
+        // search a piece in candidate which need download and not
+        // downloaded or downloading, return true if found
+        virtual bool Search(const BitPieceMap& downloaded,
+                            const BitPieceMap& downloading,
+                            const BitPieceMap& need_download,
+                            const BitPieceMap& candidate,
+                            std::size_t *piece_index) = 0;
+        virtual ~BitPieceIndexSearcher() { }
+    };
+
+    // select the lowest index piece
+    BitPieceIndexSearcher * CreateLinearPieceIndexSearcher();
+
+    // select the piece which fewest peers have, pieces with same
+    // availability are selected randomly
+    BitPieceIndexSearcher * CreateRarestFirstPieceIndexSearcher(
+            BitPieceAvailability& availability);
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_PIECE_INDEX_SEARCHER_H
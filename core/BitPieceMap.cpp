@@ -1,26 +1,283 @@
 #include "BitPieceMap.h"
 #include <assert.h>
-#include <math.h>
 #include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// AVX2 kernels are compiled without /arch:AVX2, they are used only when
+// the processor and the system support AVX2, checked once at startup
+#if defined(_MSC_VER) && _MSC_VER >= 1800 && (defined(_M_IX86) || defined(_M_X64))
+#define PIECE_MAP_AVX2
+#define PIECE_MAP_TARGET
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define PIECE_MAP_AVX2
+#define PIECE_MAP_TARGET __attribute__((target("avx2,popcnt")))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 namespace bitwave {
 namespace core {
 
+    namespace {
+
+        typedef unsigned long long Word;
+        const std::size_t word_bytes = sizeof(Word);
+        const std::size_t word_bits = word_bytes * 8;
+
+        // a word loaded from memory (little endian) to piece order,
+        // then the first piece of the word is the highest bit
+        inline Word ToPieceOrder(Word word)
+        {
+#if defined(_MSC_VER)
+            return _byteswap_uint64(word);
+#else
+            return __builtin_bswap64(word);
+#endif
+        }
+
+        // word must not be zero
+        inline std::size_t LeadingZero(Word word)
+        {
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index = 0;
+            _BitScanReverse64(&index, word);
+            return 63 - index;
+#elif defined(_MSC_VER)
+            unsigned long index = 0;
+            if (_BitScanReverse(&index, static_cast<unsigned long>(word >> 32)))
+                return 31 - index;
+            _BitScanReverse(&index, static_cast<unsigned long>(word));
+            return 63 - index;
+#else
+            return __builtin_clzll(word);
+#endif
+        }
+
+        inline std::size_t PopCount(Word word)
+        {
+            word = word - ((word >> 1) & 0x5555555555555555ULL);
+            word = (word & 0x3333333333333333ULL) +
+                   ((word >> 2) & 0x3333333333333333ULL);
+            word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return static_cast<std::size_t>((word * 0x0101010101010101ULL) >> 56);
+        }
+
+        inline Word AndNotOrWord(Word include, Word exclude1,
+                                 Word exclude2, Word mask)
+        {
+            return include & ~(exclude1 | exclude2) & mask;
+        }
+
+#if defined(PIECE_MAP_AVX2)
+
+        // AVX2 of cpuid 7 ebx bit 5, POPCNT, AVX and OSXSAVE of cpuid 1
+        // ecx, and the system saves ymm registers in xcr0
+        bool HasAvx2()
+        {
+            unsigned ebx7 = 0;
+            unsigned ecx1 = 0;
+#if defined(_MSC_VER)
+            int info[4] = { 0 };
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuidex(info, 7, 0);
+            ebx7 = static_cast<unsigned>(info[1]);
+            __cpuid(info, 1);
+            ecx1 = static_cast<unsigned>(info[2]);
+#else
+            unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if (__get_cpuid_max(0, 0) < 7)
+                return false;
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            ebx7 = ebx;
+            __cpuid(1, eax, ebx, ecx, edx);
+            ecx1 = ecx;
+#endif
+            const unsigned popcnt_avx_osxsave = (1u << 23) | (1u << 28) | (1u << 27);
+            if ((ebx7 & (1u << 5)) == 0 ||
+                (ecx1 & popcnt_avx_osxsave) != popcnt_avx_osxsave)
+                return false;
+
+#if defined(_MSC_VER)
+            unsigned long long xcr0 = _xgetbv(0);
+#else
+            unsigned xcr0_low = 0, xcr0_high = 0;
+            __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+            unsigned long long xcr0 = xcr0_low;
+#endif
+            return (xcr0 & 0x6) == 0x6;
+        }
+
+        PIECE_MAP_TARGET inline std::size_t PopCountAvx2(Word word)
+        {
+#if defined(_MSC_VER) && defined(_M_X64)
+            return static_cast<std::size_t>(__popcnt64(word));
+#elif defined(_MSC_VER)
+            return __popcnt(static_cast<unsigned>(word)) +
+                   __popcnt(static_cast<unsigned>(word >> 32));
+#else
+            return __builtin_popcountll(word);
+#endif
+        }
+
+        PIECE_MAP_TARGET inline __m256i AndNotOrVector(const Word *a, const Word *b,
+                                                       const Word *c, const Word *m)
+        {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+            __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(c));
+            __m256i vm = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m));
+            return _mm256_and_si256(
+                    _mm256_andnot_si256(_mm256_or_si256(vb, vc), va), vm);
+        }
+
+        // the following kernels process whole vectors of 4 words and
+        // return the word where they stop, word loops finish the rest
+
+        PIECE_MAP_TARGET std::size_t AndNotOrAvx2(const Word *a, const Word *b,
+                                                  const Word *c, const Word *m,
+                                                  Word *r, std::size_t count)
+        {
+            std::size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i),
+                        AndNotOrVector(a + i, b + i, c + i, m + i));
+            return i;
+        }
+
+        PIECE_MAP_TARGET std::size_t CountAndNotOrAvx2(const Word *a, const Word *b,
+                                                       const Word *c, const Word *m,
+                                                       std::size_t count,
+                                                       std::size_t *result)
+        {
+            std::size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256i v = AndNotOrVector(a + i, b + i, c + i, m + i);
+                if (_mm256_testz_si256(v, v))
+                    continue;
+
+                Word words[4];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(words), v);
+                *result += PopCountAvx2(words[0]) + PopCountAvx2(words[1]) +
+                           PopCountAvx2(words[2]) + PopCountAvx2(words[3]);
+            }
+            return i;
+        }
+
+        // skip vectors of no piece from word i
+        PIECE_MAP_TARGET std::size_t SkipAndNotOrAvx2(const Word *a, const Word *b,
+                                                      const Word *c, const Word *m,
+                                                      std::size_t i, std::size_t count)
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256i v = AndNotOrVector(a + i, b + i, c + i, m + i);
+                if (!_mm256_testz_si256(v, v))
+                    break;
+            }
+            return i;
+        }
+
+        PIECE_MAP_TARGET std::size_t CountAvx2(const Word *words, std::size_t count)
+        {
+            std::size_t result = 0;
+            for (std::size_t i = 0; i < count; ++i)
+                result += PopCountAvx2(words[i]);
+            return result;
+        }
+
+        // checked at the first use, maps maybe used by static objects,
+        // 1 is AVX2 used, 0 is not used
+        int avx2_state = -1;
+
+        inline bool UseAvx2()
+        {
+            if (avx2_state < 0)
+                avx2_state = HasAvx2() ? 1 : 0;
+            return avx2_state > 0;
+        }
+
+#endif // PIECE_MAP_AVX2
+
+        struct DifferenceOp
+        {
+            template<typename T>
+            T operator () (T left, T right) const
+            {
+                return static_cast<T>(left & ~right);
+            }
+        };
+
+        struct IntersectionOp
+        {
+            template<typename T>
+            T operator () (T left, T right) const
+            {
+                return static_cast<T>(left & right);
+            }
+        };
+
+        struct UnionOp
+        {
+            template<typename T>
+            T operator () (T left, T right) const
+            {
+                return static_cast<T>(left | right);
+            }
+        };
+
+        // apply op on bytes [begin, end), whole words in the range are
+        // processed a word at a time
+        template<typename Op>
+        void ApplyByteRange(const Word *map1, const Word *map2, Word *result,
+                            std::size_t begin, std::size_t end, Op op)
+        {
+            const unsigned char *bytes1 = reinterpret_cast<const unsigned char *>(map1);
+            const unsigned char *bytes2 = reinterpret_cast<const unsigned char *>(map2);
+            unsigned char *result_bytes = reinterpret_cast<unsigned char *>(result);
+
+            for (; begin < end && begin % word_bytes; ++begin)
+                result_bytes[begin] = op(bytes1[begin], bytes2[begin]);
+
+            for (; begin + word_bytes <= end; begin += word_bytes)
+            {
+                std::size_t i = begin / word_bytes;
+                result[i] = op(map1[i], map2[i]);
+            }
+
+            for (; begin < end; ++begin)
+                result_bytes[begin] = op(bytes1[begin], bytes2[begin]);
+        }
+
+    } // namespace
+
     BitPieceMap::BitPieceMap(std::size_t piece_count)
         : RefCount(true),
           piece_map_(0),
-          map_size_(0)
+          piece_count_(piece_count),
+          map_size_(0),
+          word_count_(0)
     {
         assert(piece_count > 0);
-        map_size_ = static_cast<std::size_t>(
-            ceil(static_cast<double>(piece_count) / 8));
+        map_size_ = (piece_count + 7) / 8;
+        word_count_ = (map_size_ + word_bytes - 1) / word_bytes;
         InitMap();
     }
 
     BitPieceMap::BitPieceMap(const BitPieceMap& piece_map)
         : RefCount(piece_map),
           piece_map_(piece_map.piece_map_),
-          map_size_(piece_map.map_size_)
+          piece_count_(piece_map.piece_count_),
+          map_size_(piece_map.map_size_),
+          word_count_(piece_map.word_count_)
     {
     }
 
@@ -38,30 +295,34 @@ namespace core {
 
     void BitPieceMap::Clear()
     {
-        memset(piece_map_, 0, map_size_);
+        memset(piece_map_, 0, word_count_ * word_bytes);
     }
 
     void BitPieceMap::Swap(BitPieceMap& piece_map)
     {
         RefCount::Swap(piece_map);
         std::swap(piece_map_, piece_map.piece_map_);
+        std::swap(piece_count_, piece_map.piece_count_);
         std::swap(map_size_, piece_map.map_size_);
+        std::swap(word_count_, piece_map.word_count_);
     }
 
     void BitPieceMap::MarkPiece(std::size_t piece_index)
     {
         std::size_t index = piece_index / 8;
         std::size_t bit_index = piece_index - 8 * index;
+        unsigned char *bytes = reinterpret_cast<unsigned char *>(piece_map_);
         if (index < map_size_)
-            piece_map_[index] |= 0x01 << (7 - bit_index);
+            bytes[index] |= 0x01 << (7 - bit_index);
     }
 
     void BitPieceMap::UnMarkPiece(std::size_t piece_index)
     {
         std::size_t index = piece_index / 8;
         std::size_t bit_index = piece_index - 8 * index;
+        unsigned char *bytes = reinterpret_cast<unsigned char *>(piece_map_);
         if (index < map_size_)
-            piece_map_[index] &= ~(0x01 << (7 - bit_index));
+            bytes[index] &= ~(0x01 << (7 - bit_index));
     }
 
     bool BitPieceMap::MarkPieceFromBitfield(const char *bit_field, std::size_t size)
@@ -69,6 +330,7 @@ namespace core {
         if (map_size_ != size)
             return false;
         memcpy(piece_map_, bit_field, map_size_);
+        ClearSpareBits();
         return true;
     }
 
@@ -77,12 +339,18 @@ namespace core {
         return map_size_;
     }
 
+    std::size_t BitPieceMap::GetPieceCount() const
+    {
+        return piece_count_;
+    }
+
     bool BitPieceMap::IsPieceMark(std::size_t piece_index) const
     {
         std::size_t index = piece_index / 8;
         std::size_t bit_index = piece_index - 8 * index;
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(piece_map_);
         if (index < map_size_)
-            return (piece_map_[index] & (0x01 << (7 - bit_index))) != 0;
+            return (bytes[index] & (0x01 << (7 - bit_index))) != 0;
         return false;
     }
 
@@ -92,13 +360,59 @@ namespace core {
         memcpy(bit_field, piece_map_, map_size_);
     }
 
+    std::size_t BitPieceMap::Count() const
+    {
+#if defined(PIECE_MAP_AVX2)
+        if (UseAvx2())
+            return CountAvx2(piece_map_, word_count_);
+#endif
+
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < word_count_; ++i)
+            count += PopCount(piece_map_[i]);
+        return count;
+    }
+
+    bool BitPieceMap::FindFirstMark(std::size_t begin, std::size_t *piece_index) const
+    {
+        assert(piece_index);
+        if (begin >= piece_count_)
+            return false;
+
+        std::size_t i = begin / word_bits;
+        Word word = ToPieceOrder(piece_map_[i]) & (~0ULL >> (begin % word_bits));
+        for (++i; !word && i < word_count_; ++i)
+            word = ToPieceOrder(piece_map_[i]);
+
+        if (!word)
+            return false;
+
+        // i is the next word of the found word
+        std::size_t index = (i - 1) * word_bits + LeadingZero(word);
+        if (index >= piece_count_)
+            return false;
+
+        *piece_index = index;
+        return true;
+    }
+
     void BitPieceMap::InitMap()
     {
         assert(!piece_map_);
-        piece_map_ = new char[map_size_];
+        piece_map_ = new Word[word_count_];
         Clear();
     }
 
+    void BitPieceMap::ClearSpareBits()
+    {
+        std::size_t spare = map_size_ * 8 - piece_count_;
+        if (spare)
+        {
+            unsigned char *bytes = reinterpret_cast<unsigned char *>(piece_map_);
+            bytes[map_size_ - 1] &= static_cast<unsigned char>(0xFF << spare);
+        }
+    }
+
     // static
     void BitPieceMap::Difference(const BitPieceMap& piece_map1,
                                  const BitPieceMap& piece_map2,
@@ -112,11 +426,8 @@ namespace core {
         assert(result.map_size_ == piece_map2.map_size_);
         assert(begin <= result.map_size_ && end <= result.map_size_);
 
-        for (; begin < end; ++begin)
-        {
-            result.piece_map_[begin] =
-                piece_map1.piece_map_[begin] & (~piece_map2.piece_map_[begin]);
-        }
+        ApplyByteRange(piece_map1.piece_map_, piece_map2.piece_map_,
+                result.piece_map_, begin, end, DifferenceOp());
     }
 
     // static
@@ -132,11 +443,8 @@ namespace core {
         assert(result.map_size_ == piece_map2.map_size_);
         assert(begin <= result.map_size_ && end <= result.map_size_);
 
-        for (; begin < end; ++begin)
-        {
-            result.piece_map_[begin] =
-                piece_map1.piece_map_[begin] & piece_map2.piece_map_[begin];
-        }
+        ApplyByteRange(piece_map1.piece_map_, piece_map2.piece_map_,
+                result.piece_map_, begin, end, IntersectionOp());
     }
 
     // static
@@ -152,11 +460,8 @@ namespace core {
         assert(result.map_size_ == piece_map2.map_size_);
         assert(begin <= result.map_size_ && end <= result.map_size_);
 
-        for (; begin < end; ++begin)
-        {
-            result.piece_map_[begin] =
-                piece_map1.piece_map_[begin] | piece_map2.piece_map_[begin];
-        }
+        ApplyByteRange(piece_map1.piece_map_, piece_map2.piece_map_,
+                result.piece_map_, begin, end, UnionOp());
     }
 
     bool BitPieceMap::IsEqual(const BitPieceMap& piece_map1,
@@ -173,8 +478,134 @@ namespace core {
         if (size == 0)
             return false;
 
-        return memcmp(piece_map1.piece_map_ + begin,
-                      piece_map2.piece_map_ + begin, size) == 0;
+        const char *bytes1 = reinterpret_cast<const char *>(piece_map1.piece_map_);
+        const char *bytes2 = reinterpret_cast<const char *>(piece_map2.piece_map_);
+        return memcmp(bytes1 + begin, bytes2 + begin, size) == 0;
+    }
+
+    // static
+    void BitPieceMap::AndNotOr(const BitPieceMap& include,
+                               const BitPieceMap& exclude1,
+                               const BitPieceMap& exclude2,
+                               const BitPieceMap& mask,
+                               BitPieceMap& result)
+    {
+        assert(include.word_count_ == result.word_count_);
+        assert(exclude1.word_count_ == result.word_count_);
+        assert(exclude2.word_count_ == result.word_count_);
+        assert(mask.word_count_ == result.word_count_);
+
+        const Word *a = include.piece_map_;
+        const Word *b = exclude1.piece_map_;
+        const Word *c = exclude2.piece_map_;
+        const Word *m = mask.piece_map_;
+        Word *r = result.piece_map_;
+        std::size_t count = result.word_count_;
+        std::size_t i = 0;
+
+#if defined(PIECE_MAP_AVX2)
+        if (UseAvx2())
+            i = AndNotOrAvx2(a, b, c, m, r, count);
+#endif
+
+        for (; i < count; ++i)
+            r[i] = AndNotOrWord(a[i], b[i], c[i], m[i]);
+    }
+
+    // static
+    std::size_t BitPieceMap::CountAndNotOr(const BitPieceMap& include,
+                                           const BitPieceMap& exclude1,
+                                           const BitPieceMap& exclude2,
+                                           const BitPieceMap& mask)
+    {
+        assert(exclude1.word_count_ == include.word_count_);
+        assert(exclude2.word_count_ == include.word_count_);
+        assert(mask.word_count_ == include.word_count_);
+
+        const Word *a = include.piece_map_;
+        const Word *b = exclude1.piece_map_;
+        const Word *c = exclude2.piece_map_;
+        const Word *m = mask.piece_map_;
+        std::size_t count = include.word_count_;
+        std::size_t result = 0;
+        std::size_t i = 0;
+
+#if defined(PIECE_MAP_AVX2)
+        if (UseAvx2())
+            i = CountAndNotOrAvx2(a, b, c, m, count, &result);
+#endif
+
+        for (; i < count; ++i)
+            result += PopCount(AndNotOrWord(a[i], b[i], c[i], m[i]));
+        return result;
+    }
+
+    // static
+    bool BitPieceMap::FindFirstAndNotOr(const BitPieceMap& include,
+                                        const BitPieceMap& exclude1,
+                                        const BitPieceMap& exclude2,
+                                        const BitPieceMap& mask,
+                                        std::size_t begin,
+                                        std::size_t *piece_index)
+    {
+        assert(piece_index);
+        assert(exclude1.word_count_ == include.word_count_);
+        assert(exclude2.word_count_ == include.word_count_);
+        assert(mask.word_count_ == include.word_count_);
+
+        if (begin >= include.piece_count_)
+            return false;
+
+        const Word *a = include.piece_map_;
+        const Word *b = exclude1.piece_map_;
+        const Word *c = exclude2.piece_map_;
+        const Word *m = mask.piece_map_;
+        std::size_t count = include.word_count_;
+
+        // the first word, drop the pieces before begin
+        std::size_t i = begin / word_bits;
+        Word word = ToPieceOrder(AndNotOrWord(a[i], b[i], c[i], m[i])) &
+                    (~0ULL >> (begin % word_bits));
+        ++i;
+
+#if defined(PIECE_MAP_AVX2)
+        if (!word && UseAvx2())
+            i = SkipAndNotOrAvx2(a, b, c, m, i, count);
+#endif
+
+        for (; !word && i < count; ++i)
+            word = ToPieceOrder(AndNotOrWord(a[i], b[i], c[i], m[i]));
+
+        if (!word)
+            return false;
+
+        // i is the next word of the found word
+        std::size_t index = (i - 1) * word_bits + LeadingZero(word);
+        if (index >= include.piece_count_)
+            return false;
+
+        *piece_index = index;
+        return true;
+    }
+
+    // static
+    bool BitPieceMap::IsAccelerated()
+    {
+#if defined(PIECE_MAP_AVX2)
+        return UseAvx2();
+#else
+        return false;
+#endif
+    }
+
+    // static
+    void BitPieceMap::EnableAcceleration(bool enable)
+    {
+#if defined(PIECE_MAP_AVX2)
+        avx2_state = enable && HasAvx2() ? 1 : 0;
+#else
+        (void)enable;
+#endif
     }
 
 } // namespace core
@@ -6,6 +6,11 @@
 namespace bitwave {
 namespace core {
 
+    // bit map of pieces, stored in 64 bits words. The bytes of the words
+    // keep the layout of bitfield message, the highest bit of the first
+    // byte is piece 0, so bitfield can be copied in and out directly.
+    // Whole map operations run a word at a time, or an AVX2 vector at a
+    // time when the processor supports it.
     class BitPieceMap : public RefCount
     {
     public:
@@ -27,13 +32,25 @@ namespace core {
 
         bool MarkPieceFromBitfield(const char *bit_field, std::size_t size);
 
+        // bytes of bitfield
         std::size_t GetMapSize() const;
 
+        std::size_t GetPieceCount() const;
+
         bool IsPieceMark(std::size_t piece_index) const;
 
         // store to bit_field, size must bigger than result of GetMapSize()
         void ToBitfield(char *bit_field) const;
 
+        // count of marked pieces
+        std::size_t Count() const;
+
+        // find first marked piece which index not less than begin
+        bool FindFirstMark(std::size_t begin, std::size_t *piece_index) const;
+
+        // the following Difference, Intersection, Union and IsEqual
+        // operate bytes in range [begin, end) of the bitfield
+
         static void Difference(const BitPieceMap& piece_map1,
                                const BitPieceMap& piece_map2,
                                std::size_t begin, std::size_t end,
@@ -53,11 +70,46 @@ namespace core {
                             const BitPieceMap& piece_map2,
                             std::size_t begin, std::size_t end);
 
+        // fused and-not-or of whole maps,
+        // result = include & ~(exclude1 | exclude2) & mask
+        static void AndNotOr(const BitPieceMap& include,
+                             const BitPieceMap& exclude1,
+                             const BitPieceMap& exclude2,
+                             const BitPieceMap& mask,
+                             BitPieceMap& result);
+
+        // count marked pieces of AndNotOr without building the result
+        static std::size_t CountAndNotOr(const BitPieceMap& include,
+                                         const BitPieceMap& exclude1,
+                                         const BitPieceMap& exclude2,
+                                         const BitPieceMap& mask);
+
+        // find first marked piece of AndNotOr, which index not less than
+        // begin, without building the result
+        static bool FindFirstAndNotOr(const BitPieceMap& include,
+                                      const BitPieceMap& exclude1,
+                                      const BitPieceMap& exclude2,
+                                      const BitPieceMap& mask,
+                                      std::size_t begin,
+                                      std::size_t *piece_index);
+
+        // the processor has AVX2 and it is used
+        static bool IsAccelerated();
+
+        // use AVX2 or not when the processor has it, for comparing the
+        // kernels only
+        static void EnableAcceleration(bool enable);
+
     private:
+        typedef unsigned long long Word;
+
         void InitMap();
+        void ClearSpareBits();
 
-        char *piece_map_;
+        Word *piece_map_;
+        std::size_t piece_count_;
         std::size_t map_size_;
+        std::size_t word_count_;
     };
 
 } // namespace core
@@ -2,10 +2,7 @@
 #define BIT_PIECE_SHA1_CALC_H
 
 #include "../base/BaseTypes.h"
-#include "../base/ScopePtr.h"
 #include "../sha1/Sha1Value.h"
-#include "../thread/Thread.h"
-#include "../thread/Event.h"
 #include "../thread/Mutex.h"
 #include <functional>
 #include <memory>
@@ -16,17 +13,16 @@ namespace bitwave {
 namespace core {
 
     class BitPiece;
+    class BitHashPool;
 
+    // calculate sha1 of pieces in BitHashPool with HIGH priority
     class BitPieceSha1Calc : private NotCopyable
     {
     public:
-        typedef std::vector<
-            std::pair<std::size_t, std::tr1::shared_ptr<BitPiece>>> PieceList;
         typedef std::vector<
             std::pair<std::size_t, Sha1Value>> PieceSha1List;
 
-        BitPieceSha1Calc();
-        ~BitPieceSha1Calc();
+        explicit BitPieceSha1Calc(BitHashPool& hash_pool);
 
         void GetResult(PieceSha1List& sha1_list);
 
@@ -34,17 +30,22 @@ namespace core {
                       const std::tr1::shared_ptr<BitPiece>& piece);
 
     private:
-        unsigned CalcSha1Thread();
-        void CalculateSha1(PieceList& piece_list,
-                           PieceSha1List& piece_sha1_list);
-
-        volatile long thread_exit_flag_;
-        ScopePtr<Thread> sha1_thread_;
-        AutoResetEvent piece_list_event_;
-        SpinlocksMutex piece_list_mutex_;
-        SpinlocksMutex piece_sha1_list_mutex_;
-        PieceList piece_list_;
-        PieceSha1List piece_sha1_list_;
+        // result list is shared with jobs, jobs may still run after
+        // this BitPieceSha1Calc object destroyed
+        struct Sha1Result
+        {
+            SpinlocksMutex mutex;
+            PieceSha1List sha1_list;
+        };
+
+        typedef std::tr1::shared_ptr<Sha1Result> Sha1ResultPtr;
+
+        static void CalculateSha1(const Sha1ResultPtr& result,
+                                  std::size_t piece_index,
+                                  const std::tr1::shared_ptr<BitPiece>& piece);
+
+        BitHashPool& hash_pool_;
+        Sha1ResultPtr result_;
     };
 
 } // namespace core
@@ -0,0 +1,21 @@
+#ifndef BIT_PRIORITY_H
+#define BIT_PRIORITY_H
+
+namespace bitwave {
+namespace core {
+
+    // download priority of files and pieces, pieces of higher priority
+    // are downloaded first, pieces of PRIORITY_SKIP are not downloaded
+    enum BitPriority
+    {
+        PRIORITY_SKIP,
+        PRIORITY_LOW,
+        PRIORITY_NORMAL,
+        PRIORITY_HIGH,
+        PRIORITY_COUNT,
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_PRIORITY_H
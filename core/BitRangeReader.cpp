@@ -0,0 +1,125 @@
+#include "BitRangeReader.h"
+#include "BitData.h"
+#include "BitCache.h"
+#include <assert.h>
+#include <string.h>
+
+namespace bitwave {
+namespace core {
+
+    BitRangeReader::BitRangeReader(
+            const std::tr1::shared_ptr<BitData>& bitdata,
+            const std::tr1::shared_ptr<BitCache>& cache,
+            BitDownloadingInfo *downloading_info)
+        : bitdata_(bitdata),
+          cache_(cache),
+          downloading_info_(downloading_info),
+          piece_length_(bitdata->GetPieceLength())
+    {
+        downloading_info_->AddInfoObserver(this);
+    }
+
+    BitRangeReader::~BitRangeReader()
+    {
+        downloading_info_->RemoveInfoObserver(this);
+    }
+
+    void BitRangeReader::ReadRange(long long offset, std::size_t length,
+                                   const ReadCallback& callback)
+    {
+        if (offset < 0 || length == 0 ||
+            offset + static_cast<long long>(length) > bitdata_->GetTotalSize())
+        {
+            callback(false, 0, 0);
+            return ;
+        }
+
+        ReadOpPtr op(new ReadOp(offset, length, callback));
+        if (IsRangeDownloaded(*op))
+            StartRead(op);
+        else
+            waiting_ops_.push_back(op);
+    }
+
+    void BitRangeReader::CompleteNewPiece(std::size_t piece_index)
+    {
+        ReadOps::iterator it = waiting_ops_.begin();
+        while (it != waiting_ops_.end())
+        {
+            if (IsRangeDownloaded(**it))
+            {
+                ReadOpPtr op = *it;
+                waiting_ops_.erase(it++);
+                StartRead(op);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    bool BitRangeReader::IsRangeDownloaded(const ReadOp& op) const
+    {
+        const BitPieceMap& downloaded = downloading_info_->GetDownloaded();
+        std::size_t first = static_cast<std::size_t>(op.offset / piece_length_);
+        std::size_t last = static_cast<std::size_t>(
+                (op.offset + op.length - 1) / piece_length_);
+
+        for (std::size_t i = first; i <= last; ++i)
+        {
+            if (!downloaded.IsPieceMark(i))
+                return false;
+        }
+        return true;
+    }
+
+    void BitRangeReader::StartRead(const ReadOpPtr& op)
+    {
+        std::size_t first = static_cast<std::size_t>(op->offset / piece_length_);
+        std::size_t last = static_cast<std::size_t>(
+                (op->offset + op->length - 1) / piece_length_);
+
+        // count all parts before read, because callback of cached piece
+        // is called in cache_->Read directly
+        op->waiting_parts = last - first + 1;
+
+        std::size_t pos = 0;
+        for (std::size_t i = first; i <= last; ++i)
+        {
+            long long piece_begin = static_cast<long long>(i) * piece_length_;
+            std::size_t begin_of_piece = static_cast<std::size_t>(
+                    i == first ? op->offset - piece_begin : 0);
+            std::size_t length = piece_length_ - begin_of_piece;
+            if (length > op->length - pos)
+                length = op->length - pos;
+
+            cache_->Read(i, begin_of_piece, length,
+                    std::tr1::bind(&BitRangeReader::OnPartRead, op, pos, length,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+            pos += length;
+        }
+
+        assert(pos == op->length);
+    }
+
+    void BitRangeReader::OnPartRead(const ReadOpPtr& op,
+                                    std::size_t pos, std::size_t length,
+                                    bool is_ok, const char *data)
+    {
+        if (is_ok)
+            memcpy(&op->data[pos], data, length);
+        else
+            op->is_ok = false;
+
+        if (--op->waiting_parts > 0)
+            return ;
+
+        if (op->is_ok)
+            op->callback(true, &op->data[0], op->length);
+        else
+            op->callback(false, 0, 0);
+    }
+
+} // namespace core
+} // namespace bitwave
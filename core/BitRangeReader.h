@@ -0,0 +1,85 @@
+#ifndef BIT_RANGE_READER_H
+#define BIT_RANGE_READER_H
+
+#include "BitDownloadingInfo.h"
+#include "../base/BaseTypes.h"
+#include <functional>
+#include <memory>
+#include <list>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+    class BitCache;
+
+    // read byte range of task data for streaming play, a read waits until
+    // all pieces of the range are downloaded, then the pieces are read
+    // from BitCache and joined
+    class BitRangeReader :
+        public BitDownloadingInfo::Observer, private NotCopyable
+    {
+    public:
+        // bool param is a flag of read success or not, const char * param
+        // and std::size_t param are the read data and its size, the data
+        // is valid only in the callback
+        typedef std::tr1::function<void (bool, const char *, std::size_t)> ReadCallback;
+
+        BitRangeReader(const std::tr1::shared_ptr<BitData>& bitdata,
+                       const std::tr1::shared_ptr<BitCache>& cache,
+                       BitDownloadingInfo *downloading_info);
+
+        ~BitRangeReader();
+
+        // read data [offset, offset + length) of the task
+        void ReadRange(long long offset, std::size_t length,
+                       const ReadCallback& callback);
+
+    private:
+        struct ReadOp
+        {
+            ReadOp(long long o, std::size_t l, const ReadCallback& cb)
+                : offset(o),
+                  length(l),
+                  callback(cb),
+                  data(l),
+                  waiting_parts(0),
+                  is_ok(true)
+            {
+            }
+
+            long long offset;
+            std::size_t length;
+            ReadCallback callback;
+            std::vector<char> data;
+            std::size_t waiting_parts;
+            bool is_ok;
+        };
+
+        typedef std::tr1::shared_ptr<ReadOp> ReadOpPtr;
+        typedef std::list<ReadOpPtr> ReadOps;
+
+        virtual void DownloadingNewPiece(std::size_t piece_index) { }
+        virtual void CompleteNewPiece(std::size_t piece_index);
+        virtual void DownloadingFailed(std::size_t piece_index) { }
+
+        bool IsRangeDownloaded(const ReadOp& op) const;
+        void StartRead(const ReadOpPtr& op);
+
+        static void OnPartRead(const ReadOpPtr& op,
+                               std::size_t pos, std::size_t length,
+                               bool is_ok, const char *data);
+
+        std::tr1::shared_ptr<BitData> bitdata_;
+        std::tr1::shared_ptr<BitCache> cache_;
+        BitDownloadingInfo *downloading_info_;
+        std::size_t piece_length_;
+        // reads wait for pieces downloading
+        ReadOps waiting_ops_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_RANGE_READER_H
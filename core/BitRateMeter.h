@@ -0,0 +1,97 @@
+#ifndef BIT_RATE_METER_H
+#define BIT_RATE_METER_H
+
+#include "../timer/TimeTraits.h"
+
+namespace bitwave {
+namespace core {
+
+    // transfer rate meter, the rate is an exponential moving average of
+    // bytes transferred in every one second sample
+    class BitRateMeter
+    {
+    public:
+        typedef time_traits<NormalTimeType> TimeTraits;
+
+        BitRateMeter()
+            : sample_begin_(TimeTraits::now()),
+              sample_bytes_(0),
+              total_bytes_(0),
+              rate_(0.0)
+        {
+        }
+
+        explicit BitRateMeter(NormalTimeType now)
+            : sample_begin_(now),
+              sample_bytes_(0),
+              total_bytes_(0),
+              rate_(0.0)
+        {
+        }
+
+        void AddBytes(long long bytes)
+        {
+            AddBytes(bytes, TimeTraits::now());
+        }
+
+        void AddBytes(long long bytes, NormalTimeType now)
+        {
+            Update(now);
+            sample_bytes_ += bytes;
+            total_bytes_ += bytes;
+        }
+
+        // bytes per second
+        double GetRate()
+        {
+            return GetRate(TimeTraits::now());
+        }
+
+        double GetRate(NormalTimeType now)
+        {
+            Update(now);
+            return rate_;
+        }
+
+        long long GetTotalBytes() const
+        {
+            return total_bytes_;
+        }
+
+    private:
+        void Update(NormalTimeType now)
+        {
+            // one second a sample, the average is as smooth as a simple
+            // average of five samples, so alpha is 2 / (5 + 1)
+            const NormalTimeType sample_time = 1000;
+            const NormalTimeType max_samples = 30;
+            const double average_samples = 5.0;
+            const double alpha = 2.0 / (average_samples + 1.0);
+
+            if (now - sample_begin_ >= sample_time * max_samples)
+            {
+                // idle for a long time, the rate decay to zero
+                sample_begin_ = now;
+                sample_bytes_ = 0;
+                rate_ = 0.0;
+                return ;
+            }
+
+            while (now - sample_begin_ >= sample_time)
+            {
+                rate_ += (static_cast<double>(sample_bytes_) - rate_) * alpha;
+                sample_bytes_ = 0;
+                sample_begin_ += sample_time;
+            }
+        }
+
+        NormalTimeType sample_begin_;
+        long long sample_bytes_;
+        long long total_bytes_;
+        double rate_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_RATE_METER_H
@@ -0,0 +1,368 @@
+#include "BitRecheck.h"
+#include "BitData.h"
+#include "BitHashPool.h"
+#include "bencode/MetainfoFile.h"
+#include "../base/StringConv.h"
+#include "../sha1/NetSha1Value.h"
+#include "../thread/Atomic.h"
+#include <algorithm>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    struct BitRecheck::Chunk
+    {
+        std::size_t first_piece;
+        std::size_t piece_count;
+        volatile long hashing_pieces;
+        std::vector<char> data;
+        std::vector<char> missing;
+    };
+
+    BitRecheck::BitRecheck(const std::tr1::shared_ptr<BitData>& bitdata,
+                           BitHashPool& hash_pool)
+        : hash_pool_(hash_pool),
+          piece_length_(bitdata->GetPieceLength()),
+          piece_count_(bitdata->GetPieceCount()),
+          total_length_(0),
+          chunk_pieces_(0),
+          max_read_ahead_(0),
+          file_index_(0),
+          file_left_(0),
+          file_handle_(INVALID_HANDLE_VALUE),
+          read_budget_(0),
+          read_bytes_(0),
+          read_start_counter_(0),
+          thread_exit_flag_(0),
+          read_ahead_(0),
+          pending_jobs_(0),
+          io_budget_(0),
+          frequency_(0),
+          start_counter_(0),
+          complete_counter_(0),
+          checked_count_(0),
+          failed_count_(0),
+          checked_bytes_(0)
+    {
+        std::string base_path = bitdata->GetBasePath();
+        const BitData::DownloadFiles& files = bitdata->GetFilesInfo();
+        for (BitData::DownloadFiles::const_iterator it = files.begin();
+                it != files.end(); ++it)
+        {
+            files_.push_back(FileInfo(
+                        UTF8ToUnicode(base_path + it->file_path), it->length));
+            total_length_ += it->length;
+        }
+
+        // read thread and hash jobs do not touch BitData and MetainfoFile
+        const bentypes::MetainfoFile *info = bitdata->GetMetainfoFile();
+        pieces_sha1_.reserve(piece_count_);
+        for (std::size_t i = 0; i < piece_count_; ++i)
+            pieces_sha1_.push_back(info->GetPieceSha1(i));
+
+        const std::size_t chunk_size = 4 * 1024 * 1024;
+        const std::size_t read_ahead_size = 64 * 1024 * 1024;
+        chunk_pieces_ = (std::max)(chunk_size / piece_length_, std::size_t(1));
+        max_read_ahead_ = static_cast<long>((std::max)(
+                read_ahead_size / (chunk_pieces_ * piece_length_), std::size_t(2)));
+
+        LARGE_INTEGER frequency;
+        ::QueryPerformanceFrequency(&frequency);
+        frequency_ = frequency.QuadPart;
+    }
+
+    BitRecheck::~BitRecheck()
+    {
+        AtomicAdd(&thread_exit_flag_, 1);
+        if (read_thread_)
+            read_thread_->Join();
+
+        // hash jobs reference this, wait all of them
+        while (AtomicAdd(&pending_jobs_, 0) > 0)
+            chunk_done_event_.Wait(10);
+    }
+
+    void BitRecheck::SetIoBudget(long long bytes_per_second)
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        io_budget_ = bytes_per_second;
+    }
+
+    void BitRecheck::Start()
+    {
+        if (read_thread_)
+            return ;
+
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            start_counter_ = GetCounter();
+            if (piece_count_ == 0)
+                complete_counter_ = start_counter_;
+        }
+
+        read_thread_.Reset(new Thread(
+                    std::tr1::bind(&BitRecheck::ReadThread, this)));
+    }
+
+    void BitRecheck::GetCheckedPieces(PieceIndexList& pieces)
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        pieces.swap(checked_pieces_);
+        checked_pieces_.clear();
+    }
+
+    void BitRecheck::GetFailedPieces(PieceIndexList& pieces)
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        pieces.swap(failed_pieces_);
+        failed_pieces_.clear();
+    }
+
+    bool BitRecheck::IsComplete() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return checked_count_ == piece_count_;
+    }
+
+    std::size_t BitRecheck::GetCheckedCount() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return checked_count_;
+    }
+
+    std::size_t BitRecheck::GetFailedCount() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return failed_count_;
+    }
+
+    long long BitRecheck::GetCheckedBytes() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return checked_bytes_;
+    }
+
+    double BitRecheck::GetThroughput() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        if (start_counter_ == 0)
+            return 0.0;
+
+        long long end = complete_counter_ ? complete_counter_ : GetCounter();
+        double seconds = static_cast<double>(end - start_counter_) / frequency_;
+        if (seconds <= 0.0)
+            return 0.0;
+
+        return checked_bytes_ / seconds / (1024.0 * 1024.0 * 1024.0);
+    }
+
+    unsigned BitRecheck::ReadThread()
+    {
+        // lower both cpu and io priority of this thread, so the recheck
+        // does not slow down the downloading and uploading
+        ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+        std::size_t piece_index = 0;
+        while (piece_index < piece_count_ && WaitReadAhead())
+        {
+            ChunkPtr chunk(new Chunk);
+            chunk->first_piece = piece_index;
+            chunk->piece_count = (std::min)(chunk_pieces_, piece_count_ - piece_index);
+            chunk->hashing_pieces = static_cast<long>(chunk->piece_count);
+
+            long long chunk_begin = static_cast<long long>(piece_index) * piece_length_;
+            long long chunk_size = (std::min)(
+                    static_cast<long long>(chunk->piece_count * piece_length_),
+                    total_length_ - chunk_begin);
+            chunk->data.resize(static_cast<std::size_t>(chunk_size));
+            chunk->missing.resize(chunk->piece_count);
+
+            ReadChunk(*chunk);
+            Throttle(chunk_size);
+
+            AtomicIncrement(&read_ahead_);
+            AtomicAdd(&pending_jobs_, static_cast<long>(chunk->piece_count));
+            for (std::size_t i = 0; i < chunk->piece_count; ++i)
+            {
+                hash_pool_.AddJob(
+                        std::tr1::bind(&BitRecheck::HashPiece, this, chunk, i),
+                        BitHashPool::LOW);
+            }
+
+            piece_index += chunk->piece_count;
+        }
+
+        CloseFile();
+        ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+        return 0;
+    }
+
+    bool BitRecheck::WaitReadAhead()
+    {
+        while (AtomicAdd(&read_ahead_, 0) >= max_read_ahead_)
+        {
+            if (AtomicAdd(&thread_exit_flag_, 0))
+                return false;
+            chunk_done_event_.Wait(100);
+        }
+
+        return AtomicAdd(&thread_exit_flag_, 0) == 0;
+    }
+
+    void BitRecheck::ReadChunk(Chunk& chunk)
+    {
+        std::size_t pos = 0;
+        std::size_t size = chunk.data.size();
+        while (pos < size)
+        {
+            if (file_left_ == 0 && !OpenNextFile())
+            {
+                MarkMissing(chunk, pos, size);
+                break;
+            }
+
+            std::size_t len = static_cast<std::size_t>(
+                    (std::min)(static_cast<long long>(size - pos), file_left_));
+
+            bool ok = false;
+            if (file_handle_ != INVALID_HANDLE_VALUE)
+            {
+                DWORD bytes = 0;
+                ok = ::ReadFile(file_handle_, &chunk.data[pos],
+                        static_cast<DWORD>(len), &bytes, 0) && bytes == len;
+
+                // data after the failed position of this file is unusable
+                if (!ok)
+                    CloseFile();
+            }
+
+            if (!ok)
+                MarkMissing(chunk, pos, pos + len);
+
+            pos += len;
+            file_left_ -= len;
+        }
+    }
+
+    void BitRecheck::MarkMissing(Chunk& chunk, std::size_t begin, std::size_t end)
+    {
+        if (begin >= end)
+            return ;
+
+        std::size_t first = begin / piece_length_;
+        std::size_t last = (end - 1) / piece_length_;
+        for (; first <= last && first < chunk.piece_count; ++first)
+            chunk.missing[first] = 1;
+    }
+
+    bool BitRecheck::OpenNextFile()
+    {
+        CloseFile();
+
+        while (file_index_ < files_.size() && files_[file_index_].length == 0)
+            ++file_index_;
+
+        if (file_index_ >= files_.size())
+            return false;
+
+        const FileInfo& info = files_[file_index_++];
+        file_left_ = info.length;
+
+        // file maybe opened by BitFile for writing
+        file_handle_ = ::CreateFile(info.path.c_str(),
+                GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        return true;
+    }
+
+    void BitRecheck::CloseFile()
+    {
+        if (file_handle_ != INVALID_HANDLE_VALUE)
+        {
+            ::CloseHandle(file_handle_);
+            file_handle_ = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    void BitRecheck::Throttle(long long read_bytes)
+    {
+        long long budget = 0;
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            budget = io_budget_;
+        }
+
+        if (budget != read_budget_)
+        {
+            // budget changed, restart the measure
+            read_budget_ = budget;
+            read_bytes_ = 0;
+            read_start_counter_ = GetCounter();
+        }
+
+        if (read_budget_ <= 0)
+            return ;
+
+        read_bytes_ += read_bytes;
+        long long expect_ms = read_bytes_ * 1000 / read_budget_;
+        long long used_ms = (GetCounter() - read_start_counter_) * 1000 / frequency_;
+        if (expect_ms > used_ms)
+            ::Sleep(static_cast<DWORD>(expect_ms - used_ms));
+    }
+
+    void BitRecheck::HashPiece(const ChunkPtr& chunk, std::size_t index_of_chunk)
+    {
+        std::size_t piece_index = chunk->first_piece + index_of_chunk;
+        std::size_t size = GetPieceSize(piece_index);
+
+        bool ok = false;
+        if (!chunk->missing[index_of_chunk] && !AtomicAdd(&thread_exit_flag_, 0))
+        {
+            const char *data = &chunk->data[index_of_chunk * piece_length_];
+            ok = NetByteOrder(Sha1Value(data, size)) == pieces_sha1_[piece_index];
+        }
+
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            ++checked_count_;
+            checked_bytes_ += size;
+            if (ok)
+            {
+                checked_pieces_.push_back(piece_index);
+            }
+            else
+            {
+                ++failed_count_;
+                failed_pieces_.push_back(piece_index);
+            }
+            if (checked_count_ == piece_count_)
+                complete_counter_ = GetCounter();
+        }
+
+        if (AtomicDecrement(&chunk->hashing_pieces) == 0)
+        {
+            AtomicDecrement(&read_ahead_);
+            chunk_done_event_.SetEvent();
+        }
+
+        // this maybe destroyed after pending_jobs_ is zero
+        AtomicDecrement(&pending_jobs_);
+    }
+
+    std::size_t BitRecheck::GetPieceSize(std::size_t piece_index) const
+    {
+        long long begin = static_cast<long long>(piece_index) * piece_length_;
+        return static_cast<std::size_t>(
+                (std::min)(static_cast<long long>(piece_length_), total_length_ - begin));
+    }
+
+    long long BitRecheck::GetCounter() const
+    {
+        LARGE_INTEGER counter;
+        ::QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,127 @@
+#ifndef BIT_RECHECK_H
+#define BIT_RECHECK_H
+
+#include "../base/BaseTypes.h"
+#include "../base/ScopePtr.h"
+#include "../sha1/Sha1Value.h"
+#include "../thread/Thread.h"
+#include "../thread/Event.h"
+#include "../thread/Mutex.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+    class BitHashPool;
+
+    // recheck all pieces of a task from disk in background. A below normal
+    // priority thread reads files sequentially in large chunks, with bounded
+    // read ahead and an optional io budget, and pieces of each chunk are
+    // hashed in BitHashPool with LOW priority
+    class BitRecheck : private NotCopyable
+    {
+    public:
+        typedef std::vector<std::size_t> PieceIndexList;
+
+        BitRecheck(const std::tr1::shared_ptr<BitData>& bitdata,
+                   BitHashPool& hash_pool);
+
+        ~BitRecheck();
+
+        // limit read bytes per second, 0 is no limit
+        void SetIoBudget(long long bytes_per_second);
+
+        void Start();
+
+        // get pieces checked ok since last call
+        void GetCheckedPieces(PieceIndexList& pieces);
+
+        // get pieces checked failed or missing on disk since last call
+        void GetFailedPieces(PieceIndexList& pieces);
+
+        // all pieces are checked, the last checked pieces maybe not get
+        // by GetCheckedPieces and GetFailedPieces yet
+        bool IsComplete() const;
+
+        std::size_t GetPieceCount() const
+            { return piece_count_; }
+
+        std::size_t GetCheckedCount() const;
+
+        std::size_t GetFailedCount() const;
+
+        long long GetCheckedBytes() const;
+
+        // checked bytes per second since Start in GB/s
+        double GetThroughput() const;
+
+    private:
+        struct Chunk;
+        typedef std::tr1::shared_ptr<Chunk> ChunkPtr;
+
+        struct FileInfo
+        {
+            FileInfo(const std::wstring& p, long long len)
+                : path(p), length(len)
+            {
+            }
+
+            std::wstring path;
+            long long length;
+        };
+
+        unsigned ReadThread();
+        bool WaitReadAhead();
+        void ReadChunk(Chunk& chunk);
+        void MarkMissing(Chunk& chunk, std::size_t begin, std::size_t end);
+        bool OpenNextFile();
+        void CloseFile();
+        void Throttle(long long read_bytes);
+        void HashPiece(const ChunkPtr& chunk, std::size_t index_of_chunk);
+        std::size_t GetPieceSize(std::size_t piece_index) const;
+        long long GetCounter() const;
+
+        BitHashPool& hash_pool_;
+        const std::size_t piece_length_;
+        const std::size_t piece_count_;
+        long long total_length_;
+        std::vector<FileInfo> files_;
+        std::vector<Sha1Value> pieces_sha1_;
+
+        std::size_t chunk_pieces_;
+        long max_read_ahead_;
+
+        // read thread data
+        std::size_t file_index_;
+        long long file_left_;
+        HANDLE file_handle_;
+        long long read_budget_;
+        long long read_bytes_;
+        long long read_start_counter_;
+
+        volatile long thread_exit_flag_;
+        volatile long read_ahead_;
+        volatile long pending_jobs_;
+        AutoResetEvent chunk_done_event_;
+        ScopePtr<Thread> read_thread_;
+
+        mutable SpinlocksMutex mutex_;
+        long long io_budget_;
+        long long frequency_;
+        long long start_counter_;
+        long long complete_counter_;
+        std::size_t checked_count_;
+        std::size_t failed_count_;
+        long long checked_bytes_;
+        PieceIndexList checked_pieces_;
+        PieceIndexList failed_pieces_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_RECHECK_H
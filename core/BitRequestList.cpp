@@ -1,12 +1,97 @@
 #include "BitRequestList.h"
+#include <assert.h>
 #include <algorithm>
 
 namespace bitwave {
 namespace core {
 
+    namespace {
+
+        const std::size_t min_slot_count = 16;
+        const std::size_t pool_chunk_size = 1024;
+        const std::size_t npos = static_cast<std::size_t>(-1);
+
+        inline std::size_t HashRequest(int index, int begin, int length)
+        {
+            unsigned int h = static_cast<unsigned int>(index) * 0x9E3779B1u;
+            h ^= static_cast<unsigned int>(begin) * 0x85EBCA6Bu;
+            h ^= static_cast<unsigned int>(length);
+            h ^= h >> 16;
+            h *= 0x85EBCA6Bu;
+            h ^= h >> 13;
+            h *= 0xC2B2AE35u;
+            h ^= h >> 16;
+            return h;
+        }
+
+    } // unnamed namespace
+
+    // free nodes of all lists, nodes are allocated by chunk and never
+    // return to system until exit
+    struct BitRequestList::NodePool : private NotCopyable
+    {
+        NodePool()
+            : free_(0)
+        {
+        }
+
+        ~NodePool()
+        {
+            for (std::size_t i = 0; i < chunks_.size(); ++i)
+                delete [] chunks_[i];
+        }
+
+        Node * Obtain()
+        {
+            if (!free_)
+            {
+                Node *chunk = new Node[pool_chunk_size];
+                chunks_.push_back(chunk);
+                for (std::size_t i = 0; i < pool_chunk_size; ++i)
+                    Return(&chunk[i]);
+            }
+
+            Node *node = free_;
+            free_ = node->next;
+            return node;
+        }
+
+        void Return(Node *node)
+        {
+            node->next = free_;
+            free_ = node;
+        }
+
+        Node *free_;
+        std::vector<Node *> chunks_;
+    };
+
+    // static
+    BitRequestList::NodePool& BitRequestList::GetNodePool()
+    {
+        static NodePool pool;
+        return pool;
+    }
+
+    BitRequestList::BitRequestList()
+        : size_(0),
+          slot_mask_(0)
+    {
+        head_.prev = &head_;
+        head_.next = &head_;
+    }
+
+    BitRequestList::~BitRequestList()
+    {
+        Clear();
+    }
+
     void BitRequestList::AddRequest(int index, int begin, int length)
     {
-        request_list_.push_back(RequestData(index, begin, length));
+        Node *node = GetNodePool().Obtain();
+        node->data = RequestData(index, begin, length);
+        InsertIndex(node);
+        LinkTail(node);
     }
 
     void BitRequestList::AddRequest(Iterator first, Iterator last)
@@ -17,28 +102,169 @@ namespace core {
 
     void BitRequestList::DelRequest(int index, int begin, int length)
     {
-        request_list_.remove(RequestData(index, begin, length));
+        std::size_t slot = FindSlot(index, begin, length);
+        while (slot != npos)
+        {
+            Erase(Iterator(slots_[slot]));
+            slot = FindSlot(index, begin, length);
+        }
     }
 
     BitRequestList::Iterator BitRequestList::FindRequest(int index, int begin, int length)
     {
-        return std::find(Begin(), End(), RequestData(index, begin, length));
+        std::size_t slot = FindSlot(index, begin, length);
+        if (slot == npos)
+            return End();
+        return Iterator(slots_[slot]);
     }
 
     BitRequestList::Iterator BitRequestList::Splice(BitRequestList& brl, Iterator it)
     {
-        request_list_.splice(End(), brl.request_list_, it);
-        return --End();
+        Node *node = it.node_;
+        brl.RemoveIndex(node);
+        brl.Unlink(node);
+        InsertIndex(node);
+        LinkTail(node);
+        return it;
     }
 
     void BitRequestList::Splice(BitRequestList& brl, Iterator first, Iterator last)
     {
-        request_list_.splice(End(), brl.request_list_, first, last);
+        // the range of the list itself ends at the tail already, moving it
+        // to the tail one by one would never reach last
+        if (&brl == this && last == End())
+            return ;
+
+        while (first != last)
+            Splice(brl, first++);
     }
 
     bool BitRequestList::IsExistRequest(int index, int begin, int length) const
     {
-        return std::find(Begin(), End(), RequestData(index, begin, length)) != End();
+        return FindSlot(index, begin, length) != npos;
+    }
+
+    void BitRequestList::Clear()
+    {
+        NodePool& pool = GetNodePool();
+        Node *node = head_.next;
+        while (node != &head_)
+        {
+            Node *next = node->next;
+            pool.Return(node);
+            node = next;
+        }
+
+        head_.prev = &head_;
+        head_.next = &head_;
+        size_ = 0;
+        std::fill(slots_.begin(), slots_.end(), static_cast<Node *>(0));
+    }
+
+    void BitRequestList::Erase(Iterator it)
+    {
+        Node *node = it.node_;
+        RemoveIndex(node);
+        Unlink(node);
+        GetNodePool().Return(node);
+    }
+
+    void BitRequestList::LinkTail(Node *node)
+    {
+        node->prev = head_.prev;
+        node->next = &head_;
+        head_.prev->next = node;
+        head_.prev = node;
+        ++size_;
+    }
+
+    void BitRequestList::Unlink(Node *node)
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        --size_;
+    }
+
+    std::size_t BitRequestList::FindSlot(int index, int begin, int length) const
+    {
+        if (slots_.empty())
+            return npos;
+
+        std::size_t slot = HashRequest(index, begin, length) & slot_mask_;
+        while (slots_[slot])
+        {
+            const RequestData& data = slots_[slot]->data;
+            if (data.index == index && data.begin == begin && data.length == length)
+                return slot;
+            slot = (slot + 1) & slot_mask_;
+        }
+
+        return npos;
+    }
+
+    void BitRequestList::InsertIndex(Node *node)
+    {
+        // keep load factor not more than half
+        if ((size_ + 1) * 2 > slots_.size())
+            GrowIndex();
+
+        const RequestData& data = node->data;
+        std::size_t slot = HashRequest(data.index, data.begin, data.length) & slot_mask_;
+        while (slots_[slot])
+            slot = (slot + 1) & slot_mask_;
+        slots_[slot] = node;
+    }
+
+    void BitRequestList::RemoveIndex(Node *node)
+    {
+        const RequestData& data = node->data;
+        std::size_t hole = HashRequest(data.index, data.begin, data.length) & slot_mask_;
+        while (slots_[hole] != node)
+        {
+            assert(slots_[hole]);
+            hole = (hole + 1) & slot_mask_;
+        }
+
+        // shift back the following nodes which can be placed in the hole,
+        // so no tombstone is needed
+        std::size_t slot = hole;
+        for (;;)
+        {
+            slot = (slot + 1) & slot_mask_;
+            Node *next = slots_[slot];
+            if (!next)
+                break;
+
+            const RequestData& next_data = next->data;
+            std::size_t home = HashRequest(next_data.index, next_data.begin,
+                    next_data.length) & slot_mask_;
+            if (((slot - home) & slot_mask_) >= ((slot - hole) & slot_mask_))
+            {
+                slots_[hole] = next;
+                hole = slot;
+            }
+        }
+
+        slots_[hole] = 0;
+    }
+
+    void BitRequestList::GrowIndex()
+    {
+        std::size_t count = slots_.empty() ? min_slot_count : slots_.size() * 2;
+        while ((size_ + 1) * 2 > count)
+            count *= 2;
+
+        slots_.assign(count, static_cast<Node *>(0));
+        slot_mask_ = count - 1;
+
+        for (Node *node = head_.next; node != &head_; node = node->next)
+        {
+            const RequestData& data = node->data;
+            std::size_t slot = HashRequest(data.index, data.begin, data.length) & slot_mask_;
+            while (slots_[slot])
+                slot = (slot + 1) & slot_mask_;
+            slots_[slot] = node;
+        }
     }
 
 } // namespace core
@@ -2,12 +2,17 @@
 #define BIT_REQUEST_LIST_H
 
 #include "../base/BaseTypes.h"
-#include <list>
-#include <limits>
+#include "../timer/TimeTraits.h"
+#include <vector>
 
 namespace bitwave {
 namespace core {
 
+    // list of block requests. Requests are intrusive nodes, Splice moves a
+    // node to another list like std::list::splice, and iterators of the
+    // node keep valid. Every list has an open addressing hash index on
+    // (index, begin, length), so find and delete is O(1). Nodes are reused
+    // from a free list of all lists, lists must be used in one thread.
     class BitRequestList : private NotCopyable
     {
     public:
@@ -16,13 +21,15 @@ namespace core {
             RequestData(int i, int b, int l)
                 : index(i),
                   begin(b),
-                  length(l)
+                  length(l),
+                  time(time_traits<NormalTimeType>::invalid())
             {
             }
 
             int index;      // zero-base piece index
             int begin;      // zero-base byte offset within the piece
             int length;     // request length
+            NormalTimeType time;    // request sent time, not compared
 
             friend bool operator == (const RequestData& left,
                                      const RequestData& right)
@@ -33,9 +40,99 @@ namespace core {
             }
         };
 
-        typedef std::list<RequestData> RequestList;
-        typedef RequestList::iterator Iterator;
-        typedef RequestList::const_iterator Const_Iterator;
+    private:
+        struct Node
+        {
+            Node()
+                : data(0, 0, 0),
+                  prev(0),
+                  next(0)
+            {
+            }
+
+            RequestData data;
+            Node *prev;
+            Node *next;
+        };
+
+        struct NodePool;
+
+    public:
+        template<typename T, typename NodePtr>
+        class BasicIterator
+        {
+        public:
+            BasicIterator()
+                : node_(0)
+            {
+            }
+
+            // Iterator convert to Const_Iterator
+            template<typename U, typename OtherNodePtr>
+            BasicIterator(const BasicIterator<U, OtherNodePtr>& other)
+                : node_(other.node_)
+            {
+            }
+
+            T& operator * () const { return node_->data; }
+            T * operator -> () const { return &node_->data; }
+
+            BasicIterator& operator ++ ()
+            {
+                node_ = node_->next;
+                return *this;
+            }
+
+            BasicIterator operator ++ (int)
+            {
+                BasicIterator it(*this);
+                node_ = node_->next;
+                return it;
+            }
+
+            BasicIterator& operator -- ()
+            {
+                node_ = node_->prev;
+                return *this;
+            }
+
+            BasicIterator operator -- (int)
+            {
+                BasicIterator it(*this);
+                node_ = node_->prev;
+                return it;
+            }
+
+            friend bool operator == (const BasicIterator& left,
+                                     const BasicIterator& right)
+            {
+                return left.node_ == right.node_;
+            }
+
+            friend bool operator != (const BasicIterator& left,
+                                     const BasicIterator& right)
+            {
+                return left.node_ != right.node_;
+            }
+
+        private:
+            friend class BitRequestList;
+            template<typename U, typename OtherNodePtr>
+            friend class BasicIterator;
+
+            explicit BasicIterator(NodePtr node)
+                : node_(node)
+            {
+            }
+
+            NodePtr node_;
+        };
+
+        typedef BasicIterator<RequestData, Node *> Iterator;
+        typedef BasicIterator<const RequestData, const Node *> Const_Iterator;
+
+        BitRequestList();
+        ~BitRequestList();
 
         // add new request to tail
         void AddRequest(int index, int begin, int length);
@@ -56,17 +153,31 @@ namespace core {
         // return the request is exist or not
         bool IsExistRequest(int index, int begin, int length) const;
 
-        void Clear() { request_list_.clear(); }
-        std::size_t Size() const { return request_list_.size(); }
-        bool Empty() const { return request_list_.empty(); }
-        void Erase(Iterator it) { request_list_.erase(it); }
-        Iterator Begin() { return request_list_.begin(); }
-        Iterator End() { return request_list_.end(); }
-        Const_Iterator Begin() const { return request_list_.begin(); }
-        Const_Iterator End() const { return request_list_.end(); }
+        void Clear();
+        void Erase(Iterator it);
+        std::size_t Size() const { return size_; }
+        bool Empty() const { return size_ == 0; }
+        Iterator Begin() { return Iterator(head_.next); }
+        Iterator End() { return Iterator(&head_); }
+        Const_Iterator Begin() const { return Const_Iterator(head_.next); }
+        Const_Iterator End() const { return Const_Iterator(&head_); }
 
     private:
-        RequestList request_list_;
+        static NodePool& GetNodePool();
+
+        void LinkTail(Node *node);
+        void Unlink(Node *node);
+
+        // hash index of nodes, linear probing
+        std::size_t FindSlot(int index, int begin, int length) const;
+        void InsertIndex(Node *node);
+        void RemoveIndex(Node *node);
+        void GrowIndex();
+
+        Node head_;
+        std::size_t size_;
+        std::vector<Node *> slots_;
+        std::size_t slot_mask_;
     };
 
 } // namespace core
@@ -0,0 +1,143 @@
+#include "BitRequestPipeline.h"
+#include <assert.h>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        // depth is twice of bandwidth delay product
+        const double depth_gain = 2.0;
+        // rtt is probed every 10 seconds, the probe lasts 3 rtt at least
+        const NormalTimeType rtt_window = 10 * 1000;
+        const NormalTimeType probe_rtt_count = 3;
+        const NormalTimeType min_probe_time = 200;
+        // tick count is not accurate for a small time, so the rtt used to
+        // compute depth is not less than 10ms, and a rate sample covers
+        // at least 50ms
+        const NormalTimeType min_rtt = 10;
+        const NormalTimeType min_round_time = 50;
+
+    } // unnamed namespace
+
+    std::size_t BitRequestPipeline::min_depth_ = 4;
+    std::size_t BitRequestPipeline::max_depth_ = 256;
+
+    // static
+    void BitRequestPipeline::SetDepthBounds(std::size_t min_depth,
+                                            std::size_t max_depth)
+    {
+        assert(min_depth > 0 && min_depth <= max_depth);
+        min_depth_ = min_depth;
+        max_depth_ = max_depth;
+    }
+
+    // static
+    std::size_t BitRequestPipeline::GetMinDepth()
+    {
+        return min_depth_;
+    }
+
+    // static
+    std::size_t BitRequestPipeline::GetMaxDepth()
+    {
+        return max_depth_;
+    }
+
+    BitRequestPipeline::BitRequestPipeline()
+        : depth_(min_depth_),
+          block_size_(16 * 1024),
+          rtt_(TimeTraits::invalid()),
+          window_rtt_(TimeTraits::invalid()),
+          window_begin_(TimeTraits::now()),
+          probe_begin_(0),
+          probing_(false),
+          round_begin_(TimeTraits::now()),
+          round_bytes_(0),
+          rate_(0.0)
+    {
+    }
+
+    void BitRequestPipeline::BlockArrived(std::size_t length,
+                                          NormalTimeType request_time)
+    {
+        NormalTimeType now = TimeTraits::now();
+        if (request_time != TimeTraits::invalid())
+        {
+            NormalTimeType sample = now - request_time;
+            if (window_rtt_ == TimeTraits::invalid() || sample < window_rtt_)
+                window_rtt_ = sample;
+            if (rtt_ == TimeTraits::invalid() || sample < rtt_)
+                rtt_ = sample;
+        }
+
+        if (length > 0)
+            block_size_ = length;
+
+        UpdateRoundTripTime(now);
+
+        // one rate sample each round trip
+        round_bytes_ += length;
+        NormalTimeType round_time = now - round_begin_;
+        NormalTimeType rtt = rtt_ == TimeTraits::invalid() ? 0 : rtt_;
+        if (round_time >= rtt && round_time >= min_round_time)
+        {
+            double sample = static_cast<double>(round_bytes_) * 1000.0 / round_time;
+            rate_ = rate_ == 0.0 ? sample : (rate_ + sample) / 2.0;
+            round_bytes_ = 0;
+            round_begin_ = now;
+
+            if (!probing_)
+                UpdateDepth();
+        }
+    }
+
+    void BitRequestPipeline::UpdateRoundTripTime(NormalTimeType now)
+    {
+        if (!probing_)
+        {
+            if (now - window_begin_ >= rtt_window)
+            {
+                // the depth is twice of bdp, so half of it drain the queue
+                probing_ = true;
+                probe_begin_ = now;
+                window_rtt_ = TimeTraits::invalid();
+                depth_ = depth_ / 2 < min_depth_ ? min_depth_ : depth_ / 2;
+            }
+            return ;
+        }
+
+        NormalTimeType probe_time = rtt_ == TimeTraits::invalid() ? 0 : rtt_;
+        probe_time *= probe_rtt_count;
+        if (probe_time < min_probe_time)
+            probe_time = min_probe_time;
+
+        if (now - probe_begin_ >= probe_time)
+        {
+            // the minimum of probe is the rtt now, it maybe grow
+            if (window_rtt_ != TimeTraits::invalid())
+                rtt_ = window_rtt_;
+            probing_ = false;
+            window_begin_ = now;
+            UpdateDepth();
+        }
+    }
+
+    void BitRequestPipeline::UpdateDepth()
+    {
+        NormalTimeType rtt = rtt_ == TimeTraits::invalid() ? 0 : rtt_;
+        if (rtt < min_rtt)
+            rtt = min_rtt;
+
+        double bdp = rate_ * rtt / 1000.0 / block_size_;
+        std::size_t depth = static_cast<std::size_t>(bdp * depth_gain) + 1;
+
+        if (depth < min_depth_)
+            depth = min_depth_;
+        if (depth > max_depth_)
+            depth = max_depth_;
+        depth_ = depth;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,68 @@
+#ifndef BIT_REQUEST_PIPELINE_H
+#define BIT_REQUEST_PIPELINE_H
+
+#include "../timer/TimeTraits.h"
+#include <cstddef>
+
+namespace bitwave {
+namespace core {
+
+    // request queue depth of a peer connection. It measures round trip
+    // time and block arrival rate of the connection, and keeps the depth
+    // twice the bandwidth delay product, so the queue grows quickly while
+    // the connection is limited by the queue, and stays when it is limited
+    // by the bandwidth
+    class BitRequestPipeline
+    {
+    public:
+        BitRequestPipeline();
+
+        // bounds of queue depth of all connections
+        static void SetDepthBounds(std::size_t min_depth, std::size_t max_depth);
+        static std::size_t GetMinDepth();
+        static std::size_t GetMaxDepth();
+
+        // a requested block arrived, request_time is the time the request
+        // was sent
+        void BlockArrived(std::size_t length, NormalTimeType request_time);
+
+        // count of requests should be outstanding
+        std::size_t GetDepth() const
+            { return depth_; }
+
+        // milliseconds, the samples include queueing time of our own
+        // requests, so it is the minimum of samples, and every 10 seconds
+        // the depth is halved for a while to drain the queue, then rtt is
+        // sampled again
+        NormalTimeType GetRoundTripTime() const
+            { return rtt_; }
+
+        // bytes per second
+        double GetArrivalRate() const
+            { return rate_; }
+
+    private:
+        typedef time_traits<NormalTimeType> TimeTraits;
+
+        void UpdateRoundTripTime(NormalTimeType now);
+        void UpdateDepth();
+
+        static std::size_t min_depth_;
+        static std::size_t max_depth_;
+
+        std::size_t depth_;
+        std::size_t block_size_;
+        NormalTimeType rtt_;
+        NormalTimeType window_rtt_;
+        NormalTimeType window_begin_;
+        NormalTimeType probe_begin_;
+        bool probing_;
+        NormalTimeType round_begin_;
+        long long round_bytes_;
+        double rate_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_REQUEST_PIPELINE_H
@@ -8,6 +8,14 @@ namespace core {
     BitController * BitService::controller = 0;
     BitRepository * BitService::repository = 0;
     BitNewTaskCreator * BitService::new_task_creator = 0;
+    BitHashPool * BitService::hash_pool = 0;
+    BitTokenBucket * BitService::upload_limiter = 0;
+    BitTokenBucket * BitService::download_limiter = 0;
+    BitUploadScheduler * BitService::upload_scheduler = 0;
+    BitHttpTracker * BitService::http_tracker = 0;
+    BitUdpSocket * BitService::udp_socket = 0;
+    BitDht * BitService::dht = 0;
+    BitUdpTracker * BitService::udp_tracker = 0;
 
 } // namespace core
 } // namespace bitwave
@@ -10,6 +10,13 @@ namespace core {
     class BitRepository;
     class BitController;
     class BitNewTaskCreator;
+    class BitHashPool;
+    class BitTokenBucket;
+    class BitUploadScheduler;
+    class BitUdpSocket;
+    class BitDht;
+    class BitUdpTracker;
+    class BitHttpTracker;
 
     class BitService : private StaticClass
     {
@@ -19,6 +26,18 @@ namespace core {
         static BitController *controller;
         static BitRepository *repository;
         static BitNewTaskCreator *new_task_creator;
+        static BitHashPool *hash_pool;
+        // global rate limiters, parents of limiters of all tasks
+        static BitTokenBucket *upload_limiter;
+        static BitTokenBucket *download_limiter;
+        static BitUploadScheduler *upload_scheduler;
+        // http tracker client, connections of all tasks are pooled in it
+        static BitHttpTracker *http_tracker;
+        // udp socket shared by dht and udp trackers, on the listen port
+        static BitUdpSocket *udp_socket;
+        // it is null when the udp socket can not be created
+        static BitDht *dht;
+        static BitUdpTracker *udp_tracker;
     };
 
 } // namespace core
@@ -1,8 +1,15 @@
 #include "BitTask.h"
+#include "BitAnnounceList.h"
 #include "BitData.h"
 #include "BitCache.h"
-#include "BitTrackerConnection.h"
+#include "BitChoker.h"
+#include "BitDht.h"
+#include "BitPex.h"
+#include "BitRecheck.h"
+#include "BitService.h"
+#include "BitTokenBucket.h"
 #include "BitUploadDispatcher.h"
+#include "BitUtMetadata.h"
 #include "BitDownloadDispatcher.h"
 #include "bencode/MetainfoFile.h"
 #include "../net/TimerService.h"
@@ -35,15 +42,26 @@ namespace core {
           bitdata_(bitdata),
           downloading_info_(bitdata),
           downloaded_updater_(bitdata),
+          upload_limiter_(new BitTokenBucket(BitService::upload_limiter)),
+          download_limiter_(new BitTokenBucket(BitService::download_limiter)),
           cache_(new BitCache(bitdata, &downloading_info_)),
-          uploader_(new BitUploadDispatcher(cache_)),
-          downloader_(new BitDownloadDispatcher(bitdata, &downloading_info_))
+          uploader_(new BitUploadDispatcher(cache_, upload_limiter_)),
+          downloader_(new BitDownloadDispatcher(bitdata, &downloading_info_)),
+          choker_(new BitChoker(bitdata, io_service)),
+          range_reader_(new BitRangeReader(bitdata, cache_, &downloading_info_)),
+          completed_(false)
     {
         peers_.SetTask(this);
         downloaded_updater_.SetTask(this);
 
         downloading_info_.AddInfoObserver(&downloaded_updater_);
 
+        if (!bitdata_->GetMetainfoFile()->IsPrivate())
+        {
+            pex_.Reset(new BitPex(bitdata_, io_service_));
+            dht_announcer_.Reset(new BitDhtAnnouncer(bitdata_, io_service_));
+        }
+
         BitPeerCreateStrategy *strategy = CreateDefaultPeerCreateStartegy();
         create_strategy_.Reset(strategy);
 
@@ -72,41 +90,94 @@ namespace core {
     void BitTask::ProcessTask()
     {
         cache_->ProcessCache();
-        uploader_->ProcessUpload();
+
+        if (downloader_->HasPendingCancels())
+            peers_.ForEach(std::tr1::bind(&BitPeerConnection::FlushCancels,
+                        std::tr1::placeholders::_1));
+
+        // a connection may be throttled by its own limiter even if the
+        // task is not limited, every throttled connection is resumed
+        peers_.ForEach(std::tr1::bind(&BitPeerConnection::ResumeDownload,
+                    std::tr1::placeholders::_1));
+
+        if (recheck_)
+            ProcessRecheck();
+    }
+
+    void BitTask::Recheck()
+    {
+        if (recheck_)
+            return ;
+
+        assert(BitService::hash_pool);
+        recheck_.Reset(new BitRecheck(bitdata_, *BitService::hash_pool));
+        recheck_->Start();
+    }
+
+    void BitTask::SetFilePriority(std::size_t file_index, BitPriority priority)
+    {
+        bitdata_->SetFilePriority(file_index, priority);
+        downloading_info_.UpdateNeedDownload(bitdata_);
+    }
+
+    void BitTask::SetPiecePriority(std::size_t begin, std::size_t end,
+                                   BitPriority priority)
+    {
+        bitdata_->SetPiecePriority(begin, end, priority);
+        downloading_info_.UpdateNeedDownload(bitdata_);
+    }
+
+    void BitTask::SetUploadLimit(long long bytes_per_second, long long burst)
+    {
+        upload_limiter_->SetRate(bytes_per_second, burst);
+    }
+
+    void BitTask::SetDownloadLimit(long long bytes_per_second, long long burst)
+    {
+        download_limiter_->SetRate(bytes_per_second, burst);
+    }
+
+    void BitTask::SetUploadPriority(BitPriority priority)
+    {
+        uploader_->SetPriority(priority);
+    }
+
+    void BitTask::StartStreaming(long long offset, long long bytes_per_second)
+    {
+        downloader_->StartStreaming(offset, bytes_per_second);
+    }
+
+    void BitTask::StopStreaming()
+    {
+        downloader_->StopStreaming();
+    }
+
+    void BitTask::ReadRange(long long offset, std::size_t length,
+                            const BitRangeReader::ReadCallback& callback)
+    {
+        if (downloader_->IsStreaming())
+            downloader_->UpdateStreamingPosition(offset);
+
+        range_reader_->ReadRange(offset, length, callback);
     }
 
     void BitTask::CreateTrackerConnection()
     {
-        typedef std::vector<std::string> AnnounceList;
         const bentypes::MetainfoFile *info = bitdata_->GetMetainfoFile();
 
-        AnnounceList announce;
-        info->GetAnnounce(&announce);
-
-        for (AnnounceList::iterator it = announce.begin();
-                it != announce.end(); ++it)
-        {
-            try
-            {
-                BitTrackerConnection *btc = new BitTrackerConnection(
-                        *it, bitdata_, io_service_);
-                TrackerConnPtr ptr(btc);
-                trackers_.push_back(ptr);
-            }
-            catch (...)
-            {
-                // we continue create tracker connection
-            }
-        }
+        BitTrackerTiers::Tiers tiers;
+        info->GetAnnounceTiers(&tiers);
+        announce_list_.Reset(new BitAnnounceList(tiers, bitdata_, io_service_));
     }
 
     void BitTask::UpdateTrackerInfo()
     {
-        std::for_each(
-                trackers_.begin(),
-                trackers_.end(),
-                std::tr1::bind(&BitTrackerConnection::UpdateTrackerInfo,
-                    std::tr1::placeholders::_1));
+        announce_list_->UpdateTrackerInfo();
+    }
+
+    void BitTask::SetAnnounceToAllTiers(bool all_tiers)
+    {
+        announce_list_->SetAnnounceToAllTiers(all_tiers);
     }
 
     void BitTask::InitCreatePeersTimer()
@@ -186,15 +257,97 @@ namespace core {
         peer_conn->SetCache(cache_);
         peer_conn->SetUploadDispatcher(uploader_);
         peer_conn->SetDownloadDispatcher(downloader_);
+        peer_conn->SetChoker(choker_);
+        peer_conn->SetTaskLimiters(upload_limiter_, download_limiter_);
+
+        // peers of magnet links download metadata of the task from us
+        std::tr1::shared_ptr<BitExtension> metadata_server(
+                new BitMetadataServer(peer_conn, bitdata_));
+        peer_conn->AddExtension(metadata_server);
+    }
+
+    void BitTask::AddChokePeer(const std::tr1::shared_ptr<BitPeerConnection>& peer)
+    {
+        choker_->AddPeer(peer);
+    }
+
+    void BitTask::RemoveChokePeer(const std::tr1::shared_ptr<BitPeerConnection>& peer)
+    {
+        choker_->RemovePeer(peer);
+    }
+
+    void BitTask::AddPexPeer(const std::tr1::shared_ptr<BitPeerConnection>& peer)
+    {
+        if (pex_)
+            pex_->AddPeer(peer);
+    }
+
+    void BitTask::RemovePexPeer(const std::tr1::shared_ptr<BitPeerConnection>& peer)
+    {
+        if (pex_)
+            pex_->RemovePeer(peer);
     }
 
     void BitTask::Complete()
     {
+        if (completed_)
+            return ;
+
+        completed_ = true;
         peers_.ForEach(
             std::tr1::bind(&BitPeerConnection::Complete, std::tr1::placeholders::_1));
         UpdateTrackerInfo();
         ClearTimer();
     }
 
+    void BitTask::ProcessRecheck()
+    {
+        bool complete = recheck_->IsComplete();
+
+        // downloaded updater completes the task when the last piece is
+        // marked by the recheck
+        BitRecheck::PieceIndexList pieces;
+        recheck_->GetCheckedPieces(pieces);
+        const BitPieceMap& downloaded = downloading_info_.GetDownloaded();
+        for (BitRecheck::PieceIndexList::iterator it = pieces.begin();
+                it != pieces.end(); ++it)
+        {
+            if (!downloaded.IsPieceMark(*it))
+                downloading_info_.MarkDownloadComplete(*it);
+        }
+
+        // pieces failed on disk are not downloaded any more
+        bool lost = false;
+        pieces.clear();
+        recheck_->GetFailedPieces(pieces);
+        for (BitRecheck::PieceIndexList::iterator it = pieces.begin();
+                it != pieces.end(); ++it)
+        {
+            if (downloading_info_.MarkRecheckFailed(*it))
+            {
+                // the picker removed the piece when it was downloaded
+                bitdata_->GetPieceAvailability().RestorePiece(*it);
+                bitdata_->IncreaseDownloaded(
+                        -static_cast<long long>(bitdata_->GetPieceLength()));
+                lost = true;
+            }
+        }
+
+        // a completed task downloads again, Complete cleared the timer
+        if (lost && completed_)
+        {
+            completed_ = false;
+            InitCreatePeersTimer();
+        }
+
+        if (!complete)
+            return ;
+
+        // all pieces passed, the task maybe downloaded before the recheck
+        if (recheck_->GetFailedCount() == 0)
+            Complete();
+        recheck_.Reset();
+    }
+
 } // namespace core
 } // namespace bitwave
@@ -4,6 +4,7 @@
 #include "BitPeerConnection.h"
 #include "BitPeerCreateStrategy.h"
 #include "BitDownloadingInfo.h"
+#include "BitRangeReader.h"
 #include "../base/BaseTypes.h"
 #include "../base/ScopePtr.h"
 #include "../net/IoService.h"
@@ -21,9 +22,14 @@ namespace core {
     class BitData;
     class BitCache;
     class BitPeerConnection;
-    class BitTrackerConnection;
+    class BitAnnounceList;
     class BitUploadDispatcher;
     class BitDownloadDispatcher;
+    class BitRecheck;
+    class BitChoker;
+    class BitPex;
+    class BitDhtAnnouncer;
+    class BitTokenBucket;
 
     // task class to control a bitwave download task
     class BitTask : private NotCopyable
@@ -43,11 +49,42 @@ namespace core {
 
         void ProcessTask();
 
+        // recheck all pieces of the task from disk in background, pieces
+        // checked ok are marked as downloaded
+        void Recheck();
+
+        // set download priority of file or pieces [begin, end), pieces
+        // of higher priority are downloaded first
+        void SetFilePriority(std::size_t file_index, BitPriority priority);
+        void SetPiecePriority(std::size_t begin, std::size_t end,
+                              BitPriority priority);
+
+        // rate limit of the task in bytes per second, 0 is unlimited,
+        // burst is the most bytes transferred at once after idle
+        void SetUploadLimit(long long bytes_per_second, long long burst = 0);
+        void SetDownloadLimit(long long bytes_per_second, long long burst = 0);
+
+        // upload share of the task in upload round robin of all tasks
+        void SetUploadPriority(BitPriority priority);
+
+        // announce to a tracker of every tier of announce-list at the same
+        // time, not only the first tier works
+        void SetAnnounceToAllTiers(bool all_tiers);
+
+        // streaming download, play from offset of the task data at
+        // bytes_per_second, pieces are downloaded by play deadline
+        void StartStreaming(long long offset, long long bytes_per_second);
+        void StopStreaming();
+
+        // read data [offset, offset + length) of the task, callback is
+        // called when the range is downloaded and read, the read offset
+        // is also the new play position of streaming
+        void ReadRange(long long offset, std::size_t length,
+                       const BitRangeReader::ReadCallback& callback);
+
     private:
         friend class TaskPeers;
         friend class DownloadedUpdater;
-        typedef std::tr1::shared_ptr<BitTrackerConnection> TrackerConnPtr;
-        typedef std::vector<TrackerConnPtr> TaskTrackers;
 
         class TaskPeers : public PeerConnectionOwner, private NotCopyable
         {
@@ -90,12 +127,16 @@ namespace core {
                 assert(task_);
                 task_->AddDownloadingInfoObserver(child.get());
                 task_->SetPeerConnectionBaseData(child.get());
+                task_->AddChokePeer(child);
+                task_->AddPexPeer(child);
             }
 
             virtual void NotifyConnectionDrop(const std::tr1::shared_ptr<BitPeerConnection>& child)
             {
                 assert(task_);
                 task_->RemoveDownloadingInfoObserver(child.get());
+                task_->RemoveChokePeer(child);
+                task_->RemovePexPeer(child);
                 peers_.erase(child);
             }
 
@@ -134,21 +175,38 @@ namespace core {
         void AddDownloadingInfoObserver(BitPeerConnection *observer);
         void RemoveDownloadingInfoObserver(BitPeerConnection *observer);
         void SetPeerConnectionBaseData(BitPeerConnection *peer_conn);
+        void AddChokePeer(const std::tr1::shared_ptr<BitPeerConnection>& peer);
+        void RemoveChokePeer(const std::tr1::shared_ptr<BitPeerConnection>& peer);
+        void AddPexPeer(const std::tr1::shared_ptr<BitPeerConnection>& peer);
+        void RemovePexPeer(const std::tr1::shared_ptr<BitPeerConnection>& peer);
         void Complete();
+        void ProcessRecheck();
 
         net::IoService& io_service_;
         Timer create_peers_timer_;
         ScopePtr<BitPeerCreateStrategy> create_strategy_;
         std::tr1::shared_ptr<BitData> bitdata_;
 
-        TaskTrackers trackers_;
+        // trackers of announce tiers of the metainfo
+        ScopePtr<BitAnnounceList> announce_list_;
         TaskPeers peers_;
         BitDownloadingInfo downloading_info_;
         DownloadedUpdater downloaded_updater_;
 
+        std::tr1::shared_ptr<BitTokenBucket> upload_limiter_;
+        std::tr1::shared_ptr<BitTokenBucket> download_limiter_;
         std::tr1::shared_ptr<BitCache> cache_;
         std::tr1::shared_ptr<BitUploadDispatcher> uploader_;
         std::tr1::shared_ptr<BitDownloadDispatcher> downloader_;
+        std::tr1::shared_ptr<BitChoker> choker_;
+        // peer exchange, it is null for private torrent
+        ScopePtr<BitPex> pex_;
+        // peers from dht, it is null for private torrent
+        ScopePtr<BitDhtAnnouncer> dht_announcer_;
+        ScopePtr<BitRecheck> recheck_;
+        ScopePtr<BitRangeReader> range_reader_;
+        // Complete has been called, reset when recheck loses pieces
+        bool completed_;
     };
 
 } // namespace core
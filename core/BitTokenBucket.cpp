@@ -0,0 +1,94 @@
+#include "BitTokenBucket.h"
+#include <assert.h>
+
+namespace bitwave {
+namespace core {
+
+    BitTokenBucket::BitTokenBucket(BitTokenBucket *parent)
+        : parent_(parent),
+          rate_(0),
+          burst_(0),
+          tokens_(0.0),
+          refill_time_(TimeTraits::now())
+    {
+    }
+
+    void BitTokenBucket::SetRate(long long bytes_per_second, long long burst)
+    {
+        assert(bytes_per_second >= 0 && burst >= 0);
+        bool was_limited = rate_ > 0;
+
+        rate_ = bytes_per_second;
+        burst_ = burst > 0 ? burst : bytes_per_second;
+        refill_time_ = TimeTraits::now();
+
+        // a new limited bucket starts full
+        if (!was_limited || tokens_ > burst_)
+            tokens_ = static_cast<double>(burst_);
+    }
+
+    bool BitTokenBucket::IsLimited() const
+    {
+        for (const BitTokenBucket *bucket = this; bucket; bucket = bucket->parent_)
+        {
+            if (bucket->rate_ > 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool BitTokenBucket::CanConsume()
+    {
+        for (BitTokenBucket *bucket = this; bucket; bucket = bucket->parent_)
+        {
+            if (bucket->rate_ > 0)
+            {
+                bucket->Refill();
+                if (bucket->tokens_ <= 0.0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool BitTokenBucket::Consume(long long bytes)
+    {
+        if (!CanConsume())
+            return false;
+
+        for (BitTokenBucket *bucket = this; bucket; bucket = bucket->parent_)
+        {
+            if (bucket->rate_ > 0)
+                bucket->tokens_ -= bytes;
+        }
+        return true;
+    }
+
+    void BitTokenBucket::Refund(long long bytes)
+    {
+        for (BitTokenBucket *bucket = this; bucket; bucket = bucket->parent_)
+        {
+            if (bucket->rate_ > 0)
+            {
+                bucket->tokens_ += bytes;
+                if (bucket->tokens_ > bucket->burst_)
+                    bucket->tokens_ = static_cast<double>(bucket->burst_);
+            }
+        }
+    }
+
+    void BitTokenBucket::Refill()
+    {
+        NormalTimeType now = TimeTraits::now();
+        NormalTimeType elapsed = now - refill_time_;
+        if (elapsed == 0)
+            return ;
+
+        refill_time_ = now;
+        tokens_ += static_cast<double>(rate_) * elapsed / 1000.0;
+        if (tokens_ > burst_)
+            tokens_ = static_cast<double>(burst_);
+    }
+
+} // namespace core
+} // namespace bitwave
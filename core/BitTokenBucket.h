@@ -0,0 +1,59 @@
+#ifndef BIT_TOKEN_BUCKET_H
+#define BIT_TOKEN_BUCKET_H
+
+#include "../base/BaseTypes.h"
+#include "../timer/TimeTraits.h"
+
+namespace bitwave {
+namespace core {
+
+    // byte token bucket of transfer rate limit. Buckets form a hierarchy
+    // (global, task, peer), bytes consumed from a bucket are consumed
+    // from all its parents too, so a transfer must have tokens in every
+    // level. A consume may take the bucket into debt, so a block larger
+    // than the burst can pass, and the debt is paid back by later tokens
+    class BitTokenBucket : private NotCopyable
+    {
+    public:
+        explicit BitTokenBucket(BitTokenBucket *parent = 0);
+
+        void SetParent(BitTokenBucket *parent)
+            { parent_ = parent; }
+
+        // bytes_per_second is 0 means unlimited, burst is the most bytes
+        // saved when idle, it is one second of the rate when it is 0
+        void SetRate(long long bytes_per_second, long long burst = 0);
+
+        long long GetRate() const
+            { return rate_; }
+        long long GetBurst() const
+            { return burst_; }
+
+        // this bucket or any parent is limited
+        bool IsLimited() const;
+
+        // every level has tokens
+        bool CanConsume();
+
+        // consume bytes from every level if CanConsume
+        bool Consume(long long bytes);
+
+        // consumed bytes are not transferred, give back the tokens
+        void Refund(long long bytes);
+
+    private:
+        typedef time_traits<NormalTimeType> TimeTraits;
+
+        void Refill();
+
+        BitTokenBucket *parent_;
+        long long rate_;
+        long long burst_;
+        double tokens_;
+        NormalTimeType refill_time_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_TOKEN_BUCKET_H
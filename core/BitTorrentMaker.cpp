@@ -0,0 +1,503 @@
+#include "BitTorrentMaker.h"
+#include "BitHashPool.h"
+#include "BitException.h"
+#include "bencode/BenEncoder.h"
+#include "../base/StringConv.h"
+#include "../sha1/NetSha1Value.h"
+#include "../thread/Atomic.h"
+#include <assert.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <utility>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        // about target_piece_count pieces, the .torrent of a large
+        // directory is not too big and a small file has small pieces
+        const std::size_t min_piece_length = 16 * 1024;
+        const std::size_t max_piece_length = 16 * 1024 * 1024;
+        const long long target_piece_count = 2000;
+
+        const std::size_t chunk_size = 8 * 1024 * 1024;
+        const std::size_t read_ahead_size = 128 * 1024 * 1024;
+
+        std::string RemoveTailSlash(const std::string& path)
+        {
+            std::string result = path;
+            while (!result.empty() &&
+                   (result[result.size() - 1] == '\\' || result[result.size() - 1] == '/'))
+                result.erase(result.size() - 1);
+            return result;
+        }
+
+        long long FileSize(const WIN32_FIND_DATA& data)
+        {
+            return (static_cast<long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        }
+
+        bool IsDirectory(const WIN32_FIND_DATA& data)
+        {
+            return (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        }
+
+        // an entry of a directory with its UTF-8 name
+        typedef std::pair<std::string, WIN32_FIND_DATA> FindEntry;
+
+        bool FindEntryLess(const FindEntry& left, const FindEntry& right)
+        {
+            return left.first < right.first;
+        }
+
+    } // unnamed namespace
+
+    struct BitTorrentMaker::Chunk
+    {
+        std::size_t first_piece;
+        std::size_t piece_count;
+        volatile long hashing_pieces;
+        std::vector<char> data;
+    };
+
+    BitTorrentMaker::BitTorrentMaker(const std::string& path, BitHashPool& hash_pool)
+        : hash_pool_(hash_pool),
+          single_file_(false),
+          total_length_(0),
+          piece_length_(0),
+          piece_count_(0),
+          private_(false),
+          chunk_pieces_(0),
+          max_read_ahead_(0),
+          file_index_(0),
+          file_left_(0),
+          file_handle_(INVALID_HANDLE_VALUE),
+          thread_exit_flag_(0),
+          read_ahead_(0),
+          pending_jobs_(0),
+          frequency_(0),
+          start_counter_(0),
+          complete_counter_(0),
+          hashed_count_(0),
+          hashed_bytes_(0),
+          failed_(false)
+    {
+        std::string root = RemoveTailSlash(path);
+        std::string::size_type slash = root.find_last_of("\\/");
+        name_ = slash == std::string::npos ? root : root.substr(slash + 1);
+
+        std::wstring wroot = root.empty() ? std::wstring() : UTF8ToUnicode(root);
+        WIN32_FIND_DATA data;
+        HANDLE find = wroot.empty() ? INVALID_HANDLE_VALUE :
+            ::FindFirstFile(wroot.c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE)
+            throw CreateFileException(PATH_ERROR, path);
+        ::FindClose(find);
+
+        if (IsDirectory(data))
+        {
+            FindFiles(wroot, std::vector<std::string>());
+        }
+        else
+        {
+            single_file_ = true;
+            files_.push_back(FileInfo(wroot,
+                        std::vector<std::string>(1, name_), FileSize(data)));
+            total_length_ = FileSize(data);
+        }
+
+        if (files_.empty() || total_length_ == 0)
+            throw CreateFileException(PATH_ERROR, path);
+
+        SetPieceLength(0);
+
+        LARGE_INTEGER frequency;
+        ::QueryPerformanceFrequency(&frequency);
+        frequency_ = frequency.QuadPart;
+    }
+
+    BitTorrentMaker::~BitTorrentMaker()
+    {
+        AtomicAdd(&thread_exit_flag_, 1);
+        if (read_thread_)
+            read_thread_->Join();
+
+        // hash jobs reference this, wait all of them
+        while (AtomicAdd(&pending_jobs_, 0) > 0)
+            chunk_done_event_.Wait(10);
+
+        CloseFile();
+    }
+
+    void BitTorrentMaker::SetPieceLength(std::size_t piece_length)
+    {
+        assert(!read_thread_);
+        piece_length_ = piece_length ? piece_length : ChoosePieceLength(total_length_);
+        piece_count_ = static_cast<std::size_t>(
+                (total_length_ + piece_length_ - 1) / piece_length_);
+        pieces_sha1_.assign(piece_count_, Sha1Value());
+
+        // enough chunks are read ahead to keep all hash threads busy
+        chunk_pieces_ = (std::max)(chunk_size / piece_length_, std::size_t(1));
+        std::size_t chunk_bytes = chunk_pieces_ * piece_length_;
+        std::size_t busy_chunks = hash_pool_.GetThreadCount() / chunk_pieces_ + 2;
+        max_read_ahead_ = static_cast<long>((std::max)(
+                read_ahead_size / chunk_bytes, busy_chunks));
+    }
+
+    void BitTorrentMaker::SetAnnounceTiers(const std::vector<std::vector<std::string> >& tiers)
+    {
+        announce_tiers_ = tiers;
+    }
+
+    void BitTorrentMaker::SetComment(const std::string& comment)
+    {
+        comment_ = comment;
+    }
+
+    void BitTorrentMaker::SetPrivate(bool is_private)
+    {
+        private_ = is_private;
+    }
+
+    void BitTorrentMaker::Start()
+    {
+        if (read_thread_)
+            return ;
+
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            start_counter_ = GetCounter();
+        }
+
+        read_thread_.Reset(new Thread(
+                    std::tr1::bind(&BitTorrentMaker::ReadThread, this)));
+    }
+
+    bool BitTorrentMaker::IsComplete() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return failed_ || hashed_count_ == piece_count_;
+    }
+
+    bool BitTorrentMaker::IsFailed() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return failed_;
+    }
+
+    std::size_t BitTorrentMaker::GetHashedCount() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        return hashed_count_;
+    }
+
+    double BitTorrentMaker::GetThroughput() const
+    {
+        SpinlocksMutexLocker locker(mutex_);
+        if (start_counter_ == 0)
+            return 0.0;
+
+        long long end = complete_counter_ ? complete_counter_ : GetCounter();
+        double seconds = static_cast<double>(end - start_counter_) / frequency_;
+        if (seconds <= 0.0)
+            return 0.0;
+
+        return hashed_bytes_ / seconds / (1024.0 * 1024.0 * 1024.0);
+    }
+
+    void BitTorrentMaker::WriteMetainfo(bentypes::BenWriter& writer) const
+    {
+        assert(IsComplete() && !IsFailed());
+
+        bentypes::BenDictionaryWriter torrent(writer);
+        if (!announce_tiers_.empty() && !announce_tiers_[0].empty())
+        {
+            torrent.Add("announce", announce_tiers_[0][0]);
+
+            // announce-list (BEP 12) when there is more than one tracker
+            if (announce_tiers_.size() > 1 || announce_tiers_[0].size() > 1)
+            {
+                torrent.Key("announce-list").BeginList();
+                for (std::size_t i = 0; i < announce_tiers_.size(); ++i)
+                {
+                    writer.BeginList();
+                    for (std::size_t j = 0; j < announce_tiers_[i].size(); ++j)
+                        writer.WriteString(announce_tiers_[i][j]);
+                    writer.End();
+                }
+                writer.End();
+            }
+        }
+
+        if (!comment_.empty())
+            torrent.Add("comment", comment_);
+        torrent.Add("created by", "BitWave");
+        torrent.Add("creation date", static_cast<long long>(time(0)));
+
+        bentypes::BenDictionaryWriter info(torrent.Key("info"));
+        if (single_file_)
+        {
+            info.Add("length", total_length_);
+        }
+        else
+        {
+            info.Key("files").BeginList();
+            for (std::size_t i = 0; i < files_.size(); ++i)
+            {
+                bentypes::BenDictionaryWriter file(writer);
+                file.Add("length", files_[i].length);
+                file.Key("path").BeginList();
+                for (std::size_t j = 0; j < files_[i].path.size(); ++j)
+                    writer.WriteString(files_[i].path[j]);
+                writer.End();
+            }
+            writer.End();
+        }
+
+        info.Add("name", name_);
+        info.Add("piece length", static_cast<long long>(piece_length_));
+
+        std::string pieces;
+        pieces.reserve(piece_count_ * 20);
+        for (std::size_t i = 0; i < piece_count_; ++i)
+            pieces.append(pieces_sha1_[i].GetData(), pieces_sha1_[i].GetDataSize());
+        info.Add("pieces", pieces);
+
+        if (private_)
+            info.Add("private", 1);
+    }
+
+    void BitTorrentMaker::SaveTorrentFile(const std::string& torrent_file) const
+    {
+        if (IsFailed())
+            throw CreateFileException(PATH_ERROR, failed_file_);
+
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache, piece_count_ * 20 + 64 * 1024);
+        WriteMetainfo(writer);
+
+        std::wstring path = UTF8ToUnicode(torrent_file);
+        std::ofstream fs(path.c_str(), std::ios_base::out | std::ios_base::binary);
+        if (!fs.is_open())
+            throw CreateFileException(PATH_ERROR, torrent_file);
+
+        fs.write(writer.GetData(), writer.GetSize());
+        if (!fs)
+            throw CreateFileException(SPACE_NOT_ENOUGH, torrent_file);
+    }
+
+    // static
+    std::size_t BitTorrentMaker::ChoosePieceLength(long long total_length)
+    {
+        std::size_t piece_length = min_piece_length;
+        while (piece_length < max_piece_length &&
+               total_length / static_cast<long long>(piece_length) > target_piece_count)
+            piece_length *= 2;
+        return piece_length;
+    }
+
+    void BitTorrentMaker::FindFiles(const std::wstring& directory,
+                                    const std::vector<std::string>& path)
+    {
+        // entries are sorted, the same directory makes the same torrent
+        std::vector<FindEntry> entries;
+
+        WIN32_FIND_DATA data;
+        HANDLE find = ::FindFirstFile((directory + L"\\*").c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE)
+            return ;
+
+        do
+        {
+            std::wstring name = data.cFileName;
+            if (name == L"." || name == L"..")
+                continue;
+            entries.push_back(std::make_pair(UnicodeToUTF8(name), data));
+        } while (::FindNextFile(find, &data));
+        ::FindClose(find);
+
+        std::sort(entries.begin(), entries.end(), FindEntryLess);
+
+        for (std::vector<FindEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            std::wstring full_path = directory + L"\\" + it->second.cFileName;
+            std::vector<std::string> file_path(path);
+            file_path.push_back(it->first);
+
+            if (IsDirectory(it->second))
+            {
+                FindFiles(full_path, file_path);
+            }
+            else
+            {
+                files_.push_back(FileInfo(full_path, file_path, FileSize(it->second)));
+                total_length_ += FileSize(it->second);
+            }
+        }
+    }
+
+    unsigned BitTorrentMaker::ReadThread()
+    {
+        std::size_t piece_index = 0;
+        while (piece_index < piece_count_ && WaitReadAhead())
+        {
+            ChunkPtr chunk(new Chunk);
+            chunk->first_piece = piece_index;
+            chunk->piece_count = (std::min)(chunk_pieces_, piece_count_ - piece_index);
+            chunk->hashing_pieces = static_cast<long>(chunk->piece_count);
+
+            long long chunk_begin = static_cast<long long>(piece_index) * piece_length_;
+            long long chunk_size = (std::min)(
+                    static_cast<long long>(chunk->piece_count * piece_length_),
+                    total_length_ - chunk_begin);
+            chunk->data.resize(static_cast<std::size_t>(chunk_size));
+
+            if (!ReadChunk(*chunk))
+            {
+                SpinlocksMutexLocker locker(mutex_);
+                failed_ = true;
+                complete_counter_ = GetCounter();
+                break;
+            }
+
+            AtomicIncrement(&read_ahead_);
+            AtomicAdd(&pending_jobs_, static_cast<long>(chunk->piece_count));
+            for (std::size_t i = 0; i < chunk->piece_count; ++i)
+            {
+                hash_pool_.AddJob(
+                        std::tr1::bind(&BitTorrentMaker::HashPiece, this, chunk, i),
+                        BitHashPool::LOW);
+            }
+
+            piece_index += chunk->piece_count;
+        }
+
+        CloseFile();
+        return 0;
+    }
+
+    bool BitTorrentMaker::WaitReadAhead()
+    {
+        while (AtomicAdd(&read_ahead_, 0) >= max_read_ahead_)
+        {
+            if (AtomicAdd(&thread_exit_flag_, 0))
+                return false;
+            chunk_done_event_.Wait(100);
+        }
+
+        return AtomicAdd(&thread_exit_flag_, 0) == 0;
+    }
+
+    bool BitTorrentMaker::ReadChunk(Chunk& chunk)
+    {
+        // a chunk is filled by several files when they are small
+        std::size_t pos = 0;
+        std::size_t size = chunk.data.size();
+        while (pos < size)
+        {
+            if (file_left_ == 0 && !OpenNextFile())
+                return false;
+
+            std::size_t len = static_cast<std::size_t>(
+                    (std::min)(static_cast<long long>(size - pos), file_left_));
+
+            DWORD bytes = 0;
+            if (!::ReadFile(file_handle_, &chunk.data[pos],
+                        static_cast<DWORD>(len), &bytes, 0) || bytes != len)
+            {
+                SpinlocksMutexLocker locker(mutex_);
+                failed_file_ = UnicodeToUTF8(files_[file_index_ - 1].full_path);
+                return false;
+            }
+
+            pos += len;
+            file_left_ -= len;
+        }
+
+        return true;
+    }
+
+    bool BitTorrentMaker::OpenNextFile()
+    {
+        CloseFile();
+
+        while (file_index_ < files_.size() && files_[file_index_].length == 0)
+            ++file_index_;
+
+        if (file_index_ >= files_.size())
+            return false;
+
+        const FileInfo& info = files_[file_index_++];
+        file_left_ = info.length;
+
+        file_handle_ = ::CreateFile(info.full_path.c_str(),
+                GENERIC_READ, FILE_SHARE_READ, 0,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        if (file_handle_ == INVALID_HANDLE_VALUE)
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            failed_file_ = UnicodeToUTF8(info.full_path);
+            return false;
+        }
+
+        return true;
+    }
+
+    void BitTorrentMaker::CloseFile()
+    {
+        if (file_handle_ != INVALID_HANDLE_VALUE)
+        {
+            ::CloseHandle(file_handle_);
+            file_handle_ = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    void BitTorrentMaker::HashPiece(const ChunkPtr& chunk, std::size_t index_of_chunk)
+    {
+        std::size_t piece_index = chunk->first_piece + index_of_chunk;
+        std::size_t size = GetPieceSize(piece_index);
+
+        if (!AtomicAdd(&thread_exit_flag_, 0))
+        {
+            const char *data = &chunk->data[index_of_chunk * piece_length_];
+            pieces_sha1_[piece_index] = NetByteOrder(Sha1Value(data, size));
+        }
+
+        {
+            SpinlocksMutexLocker locker(mutex_);
+            ++hashed_count_;
+            hashed_bytes_ += size;
+            if (hashed_count_ == piece_count_)
+                complete_counter_ = GetCounter();
+        }
+
+        if (AtomicDecrement(&chunk->hashing_pieces) == 0)
+        {
+            AtomicDecrement(&read_ahead_);
+            chunk_done_event_.SetEvent();
+        }
+
+        // this maybe destroyed after pending_jobs_ is zero
+        AtomicDecrement(&pending_jobs_);
+    }
+
+    std::size_t BitTorrentMaker::GetPieceSize(std::size_t piece_index) const
+    {
+        long long begin = static_cast<long long>(piece_index) * piece_length_;
+        return static_cast<std::size_t>(
+                (std::min)(static_cast<long long>(piece_length_), total_length_ - begin));
+    }
+
+    long long BitTorrentMaker::GetCounter() const
+    {
+        LARGE_INTEGER counter;
+        ::QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
+
+} // namespace core
+} // namespace bitwave
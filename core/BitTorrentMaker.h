@@ -0,0 +1,143 @@
+#ifndef BIT_TORRENT_MAKER_H
+#define BIT_TORRENT_MAKER_H
+
+#include "../base/BaseTypes.h"
+#include "../base/ScopePtr.h"
+#include "../sha1/Sha1Value.h"
+#include "../thread/Thread.h"
+#include "../thread/Event.h"
+#include "../thread/Mutex.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+namespace bitwave {
+namespace core {
+
+    class BitHashPool;
+
+    namespace bentypes {
+        class BenWriter;
+    } // namespace bentypes
+
+    // make a .torrent of a file or a directory. Files are read in large
+    // sequential chunks across file boundaries by a read thread with
+    // bounded read ahead, and pieces of each chunk are hashed in
+    // BitHashPool on all processors. All strings are encoded by UTF-8
+    class BitTorrentMaker : private NotCopyable
+    {
+    public:
+        // files of a directory are found recursively and sorted by path,
+        // throw CreateFileException when no file is found in path
+        BitTorrentMaker(const std::string& path, BitHashPool& hash_pool);
+
+        ~BitTorrentMaker();
+
+        // piece length is a power of 2 chosen by the total length when
+        // it is not set, it is set before Start
+        void SetPieceLength(std::size_t piece_length);
+        void SetAnnounceTiers(const std::vector<std::vector<std::string> >& tiers);
+        void SetComment(const std::string& comment);
+        void SetPrivate(bool is_private);
+
+        void Start();
+
+        // all pieces are hashed, or reading a file failed
+        bool IsComplete() const;
+        bool IsFailed() const;
+
+        std::size_t GetPieceLength() const
+            { return piece_length_; }
+        std::size_t GetPieceCount() const
+            { return piece_count_; }
+        long long GetTotalLength() const
+            { return total_length_; }
+
+        std::size_t GetHashedCount() const;
+
+        // hashed bytes per second since Start in GB/s
+        double GetThroughput() const;
+
+        // write the metainfo when it is complete and not failed
+        void WriteMetainfo(bentypes::BenWriter& writer) const;
+
+        // throw CreateFileException when the torrent file can not be
+        // written
+        void SaveTorrentFile(const std::string& torrent_file) const;
+
+        // piece length of a torrent of total_length bytes
+        static std::size_t ChoosePieceLength(long long total_length);
+
+    private:
+        struct Chunk;
+        typedef std::tr1::shared_ptr<Chunk> ChunkPtr;
+
+        struct FileInfo
+        {
+            FileInfo(const std::wstring& f, const std::vector<std::string>& p,
+                     long long len)
+                : full_path(f), path(p), length(len)
+            {
+            }
+
+            std::wstring full_path;
+            // components relative to the directory
+            std::vector<std::string> path;
+            long long length;
+        };
+
+        void FindFiles(const std::wstring& directory,
+                       const std::vector<std::string>& path);
+        unsigned ReadThread();
+        bool WaitReadAhead();
+        bool ReadChunk(Chunk& chunk);
+        bool OpenNextFile();
+        void CloseFile();
+        void HashPiece(const ChunkPtr& chunk, std::size_t index_of_chunk);
+        std::size_t GetPieceSize(std::size_t piece_index) const;
+        long long GetCounter() const;
+
+        BitHashPool& hash_pool_;
+        std::string name_;
+        bool single_file_;
+        std::vector<FileInfo> files_;
+        long long total_length_;
+        std::size_t piece_length_;
+        std::size_t piece_count_;
+
+        std::vector<std::vector<std::string> > announce_tiers_;
+        std::string comment_;
+        bool private_;
+
+        // piece hashes in net byte order, written by hash jobs
+        std::vector<Sha1Value> pieces_sha1_;
+
+        std::size_t chunk_pieces_;
+        long max_read_ahead_;
+
+        // read thread data
+        std::size_t file_index_;
+        long long file_left_;
+        HANDLE file_handle_;
+
+        volatile long thread_exit_flag_;
+        volatile long read_ahead_;
+        volatile long pending_jobs_;
+        AutoResetEvent chunk_done_event_;
+        ScopePtr<Thread> read_thread_;
+
+        mutable SpinlocksMutex mutex_;
+        long long frequency_;
+        long long start_counter_;
+        long long complete_counter_;
+        std::size_t hashed_count_;
+        long long hashed_bytes_;
+        bool failed_;
+        std::string failed_file_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_TORRENT_MAKER_H
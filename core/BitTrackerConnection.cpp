@@ -2,15 +2,11 @@
 #include "BitData.h"
 #include "BitService.h"
 #include "BitRepository.h"
-#include "bencode/TrackerResponse.h"
-#include "../net/Address.h"
+#include "../base/Random.h"
 #include "../net/TimerService.h"
 #include "../protocol/URI.h"
-#include "../protocol/Request.h"
-#include "../sha1/NetSha1Value.h"
 #include <assert.h>
-#include <string.h>
-#include <vector>
+#include <stdlib.h>
 #include <functional>
 
 namespace bitwave {
@@ -18,178 +14,208 @@ namespace core {
 
     using namespace std::tr1::placeholders;
 
+    namespace {
+
+        // the first announce fails is tried again after this seconds
+        const int retry_interval = 30;
+
+        // first announces of tasks loaded at startup are spread in this
+        // milliseconds, and an announce interval is delayed randomly at
+        // most 1/10, so announces of tasks do not come to a tracker at
+        // the same time
+        const int startup_jitter = 15 * 1000;
+        // an interval of the tracker is not longer than one day, so
+        // milliseconds of it never overflow
+        const int max_announce_interval = 24 * 60 * 60;
+
+        int IntervalJitter(int seconds)
+        {
+            unsigned long long range =
+                static_cast<unsigned long long>(seconds) * 100 + 1;
+            return static_cast<int>(RandomValue<unsigned long long>() % range);
+        }
+
+    } // unnamed namespace
+
     BitTrackerConnection::BitTrackerConnection(const std::string& url,
                                                const std::tr1::shared_ptr<BitData>& bitdata,
                                                net::IoService& io_service)
         : io_service_(io_service),
-          reconnect_interval_(30),
+          announce_interval_(retry_interval),
+          request_id_(0),
+          started_(false),
           bitdata_(bitdata),
+          info_hash_(bitdata->GetInfoHash()),
+          peer_id_(bitdata->GetPeerId()),
           url_(url)
     {
-        http::URI uri(url);
-        host_ = uri.GetHost();
-
-        net::ServicePtr<net::ResolveService> address_resolver_ptr(io_service);
-        assert(address_resolver_ptr);
-        net::ResolveHint hint(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-        address_resolver_ptr->AsyncResolve(host_, "", hint,
-                std::tr1::bind(
-                    &BitTrackerConnection::ResolveHandler,
-                    this, _1, _2, _3));
-
-        reconnect_timer_.SetCallback(
-                std::tr1::bind(
-                    &BitTrackerConnection::ReconnectTimerCallback,
-                    this));
+        Init();
     }
 
-    BitTrackerConnection::~BitTrackerConnection()
+    BitTrackerConnection::BitTrackerConnection(const std::string& url,
+                                               const std::tr1::shared_ptr<BitData>& bitdata,
+                                               net::IoService& io_service,
+                                               const AnnounceCallback& announce_callback)
+        : io_service_(io_service),
+          announce_interval_(retry_interval),
+          request_id_(0),
+          started_(false),
+          bitdata_(bitdata),
+          info_hash_(bitdata->GetInfoHash()),
+          peer_id_(bitdata->GetPeerId()),
+          announce_callback_(announce_callback),
+          url_(url)
     {
-        ClearNetProcessor();
-        CloseReconnectTimer();
+        Init();
     }
 
-    void BitTrackerConnection::UpdateTrackerInfo()
+    BitTrackerConnection::BitTrackerConnection(const std::string& url,
+                                               const Sha1Value& info_hash,
+                                               const std::string& peer_id,
+                                               const PeerCallback& peer_callback,
+                                               net::IoService& io_service)
+        : io_service_(io_service),
+          announce_interval_(retry_interval),
+          request_id_(0),
+          started_(false),
+          info_hash_(info_hash),
+          peer_id_(peer_id),
+          peer_callback_(peer_callback),
+          url_(url)
     {
-        ConnectTracker();
+        Init();
     }
 
-    void BitTrackerConnection::ProcessProtocol(const char *data, std::size_t size)
+    BitTrackerConnection::~BitTrackerConnection()
     {
-        try
-        {
-            http::Response response(data, size);
-            if (response.GetStatusCodeType() == http::Response::SUCCESS)
-            {
-                std::size_t content_size = response.GetContentSize();
-                if (content_size > 0)
-                {
-                    const char * content = response.GetContentBufPointer();
-                    bentypes::TrackerResponse response_info(content, content_size);
-
-                    if (!response_info.IsFailure())
-                    {
-                        typedef std::vector<bentypes::TrackerResponse::PeerInfo> PeersInfo;
-                        PeersInfo peers_info;
-                        response_info.GetPeerInfo(peers_info);
-
-                        for (PeersInfo::iterator it = peers_info.begin();
-                                it != peers_info.end(); ++it)
-                        {
-                            bitdata_->AddPeerListenInfo(it->ip, it->port);
-                        }
-
-                        reconnect_interval_ = response_info.GetInterval();
-                    }
-                }
-            }
-        }
-        catch (...)
-        {
-            // we do nothing here ...
-        }
-
-        net_processor_->Close();
+        if (request_id_ != 0 && BitService::http_tracker)
+            BitService::http_tracker->Cancel(request_id_);
+        CloseAnnounceTimer();
     }
 
-    void BitTrackerConnection::OnConnect()
+    void BitTrackerConnection::Init()
     {
-        SendRequest();
+        // throw URIException when the url is invalid
+        http::URI uri(url_);
+
+        announce_timer_.SetCallback(
+                std::tr1::bind(
+                    &BitTrackerConnection::AnnounceTimerCallback,
+                    this));
+
+        // the owner decides when to announce
+        if (announce_callback_)
+            return ;
+
+        // a magnet link task has no peers, it announces now
+        if (bitdata_)
+            StartAnnounceTimer(RandomValue<unsigned int>() % startup_jitter);
+        else
+            Announce();
     }
 
-    void BitTrackerConnection::OnDisconnect()
+    void BitTrackerConnection::UpdateTrackerInfo()
     {
-        ClearNetProcessor();
-        StartReconnectTimer(reconnect_interval_);
+        Announce();
     }
 
-    void BitTrackerConnection::ResolveHandler(const std::string& nodename,
-                                              const std::string& servname,
-                                              const net::ResolveResult& result)
+    void BitTrackerConnection::AddPeer(unsigned long ip, unsigned short port)
     {
-        assert(nodename == host_);
-        host_address_ = result;
-
-        ConnectTracker();
+        if (bitdata_)
+            bitdata_->AddPeerListenInfo(ip, port);
+        else
+            peer_callback_(ip, port);
     }
 
-    void BitTrackerConnection::ConnectTracker()
+    void BitTrackerConnection::Announce()
     {
-        if (net_processor_)
+        // the owner waits for the result of every announce
+        if (!BitService::http_tracker)
+        {
+            if (announce_callback_)
+                announce_callback_(false, 0);
             return ;
+        }
 
-        sockaddr *addr = 0;
-        net::ResolveResult::iterator it = host_address_.begin();
-        if (it != host_address_.end())
-            addr = it->ai_addr;
-
-        if (addr)
+        // an announce is in flight, the owner gets the result of a new
+        // one instead of it
+        if (request_id_ != 0)
         {
-            net_processor_.reset(new NetProcessor(io_service_, this));
+            if (!announce_callback_)
+                return ;
+            BitService::http_tracker->Cancel(request_id_);
+            request_id_ = 0;
+        }
 
-            net::Port port(80);
-            net::Address address(reinterpret_cast<sockaddr_in *>(addr));
-            net_processor_->Connect(address, port);
+        HttpAnnounceRequest request;
+        request.info_hash = info_hash_;
+        request.peer_id = peer_id_;
+        request.port = BitService::repository->GetListenPort();
+        request.event = started_ ? HttpAnnounceRequest::NONE :
+            HttpAnnounceRequest::STARTED;
+
+        // size of a magnet link task is unknown, announce one byte left,
+        // so the tracker takes us as a leecher
+        request.left = 1;
+        if (bitdata_)
+        {
+            request.uploaded = bitdata_->GetUploaded();
+            request.downloaded = bitdata_->GetDownloaded();
+            request.left = bitdata_->GetTotalSize() - request.downloaded;
         }
+
+        CloseAnnounceTimer();
+        request_id_ = BitService::http_tracker->Announce(url_, request,
+                std::tr1::bind(&BitTrackerConnection::AnnounceHandler,
+                    this, _1, _2));
     }
 
-    void BitTrackerConnection::SendRequest()
+    void BitTrackerConnection::AnnounceHandler(bool success,
+                                               const HttpTrackerResponse& response)
     {
-        http::URI uri(url_);
+        request_id_ = 0;
+
+        if (success)
+        {
+            started_ = true;
+            for (std::size_t i = 0; i < response.peers.size(); ++i)
+                AddPeer(response.peers[i].ip, response.peers[i].port);
+
+            if (response.interval > 0)
+                announce_interval_ = response.interval < max_announce_interval ?
+                    response.interval : max_announce_interval;
+        }
+
+        if (announce_callback_)
+        {
+            announce_callback_(success, response.interval);
+            return ;
+        }
 
-        Sha1Value net_sha1 = NetByteOrder(bitdata_->GetInfoHash());
-        std::string peer_id = bitdata_->GetPeerId();
-        short listen_port = BitService::repository->GetListenPort();
-        long long uploaded = bitdata_->GetUploaded();
-        long long downloaded = bitdata_->GetDownloaded();
-        long long left = bitdata_->GetTotalSize() - downloaded;
-
-        uri.AddQuery("info_hash", net_sha1.GetData(), net_sha1.GetDataSize());
-        uri.AddQuery("peer_id", peer_id.c_str(), 20);
-        uri.AddQuery("port", listen_port);
-        uri.AddQuery("uploaded", uploaded);
-        uri.AddQuery("downloaded", downloaded);
-        uri.AddQuery("left", left);
-        uri.AddQuery("compact", 1);
-        uri.AddQuery("numwant", 200);
-
-        http::Request request(uri);
-        std::string request_text = request.GetRequestText();
-        assert(net_processor_);
-        net_processor_->Send(request_text.data(), request_text.size());
+        StartAnnounceTimer(announce_interval_ * 1000 +
+                IntervalJitter(announce_interval_));
     }
 
-    void BitTrackerConnection::StartReconnectTimer(int seconds)
+    void BitTrackerConnection::StartAnnounceTimer(int milliseconds)
     {
-        assert(seconds > 0);
+        assert(milliseconds >= 0);
         net::ServicePtr<net::TimerService> timer_service(io_service_);
         assert(timer_service);
-        reconnect_timer_.SetDeadline(seconds * 1000);
-        timer_service->AddTimer(&reconnect_timer_);
+        announce_timer_.SetDeadline(milliseconds);
+        timer_service->AddTimer(&announce_timer_);
     }
 
-    void BitTrackerConnection::ReconnectTimerCallback()
+    void BitTrackerConnection::AnnounceTimerCallback()
     {
-        CloseReconnectTimer();
-        ConnectTracker();
+        CloseAnnounceTimer();
+        Announce();
     }
 
-    void BitTrackerConnection::CloseReconnectTimer()
+    void BitTrackerConnection::CloseAnnounceTimer()
     {
         net::ServicePtr<net::TimerService> timer_service(io_service_);
         assert(timer_service);
-        timer_service->DelTimer(&reconnect_timer_);
-    }
-
-    void BitTrackerConnection::ClearNetProcessor()
-    {
-        if (net_processor_)
-        {
-            net_processor_->ClearConnection();
-            net_processor_->Close();
-            net_processor_.reset();
-        }
+        timer_service->DelTimer(&announce_timer_);
     }
 
 } // namespace core
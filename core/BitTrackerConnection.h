@@ -1,56 +1,77 @@
 #ifndef BIT_TRACKER_CONNECTION_H
 #define BIT_TRACKER_CONNECTION_H
 
-#include "BitNetProcessor.h"
+#include "BitHttpTracker.h"
 #include "../base/BaseTypes.h"
-#include "../net/ResolveService.h"
-#include "../protocol/Response.h"
+#include "../net/IoService.h"
+#include "../sha1/Sha1Value.h"
 #include "../timer/Timer.h"
 #include <string>
 #include <memory>
+#include <functional>
 
 namespace bitwave {
 namespace core {
 
     class BitData;
 
+    // announce a task to a http tracker by the shared BitHttpTracker, which
+    // pools connections of all tasks to the tracker host
     class BitTrackerConnection : private NotCopyable
     {
     public:
+        // ip and port of a peer in host byte order
+        typedef std::tr1::function<void (unsigned long, unsigned short)> PeerCallback;
+        // success and the announce interval in seconds of an announce
+        typedef std::tr1::function<void (bool, int)> AnnounceCallback;
+
         BitTrackerConnection(const std::string& url,
                              const std::tr1::shared_ptr<BitData>& bitdata,
                              net::IoService& io_service);
 
+        // announce of a tracker in announce tiers, it announces only when
+        // UpdateTrackerInfo is called, and the result is passed to the
+        // callback after peers are added, the owner schedules announces
+        BitTrackerConnection(const std::string& url,
+                             const std::tr1::shared_ptr<BitData>& bitdata,
+                             net::IoService& io_service,
+                             const AnnounceCallback& announce_callback);
+
+        // announce of a magnet link task which has no metainfo yet, peers
+        // of the tracker response are passed to the callback
+        BitTrackerConnection(const std::string& url,
+                             const Sha1Value& info_hash,
+                             const std::string& peer_id,
+                             const PeerCallback& peer_callback,
+                             net::IoService& io_service);
+
         ~BitTrackerConnection();
 
         void UpdateTrackerInfo();
-        void ProcessProtocol(const char *data, std::size_t size);
-        void OnConnect();
-        void OnDisconnect();
 
     private:
-        typedef BitNetProcessor<http::ResponseUnpackRuler,
-                                BitTrackerConnection> NetProcessor;
-
-        void ResolveHandler(const std::string& nodename,
-                            const std::string& servname,
-                            const net::ResolveResult& result);
-        void ConnectTracker();
-        void SendRequest();
-        void StartReconnectTimer(int seconds);
-        void ReconnectTimerCallback();
-        void CloseReconnectTimer();
-        void ClearNetProcessor();
+        void Init();
+        void AddPeer(unsigned long ip, unsigned short port);
+        void Announce();
+        void AnnounceHandler(bool success, const HttpTrackerResponse& response);
+        void StartAnnounceTimer(int milliseconds);
+        void AnnounceTimerCallback();
+        void CloseAnnounceTimer();
 
         net::IoService& io_service_;
-        net::ResolveResult host_address_;
-        std::tr1::shared_ptr<NetProcessor> net_processor_;
-        Timer reconnect_timer_;
-        int reconnect_interval_;
+        Timer announce_timer_;
+        int announce_interval_;
+        // request id of the announce in flight, 0 is none
+        unsigned long request_id_;
+        bool started_;
 
+        // bitdata_ is null for a magnet link task
         std::tr1::shared_ptr<BitData> bitdata_;
+        Sha1Value info_hash_;
+        std::string peer_id_;
+        PeerCallback peer_callback_;
+        AnnounceCallback announce_callback_;
         std::string url_;
-        std::string host_;
     };
 
 } // namespace core
@@ -0,0 +1,202 @@
+#include "BitTrackerTiers.h"
+#include <assert.h>
+#include <algorithm>
+#include <set>
+
+namespace bitwave {
+namespace core {
+
+    BitTrackerTiers::BitTrackerTiers(const Tiers& tiers)
+        : all_tiers_(false)
+    {
+        std::set<std::string> urls;
+        for (std::size_t i = 0; i < tiers.size(); ++i)
+        {
+            Tier tier;
+            for (std::size_t j = 0; j < tiers[i].size(); ++j)
+            {
+                if (!urls.insert(tiers[i][j]).second)
+                    continue;
+
+                tier.push_back(Tracker());
+                tier.back().url = tiers[i][j];
+            }
+
+            if (!tier.empty())
+            {
+                std::random_shuffle(tier.begin(), tier.end());
+                tiers_.push_back(tier);
+            }
+        }
+
+        CreateGroups();
+    }
+
+    void BitTrackerTiers::SetAnnounceToAllTiers(bool all_tiers)
+    {
+        if (all_tiers_ == all_tiers)
+            return ;
+
+        all_tiers_ = all_tiers;
+        CreateGroups();
+    }
+
+    void BitTrackerTiers::GetAnnounces(NormalTimeType now,
+                                       std::vector<std::string> *urls)
+    {
+        assert(urls);
+        std::size_t announcing = 0;
+        for (std::size_t i = 0; i < groups_.size(); ++i)
+        {
+            if (IsAnnouncing(groups_[i]))
+                ++announcing;
+        }
+
+        for (std::size_t i = 0; i < groups_.size() && announcing < max_parallel; ++i)
+        {
+            Group& group = groups_[i];
+            if (!group.IsReady(now) || IsAnnouncing(group))
+                continue;
+
+            NormalTimeType wait = 0;
+            Tracker *tracker = NextTracker(group, now, &wait);
+            if (!tracker)
+            {
+                group.Wait(now, wait);
+                continue;
+            }
+
+            tracker->announcing = true;
+            urls->push_back(tracker->url);
+            ++announcing;
+        }
+    }
+
+    void BitTrackerTiers::OnAnnounced(const std::string& url, bool success,
+                                      int interval, NormalTimeType now)
+    {
+        for (std::size_t i = 0; i < tiers_.size(); ++i)
+        {
+            Tier& tier = tiers_[i];
+            for (std::size_t j = 0; j < tier.size(); ++j)
+            {
+                if (tier[j].url != url || !tier[j].announcing)
+                    continue;
+
+                Tracker& tracker = tier[j];
+                tracker.announcing = false;
+
+                Group *group = FindGroup(i);
+                assert(group);
+                if (success)
+                {
+                    tracker.fail_count = 0;
+                    tracker.backoff = 0;
+                    if (interval < min_interval)
+                        interval = min_interval;
+                    group->Wait(now, static_cast<NormalTimeType>(interval) * 1000);
+                    // promote the tracker to the front of its tier
+                    std::rotate(tier.begin(), tier.begin() + j, tier.begin() + j + 1);
+                }
+                else
+                {
+                    ++tracker.fail_count;
+                    tracker.fail_time = now;
+                    tracker.backoff = GetBackoff(tracker.fail_count);
+                    // fail over to the next tracker at once
+                    group->Wait(now, 0);
+                }
+                return ;
+            }
+        }
+    }
+
+    void BitTrackerTiers::AnnounceNow()
+    {
+        for (std::size_t i = 0; i < groups_.size(); ++i)
+            groups_[i].wait = 0;
+    }
+
+    void BitTrackerTiers::GetTiers(Tiers *tiers) const
+    {
+        assert(tiers);
+        tiers->clear();
+        for (std::size_t i = 0; i < tiers_.size(); ++i)
+        {
+            tiers->push_back(std::vector<std::string>());
+            for (std::size_t j = 0; j < tiers_[i].size(); ++j)
+                tiers->back().push_back(tiers_[i][j].url);
+        }
+    }
+
+    void BitTrackerTiers::CreateGroups()
+    {
+        groups_.clear();
+        if (tiers_.empty())
+            return ;
+
+        if (all_tiers_)
+        {
+            for (std::size_t i = 0; i < tiers_.size(); ++i)
+                groups_.push_back(Group(i, i + 1));
+        }
+        else
+        {
+            groups_.push_back(Group(0, tiers_.size()));
+        }
+    }
+
+    bool BitTrackerTiers::IsAnnouncing(const Group& group) const
+    {
+        for (std::size_t i = group.first_tier; i < group.last_tier; ++i)
+        {
+            for (std::size_t j = 0; j < tiers_[i].size(); ++j)
+            {
+                if (tiers_[i][j].announcing)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    BitTrackerTiers::Tracker * BitTrackerTiers::NextTracker(const Group& group,
+                                                            NormalTimeType now,
+                                                            NormalTimeType *wait)
+    {
+        for (std::size_t i = group.first_tier; i < group.last_tier; ++i)
+        {
+            for (std::size_t j = 0; j < tiers_[i].size(); ++j)
+            {
+                Tracker& tracker = tiers_[i][j];
+                if (tracker.IsReady(now))
+                    return &tracker;
+
+                NormalTimeType left = tracker.backoff - (now - tracker.fail_time);
+                if (*wait == 0 || left < *wait)
+                    *wait = left;
+            }
+        }
+        return 0;
+    }
+
+    BitTrackerTiers::Group * BitTrackerTiers::FindGroup(std::size_t tier)
+    {
+        for (std::size_t i = 0; i < groups_.size(); ++i)
+        {
+            if (groups_[i].first_tier <= tier && tier < groups_[i].last_tier)
+                return &groups_[i];
+        }
+        return 0;
+    }
+
+    NormalTimeType BitTrackerTiers::GetBackoff(int fail_count) const
+    {
+        assert(fail_count > 0);
+        NormalTimeType backoff = retry_backoff;
+        for (int i = 1; i < fail_count && backoff < max_backoff; ++i)
+            backoff *= 2;
+        return backoff < max_backoff ? backoff : max_backoff;
+    }
+
+} // namespace core
+} // namespace bitwave
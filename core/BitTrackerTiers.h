@@ -0,0 +1,123 @@
+#ifndef BIT_TRACKER_TIERS_H
+#define BIT_TRACKER_TIERS_H
+
+#include "../base/BaseTypes.h"
+#include "../timer/TimeTraits.h"
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // announce order of trackers in tiers of announce-list (BEP 12).
+    // Trackers are shuffled in a tier, the first tracker of the first tier
+    // is announced, it fails over to the next one at once, and a tracker
+    // answers is moved to the front of its tier. A failed tracker is not
+    // tried again in backoff of retry_backoff * 2 ^ (fail count - 1), at
+    // most max_backoff.
+    // Tiers are announced one by one in normal mode. When announcing to
+    // all tiers, every tier announces its own tracker at the same time,
+    // at most max_parallel tiers are announcing
+    class BitTrackerTiers : private NotCopyable
+    {
+    public:
+        typedef std::vector<std::vector<std::string> > Tiers;
+
+        static const NormalTimeType retry_backoff = 15 * 1000;
+        static const NormalTimeType max_backoff = 30 * 60 * 1000;
+        static const std::size_t max_parallel = 4;
+        // a tracker answers is announced again after its interval, not
+        // less than this seconds
+        static const int min_interval = 60;
+
+        // urls appear more than once are used once
+        explicit BitTrackerTiers(const Tiers& tiers);
+
+        void SetAnnounceToAllTiers(bool all_tiers);
+        bool IsAnnounceToAllTiers() const
+            { return all_tiers_; }
+
+        // trackers should be announced now, they are announcing until
+        // OnAnnounced is called
+        void GetAnnounces(NormalTimeType now, std::vector<std::string> *urls);
+
+        // result of an announce, interval is the announce interval of
+        // the tracker in seconds
+        void OnAnnounced(const std::string& url, bool success,
+                         int interval, NormalTimeType now);
+
+        // announce again at once, trackers in backoff are not tried
+        void AnnounceNow();
+
+        // current order of trackers, for test
+        void GetTiers(Tiers *tiers) const;
+
+    private:
+        struct Tracker
+        {
+            Tracker()
+                : fail_count(0),
+                  fail_time(0),
+                  backoff(0),
+                  announcing(false)
+            {
+            }
+
+            bool IsReady(NormalTimeType now) const
+                { return now - fail_time >= backoff; }
+
+            std::string url;
+            int fail_count;
+            NormalTimeType fail_time;
+            // 0 when the tracker does not fail
+            NormalTimeType backoff;
+            bool announcing;
+        };
+
+        // tiers [first_tier, last_tier) announce one tracker at a time
+        struct Group
+        {
+            Group(std::size_t first, std::size_t last)
+                : first_tier(first),
+                  last_tier(last),
+                  wait_begin(0),
+                  wait(0)
+            {
+            }
+
+            bool IsReady(NormalTimeType now) const
+                { return now - wait_begin >= wait; }
+
+            void Wait(NormalTimeType now, NormalTimeType milliseconds)
+            {
+                wait_begin = now;
+                wait = milliseconds;
+            }
+
+            std::size_t first_tier;
+            std::size_t last_tier;
+            // next announce of the group is after wait from wait_begin
+            NormalTimeType wait_begin;
+            NormalTimeType wait;
+        };
+
+        typedef std::vector<Tracker> Tier;
+
+        void CreateGroups();
+        bool IsAnnouncing(const Group& group) const;
+        // return 0 when all trackers of the group are in backoff, and
+        // wait is the shortest time to the end of backoff
+        Tracker * NextTracker(const Group& group, NormalTimeType now,
+                              NormalTimeType *wait);
+        Group * FindGroup(std::size_t tier);
+        NormalTimeType GetBackoff(int fail_count) const;
+
+        std::vector<Tier> tiers_;
+        std::vector<Group> groups_;
+        bool all_tiers_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_TRACKER_TIERS_H
@@ -0,0 +1,140 @@
+#include "BitUdpSocket.h"
+#include "../net/NetHelper.h"
+#include "../net/TimerService.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <Windows.h>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        const int receive_retry_interval = 1000;
+
+    } // unnamed namespace
+
+    BitUdpSocket::BitUdpSocket(net::IoService& io_service, unsigned short port)
+        : io_service_(io_service),
+          socket_(net::Address(), net::Port(port), io_service)
+    {
+        receive_timer_.SetCallback(
+                std::tr1::bind(&BitUdpSocket::OnReceiveTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&receive_timer_);
+        receive_timer_.SetDeadline(receive_retry_interval);
+
+        Receive();
+    }
+
+    BitUdpSocket::~BitUdpSocket()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&receive_timer_);
+    }
+
+    unsigned short BitUdpSocket::GetLocalPort() const
+    {
+        return net::GetLocalPort(socket_.GetImplement());
+    }
+
+    void BitUdpSocket::AddReceiver(Receiver *receiver)
+    {
+        assert(receiver);
+        if (std::find(receivers_.begin(), receivers_.end(), receiver) == receivers_.end())
+            receivers_.push_back(receiver);
+    }
+
+    void BitUdpSocket::RemoveReceiver(Receiver *receiver)
+    {
+        receivers_.erase(std::remove(receivers_.begin(), receivers_.end(), receiver),
+                receivers_.end());
+    }
+
+    void BitUdpSocket::SendTo(const char *data, std::size_t len,
+                              unsigned long ip, unsigned short port)
+    {
+        Buffer buffer = buffer_cache_.GetBuffer(len);
+        memcpy(buffer.GetBuffer(), data, len);
+
+        try
+        {
+            socket_.AsyncSendTo(buffer, net::Address(ip), net::Port(port),
+                    std::tr1::bind(&BitUdpSocket::SendHandler, this, buffer,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        }
+        catch (const net::NetException&)
+        {
+            // a lost datagram is the same as a failed send
+            buffer_cache_.FreeBuffer(buffer);
+        }
+    }
+
+    void BitUdpSocket::Receive()
+    {
+        if (!receive_buffer_)
+            receive_buffer_ = buffer_cache_.GetBuffer(receive_buffer_size);
+
+        try
+        {
+            socket_.AsyncReceiveFrom(receive_buffer_,
+                    std::tr1::bind(&BitUdpSocket::ReceiveHandler, this,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2,
+                        std::tr1::placeholders::_3, std::tr1::placeholders::_4));
+        }
+        catch (const net::NetException& ne)
+        {
+            char message[64];
+            sprintf(message, "udp socket receive error %d, retry later\n",
+                    ne.get_exception_code());
+            ::OutputDebugStringA(message);
+
+            buffer_cache_.FreeBuffer(receive_buffer_);
+            receive_buffer_.Reset();
+        }
+    }
+
+    void BitUdpSocket::OnReceiveTimer()
+    {
+        if (!receive_buffer_)
+            Receive();
+        receive_timer_.SetDeadline(receive_retry_interval);
+    }
+
+    void BitUdpSocket::ReceiveHandler(bool success, int received,
+                                      net::Address address, net::Port port)
+    {
+        Buffer temp = receive_buffer_;
+        receive_buffer_.Reset();
+        Receive();
+
+        // a failed receive of udp socket is the error of one datagram,
+        // the socket is still good
+        if (success && received > 0)
+        {
+            unsigned long ip = net::NetToHostl(static_cast<unsigned long>(address));
+            unsigned short hsport = net::NetToHosts(static_cast<unsigned short>(port));
+
+            for (std::size_t i = 0; i < receivers_.size(); ++i)
+            {
+                if (receivers_[i]->OnDatagram(temp.GetBuffer(), received, ip, hsport))
+                    break;
+            }
+        }
+
+        buffer_cache_.FreeBuffer(temp);
+    }
+
+    void BitUdpSocket::SendHandler(Buffer& buffer, bool success, int send)
+    {
+        buffer_cache_.FreeBuffer(buffer);
+    }
+
+} // namespace core
+} // namespace bitwave
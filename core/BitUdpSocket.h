@@ -0,0 +1,66 @@
+#ifndef BIT_UDP_SOCKET_H
+#define BIT_UDP_SOCKET_H
+
+#include "../base/BaseTypes.h"
+#include "../buffer/Buffer.h"
+#include "../net/IoService.h"
+#include "../timer/Timer.h"
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // a udp socket shared by dht and udp trackers. Received datagrams are
+    // passed to receivers in turn until one of them accepts
+    class BitUdpSocket : private NotCopyable
+    {
+    public:
+        class Receiver
+        {
+        public:
+            // return true when the datagram is accepted, ip and port
+            // are in host byte order
+            virtual bool OnDatagram(const char *data, std::size_t len,
+                                    unsigned long ip, unsigned short port) = 0;
+
+        protected:
+            ~Receiver() { }
+        };
+
+        static const std::size_t receive_buffer_size = 2048;
+
+        // bind to the port, throw net::NetException when it fails
+        BitUdpSocket(net::IoService& io_service, unsigned short port);
+
+        ~BitUdpSocket();
+
+        unsigned short GetLocalPort() const;
+
+        void AddReceiver(Receiver *receiver);
+        void RemoveReceiver(Receiver *receiver);
+
+        // ip and port are in host byte order
+        void SendTo(const char *data, std::size_t len,
+                    unsigned long ip, unsigned short port);
+
+    private:
+        void Receive();
+        void OnReceiveTimer();
+        void ReceiveHandler(bool success, int received,
+                            net::Address address, net::Port port);
+        void SendHandler(Buffer& buffer, bool success, int send);
+
+        net::IoService& io_service_;
+        DefaultBufferCache buffer_cache_;
+        // no receive_buffer_ is no pending receive, the receive is
+        // started again by the timer
+        Buffer receive_buffer_;
+        Timer receive_timer_;
+        net::AsyncUdpSocket socket_;
+        std::vector<Receiver *> receivers_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_UDP_SOCKET_H
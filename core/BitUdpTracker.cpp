@@ -0,0 +1,441 @@
+#include "BitUdpTracker.h"
+#include "../base/Random.h"
+#include "../net/TimerService.h"
+#include "../sha1/NetSha1Value.h"
+#include <assert.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    namespace {
+
+        const unsigned long long protocol_id = 0x41727101980ULL;
+        const std::size_t connect_request_size = 16;
+        const std::size_t announce_request_size = 98;
+        const std::size_t compact_peer_size = 6;
+
+        void AppendInt16(std::string& buf, unsigned short value)
+        {
+            buf.push_back(static_cast<char>(value >> 8));
+            buf.push_back(static_cast<char>(value));
+        }
+
+        void AppendInt32(std::string& buf, unsigned long value)
+        {
+            buf.push_back(static_cast<char>(value >> 24));
+            buf.push_back(static_cast<char>(value >> 16));
+            buf.push_back(static_cast<char>(value >> 8));
+            buf.push_back(static_cast<char>(value));
+        }
+
+        void AppendInt64(std::string& buf, unsigned long long value)
+        {
+            AppendInt32(buf, static_cast<unsigned long>(value >> 32));
+            AppendInt32(buf, static_cast<unsigned long>(value));
+        }
+
+        unsigned long ReadInt32(const char *data)
+        {
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+            return (static_cast<unsigned long>(p[0]) << 24) |
+                (static_cast<unsigned long>(p[1]) << 16) |
+                (static_cast<unsigned long>(p[2]) << 8) | p[3];
+        }
+
+        unsigned long long ReadInt64(const char *data)
+        {
+            return (static_cast<unsigned long long>(ReadInt32(data)) << 32) |
+                ReadInt32(data + 4);
+        }
+
+        NormalTimeType Now()
+        {
+            return time_traits<NormalTimeType>::now();
+        }
+
+    } // unnamed namespace
+
+    std::string EncodeUdpConnectRequest(unsigned long transaction)
+    {
+        std::string buf;
+        buf.reserve(connect_request_size);
+        AppendInt64(buf, protocol_id);
+        AppendInt32(buf, UdpTrackerResponse::CONNECT);
+        AppendInt32(buf, transaction);
+        return buf;
+    }
+
+    std::string EncodeUdpAnnounceRequest(unsigned long long connection_id,
+                                         unsigned long transaction,
+                                         const UdpAnnounceRequest& request)
+    {
+        assert(request.peer_id.size() == 20);
+        Sha1Value net_sha1 = NetByteOrder(request.info_hash);
+
+        std::string buf;
+        buf.reserve(announce_request_size);
+        AppendInt64(buf, connection_id);
+        AppendInt32(buf, UdpTrackerResponse::ANNOUNCE);
+        AppendInt32(buf, transaction);
+        buf.append(net_sha1.GetData(), net_sha1.GetDataSize());
+        buf.append(request.peer_id.data(), 20);
+        AppendInt64(buf, request.downloaded);
+        AppendInt64(buf, request.left);
+        AppendInt64(buf, request.uploaded);
+        AppendInt32(buf, request.event);
+        // ip address 0 is the source address of the datagram
+        AppendInt32(buf, 0);
+        AppendInt32(buf, request.key);
+        AppendInt32(buf, static_cast<unsigned long>(request.num_want));
+        AppendInt16(buf, request.port);
+        return buf;
+    }
+
+    bool ParseUdpTrackerResponse(const char *data, std::size_t len,
+                                 UdpTrackerResponse *response)
+    {
+        assert(response);
+        if (len < 8)
+            return false;
+
+        response->action = static_cast<int>(ReadInt32(data));
+        response->transaction = ReadInt32(data + 4);
+
+        switch (response->action)
+        {
+        case UdpTrackerResponse::CONNECT:
+            if (len < 16)
+                return false;
+            response->connection_id = ReadInt64(data + 8);
+            return true;
+
+        case UdpTrackerResponse::ANNOUNCE:
+            {
+                if (len < 20)
+                    return false;
+                response->interval = static_cast<int>(ReadInt32(data + 8));
+                response->leechers = static_cast<int>(ReadInt32(data + 12));
+                response->seeders = static_cast<int>(ReadInt32(data + 16));
+
+                response->peers.clear();
+                std::size_t count = (len - 20) / compact_peer_size;
+                response->peers.reserve(count);
+                const unsigned char *peer =
+                    reinterpret_cast<const unsigned char *>(data + 20);
+                for (std::size_t i = 0; i < count; ++i, peer += compact_peer_size)
+                {
+                    unsigned long ip = ReadInt32(reinterpret_cast<const char *>(peer));
+                    unsigned short port = static_cast<unsigned short>(
+                            (peer[4] << 8) | peer[5]);
+                    if (ip != 0 && port != 0)
+                        response->peers.push_back(UdpEndpoint(ip, port));
+                }
+            }
+            return true;
+
+        case UdpTrackerResponse::ERROR_ACTION:
+            response->error.assign(data + 8, len - 8);
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    BitUdpTracker::BitUdpTracker(net::IoService& io_service,
+                                 BitUdpSocket *udp_socket,
+                                 NormalTimeType retransmit_timeout)
+        : io_service_(io_service),
+          udp_socket_(udp_socket),
+          retransmit_timeout_(retransmit_timeout),
+          next_request_id_(1)
+    {
+        assert(udp_socket_);
+        udp_socket_->AddReceiver(this);
+
+        process_timer_.SetCallback(std::tr1::bind(&BitUdpTracker::OnTimer, this));
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->AddTimer(&process_timer_);
+        process_timer_.SetDeadline(process_interval);
+    }
+
+    BitUdpTracker::~BitUdpTracker()
+    {
+        udp_socket_->RemoveReceiver(this);
+
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&process_timer_);
+    }
+
+    unsigned long BitUdpTracker::Announce(const UdpEndpoint& tracker,
+                                          const UdpAnnounceRequest& request,
+                                          const AnnounceCallback& callback)
+    {
+        unsigned long request_id = next_request_id_++;
+        if (next_request_id_ == 0)
+            next_request_id_ = 1;
+
+        AnnounceState& state = requests_[request_id];
+        state.tracker = tracker;
+        state.request = request;
+        state.callback = callback;
+        state.transaction = 0;
+        state.attempt = 0;
+        state.send_time = 0;
+
+        TrackerState& tracker_state = trackers_[tracker];
+        if (tracker_state.connected &&
+            Now() - tracker_state.connect_time < connection_id_timeout)
+            SendAnnounce(request_id, state, tracker_state);
+        else if (!tracker_state.connecting)
+            Connect(tracker, tracker_state);
+
+        return request_id;
+    }
+
+    void BitUdpTracker::Cancel(unsigned long request_id)
+    {
+        Requests::iterator it = requests_.find(request_id);
+        if (it == requests_.end())
+            return ;
+
+        if (it->second.transaction != 0)
+            transactions_.erase(it->second.transaction);
+        requests_.erase(it);
+    }
+
+    bool BitUdpTracker::OnDatagram(const char *data, std::size_t len,
+                                   unsigned long ip, unsigned short port)
+    {
+        UdpTrackerResponse response;
+        if (!ParseUdpTrackerResponse(data, len, &response))
+            return false;
+
+        Transactions::iterator it = transactions_.find(response.transaction);
+        if (it == transactions_.end() ||
+            it->second.tracker != UdpEndpoint(ip, port))
+            return false;
+
+        Transaction transaction = it->second;
+        transactions_.erase(it);
+
+        if (transaction.is_connect)
+            OnConnectResponse(transaction, response);
+        else
+            OnAnnounceResponse(transaction, response);
+        return true;
+    }
+
+    void BitUdpTracker::OnTimer()
+    {
+        process_timer_.SetDeadline(process_interval);
+        NormalTimeType now = Now();
+
+        for (Trackers::iterator it = trackers_.begin(); it != trackers_.end(); ++it)
+        {
+            TrackerState& tracker = it->second;
+            if (!tracker.connecting ||
+                now - tracker.send_time < GetRetransmitTimeout(tracker.attempt))
+                continue;
+
+            transactions_.erase(tracker.transaction);
+            if (tracker.attempt >= max_retransmit)
+            {
+                tracker.connecting = false;
+                FailWaitingAnnounces(it->first);
+                continue;
+            }
+
+            int attempt = tracker.attempt + 1;
+            Connect(it->first, tracker);
+            tracker.attempt = attempt;
+        }
+
+        // callbacks may change requests, collect the timed out first
+        std::vector<unsigned long> timeouts;
+        for (Requests::iterator it = requests_.begin(); it != requests_.end(); ++it)
+        {
+            const AnnounceState& state = it->second;
+            if (state.transaction != 0 &&
+                now - state.send_time >= GetRetransmitTimeout(state.attempt))
+                timeouts.push_back(it->first);
+        }
+
+        for (std::size_t i = 0; i < timeouts.size(); ++i)
+        {
+            Requests::iterator it = requests_.find(timeouts[i]);
+            if (it == requests_.end())
+                continue;
+
+            AnnounceState& state = it->second;
+            if (state.attempt >= max_retransmit)
+            {
+                FailRequest(it->first, UdpTrackerResponse());
+                continue;
+            }
+
+            ++state.attempt;
+            TrackerState& tracker = trackers_[state.tracker];
+            if (tracker.connected && now - tracker.connect_time < connection_id_timeout)
+            {
+                SendAnnounce(it->first, state, tracker);
+                continue;
+            }
+
+            // the connection id is expired, wait for a new one
+            transactions_.erase(state.transaction);
+            state.transaction = 0;
+            if (!tracker.connecting)
+                Connect(state.tracker, tracker);
+        }
+    }
+
+    void BitUdpTracker::Connect(const UdpEndpoint& endpoint, TrackerState& tracker)
+    {
+        tracker.connected = false;
+        tracker.connecting = true;
+        tracker.attempt = 0;
+        tracker.send_time = Now();
+        tracker.transaction = NewTransaction(true, endpoint, 0);
+
+        std::string packet = EncodeUdpConnectRequest(tracker.transaction);
+        udp_socket_->SendTo(packet.data(), packet.size(),
+                endpoint.first, endpoint.second);
+    }
+
+    void BitUdpTracker::SendAnnounce(unsigned long request_id,
+                                     AnnounceState& state,
+                                     const TrackerState& tracker)
+    {
+        if (state.transaction != 0)
+            transactions_.erase(state.transaction);
+
+        state.transaction = NewTransaction(false, state.tracker, request_id);
+        state.send_time = Now();
+
+        std::string packet = EncodeUdpAnnounceRequest(tracker.connection_id,
+                state.transaction, state.request);
+        udp_socket_->SendTo(packet.data(), packet.size(),
+                state.tracker.first, state.tracker.second);
+    }
+
+    void BitUdpTracker::SendWaitingAnnounces(const UdpEndpoint& endpoint,
+                                             const TrackerState& tracker)
+    {
+        for (Requests::iterator it = requests_.begin(); it != requests_.end(); ++it)
+        {
+            AnnounceState& state = it->second;
+            if (state.transaction == 0 && state.tracker == endpoint)
+            {
+                state.attempt = 0;
+                SendAnnounce(it->first, state, tracker);
+            }
+        }
+    }
+
+    void BitUdpTracker::FailRequest(unsigned long request_id,
+                                    const UdpTrackerResponse& response)
+    {
+        Requests::iterator it = requests_.find(request_id);
+        if (it == requests_.end())
+            return ;
+
+        if (it->second.transaction != 0)
+            transactions_.erase(it->second.transaction);
+
+        AnnounceCallback callback = it->second.callback;
+        requests_.erase(it);
+        if (callback)
+            callback(false, response);
+    }
+
+    void BitUdpTracker::FailWaitingAnnounces(const UdpEndpoint& endpoint)
+    {
+        std::vector<unsigned long> waiting;
+        for (Requests::iterator it = requests_.begin(); it != requests_.end(); ++it)
+        {
+            if (it->second.transaction == 0 && it->second.tracker == endpoint)
+                waiting.push_back(it->first);
+        }
+
+        for (std::size_t i = 0; i < waiting.size(); ++i)
+            FailRequest(waiting[i], UdpTrackerResponse());
+    }
+
+    void BitUdpTracker::OnConnectResponse(const Transaction& transaction,
+                                          const UdpTrackerResponse& response)
+    {
+        Trackers::iterator it = trackers_.find(transaction.tracker);
+        if (it == trackers_.end() || !it->second.connecting ||
+            it->second.transaction != response.transaction)
+            return ;
+
+        TrackerState& tracker = it->second;
+        tracker.connecting = false;
+
+        if (response.action != UdpTrackerResponse::CONNECT)
+        {
+            FailWaitingAnnounces(transaction.tracker);
+            return ;
+        }
+
+        tracker.connected = true;
+        tracker.connection_id = response.connection_id;
+        tracker.connect_time = Now();
+        SendWaitingAnnounces(transaction.tracker, tracker);
+    }
+
+    void BitUdpTracker::OnAnnounceResponse(const Transaction& transaction,
+                                           const UdpTrackerResponse& response)
+    {
+        Requests::iterator it = requests_.find(transaction.request_id);
+        if (it == requests_.end())
+            return ;
+
+        // the transaction is erased
+        it->second.transaction = 0;
+
+        if (response.action != UdpTrackerResponse::ANNOUNCE)
+        {
+            // an error may be an invalid connection id, connect again
+            // next time
+            trackers_[transaction.tracker].connected = false;
+            FailRequest(it->first, response);
+            return ;
+        }
+
+        AnnounceCallback callback = it->second.callback;
+        requests_.erase(it);
+        if (callback)
+            callback(true, response);
+    }
+
+    NormalTimeType BitUdpTracker::GetRetransmitTimeout(int attempt) const
+    {
+        return retransmit_timeout_ << attempt;
+    }
+
+    unsigned long BitUdpTracker::NewTransaction(bool is_connect,
+                                                const UdpEndpoint& tracker,
+                                                unsigned long request_id)
+    {
+        unsigned long id = 0;
+        do
+        {
+            // transaction id 0 means no transaction
+            id = RandomValue<unsigned long>() & 0xFFFFFFFF;
+        } while (id == 0 || transactions_.find(id) != transactions_.end());
+
+        Transaction& transaction = transactions_[id];
+        transaction.is_connect = is_connect;
+        transaction.tracker = tracker;
+        transaction.request_id = request_id;
+        return id;
+    }
+
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,202 @@
+#ifndef BIT_UDP_TRACKER_H
+#define BIT_UDP_TRACKER_H
+
+#include "BitUdpSocket.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../sha1/Sha1Value.h"
+#include "../timer/Timer.h"
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    // ip and port in host byte order
+    typedef std::pair<unsigned long, unsigned short> UdpEndpoint;
+
+    struct UdpAnnounceRequest
+    {
+        enum Event
+        {
+            NONE,
+            COMPLETED,
+            STARTED,
+            STOPPED
+        };
+
+        UdpAnnounceRequest()
+            : downloaded(0),
+              left(0),
+              uploaded(0),
+              event(NONE),
+              key(0),
+              num_want(-1),
+              port(0)
+        {
+        }
+
+        Sha1Value info_hash;
+        std::string peer_id;
+        long long downloaded;
+        long long left;
+        long long uploaded;
+        int event;
+        unsigned long key;
+        int num_want;
+        unsigned short port;
+    };
+
+    // a response of udp tracker (BEP 15)
+    struct UdpTrackerResponse
+    {
+        enum Action
+        {
+            CONNECT,
+            ANNOUNCE,
+            SCRAPE,
+            ERROR_ACTION
+        };
+
+        UdpTrackerResponse()
+            : action(CONNECT),
+              transaction(0),
+              connection_id(0),
+              interval(0),
+              leechers(0),
+              seeders(0)
+        {
+        }
+
+        int action;
+        unsigned long transaction;
+        unsigned long long connection_id;
+        int interval;
+        int leechers;
+        int seeders;
+        std::vector<UdpEndpoint> peers;
+        std::string error;
+    };
+
+    std::string EncodeUdpConnectRequest(unsigned long transaction);
+    std::string EncodeUdpAnnounceRequest(unsigned long long connection_id,
+                                         unsigned long transaction,
+                                         const UdpAnnounceRequest& request);
+    bool ParseUdpTrackerResponse(const char *data, std::size_t len,
+                                 UdpTrackerResponse *response);
+
+    // udp tracker client of all tasks on the shared udp socket. A
+    // connection id of a tracker is cached for a minute and used by all
+    // announces to the tracker, announces wait for one connect request
+    // when there is no connection id. A request is sent again after
+    // retransmit_timeout * 2 ^ n, it fails after max_retransmit times
+    class BitUdpTracker : public BitUdpSocket::Receiver, private NotCopyable
+    {
+    public:
+        // response is valid when success is true, the error message is in
+        // response when the tracker returns an error
+        typedef std::tr1::function<void (bool, const UdpTrackerResponse&)> AnnounceCallback;
+
+        static const NormalTimeType connection_id_timeout = 60 * 1000;
+        static const int max_retransmit = 8;
+        static const int process_interval = 1000;
+
+        BitUdpTracker(net::IoService& io_service, BitUdpSocket *udp_socket,
+                      NormalTimeType retransmit_timeout = 15 * 1000);
+
+        ~BitUdpTracker();
+
+        // announce to tracker, return an id of the request to cancel it
+        unsigned long Announce(const UdpEndpoint& tracker,
+                               const UdpAnnounceRequest& request,
+                               const AnnounceCallback& callback);
+
+        // the callback of the request will not be called
+        void Cancel(unsigned long request_id);
+
+        std::size_t GetPendingCount() const
+            { return requests_.size(); }
+
+        virtual bool OnDatagram(const char *data, std::size_t len,
+                                unsigned long ip, unsigned short port);
+
+    private:
+        struct TrackerState
+        {
+            TrackerState()
+                : connection_id(0),
+                  connect_time(0),
+                  connected(false),
+                  connecting(false),
+                  transaction(0),
+                  attempt(0),
+                  send_time(0)
+            {
+            }
+
+            unsigned long long connection_id;
+            NormalTimeType connect_time;
+            bool connected;
+            // a connect request is in flight
+            bool connecting;
+            unsigned long transaction;
+            int attempt;
+            NormalTimeType send_time;
+        };
+
+        struct AnnounceState
+        {
+            UdpEndpoint tracker;
+            UdpAnnounceRequest request;
+            AnnounceCallback callback;
+            // 0 when it waits for connection id
+            unsigned long transaction;
+            int attempt;
+            NormalTimeType send_time;
+        };
+
+        struct Transaction
+        {
+            bool is_connect;
+            UdpEndpoint tracker;
+            unsigned long request_id;
+        };
+
+        typedef std::map<UdpEndpoint, TrackerState> Trackers;
+        typedef std::map<unsigned long, AnnounceState> Requests;
+        typedef std::map<unsigned long, Transaction> Transactions;
+
+        void OnTimer();
+        void Connect(const UdpEndpoint& endpoint, TrackerState& tracker);
+        void SendAnnounce(unsigned long request_id, AnnounceState& state,
+                          const TrackerState& tracker);
+        void SendWaitingAnnounces(const UdpEndpoint& endpoint,
+                                  const TrackerState& tracker);
+        void FailRequest(unsigned long request_id,
+                         const UdpTrackerResponse& response);
+        void FailWaitingAnnounces(const UdpEndpoint& endpoint);
+        void OnConnectResponse(const Transaction& transaction,
+                               const UdpTrackerResponse& response);
+        void OnAnnounceResponse(const Transaction& transaction,
+                                const UdpTrackerResponse& response);
+        NormalTimeType GetRetransmitTimeout(int attempt) const;
+        unsigned long NewTransaction(bool is_connect, const UdpEndpoint& tracker,
+                                     unsigned long request_id);
+
+        net::IoService& io_service_;
+        BitUdpSocket *udp_socket_;
+        NormalTimeType retransmit_timeout_;
+        Timer process_timer_;
+        Trackers trackers_;
+        Requests requests_;
+        Transactions transactions_;
+        unsigned long next_request_id_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_UDP_TRACKER_H
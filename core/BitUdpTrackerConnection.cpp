@@ -0,0 +1,319 @@
+#include "BitUdpTrackerConnection.h"
+#include "BitData.h"
+#include "BitService.h"
+#include "BitRepository.h"
+#include "../base/Random.h"
+#include "../net/NetHelper.h"
+#include "../net/TimerService.h"
+#include "../protocol/HttpException.h"
+#include "../protocol/URI.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+
+    using namespace std::tr1::placeholders;
+
+    namespace {
+
+        // the first announce fails is tried again after this seconds
+        const int retry_interval = 60;
+        // an interval of the tracker is not longer than one day, so
+        // milliseconds of it never overflow
+        const int max_announce_interval = 24 * 60 * 60;
+
+        // the same as BitTrackerConnection, first announces of tasks are
+        // spread in this milliseconds and intervals are delayed randomly
+        const int startup_jitter = 15 * 1000;
+
+        int IntervalJitter(int seconds)
+        {
+            unsigned long long range =
+                static_cast<unsigned long long>(seconds) * 100 + 1;
+            return static_cast<int>(RandomValue<unsigned long long>() % range);
+        }
+
+    } // unnamed namespace
+
+    BitUdpTrackerConnection::BitUdpTrackerConnection(
+            const std::string& url,
+            const std::tr1::shared_ptr<BitData>& bitdata,
+            net::IoService& io_service)
+        : io_service_(io_service),
+          announce_interval_(retry_interval),
+          endpoint_index_(0),
+          resolving_(false),
+          announce_pending_(false),
+          request_id_(0),
+          started_(false),
+          bitdata_(bitdata),
+          info_hash_(bitdata->GetInfoHash()),
+          peer_id_(bitdata->GetPeerId()),
+          url_(url)
+    {
+        Init();
+    }
+
+    BitUdpTrackerConnection::BitUdpTrackerConnection(
+            const std::string& url,
+            const std::tr1::shared_ptr<BitData>& bitdata,
+            net::IoService& io_service,
+            const AnnounceCallback& announce_callback)
+        : io_service_(io_service),
+          announce_interval_(retry_interval),
+          endpoint_index_(0),
+          resolving_(false),
+          announce_pending_(false),
+          request_id_(0),
+          started_(false),
+          bitdata_(bitdata),
+          info_hash_(bitdata->GetInfoHash()),
+          peer_id_(bitdata->GetPeerId()),
+          announce_callback_(announce_callback),
+          url_(url)
+    {
+        Init();
+    }
+
+    BitUdpTrackerConnection::BitUdpTrackerConnection(
+            const std::string& url,
+            const Sha1Value& info_hash,
+            const std::string& peer_id,
+            const PeerCallback& peer_callback,
+            net::IoService& io_service)
+        : io_service_(io_service),
+          announce_interval_(retry_interval),
+          endpoint_index_(0),
+          resolving_(false),
+          announce_pending_(false),
+          request_id_(0),
+          started_(false),
+          info_hash_(info_hash),
+          peer_id_(peer_id),
+          peer_callback_(peer_callback),
+          url_(url)
+    {
+        Init();
+    }
+
+    BitUdpTrackerConnection::~BitUdpTrackerConnection()
+    {
+        if (request_id_ != 0 && BitService::udp_tracker)
+            BitService::udp_tracker->Cancel(request_id_);
+        CloseAnnounceTimer();
+    }
+
+    // static
+    bool BitUdpTrackerConnection::IsUdpTracker(const std::string& url)
+    {
+        return url.compare(0, 6, "udp://") == 0;
+    }
+
+    void BitUdpTrackerConnection::Init()
+    {
+        // udp://host:port/announce, the port is necessary
+        http::URI uri(url_);
+        host_ = uri.GetHost();
+        port_ = uri.GetPort();
+        if (host_.empty() || atoi(port_.c_str()) <= 0 || atoi(port_.c_str()) > 0xFFFF)
+            throw http::URIException(http::NO_AUTHORITY);
+
+        announce_timer_.SetCallback(
+                std::tr1::bind(
+                    &BitUdpTrackerConnection::AnnounceTimerCallback,
+                    this));
+
+        // the host of a tracker in announce tiers is resolved when it
+        // announces first, a tracker may never be used
+        if (!announce_callback_)
+            Resolve();
+    }
+
+    void BitUdpTrackerConnection::UpdateTrackerInfo()
+    {
+        Announce();
+    }
+
+    void BitUdpTrackerConnection::Resolve()
+    {
+        if (resolving_)
+            return ;
+
+        resolving_ = true;
+        net::ServicePtr<net::ResolveService> address_resolver_ptr(io_service_);
+        assert(address_resolver_ptr);
+        net::ResolveHint hint(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+        address_resolver_ptr->AsyncResolve(host_, port_, hint,
+                std::tr1::bind(
+                    &BitUdpTrackerConnection::ResolveHandler,
+                    this, _1, _2, _3));
+    }
+
+    void BitUdpTrackerConnection::ResolveHandler(const std::string& nodename,
+                                                 const std::string& servname,
+                                                 const net::ResolveResult& result)
+    {
+        assert(nodename == host_);
+        resolving_ = false;
+        endpoints_.clear();
+        endpoint_index_ = 0;
+        for (net::ResolveResult::iterator it = result.begin();
+                it != result.end(); ++it)
+        {
+            if (!it->ai_addr)
+                continue;
+
+            const sockaddr_in *addr = reinterpret_cast<const sockaddr_in *>(it->ai_addr);
+            endpoints_.push_back(UdpEndpoint(net::NetToHostl(addr->sin_addr.s_addr),
+                        net::NetToHosts(addr->sin_port)));
+        }
+
+        bool pending = announce_pending_;
+        announce_pending_ = false;
+        if (endpoints_.empty())
+        {
+            // the owner fails over to another tracker, otherwise we
+            // resolve again later
+            if (!announce_callback_)
+                StartAnnounceTimer(retry_interval * 1000);
+            else if (pending)
+                announce_callback_(false, 0);
+            return ;
+        }
+
+        if (pending)
+        {
+            Announce();
+            return ;
+        }
+
+        if (announce_callback_)
+            return ;
+
+        // a magnet link task has no peers, it announces now
+        if (bitdata_)
+            StartAnnounceTimer(RandomValue<unsigned int>() % startup_jitter);
+        else
+            Announce();
+    }
+
+    void BitUdpTrackerConnection::Announce()
+    {
+        // the owner waits for the result of every announce
+        if (!BitService::udp_tracker)
+        {
+            if (announce_callback_)
+                announce_callback_(false, 0);
+            return ;
+        }
+
+        // an announce is in flight, the owner gets the result of a new
+        // one instead of it
+        if (request_id_ != 0)
+        {
+            if (!announce_callback_)
+                return ;
+            BitService::udp_tracker->Cancel(request_id_);
+            request_id_ = 0;
+        }
+
+        // the host is resolved again after all addresses failed
+        if (endpoints_.empty())
+        {
+            announce_pending_ = true;
+            Resolve();
+            return ;
+        }
+
+        UdpAnnounceRequest request;
+        request.info_hash = info_hash_;
+        request.peer_id = peer_id_;
+        request.port = BitService::repository->GetListenPort();
+        request.num_want = 200;
+        request.event = started_ ? UdpAnnounceRequest::NONE :
+            UdpAnnounceRequest::STARTED;
+
+        // size of a magnet link task is unknown, announce one byte left,
+        // so the tracker takes us as a leecher
+        request.left = 1;
+        if (bitdata_)
+        {
+            request.uploaded = bitdata_->GetUploaded();
+            request.downloaded = bitdata_->GetDownloaded();
+            request.left = bitdata_->GetTotalSize() - request.downloaded;
+        }
+
+        CloseAnnounceTimer();
+        request_id_ = BitService::udp_tracker->Announce(
+                endpoints_[endpoint_index_], request,
+                std::tr1::bind(&BitUdpTrackerConnection::AnnounceHandler,
+                    this, _1, _2));
+    }
+
+    void BitUdpTrackerConnection::AnnounceHandler(bool success,
+                                                  const UdpTrackerResponse& response)
+    {
+        request_id_ = 0;
+
+        if (success)
+        {
+            started_ = true;
+            for (std::size_t i = 0; i < response.peers.size(); ++i)
+            {
+                if (bitdata_)
+                    bitdata_->AddPeerListenInfo(response.peers[i].first,
+                            response.peers[i].second);
+                else
+                    peer_callback_(response.peers[i].first,
+                            response.peers[i].second);
+            }
+
+            if (response.interval > 0)
+                announce_interval_ = response.interval < max_announce_interval ?
+                    response.interval : max_announce_interval;
+        }
+        else if (!endpoints_.empty())
+        {
+            // try the next address of the host, resolve again when all
+            // addresses are tried
+            if (++endpoint_index_ >= endpoints_.size())
+                endpoints_.clear();
+        }
+
+        if (announce_callback_)
+        {
+            announce_callback_(success, response.interval);
+            return ;
+        }
+
+        StartAnnounceTimer(announce_interval_ * 1000 +
+                IntervalJitter(announce_interval_));
+    }
+
+    void BitUdpTrackerConnection::StartAnnounceTimer(int milliseconds)
+    {
+        assert(milliseconds >= 0);
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        announce_timer_.SetDeadline(milliseconds);
+        timer_service->AddTimer(&announce_timer_);
+    }
+
+    void BitUdpTrackerConnection::AnnounceTimerCallback()
+    {
+        CloseAnnounceTimer();
+        Announce();
+    }
+
+    void BitUdpTrackerConnection::CloseAnnounceTimer()
+    {
+        net::ServicePtr<net::TimerService> timer_service(io_service_);
+        assert(timer_service);
+        timer_service->DelTimer(&announce_timer_);
+    }
+
+} // namespace core
+} // namespace bitwave
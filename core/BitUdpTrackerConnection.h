@@ -0,0 +1,97 @@
+#ifndef BIT_UDP_TRACKER_CONNECTION_H
+#define BIT_UDP_TRACKER_CONNECTION_H
+
+#include "BitUdpTracker.h"
+#include "../base/BaseTypes.h"
+#include "../net/IoService.h"
+#include "../net/ResolveService.h"
+#include "../sha1/Sha1Value.h"
+#include "../timer/Timer.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+
+    // announce a task to a udp:// tracker by the shared BitUdpTracker, it
+    // is the same as BitTrackerConnection for http trackers
+    class BitUdpTrackerConnection : private NotCopyable
+    {
+    public:
+        // ip and port of a peer in host byte order
+        typedef std::tr1::function<void (unsigned long, unsigned short)> PeerCallback;
+        // success and the announce interval in seconds of an announce
+        typedef std::tr1::function<void (bool, int)> AnnounceCallback;
+
+        BitUdpTrackerConnection(const std::string& url,
+                                const std::tr1::shared_ptr<BitData>& bitdata,
+                                net::IoService& io_service);
+
+        // announce of a tracker in announce tiers, the same as
+        // BitTrackerConnection, the owner schedules announces
+        BitUdpTrackerConnection(const std::string& url,
+                                const std::tr1::shared_ptr<BitData>& bitdata,
+                                net::IoService& io_service,
+                                const AnnounceCallback& announce_callback);
+
+        // announce of a magnet link task which has no metainfo yet
+        BitUdpTrackerConnection(const std::string& url,
+                                const Sha1Value& info_hash,
+                                const std::string& peer_id,
+                                const PeerCallback& peer_callback,
+                                net::IoService& io_service);
+
+        ~BitUdpTrackerConnection();
+
+        // the url is an udp tracker
+        static bool IsUdpTracker(const std::string& url);
+
+        void UpdateTrackerInfo();
+
+    private:
+        typedef std::vector<UdpEndpoint> Endpoints;
+
+        void Init();
+        void Resolve();
+        void ResolveHandler(const std::string& nodename,
+                            const std::string& servname,
+                            const net::ResolveResult& result);
+        void Announce();
+        void AnnounceHandler(bool success, const UdpTrackerResponse& response);
+        void StartAnnounceTimer(int milliseconds);
+        void AnnounceTimerCallback();
+        void CloseAnnounceTimer();
+
+        net::IoService& io_service_;
+        Timer announce_timer_;
+        int announce_interval_;
+        // all resolved addresses of the tracker host, the announce uses
+        // the address of endpoint_index_, the next one after a failure
+        Endpoints endpoints_;
+        std::size_t endpoint_index_;
+        bool resolving_;
+        // UpdateTrackerInfo is called before the host is resolved
+        bool announce_pending_;
+        // request id of the announce in flight, 0 is none
+        unsigned long request_id_;
+        bool started_;
+
+        // bitdata_ is null for a magnet link task
+        std::tr1::shared_ptr<BitData> bitdata_;
+        Sha1Value info_hash_;
+        std::string peer_id_;
+        PeerCallback peer_callback_;
+        AnnounceCallback announce_callback_;
+        std::string url_;
+        std::string host_;
+        std::string port_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_UDP_TRACKER_CONNECTION_H
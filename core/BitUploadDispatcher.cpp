@@ -4,73 +4,177 @@
 
 #include "BitUploadDispatcher.h"
 #include "BitCache.h"
-#include "BitPeerConnection.h"
+#include "BitService.h"
+#include "BitTokenBucket.h"
+#include "BitUploadScheduler.h"
+#include <assert.h>
 #include <functional>
 
 using namespace std::tr1::placeholders;
 
-namespace {
-    const std::size_t quota_per_second = 2;
-} // unnamed namespace
-
 namespace bitwave {
 namespace core {
 
     BitUploadDispatcher::BitUploadDispatcher(
-            const std::tr1::shared_ptr<BitCache>& cache)
-        : upload_time_(TimeTraits::now()),
-          upload_blocks_quota_(quota_per_second),
-          cache_(cache)
+            const std::tr1::shared_ptr<BitCache>& cache,
+            const std::tr1::shared_ptr<BitTokenBucket>& limiter)
+        : cache_(cache),
+          limiter_(limiter),
+          priority_(PRIORITY_NORMAL),
+          scheduled_(false)
     {
     }
 
+    BitUploadDispatcher::~BitUploadDispatcher()
+    {
+        if (BitService::upload_scheduler)
+            BitService::upload_scheduler->Remove(this);
+    }
+
+    // static
+    bool BitUploadDispatcher::IsValidRequest(int begin, int length,
+                                             std::size_t piece_length)
+    {
+        return begin >= 0 && length > 0 && length <= max_request_length &&
+            static_cast<long long>(begin) + length <=
+            static_cast<long long>(piece_length);
+    }
+
     void BitUploadDispatcher::PendingUpload(const ConnectionWeakPtr& weak_conn,
                                             int index, int begin, int length)
     {
-        pending_list_.push_back(PendingData(weak_conn, index, begin, length));
+        // a block larger than the deficit of a turn is never served, and
+        // a block of no length breaks the deficit
+        if (!IsValidRequest(begin, length, cache_->GetPieceLength()))
+            return ;
+
+        std::tr1::shared_ptr<BitUploadPeer> conn = weak_conn.lock();
+        if (!conn)
+            return ;
+
+        PeerQueues::iterator it = peer_queues_.find(conn.get());
+        if (it == peer_queues_.end())
+        {
+            it = peer_queues_.insert(std::make_pair(conn.get(), PeerQueue())).first;
+            it->second.weak_conn = weak_conn;
+            active_peers_.push_back(it);
+        }
+        else if (it->second.weak_conn.expired())
+        {
+            // the queue of a gone peer which had the same address
+            it->second = PeerQueue();
+            it->second.weak_conn = weak_conn;
+        }
+
+        it->second.requests.push_back(PendingData(weak_conn, index, begin, length));
+
+        assert(BitService::upload_scheduler);
+        BitService::upload_scheduler->Activate(this);
     }
 
-    void BitUploadDispatcher::ProcessUpload()
+    void BitUploadDispatcher::Prefetch(int index, int begin, int length,
+                                       bool sequential)
     {
-        NormalTimeType now = TimeTraits::now();
-        if (now - upload_time_ >= 1000)
+        if (index < 0)
+            return ;
+
+        cache_->Prefetch(index);
+
+        // read ahead when the peer is in the second half of the piece,
+        // about 2MB ahead
+        std::size_t piece_length = cache_->GetPieceLength();
+        if (sequential && (begin + length) * 2 > static_cast<int>(piece_length))
         {
-            std::size_t count = upload_blocks_quota_;
-            upload_blocks_quota_ = quota_per_second;
-            ProcessPending(count);
-            upload_time_ = now;
+            const std::size_t read_ahead_bytes = 2 * 1024 * 1024;
+            std::size_t ahead = read_ahead_bytes / piece_length;
+            if (ahead == 0)
+                ahead = 1;
+
+            for (std::size_t i = 1; i <= ahead; ++i)
+                cache_->Prefetch(index + i);
         }
     }
 
-    void BitUploadDispatcher::ProcessPending(std::size_t count)
+    int BitUploadDispatcher::GetWeight() const
     {
-        while (!pending_list_.empty() && count > 0)
+        static const int weights[PRIORITY_COUNT] = { 1, 1, 2, 4 };
+        return weights[priority_];
+    }
+
+    std::size_t BitUploadDispatcher::ServeOne()
+    {
+        // the task has no tokens, no peer can upload
+        if (!limiter_->CanConsume())
+            return 0;
+
+        for (std::size_t count = active_peers_.size(); count > 0; --count)
         {
-            PendingData data = pending_list_.front();
-            pending_list_.pop_front();
+            PeerQueue& queue = active_peers_.front()->second;
+            std::tr1::shared_ptr<BitUploadPeer> conn = queue.weak_conn.lock();
+            if (!conn)
+            {
+                DeactivatePeer();
+                continue;
+            }
+
+            // a turn of the peer begins, add the quantum by its weight,
+            // and the peer can not upload does not save the quantum more
+            // than one turn
+            if (!queue.in_turn)
+            {
+                long long peer_quantum = quantum * conn->GetUploadWeight();
+                queue.deficit += peer_quantum;
+                if (queue.deficit > 2 * peer_quantum)
+                    queue.deficit = 2 * peer_quantum;
+                queue.in_turn = true;
+            }
 
-            if (!data.weak_conn.expired())
+            const PendingData& front = queue.requests.front();
+            if (queue.deficit < front.length ||
+                !conn->GetUploadLimiter().Consume(front.length))
             {
-                cache_->Read(data.index, data.begin, data.length,
-                        std::tr1::bind(&BitUploadDispatcher::CacheReadCallback,
-                            this, data, _1, _2));
-                --count;
+                NextTurn(queue);
+                continue;
             }
+
+            PendingData data = front;
+            queue.requests.pop_front();
+            queue.deficit -= data.length;
+            if (queue.requests.empty())
+                DeactivatePeer();
+
+            cache_->Read(data.index, data.begin, data.length,
+                    std::tr1::bind(&BitUploadDispatcher::CacheReadCallback,
+                        this, data, _1, _2));
+            return data.length;
         }
+
+        return 0;
+    }
+
+    void BitUploadDispatcher::NextTurn(PeerQueue& queue)
+    {
+        queue.in_turn = false;
+        active_peers_.splice(active_peers_.end(), active_peers_,
+                active_peers_.begin());
+    }
+
+    void BitUploadDispatcher::DeactivatePeer()
+    {
+        peer_queues_.erase(active_peers_.front());
+        active_peers_.pop_front();
     }
 
     void BitUploadDispatcher::CacheReadCallback(const PendingData& data,
                                                 bool read_ok,
                                                 const char *block)
     {
-        if (data.weak_conn.expired() ||
-            !data.weak_conn.lock()->UploadBlock(
-                data.index, data.begin, data.length, read_ok, block))
+        std::tr1::shared_ptr<BitUploadPeer> conn = data.weak_conn.lock();
+        if (conn && !conn->UploadBlock(data.index, data.begin, data.length,
+                    read_ok, block))
         {
-            // upload failure, do not consume upload_blocks_quota_,
-            // so increase upload_blocks_quota_, then next upload round
-            // can consume the upload_blocks_quota_
-            ++upload_blocks_quota_;
+            // upload failure, give back the tokens
+            conn->GetUploadLimiter().Refund(data.length);
         }
     }
 
@@ -1,32 +1,82 @@
 #ifndef BIT_UPLOAD_DISPATCHER_H
 #define BIT_UPLOAD_DISPATCHER_H
 
+#include "BitPriority.h"
 #include "../base/BaseTypes.h"
-#include "../timer/TimeTraits.h"
+#include <deque>
 #include <list>
+#include <map>
 #include <memory>
 
 namespace bitwave {
 namespace core {
 
     class BitCache;
-    class BitPeerConnection;
+    class BitTokenBucket;
+    class BitUploadScheduler;
 
+    // a peer of pending upload requests, BitPeerConnection
+    class BitUploadPeer
+    {
+    public:
+        // weight of the peer in upload round robin
+        virtual int GetUploadWeight() const = 0;
+        virtual BitTokenBucket& GetUploadLimiter() = 0;
+        // the block of a request is read, return false when it is not sent
+        virtual bool UploadBlock(int index, int begin, int length,
+                                 bool read_ok, const char *block) = 0;
+        virtual ~BitUploadPeer() { }
+    };
+
+    // upload pending requests of a task. Every peer has a queue of
+    // pending requests, the queues of peers are served by deficit round
+    // robin weighted by the choker, and a request is read from cache and
+    // sent when the peer has upload tokens. The task is scheduled with
+    // other tasks by BitUploadScheduler
     class BitUploadDispatcher : private NotCopyable
     {
     public:
-        typedef std::tr1::weak_ptr<BitPeerConnection> ConnectionWeakPtr;
+        typedef std::tr1::weak_ptr<BitUploadPeer> ConnectionWeakPtr;
+
+        // bytes of one round for weight 1
+        static const long long quantum = 16 * 1024;
+        // the largest block a peer may request
+        static const int max_request_length = 16 * 1024;
 
-        explicit BitUploadDispatcher(
-                const std::tr1::shared_ptr<BitCache>& cache);
+        // a request is served only when 0 < length <= max_request_length
+        // and the block is in the piece
+        static bool IsValidRequest(int begin, int length,
+                                   std::size_t piece_length);
 
+        BitUploadDispatcher(const std::tr1::shared_ptr<BitCache>& cache,
+                            const std::tr1::shared_ptr<BitTokenBucket>& limiter);
+
+        ~BitUploadDispatcher();
+
+        // queue a request of the peer, an invalid request is dropped
         void PendingUpload(const ConnectionWeakPtr& weak_conn,
                            int index, int begin, int length);
 
-        void ProcessUpload();
+        // a request of the peer is queued, read its piece into cache
+        // before it is uploaded, and when the peer requests pieces in
+        // sequence, read ahead the next pieces
+        void Prefetch(int index, int begin, int length, bool sequential);
+
+        // upload priority of the task, PRIORITY_SKIP is the same as
+        // PRIORITY_LOW
+        void SetPriority(BitPriority priority)
+            { priority_ = priority; }
+        int GetWeight() const;
+
+        bool HasPending() const
+            { return !active_peers_.empty(); }
+
+        // upload one request of the next peer in round robin, return the
+        // length, or 0 when no peer can upload now
+        std::size_t ServeOne();
 
     private:
-        typedef time_traits<NormalTimeType> TimeTraits;
+        friend class BitUploadScheduler;
 
         struct PendingData
         {
@@ -45,15 +95,39 @@ namespace core {
             int length;
         };
 
-        void ProcessPending(std::size_t count);
+        // pending requests of one peer
+        struct PeerQueue
+        {
+            PeerQueue()
+                : deficit(0),
+                  in_turn(false)
+            {
+            }
+
+            ConnectionWeakPtr weak_conn;
+            std::deque<PendingData> requests;
+            long long deficit;
+            bool in_turn;       // quantum of this turn is added
+        };
+
+        typedef std::map<const BitUploadPeer *, PeerQueue> PeerQueues;
+        typedef std::list<PeerQueues::iterator> ActivePeers;
+
+        void NextTurn(PeerQueue& queue);
+        void DeactivatePeer();
         void CacheReadCallback(const PendingData& data,
                                bool read_ok,
                                const char *block);
 
-        NormalTimeType upload_time_;
-        std::size_t upload_blocks_quota_;
-        std::list<PendingData> pending_list_;
+        PeerQueues peer_queues_;
+        // peers have pending requests, in round robin order
+        ActivePeers active_peers_;
         std::tr1::shared_ptr<BitCache> cache_;
+        // upload limiter of the task
+        std::tr1::shared_ptr<BitTokenBucket> limiter_;
+        BitPriority priority_;
+        // in the active list of BitUploadScheduler
+        bool scheduled_;
     };
 
 } // namespace core
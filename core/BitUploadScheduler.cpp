@@ -0,0 +1,81 @@
+#include "BitUploadScheduler.h"
+#include "BitUploadDispatcher.h"
+#include <assert.h>
+
+namespace bitwave {
+namespace core {
+
+    BitUploadScheduler::BitUploadScheduler()
+    {
+    }
+
+    void BitUploadScheduler::Activate(BitUploadDispatcher *dispatcher)
+    {
+        assert(dispatcher);
+        if (dispatcher->scheduled_)
+            return ;
+
+        dispatcher->scheduled_ = true;
+        active_.push_back(ActiveTask(dispatcher));
+    }
+
+    void BitUploadScheduler::Remove(BitUploadDispatcher *dispatcher)
+    {
+        if (!dispatcher->scheduled_)
+            return ;
+
+        dispatcher->scheduled_ = false;
+        for (ActiveTasks::iterator it = active_.begin(); it != active_.end(); ++it)
+        {
+            if (it->dispatcher == dispatcher)
+            {
+                active_.erase(it);
+                break;
+            }
+        }
+    }
+
+    void BitUploadScheduler::Process()
+    {
+        // rounds go on until a round uploads nothing, then every active
+        // task is limited by tokens or waits for the peers
+        bool is_served = true;
+        while (is_served && !active_.empty())
+        {
+            is_served = false;
+            for (std::size_t count = active_.size(); count > 0; --count)
+            {
+                ActiveTask& task = active_.front();
+                long long quantum = BitUploadDispatcher::quantum *
+                    task.dispatcher->GetWeight();
+
+                // a task can not upload does not save the quantum more
+                // than one round
+                task.deficit += quantum;
+                if (task.deficit > 2 * quantum)
+                    task.deficit = 2 * quantum;
+
+                while (task.deficit > 0)
+                {
+                    std::size_t served = task.dispatcher->ServeOne();
+                    if (served == 0)
+                        break;
+                    task.deficit -= served;
+                    is_served = true;
+                }
+
+                if (task.dispatcher->HasPending())
+                {
+                    active_.splice(active_.end(), active_, active_.begin());
+                }
+                else
+                {
+                    task.dispatcher->scheduled_ = false;
+                    active_.pop_front();
+                }
+            }
+        }
+    }
+
+} // namespace core
+} // namespace bitwave
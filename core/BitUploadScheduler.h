@@ -0,0 +1,49 @@
+#ifndef BIT_UPLOAD_SCHEDULER_H
+#define BIT_UPLOAD_SCHEDULER_H
+
+#include "../base/BaseTypes.h"
+#include <list>
+
+namespace bitwave {
+namespace core {
+
+    class BitUploadDispatcher;
+
+    // deficit round robin of upload across tasks. A task of pending
+    // uploads is active, every round an active task gets a quantum of
+    // bytes by its weight, and its dispatcher serves peers in the same
+    // way until the quantum is used or no peer can upload
+    class BitUploadScheduler : private NotCopyable
+    {
+    public:
+        BitUploadScheduler();
+
+        // the dispatcher has pending uploads
+        void Activate(BitUploadDispatcher *dispatcher);
+        // the dispatcher is destroyed
+        void Remove(BitUploadDispatcher *dispatcher);
+
+        void Process();
+
+    private:
+        struct ActiveTask
+        {
+            explicit ActiveTask(BitUploadDispatcher *d)
+                : dispatcher(d),
+                  deficit(0)
+            {
+            }
+
+            BitUploadDispatcher *dispatcher;
+            long long deficit;
+        };
+
+        typedef std::list<ActiveTask> ActiveTasks;
+
+        ActiveTasks active_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_UPLOAD_SCHEDULER_H
@@ -0,0 +1,132 @@
+#include "BitUtMetadata.h"
+#include "BitData.h"
+#include "BitException.h"
+#include "BitPeerConnection.h"
+#include "bencode/BenTypes.h"
+#include <assert.h>
+#include <sstream>
+
+namespace bitwave {
+namespace core {
+
+    bool ParseUtMetadataMessage(const char *payload, std::size_t len,
+                                UtMetadataMessage *message)
+    {
+        using namespace bentypes;
+        assert(message);
+        if (len == 0)
+            return false;
+
+        try
+        {
+            BenTypesStreamBuf buf(payload, len);
+            std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+            BenDictionary *dict = dynamic_cast<BenDictionary *>(object.get());
+            if (!dict)
+                return false;
+
+            BenInteger *type = dict->ValueBenTypeCast<BenInteger>("msg_type");
+            BenInteger *piece = dict->ValueBenTypeCast<BenInteger>("piece");
+            if (!type || !piece ||
+                type->GetValue() < UtMetadataMessage::REQUEST ||
+                type->GetValue() > UtMetadataMessage::REJECT ||
+                piece->GetValue() < 0 || piece->GetValue() > 0xFFFF)
+                return false;
+
+            message->type = static_cast<int>(type->GetValue());
+            message->piece = static_cast<int>(piece->GetValue());
+            message->total_size = 0;
+            message->data = 0;
+            message->data_len = 0;
+
+            if (message->type == UtMetadataMessage::DATA)
+            {
+                BenInteger *total_size =
+                    dict->ValueBenTypeCast<BenInteger>("total_size");
+                if (!total_size || total_size->GetValue() <= 0)
+                    return false;
+
+                // piece data follows the dictionary
+                std::size_t dict_len = dict->GetSrcBufEnd() - buf.begin();
+                message->total_size = total_size->GetValue();
+                message->data = payload + dict_len;
+                message->data_len = len - dict_len;
+            }
+        }
+        catch (const BenTypeException&)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::string EncodeUtMetadataMessage(const UtMetadataMessage& message)
+    {
+        // d8:msg_typei<type>e5:piecei<piece>e10:total_sizei<size>ee<data>
+        std::ostringstream oss;
+        oss << "d8:msg_typei" << message.type << "e5:piecei" << message.piece << 'e';
+        if (message.type == UtMetadataMessage::DATA)
+            oss << "10:total_sizei" << message.total_size << 'e';
+        oss << 'e';
+
+        std::string payload = oss.str();
+        if (message.type == UtMetadataMessage::DATA && message.data_len > 0)
+            payload.append(message.data, message.data_len);
+        return payload;
+    }
+
+    std::size_t GetMetadataPieceCount(std::size_t metadata_size)
+    {
+        return (metadata_size + UtMetadataMessage::piece_size - 1) /
+            UtMetadataMessage::piece_size;
+    }
+
+    BitMetadataServer::BitMetadataServer(BitPeerConnection *connection,
+                                         const std::tr1::shared_ptr<BitData>& bitdata)
+        : connection_(connection),
+          bitdata_(bitdata)
+    {
+    }
+
+    void BitMetadataServer::GetHandshakeItems(
+            std::map<std::string, long long>& items) const
+    {
+        std::pair<const char *, const char *> info =
+            bitdata_->GetMetainfoFile()->GetRawInfoValue();
+        items["metadata_size"] = info.second - info.first;
+    }
+
+    void BitMetadataServer::OnMessage(const char *data, std::size_t len)
+    {
+        UtMetadataMessage request;
+        if (!ParseUtMetadataMessage(data, len, &request) ||
+            request.type != UtMetadataMessage::REQUEST)
+            return ;
+
+        std::pair<const char *, const char *> info =
+            bitdata_->GetMetainfoFile()->GetRawInfoValue();
+        std::size_t metadata_size = info.second - info.first;
+
+        UtMetadataMessage reply;
+        reply.piece = request.piece;
+        std::size_t begin = request.piece * UtMetadataMessage::piece_size;
+        if (begin < metadata_size)
+        {
+            reply.type = UtMetadataMessage::DATA;
+            reply.total_size = metadata_size;
+            reply.data = info.first + begin;
+            reply.data_len = metadata_size - begin;
+            if (reply.data_len > UtMetadataMessage::piece_size)
+                reply.data_len = UtMetadataMessage::piece_size;
+        }
+        else
+        {
+            reply.type = UtMetadataMessage::REJECT;
+        }
+
+        connection_->SendExtensionMessage(this, EncodeUtMetadataMessage(reply));
+    }
+
+} // namespace core
+} // namespace bitwave
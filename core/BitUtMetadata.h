@@ -0,0 +1,80 @@
+#ifndef BIT_UT_METADATA_H
+#define BIT_UT_METADATA_H
+
+#include "BitExtension.h"
+#include <memory>
+#include <string>
+
+namespace bitwave {
+namespace core {
+
+    class BitData;
+    class BitPeerConnection;
+
+    // message of ut_metadata (BEP 9). The metadata is the bencoded info
+    // dictionary of a torrent, it is transferred in pieces of 16KB, the
+    // last piece may be shorter
+    struct UtMetadataMessage
+    {
+        enum Type
+        {
+            REQUEST,
+            DATA,
+            REJECT
+        };
+
+        static const std::size_t piece_size = 16 * 1024;
+
+        UtMetadataMessage()
+            : type(REQUEST),
+              piece(0),
+              total_size(0),
+              data(0),
+              data_len(0)
+        {
+        }
+
+        int type;
+        int piece;
+        long long total_size;       // of DATA
+        const char *data;           // piece data of DATA, in the payload
+        std::size_t data_len;
+    };
+
+    // parse payload of a ut_metadata message, return false when it is
+    // invalid
+    bool ParseUtMetadataMessage(const char *payload, std::size_t len,
+                                UtMetadataMessage *message);
+
+    // payload of a ut_metadata message, piece data of DATA is appended
+    std::string EncodeUtMetadataMessage(const UtMetadataMessage& message);
+
+    // piece count of metadata of metadata_size bytes
+    std::size_t GetMetadataPieceCount(std::size_t metadata_size);
+
+    // ut_metadata extension of a task connection, pieces of the info
+    // dictionary of the task are sent to the peer which requests them
+    class BitMetadataServer : public BitExtension
+    {
+    public:
+        BitMetadataServer(BitPeerConnection *connection,
+                          const std::tr1::shared_ptr<BitData>& bitdata);
+
+        virtual const char * GetName() const
+        {
+            return "ut_metadata";
+        }
+
+        virtual void GetHandshakeItems(std::map<std::string, long long>& items) const;
+        virtual void OnMessage(const char *data, std::size_t len);
+
+    private:
+        // the connection owns this extension
+        BitPeerConnection *connection_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+    };
+
+} // namespace core
+} // namespace bitwave
+
+#endif // BIT_UT_METADATA_H
@@ -1,10 +1,17 @@
 #include "BitWave.h"
 #include "BitData.h"
+#include "BitDht.h"
 #include "BitService.h"
 #include "BitCreator.h"
 #include "BitController.h"
+#include "BitHashPool.h"
+#include "BitHttpTracker.h"
 #include "BitRepository.h"
 #include "BitPeerListener.h"
+#include "BitTokenBucket.h"
+#include "BitUdpSocket.h"
+#include "BitUdpTracker.h"
+#include "BitUploadScheduler.h"
 #include "../base/Console.h"
 #include <assert.h>
 #include <stdio.h>
@@ -38,6 +45,21 @@ namespace core {
 
     BitCoreControlObject::BitCoreControlObject()
     {
+        hash_pool_.Reset(new BitHashPool);
+        BitService::hash_pool = hash_pool_.Get();
+
+        upload_limiter_.Reset(new BitTokenBucket);
+        download_limiter_.Reset(new BitTokenBucket);
+        BitService::upload_limiter = upload_limiter_.Get();
+        BitService::download_limiter = download_limiter_.Get();
+
+        upload_scheduler_.Reset(new BitUploadScheduler);
+        BitService::upload_scheduler = upload_scheduler_.Get();
+
+        assert(BitService::io_service);
+        http_tracker_.Reset(new BitHttpTracker(*BitService::io_service));
+        BitService::http_tracker = http_tracker_.Get();
+
         repository_.Reset(new BitRepository);
         controller_.Reset(new BitController);
 
@@ -50,6 +72,7 @@ namespace core {
         BitService::new_task_creator = new_task_creator_.Get();
 
         peer_listener_.Reset(new BitPeerListener(*BitService::io_service));
+        CreateUdpServices();
     }
 
     BitCoreControlObject::~BitCoreControlObject()
@@ -57,11 +80,46 @@ namespace core {
         BitService::controller = 0;
         BitService::repository = 0;
         BitService::new_task_creator = 0;
+        BitService::hash_pool = 0;
+        BitService::upload_limiter = 0;
+        BitService::download_limiter = 0;
+        BitService::upload_scheduler = 0;
+        BitService::http_tracker = 0;
+        BitService::dht = 0;
+        BitService::udp_tracker = 0;
+        BitService::udp_socket = 0;
+    }
+
+    void BitCoreControlObject::CreateUdpServices()
+    {
+        // udp is on the same port as the peer listener, the client works
+        // without dht and udp trackers when the port is used
+        unsigned short port = BitService::repository->GetListenPort();
+        try
+        {
+            udp_socket_.Reset(new BitUdpSocket(*BitService::io_service, port));
+        }
+        catch (const net::NetException&)
+        {
+            return ;
+        }
+
+        dht_.Reset(new BitDht(*BitService::io_service, udp_socket_.Get()));
+        udp_tracker_.Reset(new BitUdpTracker(*BitService::io_service, udp_socket_.Get()));
+        BitService::udp_socket = udp_socket_.Get();
+        BitService::dht = dht_.Get();
+        BitService::udp_tracker = udp_tracker_.Get();
+
+        dht_->AddBootstrapHost("router.bittorrent.com", 6881);
+        dht_->AddBootstrapHost("router.utorrent.com", 6881);
+        dht_->AddBootstrapHost("dht.transmissionbt.com", 6881);
     }
 
     bool BitCoreControlObject::Wave()
     {
+        new_task_creator_->ProcessMagnetTasks();
         controller_->Process();
+        upload_scheduler_->Process();
         return true;
     }
 
@@ -109,10 +167,11 @@ namespace core {
             double upload_speed = GetUploadSpeed(bitdata, i, interval);
             double percent = GetDownloadPercent(bitdata);
             int peer_count = bitdata->GetPeerDataSet().size();
+            double wasted = static_cast<double>(bitdata->GetWasted()) / (1024 * 1024);
 
             wchar_t str[256] = { 0 };
-            swprintf(str, sizeof(str), L"download:%6.2fKB/S upload:%6.2fKB/S peer count:%4d downloaded:%6.2f%%",
-                    download_speed, upload_speed, peer_count, percent);
+            swprintf(str, sizeof(str), L"download:%6.2fKB/S upload:%6.2fKB/S peer count:%4d downloaded:%6.2f%% wasted:%6.2fMB",
+                    download_speed, upload_speed, peer_count, percent, wasted);
 
             console_->SetCursorPos(cursor_x_, cursor_y_ + i);
             console_->Write(str, wcslen(str));
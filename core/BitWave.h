@@ -40,6 +40,13 @@ namespace core {
     class BitController;
     class BitNewTaskCreator;
     class BitPeerListener;
+    class BitHashPool;
+    class BitTokenBucket;
+    class BitUploadScheduler;
+    class BitUdpSocket;
+    class BitDht;
+    class BitUdpTracker;
+    class BitHttpTracker;
 
     class BitCoreControlObject : public BitWaveObject, private NotCopyable
     {
@@ -49,10 +56,20 @@ namespace core {
         virtual bool Wave();
 
     private:
+        void CreateUdpServices();
+
+        ScopePtr<BitHashPool> hash_pool_;
+        ScopePtr<BitTokenBucket> upload_limiter_;
+        ScopePtr<BitTokenBucket> download_limiter_;
+        ScopePtr<BitUploadScheduler> upload_scheduler_;
+        ScopePtr<BitHttpTracker> http_tracker_;
         ScopePtr<BitRepository> repository_;
         ScopePtr<BitController> controller_;
         ScopePtr<BitNewTaskCreator> new_task_creator_;
         ScopePtr<BitPeerListener> peer_listener_;
+        ScopePtr<BitUdpSocket> udp_socket_;
+        ScopePtr<BitDht> dht_;
+        ScopePtr<BitUdpTracker> udp_tracker_;
     };
 
     class BitData;
@@ -2,8 +2,12 @@
 #include "BitCreator.h"
 #include "BitService.h"
 #include "BitException.h"
+#include "BitHashPool.h"
+#include "BitTorrentMaker.h"
 #include "../base/StringConv.h"
 #include <iostream>
+#include <string>
+#include <vector>
 
 void ProcessException(const bitwave::core::BenTypeException& bte)
 {
@@ -36,17 +40,55 @@ void ProcessException(const bitwave::core::ListenPortException& lpe)
     std::cout << "Program can not start up!" << std::endl;
 }
 
+// make a torrent of path, every tracker url is a tier
+void CreateTorrent(int argc, const char **argv)
+{
+    std::string path = ANSIToUTF8(argv[2]);
+    std::string torrent_file = ANSIToUTF8(argv[3]);
+    std::vector<std::vector<std::string> > tiers;
+    for (int i = 4; i < argc; ++i)
+        tiers.push_back(std::vector<std::string>(1, ANSIToUTF8(argv[i])));
+
+    bitwave::core::BitHashPool hash_pool;
+    bitwave::core::BitTorrentMaker maker(path, hash_pool);
+    maker.SetAnnounceTiers(tiers);
+    maker.Start();
+
+    while (!maker.IsComplete())
+    {
+        ::Sleep(500);
+        std::cout << "\rhashed " << maker.GetHashedCount() << "/"
+                  << maker.GetPieceCount() << " pieces, "
+                  << maker.GetThroughput() << " GB/s" << std::flush;
+    }
+
+    maker.SaveTorrentFile(torrent_file);
+    std::cout << "\r" << maker.GetPieceCount() << " pieces of "
+              << maker.GetPieceLength() << " bytes hashed in "
+              << maker.GetThroughput() << " GB/s, torrent is saved" << std::endl;
+}
+
 int main(int argc, const char **argv)
 {
-    if (argc != 3)
+    bool create = argc >= 4 && std::string(argv[1]) == "-create";
+    bool recheck = argc == 4 && std::string(argv[3]) == "-recheck";
+    if (argc != 3 && !recheck && !create)
     {
         std::cout << "error command, please input command like this:" << std::endl;
-        std::cout << "\tBitTorrent torrent download_path" << std::endl;
+        std::cout << "\tBitTorrent torrent download_path [-recheck]" << std::endl;
+        std::cout << "\tBitTorrent magnet_link download_path" << std::endl;
+        std::cout << "\tBitTorrent -create path torrent [tracker_url ...]" << std::endl;
         return 0;
     }
 
     try
     {
+        if (create)
+        {
+            CreateTorrent(argc, argv);
+            return 0;
+        }
+
         std::string torrent = ANSIToUTF8(argv[1]);
         std::string download_path = ANSIToUTF8(argv[2]);
 
@@ -55,7 +97,18 @@ int main(int argc, const char **argv)
         bitwave::core::BitCoreControlObject core_control_object;
         bitwave::core::BitConsoleShowerObject console_shower_object;
 
-        bitwave::core::BitService::new_task_creator->CreateTask(torrent, download_path);
+        if (torrent.compare(0, 7, "magnet:") == 0)
+        {
+            if (!bitwave::core::BitService::new_task_creator->CreateMagnetTask(torrent, download_path))
+            {
+                std::cout << "magnet link is invalidate!" << std::endl;
+                return 0;
+            }
+        }
+        else
+        {
+            bitwave::core::BitService::new_task_creator->CreateTask(torrent, download_path, recheck);
+        }
 
         wave.AddWaveObject(&net_wave_object);
         wave.AddWaveObject(&core_control_object);
@@ -0,0 +1,287 @@
+#include "BenDecoder.h"
+#include <assert.h>
+#include <string.h>
+
+namespace bitwave {
+namespace core {
+namespace bentypes {
+
+    namespace {
+
+        inline bool IsDigit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+    } // unnamed namespace
+
+    // BenNode ------------------------------------------------------
+    bool BenNode::IsType(unsigned int type) const
+    {
+        return decoder_ && Token().type == type;
+    }
+
+    const BenToken& BenNode::Token() const
+    {
+        assert(decoder_ && index_ < decoder_->tokens_.size());
+        return decoder_->tokens_[index_];
+    }
+
+    long long BenNode::GetInteger() const
+    {
+        if (!IsInteger())
+            return 0;
+
+        // the integer is checked by the decoder, i[-]digitse
+        const char *p = decoder_->data_ + Token().offset + 1;
+        bool negative = *p == '-';
+        if (negative)
+            ++p;
+
+        long long value = 0;
+        for (; *p != 'e'; ++p)
+            value = value * 10 + (*p - '0');
+        return negative ? -value : value;
+    }
+
+    const char * BenNode::GetStringData() const
+    {
+        if (!IsString())
+            return 0;
+
+        const char *raw = decoder_->data_ + Token().offset;
+        return static_cast<const char *>(memchr(raw, ':', Token().length)) + 1;
+    }
+
+    std::size_t BenNode::GetStringLength() const
+    {
+        if (!IsString())
+            return 0;
+        return GetRawEnd() - GetStringData();
+    }
+
+    std::string BenNode::GetString() const
+    {
+        if (!IsString())
+            return std::string();
+        return std::string(GetStringData(), GetRawEnd());
+    }
+
+    bool BenNode::StringEquals(const char *data, std::size_t length) const
+    {
+        return IsString() && GetStringLength() == length &&
+            memcmp(GetStringData(), data, length) == 0;
+    }
+
+    BenNode BenNode::First() const
+    {
+        if (!IsList() && !IsDictionary())
+            return BenNode();
+
+        const BenToken& token = Token();
+        if (index_ + 1 == token.next)
+            return BenNode();
+        return BenNode(decoder_, index_ + 1, token.next);
+    }
+
+    BenNode BenNode::Next() const
+    {
+        if (!decoder_)
+            return BenNode();
+
+        unsigned int next = Token().next;
+        if (next >= end_)
+            return BenNode();
+        return BenNode(decoder_, next, end_);
+    }
+
+    std::size_t BenNode::Size() const
+    {
+        std::size_t count = 0;
+        for (BenNode node = First(); node.IsValid(); node = node.Next())
+            ++count;
+        return IsDictionary() ? count / 2 : count;
+    }
+
+    BenNode BenNode::Find(const char *key, std::size_t length) const
+    {
+        if (!IsDictionary())
+            return BenNode();
+
+        for (BenNode k = First(); k.IsValid(); k = k.Next().Next())
+        {
+            if (k.StringEquals(key, length))
+                return k.Next();
+        }
+        return BenNode();
+    }
+
+    const char * BenNode::GetRawBegin() const
+    {
+        if (!decoder_)
+            return 0;
+        return decoder_->data_ + Token().offset;
+    }
+
+    const char * BenNode::GetRawEnd() const
+    {
+        if (!decoder_)
+            return 0;
+        return decoder_->data_ + Token().offset + Token().length;
+    }
+
+    // BenDecoder ---------------------------------------------------
+    BenDecoder::BenDecoder()
+        : data_(0),
+          size_(0),
+          decoded_size_(0)
+    {
+    }
+
+    bool BenDecoder::Decode(const char *data, std::size_t size)
+    {
+        data_ = data;
+        size_ = size;
+        decoded_size_ = 0;
+        tokens_.clear();
+        stack_.clear();
+
+        // offsets are 32 bits
+        if (!data || size == 0 || size > 0xFFFFFFFFu)
+            return false;
+
+        std::size_t pos = 0;
+        do
+        {
+            if (pos >= size)
+                return false;
+
+            if (!stack_.empty() && data[pos] == 'e')
+            {
+                // next of an open list or dictionary is the count of its
+                // values, a dictionary has a value of every key
+                BenToken& token = tokens_[stack_.back()];
+                if (token.type == BenToken::DICTIONARY && token.next % 2)
+                    return false;
+
+                ++pos;
+                token.length = static_cast<unsigned int>(pos - token.offset);
+                token.next = static_cast<unsigned int>(tokens_.size());
+                stack_.pop_back();
+                continue;
+            }
+
+            if (!stack_.empty())
+            {
+                // keys of a dictionary are strings
+                BenToken& parent = tokens_[stack_.back()];
+                if (parent.type == BenToken::DICTIONARY &&
+                    parent.next % 2 == 0 && !IsDigit(data[pos]))
+                    return false;
+                ++parent.next;
+            }
+
+            switch (data[pos])
+            {
+            case 'i':
+                if (!DecodeInteger(&pos))
+                    return false;
+                break;
+
+            case 'l':
+            case 'd':
+                {
+                    if (stack_.size() >= max_depth)
+                        return false;
+
+                    BenToken token;
+                    token.type = data[pos] == 'l' ? BenToken::LIST : BenToken::DICTIONARY;
+                    token.offset = static_cast<unsigned int>(pos);
+                    token.length = 0;
+                    token.next = 0;
+                    stack_.push_back(static_cast<unsigned int>(tokens_.size()));
+                    tokens_.push_back(token);
+                    ++pos;
+                }
+                break;
+
+            default:
+                if (!DecodeString(&pos))
+                    return false;
+                break;
+            }
+        } while (!stack_.empty());
+
+        decoded_size_ = pos;
+        return true;
+    }
+
+    BenNode BenDecoder::GetRoot() const
+    {
+        if (tokens_.empty() || decoded_size_ == 0)
+            return BenNode();
+        return BenNode(this, 0, static_cast<unsigned int>(tokens_.size()));
+    }
+
+    bool BenDecoder::DecodeInteger(std::size_t *pos)
+    {
+        // i[-]digitse
+        std::size_t begin = *pos;
+        std::size_t p = begin + 1;
+        if (p < size_ && data_[p] == '-')
+            ++p;
+
+        std::size_t digits = p;
+        while (p < size_ && IsDigit(data_[p]))
+            ++p;
+
+        // at most 18 digits, it does not overflow long long
+        if (p == digits || p - digits > 18 || p >= size_ || data_[p] != 'e')
+            return false;
+
+        ++p;
+        BenToken token;
+        token.type = BenToken::INTEGER;
+        token.offset = static_cast<unsigned int>(begin);
+        token.length = static_cast<unsigned int>(p - begin);
+        token.next = static_cast<unsigned int>(tokens_.size() + 1);
+        tokens_.push_back(token);
+        *pos = p;
+        return true;
+    }
+
+    bool BenDecoder::DecodeString(std::size_t *pos)
+    {
+        // length:data, "0:" is an empty string
+        std::size_t begin = *pos;
+        std::size_t p = begin;
+        std::size_t length = 0;
+        while (p < size_ && IsDigit(data_[p]))
+        {
+            length = length * 10 + (data_[p] - '0');
+            if (length > size_)
+                return false;
+            ++p;
+        }
+
+        if (p == begin || p >= size_ || data_[p] != ':')
+            return false;
+
+        ++p;
+        if (length > size_ - p)
+            return false;
+
+        p += length;
+        BenToken token;
+        token.type = BenToken::STRING;
+        token.offset = static_cast<unsigned int>(begin);
+        token.length = static_cast<unsigned int>(p - begin);
+        token.next = static_cast<unsigned int>(tokens_.size() + 1);
+        tokens_.push_back(token);
+        *pos = p;
+        return true;
+    }
+
+} // namespace bentypes
+} // namespace core
+} // namespace bitwave
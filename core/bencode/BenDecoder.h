@@ -0,0 +1,155 @@
+#ifndef BEN_DECODER_H
+#define BEN_DECODER_H
+
+#include "../../base/BaseTypes.h"
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace bentypes {
+
+    // a decoded bencode value, it refers to the source buffer by offset
+    struct BenToken
+    {
+        enum Type
+        {
+            INTEGER,
+            STRING,
+            LIST,
+            DICTIONARY
+        };
+
+        unsigned int type;
+        // raw bencoded value is [offset, offset + length) of the source
+        unsigned int offset;
+        unsigned int length;
+        // index of the token after this value and all values in it
+        unsigned int next;
+    };
+
+    class BenDecoder;
+
+    // a light handle of a decoded value, it is invalid when the value does
+    // not exist or is not the expected type. A list or dictionary is
+    // walked by First and Next, values of a dictionary follow their keys
+    class BenNode
+    {
+    public:
+        BenNode()
+            : decoder_(0), index_(0), end_(0)
+        {
+        }
+
+        bool IsValid() const
+            { return decoder_ != 0; }
+        bool IsInteger() const
+            { return IsType(BenToken::INTEGER); }
+        bool IsString() const
+            { return IsType(BenToken::STRING); }
+        bool IsList() const
+            { return IsType(BenToken::LIST); }
+        bool IsDictionary() const
+            { return IsType(BenToken::DICTIONARY); }
+
+        // 0 when it is not an integer
+        long long GetInteger() const;
+
+        // string data in the source buffer, 0 and 0 when it is not a
+        // string
+        const char * GetStringData() const;
+        std::size_t GetStringLength() const;
+        std::string GetString() const;
+        bool StringEquals(const char *data, std::size_t length) const;
+
+        // first value in a list or dictionary, next value in the same
+        // list or dictionary
+        BenNode First() const;
+        BenNode Next() const;
+
+        // count of values of a list, or keys of a dictionary, it walks
+        // all values
+        std::size_t Size() const;
+
+        // value of the key in a dictionary
+        BenNode Find(const char *key, std::size_t length) const;
+        BenNode Find(const std::string& key) const
+            { return Find(key.data(), key.size()); }
+
+        BenNode FindInteger(const std::string& key) const
+            { return Typed(Find(key), BenToken::INTEGER); }
+        BenNode FindString(const std::string& key) const
+            { return Typed(Find(key), BenToken::STRING); }
+        BenNode FindList(const std::string& key) const
+            { return Typed(Find(key), BenToken::LIST); }
+        BenNode FindDictionary(const std::string& key) const
+            { return Typed(Find(key), BenToken::DICTIONARY); }
+
+        // raw bencoded value in the source buffer
+        const char * GetRawBegin() const;
+        const char * GetRawEnd() const;
+
+    private:
+        friend class BenDecoder;
+
+        BenNode(const BenDecoder *decoder, unsigned int index, unsigned int end)
+            : decoder_(decoder), index_(index), end_(end)
+        {
+        }
+
+        static BenNode Typed(const BenNode& node, unsigned int type)
+            { return node.IsType(type) ? node : BenNode(); }
+
+        bool IsType(unsigned int type) const;
+        const BenToken& Token() const;
+
+        const BenDecoder *decoder_;
+        unsigned int index_;
+        // index of the token after the parent value
+        unsigned int end_;
+    };
+
+    // a zero copy bencode decoder. It decodes a borrowed buffer to a flat
+    // array of tokens in one pass, strings are not copied and no memory
+    // is allocated for a value, the buffer must be valid while nodes are
+    // used. Data after the first value is not decoded
+    class BenDecoder : private NotCopyable
+    {
+    public:
+        // deepest nested lists and dictionaries
+        static const std::size_t max_depth = 256;
+
+        BenDecoder();
+
+        // return false when data is not bencoded, tokens of the previous
+        // decode are freed
+        bool Decode(const char *data, std::size_t size);
+
+        BenNode GetRoot() const;
+
+        // bytes of the decoded value
+        std::size_t GetDecodedSize() const
+            { return decoded_size_; }
+
+        std::size_t GetTokenCount() const
+            { return tokens_.size(); }
+
+    private:
+        friend class BenNode;
+
+        bool DecodeInteger(std::size_t *pos);
+        bool DecodeString(std::size_t *pos);
+
+        const char *data_;
+        std::size_t size_;
+        std::size_t decoded_size_;
+        std::vector<BenToken> tokens_;
+        // open lists and dictionaries
+        std::vector<unsigned int> stack_;
+    };
+
+} // namespace bentypes
+} // namespace core
+} // namespace bitwave
+
+#endif // BEN_DECODER_H
@@ -0,0 +1,196 @@
+#include "BenEncoder.h"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+namespace bitwave {
+namespace core {
+namespace bentypes {
+
+    namespace {
+
+        // digits of the max unsigned long long, a sign and a type char
+        const std::size_t max_number_length = 22;
+
+        // keys of a dictionary are sorted as raw strings
+        bool KeyLess(const char *left, std::size_t left_length,
+                     const char *right, std::size_t right_length)
+        {
+            int result = memcmp(left, right, std::min(left_length, right_length));
+            return result < 0 || (result == 0 && left_length < right_length);
+        }
+
+    } // unnamed namespace
+
+    BenWriter::BenWriter(DefaultBufferCache& cache, std::size_t reserve)
+        : cache_(cache),
+          size_(0)
+    {
+        Reserve(reserve);
+    }
+
+    BenWriter::~BenWriter()
+    {
+        if (buffer_)
+            cache_.FreeBuffer(buffer_);
+    }
+
+    void BenWriter::WriteInteger(long long value)
+    {
+        assert(!IsKeyNext() && "a key of dictionary is a string");
+        Reserve(max_number_length);
+
+        char *data = buffer_.GetBuffer();
+        data[size_++] = 'i';
+        if (value < 0)
+        {
+            data[size_++] = '-';
+            // the magnitude of the min value does not fit in long long
+            AppendNumber(0ULL - static_cast<unsigned long long>(value));
+        }
+        else
+        {
+            AppendNumber(static_cast<unsigned long long>(value));
+        }
+        data[size_++] = 'e';
+
+        ValueWritten();
+    }
+
+    void BenWriter::WriteString(const char *data, std::size_t length)
+    {
+        bool key = IsKeyNext();
+        Reserve(max_number_length + length);
+
+        AppendNumber(length);
+        buffer_.GetBuffer()[size_++] = ':';
+        if (length > 0)
+            memcpy(buffer_.GetBuffer() + size_, data, length);
+
+        if (key)
+        {
+            Container& dictionary = containers_.back();
+            assert((dictionary.key_length == static_cast<std::size_t>(-1) ||
+                    KeyLess(buffer_.GetBuffer() + dictionary.key_offset,
+                            dictionary.key_length, data, length)) &&
+                   "keys of dictionary are not in ascending order");
+            dictionary.key_offset = size_;
+            dictionary.key_length = length;
+        }
+
+        size_ += length;
+        ValueWritten();
+    }
+
+    void BenWriter::WriteString(const char *str)
+    {
+        WriteString(str, strlen(str));
+    }
+
+    void BenWriter::WriteRaw(const char *data, std::size_t length)
+    {
+        assert(!IsKeyNext() && "a key of dictionary is a string");
+        Reserve(length);
+        memcpy(buffer_.GetBuffer() + size_, data, length);
+        size_ += length;
+        ValueWritten();
+    }
+
+    void BenWriter::BeginList()
+    {
+        BeginContainer('l', false);
+    }
+
+    void BenWriter::BeginDictionary()
+    {
+        BeginContainer('d', true);
+    }
+
+    void BenWriter::End()
+    {
+        assert(!containers_.empty() && "no list or dictionary to end");
+        assert(!(containers_.back().dictionary && !containers_.back().key_next) &&
+               "a key of dictionary has no value");
+        containers_.pop_back();
+
+        Reserve(1);
+        buffer_.GetBuffer()[size_++] = 'e';
+    }
+
+    Buffer BenWriter::DetachBuffer()
+    {
+        Buffer buffer = buffer_;
+        buffer_.Reset();
+        size_ = 0;
+        containers_.clear();
+        return buffer;
+    }
+
+    void BenWriter::Clear()
+    {
+        size_ = 0;
+        containers_.clear();
+    }
+
+    bool BenWriter::IsKeyNext() const
+    {
+        return !containers_.empty() && containers_.back().key_next;
+    }
+
+    void BenWriter::ValueWritten()
+    {
+        // a key and a value are written in turn in a dictionary
+        if (!containers_.empty() && containers_.back().dictionary)
+            containers_.back().key_next = !containers_.back().key_next;
+    }
+
+    void BenWriter::BeginContainer(char type, bool dictionary)
+    {
+        assert(!IsKeyNext() && "a key of dictionary is a string");
+        ValueWritten();
+
+        Reserve(1);
+        buffer_.GetBuffer()[size_++] = type;
+
+        Container container;
+        container.dictionary = dictionary;
+        container.key_next = dictionary;
+        container.key_offset = 0;
+        container.key_length = static_cast<std::size_t>(-1);
+        containers_.push_back(container);
+    }
+
+    void BenWriter::Reserve(std::size_t length)
+    {
+        std::size_t capacity = buffer_.BufferLen();
+        if (buffer_ && length <= capacity - size_)
+            return ;
+
+        std::size_t new_capacity = std::max(capacity * 2, size_ + length);
+        Buffer buffer = cache_.GetBuffer(std::max(new_capacity, static_cast<std::size_t>(16)));
+        if (size_ > 0)
+            memcpy(buffer.GetBuffer(), buffer_.GetBuffer(), size_);
+        if (buffer_)
+            cache_.FreeBuffer(buffer_);
+        buffer_ = buffer;
+    }
+
+    void BenWriter::AppendNumber(unsigned long long number)
+    {
+        // digits are made from the lowest, then copied in order
+        char digits[max_number_length];
+        char *end = digits + sizeof(digits);
+        char *begin = end;
+        do
+        {
+            *--begin = static_cast<char>('0' + number % 10);
+            number /= 10;
+        } while (number);
+
+        memcpy(buffer_.GetBuffer() + size_, begin, end - begin);
+        size_ += end - begin;
+    }
+
+} // namespace bentypes
+} // namespace core
+} // namespace bitwave
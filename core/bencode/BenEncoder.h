@@ -0,0 +1,131 @@
+#ifndef BEN_ENCODER_H
+#define BEN_ENCODER_H
+
+#include "../../base/BaseTypes.h"
+#include "../../buffer/Buffer.h"
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace bentypes {
+
+    // a streaming bencode writer, values are appended to a buffer of the
+    // cache as they are written and no tree is built. Lists and
+    // dictionaries are begun and ended, keys of a dictionary are written
+    // by WriteString in ascending order of bytes before their values,
+    // wrong order and unmatched ends are asserted in debug build
+    class BenWriter : private NotCopyable
+    {
+    public:
+        explicit BenWriter(DefaultBufferCache& cache, std::size_t reserve = 256);
+        ~BenWriter();
+
+        void WriteInteger(long long value);
+        void WriteString(const char *data, std::size_t length);
+        void WriteString(const std::string& str)
+            { WriteString(str.data(), str.size()); }
+        void WriteString(const char *str);
+
+        // a value bencoded already, such as the raw info value
+        void WriteRaw(const char *data, std::size_t length);
+
+        void BeginList();
+        void BeginDictionary();
+        void End();
+
+        // all lists and dictionaries are ended
+        bool IsComplete() const
+            { return size_ > 0 && containers_.empty(); }
+
+        const char * GetData() const
+            { return buffer_.GetBuffer(); }
+        std::size_t GetSize() const
+            { return size_; }
+        std::string GetString() const
+            { return std::string(GetData(), size_); }
+
+        // the written data of GetSize bytes is in the returned buffer, it
+        // is freed by FreeBuffer of the cache, the writer is empty after
+        Buffer DetachBuffer();
+
+        // clear the written data, the buffer is reused
+        void Clear();
+
+    private:
+        struct Container
+        {
+            bool dictionary;
+            bool key_next;
+            // the last key written in a dictionary
+            std::size_t key_offset;
+            std::size_t key_length;
+        };
+
+        bool IsKeyNext() const;
+        void ValueWritten();
+        void BeginContainer(char type, bool dictionary);
+        void Reserve(std::size_t length);
+        void AppendNumber(unsigned long long number);
+
+        DefaultBufferCache& cache_;
+        Buffer buffer_;
+        std::size_t size_;
+        std::vector<Container> containers_;
+    };
+
+    // write a dictionary in scope, it is ended when the object is
+    // destructed. A value of other types follows Key:
+    //     BenDictionaryWriter dict(writer);
+    //     dict.Add("interval", 1800);
+    //     dict.Key("peers").BeginList();
+    class BenDictionaryWriter : private NotCopyable
+    {
+    public:
+        explicit BenDictionaryWriter(BenWriter& writer)
+            : writer_(writer)
+        {
+            writer_.BeginDictionary();
+        }
+
+        ~BenDictionaryWriter()
+        {
+            writer_.End();
+        }
+
+        BenDictionaryWriter& Add(const char *key, long long value)
+        {
+            writer_.WriteString(key);
+            writer_.WriteInteger(value);
+            return *this;
+        }
+
+        BenDictionaryWriter& Add(const char *key, const std::string& value)
+        {
+            writer_.WriteString(key);
+            writer_.WriteString(value);
+            return *this;
+        }
+
+        BenDictionaryWriter& Add(const char *key, const char *data, std::size_t length)
+        {
+            writer_.WriteString(key);
+            writer_.WriteString(data, length);
+            return *this;
+        }
+
+        BenWriter& Key(const char *key)
+        {
+            writer_.WriteString(key);
+            return writer_;
+        }
+
+    private:
+        BenWriter& writer_;
+    };
+
+} // namespace bentypes
+} // namespace core
+} // namespace bitwave
+
+#endif // BEN_ENCODER_H
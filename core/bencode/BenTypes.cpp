@@ -46,8 +46,9 @@ namespace bentypes {
         : benstr_()
     {
         srcbufbegin_ = begin;
+        // empty string "0:" is valid
         int stringlen = ReadStringLen(begin, end);
-        if (stringlen <= 0 || begin == end || *begin != ':')
+        if (stringlen < 0 || begin == end || *begin != ':')
             throw BenTypeException(INVALIDATE_STRING);
 
         ++begin;
@@ -65,6 +66,8 @@ namespace bentypes {
             lenbuf.push_back(*begin++);
         }
 
+        if (lenbuf.empty())
+            return -1;
         return atoi(lenbuf.c_str());
     }
 
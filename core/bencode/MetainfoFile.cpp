@@ -1,177 +1,582 @@
 #include "MetainfoFile.h"
+#include "BenDecoder.h"
 #include "../BitException.h"
+#include "../BitMappedFile.h"
+#include "../BitMerkleTree.h"
 #include <assert.h>
+#include <string.h>
 #include <algorithm>
-#include <functional>
-#include <iterator>
+#include <map>
 
 namespace bitwave {
 namespace core {
 namespace bentypes {
 
-    MetainfoFile::MetainfoFile(const char *filepath)
-        : metafilebuf_(filepath),
-          metainfo_(GetBenObject(metafilebuf_)),
-          ann_(0),
-          annlist_(0),
-          infodic_(0),
-          pieces_(0)
-    {
-        if (!metainfo_ || !PrepareBasicData())
+    namespace {
+
+        typedef std::map<std::string, unsigned int> InternedNames;
+
+        // index of the component, it is appended when it is new
+        unsigned int InternName(const std::string& name, InternedNames *interned,
+                                std::string *names, std::vector<unsigned int> *offsets)
         {
-            std::string info = std::string("invalid torrent file: ") + filepath;
-            throw MetainfoFileExeception(info);
+            InternedNames::iterator it = interned->find(name);
+            if (it != interned->end())
+                return it->second;
+
+            unsigned int component = static_cast<unsigned int>(offsets->size() - 1);
+            names->append(name);
+            offsets->push_back(static_cast<unsigned int>(names->size()));
+            interned->insert(std::make_pair(name, component));
+            return component;
         }
-    }
 
-    void MetainfoFile::GetAnnounce(std::vector<std::string> *announce) const
-    {
-        assert(announce);
-        if (annlist_)
+        // a file of the file tree, root is 0 when the file is empty
+        struct TreeFile
         {
-            announce->reserve(annlist_->size());
+            long long length;
+            const char *root;
+        };
 
-            std::vector<BenList *> vl;
-            annlist_->AllElementPtr(&vl);
+        // files of a node of the file tree in order of keys, a file is a
+        // dictionary of the empty key
+        bool WalkFileTree(const BenNode& node, std::vector<TreeFile> *files)
+        {
+            if (!node.IsDictionary())
+                return false;
+
+            for (BenNode key = node.First(); key.IsValid(); key = key.Next().Next())
+            {
+                BenNode value = key.Next();
+                if (key.GetStringLength() > 0)
+                {
+                    if (!WalkFileTree(value, files))
+                        return false;
+                    continue;
+                }
 
-            std::vector<BenString *> vs;
-            std::for_each(vl.begin(), vl.end(),
-                std::bind2nd(
-                    std::mem_fun(&BenList::AllElementPtr<BenString>), &vs));
+                if (!value.IsDictionary())
+                    return false;
+                BenNode length = value.FindInteger("length");
+                BenNode root = value.FindString("pieces root");
+                if (!length.IsValid() || length.GetInteger() < 0)
+                    return false;
 
-            std::transform(vs.begin(), vs.end(),
-                std::back_inserter(*announce),
-                    std::mem_fun(&BenString::std_string));
+                TreeFile file = { length.GetInteger(), 0 };
+                if (file.length > 0)
+                {
+                    if (!root.IsValid() || root.GetStringLength() != 32)
+                        return false;
+                    file.root = root.GetStringData();
+                }
+                files->push_back(file);
+            }
+            return true;
         }
-        else
+
+        // free the spare capacity of the tables
+        template<typename Container>
+        void ShrinkToFit(Container& container)
         {
-            announce->push_back(ann_->std_string());
+            Container(container).swap(container);
         }
+
+    } // unnamed namespace
+
+    MetainfoFile::MetainfoFile(const char *filepath)
+        : pieces_offset_(0),
+          pieces_count_(0),
+          piece_length_(0),
+          single_file_(false),
+          private_(false),
+          length_(0)
+    {
+        // the mapping is released after load, a task holds only the
+        // compact tables of its torrent
+        BitMappedFile file(filepath);
+        Load(file.GetData(), file.GetSize(), filepath);
+    }
+
+    MetainfoFile::MetainfoFile(const char *data, std::size_t size)
+        : pieces_offset_(0),
+          pieces_count_(0),
+          piece_length_(0),
+          single_file_(false),
+          private_(false),
+          length_(0)
+    {
+        Load(data, size, "memory data");
+    }
+
+    void MetainfoFile::GetAnnounce(std::vector<std::string> *announce) const
+    {
+        assert(announce);
+        for (std::size_t i = 0; i < announce_tiers_.size(); ++i)
+            announce->insert(announce->end(),
+                    announce_tiers_[i].begin(), announce_tiers_[i].end());
+    }
+
+    void MetainfoFile::GetAnnounceTiers(std::vector<std::vector<std::string> > *tiers) const
+    {
+        assert(tiers);
+        tiers->insert(tiers->end(), announce_tiers_.begin(), announce_tiers_.end());
     }
 
     bool MetainfoFile::IsSingleFile() const
     {
-        BenInteger *length = infodic_->ValueBenTypeCast<BenInteger>("length");
-        return length != 0;
+        return single_file_;
+    }
+
+    bool MetainfoFile::IsPrivate() const
+    {
+        return private_;
     }
 
     std::string MetainfoFile::Name() const
     {
-        BenString *name = infodic_->ValueBenTypeCast<BenString>("name");
-        if (name)
-            return name->std_string();
-        return std::string();
+        return GetComponent(0);
     }
 
     std::size_t MetainfoFile::PieceLength() const
     {
-        BenInteger *pl = infodic_->ValueBenTypeCast<BenInteger>("piece length");
-        if (pl)
-            return static_cast<std::size_t>(pl->GetValue());
-        return 0;
+        return piece_length_;
     }
 
     std::size_t MetainfoFile::PiecesCount() const
     {
-        return pieces_->length() / 20;
+        return pieces_count_;
     }
 
     Sha1Value MetainfoFile::GetPieceSha1(std::size_t index) const
     {
-        const char *data = pieces_->data() + index * 20;
+        assert(index < pieces_count_);
+        const char *data = &info_[pieces_offset_ + index * 20];
         const unsigned *sha1 = reinterpret_cast<const unsigned *>(data);
         return Sha1Value(sha1);
     }
 
     long long MetainfoFile::Length() const
     {
-        BenInteger *length = infodic_->ValueBenTypeCast<BenInteger>("length");
-        if (length)
-            return length->GetValue();
-        return 0;
+        return length_;
+    }
+
+    std::size_t MetainfoFile::GetFileCount() const
+    {
+        return files_.size();
+    }
+
+    long long MetainfoFile::GetFileLength(std::size_t index) const
+    {
+        assert(index < files_.size());
+        return files_[index].length;
+    }
+
+    void MetainfoFile::GetFilePath(std::size_t index, std::vector<std::string> *path) const
+    {
+        assert(index < files_.size() && path);
+        const CompactFile& file = files_[index];
+        path->reserve(path->size() + file.component_count);
+        for (unsigned int i = 0; i < file.component_count; ++i)
+            path->push_back(GetComponent(path_components_[file.first_component + i]));
+    }
+
+    std::string MetainfoFile::GetFilePath(std::size_t index, char separator) const
+    {
+        assert(index < files_.size());
+        const CompactFile& file = files_[index];
+        std::string path;
+        for (unsigned int i = 0; i < file.component_count; ++i)
+        {
+            if (i > 0)
+                path.push_back(separator);
+            unsigned int component = path_components_[file.first_component + i];
+            path.append(names_, name_offsets_[component],
+                    name_offsets_[component + 1] - name_offsets_[component]);
+        }
+        return path;
     }
 
     void MetainfoFile::GetFiles(std::vector<FileInfo> *files) const
     {
-        if (IsSingleFile())
-            GetTheFile(files);
-        else
-            GetFileList(files);
+        assert(files);
+        files->reserve(files->size() + files_.size());
+        for (std::size_t i = 0; i < files_.size(); ++i)
+        {
+            files->push_back(FileInfo());
+            files->back().length = files_[i].length;
+            GetFilePath(i, &files->back().path);
+        }
     }
 
     std::pair<const char *, const char *> MetainfoFile::GetRawInfoValue() const
     {
-        const char *begin = metafilebuf_.iter_data(infodic_->GetSrcBufBegin());
-        const char *end = metafilebuf_.iter_data(infodic_->GetSrcBufEnd());
-        return std::make_pair(begin, end);
+        if (info_.empty())
+            return std::make_pair(static_cast<const char *>(0), static_cast<const char *>(0));
+        return std::make_pair(&info_[0], &info_[0] + info_.size());
     }
 
-    bool MetainfoFile::PrepareBasicData()
+    bool MetainfoFile::HasMerkleTrees() const
     {
-        BenDictionary *dic = dynamic_cast<BenDictionary *>(metainfo_.get());
-        if (!dic) return false;
+        return !merkle_files_.empty();
+    }
 
-        ann_ = dic->ValueBenTypeCast<BenString>("announce");
-        if (!ann_) return false;
+    bool MetainfoFile::GetMerklePiece(std::size_t piece_index, MerklePiece *piece) const
+    {
+        assert(piece);
+        if (piece_index >= pieces_count_)
+            return false;
 
-        annlist_ = dic->ValueBenTypeCast<BenList>("announce-list");
+        // the last file begins not after the piece
+        std::size_t low = 0;
+        std::size_t high = merkle_files_.size();
+        while (low < high)
+        {
+            std::size_t middle = low + (high - low) / 2;
+            if (merkle_files_[middle].first_piece <= piece_index)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (low == 0)
+            return false;
 
-        infodic_ = dic->ValueBenTypeCast<BenDictionary>("info");
-        if (!infodic_) return false;
+        const CompactMerkleFile& file = merkle_files_[low - 1];
+        std::size_t piece_count = GetMerklePieceCount(file);
+        std::size_t piece_of_file = piece_index - file.first_piece;
+        if (piece_of_file >= piece_count)
+            return false;
 
-        pieces_ = infodic_->ValueBenTypeCast<BenString>("pieces");
-        if (!pieces_) return false;
+        long long left = file.length - static_cast<long long>(piece_of_file) * piece_length_;
+        piece->file_index = low - 1;
+        piece->pieces_root = GetMerkleHash(file.hash_offset);
+        piece->data_length = left < static_cast<long long>(piece_length_) ?
+            static_cast<std::size_t>(left) : piece_length_;
 
-        if (pieces_->length() % 20) return false;
+        if (piece_count == 1)
+        {
+            piece->hash = piece->pieces_root;
+            piece->first_leaf = 0;
+            piece->leaf_count = BitMerkleTree::RoundUpPower2(
+                    BitMerkleTree::BlockCount(file.length));
+        }
+        else
+        {
+            piece->hash = GetMerkleHash(file.hash_offset + 32 * (1 + piece_of_file));
+            piece->leaf_count = piece_length_ / BitMerkleTree::block_size;
+            piece->first_leaf = piece_of_file * piece->leaf_count;
+        }
+        return true;
+    }
 
+    std::size_t MetainfoFile::GetMerkleFileCount() const
+    {
+        return merkle_files_.size();
+    }
+
+    bool MetainfoFile::GetMerkleFile(std::size_t file_index, MerkleFile *file) const
+    {
+        assert(file);
+        if (file_index >= merkle_files_.size())
+            return false;
+
+        const CompactMerkleFile& compact = merkle_files_[file_index];
+        file->pieces_root = GetMerkleHash(compact.hash_offset);
+        file->length = compact.length;
+        file->first_piece = compact.first_piece;
+        file->piece_count = GetMerklePieceCount(compact);
         return true;
     }
 
-    void MetainfoFile::GetTheFile(std::vector<FileInfo> *files) const
+    void MetainfoFile::FindMerkleFiles(const Sha256Value& pieces_root,
+                                       std::vector<std::size_t> *file_indexes) const
     {
-        assert(files);
-        FileInfo the_file;
-        the_file.length = Length();
-        the_file.path.push_back(Name());
-        files->push_back(the_file);
+        assert(file_indexes);
+        std::vector<unsigned int>::const_iterator it = std::lower_bound(
+                merkle_roots_.begin(), merkle_roots_.end(), pieces_root, RootLess(*this));
+        for (; it != merkle_roots_.end() &&
+                GetMerkleHash(merkle_files_[*it].hash_offset) == pieces_root; ++it)
+            file_indexes->push_back(*it);
     }
 
-    void MetainfoFile::GetFileList(std::vector<FileInfo> *files) const
+    bool MetainfoFile::GetPieceLayer(std::size_t file_index,
+                                     std::vector<Sha256Value> *layer) const
     {
-        assert(files);
-        BenList *fs = infodic_->ValueBenTypeCast<BenList>("files");
-        if (!fs)
+        assert(layer);
+        if (file_index >= merkle_files_.size())
+            return false;
+
+        const CompactMerkleFile& compact = merkle_files_[file_index];
+        std::size_t piece_count = GetMerklePieceCount(compact);
+        if (piece_count == 1)
+        {
+            layer->push_back(GetMerkleHash(compact.hash_offset));
+            return true;
+        }
+
+        layer->reserve(layer->size() + piece_count);
+        for (std::size_t i = 0; i < piece_count; ++i)
+            layer->push_back(GetMerkleHash(compact.hash_offset + 32 * (1 + i)));
+        return true;
+    }
+
+    bool MetainfoFile::RootLess::operator () (unsigned int left,
+                                              unsigned int right) const
+    {
+        const std::vector<char>& hashes = metainfo.merkle_hashes_;
+        return memcmp(&hashes[metainfo.merkle_files_[left].hash_offset],
+                &hashes[metainfo.merkle_files_[right].hash_offset], 32) < 0;
+    }
+
+    bool MetainfoFile::RootLess::operator () (unsigned int left,
+                                              const Sha256Value& right) const
+    {
+        const std::vector<char>& hashes = metainfo.merkle_hashes_;
+        return memcmp(&hashes[metainfo.merkle_files_[left].hash_offset],
+                right.GetData(), 32) < 0;
+    }
+
+    void MetainfoFile::Load(const char *data, std::size_t size, const std::string& source)
+    {
+        // tokens of the decoder are freed when the tables are ready
+        BenDecoder decoder;
+        if (size == 0 || !decoder.Decode(data, size) ||
+            !PrepareBasicData(decoder.GetRoot()))
+        {
+            std::string info = std::string("invalid torrent file: ") + source;
+            throw MetainfoFileExeception(info);
+        }
+    }
+
+    bool MetainfoFile::PrepareBasicData(const BenNode& root)
+    {
+        if (!root.IsDictionary()) return false;
+
+        BenNode info = root.FindDictionary("info");
+        if (!info.IsValid()) return false;
+
+        BenNode pieces = info.FindString("pieces");
+        if (!pieces.IsValid()) return false;
+
+        if (pieces.GetStringLength() % 20) return false;
+
+        info_.assign(info.GetRawBegin(), info.GetRawEnd());
+        pieces_offset_ = pieces.GetStringData() - info.GetRawBegin();
+        pieces_count_ = pieces.GetStringLength() / 20;
+        piece_length_ = static_cast<std::size_t>(
+                info.FindInteger("piece length").GetInteger());
+
+        BenNode length = info.FindInteger("length");
+        single_file_ = length.IsValid();
+        length_ = length.GetInteger();
+        private_ = info.FindInteger("private").GetInteger() == 1;
+
+        PrepareAnnounceTiers(root);
+
+        std::vector<bool> pad_files;
+        PrepareFiles(info, &pad_files);
+        return PrepareMerkleTrees(root, info, pad_files);
+    }
+
+    void MetainfoFile::PrepareAnnounceTiers(const BenNode& root)
+    {
+        // announce is optional, a torrent of magnet link may have no
+        // tracker
+        BenNode annlist = root.FindList("announce-list");
+        if (annlist.IsValid())
+        {
+            for (BenNode tier = annlist.First(); tier.IsValid(); tier = tier.Next())
+            {
+                std::vector<std::string> urls;
+                for (BenNode url = tier.First(); url.IsValid(); url = url.Next())
+                {
+                    if (url.IsString())
+                        urls.push_back(url.GetString());
+                }
+
+                if (!urls.empty())
+                    announce_tiers_.push_back(urls);
+            }
             return ;
-        files->reserve(fs->size());
+        }
+
+        BenNode ann = root.FindString("announce");
+        if (ann.IsValid())
+            announce_tiers_.push_back(std::vector<std::string>(1, ann.GetString()));
+    }
+
+    void MetainfoFile::PrepareFiles(const BenNode& info, std::vector<bool> *pad_files)
+    {
+        InternedNames interned;
+        name_offsets_.push_back(0);
+        unsigned int name = InternName(info.FindString("name").GetString(),
+                &interned, &names_, &name_offsets_);
 
-        std::string base_path = Name();
-        std::vector<BenDictionary *> vd;
-        fs->AllElementPtr(&vd);
-        for (std::vector<BenDictionary *>::iterator it = vd.begin(); it != vd.end(); ++it)
+        if (single_file_)
         {
-            BenDictionary *file = *it;
-            BenInteger *len = file->ValueBenTypeCast<BenInteger>("length");
-            if (!len) continue;
+            CompactFile the_file = { length_, 0, 1 };
+            path_components_.push_back(name);
+            files_.push_back(the_file);
+            pad_files->push_back(false);
+            return ;
+        }
+
+        BenNode fs = info.FindList("files");
+        if (!fs.IsValid())
+            return ;
+
+        files_.reserve(fs.Size());
+        for (BenNode file = fs.First(); file.IsValid(); file = file.Next())
+        {
+            BenNode len = file.FindInteger("length");
+            if (!len.IsValid()) continue;
+
+            BenNode pathlist = file.FindList("path");
+            if (!pathlist.IsValid()) continue;
+
+            CompactFile compact_file = { len.GetInteger(),
+                static_cast<unsigned int>(path_components_.size()), 1 };
+            path_components_.push_back(name);
+            for (BenNode path = pathlist.First(); path.IsValid(); path = path.Next())
+            {
+                if (!path.IsString()) continue;
+
+                // directories are shared by files, names of files are
+                // seldom repeated and are not looked up
+                if (path.Next().IsValid())
+                {
+                    path_components_.push_back(InternName(path.GetString(),
+                                &interned, &names_, &name_offsets_));
+                }
+                else
+                {
+                    path_components_.push_back(
+                            static_cast<unsigned int>(name_offsets_.size() - 1));
+                    names_.append(path.GetStringData(), path.GetStringLength());
+                    name_offsets_.push_back(static_cast<unsigned int>(names_.size()));
+                }
+                ++compact_file.component_count;
+            }
+
+            files_.push_back(compact_file);
+
+            // pad files of BEP 47 align files to pieces
+            BenNode attr = file.FindString("attr");
+            pad_files->push_back(attr.IsValid() && memchr(attr.GetStringData(),
+                        'p', attr.GetStringLength()) != 0);
+        }
+
+        ShrinkToFit(names_);
+        ShrinkToFit(name_offsets_);
+        ShrinkToFit(path_components_);
+    }
+
+    bool MetainfoFile::PrepareMerkleTrees(const BenNode& root, const BenNode& info,
+                                          const std::vector<bool>& pad_files)
+    {
+        if (info.FindInteger("meta version").GetInteger() != 2)
+            return true;
+
+        // piece layers are out of the info, a torrent from a magnet link
+        // has no piece layers and it is a v1 torrent for us
+        BenNode layers = root.FindDictionary("piece layers");
+        if (!layers.IsValid())
+            return true;
+
+        std::vector<TreeFile> tree_files;
+        if (!WalkFileTree(info.FindDictionary("file tree"), &tree_files))
+            return false;
 
-            FileInfo file_info;
-            file_info.length = len->GetValue();
+        std::size_t leaves_per_piece = piece_length_ / BitMerkleTree::block_size;
+        if (leaves_per_piece == 0 ||
+            BitMerkleTree::RoundUpPower2(leaves_per_piece) != leaves_per_piece ||
+            leaves_per_piece * BitMerkleTree::block_size != piece_length_)
+            return false;
 
-            BenList *pathlist = file->ValueBenTypeCast<BenList>("path");
-            if (!pathlist) continue;
+        // files of the tree are the v1 files without pad files in the
+        // same order, and every file which is not empty begins at a piece
+        std::size_t tree_index = 0;
+        long long offset = 0;
+        for (std::size_t i = 0; i < files_.size(); ++i)
+        {
+            long long length = files_[i].length;
+            if (pad_files[i])
+            {
+                offset += length;
+                continue;
+            }
+
+            if (tree_index >= tree_files.size() ||
+                tree_files[tree_index].length != length)
+                return false;
+            const TreeFile& tree_file = tree_files[tree_index++];
+            if (length == 0)
+                continue;
+            if (offset % piece_length_)
+                return false;
+
+            CompactMerkleFile merkle_file = { length,
+                static_cast<std::size_t>(offset / piece_length_),
+                merkle_hashes_.size() };
+            merkle_hashes_.insert(merkle_hashes_.end(),
+                    tree_file.root, tree_file.root + 32);
 
-            // reserve for base path and file path
-            file_info.path.reserve(pathlist->size() + 1);
-            file_info.path.push_back(base_path);
+            // the piece layer of a file of more than one piece must be
+            // the layer of its root
+            std::size_t piece_count = GetMerklePieceCount(merkle_file);
+            if (piece_count > 1)
+            {
+                BenNode layer = layers.FindString(std::string(tree_file.root, 32));
+                if (!layer.IsValid() || layer.GetStringLength() != piece_count * 32)
+                    return false;
 
-            std::vector<BenString *> vs;
-            pathlist->AllElementPtr(&vs);
+                const char *data = layer.GetStringData();
+                std::vector<Sha256Value> hashes;
+                hashes.reserve(piece_count);
+                for (std::size_t p = 0; p < piece_count; ++p)
+                    hashes.push_back(StreamToSha256Value(data + p * 32));
 
-            std::transform(vs.begin(), vs.end(),
-                    std::back_inserter(file_info.path),
-                    std::mem_fun(&BenString::std_string));
+                Sha256Value pieces_root = BitMerkleTree::Root(&hashes[0], piece_count,
+                        BitMerkleTree::RoundUpPower2(piece_count),
+                        BitMerkleTree::Log2(leaves_per_piece));
+                if (pieces_root != StreamToSha256Value(tree_file.root))
+                    return false;
 
-            files->push_back(file_info);
+                merkle_hashes_.insert(merkle_hashes_.end(), data, data + piece_count * 32);
+            }
+
+            merkle_files_.push_back(merkle_file);
+            offset += length;
         }
+
+        if (tree_index != tree_files.size())
+            return false;
+
+        merkle_roots_.reserve(merkle_files_.size());
+        for (std::size_t i = 0; i < merkle_files_.size(); ++i)
+            merkle_roots_.push_back(static_cast<unsigned int>(i));
+        std::sort(merkle_roots_.begin(), merkle_roots_.end(), RootLess(*this));
+
+        ShrinkToFit(merkle_hashes_);
+        ShrinkToFit(merkle_files_);
+        return true;
+    }
+
+    std::size_t MetainfoFile::GetMerklePieceCount(const CompactMerkleFile& file) const
+    {
+        return static_cast<std::size_t>((file.length + piece_length_ - 1) / piece_length_);
+    }
+
+    Sha256Value MetainfoFile::GetMerkleHash(std::size_t offset) const
+    {
+        assert(offset + 32 <= merkle_hashes_.size());
+        return StreamToSha256Value(&merkle_hashes_[offset]);
+    }
+
+    std::string MetainfoFile::GetComponent(unsigned int component) const
+    {
+        assert(component + 1 < name_offsets_.size());
+        return names_.substr(name_offsets_[component],
+                name_offsets_[component + 1] - name_offsets_[component]);
     }
 
 } // namespace bentypes
@@ -1,10 +1,9 @@
 #ifndef METAINFO_FILE_H
 #define METAINFO_FILE_H
 
-#include "BenTypes.h"
 #include "../../base/BaseTypes.h"
 #include "../../sha1/Sha1Value.h"
-#include <memory>
+#include "../../sha256/Sha256Value.h"
 #include <string>
 #include <utility>
 #include <vector>
@@ -13,7 +12,11 @@ namespace bitwave {
 namespace core {
 namespace bentypes {
 
-    // All strings encoded by UTF-8 in this class
+    class BenNode;
+
+    // All strings encoded by UTF-8 in this class. It is immutable and
+    // compact, the torrent file is mapped and decoded once, then only the
+    // raw info value and tables of announce, pieces and files are kept
     class MetainfoFile : private NotCopyable
     {
     public:
@@ -23,12 +26,49 @@ namespace bentypes {
             std::vector<std::string> path;
         };
 
+        // a file of the file tree of BEP 52, its pieces are the v1 pieces
+        // [first_piece, first_piece + piece_count) of the hybrid torrent
+        struct MerkleFile
+        {
+            Sha256Value pieces_root;
+            long long length;
+            std::size_t first_piece;
+            std::size_t piece_count;
+        };
+
+        // a v1 piece in the merkle tree of its file
+        struct MerklePiece
+        {
+            // index of the file in the file trees, and its root
+            std::size_t file_index;
+            Sha256Value pieces_root;
+            // hash of the piece layer, it is the root when the file has
+            // one piece
+            Sha256Value hash;
+            // leaves under hash are [first_leaf, first_leaf + leaf_count)
+            // of the tree, leaf_count is a power of 2
+            std::size_t first_leaf;
+            std::size_t leaf_count;
+            // bytes of the file in the piece, the rest is padding
+            std::size_t data_length;
+        };
+
         explicit MetainfoFile(const char *filepath);
 
+        // load a torrent in memory, data is not used after construct
+        MetainfoFile(const char *data, std::size_t size);
+
         void GetAnnounce(std::vector<std::string> *announce) const;
 
+        // tiers of announce-list (BEP 12), it is one tier of announce when
+        // the torrent has no announce-list
+        void GetAnnounceTiers(std::vector<std::vector<std::string> > *tiers) const;
+
         bool IsSingleFile() const;
 
+        // private torrent (BEP 27), peers come from trackers only
+        bool IsPrivate() const;
+
         // return file name when IsSingleFile is true, otherwise
         // return a directory name, this just advisory.
         std::string Name() const;
@@ -38,22 +78,111 @@ namespace bentypes {
         Sha1Value GetPieceSha1(std::size_t index) const;
 
         long long Length() const;
+
+        // files of the torrent, path of a file begins with Name()
+        std::size_t GetFileCount() const;
+        long long GetFileLength(std::size_t index) const;
+        void GetFilePath(std::size_t index, std::vector<std::string> *path) const;
+        // components of the path joined by separator
+        std::string GetFilePath(std::size_t index, char separator) const;
+
+        // build all files with their paths, prefer the accessors above
         void GetFiles(std::vector<FileInfo> *files) const;
 
         // return raw info value buffer, first is begin, second is end
         std::pair<const char *, const char *> GetRawInfoValue() const;
 
+        // a hybrid torrent of BEP 52 with piece layers, files have merkle
+        // trees of SHA-256 besides the v1 pieces, and every file begins at
+        // a piece by pad files. A torrent from a magnet link has no piece
+        // layers, then it is checked by v1 pieces only
+        bool HasMerkleTrees() const;
+
+        // return false when the piece is not in a file tree
+        bool GetMerklePiece(std::size_t piece_index, MerklePiece *piece) const;
+
+        // files of the file trees in order of pieces
+        std::size_t GetMerkleFileCount() const;
+        bool GetMerkleFile(std::size_t file_index, MerkleFile *file) const;
+
+        // files of the same content have the same root, indexes of all
+        // files of the root are appended
+        void FindMerkleFiles(const Sha256Value& pieces_root,
+                             std::vector<std::size_t> *file_indexes) const;
+
+        // hashes of the piece layer of the file, it is the root when the
+        // file has one piece
+        bool GetPieceLayer(std::size_t file_index,
+                           std::vector<Sha256Value> *layer) const;
+
     private:
-        bool PrepareBasicData();
-        void GetTheFile(std::vector<FileInfo> *files) const;
-        void GetFileList(std::vector<FileInfo> *files) const;
-
-        BenTypesStreamBuf metafilebuf_;
-        std::tr1::shared_ptr<BenType> metainfo_;
-        BenString *ann_;
-        BenList *annlist_;
-        BenDictionary *infodic_;
-        BenString *pieces_;
+        struct CompactFile
+        {
+            long long length;
+            // path is path_components_[first, first + count)
+            unsigned int first_component;
+            unsigned int component_count;
+        };
+
+        struct CompactMerkleFile
+        {
+            long long length;
+            std::size_t first_piece;
+            // the root is at hash_offset of merkle_hashes_, the piece
+            // layer follows it when the file has more than one piece
+            std::size_t hash_offset;
+        };
+
+        // order of merkle_roots_ by the roots of the files
+        struct RootLess
+        {
+            explicit RootLess(const MetainfoFile& m)
+                : metainfo(m)
+            {
+            }
+
+            bool operator () (unsigned int left, unsigned int right) const;
+            bool operator () (unsigned int left, const Sha256Value& right) const;
+
+            const MetainfoFile& metainfo;
+        };
+
+        void Load(const char *data, std::size_t size, const std::string& source);
+        bool PrepareBasicData(const BenNode& root);
+        void PrepareAnnounceTiers(const BenNode& root);
+        void PrepareFiles(const BenNode& info, std::vector<bool> *pad_files);
+        bool PrepareMerkleTrees(const BenNode& root, const BenNode& info,
+                                const std::vector<bool>& pad_files);
+        std::size_t GetMerklePieceCount(const CompactMerkleFile& file) const;
+        Sha256Value GetMerkleHash(std::size_t offset) const;
+        std::string GetComponent(unsigned int component) const;
+
+        std::vector<std::vector<std::string> > announce_tiers_;
+
+        // raw info value, piece hashes are [pieces_offset_,
+        // pieces_offset_ + pieces_count_ * 20) of it
+        std::vector<char> info_;
+        std::size_t pieces_offset_;
+        std::size_t pieces_count_;
+        std::size_t piece_length_;
+
+        bool single_file_;
+        bool private_;
+        long long length_;
+
+        // every distinct directory is stored once, component i is
+        // names_[name_offsets_[i], name_offsets_[i + 1]), component 0 is
+        // the name of the torrent
+        std::string names_;
+        std::vector<unsigned int> name_offsets_;
+        std::vector<unsigned int> path_components_;
+        std::vector<CompactFile> files_;
+
+        // files of the file trees in order of pieces, and their indexes
+        // in order of roots
+        std::vector<char> merkle_hashes_;
+        std::vector<CompactMerkleFile> merkle_files_;
+        std::vector<unsigned int> merkle_roots_;
     };
 
 } // namespace bentypes
@@ -1,53 +1,49 @@
 #include "TrackerResponse.h"
+#include "../BitException.h"
 #include "../../net/NetHelper.h"
+#include "../../sha1/NetSha1Value.h"
 
 namespace bitwave {
 namespace core {
 namespace bentypes {
 
     TrackerResponse::TrackerResponse(const char *data, std::size_t size)
-        : response_buffer_(data, size),
-          ben_dic_(GetBenObject(response_buffer_)),
-          response_dic_(0),
-          failure_reason_(0),
-          interval_(0),
-          peers_(0)
     {
-        response_dic_ = dynamic_cast<BenDictionary *>(ben_dic_.get());
-        if (!response_dic_) return ;
-        failure_reason_ = response_dic_->ValueBenTypeCast<BenString>("failure reason");
-        interval_ = response_dic_->ValueBenTypeCast<BenInteger>("interval");
-        peers_ = response_dic_->ValueBenTypeCast<BenString>("peers");
+        if (!decoder_.Decode(data, size))
+            throw BenTypeException(INVALIDATE_NOBENTYPE);
+
+        BenNode response = decoder_.GetRoot();
+        failure_reason_ = response.FindString("failure reason");
+        interval_ = response.FindInteger("interval");
+        peers_ = response.FindString("peers");
     }
 
     bool TrackerResponse::IsFailure() const
     {
-        return failure_reason_ != 0;
+        return failure_reason_.IsValid();
     }
 
     std::string TrackerResponse::GetFailureReason() const
     {
-        if (failure_reason_)
-            return failure_reason_->std_string();
+        if (failure_reason_.IsValid())
+            return failure_reason_.GetString();
         return std::string("not failure");
     }
 
     int TrackerResponse::GetInterval() const
     {
-        if (interval_)
-            return static_cast<int>(interval_->GetValue());
-        return 0;
+        return static_cast<int>(interval_.GetInteger());
     }
 
     void TrackerResponse::GetPeerInfo(std::vector<PeerInfo>& peers_info) const
     {
-        if (!peers_)
+        if (!peers_.IsValid())
             return ;
 
-        std::size_t number = peers_->length() / 6;
+        std::size_t number = peers_.GetStringLength() / 6;
         peers_info.reserve(number);
 
-        const char *data = peers_->data();
+        const char *data = peers_.GetStringData();
         for (std::size_t i = 0; i < number; ++i)
         {
             PeerInfo info;
@@ -60,6 +56,35 @@ namespace bentypes {
         }
     }
 
+    ScrapeResponse::ScrapeResponse(const char *data, std::size_t size)
+    {
+        if (!decoder_.Decode(data, size))
+            throw BenTypeException(INVALIDATE_NOBENTYPE);
+
+        files_ = decoder_.GetRoot().FindDictionary("files");
+    }
+
+    bool ScrapeResponse::IsFailure() const
+    {
+        return !files_.IsValid();
+    }
+
+    void ScrapeResponse::GetFilesInfo(FilesInfo& files_info) const
+    {
+        for (BenNode hash = files_.First(); hash.IsValid(); hash = hash.Next().Next())
+        {
+            BenNode file = hash.Next();
+            if (hash.GetStringLength() != 20 || !file.IsDictionary())
+                continue;
+
+            FileInfo info;
+            info.complete = static_cast<int>(file.FindInteger("complete").GetInteger());
+            info.downloaded = static_cast<int>(file.FindInteger("downloaded").GetInteger());
+            info.incomplete = static_cast<int>(file.FindInteger("incomplete").GetInteger());
+            files_info[NetStreamToSha1Value(hash.GetStringData())] = info;
+        }
+    }
+
 } // namespace bentypes
 } // namespace core
 } // namespace bitwave
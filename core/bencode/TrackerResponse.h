@@ -2,7 +2,9 @@
 #define TRACKER_RESPONSE_H
 
 #include "../../base/BaseTypes.h"
-#include "BenTypes.h"
+#include "../../sha1/Sha1Value.h"
+#include "BenDecoder.h"
+#include <map>
 #include <string>
 #include <vector>
 
@@ -10,6 +12,9 @@ namespace bitwave {
 namespace core {
 namespace bentypes {
 
+    // a tracker response decoded from a borrowed buffer, the data must be
+    // valid while the response is used, it throws BenTypeException when
+    // the data is not bencoded
     class TrackerResponse : private NotCopyable
     {
     public:
@@ -27,12 +32,34 @@ namespace bentypes {
         void GetPeerInfo(std::vector<PeerInfo>& peers_info) const;
 
     private:
-        BenTypesStreamBuf response_buffer_;
-        std::tr1::shared_ptr<BenType> ben_dic_;
-        BenDictionary *response_dic_;
-        BenString *failure_reason_;
-        BenInteger *interval_;
-        BenString *peers_;
+        BenDecoder decoder_;
+        BenNode failure_reason_;
+        BenNode interval_;
+        BenNode peers_;
+    };
+
+    // response of a scrape request, files dictionary is keyed by info hash,
+    // it borrows the data as TrackerResponse
+    class ScrapeResponse : private NotCopyable
+    {
+    public:
+        struct FileInfo
+        {
+            int complete;
+            int downloaded;
+            int incomplete;
+        };
+
+        typedef std::map<Sha1Value, FileInfo> FilesInfo;
+
+        ScrapeResponse(const char *data, std::size_t size);
+
+        bool IsFailure() const;
+        void GetFilesInfo(FilesInfo& files_info) const;
+
+    private:
+        BenDecoder decoder_;
+        BenNode files_;
     };
 
 } // namespace bentypes
@@ -0,0 +1,218 @@
+#include "DhtLookup.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    namespace {
+
+        struct CandidateCloser
+        {
+            explicit CandidateCloser(const NodeId& t)
+                : target(t)
+            {
+            }
+
+            bool operator () (const Lookup::Candidate& left,
+                              const Lookup::Candidate& right) const
+            {
+                if (left.has_id != right.has_id)
+                    return left.has_id;
+                if (!left.has_id)
+                    return false;
+                return CloserTo(target, left.node.id, right.node.id);
+            }
+
+            const NodeId& target;
+        };
+
+    } // unnamed namespace
+
+    Lookup::Lookup(int method, const NodeId& target, unsigned short announce_port,
+                   const PeerCallback& peer_callback,
+                   const DoneCallback& done_callback)
+        : method_(method),
+          target_(target),
+          announce_port_(announce_port),
+          peer_callback_(peer_callback),
+          done_callback_(done_callback),
+          in_flight_(0),
+          query_count_(0),
+          finished_(false)
+    {
+        assert(method == Message::FIND_NODE || method == Message::GET_PEERS);
+    }
+
+    void Lookup::AddCandidate(const NodeEntry& node, bool has_id)
+    {
+        Candidates::iterator it = Find(node.ip, node.port);
+        if (it != candidates_.end())
+            return ;
+
+        // a full candidate list only accepts closer nodes
+        if (candidates_.size() >= max_candidates)
+        {
+            Candidate& last = candidates_.back();
+            if (!has_id || last.state != Candidate::NEW ||
+                (last.has_id && !CloserTo(target_, node.id, last.node.id)))
+                return ;
+            candidates_.pop_back();
+        }
+
+        Candidate candidate;
+        candidate.node = node;
+        candidate.has_id = has_id;
+
+        // insert in order
+        CandidateCloser closer(target_);
+        candidates_.insert(std::upper_bound(candidates_.begin(),
+                    candidates_.end(), candidate, closer), candidate);
+    }
+
+    bool Lookup::NextQuery(NodeEntry *node)
+    {
+        assert(node);
+        if (in_flight_ >= alpha)
+            return false;
+
+        std::size_t count = 0;
+        for (Candidates::iterator it = candidates_.begin();
+             it != candidates_.end() && count < k; ++it)
+        {
+            if (it->state == Candidate::FAILED)
+                continue;
+
+            ++count;
+            if (it->state == Candidate::NEW)
+            {
+                it->state = Candidate::QUERIED;
+                *node = it->node;
+                ++in_flight_;
+                ++query_count_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Lookup::OnResponse(unsigned long ip, unsigned short port,
+                            const Message& response)
+    {
+        Candidates::iterator it = Find(ip, port);
+        if (it == candidates_.end() ||
+            (it->state != Candidate::QUERIED && it->state != Candidate::SLOW))
+            return ;
+
+        if (it->state == Candidate::QUERIED)
+            --in_flight_;
+        it->state = Candidate::RESPONDED;
+        it->token = response.token;
+        if (!it->has_id)
+        {
+            // the id of a bootstrap node is known now
+            it->has_id = true;
+            it->node.id = response.id;
+            SortCandidates();
+        }
+
+        for (std::size_t i = 0; i < response.nodes.size(); ++i)
+            AddCandidate(response.nodes[i], true);
+
+        if (peer_callback_)
+        {
+            for (std::size_t i = 0; i < response.values.size(); ++i)
+            {
+                const unsigned char *value =
+                    reinterpret_cast<const unsigned char *>(response.values[i].data());
+                unsigned long peer_ip = (static_cast<unsigned long>(value[0]) << 24) |
+                    (static_cast<unsigned long>(value[1]) << 16) |
+                    (static_cast<unsigned long>(value[2]) << 8) | value[3];
+                unsigned short peer_port = static_cast<unsigned short>(
+                        (value[4] << 8) | value[5]);
+                if (peer_ip != 0 && peer_port != 0)
+                    peer_callback_(peer_ip, peer_port);
+            }
+        }
+    }
+
+    void Lookup::OnSlow(unsigned long ip, unsigned short port)
+    {
+        Candidates::iterator it = Find(ip, port);
+        if (it == candidates_.end() || it->state != Candidate::QUERIED)
+            return ;
+
+        --in_flight_;
+        it->state = Candidate::SLOW;
+    }
+
+    void Lookup::OnFailed(unsigned long ip, unsigned short port)
+    {
+        Candidates::iterator it = Find(ip, port);
+        if (it == candidates_.end() ||
+            (it->state != Candidate::QUERIED && it->state != Candidate::SLOW))
+            return ;
+
+        if (it->state == Candidate::QUERIED)
+            --in_flight_;
+        it->state = Candidate::FAILED;
+    }
+
+    bool Lookup::IsDone() const
+    {
+        if (in_flight_ > 0)
+            return false;
+
+        std::size_t count = 0;
+        for (Candidates::const_iterator it = candidates_.begin();
+             it != candidates_.end() && count < k; ++it)
+        {
+            if (it->state == Candidate::FAILED)
+                continue;
+            if (it->state == Candidate::NEW)
+                return false;
+            ++count;
+        }
+        return true;
+    }
+
+    void Lookup::GetAnnounceNodes(std::vector<Candidate>& nodes) const
+    {
+        nodes.clear();
+        for (Candidates::const_iterator it = candidates_.begin();
+             it != candidates_.end() && nodes.size() < k; ++it)
+        {
+            if (it->state == Candidate::RESPONDED && !it->token.empty())
+                nodes.push_back(*it);
+        }
+    }
+
+    void Lookup::Done()
+    {
+        finished_ = true;
+        if (done_callback_)
+            done_callback_();
+    }
+
+    Lookup::Candidates::iterator Lookup::Find(unsigned long ip,
+                                              unsigned short port)
+    {
+        for (Candidates::iterator it = candidates_.begin();
+             it != candidates_.end(); ++it)
+        {
+            if (it->node.ip == ip && it->node.port == port)
+                return it;
+        }
+        return candidates_.end();
+    }
+
+    void Lookup::SortCandidates()
+    {
+        std::stable_sort(candidates_.begin(), candidates_.end(),
+                CandidateCloser(target_));
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
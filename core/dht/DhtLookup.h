@@ -0,0 +1,117 @@
+#ifndef DHT_LOOKUP_H
+#define DHT_LOOKUP_H
+
+#include "DhtMessage.h"
+#include "DhtNodeId.h"
+#include "DhtRoutingTable.h"
+#include "../../base/BaseTypes.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // iterative find_node or get_peers lookup of kademlia. Candidates
+    // are kept in order of distance to the target, at most alpha queries
+    // are in flight, and the lookup is done when the closest k candidates
+    // which do not fail are all responded. A slow query does not count
+    // in alpha, so the lookup goes on while waiting for it. Bootstrap
+    // nodes have no id, they are after all other candidates
+    class Lookup : private NotCopyable
+    {
+    public:
+        // ip and port are in host byte order
+        typedef std::tr1::function<void (unsigned long, unsigned short)> PeerCallback;
+        typedef std::tr1::function<void ()> DoneCallback;
+
+        static const std::size_t alpha = 3;
+        static const std::size_t k = RoutingTable::bucket_size;
+        static const std::size_t max_candidates = 100;
+
+        struct Candidate
+        {
+            enum State
+            {
+                NEW,
+                QUERIED,
+                SLOW,
+                RESPONDED,
+                FAILED
+            };
+
+            Candidate()
+                : has_id(false),
+                  state(NEW)
+            {
+            }
+
+            NodeEntry node;
+            bool has_id;
+            int state;
+            // get_peers token for announce
+            std::string token;
+        };
+
+        // method is FIND_NODE or GET_PEERS, announce_port is not 0 when
+        // announce_peer to the closest nodes after get_peers
+        Lookup(int method, const NodeId& target, unsigned short announce_port,
+               const PeerCallback& peer_callback,
+               const DoneCallback& done_callback);
+
+        int GetMethod() const
+            { return method_; }
+        const NodeId& GetTarget() const
+            { return target_; }
+        unsigned short GetAnnouncePort() const
+            { return announce_port_; }
+
+        void AddCandidate(const NodeEntry& node, bool has_id);
+
+        // get next node to query, return false when no node can be
+        // queried now
+        bool NextQuery(NodeEntry *node);
+
+        void OnResponse(unsigned long ip, unsigned short port,
+                        const Message& response);
+        void OnSlow(unsigned long ip, unsigned short port);
+        void OnFailed(unsigned long ip, unsigned short port);
+
+        bool IsDone() const;
+
+        // Done is called
+        bool IsFinished() const
+            { return finished_; }
+
+        // responded nodes of the closest k, which have tokens
+        void GetAnnounceNodes(std::vector<Candidate>& nodes) const;
+
+        // count of queries sent
+        std::size_t GetQueryCount() const
+            { return query_count_; }
+
+        void Done();
+
+    private:
+        typedef std::vector<Candidate> Candidates;
+
+        Candidates::iterator Find(unsigned long ip, unsigned short port);
+        void SortCandidates();
+
+        int method_;
+        NodeId target_;
+        unsigned short announce_port_;
+        PeerCallback peer_callback_;
+        DoneCallback done_callback_;
+        Candidates candidates_;
+        std::size_t in_flight_;
+        std::size_t query_count_;
+        bool finished_;
+    };
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_LOOKUP_H
@@ -0,0 +1,325 @@
+#include "DhtMessage.h"
+#include "../BitException.h"
+#include "../bencode/BenTypes.h"
+#include <assert.h>
+#include <sstream>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    namespace {
+
+        const char *method_names[] = {
+            "ping", "find_node", "get_peers", "announce_peer"
+        };
+
+        int GetMethod(const std::string& name)
+        {
+            for (int i = Message::PING; i < Message::UNKNOWN_METHOD; ++i)
+            {
+                if (name == method_names[i])
+                    return i;
+            }
+            return Message::UNKNOWN_METHOD;
+        }
+
+        bool GetNodeId(const bentypes::BenDictionary *dict,
+                       const char *key, NodeId *id)
+        {
+            bentypes::BenString *str =
+                dict->ValueBenTypeCast<bentypes::BenString>(key);
+            if (!str || str->length() != NodeId::size)
+                return false;
+            *id = NodeId(str->data());
+            return true;
+        }
+
+        void WriteString(std::ostringstream& oss, const std::string& str)
+        {
+            oss << str.size() << ':' << str;
+        }
+
+        void WriteString(std::ostringstream& oss, const char *data, std::size_t len)
+        {
+            oss << len << ':';
+            oss.write(data, len);
+        }
+
+        void WriteKey(std::ostringstream& oss, const char *key)
+        {
+            WriteString(oss, std::string(key));
+        }
+
+    } // unnamed namespace
+
+    const char * GetMethodName(int method)
+    {
+        assert(method >= Message::PING && method < Message::UNKNOWN_METHOD);
+        return method_names[method];
+    }
+
+    bool ParseMessage(const char *data, std::size_t len, Message *message)
+    {
+        using namespace bentypes;
+        assert(message);
+        if (len == 0)
+            return false;
+
+        try
+        {
+            BenTypesStreamBuf buf(data, len);
+            std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+            BenDictionary *dict = dynamic_cast<BenDictionary *>(object.get());
+            if (!dict)
+                return false;
+
+            BenString *t = dict->ValueBenTypeCast<BenString>("t");
+            BenString *y = dict->ValueBenTypeCast<BenString>("y");
+            if (!t || !y || y->length() != 1)
+                return false;
+
+            message->transaction = t->std_string();
+
+            switch (y->c_str()[0])
+            {
+            case 'q':
+                {
+                    BenString *q = dict->ValueBenTypeCast<BenString>("q");
+                    BenDictionary *a = dict->ValueBenTypeCast<BenDictionary>("a");
+                    if (!q || !a || !GetNodeId(a, "id", &message->id))
+                        return false;
+
+                    message->type = Message::QUERY;
+                    message->method = GetMethod(q->std_string());
+
+                    switch (message->method)
+                    {
+                    case Message::FIND_NODE:
+                        if (!GetNodeId(a, "target", &message->target))
+                            return false;
+                        break;
+
+                    case Message::GET_PEERS:
+                        if (!GetNodeId(a, "info_hash", &message->info_hash))
+                            return false;
+                        break;
+
+                    case Message::ANNOUNCE_PEER:
+                        {
+                            BenInteger *port = a->ValueBenTypeCast<BenInteger>("port");
+                            BenInteger *implied = a->ValueBenTypeCast<BenInteger>("implied_port");
+                            BenString *token = a->ValueBenTypeCast<BenString>("token");
+                            if (!GetNodeId(a, "info_hash", &message->info_hash) ||
+                                !token)
+                                return false;
+
+                            message->implied_port = implied && implied->GetValue() != 0;
+                            if (!message->implied_port &&
+                                (!port || port->GetValue() <= 0 || port->GetValue() > 0xFFFF))
+                                return false;
+
+                            message->port = port ?
+                                static_cast<unsigned short>(port->GetValue()) : 0;
+                            message->token = token->std_string();
+                        }
+                        break;
+
+                    default:
+                        break;
+                    }
+                }
+                break;
+
+            case 'r':
+                {
+                    BenDictionary *r = dict->ValueBenTypeCast<BenDictionary>("r");
+                    if (!r || !GetNodeId(r, "id", &message->id))
+                        return false;
+
+                    message->type = Message::RESPONSE;
+
+                    BenString *nodes = r->ValueBenTypeCast<BenString>("nodes");
+                    if (nodes)
+                        DecodeCompactNodes(nodes->std_string(), message->nodes);
+
+                    BenString *token = r->ValueBenTypeCast<BenString>("token");
+                    if (token)
+                        message->token = token->std_string();
+
+                    BenList *values = r->ValueBenTypeCast<BenList>("values");
+                    if (values)
+                    {
+                        std::vector<BenString *> peers;
+                        values->AllElementPtr(&peers);
+                        for (std::size_t i = 0; i < peers.size(); ++i)
+                        {
+                            if (peers[i]->length() == 6)
+                                message->values.push_back(peers[i]->std_string());
+                        }
+                    }
+                }
+                break;
+
+            case 'e':
+                {
+                    BenList *e = dict->ValueBenTypeCast<BenList>("e");
+                    if (!e || e->size() != 2)
+                        return false;
+
+                    BenInteger *code = dynamic_cast<BenInteger *>(e->begin()->get());
+                    BenString *msg = dynamic_cast<BenString *>((++e->begin())->get());
+                    if (!code || !msg)
+                        return false;
+
+                    message->type = Message::ERROR_MESSAGE;
+                    message->error_code = static_cast<int>(code->GetValue());
+                    message->error_message = msg->std_string();
+                }
+                break;
+
+            default:
+                return false;
+            }
+        }
+        catch (const BenTypeException&)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::string EncodeMessage(const Message& message)
+    {
+        // keys of dictionaries are in sorted order
+        std::ostringstream oss;
+        oss << 'd';
+
+        switch (message.type)
+        {
+        case Message::QUERY:
+            WriteKey(oss, "a");
+            oss << 'd';
+            WriteKey(oss, "id");
+            WriteString(oss, message.id.GetData(), NodeId::size);
+            if (message.method == Message::ANNOUNCE_PEER)
+            {
+                WriteKey(oss, "implied_port");
+                oss << 'i' << (message.implied_port ? 1 : 0) << 'e';
+            }
+            if (message.method == Message::GET_PEERS ||
+                message.method == Message::ANNOUNCE_PEER)
+            {
+                WriteKey(oss, "info_hash");
+                WriteString(oss, message.info_hash.GetData(), NodeId::size);
+            }
+            if (message.method == Message::ANNOUNCE_PEER)
+            {
+                WriteKey(oss, "port");
+                oss << 'i' << message.port << 'e';
+            }
+            if (message.method == Message::FIND_NODE)
+            {
+                WriteKey(oss, "target");
+                WriteString(oss, message.target.GetData(), NodeId::size);
+            }
+            if (message.method == Message::ANNOUNCE_PEER)
+            {
+                WriteKey(oss, "token");
+                WriteString(oss, message.token);
+            }
+            oss << 'e';
+            WriteKey(oss, "q");
+            WriteKey(oss, GetMethodName(message.method));
+            break;
+
+        case Message::RESPONSE:
+            WriteKey(oss, "r");
+            oss << 'd';
+            WriteKey(oss, "id");
+            WriteString(oss, message.id.GetData(), NodeId::size);
+            if (!message.nodes.empty())
+            {
+                WriteKey(oss, "nodes");
+                WriteString(oss, EncodeCompactNodes(message.nodes));
+            }
+            if (!message.token.empty())
+            {
+                WriteKey(oss, "token");
+                WriteString(oss, message.token);
+            }
+            if (!message.values.empty())
+            {
+                WriteKey(oss, "values");
+                oss << 'l';
+                for (std::size_t i = 0; i < message.values.size(); ++i)
+                    WriteString(oss, message.values[i]);
+                oss << 'e';
+            }
+            oss << 'e';
+            break;
+
+        case Message::ERROR_MESSAGE:
+            WriteKey(oss, "e");
+            oss << "li" << message.error_code << 'e';
+            WriteString(oss, message.error_message);
+            oss << 'e';
+            break;
+        }
+
+        WriteKey(oss, "t");
+        WriteString(oss, message.transaction);
+        WriteKey(oss, "y");
+        WriteKey(oss, message.type == Message::QUERY ? "q" :
+                 message.type == Message::RESPONSE ? "r" : "e");
+        oss << 'e';
+        return oss.str();
+    }
+
+    void DecodeCompactNodes(const std::string& compact,
+                            std::vector<NodeEntry>& nodes)
+    {
+        const unsigned char *data =
+            reinterpret_cast<const unsigned char *>(compact.data());
+        std::size_t count = compact.size() / compact_node_size;
+        nodes.reserve(nodes.size() + count);
+
+        for (std::size_t i = 0; i < count; ++i, data += compact_node_size)
+        {
+            const unsigned char *addr = data + NodeId::size;
+            unsigned long ip = (static_cast<unsigned long>(addr[0]) << 24) |
+                (static_cast<unsigned long>(addr[1]) << 16) |
+                (static_cast<unsigned long>(addr[2]) << 8) | addr[3];
+            unsigned short port = static_cast<unsigned short>(
+                    (addr[4] << 8) | addr[5]);
+            if (ip == 0 || port == 0)
+                continue;
+
+            nodes.push_back(NodeEntry(
+                        NodeId(reinterpret_cast<const char *>(data)), ip, port));
+        }
+    }
+
+    std::string EncodeCompactNodes(const std::vector<NodeEntry>& nodes)
+    {
+        std::string compact;
+        compact.reserve(nodes.size() * compact_node_size);
+
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            const NodeEntry& node = nodes[i];
+            compact.append(node.id.GetData(), NodeId::size);
+            compact.push_back(static_cast<char>(node.ip >> 24));
+            compact.push_back(static_cast<char>(node.ip >> 16));
+            compact.push_back(static_cast<char>(node.ip >> 8));
+            compact.push_back(static_cast<char>(node.ip));
+            compact.push_back(static_cast<char>(node.port >> 8));
+            compact.push_back(static_cast<char>(node.port));
+        }
+        return compact;
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
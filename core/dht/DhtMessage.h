@@ -0,0 +1,91 @@
+#ifndef DHT_MESSAGE_H
+#define DHT_MESSAGE_H
+
+#include "DhtNodeId.h"
+#include "DhtRoutingTable.h"
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // a KRPC message of BEP 5. A query has a method and its arguments,
+    // a response has the fields of all methods, the method of a response
+    // is known by its transaction id
+    struct Message
+    {
+        enum Type
+        {
+            QUERY,
+            RESPONSE,
+            ERROR_MESSAGE
+        };
+
+        enum Method
+        {
+            PING,
+            FIND_NODE,
+            GET_PEERS,
+            ANNOUNCE_PEER,
+            UNKNOWN_METHOD
+        };
+
+        // error codes
+        static const int generic_error = 201;
+        static const int server_error = 202;
+        static const int protocol_error = 203;
+        static const int method_unknown = 204;
+
+        Message()
+            : type(QUERY),
+              method(PING),
+              port(0),
+              implied_port(false),
+              error_code(0)
+        {
+        }
+
+        int type;
+        std::string transaction;
+        int method;
+
+        // id of the sender
+        NodeId id;
+        // find_node target
+        NodeId target;
+        // get_peers and announce_peer info hash
+        NodeId info_hash;
+        // announce_peer port
+        unsigned short port;
+        bool implied_port;
+        // get_peers response token, and announce_peer token
+        std::string token;
+
+        // find_node and get_peers response
+        std::vector<NodeEntry> nodes;
+        // get_peers response, compact peer info of 6 bytes
+        std::vector<std::string> values;
+
+        int error_code;
+        std::string error_message;
+    };
+
+    const char * GetMethodName(int method);
+
+    bool ParseMessage(const char *data, std::size_t len, Message *message);
+
+    std::string EncodeMessage(const Message& message);
+
+    // compact node info is 20 bytes id, 4 bytes ip and 2 bytes port
+    const std::size_t compact_node_size = 26;
+
+    void DecodeCompactNodes(const std::string& compact,
+                            std::vector<NodeEntry>& nodes);
+    std::string EncodeCompactNodes(const std::vector<NodeEntry>& nodes);
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_MESSAGE_H
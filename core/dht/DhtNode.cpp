@@ -0,0 +1,405 @@
+#include "DhtNode.h"
+#include "../../base/Random.h"
+#include "../../sha1/Sha1Value.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    namespace {
+
+        struct IsNode
+        {
+            explicit IsNode(const NodeId& i)
+                : id(i)
+            {
+            }
+
+            bool operator () (const NodeEntry& entry) const
+            {
+                return entry.id == id;
+            }
+
+            const NodeId& id;
+        };
+
+    } // unnamed namespace
+
+    DhtNode::DhtNode(const NodeId& id, DhtNetwork *network)
+        : network_(network),
+          table_(id),
+          transaction_(RandomValue<unsigned short>()),
+          secret_time_(0),
+          bootstrap_time_(0)
+    {
+        assert(network_);
+        RotateSecret();
+        previous_secret_ = secret_;
+    }
+
+    void DhtNode::AddBootstrapNode(unsigned long ip, unsigned short port)
+    {
+        Address address(ip, port);
+        if (std::find(bootstrap_nodes_.begin(), bootstrap_nodes_.end(), address) ==
+            bootstrap_nodes_.end())
+            bootstrap_nodes_.push_back(address);
+    }
+
+    void DhtNode::AddNode(const NodeId& id, unsigned long ip, unsigned short port)
+    {
+        table_.NodeSeen(id, ip, port, network_->Now());
+    }
+
+    void DhtNode::Bootstrap(const DoneCallback& done_callback)
+    {
+        bootstrap_time_ = network_->Now();
+        FindNode(GetId(), std::tr1::bind(&DhtNode::OnBootstrapDone,
+                    this, done_callback));
+    }
+
+    void DhtNode::FindNode(const NodeId& target, const DoneCallback& done_callback)
+    {
+        LookupPtr lookup(new Lookup(Message::FIND_NODE, target, 0,
+                    PeerCallback(), done_callback));
+        StartLookup(lookup);
+    }
+
+    void DhtNode::GetPeers(const NodeId& info_hash, unsigned short announce_port,
+                           const PeerCallback& peer_callback,
+                           const DoneCallback& done_callback)
+    {
+        LookupPtr lookup(new Lookup(Message::GET_PEERS, info_hash,
+                    announce_port, peer_callback, done_callback));
+        StartLookup(lookup);
+    }
+
+    void DhtNode::OnPacket(const char *data, std::size_t len,
+                           unsigned long ip, unsigned short port)
+    {
+        Message message;
+        if (!ParseMessage(data, len, &message))
+            return ;
+
+        switch (message.type)
+        {
+        case Message::QUERY:
+            HandleQuery(message, ip, port);
+            break;
+
+        case Message::RESPONSE:
+            HandleResponse(message, ip, port);
+            break;
+
+        case Message::ERROR_MESSAGE:
+            HandleError(message, ip, port);
+            break;
+        }
+    }
+
+    void DhtNode::Process()
+    {
+        NormalTimeType now = network_->Now();
+
+        // time out queries, lookups of them go on with other nodes
+        std::vector<LookupPtr> timeout_lookups;
+        for (PendingQueries::iterator it = pending_.begin(); it != pending_.end(); )
+        {
+            PendingQuery& query = it->second;
+            if (now - query.send_time < query_timeout)
+            {
+                if (!query.is_slow && query.lookup &&
+                    now - query.send_time >= short_query_timeout)
+                {
+                    query.is_slow = true;
+                    query.lookup->OnSlow(query.ip, query.port);
+                    timeout_lookups.push_back(query.lookup);
+                }
+                ++it;
+                continue;
+            }
+
+            if (query.has_id)
+                table_.NodeFailed(query.id);
+            if (query.lookup)
+            {
+                query.lookup->OnFailed(query.ip, query.port);
+                timeout_lookups.push_back(query.lookup);
+            }
+            pending_.erase(it++);
+        }
+
+        for (std::size_t i = 0; i < timeout_lookups.size(); ++i)
+            StepLookup(timeout_lookups[i]);
+
+        if (now - secret_time_ >= token_interval)
+        {
+            RotateSecret();
+            peer_store_.RemoveExpired(now);
+        }
+
+        if (table_.GetNodeCount() == 0)
+        {
+            if (lookups_.empty() && !bootstrap_nodes_.empty() &&
+                now - bootstrap_time_ >= bootstrap_interval)
+                Bootstrap();
+            return ;
+        }
+
+        NodeId target;
+        if (table_.GetRefreshTarget(now, refresh_interval, &target))
+            FindNode(target, DoneCallback());
+    }
+
+    void DhtNode::OnBootstrapDone(const DoneCallback& done_callback)
+    {
+        std::vector<int> buckets;
+        table_.GetUnfilledBuckets(buckets);
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+            FindNode(NodeId::Random(GetId(), buckets[i]), DoneCallback());
+
+        if (done_callback)
+            done_callback();
+    }
+
+    void DhtNode::StartLookup(const LookupPtr& lookup)
+    {
+        std::vector<NodeEntry> nodes;
+        table_.FindClosest(lookup->GetTarget(), Lookup::k, nodes);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+            lookup->AddCandidate(nodes[i], true);
+
+        // bootstrap nodes are after all known nodes, they are queried only
+        // when we know few nodes
+        if (nodes.size() < Lookup::k)
+        {
+            for (std::size_t i = 0; i < bootstrap_nodes_.size(); ++i)
+            {
+                NodeEntry node;
+                node.ip = bootstrap_nodes_[i].first;
+                node.port = bootstrap_nodes_[i].second;
+                lookup->AddCandidate(node, false);
+            }
+        }
+
+        lookups_.push_back(lookup);
+        StepLookup(lookup);
+    }
+
+    void DhtNode::StepLookup(const LookupPtr& lookup)
+    {
+        // a late response of a finished lookup
+        if (lookup->IsFinished())
+            return ;
+
+        NodeEntry node;
+        while (lookup->NextQuery(&node))
+        {
+            Message query;
+            query.method = lookup->GetMethod();
+            if (query.method == Message::FIND_NODE)
+                query.target = lookup->GetTarget();
+            else
+                query.info_hash = lookup->GetTarget();
+            SendQuery(query, node, node.id != NodeId(), lookup);
+        }
+
+        if (lookup->IsDone())
+            FinishLookup(lookup);
+    }
+
+    void DhtNode::FinishLookup(const LookupPtr& lookup)
+    {
+        Lookups::iterator it = std::find(lookups_.begin(), lookups_.end(), lookup);
+        if (it == lookups_.end())
+            return ;
+
+        lookups_.erase(it);
+        if (lookup->GetMethod() == Message::GET_PEERS &&
+            lookup->GetAnnouncePort() != 0)
+            AnnouncePeer(lookup);
+        lookup->Done();
+    }
+
+    void DhtNode::AnnouncePeer(const LookupPtr& lookup)
+    {
+        std::vector<Lookup::Candidate> nodes;
+        lookup->GetAnnounceNodes(nodes);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            Message query;
+            query.method = Message::ANNOUNCE_PEER;
+            query.info_hash = lookup->GetTarget();
+            query.port = lookup->GetAnnouncePort();
+            query.token = nodes[i].token;
+            SendQuery(query, nodes[i].node, true, LookupPtr());
+        }
+    }
+
+    void DhtNode::SendQuery(Message& query, const NodeEntry& node, bool has_id,
+                            const LookupPtr& lookup)
+    {
+        query.type = Message::QUERY;
+        query.id = GetId();
+        query.transaction = NextTransaction();
+
+        PendingQuery& pending = pending_[query.transaction];
+        pending.ip = node.ip;
+        pending.port = node.port;
+        pending.id = node.id;
+        pending.has_id = has_id;
+        pending.is_slow = false;
+        pending.method = query.method;
+        pending.send_time = network_->Now();
+        pending.lookup = lookup;
+
+        Send(query, node.ip, node.port);
+    }
+
+    void DhtNode::Send(const Message& message,
+                       unsigned long ip, unsigned short port)
+    {
+        network_->SendPacket(EncodeMessage(message), ip, port);
+    }
+
+    void DhtNode::HandleQuery(const Message& query,
+                              unsigned long ip, unsigned short port)
+    {
+        if (query.id == GetId())
+            return ;
+
+        NormalTimeType now = network_->Now();
+        table_.NodeSeen(query.id, ip, port, now);
+
+        Message reply;
+        reply.type = Message::RESPONSE;
+        reply.transaction = query.transaction;
+        reply.id = GetId();
+
+        switch (query.method)
+        {
+        case Message::PING:
+            break;
+
+        case Message::FIND_NODE:
+            table_.FindClosest(query.target, Lookup::k, reply.nodes);
+            break;
+
+        case Message::GET_PEERS:
+            reply.token = MakeToken(ip, secret_);
+            peer_store_.GetPeers(query.info_hash, reply.values);
+            table_.FindClosest(query.info_hash, Lookup::k, reply.nodes);
+            break;
+
+        case Message::ANNOUNCE_PEER:
+            if (!IsValidToken(query.token, ip))
+            {
+                reply.type = Message::ERROR_MESSAGE;
+                reply.error_code = Message::protocol_error;
+                reply.error_message = "bad token";
+                break;
+            }
+            peer_store_.AddPeer(query.info_hash, ip,
+                    query.implied_port ? port : query.port, now);
+            break;
+
+        default:
+            reply.type = Message::ERROR_MESSAGE;
+            reply.error_code = Message::method_unknown;
+            reply.error_message = "method unknown";
+            break;
+        }
+
+        Send(reply, ip, port);
+    }
+
+    void DhtNode::HandleResponse(const Message& response,
+                                 unsigned long ip, unsigned short port)
+    {
+        PendingQueries::iterator it = pending_.find(response.transaction);
+        if (it == pending_.end() ||
+            it->second.ip != ip || it->second.port != port)
+            return ;
+
+        LookupPtr lookup = it->second.lookup;
+        pending_.erase(it);
+
+        if (response.id != GetId())
+            table_.NodeSeen(response.id, ip, port, network_->Now());
+
+        if (lookup)
+        {
+            // we are not a candidate of our lookups
+            Message filtered = response;
+            filtered.nodes.erase(std::remove_if(filtered.nodes.begin(),
+                        filtered.nodes.end(), IsNode(GetId())),
+                    filtered.nodes.end());
+
+            lookup->OnResponse(ip, port, filtered);
+            StepLookup(lookup);
+        }
+    }
+
+    void DhtNode::HandleError(const Message& error,
+                              unsigned long ip, unsigned short port)
+    {
+        PendingQueries::iterator it = pending_.find(error.transaction);
+        if (it == pending_.end() ||
+            it->second.ip != ip || it->second.port != port)
+            return ;
+
+        LookupPtr lookup = it->second.lookup;
+        pending_.erase(it);
+
+        if (lookup)
+        {
+            lookup->OnFailed(ip, port);
+            StepLookup(lookup);
+        }
+    }
+
+    std::string DhtNode::NextTransaction()
+    {
+        ++transaction_;
+        std::string transaction;
+        transaction.push_back(static_cast<char>(transaction_ >> 8));
+        transaction.push_back(static_cast<char>(transaction_));
+        return transaction;
+    }
+
+    std::string DhtNode::MakeToken(unsigned long ip,
+                                   const std::string& secret) const
+    {
+        // token is the head of sha1 of ip and secret
+        std::string buf;
+        buf.push_back(static_cast<char>(ip >> 24));
+        buf.push_back(static_cast<char>(ip >> 16));
+        buf.push_back(static_cast<char>(ip >> 8));
+        buf.push_back(static_cast<char>(ip));
+        buf += secret;
+
+        Sha1Value sha1(buf.data(), buf.size());
+        return NodeId(sha1).ToString().substr(0, token_size);
+    }
+
+    bool DhtNode::IsValidToken(const std::string& token, unsigned long ip) const
+    {
+        // a token is valid in two secret intervals
+        return token == MakeToken(ip, secret_) ||
+            token == MakeToken(ip, previous_secret_);
+    }
+
+    void DhtNode::RotateSecret()
+    {
+        previous_secret_ = secret_;
+        secret_.assign(8, '\0');
+        RandomBytes(&secret_[0], secret_.size());
+        secret_time_ = network_->Now();
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
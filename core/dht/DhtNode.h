@@ -0,0 +1,151 @@
+#ifndef DHT_NODE_H
+#define DHT_NODE_H
+
+#include "DhtLookup.h"
+#include "DhtMessage.h"
+#include "DhtNodeId.h"
+#include "DhtPeerStore.h"
+#include "DhtRoutingTable.h"
+#include "../../base/BaseTypes.h"
+#include "../../timer/TimeTraits.h"
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // network of a dht node, it sends packets by udp, or by a simulated
+    // network in test
+    class DhtNetwork
+    {
+    public:
+        // ip and port are in host byte order
+        virtual void SendPacket(const std::string& packet,
+                                unsigned long ip, unsigned short port) = 0;
+        virtual NormalTimeType Now() const = 0;
+
+    protected:
+        ~DhtNetwork() { }
+    };
+
+    // a mainline dht node of BEP 5. It answers ping, find_node, get_peers
+    // and announce_peer, and runs iterative lookups to find peers of info
+    // hashes. It does not own a socket or timer, received packets are
+    // passed to OnPacket, and Process should be called about every second
+    class DhtNode : private NotCopyable
+    {
+    public:
+        typedef Lookup::PeerCallback PeerCallback;
+        typedef Lookup::DoneCallback DoneCallback;
+
+        // a query is slow after short_query_timeout, then its lookup
+        // queries another node, and it fails after query_timeout
+        static const NormalTimeType short_query_timeout = 1000;
+        static const NormalTimeType query_timeout = 3 * 1000;
+        static const NormalTimeType token_interval = 5 * 60 * 1000;
+        static const NormalTimeType refresh_interval = 15 * 60 * 1000;
+        static const NormalTimeType bootstrap_interval = 60 * 1000;
+        static const std::size_t token_size = 8;
+
+        DhtNode(const NodeId& id, DhtNetwork *network);
+
+        const NodeId& GetId() const
+            { return table_.GetSelfId(); }
+
+        std::size_t GetNodeCount() const
+            { return table_.GetNodeCount(); }
+
+        std::size_t GetLookupCount() const
+            { return lookups_.size(); }
+
+        // bootstrap nodes are used when the routing table is empty
+        void AddBootstrapNode(unsigned long ip, unsigned short port);
+
+        // add a known node to routing table directly
+        void AddNode(const NodeId& id, unsigned long ip, unsigned short port);
+
+        // find nodes close to us, then find nodes of buckets which are not
+        // full to fill the routing table
+        void Bootstrap(const DoneCallback& done_callback = DoneCallback());
+
+        void FindNode(const NodeId& target, const DoneCallback& done_callback);
+
+        // find peers of info hash, announce us on announce_port to the
+        // closest nodes when it is not 0
+        void GetPeers(const NodeId& info_hash, unsigned short announce_port,
+                      const PeerCallback& peer_callback,
+                      const DoneCallback& done_callback);
+
+        // a packet received from ip:port
+        void OnPacket(const char *data, std::size_t len,
+                      unsigned long ip, unsigned short port);
+
+        // check query timeouts, rotate token secret, expire peers and
+        // refresh buckets
+        void Process();
+
+    private:
+        typedef std::tr1::shared_ptr<Lookup> LookupPtr;
+        typedef std::list<LookupPtr> Lookups;
+
+        struct PendingQuery
+        {
+            unsigned long ip;
+            unsigned short port;
+            NodeId id;
+            bool has_id;
+            bool is_slow;
+            int method;
+            NormalTimeType send_time;
+            LookupPtr lookup;
+        };
+
+        typedef std::map<std::string, PendingQuery> PendingQueries;
+        typedef std::pair<unsigned long, unsigned short> Address;
+
+        void OnBootstrapDone(const DoneCallback& done_callback);
+        void StartLookup(const LookupPtr& lookup);
+        void StepLookup(const LookupPtr& lookup);
+        void FinishLookup(const LookupPtr& lookup);
+        void AnnouncePeer(const LookupPtr& lookup);
+
+        void SendQuery(Message& query, const NodeEntry& node, bool has_id,
+                       const LookupPtr& lookup);
+        void Send(const Message& message,
+                  unsigned long ip, unsigned short port);
+
+        void HandleQuery(const Message& query,
+                         unsigned long ip, unsigned short port);
+        void HandleResponse(const Message& response,
+                            unsigned long ip, unsigned short port);
+        void HandleError(const Message& error,
+                         unsigned long ip, unsigned short port);
+
+        std::string NextTransaction();
+        std::string MakeToken(unsigned long ip, const std::string& secret) const;
+        bool IsValidToken(const std::string& token, unsigned long ip) const;
+        void RotateSecret();
+
+        DhtNetwork *network_;
+        RoutingTable table_;
+        PeerStore peer_store_;
+        std::vector<Address> bootstrap_nodes_;
+        PendingQueries pending_;
+        Lookups lookups_;
+        unsigned short transaction_;
+        std::string secret_;
+        std::string previous_secret_;
+        NormalTimeType secret_time_;
+        NormalTimeType bootstrap_time_;
+    };
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_NODE_H
@@ -0,0 +1,67 @@
+#include "DhtNodeId.h"
+#include "../../base/Random.h"
+#include "../../sha1/NetSha1Value.h"
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    NodeId::NodeId(const Sha1Value& sha1)
+    {
+        Sha1Value net_sha1 = NetByteOrder(sha1);
+        memcpy(id_, net_sha1.GetData(), sizeof(id_));
+    }
+
+    Sha1Value NodeId::ToSha1Value() const
+    {
+        return NetStreamToSha1Value(GetData());
+    }
+
+    int NodeId::LeadingZeroBits() const
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (id_[i] == 0)
+                continue;
+
+            int count = static_cast<int>(i) * 8;
+            for (unsigned char mask = 0x80; (id_[i] & mask) == 0; mask >>= 1)
+                ++count;
+            return count;
+        }
+        return bits;
+    }
+
+    // static
+    NodeId NodeId::Random()
+    {
+        NodeId result;
+        RandomBytes(result.id_, sizeof(result.id_));
+        return result;
+    }
+
+    // static
+    NodeId NodeId::Random(const NodeId& base, int leading_zero_bits)
+    {
+        NodeId result = Random();
+        for (int bit = 0; bit <= leading_zero_bits && bit < bits; ++bit)
+        {
+            unsigned char mask = static_cast<unsigned char>(0x80 >> (bit % 8));
+            unsigned char& byte = result.id_[bit / 8];
+            // the same bits of prefix, and a different bit after it
+            unsigned char base_bit = base.id_[bit / 8] & mask;
+            if (bit == leading_zero_bits)
+                base_bit ^= mask;
+            byte = (byte & ~mask) | base_bit;
+        }
+        return result;
+    }
+
+    bool CloserTo(const NodeId& target, const NodeId& left, const NodeId& right)
+    {
+        return (left ^ target) < (right ^ target);
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
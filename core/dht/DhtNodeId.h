@@ -0,0 +1,87 @@
+#ifndef DHT_NODE_ID_H
+#define DHT_NODE_ID_H
+
+#include "../../sha1/Sha1Value.h"
+#include <string.h>
+#include <string>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // 160 bits id of dht node or info hash, bytes are in network order,
+    // so ids compare as big numbers
+    class NodeId
+    {
+    public:
+        static const std::size_t size = 20;
+        static const int bits = 160;
+
+        NodeId()
+        {
+            memset(id_, 0, sizeof(id_));
+        }
+
+        explicit NodeId(const char *bytes)
+        {
+            memcpy(id_, bytes, sizeof(id_));
+        }
+
+        explicit NodeId(const Sha1Value& sha1);
+
+        Sha1Value ToSha1Value() const;
+
+        const char * GetData() const
+        {
+            return reinterpret_cast<const char *>(id_);
+        }
+
+        std::string ToString() const
+        {
+            return std::string(GetData(), size);
+        }
+
+        // count of leading zero bits, it is 160 for zero id
+        int LeadingZeroBits() const;
+
+        static NodeId Random();
+
+        // random id of which xor distance to base has leading_zero_bits
+        // leading zero bits, it is an id of that bucket of base
+        static NodeId Random(const NodeId& base, int leading_zero_bits);
+
+        friend NodeId operator ^ (const NodeId& left, const NodeId& right)
+        {
+            NodeId result;
+            for (std::size_t i = 0; i < size; ++i)
+                result.id_[i] = left.id_[i] ^ right.id_[i];
+            return result;
+        }
+
+        friend bool operator == (const NodeId& left, const NodeId& right)
+        {
+            return memcmp(left.id_, right.id_, size) == 0;
+        }
+
+        friend bool operator != (const NodeId& left, const NodeId& right)
+        {
+            return !(left == right);
+        }
+
+        friend bool operator < (const NodeId& left, const NodeId& right)
+        {
+            return memcmp(left.id_, right.id_, size) < 0;
+        }
+
+    private:
+        unsigned char id_[size];
+    };
+
+    // left is closer to target than right in xor distance
+    bool CloserTo(const NodeId& target, const NodeId& left, const NodeId& right);
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_NODE_ID_H
@@ -0,0 +1,103 @@
+#include "DhtPeerStore.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    PeerStore::PeerStore()
+    {
+    }
+
+    void PeerStore::AddPeer(const NodeId& info_hash, unsigned long ip,
+                            unsigned short port, NormalTimeType now)
+    {
+        PeerMap::iterator it = peers_.find(info_hash);
+        if (it == peers_.end())
+        {
+            if (peers_.size() >= max_info_hashes)
+                return ;
+            it = peers_.insert(std::make_pair(info_hash, StoredPeers())).first;
+        }
+
+        StoredPeer peer;
+        peer.compact[0] = static_cast<char>(ip >> 24);
+        peer.compact[1] = static_cast<char>(ip >> 16);
+        peer.compact[2] = static_cast<char>(ip >> 8);
+        peer.compact[3] = static_cast<char>(ip);
+        peer.compact[4] = static_cast<char>(port >> 8);
+        peer.compact[5] = static_cast<char>(port);
+        peer.announce_time = now;
+
+        StoredPeers& stored = it->second;
+        for (StoredPeers::iterator i = stored.begin(); i != stored.end(); ++i)
+        {
+            if (memcmp(i->compact, peer.compact, sizeof(peer.compact)) == 0)
+            {
+                i->announce_time = now;
+                return ;
+            }
+        }
+
+        if (stored.size() < max_peers_per_hash)
+        {
+            stored.push_back(peer);
+        }
+        else
+        {
+            // replace the oldest announced peer
+            StoredPeers::iterator oldest = stored.begin();
+            for (StoredPeers::iterator i = stored.begin(); i != stored.end(); ++i)
+            {
+                if (now - i->announce_time > now - oldest->announce_time)
+                    oldest = i;
+            }
+            *oldest = peer;
+        }
+    }
+
+    bool PeerStore::GetPeers(const NodeId& info_hash,
+                             std::vector<std::string>& values) const
+    {
+        values.clear();
+        PeerMap::const_iterator it = peers_.find(info_hash);
+        if (it == peers_.end())
+            return false;
+
+        const StoredPeers& stored = it->second;
+        // start at a random place, so different peers are returned when
+        // there are more peers than max_values
+        std::size_t count = stored.size() < max_values ? stored.size() : max_values;
+        std::size_t start = stored.size() > max_values ? rand() % stored.size() : 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const StoredPeer& peer = stored[(start + i) % stored.size()];
+            values.push_back(std::string(peer.compact, sizeof(peer.compact)));
+        }
+        return !values.empty();
+    }
+
+    void PeerStore::RemoveExpired(NormalTimeType now)
+    {
+        for (PeerMap::iterator it = peers_.begin(); it != peers_.end(); )
+        {
+            StoredPeers& stored = it->second;
+            std::size_t alive = 0;
+            for (std::size_t i = 0; i < stored.size(); ++i)
+            {
+                if (now - stored[i].announce_time < peer_timeout)
+                    stored[alive++] = stored[i];
+            }
+            stored.resize(alive);
+
+            if (stored.empty())
+                peers_.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,60 @@
+#ifndef DHT_PEER_STORE_H
+#define DHT_PEER_STORE_H
+
+#include "DhtNodeId.h"
+#include "../../base/BaseTypes.h"
+#include "../../timer/TimeTraits.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // peers announced to us, by info hash. Peers of an info hash are
+    // stored as compact peer info (6 bytes) in a vector, a peer expires
+    // when it is not announced again in 30 minutes
+    class PeerStore : private NotCopyable
+    {
+    public:
+        static const std::size_t max_info_hashes = 5000;
+        static const std::size_t max_peers_per_hash = 1000;
+        // max peers returned for one get_peers
+        static const std::size_t max_values = 50;
+        static const NormalTimeType peer_timeout = 30 * 60 * 1000;
+
+        PeerStore();
+
+        // ip and port are in host byte order
+        void AddPeer(const NodeId& info_hash, unsigned long ip,
+                     unsigned short port, NormalTimeType now);
+
+        // get compact peers of the info hash, return false when it has
+        // no peer
+        bool GetPeers(const NodeId& info_hash,
+                      std::vector<std::string>& values) const;
+
+        void RemoveExpired(NormalTimeType now);
+
+        std::size_t GetInfoHashCount() const
+            { return peers_.size(); }
+
+    private:
+        struct StoredPeer
+        {
+            char compact[6];
+            NormalTimeType announce_time;
+        };
+
+        typedef std::vector<StoredPeer> StoredPeers;
+        typedef std::map<NodeId, StoredPeers> PeerMap;
+
+        PeerMap peers_;
+    };
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_PEER_STORE_H
@@ -0,0 +1,221 @@
+#include "DhtRoutingTable.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    namespace {
+
+        struct SameId
+        {
+            explicit SameId(const NodeId& i)
+                : id(i)
+            {
+            }
+
+            bool operator () (const NodeEntry& entry) const
+            {
+                return entry.id == id;
+            }
+
+            const NodeId& id;
+        };
+
+        struct CloserToTarget
+        {
+            explicit CloserToTarget(const NodeId& t)
+                : target(t)
+            {
+            }
+
+            bool operator () (const NodeEntry& left, const NodeEntry& right) const
+            {
+                return CloserTo(target, left.id, right.id);
+            }
+
+            const NodeId& target;
+        };
+
+    } // unnamed namespace
+
+    RoutingTable::RoutingTable(const NodeId& self)
+        : self_(self),
+          buckets_(NodeId::bits + 1)
+    {
+    }
+
+    void RoutingTable::NodeSeen(const NodeId& id, unsigned long ip,
+                                unsigned short port, NormalTimeType now)
+    {
+        int index = BucketIndex(id);
+        if (index == NodeId::bits)
+            return ;
+
+        Bucket& bucket = buckets_[index];
+        std::vector<NodeEntry>::iterator it = std::find_if(
+                bucket.nodes.begin(), bucket.nodes.end(), SameId(id));
+
+        NodeEntry entry(id, ip, port);
+        entry.last_seen = now;
+
+        if (it != bucket.nodes.end())
+        {
+            // move to the end, it is the most recently seen
+            bucket.nodes.erase(it);
+            bucket.nodes.push_back(entry);
+            bucket.last_changed = now;
+            return ;
+        }
+
+        if (bucket.nodes.size() < bucket_size)
+        {
+            bucket.nodes.push_back(entry);
+            bucket.last_changed = now;
+            return ;
+        }
+
+        // replace a bad node of the full bucket
+        for (it = bucket.nodes.begin(); it != bucket.nodes.end(); ++it)
+        {
+            if (it->fail_count >= max_fail_count)
+            {
+                bucket.nodes.erase(it);
+                bucket.nodes.push_back(entry);
+                bucket.last_changed = now;
+                return ;
+            }
+        }
+
+        std::vector<NodeEntry>::iterator replacement = std::find_if(
+                bucket.replacements.begin(), bucket.replacements.end(), SameId(id));
+        if (replacement != bucket.replacements.end())
+            bucket.replacements.erase(replacement);
+        else if (bucket.replacements.size() >= bucket_size)
+            bucket.replacements.erase(bucket.replacements.begin());
+        bucket.replacements.push_back(entry);
+    }
+
+    void RoutingTable::NodeFailed(const NodeId& id)
+    {
+        int index = BucketIndex(id);
+        if (index == NodeId::bits)
+            return ;
+
+        Bucket& bucket = buckets_[index];
+        std::vector<NodeEntry>::iterator it = std::find_if(
+                bucket.nodes.begin(), bucket.nodes.end(), SameId(id));
+        if (it == bucket.nodes.end())
+            return ;
+
+        if (++it->fail_count < max_fail_count || bucket.replacements.empty())
+            return ;
+
+        // the most recently seen replacement takes the place
+        bucket.nodes.erase(it);
+        bucket.nodes.push_back(bucket.replacements.back());
+        bucket.replacements.pop_back();
+    }
+
+    void RoutingTable::FindClosest(const NodeId& target, std::size_t count,
+                                   std::vector<NodeEntry>& nodes) const
+    {
+        nodes.clear();
+
+        // nodes of the bucket of target are closer than nodes of other
+        // buckets after it, so buckets after the target bucket are
+        // visited first, then buckets before it from the nearest
+        int target_index = BucketIndex(target);
+        for (int i = target_index; i < NodeId::bits; ++i)
+        {
+            const std::vector<NodeEntry>& bucket = buckets_[i].nodes;
+            for (std::size_t j = 0; j < bucket.size(); ++j)
+            {
+                if (bucket[j].fail_count < max_fail_count)
+                    nodes.push_back(bucket[j]);
+            }
+        }
+
+        for (int i = target_index - 1; i >= 0 && nodes.size() < count; --i)
+        {
+            const std::vector<NodeEntry>& bucket = buckets_[i].nodes;
+            for (std::size_t j = 0; j < bucket.size(); ++j)
+            {
+                if (bucket[j].fail_count < max_fail_count)
+                    nodes.push_back(bucket[j]);
+            }
+        }
+
+        CloserToTarget closer(target);
+        if (nodes.size() > count)
+        {
+            std::partial_sort(nodes.begin(), nodes.begin() + count,
+                    nodes.end(), closer);
+            nodes.resize(count);
+        }
+        else
+        {
+            std::sort(nodes.begin(), nodes.end(), closer);
+        }
+    }
+
+    std::size_t RoutingTable::GetNodeCount() const
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < buckets_.size(); ++i)
+            count += buckets_[i].nodes.size();
+        return count;
+    }
+
+    void RoutingTable::GetUnfilledBuckets(std::vector<int>& indexes) const
+    {
+        indexes.clear();
+        int last = LastUsedBucket();
+        for (int i = 0; i < last; ++i)
+        {
+            if (buckets_[i].nodes.size() < bucket_size)
+                indexes.push_back(i);
+        }
+    }
+
+    bool RoutingTable::GetRefreshTarget(NormalTimeType now,
+                                        NormalTimeType interval,
+                                        NodeId *target)
+    {
+        assert(target);
+
+        // buckets after the last bucket which has nodes are empty, they
+        // are refreshed with it
+        int last = LastUsedBucket();
+        for (int i = 0; i <= last; ++i)
+        {
+            Bucket& bucket = buckets_[i];
+            if (now - bucket.last_changed >= interval)
+            {
+                bucket.last_changed = now;
+                *target = NodeId::Random(self_, i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int RoutingTable::LastUsedBucket() const
+    {
+        for (int i = NodeId::bits - 1; i >= 0; --i)
+        {
+            if (!buckets_[i].nodes.empty())
+                return i;
+        }
+        return -1;
+    }
+
+    int RoutingTable::BucketIndex(const NodeId& id) const
+    {
+        return (self_ ^ id).LeadingZeroBits();
+    }
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
@@ -0,0 +1,106 @@
+#ifndef DHT_ROUTING_TABLE_H
+#define DHT_ROUTING_TABLE_H
+
+#include "DhtNodeId.h"
+#include "../../base/BaseTypes.h"
+#include "../../timer/TimeTraits.h"
+#include <vector>
+
+namespace bitwave {
+namespace core {
+namespace dht {
+
+    // a dht node, ip and port are in host byte order
+    struct NodeEntry
+    {
+        NodeEntry()
+            : ip(0),
+              port(0),
+              last_seen(0),
+              fail_count(0)
+        {
+        }
+
+        NodeEntry(const NodeId& i, unsigned long addr, unsigned short p)
+            : id(i),
+              ip(addr),
+              port(p),
+              last_seen(0),
+              fail_count(0)
+        {
+        }
+
+        NodeId id;
+        unsigned long ip;
+        unsigned short port;
+        NormalTimeType last_seen;
+        // queries failed in sequence
+        unsigned char fail_count;
+    };
+
+    // kademlia routing table. Bucket i stores at most 8 nodes of which
+    // xor distance to us has i leading zero bits, nodes of a bucket are
+    // in least recently seen order, and nodes can not be put into a full
+    // bucket are kept in its replacement cache until a node of the bucket
+    // fails
+    class RoutingTable : private NotCopyable
+    {
+    public:
+        static const std::size_t bucket_size = 8;
+        // a node failed this times is replaced
+        static const int max_fail_count = 2;
+
+        explicit RoutingTable(const NodeId& self);
+
+        const NodeId& GetSelfId() const
+            { return self_; }
+
+        // a node responds us or queries us
+        void NodeSeen(const NodeId& id, unsigned long ip,
+                      unsigned short port, NormalTimeType now);
+
+        // a query to the node is timed out
+        void NodeFailed(const NodeId& id);
+
+        // count closest nodes of target, the closest is the first
+        void FindClosest(const NodeId& target, std::size_t count,
+                         std::vector<NodeEntry>& nodes) const;
+
+        std::size_t GetNodeCount() const;
+
+        // buckets which are not full before the closest bucket which has
+        // nodes, they can have more nodes
+        void GetUnfilledBuckets(std::vector<int>& indexes) const;
+
+        // a random id of the first bucket which is not changed in
+        // interval, return false when all buckets are fresh
+        bool GetRefreshTarget(NormalTimeType now, NormalTimeType interval,
+                              NodeId *target);
+
+    private:
+        struct Bucket
+        {
+            Bucket()
+                : last_changed(0)
+            {
+            }
+
+            std::vector<NodeEntry> nodes;
+            std::vector<NodeEntry> replacements;
+            NormalTimeType last_changed;
+        };
+
+        int BucketIndex(const NodeId& id) const;
+        // index of the closest bucket which has nodes, -1 when no node
+        int LastUsedBucket() const;
+
+        NodeId self_;
+        // bucket of index NodeId::bits is us, it is not used
+        std::vector<Bucket> buckets_;
+    };
+
+} // namespace dht
+} // namespace core
+} // namespace bitwave
+
+#endif // DHT_ROUTING_TABLE_H
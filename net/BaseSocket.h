@@ -22,6 +22,18 @@ namespace net {
             service.RegisterSocket(socket_);
         }
 
+        // construct a socket of type, such as SOCK_DGRAM and IPPROTO_UDP
+        template<typename Service>
+        BaseSocket(Service& service, int type, int protocol)
+            : RefCount(true),
+              socket_(::socket(AF_INET, type, protocol))
+        {
+            if (socket_ == INVALID_SOCKET)
+                throw NetException(CREATE_SOCKET_ERROR);
+
+            service.RegisterSocket(socket_);
+        }
+
         ~BaseSocket()
         {
             if (Only())
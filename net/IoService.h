@@ -13,6 +13,7 @@ namespace net {
     typedef IocpService IoService;
     typedef Socket<BaseSocket, IoService> AsyncSocket;
     typedef Listener<BaseSocket, IoService> AsyncListener;
+    typedef DatagramSocket<BaseSocket, IoService> AsyncUdpSocket;
 
     // a help function to construct a AsyncSocket by service and BaseSocket
     inline AsyncSocket MakeAsyncSocket(IoService& service,
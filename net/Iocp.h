@@ -133,6 +133,36 @@ namespace net {
             ptr.Release();
         }
 
+        template<typename SocketImplement, typename Buffer, typename Handler>
+        void AsyncReceiveFrom(const SocketImplement& impl, Buffer& buffer, const Handler& handler)
+        {
+            DWORD flags = 0;
+            OverlappedPtr<ReceiveFromOverlapped> ptr(new ReceiveFromOverlapped(handler, buffer));
+
+            int error = ::WSARecvFrom(impl.Get(), ptr->GetWsaBuf(), ptr->GetWsaBufCount(),
+                                      0, &flags, ptr->GetFrom(), ptr->GetFromLength(),
+                                      (LPWSAOVERLAPPED)ptr.Get(), 0);
+            if (error == SOCKET_ERROR && ::WSAGetLastError() != WSA_IO_PENDING)
+                throw NetException(CALL_WSARECVFROM_FUNCTION_ERROR);
+
+            ptr.Release();
+        }
+
+        template<typename SocketImplement, typename Buffer, typename Handler>
+        void AsyncSendTo(const SocketImplement& impl, const Buffer& buffer,
+                         const Address& address, const Port& port, const Handler& handler)
+        {
+            OverlappedPtr<SendToOverlapped> ptr(new SendToOverlapped(handler, buffer, address, port));
+
+            int error = ::WSASendTo(impl.Get(), ptr->GetWsaBuf(), ptr->GetWsaBufCount(),
+                                    0, 0, ptr->GetTo(), ptr->GetToLength(),
+                                    (LPWSAOVERLAPPED)ptr.Get(), 0);
+            if (error == SOCKET_ERROR && ::WSAGetLastError() != WSA_IO_PENDING)
+                throw NetException(CALL_WSASENDTO_FUNCTION_ERROR);
+
+            ptr.Release();
+        }
+
     private:
         typedef std::tr1::shared_ptr<Thread> ThreadPtr;
         typedef std::vector<ThreadPtr> ServiceThreads;
@@ -21,6 +21,9 @@ namespace net {
         CALL_WSARECV_FUNCTION_ERROR,
         CALL_WSASEND_FUNCTION_ERROR,
         CONNECT_BIND_LOCAL_ERROR,
+        BIND_DATAGRAM_SOCKET_ERROR,
+        CALL_WSARECVFROM_FUNCTION_ERROR,
+        CALL_WSASENDTO_FUNCTION_ERROR,
     };
 
     // an exception class for net
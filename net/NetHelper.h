@@ -123,6 +123,30 @@ namespace net {
         return size;
     }
 
+    // ipv4 address of the remote peer in network byte order, it is 0
+    // when the socket is not connected
+    inline unsigned long GetRemoteAddress(const BaseSocket& base_socket)
+    {
+        sockaddr_in addr;
+        int addr_len = sizeof(addr);
+        if (::getpeername(base_socket.Get(),
+                    reinterpret_cast<sockaddr *>(&addr), &addr_len) != 0)
+            return 0;
+        return addr.sin_addr.s_addr;
+    }
+
+    // local port of the bound socket in host byte order, it is 0 when the
+    // socket is not bound
+    inline unsigned short GetLocalPort(const BaseSocket& base_socket)
+    {
+        sockaddr_in addr;
+        int addr_len = sizeof(addr);
+        if (::getsockname(base_socket.Get(),
+                    reinterpret_cast<sockaddr *>(&addr), &addr_len) != 0)
+            return 0;
+        return NetToHosts(addr.sin_port);
+    }
+
 } // namespace net
 } // namespace bitwave
 
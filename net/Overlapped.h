@@ -1,6 +1,7 @@
 #ifndef OVERLAPPED_H
 #define OVERLAPPED_H
 
+#include "Address.h"
 #include "BaseSocket.h"
 #include "../base/BaseTypes.h"
 #include "../base/RefCount.h"
@@ -16,7 +17,9 @@ namespace net {
         ACCEPT,
         CONNECT,
         RECEIVE,
-        SEND
+        SEND,
+        RECEIVE_FROM,
+        SEND_TO
     };
 
     struct Overlapped
@@ -176,6 +179,109 @@ namespace net {
         WSABUF wsabuf_;
     };
 
+    // an Overlapped for iocp service AsyncReceiveFrom of datagram socket,
+    // handler gets the address and port of the sender
+    class ReceiveFromOverlapped : public Overlapped
+    {
+    public:
+        typedef std::tr1::function<void (bool, int, Address, Port)> Handler;
+
+        template<typename Buffer>
+        ReceiveFromOverlapped(const Handler& handler, Buffer& buffer)
+            : Overlapped(RECEIVE_FROM),
+              handler_(handler),
+              wsabuf_(),
+              from_length_(sizeof(from_))
+        {
+            wsabuf_.buf = buffer.GetBuffer();
+            wsabuf_.len = buffer.BufferLen();
+            memset(&from_, 0, sizeof(from_));
+        }
+
+        LPWSABUF GetWsaBuf()
+        {
+            return &wsabuf_;
+        }
+
+        DWORD GetWsaBufCount() const
+        {
+            return 1;
+        }
+
+        sockaddr * GetFrom()
+        {
+            return reinterpret_cast<sockaddr *>(&from_);
+        }
+
+        int * GetFromLength()
+        {
+            return &from_length_;
+        }
+
+        void Invoke()
+        {
+            // an empty datagram is valid
+            bool success = (error == ERROR_SUCCESS);
+            handler_(success, transfered_bytes, Address(&from_), Port(&from_));
+        }
+
+    private:
+        Handler handler_;
+        WSABUF wsabuf_;
+        sockaddr_in from_;
+        int from_length_;
+    };
+
+    // an Overlapped for iocp service AsyncSendTo of datagram socket
+    class SendToOverlapped : public Overlapped
+    {
+    public:
+        typedef std::tr1::function<void (bool, int)> Handler;
+
+        template<typename Buffer>
+        SendToOverlapped(const Handler& handler, const Buffer& buffer,
+                         const Address& address, const Port& port)
+            : Overlapped(SEND_TO),
+              handler_(handler),
+              wsabuf_(),
+              to_(Ipv4Address(address, port))
+        {
+            wsabuf_.buf = buffer.GetBuffer();
+            wsabuf_.len = buffer.BufferLen();
+        }
+
+        LPWSABUF GetWsaBuf()
+        {
+            return &wsabuf_;
+        }
+
+        DWORD GetWsaBufCount() const
+        {
+            return 1;
+        }
+
+        const sockaddr * GetTo() const
+        {
+            return reinterpret_cast<const sockaddr *>(&to_);
+        }
+
+        int GetToLength() const
+        {
+            return sizeof(to_);
+        }
+
+        void Invoke()
+        {
+            bool success = (error == ERROR_SUCCESS);
+            handler_(success, transfered_bytes);
+        }
+
+    private:
+        Handler handler_;
+        WSABUF wsabuf_;
+        sockaddr_in to_;
+    };
+
     // an exception safe Overlappeds helper template class
     template<typename Type>
     class OverlappedPtr : private NotCopyable
@@ -245,6 +351,12 @@ namespace net {
                 case SEND:
                     delete reinterpret_cast<SendOverlapped *>(overlapped_);
                     break;
+                case RECEIVE_FROM:
+                    delete reinterpret_cast<ReceiveFromOverlapped *>(overlapped_);
+                    break;
+                case SEND_TO:
+                    delete reinterpret_cast<SendToOverlapped *>(overlapped_);
+                    break;
                 }
             }
         }
@@ -283,6 +395,12 @@ namespace net {
             case SEND:
                 reinterpret_cast<SendOverlapped *>(overlapped_)->Invoke();
                 break;
+            case RECEIVE_FROM:
+                reinterpret_cast<ReceiveFromOverlapped *>(overlapped_)->Invoke();
+                break;
+            case SEND_TO:
+                reinterpret_cast<SendToOverlapped *>(overlapped_)->Invoke();
+                break;
             }
         }
 
@@ -4,6 +4,10 @@
 #include "Address.h"
 #include "NetException.h"
 
+#ifndef SIO_UDP_CONNRESET
+#define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR, 12)
+#endif
+
 namespace bitwave {
 namespace net {
 
@@ -122,6 +126,66 @@ namespace net {
         implement_type implement_;
     };
 
+    // a template DatagramSocket class associate udp socket implement with
+    // service, the socket is bound to the address and port, and provide
+    // AsyncReceiveFrom, AsyncSendTo operations by service
+    template<typename ImplementType, typename ServiceType>
+    class DatagramSocket
+    {
+    public:
+        typedef ImplementType implement_type;
+        typedef ServiceType service_type;
+
+        DatagramSocket(const Address& address, const Port& port, service_type& service)
+            : service_(service),
+              implement_(service, SOCK_DGRAM, IPPROTO_UDP)
+        {
+            sockaddr_in name = Ipv4Address(address, port);
+            int result = ::bind(implement_.Get(), (sockaddr *)&name, sizeof(name));
+            if (result == SOCKET_ERROR)
+                throw NetException(BIND_DATAGRAM_SOCKET_ERROR);
+
+            // an ICMP port unreachable fails the next receive of udp socket
+            // on windows, we do not want it
+            BOOL report = FALSE;
+            DWORD bytes = 0;
+            ::WSAIoctl(implement_.Get(), SIO_UDP_CONNRESET, &report, sizeof(report),
+                       0, 0, &bytes, 0, 0);
+        }
+
+        template<typename Buffer, typename Handler>
+        void AsyncReceiveFrom(Buffer& buffer, const Handler& handler)
+        {
+            service_.AsyncReceiveFrom(implement_, buffer, handler);
+        }
+
+        template<typename Buffer, typename Handler>
+        void AsyncSendTo(const Buffer& buffer, const Address& address,
+                         const Port& port, const Handler& handler)
+        {
+            service_.AsyncSendTo(implement_, buffer, address, port, handler);
+        }
+
+        service_type& GetService() const
+        {
+            return service_;
+        }
+
+        void Close()
+        {
+            implement_.Close();
+        }
+
+        const implement_type& GetImplement() const
+        {
+            return implement_;
+        }
+
+    private:
+        service_type& service_;
+        implement_type implement_;
+    };
+
 } // namespace net
 } // namespace bitwave
 
@@ -9,7 +9,8 @@ namespace bitwave {
 namespace net {
 
     // a template class use UnpackRuler to unpack tcp stream data, if unpack
-    // success, then call the OnUnpackOne function
+    // success, then call the OnUnpackOne function. UnpackRuler may keep
+    // state of the pack at the front of the stream between calls
     template<typename UnpackRuler, int base_buffer_size = 2048>
     class StreamUnpacker : private NotCopyable
     {
@@ -17,7 +18,8 @@ namespace net {
         typedef std::vector<char> Stream;
 
         StreamUnpacker()
-            : stream_buffer_()
+            : unpack_ruler_(),
+              stream_buffer_()
         {
             stream_buffer_.reserve(base_buffer_size);
         }
@@ -35,7 +37,7 @@ namespace net {
                 std::size_t pack_remain = stream_buffer_.size() - pack_start;
                 if (pack_remain == 0) break;
 
-                bool is_can_unpack = UnpackRuler::CanUnpack(
+                bool is_can_unpack = unpack_ruler_.CanUnpack(
                         &stream_buffer_[pack_start],
                         pack_remain, &pack_len);
                 if (!is_can_unpack) break;
@@ -49,15 +51,33 @@ namespace net {
             stream_buffer_.erase(unpacked_begin, unpacked_end);
         }
 
+        // Tcp stream is closed, the data left is unpacked when the
+        // UnpackRuler takes it as the last pack
+        void StreamEnd()
+        {
+            if (!stream_buffer_.empty())
+            {
+                std::size_t pack_len = 0;
+                bool is_can_unpack = unpack_ruler_.CanUnpackAtEnd(
+                        &stream_buffer_[0], stream_buffer_.size(), &pack_len);
+                if (is_can_unpack)
+                    OnUnpackOne(&stream_buffer_[0], pack_len);
+            }
+
+            Clear();
+        }
+
         // clear tcp stream buffer
         void Clear()
         {
+            unpack_ruler_ = UnpackRuler();
             stream_buffer_.clear();
         }
 
     private:
         virtual void OnUnpackOne(const char *data, std::size_t size) = 0;
 
+        UnpackRuler unpack_ruler_;
         Stream stream_buffer_;
     };
 
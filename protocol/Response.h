@@ -1,17 +1,32 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include "ResponseParser.h"
+#include <string>
 #include <vector>
 
 namespace bitwave {
 namespace http {
 
-    // a simply http Response unpack ruler to unpack tcp stream
+    // a http Response unpack ruler to unpack tcp stream, it keeps the
+    // parse state of the response at the front of the stream, so data
+    // received in many pieces is parsed once. An invalid response is
+    // unpacked with all data of the stream, and Response throws for it
     class ResponseUnpackRuler
     {
     public:
-        static bool CanUnpack(const char *stream,
+        ResponseUnpackRuler();
+
+        bool CanUnpack(const char *stream,
+                std::size_t size, std::size_t *pack_len);
+
+        // the stream is closed, the response of content to the end of
+        // the connection is unpacked
+        bool CanUnpackAtEnd(const char *stream,
                 std::size_t size, std::size_t *pack_len);
+
+    private:
+        ResponseParser parser_;
     };
 
     class Response
@@ -25,6 +40,8 @@ namespace http {
             SERVER_ERROR
         };
 
+        // [stream, stream + size) is a whole response, the content of a
+        // response without length is to the end
         Response(const char *stream, std::size_t size);
 
         int GetStatusCode() const;
@@ -32,6 +49,11 @@ namespace http {
         double GetHttpVersion() const;
         std::string GetReasonPhrase() const;
 
+        // the connection can be used by next request, it is the default
+        // of HTTP/1.1 without "Connection: close", and HTTP/1.0 needs
+        // "Connection: keep-alive"
+        bool IsKeepAlive() const;
+
         // get response content, pointer to content buffer,
         // return zero when the response has no content
         const char * GetContentBufPointer() const;
@@ -44,6 +66,7 @@ namespace http {
         int status_code_type_;
         double http_version_;
         std::string reason_phrase_;
+        bool keep_alive_;
         ContentBuffer content_buffer_;
     };
 
@@ -0,0 +1,315 @@
+#include "ResponseParser.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+    // content is reserved at most this bytes by Content-Length, a wrong
+    // length does not allocate too much memory
+    const std::size_t max_reserve_size = 1024 * 1024;
+
+    std::string ToLower(const std::string& str)
+    {
+        std::string result(str);
+        for (std::string::iterator it = result.begin(); it != result.end(); ++it)
+            *it = static_cast<char>(tolower(static_cast<unsigned char>(*it)));
+        return result;
+    }
+
+    std::string Trim(const std::string& str)
+    {
+        std::string::size_type first = str.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            return std::string();
+        std::string::size_type last = str.find_last_not_of(" \t");
+        return str.substr(first, last - first + 1);
+    }
+
+} // unnamed namespace
+
+namespace bitwave {
+namespace http {
+
+    ResponseParser::ResponseParser(bool keep_content)
+        : keep_content_(keep_content)
+    {
+        Reset();
+    }
+
+    void ResponseParser::Reset()
+    {
+        state_ = STATUS_LINE;
+        parsed_length_ = 0;
+        line_.clear();
+        content_left_ = 0;
+        chunked_ = false;
+        content_to_end_ = false;
+        status_code_ = 0;
+        http_version_ = 0;
+        reason_phrase_.clear();
+        headers_.clear();
+        content_.clear();
+    }
+
+    std::size_t ResponseParser::Parse(const char *data, std::size_t size)
+    {
+        std::size_t used = 0;
+        while (used < size && state_ != COMPLETE && state_ != PARSE_ERROR)
+        {
+            if (state_ == CONTENT || state_ == CHUNK_DATA)
+            {
+                used += ReadContent(data + used, size - used);
+            }
+            else
+            {
+                bool complete = false;
+                used += ReadLine(data + used, size - used, &complete);
+                if (complete)
+                    ParseLine();
+            }
+        }
+
+        parsed_length_ += used;
+        return used;
+    }
+
+    void ResponseParser::EndOfStream()
+    {
+        if (state_ == COMPLETE)
+            return ;
+
+        state_ = state_ == CONTENT && content_to_end_ ? COMPLETE : PARSE_ERROR;
+    }
+
+    std::string ResponseParser::GetHeader(const std::string& name) const
+    {
+        std::string lower_name = ToLower(name);
+        for (Headers::const_iterator it = headers_.begin(); it != headers_.end(); ++it)
+        {
+            if (it->first == lower_name)
+                return it->second;
+        }
+        return std::string();
+    }
+
+    bool ResponseParser::IsKeepAlive() const
+    {
+        // HTTP/1.1 is kept alive without "Connection: close", and
+        // HTTP/1.0 needs "Connection: keep-alive", the end of content
+        // to the end is the close of the connection
+        if (content_to_end_)
+            return false;
+
+        std::string connection = ToLower(GetHeader("Connection"));
+        if (http_version_ >= 1.1)
+            return connection.find("close") == std::string::npos;
+        return connection.find("keep-alive") != std::string::npos;
+    }
+
+    std::size_t ResponseParser::ReadLine(const char *data, std::size_t size,
+                                         bool *complete)
+    {
+        const char *end = static_cast<const char *>(memchr(data, '\n', size));
+        std::size_t used = end ? end - data + 1 : size;
+        line_.append(data, end ? end : data + size);
+
+        if (end)
+        {
+            if (!line_.empty() && line_[line_.size() - 1] == '\r')
+                line_.erase(line_.size() - 1);
+            *complete = true;
+        }
+        else if (line_.size() > max_line_length)
+        {
+            state_ = PARSE_ERROR;
+        }
+        return used;
+    }
+
+    std::size_t ResponseParser::ReadContent(const char *data, std::size_t size)
+    {
+        if (content_to_end_)
+        {
+            if (keep_content_)
+                content_.insert(content_.end(), data, data + size);
+            return size;
+        }
+
+        std::size_t used = std::min(content_left_, size);
+        if (keep_content_)
+            content_.insert(content_.end(), data, data + used);
+
+        content_left_ -= used;
+        if (content_left_ == 0)
+            state_ = chunked_ ? CHUNK_DATA_END : COMPLETE;
+        return used;
+    }
+
+    void ResponseParser::ParseLine()
+    {
+        switch (state_)
+        {
+        case STATUS_LINE:
+            // empty lines before a response are ignored
+            if (!line_.empty())
+                ParseStatusLine();
+            break;
+
+        case HEADER:
+            if (line_.empty())
+                EndHeaders();
+            else
+                ParseHeaderLine();
+            break;
+
+        case CHUNK_SIZE:
+            ParseChunkSize();
+            break;
+
+        case CHUNK_DATA_END:
+            state_ = line_.empty() ? CHUNK_SIZE : PARSE_ERROR;
+            break;
+
+        case TRAILER:
+            // trailer headers are ignored
+            if (line_.empty())
+                state_ = COMPLETE;
+            break;
+
+        default:
+            break;
+        }
+
+        line_.clear();
+    }
+
+    void ResponseParser::ParseStatusLine()
+    {
+        // HTTP/1.1 200 OK
+        const char http[] = "HTTP/";
+        if (line_.compare(0, sizeof(http) - 1, http) != 0)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        std::string::size_type code_begin = line_.find(' ');
+        if (code_begin == std::string::npos)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        http_version_ = atof(line_.substr(sizeof(http) - 1,
+                    code_begin - (sizeof(http) - 1)).c_str());
+
+        ++code_begin;
+        std::string::size_type code_end = line_.find(' ', code_begin);
+        status_code_ = atoi(line_.substr(code_begin, code_end == std::string::npos ?
+                    std::string::npos : code_end - code_begin).c_str());
+        if (status_code_ < 100 || status_code_ > 999)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        if (code_end != std::string::npos)
+            reason_phrase_ = line_.substr(code_end + 1);
+        state_ = HEADER;
+    }
+
+    void ResponseParser::ParseHeaderLine()
+    {
+        // a folded line continues the value of the previous header
+        if (line_[0] == ' ' || line_[0] == '\t')
+        {
+            if (headers_.empty())
+            {
+                state_ = PARSE_ERROR;
+                return ;
+            }
+
+            headers_.back().second += " " + Trim(line_);
+            return ;
+        }
+
+        std::string::size_type colon = line_.find(':');
+        if (colon == std::string::npos)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        headers_.push_back(std::make_pair(ToLower(Trim(line_.substr(0, colon))),
+                    Trim(line_.substr(colon + 1))));
+    }
+
+    void ResponseParser::ParseChunkSize()
+    {
+        // chunk size in hex, chunk extensions after ';' are ignored
+        std::string::size_type end = line_.find_first_not_of("0123456789abcdefABCDEF");
+        if (end == std::string::npos)
+            end = line_.size();
+        if (end == 0 || end > sizeof(std::size_t) * 2)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        content_left_ = strtoul(line_.substr(0, end).c_str(), 0, 16);
+        state_ = content_left_ == 0 ? TRAILER : CHUNK_DATA;
+    }
+
+    void ResponseParser::EndHeaders()
+    {
+        // an interim response is followed by the final response
+        if (status_code_ / 100 == 1)
+        {
+            headers_.clear();
+            state_ = STATUS_LINE;
+            return ;
+        }
+
+        if (status_code_ == 204 || status_code_ == 304)
+        {
+            state_ = COMPLETE;
+            return ;
+        }
+
+        if (ToLower(GetHeader("Transfer-Encoding")).find("chunked") != std::string::npos)
+        {
+            chunked_ = true;
+            state_ = CHUNK_SIZE;
+            return ;
+        }
+
+        std::string length = GetHeader("Content-Length");
+        if (length.empty())
+        {
+            content_to_end_ = true;
+            state_ = CONTENT;
+            return ;
+        }
+
+        if (length.find_first_not_of("0123456789") != std::string::npos)
+        {
+            state_ = PARSE_ERROR;
+            return ;
+        }
+
+        content_left_ = strtoul(length.c_str(), 0, 10);
+        if (content_left_ == 0)
+        {
+            state_ = COMPLETE;
+            return ;
+        }
+
+        if (keep_content_)
+            content_.reserve(std::min(content_left_, max_reserve_size));
+        state_ = CONTENT;
+    }
+
+} // namespace http
+} // namespace bitwave
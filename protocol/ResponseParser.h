@@ -0,0 +1,114 @@
+#ifndef RESPONSE_PARSER_H
+#define RESPONSE_PARSER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bitwave {
+namespace http {
+
+    // a resumable HTTP/1.1 response parser. Data of a response is passed
+    // in one or more calls of Parse, the state is kept between calls, so
+    // every byte is parsed only once, and it never throws on partial or
+    // invalid data. Content of Content-Length and chunked
+    // Transfer-Encoding is supported, header names are case insensitive.
+    // A response has no Content-Length and is not chunked has content to
+    // the end of the connection, it is complete after EndOfStream
+    class ResponseParser
+    {
+    public:
+        enum State
+        {
+            STATUS_LINE,
+            HEADER,
+            CONTENT,
+            CHUNK_SIZE,
+            CHUNK_DATA,
+            CHUNK_DATA_END,
+            TRAILER,
+            COMPLETE,
+            PARSE_ERROR
+        };
+
+        // the longest status line, header line or chunk size line
+        static const std::size_t max_line_length = 8 * 1024;
+
+        // content is not kept when keep_content is false, it is only
+        // parsed to find the end of the response
+        explicit ResponseParser(bool keep_content = true);
+
+        // parse a new response
+        void Reset();
+
+        // parse [data, data + size) follows data of the previous calls,
+        // return bytes parsed, it stops at the end of the response, so
+        // the rest data is the next response
+        std::size_t Parse(const char *data, std::size_t size);
+
+        // the connection is closed after the data parsed, a response of
+        // content to the end is complete, others are errors
+        void EndOfStream();
+
+        State GetState() const
+            { return state_; }
+        bool IsComplete() const
+            { return state_ == COMPLETE; }
+        bool IsError() const
+            { return state_ == PARSE_ERROR; }
+
+        // bytes of the response parsed
+        std::size_t GetParsedLength() const
+            { return parsed_length_; }
+
+        int GetStatusCode() const
+            { return status_code_; }
+        double GetHttpVersion() const
+            { return http_version_; }
+        const std::string& GetReasonPhrase() const
+            { return reason_phrase_; }
+
+        // value of the header, an empty string when the response has no
+        // such header
+        std::string GetHeader(const std::string& name) const;
+
+        // the connection can be used by next request
+        bool IsKeepAlive() const;
+
+        const std::vector<char>& GetContent() const
+            { return content_; }
+
+    private:
+        // name in lower case and value without spaces around
+        typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+        // append data to line_ until '\n', return bytes used
+        std::size_t ReadLine(const char *data, std::size_t size, bool *complete);
+        std::size_t ReadContent(const char *data, std::size_t size);
+        void ParseLine();
+        void ParseStatusLine();
+        void ParseHeaderLine();
+        void ParseChunkSize();
+        void EndHeaders();
+
+        bool keep_content_;
+        State state_;
+        std::size_t parsed_length_;
+        std::string line_;
+        // bytes of content or chunk not read yet
+        std::size_t content_left_;
+        bool chunked_;
+        // content is to the end of the connection
+        bool content_to_end_;
+
+        int status_code_;
+        double http_version_;
+        std::string reason_phrase_;
+        Headers headers_;
+        std::vector<char> content_;
+    };
+
+} // namespace http
+} // namespace bitwave
+
+#endif // RESPONSE_PARSER_H
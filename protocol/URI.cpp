@@ -90,7 +90,10 @@ namespace http {
 
         end = host_.find(':');
         if (end != std::string::npos)
+        {
+            port_ = host_.substr(end + 1);
             host_.erase(end, host_.size() - end);
+        }
     }
 
 } // namespace http
@@ -16,7 +16,8 @@ namespace http {
         explicit URI(const std::string& url)
             : numofquery_(0),
               query_(url),
-              host_()
+              host_(),
+              port_()
         {
             ParseHostFromUri();
         }
@@ -26,6 +27,12 @@ namespace http {
             return host_;
         }
 
+        // port of the authority, it is empty when the url has no port
+        std::string GetPort() const
+        {
+            return port_;
+        }
+
         std::string GetQueryString() const
         {
             return query_;
@@ -68,6 +75,7 @@ namespace http {
         int numofquery_;
         std::string query_;
         std::string host_;
+        std::string port_;
     };
 
 } // namespace http
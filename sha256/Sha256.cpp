@@ -0,0 +1,316 @@
+#include "Sha256.h"
+#include <string.h>
+
+#if defined(_MSC_VER) && _MSC_VER >= 1900 && (defined(_M_IX86) || defined(_M_X64))
+#define SHA256_SHA_EXTENSIONS
+#define SHA256_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SHA256_SHA_EXTENSIONS
+#define SHA256_TARGET __attribute__((target("sha,sse4.1")))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace bitwave {
+
+    namespace {
+
+        typedef void (*CompressFunction)(unsigned *state,
+                const unsigned char *data, std::size_t blocks);
+
+        const unsigned k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+            0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+            0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+            0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+            0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+            0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+            0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        inline unsigned Rotr(unsigned x, int n)
+        {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        inline unsigned LoadBigEndian(const unsigned char *p)
+        {
+            return (static_cast<unsigned>(p[0]) << 24) |
+                   (static_cast<unsigned>(p[1]) << 16) |
+                   (static_cast<unsigned>(p[2]) << 8) |
+                   static_cast<unsigned>(p[3]);
+        }
+
+        inline void StoreBigEndian(unsigned x, char *p)
+        {
+            p[0] = static_cast<char>(x >> 24);
+            p[1] = static_cast<char>(x >> 16);
+            p[2] = static_cast<char>(x >> 8);
+            p[3] = static_cast<char>(x);
+        }
+
+        // one round, the working variables rotate by the names of the
+        // arguments instead of moving, so 8 rounds are a cycle
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, i)                             \
+        do                                                                  \
+        {                                                                   \
+            unsigned t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) +   \
+                ((e & f) ^ (~e & g)) + k[i] + w[i];                         \
+            unsigned t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) +       \
+                ((a & b) ^ (a & c) ^ (b & c));                              \
+            d += t1;                                                        \
+            h = t1 + t2;                                                    \
+        } while (0)
+
+        void CompressPortable(unsigned *state,
+                              const unsigned char *data, std::size_t blocks)
+        {
+            unsigned w[64];
+            for (; blocks > 0; --blocks, data += 64)
+            {
+                for (int i = 0; i < 16; ++i)
+                    w[i] = LoadBigEndian(data + i * 4);
+                for (int i = 16; i < 64; ++i)
+                {
+                    unsigned s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    unsigned s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+
+                unsigned a = state[0], b = state[1], c = state[2], d = state[3];
+                unsigned e = state[4], f = state[5], g = state[6], h = state[7];
+                for (int i = 0; i < 64; i += 8)
+                {
+                    SHA256_ROUND(a, b, c, d, e, f, g, h, i);
+                    SHA256_ROUND(h, a, b, c, d, e, f, g, i + 1);
+                    SHA256_ROUND(g, h, a, b, c, d, e, f, i + 2);
+                    SHA256_ROUND(f, g, h, a, b, c, d, e, i + 3);
+                    SHA256_ROUND(e, f, g, h, a, b, c, d, i + 4);
+                    SHA256_ROUND(d, e, f, g, h, a, b, c, i + 5);
+                    SHA256_ROUND(c, d, e, f, g, h, a, b, i + 6);
+                    SHA256_ROUND(b, c, d, e, f, g, h, a, i + 7);
+                }
+
+                state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+                state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            }
+        }
+
+#undef SHA256_ROUND
+
+#if defined(SHA256_SHA_EXTENSIONS)
+
+        // 4 rounds of the message words w, a sha256rnds2 does 2 rounds
+#define SHA256_NI_ROUNDS(w, i)                                              \
+        do                                                                  \
+        {                                                                   \
+            __m128i msg = _mm_add_epi32(w,                                  \
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(k + i))); \
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);            \
+            state0 = _mm_sha256rnds2_epu32(state0, state1,                  \
+                    _mm_shuffle_epi32(msg, 0x0E));                          \
+        } while (0)
+
+        // w0 of the words 16 rounds before becomes the next 4 words
+#define SHA256_NI_SCHEDULE(w0, w1, w2, w3)                                  \
+        w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), \
+                    _mm_alignr_epi8(w3, w2, 4)), w3)
+
+        SHA256_TARGET
+        void CompressExtensions(unsigned *state,
+                                const unsigned char *data, std::size_t blocks)
+        {
+            const __m128i byte_swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                                    11, 10, 9, 8, 15, 14, 13, 12);
+
+            // the state is in ABEF and CDGH order for sha256rnds2
+            __m128i abcd = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+            __m128i efgh = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4));
+            abcd = _mm_shuffle_epi32(abcd, 0xB1);
+            efgh = _mm_shuffle_epi32(efgh, 0x1B);
+            __m128i state0 = _mm_alignr_epi8(abcd, efgh, 8);
+            __m128i state1 = _mm_blend_epi16(efgh, abcd, 0xF0);
+
+            for (; blocks > 0; --blocks, data += 64)
+            {
+                __m128i save0 = state0;
+                __m128i save1 = state1;
+                const __m128i *block = reinterpret_cast<const __m128i *>(data);
+                __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128(block), byte_swap);
+                __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128(block + 1), byte_swap);
+                __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128(block + 2), byte_swap);
+                __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128(block + 3), byte_swap);
+
+                SHA256_NI_ROUNDS(w0, 0);
+                SHA256_NI_ROUNDS(w1, 4);
+                SHA256_NI_ROUNDS(w2, 8);
+                SHA256_NI_ROUNDS(w3, 12);
+                for (int i = 16; i < 64; i += 16)
+                {
+                    SHA256_NI_SCHEDULE(w0, w1, w2, w3);
+                    SHA256_NI_ROUNDS(w0, i);
+                    SHA256_NI_SCHEDULE(w1, w2, w3, w0);
+                    SHA256_NI_ROUNDS(w1, i + 4);
+                    SHA256_NI_SCHEDULE(w2, w3, w0, w1);
+                    SHA256_NI_ROUNDS(w2, i + 8);
+                    SHA256_NI_SCHEDULE(w3, w0, w1, w2);
+                    SHA256_NI_ROUNDS(w3, i + 12);
+                }
+
+                state0 = _mm_add_epi32(state0, save0);
+                state1 = _mm_add_epi32(state1, save1);
+            }
+
+            __m128i feba = _mm_shuffle_epi32(state0, 0x1B);
+            __m128i dchg = _mm_shuffle_epi32(state1, 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+                    _mm_blend_epi16(feba, dchg, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4),
+                    _mm_alignr_epi8(dchg, feba, 8));
+        }
+
+#undef SHA256_NI_ROUNDS
+#undef SHA256_NI_SCHEDULE
+
+        // SHA of cpuid 7 ebx bit 29, SSSE3 and SSE4.1 of cpuid 1 ecx
+        bool HasShaExtensions()
+        {
+            unsigned regs[4] = { 0 };
+#if defined(_MSC_VER)
+            int info[4] = { 0 };
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuidex(info, 7, 0);
+            regs[1] = static_cast<unsigned>(info[1]);
+            __cpuid(info, 1);
+            regs[2] = static_cast<unsigned>(info[2]);
+#else
+            unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if (__get_cpuid_max(0, 0) < 7)
+                return false;
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            regs[1] = ebx;
+            __cpuid(1, eax, ebx, ecx, edx);
+            regs[2] = ecx;
+#endif
+            return (regs[1] & (1u << 29)) != 0 &&
+                   (regs[2] & (1u << 9)) != 0 &&
+                   (regs[2] & (1u << 19)) != 0;
+        }
+
+        const bool has_sha_extensions = HasShaExtensions();
+        CompressFunction compress = has_sha_extensions ?
+            CompressExtensions : CompressPortable;
+
+#else
+
+        CompressFunction compress = CompressPortable;
+
+#endif // SHA256_SHA_EXTENSIONS
+
+    } // unnamed namespace
+
+    Sha256::Sha256()
+    {
+        Reset();
+    }
+
+    void Sha256::Reset()
+    {
+        static const unsigned initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(state_, initial, sizeof(state_));
+        buffered_ = 0;
+        length_ = 0;
+    }
+
+    void Sha256::Update(const char *data, std::size_t length)
+    {
+        const unsigned char *input = reinterpret_cast<const unsigned char *>(data);
+        length_ += length;
+
+        if (buffered_ > 0)
+        {
+            std::size_t fill = sizeof(buffer_) - buffered_;
+            if (fill > length)
+                fill = length;
+            memcpy(buffer_ + buffered_, input, fill);
+            buffered_ += fill;
+            input += fill;
+            length -= fill;
+
+            if (buffered_ < sizeof(buffer_))
+                return ;
+            compress(state_, buffer_, 1);
+            buffered_ = 0;
+        }
+
+        // whole blocks are compressed from the input without copy
+        std::size_t blocks = length / sizeof(buffer_);
+        if (blocks > 0)
+        {
+            compress(state_, input, blocks);
+            input += blocks * sizeof(buffer_);
+            length -= blocks * sizeof(buffer_);
+        }
+
+        if (length > 0)
+        {
+            memcpy(buffer_, input, length);
+            buffered_ = length;
+        }
+    }
+
+    void Sha256::Final(char *digest)
+    {
+        unsigned long long bits = length_ * 8;
+
+        // 0x80, zeros, then the 64 bits length in big endian
+        buffer_[buffered_++] = 0x80;
+        if (buffered_ > sizeof(buffer_) - 8)
+        {
+            memset(buffer_ + buffered_, 0, sizeof(buffer_) - buffered_);
+            compress(state_, buffer_, 1);
+            buffered_ = 0;
+        }
+        memset(buffer_ + buffered_, 0, sizeof(buffer_) - 8 - buffered_);
+        for (int i = 0; i < 8; ++i)
+            buffer_[sizeof(buffer_) - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+        compress(state_, buffer_, 1);
+
+        for (int i = 0; i < 8; ++i)
+            StoreBigEndian(state_[i], digest + i * 4);
+    }
+
+    // static
+    bool Sha256::IsAccelerated()
+    {
+        return compress != CompressPortable;
+    }
+
+    // static
+    void Sha256::EnableAcceleration(bool enable)
+    {
+#if defined(SHA256_SHA_EXTENSIONS)
+        compress = enable && has_sha_extensions ?
+            CompressExtensions : CompressPortable;
+#else
+        (void)enable;
+#endif
+    }
+
+} // namespace bitwave
@@ -0,0 +1,40 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+
+namespace bitwave {
+
+    // SHA-256 of FIPS 180-4. Blocks are compressed by the SHA extensions
+    // of x86 when the processor has them, otherwise by the portable
+    // kernel, the processor is checked once at startup
+    class Sha256
+    {
+    public:
+        static const std::size_t digest_size = 32;
+
+        Sha256();
+
+        void Reset();
+        void Update(const char *data, std::size_t length);
+        // the digest in byte order of the standard, then Reset is needed
+        // for a new message
+        void Final(char *digest);
+
+        // the processor has SHA extensions and they are used
+        static bool IsAccelerated();
+
+        // use the accelerated kernel or not when the processor has it,
+        // for comparing the kernels only
+        static void EnableAcceleration(bool enable);
+
+    private:
+        unsigned state_[8];
+        unsigned char buffer_[64];
+        std::size_t buffered_;
+        unsigned long long length_;
+    };
+
+} // namespace bitwave
+
+#endif // SHA256_H
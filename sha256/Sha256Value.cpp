@@ -0,0 +1,56 @@
+#include "Sha256Value.h"
+#include "Sha256.h"
+#include <iomanip>
+#include <sstream>
+
+namespace bitwave {
+
+    Sha256Value::Sha256Value()
+    {
+        memset(value_, 0, sizeof(value_));
+    }
+
+    Sha256Value::Sha256Value(const char *begin, const char *end)
+    {
+        Calculate(begin, end - begin);
+    }
+
+    Sha256Value::Sha256Value(const char *begin, std::size_t length)
+    {
+        Calculate(begin, length);
+    }
+
+    std::string Sha256Value::GetReadableString() const
+    {
+        std::ostringstream oss;
+        oss << std::hex << std::setfill('0');
+        for (std::size_t i = 0; i < sizeof(value_); ++i)
+            oss << std::setw(2) << (static_cast<unsigned>(value_[i]) & 0xFF);
+        return oss.str();
+    }
+
+    const char * Sha256Value::GetData() const
+    {
+        return value_;
+    }
+
+    int Sha256Value::GetDataSize() const
+    {
+        return sizeof(value_);
+    }
+
+    void Sha256Value::Calculate(const char *begin, std::size_t length)
+    {
+        Sha256 sha256;
+        sha256.Update(begin, length);
+        sha256.Final(value_);
+    }
+
+    Sha256Value StreamToSha256Value(const char *stream)
+    {
+        Sha256Value result;
+        memcpy(result.value_, stream, sizeof(result.value_));
+        return result;
+    }
+
+} // namespace bitwave
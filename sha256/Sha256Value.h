@@ -0,0 +1,49 @@
+#ifndef SHA256_VALUE_H
+#define SHA256_VALUE_H
+
+#include <string>
+#include <string.h>
+
+namespace bitwave {
+
+    // digest of SHA-256, the bytes are in the order of the digest, so
+    // it is sent and compared as is
+    class Sha256Value
+    {
+    public:
+        Sha256Value();
+        Sha256Value(const char *begin, const char *end);
+        Sha256Value(const char *begin, std::size_t length);
+
+        std::string GetReadableString() const;
+        const char * GetData() const;
+        int GetDataSize() const;
+
+        friend bool operator == (const Sha256Value& left, const Sha256Value& right)
+        {
+            return memcmp(left.value_, right.value_, sizeof(left.value_)) == 0;
+        }
+
+        friend bool operator != (const Sha256Value& left, const Sha256Value& right)
+        {
+            return !(left == right);
+        }
+
+        friend bool operator < (const Sha256Value& left, const Sha256Value& right)
+        {
+            return memcmp(left.value_, right.value_, sizeof(left.value_)) < 0;
+        }
+
+        // the digest of 32 bytes in stream, it is not hashed again
+        friend Sha256Value StreamToSha256Value(const char *stream);
+
+    private:
+        void Calculate(const char *begin, std::size_t length);
+        char value_[32];
+    };
+
+    Sha256Value StreamToSha256Value(const char *stream);
+
+} // namespace bitwave
+
+#endif // SHA256_VALUE_H
@@ -0,0 +1,60 @@
+#include "../core/BitFastExtension.h"
+#include "../sha1/NetSha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <string.h>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // test vectors of BEP 6: ip 80.4.4.200, info hash of 20 bytes 0xaa,
+    // 1313 pieces
+    const std::size_t expect_set[] = { 1059, 431, 808, 1217, 287, 376, 1188, 353, 508 };
+
+    // the first k pieces of the allowed fast set are the test vectors
+    bool Check(std::size_t k)
+    {
+        char info_hash_stream[20];
+        memset(info_hash_stream, 0xaa, sizeof(info_hash_stream));
+        Sha1Value info_hash = NetStreamToSha1Value(info_hash_stream);
+
+        unsigned char ip[4] = { 80, 4, 4, 200 };
+        unsigned int address = 0;
+        memcpy(&address, ip, sizeof(ip));
+
+        std::vector<std::size_t> pieces;
+        GenerateAllowedFastSet(address, info_hash, 1313, k, pieces);
+
+        if (pieces.size() != k)
+            return false;
+        for (std::size_t i = 0; i < k; ++i)
+        {
+            if (pieces[i] != expect_set[i])
+                return false;
+        }
+        return true;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(bep6_vectors)
+{
+    CHECK_TRUE(Check(7));
+    CHECK_TRUE(Check(9));
+}
+
+// k is limited by piece count
+TEST_CASE(few_pieces)
+{
+    std::vector<std::size_t> pieces;
+    GenerateAllowedFastSet(0, Sha1Value(), 3, 10, pieces);
+    CHECK_TRUE(pieces.size() == 3);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "../core/bencode/BenDecoder.h"
+#include "../core/bencode/BenTypes.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <new>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core::bentypes;
+
+// a torrent of file_count files and pieces of about 50MB in all is
+// decoded by the tree of BenTypes and by BenDecoder, parse time and peak
+// heap memory of both are compared, memory is counted by operator new
+
+const int file_count = 200000;
+const std::size_t torrent_size = 50 * 1024 * 1024;
+
+std::size_t heap_size = 0;
+std::size_t peak_heap_size = 0;
+
+void * operator new (std::size_t size)
+{
+    std::size_t *p = static_cast<std::size_t *>(malloc(size + sizeof(std::size_t) * 2));
+    if (!p)
+        throw std::bad_alloc();
+    *p = size;
+    heap_size += size;
+    if (heap_size > peak_heap_size)
+        peak_heap_size = heap_size;
+    return p + 2;
+}
+
+void operator delete (void *ptr)
+{
+    if (!ptr)
+        return ;
+    std::size_t *p = static_cast<std::size_t *>(ptr) - 2;
+    heap_size -= *p;
+    free(p);
+}
+
+void * operator new [] (std::size_t size)
+{
+    return operator new (size);
+}
+
+void operator delete [] (void *ptr)
+{
+    operator delete (ptr);
+}
+
+namespace {
+
+    double NowMillisecond()
+    {
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    bool Decode(BenDecoder& decoder, const char *str)
+    {
+        return decoder.Decode(str, strlen(str));
+    }
+
+    std::string MakeTorrent()
+    {
+        std::string torrent = "d8:announce29:http://tracker.sample.com/ann4:infod5:filesl";
+        char buf[64];
+        for (int i = 0; i < file_count; ++i)
+        {
+            sprintf(buf, "d6:lengthi%de4:pathl5:dir%02d14:file%06d.datee", i + 1, i % 100, i);
+            torrent += buf;
+        }
+        torrent += "e4:name7:sample012:piece lengthi262144e6:pieces";
+
+        std::size_t pieces = (torrent_size - torrent.size()) / 20 * 20;
+        sprintf(buf, "%u:", static_cast<unsigned>(pieces));
+        torrent += buf;
+        torrent.append(pieces, 'p');
+        torrent += "ee";
+        return torrent;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(decode)
+{
+    BenDecoder decoder;
+    CHECK_TRUE(Decode(decoder, "i-42e"));
+    CHECK_TRUE(decoder.GetRoot().GetInteger() == -42);
+
+    CHECK_TRUE(Decode(decoder, "0:"));
+    CHECK_TRUE(decoder.GetRoot().IsString());
+    CHECK_TRUE(decoder.GetRoot().GetStringLength() == 0);
+
+    // data after the first value is not decoded
+    CHECK_TRUE(Decode(decoder, "l4:spami3eeabc"));
+    CHECK_TRUE(decoder.GetDecodedSize() == 11);
+    BenNode list = decoder.GetRoot();
+    CHECK_TRUE(list.IsList() && list.Size() == 2);
+    CHECK_TRUE(list.First().GetString() == "spam");
+    CHECK_TRUE(list.First().Next().GetInteger() == 3);
+    CHECK_TRUE(!list.First().Next().Next().IsValid());
+
+    const char dict[] = "d3:cowd3:mool1:aee4:spam4:eggs5:emptyle1:ni7ee";
+    CHECK_TRUE(Decode(decoder, dict));
+    BenNode root = decoder.GetRoot();
+    CHECK_TRUE(root.IsDictionary() && root.Size() == 4);
+    CHECK_TRUE(root.FindString("spam").GetString() == "eggs");
+    CHECK_TRUE(root.FindInteger("n").GetInteger() == 7);
+    CHECK_TRUE(!root.FindString("n").IsValid());
+    CHECK_TRUE(!root.Find("none").IsValid());
+    CHECK_TRUE(root.FindList("empty").IsValid());
+    CHECK_TRUE(!root.FindList("empty").First().IsValid());
+
+    BenNode cow = root.FindDictionary("cow");
+    CHECK_TRUE(std::string(cow.GetRawBegin(), cow.GetRawEnd()) == "d3:mool1:aee");
+    CHECK_TRUE(cow.FindList("moo").First().GetString() == "a");
+    // values of a nested dictionary are not values of its parent
+    CHECK_TRUE(!cow.FindList("moo").First().Next().IsValid());
+    CHECK_TRUE(cow.Next().GetString() == "spam");
+
+    // type accessors of other types are empty
+    CHECK_TRUE(root.GetInteger() == 0);
+    CHECK_TRUE(root.GetStringData() == 0);
+    CHECK_TRUE(!root.FindString("spam").First().IsValid());
+
+    const char *invalid[] = {
+        "", "i", "ie", "i-e", "i12", "i1234567890123456789e", "5:abc",
+        "1x", "l", "li1e", "d1:ae", "di1ei2ee", "x",
+    };
+    for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        CHECK_TRUE(!Decode(decoder, invalid[i]));
+        CHECK_TRUE(!decoder.GetRoot().IsValid());
+    }
+
+    std::string deep(BenDecoder::max_depth + 1, 'l');
+    deep.append(BenDecoder::max_depth + 1, 'e');
+    CHECK_TRUE(!decoder.Decode(deep.data(), deep.size()));
+    deep = deep.substr(1, deep.size() - 2);
+    CHECK_TRUE(decoder.Decode(deep.data(), deep.size()));
+}
+
+TEST_CASE(benchmark)
+{
+    std::string torrent = MakeTorrent();
+
+    std::size_t base = heap_size;
+    peak_heap_size = heap_size;
+    double begin = NowMillisecond();
+    {
+        BenTypesStreamBuf buf(torrent.data(), torrent.size());
+        std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+        CHECK_TRUE(object);
+    }
+    double tree_time = NowMillisecond() - begin;
+    std::size_t tree_memory = peak_heap_size - base;
+
+    peak_heap_size = heap_size;
+    begin = NowMillisecond();
+    std::size_t file_number = 0;
+    {
+        BenDecoder decoder;
+        CHECK_TRUE(decoder.Decode(torrent.data(), torrent.size()));
+        BenNode files = decoder.GetRoot().FindDictionary("info").FindList("files");
+        for (BenNode file = files.First(); file.IsValid(); file = file.Next())
+            ++file_number;
+    }
+    double decoder_time = NowMillisecond() - begin;
+    std::size_t decoder_memory = peak_heap_size - base;
+    CHECK_TRUE(file_number == file_count);
+
+    std::cout << "torrent of " << torrent.size() << " bytes and " << file_count
+              << " files" << std::endl;
+    std::cout << "BenTypes tree: " << tree_time << "ms, peak memory "
+              << tree_memory / 1024 << "KB" << std::endl;
+    std::cout << "BenDecoder: " << decoder_time << "ms, peak memory "
+              << decoder_memory / 1024 << "KB" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "../core/bencode/BenEncoder.h"
+#include "../core/bencode/BenDecoder.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core::bentypes;
+
+// a dictionary of file_count files is encoded run_count times by
+// BenWriter and by std::ostringstream as messages are built by hand,
+// throughput of both is compared
+
+const int file_count = 10000;
+const int run_count = 20;
+
+namespace {
+
+    double NowMillisecond()
+    {
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    std::size_t EncodeByWriter(DefaultBufferCache& cache)
+    {
+        BenWriter writer(cache);
+        {
+            BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            BenDictionaryWriter info(torrent.Key("info"));
+            info.Key("files").BeginList();
+            char name[32];
+            for (int i = 0; i < file_count; ++i)
+            {
+                int length = sprintf(name, "file%06d.dat", i);
+                BenDictionaryWriter file(writer);
+                file.Add("length", 1000000LL * i);
+                file.Key("path").BeginList();
+                writer.WriteString("directory", 9);
+                writer.WriteString(name, length);
+                writer.End();
+            }
+            writer.End();
+            info.Add("name", "sample").Add("piece length", 262144);
+        }
+        return writer.GetSize();
+    }
+
+    std::size_t EncodeByStream()
+    {
+        std::ostringstream oss;
+        std::string announce = "http://tracker.sample.com/announce";
+        oss << "d8:announce" << announce.size() << ':' << announce << "4:infod5:filesl";
+        char name[32];
+        for (int i = 0; i < file_count; ++i)
+        {
+            int length = sprintf(name, "file%06d.dat", i);
+            oss << "d6:lengthi" << 1000000LL * i << "e4:pathl9:directory"
+                << length << ':' << name << "ee";
+        }
+        oss << "e4:name6:sample12:piece lengthi262144eee";
+        return oss.str().size();
+    }
+
+} // unnamed namespace
+
+TEST_CASE(writer)
+{
+    DefaultBufferCache cache;
+
+    {
+        BenWriter writer(cache, 0);
+        writer.WriteInteger(0);
+        CHECK_TRUE(writer.IsComplete());
+        CHECK_TRUE(writer.GetString() == "i0e");
+
+        writer.Clear();
+        writer.WriteInteger(-9223372036854775807LL - 1);
+        CHECK_TRUE(writer.GetString() == "i-9223372036854775808e");
+
+        writer.Clear();
+        writer.WriteString("");
+        CHECK_TRUE(writer.GetString() == "0:");
+    }
+
+    // grown from a small buffer, the same as the decoded value
+    BenWriter writer(cache, 1);
+    {
+        BenDictionaryWriter dict(writer);
+        dict.Add("a", -3);
+        writer.WriteString("list");
+        writer.BeginList();
+        writer.WriteString(std::string(300, 'x'));
+        writer.BeginDictionary();
+        writer.End();
+        writer.WriteRaw("i7e", 3);
+        writer.End();
+        dict.Key("nested").BeginList();
+        writer.End();
+        dict.Add("z", "spam").Add("zz", "\0\1", 2);
+        CHECK_TRUE(!writer.IsComplete());
+    }
+    CHECK_TRUE(writer.IsComplete());
+
+    std::string expected = "d1:ai-3e4:listl300:" + std::string(300, 'x') +
+        "dei7ee6:nestedle1:z4:spam2:zz2:" + std::string("\0\1", 2) + "e";
+    CHECK_TRUE(writer.GetString() == expected);
+
+    BenDecoder decoder;
+    CHECK_TRUE(decoder.Decode(writer.GetData(), writer.GetSize()));
+    CHECK_TRUE(decoder.GetDecodedSize() == writer.GetSize());
+    CHECK_TRUE(decoder.GetRoot().FindInteger("a").GetInteger() == -3);
+    CHECK_TRUE(decoder.GetRoot().FindString("z").GetString() == "spam");
+
+    std::size_t size = writer.GetSize();
+    Buffer buffer = writer.DetachBuffer();
+    CHECK_TRUE(buffer && memcmp(buffer.GetBuffer(), expected.data(), size) == 0);
+    CHECK_TRUE(writer.GetSize() == 0);
+    cache.FreeBuffer(buffer);
+
+    writer.WriteString("after detach");
+    CHECK_TRUE(writer.GetString() == "12:after detach");
+}
+
+TEST_CASE(benchmark)
+{
+    DefaultBufferCache cache;
+    std::size_t size = 0;
+
+    double begin = NowMillisecond();
+    for (int run = 0; run < run_count; ++run)
+        size = EncodeByWriter(cache);
+    double writer_time = (NowMillisecond() - begin) / run_count;
+
+    begin = NowMillisecond();
+    std::size_t stream_size = 0;
+    for (int run = 0; run < run_count; ++run)
+        stream_size = EncodeByStream();
+    double stream_time = (NowMillisecond() - begin) / run_count;
+    CHECK_TRUE(stream_size == size);
+
+    double megabytes = size / (1024.0 * 1024.0);
+    std::cout << "encode " << size << " bytes of " << file_count << " files" << std::endl;
+    std::cout << "BenWriter: " << writer_time << "ms, "
+              << megabytes * 1000.0 / writer_time << "MB/s" << std::endl;
+    std::cout << "ostringstream: " << stream_time << "ms, "
+              << megabytes * 1000.0 / stream_time << "MB/s" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -26,6 +26,17 @@ TEST_CASE(BenString)
     CHECK_TRUE(s.std_string() == "spam");
 }
 
+TEST_CASE(BenEmptyString)
+{
+    const char *benstring = "0:";
+    BenTypesStreamBuf buf(benstring, strlen(benstring));
+    BenTypesStreamBuf::const_iterator begin = buf.begin();
+    BenTypesStreamBuf::const_iterator end = buf.end();
+    BenString s(begin, end);
+    CHECK_TRUE(s.length() == 0);
+    CHECK_TRUE(begin == end);
+}
+
 TEST_CASE(BenList)
 {
     const char *benlist = "l4:spam4:eggse";
@@ -60,6 +71,20 @@ TEST_CASE(BenDictionary)
     CHECK_TRUE(pv2->std_string() == "eggs");
 }
 
+TEST_CASE(BenPexDictionary)
+{
+    const char *bendict = "d5:added0:7:added.f0:7:dropped6:abcdefe";
+    BenTypesStreamBuf buf(bendict, strlen(bendict));
+    BenTypesStreamBuf::const_iterator begin = buf.begin();
+    BenTypesStreamBuf::const_iterator end = buf.end();
+    BenDictionary d(begin, end);
+    CHECK_TRUE(d.size() == 3);
+    BenString *added = d.ValueBenTypeCast<BenString>("added");
+    BenString *dropped = d.ValueBenTypeCast<BenString>("dropped");
+    CHECK_TRUE(added && added->length() == 0);
+    CHECK_TRUE(dropped && dropped->std_string() == "abcdef");
+}
+
 int main()
 {
     TestCollector.RunCases();
@@ -0,0 +1,284 @@
+#include "../core/BitData.h"
+#include "../core/BitChoker.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../net/IoService.h"
+#include "../net/TimerService.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // a task of 4 pieces, 4 upload slots are 3 regular and 1 optimistic
+    const char torrent_file[] = "TestChoker.torrent";
+    const long long piece_length = 32 * 1024;
+    const std::size_t piece_count = 4;
+    const std::size_t upload_slots = 4;
+    const int regular_weight = 2;
+
+    class TestPeer : public BitChokePeer
+    {
+    public:
+        explicit TestPeer(double rate)
+            : interested_(true),
+              snubbed_(false),
+              choking_(true),
+              weight_(0),
+              rate_(rate)
+        {
+        }
+
+        virtual bool IsPeerInterested() const
+        {
+            return interested_;
+        }
+
+        virtual bool IsSnubbed() const
+        {
+            return snubbed_;
+        }
+
+        virtual bool IsChoking() const
+        {
+            return choking_;
+        }
+
+        virtual void SetChoke(bool choke)
+        {
+            choking_ = choke;
+        }
+
+        virtual void SetUploadWeight(int weight)
+        {
+            weight_ = weight;
+        }
+
+        // the same rate both ways
+        virtual double GetDownloadRate()
+        {
+            return rate_;
+        }
+
+        virtual double GetUploadRate()
+        {
+            return rate_;
+        }
+
+        void SetInterested(bool interested)
+        {
+            interested_ = interested;
+        }
+
+        void SetSnubbed(bool snubbed)
+        {
+            snubbed_ = snubbed;
+        }
+
+        bool IsRegular() const
+        {
+            return !choking_ && weight_ == regular_weight;
+        }
+
+        bool IsOptimistic() const
+        {
+            return !choking_ && weight_ == 1;
+        }
+
+    private:
+        bool interested_;
+        bool snubbed_;
+        bool choking_;
+        int weight_;
+        double rate_;
+    };
+
+    typedef std::tr1::shared_ptr<TestPeer> TestPeerPtr;
+    typedef std::vector<TestPeerPtr> TestPeers;
+
+    std::tr1::shared_ptr<BitData> MakeBitData()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            bentypes::BenDictionaryWriter info(torrent.Key("info"));
+            info.Add("length", piece_length * piece_count);
+            info.Add("name", "TestChoker.bin");
+            info.Add("piece length", piece_length);
+            info.Add("pieces", std::string(20 * piece_count, 'x'));
+        }
+
+        {
+            std::ofstream fs(torrent_file, std::ios_base::out | std::ios_base::binary);
+            fs.write(writer.GetData(), writer.GetSize());
+        }
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        bitdata->SelectAllFile(true);
+        ::DeleteFileA(torrent_file);
+        return bitdata;
+    }
+
+    // the choker of a task and its net and timer services
+    class TestTask
+    {
+    public:
+        TestTask()
+            : bitdata_(MakeBitData())
+        {
+            io_service_.AddService(&timer_service_);
+            BitChoker::SetUploadSlots(upload_slots);
+            choker_.reset(new BitChoker(bitdata_, io_service_));
+        }
+
+        ~TestTask()
+        {
+            choker_.reset();
+        }
+
+        void Seeding()
+        {
+            bitdata_->IncreaseDownloaded(bitdata_->GetTotalSize());
+        }
+
+        // peers of the rates are added to the choker
+        TestPeers AddPeers(const double *rates, std::size_t count)
+        {
+            TestPeers peers;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                peers.push_back(TestPeerPtr(new TestPeer(rates[i])));
+                choker_->AddPeer(peers.back());
+            }
+            return peers;
+        }
+
+        BitChoker& GetChoker()
+        {
+            return *choker_;
+        }
+
+    private:
+        net::IoService io_service_;
+        net::TimerService timer_service_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+        std::tr1::shared_ptr<BitChoker> choker_;
+    };
+
+    std::size_t CountOptimistic(const TestPeers& peers, std::size_t *which)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < peers.size(); ++i)
+        {
+            if (peers[i]->IsOptimistic())
+            {
+                *which = i;
+                ++count;
+            }
+        }
+        return count;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(regular_by_rate)
+{
+    TestTask task;
+    const double rates[] = { 10.0, 60.0, 20.0, 50.0, 30.0, 40.0 };
+    TestPeers peers = task.AddPeers(rates, 6);
+    task.GetChoker().Rechoke();
+
+    // the fastest 3 are regular, one of the others is optimistic
+    CHECK_TRUE(peers[1]->IsRegular());
+    CHECK_TRUE(peers[3]->IsRegular());
+    CHECK_TRUE(peers[5]->IsRegular());
+    std::size_t optimistic = 0;
+    CHECK_TRUE(CountOptimistic(peers, &optimistic) == 1);
+
+    std::size_t choked = 0;
+    for (std::size_t i = 0; i < peers.size(); ++i)
+        choked += peers[i]->IsChoking();
+    CHECK_TRUE(choked == peers.size() - upload_slots);
+
+    // a peer which is not interested gets no slot
+    peers[1]->SetInterested(false);
+    task.GetChoker().Rechoke();
+    CHECK_TRUE(peers[1]->IsChoking());
+    CHECK_TRUE(peers[4]->IsRegular());
+}
+
+TEST_CASE(optimistic_rotation)
+{
+    TestTask task;
+    const double rates[] = { 30.0, 20.0, 10.0, 0.0, 0.0, 0.0 };
+    TestPeers peers = task.AddPeers(rates, 6);
+
+    // the optimistic one is kept for 3 rounds, then the next one
+    std::size_t optimistics[7] = { 0 };
+    for (std::size_t round = 0; round < 7; ++round)
+    {
+        task.GetChoker().Rechoke();
+        CHECK_TRUE(CountOptimistic(peers, &optimistics[round]) == 1);
+        CHECK_TRUE(optimistics[round] >= 3);
+    }
+
+    CHECK_TRUE(optimistics[1] == optimistics[0]);
+    CHECK_TRUE(optimistics[2] == optimistics[0]);
+    CHECK_TRUE(optimistics[3] != optimistics[2]);
+    CHECK_TRUE(optimistics[4] == optimistics[3]);
+    CHECK_TRUE(optimistics[5] == optimistics[3]);
+    CHECK_TRUE(optimistics[6] != optimistics[5]);
+}
+
+TEST_CASE(snubbed_while_leeching)
+{
+    TestTask task;
+    const double rates[] = { 60.0, 50.0, 40.0, 30.0, 20.0 };
+    TestPeers peers = task.AddPeers(rates, 5);
+    peers[0]->SetSnubbed(true);
+
+    // the fastest peer is snubbed, it is not regular
+    task.GetChoker().Rechoke();
+    CHECK_TRUE(!peers[0]->IsRegular());
+    CHECK_TRUE(peers[1]->IsRegular());
+    CHECK_TRUE(peers[2]->IsRegular());
+    CHECK_TRUE(peers[3]->IsRegular());
+
+    // a seeder does not wait piece data, snubbed peers are not excluded
+    task.Seeding();
+    task.GetChoker().Rechoke();
+    CHECK_TRUE(peers[0]->IsRegular());
+    CHECK_TRUE(peers[1]->IsRegular());
+    CHECK_TRUE(peers[2]->IsRegular());
+    CHECK_TRUE(!peers[3]->IsRegular());
+}
+
+TEST_CASE(interested_in_free_slot)
+{
+    TestTask task;
+    const double rates[] = { 10.0, 10.0, 10.0, 10.0, 10.0 };
+    TestPeers peers = task.AddPeers(rates, 5);
+
+    // peers are unchoked at once while there are free slots
+    for (std::size_t i = 0; i < upload_slots; ++i)
+    {
+        task.GetChoker().PeerInterested(peers[i]);
+        CHECK_TRUE(!peers[i]->IsChoking());
+    }
+
+    task.GetChoker().PeerInterested(peers[upload_slots]);
+    CHECK_TRUE(peers[upload_slots]->IsChoking());
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "../core/BitDht.h"
+#include "../core/BitUdpSocket.h"
+#include "../core/dht/DhtMessage.h"
+#include "../core/dht/DhtRoutingTable.h"
+#include "../net/IoService.h"
+#include "../net/ResolveService.h"
+#include "../net/TimerService.h"
+#include "../net/WinSockIniter.h"
+#include "../sha1/Sha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    const unsigned long loopback = 0x7F000001;
+    const int node_count = 20;
+
+    // peers found by a lookup
+    std::set<std::pair<unsigned long, unsigned short> > found_peers;
+    int done_lookups = 0;
+
+    void OnPeer(unsigned long ip, unsigned short port)
+    {
+        found_peers.insert(std::make_pair(ip, port));
+    }
+
+    void OnDone()
+    {
+        ++done_lookups;
+    }
+
+    void RunFor(net::IoService& io_service, DWORD millisecond)
+    {
+        DWORD begin = ::GetTickCount();
+        while (::GetTickCount() - begin < millisecond)
+        {
+            io_service.Run();
+            ::Sleep(1);
+        }
+    }
+
+    void RunUntil(net::IoService& io_service, int lookups, DWORD max_millisecond)
+    {
+        DWORD begin = ::GetTickCount();
+        while (done_lookups < lookups && ::GetTickCount() - begin < max_millisecond)
+        {
+            io_service.Run();
+            ::Sleep(1);
+        }
+    }
+
+} // unnamed namespace
+
+TEST_CASE(message)
+{
+    dht::Message query;
+    query.type = dht::Message::QUERY;
+    query.method = dht::Message::ANNOUNCE_PEER;
+    query.transaction = "aa";
+    query.id = dht::NodeId::Random();
+    query.info_hash = dht::NodeId::Random();
+    query.port = 6881;
+    query.token = "token";
+
+    dht::Message parsed;
+    std::string packet = dht::EncodeMessage(query);
+    bool result = dht::ParseMessage(packet.data(), packet.size(), &parsed);
+    CHECK_TRUE(result);
+    CHECK_TRUE(parsed.type == dht::Message::QUERY);
+    CHECK_TRUE(parsed.method == dht::Message::ANNOUNCE_PEER);
+    CHECK_TRUE(parsed.transaction == "aa");
+    CHECK_TRUE(parsed.id == query.id);
+    CHECK_TRUE(parsed.info_hash == query.info_hash);
+    CHECK_TRUE(parsed.port == 6881 && !parsed.implied_port);
+    CHECK_TRUE(parsed.token == "token");
+
+    dht::Message response;
+    response.type = dht::Message::RESPONSE;
+    response.transaction = "bb";
+    response.id = dht::NodeId::Random();
+    response.token = "tk";
+    response.nodes.push_back(dht::NodeEntry(dht::NodeId::Random(), loopback, 6881));
+    response.values.push_back(std::string("\x7F\x00\x00\x01\x1A\xE1", 6));
+
+    dht::Message parsed_response;
+    packet = dht::EncodeMessage(response);
+    result = dht::ParseMessage(packet.data(), packet.size(), &parsed_response);
+    CHECK_TRUE(result);
+    CHECK_TRUE(parsed_response.type == dht::Message::RESPONSE);
+    CHECK_TRUE(parsed_response.id == response.id);
+    CHECK_TRUE(parsed_response.nodes.size() == 1);
+    CHECK_TRUE(parsed_response.nodes[0].id == response.nodes[0].id);
+    CHECK_TRUE(parsed_response.nodes[0].ip == loopback);
+    CHECK_TRUE(parsed_response.nodes[0].port == 6881);
+    CHECK_TRUE(parsed_response.values.size() == 1);
+    CHECK_TRUE(parsed_response.values[0] == response.values[0]);
+
+    result = dht::ParseMessage("d1:t2:aae", 9, &parsed);
+    CHECK_TRUE(!result);
+}
+
+TEST_CASE(routing_table)
+{
+    dht::NodeId self = dht::NodeId::Random();
+    dht::RoutingTable table(self);
+
+    // the bucket of one leading zero bit is full after 8 nodes, other
+    // nodes go to the replacement cache
+    std::vector<dht::NodeId> ids;
+    for (int i = 0; i < 12; ++i)
+    {
+        ids.push_back(dht::NodeId::Random(self, 1));
+        table.NodeSeen(ids.back(), loopback, static_cast<unsigned short>(7000 + i), 0);
+    }
+    CHECK_TRUE(table.GetNodeCount() == dht::RoutingTable::bucket_size);
+
+    // a node fails twice is replaced
+    for (int i = 0; i < dht::RoutingTable::max_fail_count; ++i)
+        table.NodeFailed(ids[0]);
+
+    std::vector<dht::NodeEntry> closest;
+    table.FindClosest(ids[11], 8, closest);
+    CHECK_TRUE(closest.size() == 8);
+    CHECK_TRUE(closest[0].id == ids[11]);
+    for (std::size_t i = 0; i < closest.size(); ++i)
+        CHECK_TRUE(closest[i].id != ids[0]);
+}
+
+// dht nodes of this process on loopback, every node has its udp socket
+TEST_CASE(loopback_nodes)
+{
+    net::WinSockIniter sock_initer;
+    net::IoService io_service;
+    net::TimerService timer_service;
+    net::ResolveService resolve_service;
+    io_service.AddService(&timer_service);
+    io_service.AddService(&resolve_service);
+
+    std::vector<BitUdpSocket *> sockets;
+    std::vector<BitDht *> nodes;
+    for (int i = 0; i < node_count; ++i)
+    {
+        sockets.push_back(new BitUdpSocket(io_service, 0));
+        nodes.push_back(new BitDht(io_service, sockets.back()));
+    }
+
+    // all nodes bootstrap from the first node
+    unsigned short first_port = sockets[0]->GetLocalPort();
+    CHECK_TRUE(first_port != 0);
+    for (int i = 1; i < node_count; ++i)
+    {
+        nodes[i]->AddBootstrapNode(loopback, first_port);
+        nodes[i]->Bootstrap();
+    }
+    RunFor(io_service, 2000);
+
+    for (int i = 0; i < node_count; ++i)
+    {
+        std::cout << "node " << i << " knows " << nodes[i]->GetNodeCount()
+            << " nodes" << std::endl;
+        CHECK_TRUE(nodes[i]->GetNodeCount() > 0);
+    }
+
+    // node 1 announces an info hash, then node 2 finds it
+    Sha1Value info_hash("bitwave dht test", 16);
+    done_lookups = 0;
+    nodes[1]->GetPeers(info_hash, 6881, BitDht::PeerCallback(), OnDone);
+    RunUntil(io_service, 1, 5000);
+    CHECK_TRUE(done_lookups == 1);
+
+    // announce_peer has no callback, wait for it
+    RunFor(io_service, 500);
+
+    done_lookups = 0;
+    nodes[node_count - 1]->GetPeers(info_hash, 0, OnPeer, OnDone);
+    RunUntil(io_service, 1, 5000);
+    CHECK_TRUE(done_lookups == 1);
+    CHECK_TRUE(found_peers.count(std::make_pair(loopback, 6881)) == 1);
+
+    for (int i = 0; i < node_count; ++i)
+    {
+        delete nodes[i];
+        delete sockets[i];
+    }
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
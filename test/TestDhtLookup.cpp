@@ -0,0 +1,309 @@
+#include "../core/dht/DhtNode.h"
+#include "../sha1/Sha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// lookup latency of a simulated network of 1000 dht nodes. Packets are
+// delivered by an event queue in virtual time with random latency and
+// loss, so the result does not depend on the machine, and the cpu time
+// of the simulation is reported too
+
+const int node_count = 1000;
+const int bootstrap_batch = 50;
+const int announce_count = 20;
+const int lookup_count = 200;
+const NormalTimeType min_latency = 10;
+const NormalTimeType max_latency = 150;
+const int loss_percent = 2;
+const unsigned short node_port = 6881;
+
+class SimNetwork;
+
+class SimNode : public dht::DhtNetwork
+{
+public:
+    SimNode(SimNetwork *network, unsigned long ip);
+
+    virtual void SendPacket(const std::string& packet,
+                            unsigned long ip, unsigned short port);
+    virtual NormalTimeType Now() const;
+
+    dht::DhtNode& GetNode()
+        { return node_; }
+
+    unsigned long GetIp() const
+        { return ip_; }
+
+    std::size_t sent_count;
+
+private:
+    SimNetwork *network_;
+    unsigned long ip_;
+    dht::DhtNode node_;
+};
+
+class SimNetwork
+{
+public:
+    SimNetwork()
+        : now_(1),
+          next_process_(1000),
+          sequence_(0),
+          packet_count_(0)
+    {
+    }
+
+    ~SimNetwork()
+    {
+        for (std::size_t i = 0; i < nodes_.size(); ++i)
+            delete nodes_[i];
+    }
+
+    SimNode * AddNode()
+    {
+        unsigned long ip = 0x0A000001 + static_cast<unsigned long>(nodes_.size());
+        nodes_.push_back(new SimNode(this, ip));
+        return nodes_.back();
+    }
+
+    SimNode * GetNode(std::size_t index)
+        { return nodes_[index]; }
+
+    NormalTimeType Now() const
+        { return now_; }
+
+    std::size_t GetPacketCount() const
+        { return packet_count_; }
+
+    void Send(const std::string& packet, unsigned long from,
+              unsigned long to, unsigned short port)
+    {
+        ++packet_count_;
+        std::size_t index = to - 0x0A000001;
+        if (index >= nodes_.size() || port != node_port)
+            return ;
+        if (rand() % 100 < loss_percent)
+            return ;
+
+        Event event;
+        event.time = now_ + min_latency + rand() % (max_latency - min_latency);
+        event.sequence = sequence_++;
+        event.to = index;
+        event.from = from;
+        event.packet = packet;
+        events_.push(event);
+    }
+
+    // run until the count of done lookups reaches target
+    void RunUntil(const int *done, int target)
+    {
+        while (*done < target)
+        {
+            NormalTimeType next_event = events_.empty() ?
+                next_process_ : events_.top().time;
+            if (next_process_ <= next_event)
+            {
+                now_ = next_process_;
+                next_process_ += 1000;
+                for (std::size_t i = 0; i < nodes_.size(); ++i)
+                    nodes_[i]->GetNode().Process();
+                continue;
+            }
+
+            Event event = events_.top();
+            events_.pop();
+            now_ = event.time;
+            nodes_[event.to]->GetNode().OnPacket(event.packet.data(),
+                    event.packet.size(), event.from, node_port);
+        }
+    }
+
+private:
+    struct Event
+    {
+        NormalTimeType time;
+        std::size_t sequence;
+        std::size_t to;
+        unsigned long from;
+        std::string packet;
+
+        friend bool operator < (const Event& left, const Event& right)
+        {
+            // priority_queue pops the largest, it is the earliest event
+            if (left.time != right.time)
+                return left.time > right.time;
+            return left.sequence > right.sequence;
+        }
+    };
+
+    NormalTimeType now_;
+    NormalTimeType next_process_;
+    std::size_t sequence_;
+    std::size_t packet_count_;
+    std::vector<SimNode *> nodes_;
+    std::priority_queue<Event> events_;
+};
+
+SimNode::SimNode(SimNetwork *network, unsigned long ip)
+    : sent_count(0),
+      network_(network),
+      ip_(ip),
+      node_(dht::NodeId::Random(), this)
+{
+}
+
+void SimNode::SendPacket(const std::string& packet,
+                         unsigned long ip, unsigned short port)
+{
+    ++sent_count;
+    network_->Send(packet, ip_, ip, port);
+}
+
+NormalTimeType SimNode::Now() const
+{
+    return network_->Now();
+}
+
+struct LookupResult
+{
+    LookupResult()
+        : start(0),
+          latency(0),
+          found(false)
+    {
+    }
+
+    NormalTimeType start;
+    NormalTimeType latency;
+    bool found;
+};
+
+int done_count = 0;
+
+void CountDone()
+{
+    ++done_count;
+}
+
+void LookupDone(SimNetwork *network, LookupResult *result)
+{
+    result->latency = network->Now() - result->start;
+    ++done_count;
+}
+
+void LookupPeer(LookupResult *result, unsigned long ip, unsigned short port)
+{
+    result->found = true;
+}
+
+double NowMillisecond()
+{
+    LARGE_INTEGER frequency, counter;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&counter);
+    return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+TEST_CASE(lookup)
+{
+    srand(1);
+    SimNetwork network;
+    for (int i = 0; i < node_count; ++i)
+        network.AddNode();
+
+    double begin = NowMillisecond();
+
+    // nodes bootstrap from the first node in batches, so later nodes
+    // know the earlier nodes
+    done_count = 0;
+    int bootstrapped = 0;
+    for (int i = 1; i < node_count; ++i)
+    {
+        dht::DhtNode& node = network.GetNode(i)->GetNode();
+        node.AddBootstrapNode(network.GetNode(0)->GetIp(), node_port);
+        node.Bootstrap(CountDone);
+        ++bootstrapped;
+        if (bootstrapped % bootstrap_batch == 0 || i == node_count - 1)
+            network.RunUntil(&done_count, bootstrapped);
+    }
+
+    std::size_t total_nodes = 0;
+    for (int i = 0; i < node_count; ++i)
+        total_nodes += network.GetNode(i)->GetNode().GetNodeCount();
+    std::cout << "bootstrap: " << node_count << " nodes, "
+        << total_nodes / node_count << " nodes in routing table on average, "
+        << network.GetPacketCount() << " packets" << std::endl;
+
+    // random nodes announce info hashes
+    std::vector<dht::NodeId> info_hashes;
+    for (int i = 0; i < announce_count; ++i)
+    {
+        info_hashes.push_back(dht::NodeId::Random());
+        done_count = 0;
+        network.GetNode(rand() % node_count)->GetNode().GetPeers(
+                info_hashes.back(), node_port,
+                dht::DhtNode::PeerCallback(), CountDone);
+        network.RunUntil(&done_count, 1);
+    }
+
+    // lookups one by one from random nodes
+    std::vector<LookupResult> results(lookup_count);
+    std::size_t sent = 0;
+    std::size_t found = 0;
+    for (int i = 0; i < lookup_count; ++i)
+    {
+        SimNode *sim_node = network.GetNode(rand() % node_count);
+        std::size_t sent_before = sim_node->sent_count;
+
+        LookupResult& result = results[i];
+        result.start = network.Now();
+        done_count = 0;
+        sim_node->GetNode().GetPeers(info_hashes[i % announce_count], 0,
+                std::tr1::bind(LookupPeer, &result,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2),
+                std::tr1::bind(LookupDone, &network, &result));
+        network.RunUntil(&done_count, 1);
+
+        sent += sim_node->sent_count - sent_before;
+        if (result.found)
+            ++found;
+    }
+
+    double elapsed = NowMillisecond() - begin;
+
+    std::vector<NormalTimeType> latencies;
+    double total_latency = 0.0;
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        latencies.push_back(results[i].latency);
+        total_latency += results[i].latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << "lookup: " << lookup_count << " lookups, found "
+        << found * 100 / lookup_count << "%, latency average "
+        << total_latency / lookup_count << "ms, median "
+        << latencies[latencies.size() / 2] << "ms, 90th "
+        << latencies[latencies.size() * 9 / 10] << "ms, "
+        << static_cast<double>(sent) / lookup_count << " queries per lookup"
+        << std::endl;
+    std::cout << "simulation cpu time " << elapsed << "ms" << std::endl;
+
+    CHECK_TRUE(found * 100 / lookup_count >= 95);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
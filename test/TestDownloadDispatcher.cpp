@@ -0,0 +1,244 @@
+#include "../core/BitData.h"
+#include "../core/BitPeerData.h"
+#include "../core/BitRateMeter.h"
+#include "../core/BitRequestList.h"
+#include "../core/BitDownloadingInfo.h"
+#include "../core/BitDownloadDispatcher.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // a task of 16 pieces of 2 blocks, the pieces are never verified
+    const char torrent_file[] = "TestDownloadDispatcher.torrent";
+    const std::size_t piece_length = 32 * 1024;
+    const std::size_t piece_count = 16;
+    const int block_size = 16 * 1024;
+
+    typedef std::tr1::shared_ptr<BitPeerData> PeerDataPtr;
+
+    std::tr1::shared_ptr<BitData> MakeBitData()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            bentypes::BenDictionaryWriter info(torrent.Key("info"));
+            info.Add("length", static_cast<long long>(piece_length * piece_count));
+            info.Add("name", "TestDownloadDispatcher.bin");
+            info.Add("piece length", static_cast<long long>(piece_length));
+            info.Add("pieces", std::string(20 * piece_count, 'x'));
+        }
+
+        {
+            std::ofstream fs(torrent_file, std::ios_base::out | std::ios_base::binary);
+            fs.write(writer.GetData(), writer.GetSize());
+        }
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        bitdata->SelectAllFile(true);
+        ::DeleteFileA(torrent_file);
+        return bitdata;
+    }
+
+    PeerDataPtr AddPeer(const std::tr1::shared_ptr<BitData>& bitdata,
+                        const std::string& peer_id)
+    {
+        PeerDataPtr peer(new BitPeerData(peer_id, bitdata->GetPieceCount(),
+                    bitdata->GetPieceAvailabilityPtr()));
+        peer->PeerHaveAll();
+        bitdata->AddPeerData(peer);
+        return peer;
+    }
+
+    std::vector<int> PieceIndexes(BitRequestList& request_list)
+    {
+        std::vector<int> indexes;
+        for (BitRequestList::Iterator it = request_list.Begin();
+                it != request_list.End(); ++it)
+            indexes.push_back(it->index);
+        return indexes;
+    }
+
+    std::vector<int> Pieces(int first, int second)
+    {
+        std::vector<int> indexes;
+        indexes.push_back(first);
+        indexes.push_back(first);
+        indexes.push_back(second);
+        indexes.push_back(second);
+        return indexes;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(rate_meter)
+{
+    // alpha of the moving average is 1 / 3
+    BitRateMeter meter(0);
+    meter.AddBytes(3000, 0);
+    CHECK_TRUE(meter.GetRate(999) == 0.0);
+    CHECK_TRUE(meter.GetRate(1000) > 999.9 && meter.GetRate(1000) < 1000.1);
+
+    meter.AddBytes(3000, 1500);
+    CHECK_TRUE(meter.GetRate(2000) > 1666.6 && meter.GetRate(2000) < 1666.7);
+
+    // five samples close nearly 90 percent of the gap to a steady rate
+    NormalTimeType now = 2000;
+    for (int i = 0; i < 5; ++i, now += 1000)
+        meter.AddBytes(3000, now);
+    CHECK_TRUE(meter.GetRate(now) > 2824.0 && meter.GetRate(now) < 2825.0);
+    CHECK_TRUE(meter.GetTotalBytes() == 21000);
+
+    // a sample of nothing, then idle for a long time
+    CHECK_TRUE(meter.GetRate(now + 1000) < 2000.0);
+    CHECK_TRUE(meter.GetRate(now + 40000) == 0.0);
+}
+
+TEST_CASE(streaming_deadline_order)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    BitDownloadingInfo info(bitdata);
+    BitDownloadDispatcher dispatcher(bitdata, &info);
+
+    // pieces after 10 are the rarest, but the play deadline goes first
+    PeerDataPtr seed = AddPeer(bitdata, "seed");
+    PeerDataPtr partial(new BitPeerData("partial", piece_count,
+                bitdata->GetPieceAvailabilityPtr()));
+    for (int i = 0; i < 10; ++i)
+        partial->PeerHavePiece(i);
+    bitdata->AddPeerData(partial);
+
+    // play at piece 5, one piece a second
+    dispatcher.StartStreaming(5 * piece_length, piece_length);
+    CHECK_TRUE(dispatcher.IsStreamingPiece(5));
+    CHECK_TRUE(!dispatcher.IsStreamingPiece(4));
+
+    BitRequestList first;
+    dispatcher.DispatchRequestList(seed, first);
+    CHECK_TRUE(PieceIndexes(first) == Pieces(5, 6));
+
+    BitRequestList second;
+    dispatcher.DispatchRequestList(seed, second);
+    CHECK_TRUE(PieceIndexes(second) == Pieces(7, 8));
+}
+
+TEST_CASE(streaming_unknown_bitrate)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    BitDownloadingInfo info(bitdata);
+    BitDownloadDispatcher dispatcher(bitdata, &info);
+    PeerDataPtr peer1 = AddPeer(bitdata, "peer1");
+    PeerDataPtr peer2 = AddPeer(bitdata, "peer2");
+    PeerDataPtr peer3 = AddPeer(bitdata, "peer3");
+
+    // the window is the minimum 4 pieces from the offset
+    dispatcher.StartStreaming(0, 0);
+    CHECK_TRUE(dispatcher.IsStreamingPiece(3));
+    CHECK_TRUE(!dispatcher.IsStreamingPiece(4));
+
+    BitRequestList list1;
+    dispatcher.DispatchRequestList(peer1, list1);
+    CHECK_TRUE(PieceIndexes(list1) == Pieces(0, 1));
+
+    BitRequestList list2;
+    dispatcher.DispatchRequestList(peer2, list2);
+    CHECK_TRUE(PieceIndexes(list2) == Pieces(2, 3));
+
+    // the requests are late, only the piece at the play position is
+    // due, so only its blocks are requested again
+    ::Sleep(2100);
+    BitRequestList list3;
+    dispatcher.DispatchRequestList(peer3, list3);
+    std::vector<int> due(2, 0);
+    CHECK_TRUE(PieceIndexes(list3) == due);
+}
+
+TEST_CASE(cancel_duplicate_request)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    BitDownloadingInfo info(bitdata);
+    BitDownloadDispatcher dispatcher(bitdata, &info);
+    PeerDataPtr peer1 = AddPeer(bitdata, "peer1");
+    PeerDataPtr peer2 = AddPeer(bitdata, "peer2");
+    PeerDataPtr peer3 = AddPeer(bitdata, "peer3");
+
+    dispatcher.StartStreaming(0, 0);
+    BitRequestList list1;
+    dispatcher.DispatchRequestList(peer1, list1);
+    BitRequestList list2;
+    dispatcher.DispatchRequestList(peer2, list2);
+
+    // the blocks of piece 0 are late, peer3 requests them too
+    ::Sleep(2100);
+    BitRequestList list3;
+    dispatcher.DispatchRequestList(peer3, list3);
+    CHECK_TRUE(list3.Size() == 2);
+
+    // peer3 receives the first block, the request of peer1 is cancelled
+    CHECK_TRUE(dispatcher.CompleteRequest(peer3, 0, 0, block_size));
+    CHECK_TRUE(dispatcher.HasPendingCancels());
+
+    // peer1 is choked, its cancels are taken before its requests are
+    // returned, as the peer connection does
+    BitRequestList cancels;
+    dispatcher.TakeCancels(peer1, cancels);
+    CHECK_TRUE(cancels.Size() == 1);
+    CHECK_TRUE(cancels.IsExistRequest(0, 0, block_size));
+    CHECK_TRUE(!dispatcher.HasPendingCancels());
+
+    BitRequestList::Iterator it = list1.Begin();
+    while (it != list1.End())
+        dispatcher.ReturnRequest(peer1, list1, it++);
+    CHECK_TRUE(list1.Empty());
+
+    // the received block is not requested again, the others are
+    BitRequestList list4;
+    dispatcher.DispatchRequestList(peer2, list4);
+    CHECK_TRUE(!list4.IsExistRequest(0, 0, block_size));
+    CHECK_TRUE(list4.IsExistRequest(1, 0, block_size));
+    CHECK_TRUE(list4.IsExistRequest(1, block_size, block_size));
+}
+
+TEST_CASE(suggestion_in_priority_tier)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    bitdata->SetPiecePriority(8, 10, PRIORITY_HIGH);
+    BitDownloadingInfo info(bitdata);
+    BitDownloadDispatcher dispatcher(bitdata, &info);
+    PeerDataPtr peer = AddPeer(bitdata, "peer");
+
+    // piece 2 is suggested, but the pieces of high priority go first
+    peer->SuggestPiece(2);
+    BitRequestList first;
+    dispatcher.DispatchRequestList(peer, first);
+    BitRequestList second;
+    dispatcher.DispatchRequestList(peer, second);
+    std::vector<int> high = PieceIndexes(first);
+    std::vector<int> more = PieceIndexes(second);
+    high.insert(high.end(), more.begin(), more.end());
+    std::sort(high.begin(), high.end());
+    CHECK_TRUE(high == Pieces(8, 9));
+
+    // the suggestion is kept until the tier of it is searched
+    BitRequestList third;
+    dispatcher.DispatchRequestList(peer, third);
+    std::vector<int> suggested(2, 2);
+    CHECK_TRUE(PieceIndexes(third) == suggested);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,415 @@
+#include "../core/BitHttpTracker.h"
+#include "../net/IoService.h"
+#include "../net/NetHelper.h"
+#include "../net/ResolveService.h"
+#include "../net/TimerService.h"
+#include "../net/WinSockIniter.h"
+#include "../protocol/Response.h"
+#include "../sha1/NetSha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    class TestBuffer
+    {
+    public:
+        explicit TestBuffer(const std::string& data)
+            : buffer_(data.begin(), data.end())
+        {
+        }
+
+        char * GetBuffer() const
+        {
+            return const_cast<char *>(&buffer_[0]);
+        }
+
+        int BufferLen() const
+        {
+            return static_cast<int>(buffer_.size());
+        }
+
+    private:
+        std::vector<char> buffer_;
+    };
+
+    int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return c - 'a' + 10;
+    }
+
+    // all percent decoded info_hash values of the request line
+    std::vector<std::string> GetInfoHashes(const std::string& request)
+    {
+        std::vector<std::string> result;
+        std::string line = request.substr(0, request.find(' ', 4));
+        const std::string key = "info_hash=";
+
+        std::string::size_type pos = 0;
+        while ((pos = line.find(key, pos)) != std::string::npos)
+        {
+            pos += key.size();
+            std::string value;
+            while (pos < line.size() && line[pos] != '&')
+            {
+                if (line[pos] == '%')
+                {
+                    value.push_back(static_cast<char>(
+                                HexValue(line[pos + 1]) * 16 + HexValue(line[pos + 2])));
+                    pos += 3;
+                }
+                else
+                {
+                    value.push_back(line[pos++]);
+                }
+            }
+            result.push_back(value);
+        }
+        return result;
+    }
+
+    std::string BenString(const std::string& str)
+    {
+        std::ostringstream oss;
+        oss << str.size() << ':' << str;
+        return oss.str();
+    }
+
+    class FakeHttpTracker;
+
+    // a connection of the fake tracker, requests end with an empty line
+    class FakeConnection
+    {
+    public:
+        FakeConnection(FakeHttpTracker *tracker, net::IoService& io_service,
+                       const net::BaseSocket& sock)
+            : tracker_(tracker),
+              socket_(net::MakeAsyncSocket(io_service, sock)),
+              receive_buffer_(std::string(4096, '\0'))
+        {
+            Receive();
+        }
+
+    private:
+        void Receive()
+        {
+            socket_.AsyncReceive(receive_buffer_,
+                    std::tr1::bind(&FakeConnection::ReceiveHandler, this,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        }
+
+        void ReceiveHandler(bool success, int received);
+
+        void Send(const std::string& reply, bool close)
+        {
+            std::tr1::shared_ptr<TestBuffer> buffer(new TestBuffer(reply));
+            socket_.AsyncSend(*buffer,
+                    std::tr1::bind(&FakeConnection::SendHandler, this, buffer, close,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        }
+
+        void SendHandler(std::tr1::shared_ptr<TestBuffer> buffer, bool close,
+                         bool success, int send)
+        {
+            if (close)
+                socket_.Close();
+        }
+
+        FakeHttpTracker *tracker_;
+        net::AsyncSocket socket_;
+        TestBuffer receive_buffer_;
+        std::string data_;
+    };
+
+    // a local http tracker stand-in, it answers every announce with one peer
+    // of which ip is the first 4 bytes of the info hash, and every scrape with
+    // all info hashes of the request
+    class FakeHttpTracker
+    {
+    public:
+        explicit FakeHttpTracker(net::IoService& io_service)
+            : accept_count(0),
+              announce_count(0),
+              scrape_count(0),
+              bad_request_count(0),
+              keep_alive(true),
+              io_service_(io_service),
+              listener_(net::Address(0x7F000001),
+                        net::Port(static_cast<unsigned short>(0)), io_service)
+        {
+            Accept();
+        }
+
+        ~FakeHttpTracker()
+        {
+            for (std::size_t i = 0; i < connections_.size(); ++i)
+                delete connections_[i];
+        }
+
+        unsigned short GetPort() const
+        {
+            return net::GetLocalPort(listener_.GetImplement());
+        }
+
+        std::string Reply(const std::string& request)
+        {
+            std::string body;
+            std::vector<std::string> info_hashes = GetInfoHashes(request);
+            if (request.compare(0, 14, "GET /announce?") == 0)
+            {
+                ++announce_count;
+                if (info_hashes.size() != 1 || info_hashes[0].size() != 20)
+                    ++bad_request_count;
+                body = "d8:intervali1800e5:peers" +
+                    BenString(info_hashes[0].substr(0, 4) + "\x1A\xE1") + "e";
+            }
+            else
+            {
+                ++scrape_count;
+                body = "d5:filesd";
+                for (std::size_t i = 0; i < info_hashes.size(); ++i)
+                {
+                    body += BenString(info_hashes[i]);
+                    body += "d8:completei1e10:downloadedi2e10:incompletei3ee";
+                }
+                body += "ee";
+            }
+
+            std::ostringstream oss;
+            oss << (keep_alive ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.0 200 OK\r\n")
+                << "Content-Type: text/plain\r\n"
+                << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+            return oss.str();
+        }
+
+        int accept_count;
+        int announce_count;
+        int scrape_count;
+        // announces without exactly one info hash of 20 bytes
+        int bad_request_count;
+        // reply HTTP/1.0 and close the connection when it is false
+        bool keep_alive;
+
+    private:
+        void Accept()
+        {
+            listener_.AsyncAccept(
+                    std::tr1::bind(&FakeHttpTracker::AcceptHandler, this,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        }
+
+        void AcceptHandler(bool success, net::BaseSocket sock)
+        {
+            if (success)
+            {
+                ++accept_count;
+                connections_.push_back(new FakeConnection(this, io_service_, sock));
+            }
+            Accept();
+        }
+
+        net::IoService& io_service_;
+        net::AsyncListener listener_;
+        std::vector<FakeConnection *> connections_;
+    };
+
+    void FakeConnection::ReceiveHandler(bool success, int received)
+    {
+        if (!success)
+        {
+            socket_.Close();
+            return ;
+        }
+
+        data_.append(receive_buffer_.GetBuffer(), received);
+        std::string::size_type end;
+        while ((end = data_.find("\r\n\r\n")) != std::string::npos)
+        {
+            std::string request = data_.substr(0, end + 4);
+            data_.erase(0, end + 4);
+            Send(tracker_->Reply(request), !tracker_->keep_alive);
+        }
+        Receive();
+    }
+
+    Sha1Value MakeInfoHash(unsigned long first_word)
+    {
+        char bytes[20] = { 0 };
+        bytes[0] = static_cast<char>(first_word >> 24);
+        bytes[1] = static_cast<char>(first_word >> 16);
+        bytes[2] = static_cast<char>(first_word >> 8);
+        bytes[3] = static_cast<char>(first_word);
+        bytes[19] = 1;
+        return NetStreamToSha1Value(bytes);
+    }
+
+    HttpAnnounceRequest MakeRequest(unsigned long first_word)
+    {
+        HttpAnnounceRequest request;
+        request.info_hash = MakeInfoHash(first_word);
+        request.peer_id = "-BW0001-000000000000";
+        request.left = 100;
+        request.event = HttpAnnounceRequest::STARTED;
+        request.port = 6881;
+        return request;
+    }
+
+    int done_count = 0;
+    int fail_count = 0;
+
+    void CountAnnounce(unsigned long first_word, bool success,
+                       const HttpTrackerResponse& response)
+    {
+        if (success && response.interval == 1800 && response.peers.size() == 1 &&
+            response.peers[0].ip == first_word && response.peers[0].port == 6881)
+            ++done_count;
+        else
+            ++fail_count;
+    }
+
+    void CountScrape(Sha1Value info_hash, bool success,
+                     const bentypes::ScrapeResponse::FilesInfo& files_info)
+    {
+        bentypes::ScrapeResponse::FilesInfo::const_iterator it =
+            files_info.find(info_hash);
+        if (success && it != files_info.end() && it->second.complete == 1 &&
+            it->second.downloaded == 2 && it->second.incomplete == 3)
+            ++done_count;
+        else
+            ++fail_count;
+    }
+
+    void RunUntil(net::IoService& io_service, int count, DWORD max_millisecond)
+    {
+        DWORD begin = ::GetTickCount();
+        while (done_count + fail_count < count &&
+               ::GetTickCount() - begin < max_millisecond)
+        {
+            io_service.Run();
+            ::Sleep(1);
+        }
+    }
+
+} // unnamed namespace
+
+TEST_CASE(protocol)
+{
+    std::string announce = EncodeHttpAnnounceRequest(
+            "http://tracker.example.com:6969/announce", MakeRequest(0x0A000001));
+    CHECK_TRUE(announce.compare(0, 24, "GET /announce?info_hash=") == 0);
+    CHECK_TRUE(announce.find("&event=started") != std::string::npos);
+    CHECK_TRUE(announce.find("&compact=1") != std::string::npos);
+    CHECK_TRUE(announce.find("Host: tracker.example.com\r\n") != std::string::npos);
+
+    CHECK_TRUE(GetScrapeUrl("http://a.com/announce") == "http://a.com/scrape");
+    CHECK_TRUE(GetScrapeUrl("http://a.com/x/announce.php?k=1") ==
+            "http://a.com/x/scrape.php?k=1");
+    CHECK_TRUE(GetScrapeUrl("http://a.com/a") == "");
+    CHECK_TRUE(GetScrapeUrl("http://a.com/announce/x") == "");
+
+    std::vector<Sha1Value> info_hashes;
+    info_hashes.push_back(MakeInfoHash(1));
+    info_hashes.push_back(MakeInfoHash(2));
+    std::string scrape = EncodeHttpScrapeRequest("http://a.com/scrape", info_hashes);
+    CHECK_TRUE(GetInfoHashes(scrape).size() == 2);
+
+    const char keep_alive[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nde";
+    const char close[] = "HTTP/1.1 200 OK\r\nconnection: Close\r\nContent-Length: 2\r\n\r\nde";
+    const char http10[] = "HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nde";
+    CHECK_TRUE(http::Response(keep_alive, sizeof(keep_alive) - 1).IsKeepAlive());
+    CHECK_TRUE(!http::Response(close, sizeof(close) - 1).IsKeepAlive());
+    CHECK_TRUE(!http::Response(http10, sizeof(http10) - 1).IsKeepAlive());
+}
+
+// announces and scrapes of the client to a fake tracker on loopback
+TEST_CASE(fake_tracker)
+{
+    net::WinSockIniter sock_initer;
+    net::IoService io_service;
+    net::TimerService timer_service;
+    net::ResolveService resolve_service;
+    io_service.AddService(&timer_service);
+    io_service.AddService(&resolve_service);
+
+    FakeHttpTracker fake_tracker(io_service);
+    BitHttpTracker client(io_service);
+
+    std::ostringstream oss;
+    oss << "http://127.0.0.1:" << fake_tracker.GetPort() << "/announce";
+    std::string url = oss.str();
+
+    // announces of many tasks at the same time share pooled connections
+    const int task_count = 500;
+    DWORD begin = ::GetTickCount();
+    for (int i = 0; i < task_count; ++i)
+    {
+        unsigned long first_word = 0x0A000000 + i;
+        client.Announce(url, MakeRequest(first_word),
+                std::tr1::bind(CountAnnounce, first_word,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+    RunUntil(io_service, task_count, 30000);
+    DWORD elapsed = ::GetTickCount() - begin;
+    CHECK_TRUE(done_count == task_count && fail_count == 0);
+    CHECK_TRUE(fake_tracker.accept_count <= static_cast<int>(
+                BitHttpTracker::max_host_connections));
+
+    std::cout << task_count << " announces in " << elapsed << "ms on "
+        << fake_tracker.accept_count << " connections" << std::endl;
+
+    // scrapes queued together are sent in one request of many info hashes
+    done_count = 0;
+    const int scrape_count = 200;
+    for (int i = 0; i < scrape_count; ++i)
+    {
+        std::vector<Sha1Value> info_hashes(1, MakeInfoHash(0x0B000000 + i));
+        unsigned long id = client.Scrape(url, info_hashes,
+                std::tr1::bind(CountScrape, info_hashes[0],
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        CHECK_TRUE(id != 0);
+    }
+    RunUntil(io_service, scrape_count, 30000);
+    CHECK_TRUE(done_count == scrape_count && fail_count == 0);
+    CHECK_TRUE(fake_tracker.scrape_count <= scrape_count /
+            static_cast<int>(BitHttpTracker::max_scrape_hashes) + 2);
+
+    std::cout << scrape_count << " scrapes in " << fake_tracker.scrape_count
+        << " requests" << std::endl;
+
+    // the tracker closes every connection, announces still succeed
+    done_count = 0;
+    fake_tracker.keep_alive = false;
+    int accept_count = fake_tracker.accept_count;
+    for (int i = 0; i < 10; ++i)
+    {
+        unsigned long first_word = 0x0C000000 + i;
+        client.Announce(url, MakeRequest(first_word),
+                std::tr1::bind(CountAnnounce, first_word,
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    }
+    RunUntil(io_service, 10, 30000);
+    CHECK_TRUE(done_count == 10 && fail_count == 0);
+    CHECK_TRUE(fake_tracker.accept_count > accept_count);
+    CHECK_TRUE(fake_tracker.bad_request_count == 0);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "../core/BitMagnet.h"
+#include "../core/BitUtMetadata.h"
+#include "../sha1/NetSha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <string.h>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // info hash of 20 bytes 0x00, 0x01, ... 0x13
+    Sha1Value ExpectInfoHash()
+    {
+        char bytes[20];
+        for (int i = 0; i < 20; ++i)
+            bytes[i] = static_cast<char>(i);
+        return NetStreamToSha1Value(bytes);
+    }
+
+} // unnamed namespace
+
+TEST_CASE(hex_link)
+{
+    MagnetLink magnet;
+    bool ok = ParseMagnetLink(
+            "magnet:?xt=urn:btih:000102030405060708090A0B0C0D0E0F10111213"
+            "&dn=Some+File%2Etxt"
+            "&tr=http%3A%2F%2Ftracker.example.com%2Fannounce"
+            "&tr=http://tracker2.example.com/announce"
+            "&x.pe=127.0.0.1:6881&x.pe=bad:1", &magnet);
+
+    CHECK_TRUE(ok);
+    CHECK_TRUE(magnet.info_hash == ExpectInfoHash());
+    CHECK_TRUE(magnet.name == "Some File.txt");
+    CHECK_TRUE(magnet.trackers.size() == 2);
+    CHECK_TRUE(magnet.trackers[0] == "http://tracker.example.com/announce");
+    CHECK_TRUE(magnet.trackers[1] == "http://tracker2.example.com/announce");
+    CHECK_TRUE(magnet.peers.size() == 1);
+    CHECK_TRUE(magnet.peers[0].first == 0x7F000001);
+    CHECK_TRUE(magnet.peers[0].second == 6881);
+}
+
+TEST_CASE(base32_link)
+{
+    // base32 of bytes 0x00, 0x01, ... 0x13
+    MagnetLink magnet;
+    bool ok = ParseMagnetLink(
+            "magnet:?xt=urn:btih:AAAQEAYEAUDAOCAJBIFQYDIOB4IBCEQT", &magnet);
+    CHECK_TRUE(ok);
+    CHECK_TRUE(magnet.info_hash == ExpectInfoHash());
+    CHECK_TRUE(magnet.trackers.empty());
+}
+
+TEST_CASE(invalid_link)
+{
+    MagnetLink magnet;
+    CHECK_TRUE(!ParseMagnetLink("http://example.com/a.torrent", &magnet));
+    CHECK_TRUE(!ParseMagnetLink("magnet:?dn=name", &magnet));
+    CHECK_TRUE(!ParseMagnetLink("magnet:?xt=urn:btih:0001", &magnet));
+    CHECK_TRUE(!ParseMagnetLink("magnet:?xt=urn:btih:"
+                "zz0102030405060708090a0b0c0d0e0f10111213", &magnet));
+}
+
+TEST_CASE(ut_metadata_message)
+{
+    UtMetadataMessage request;
+    request.type = UtMetadataMessage::REQUEST;
+    request.piece = 3;
+    std::string payload = EncodeUtMetadataMessage(request);
+    CHECK_TRUE(payload == "d8:msg_typei0e5:piecei3ee");
+
+    UtMetadataMessage parsed;
+    CHECK_TRUE(ParseUtMetadataMessage(payload.data(), payload.size(), &parsed));
+    CHECK_TRUE(parsed.type == UtMetadataMessage::REQUEST && parsed.piece == 3);
+
+    // piece data follows the dictionary of DATA
+    const char block[] = "d4:name1:ae";
+    UtMetadataMessage data;
+    data.type = UtMetadataMessage::DATA;
+    data.piece = 0;
+    data.total_size = sizeof(block) - 1;
+    data.data = block;
+    data.data_len = sizeof(block) - 1;
+    payload = EncodeUtMetadataMessage(data);
+
+    CHECK_TRUE(ParseUtMetadataMessage(payload.data(), payload.size(), &parsed));
+    CHECK_TRUE(parsed.type == UtMetadataMessage::DATA);
+    CHECK_TRUE(parsed.total_size == data.total_size);
+    CHECK_TRUE(parsed.data_len == data.data_len);
+    CHECK_TRUE(memcmp(parsed.data, block, parsed.data_len) == 0);
+
+    std::string reject = "d8:msg_typei2e5:piecei1ee";
+    CHECK_TRUE(ParseUtMetadataMessage(reject.data(), reject.size(), &parsed));
+    CHECK_TRUE(parsed.type == UtMetadataMessage::REJECT && parsed.piece == 1);
+
+    std::string invalid = "d8:msg_typei1e5:piecei0ee";
+    CHECK_TRUE(!ParseUtMetadataMessage(invalid.data(), invalid.size(), &parsed));
+
+    CHECK_TRUE(GetMetadataPieceCount(1) == 1);
+    CHECK_TRUE(GetMetadataPieceCount(16 * 1024) == 1);
+    CHECK_TRUE(GetMetadataPieceCount(16 * 1024 + 1) == 2);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
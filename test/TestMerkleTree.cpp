@@ -0,0 +1,364 @@
+#include "../core/BitMerkleTree.h"
+#include "../core/BitException.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../core/bencode/MetainfoFile.h"
+#include "../sha1/Sha1Value.h"
+#include "../sha1/NetSha1Value.h"
+#include "../sha256/Sha256.h"
+#include "../sha256/Sha256Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+using namespace bitwave::core::bentypes;
+
+// SHA-256 is checked by the vectors of FIPS 180-4 on both kernels, merkle
+// roots and proofs of BEP 52 are checked against a whole tree, then a
+// hybrid torrent is built and loaded. At last the throughput of hashing
+// 16KB blocks is compared between the kernels and SHA-1 of pieces
+
+const std::size_t piece_length = 64 * 1024;
+const std::size_t benchmark_size = 256 * 1024 * 1024;
+
+namespace {
+
+    double NowMillisecond()
+    {
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    std::string RandomData(std::size_t size)
+    {
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i)
+            data[i] = static_cast<char>(rand());
+        return data;
+    }
+
+    // root of a file by the whole tree, leaves are padded to a power of 2
+    // which is not less than a piece
+    Sha256Value WholeTreeRoot(const std::string& file)
+    {
+        std::vector<Sha256Value> layer;
+        for (std::size_t begin = 0; begin < file.size(); begin += BitMerkleTree::block_size)
+            layer.push_back(BitMerkleTree::HashBlock(file.data() + begin,
+                        std::min(BitMerkleTree::block_size, file.size() - begin)));
+
+        std::size_t width = BitMerkleTree::RoundUpPower2(layer.size());
+        if (file.size() > piece_length)
+            width = std::max(width, piece_length / BitMerkleTree::block_size);
+        layer.resize(width);
+
+        while (layer.size() > 1)
+        {
+            std::vector<Sha256Value> next;
+            for (std::size_t i = 0; i < layer.size(); i += 2)
+                next.push_back(BitMerkleTree::HashPair(layer[i], layer[i + 1]));
+            layer.swap(next);
+        }
+        return layer[0];
+    }
+
+    // root and piece layer of a file by pieces
+    Sha256Value FileTree(const std::string& file, std::vector<Sha256Value>& piece_layer)
+    {
+        const std::size_t leaves_per_piece = piece_length / BitMerkleTree::block_size;
+        std::vector<Sha256Value> leaves;
+        for (std::size_t begin = 0; begin < file.size(); begin += BitMerkleTree::block_size)
+            leaves.push_back(BitMerkleTree::HashBlock(file.data() + begin,
+                        std::min(BitMerkleTree::block_size, file.size() - begin)));
+
+        if (file.size() <= piece_length)
+            return BitMerkleTree::Root(&leaves[0], leaves.size(),
+                    BitMerkleTree::RoundUpPower2(leaves.size()));
+
+        for (std::size_t first = 0; first < leaves.size(); first += leaves_per_piece)
+            piece_layer.push_back(BitMerkleTree::Root(&leaves[first],
+                        std::min(leaves_per_piece, leaves.size() - first), leaves_per_piece));
+
+        return BitMerkleTree::Root(&piece_layer[0], piece_layer.size(),
+                BitMerkleTree::RoundUpPower2(piece_layer.size()),
+                BitMerkleTree::Log2(leaves_per_piece));
+    }
+
+    // a hybrid torrent of file a and file b, a pad file aligns b to a piece
+    std::string MakeHybridTorrent(const std::string& a, const std::string& b,
+                                  bool corrupt_layer)
+    {
+        std::vector<Sha256Value> layer_a;
+        std::vector<Sha256Value> layer_b;
+        Sha256Value root_a = FileTree(a, layer_a);
+        Sha256Value root_b = FileTree(b, layer_b);
+        std::string layer_data;
+        for (std::size_t i = 0; i < layer_a.size(); ++i)
+            layer_data.append(layer_a[i].GetData(), 32);
+        if (corrupt_layer)
+            layer_data[0] ^= 1;
+
+        std::size_t pad = piece_length - a.size() % piece_length;
+        std::string content = a + std::string(pad, '\0') + b;
+        std::string pieces;
+        for (std::size_t begin = 0; begin < content.size(); begin += piece_length)
+        {
+            Sha1Value sha1 = NetByteOrder(Sha1Value(content.data() + begin,
+                        std::min(piece_length, content.size() - begin)));
+            pieces.append(sha1.GetData(), sha1.GetDataSize());
+        }
+
+        DefaultBufferCache cache;
+        BenWriter writer(cache);
+        {
+            BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            {
+                BenDictionaryWriter info(torrent.Key("info"));
+                {
+                    BenDictionaryWriter tree(info.Key("file tree"));
+                    {
+                        BenDictionaryWriter name(tree.Key("a.bin"));
+                        BenDictionaryWriter file(name.Key(""));
+                        file.Add("length", static_cast<long long>(a.size()));
+                        file.Add("pieces root", root_a.GetData(), 32);
+                    }
+                    {
+                        BenDictionaryWriter name(tree.Key("b.bin"));
+                        BenDictionaryWriter file(name.Key(""));
+                        file.Add("length", static_cast<long long>(b.size()));
+                        file.Add("pieces root", root_b.GetData(), 32);
+                    }
+                }
+
+                info.Key("files").BeginList();
+                {
+                    BenDictionaryWriter file(writer);
+                    file.Add("length", static_cast<long long>(a.size()));
+                    file.Key("path").BeginList();
+                    writer.WriteString("a.bin");
+                    writer.End();
+                }
+                {
+                    BenDictionaryWriter file(writer);
+                    file.Add("attr", "p");
+                    file.Add("length", static_cast<long long>(pad));
+                    file.Key("path").BeginList();
+                    writer.WriteString(".pad");
+                    writer.WriteString("pad");
+                    writer.End();
+                }
+                {
+                    BenDictionaryWriter file(writer);
+                    file.Add("length", static_cast<long long>(b.size()));
+                    file.Key("path").BeginList();
+                    writer.WriteString("b.bin");
+                    writer.End();
+                }
+                writer.End();
+
+                info.Add("meta version", 2);
+                info.Add("name", "hybrid");
+                info.Add("piece length", static_cast<long long>(piece_length));
+                info.Add("pieces", pieces);
+            }
+            BenDictionaryWriter layers(torrent.Key("piece layers"));
+            writer.WriteString(root_a.GetData(), 32);
+            writer.WriteString(layer_data);
+        }
+        return writer.GetString();
+    }
+
+} // unnamed namespace
+
+TEST_CASE(sha256)
+{
+    const char *messages[] = {
+        "",
+        "abc",
+        "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+    };
+    const char *digests[] = {
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+    };
+
+    std::string million(1000000, 'a');
+    std::string data = RandomData(10000);
+    for (int accelerated = 0; accelerated < 2; ++accelerated)
+    {
+        Sha256::EnableAcceleration(accelerated != 0);
+        for (int i = 0; i < 3; ++i)
+            CHECK_TRUE(Sha256Value(messages[i], strlen(messages[i])).GetReadableString() ==
+                   digests[i]);
+        CHECK_TRUE(Sha256Value(million.data(), million.size()).GetReadableString() ==
+               "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+        // updates of any size are the same as one update
+        for (std::size_t length = 0; length < 300; ++length)
+        {
+            Sha256 sha256;
+            for (std::size_t i = 0; i < length; i += 7)
+                sha256.Update(data.data() + i, std::min<std::size_t>(7, length - i));
+            char digest[Sha256::digest_size];
+            sha256.Final(digest);
+            CHECK_TRUE(StreamToSha256Value(digest) == Sha256Value(data.data(), length));
+        }
+    }
+    Sha256::EnableAcceleration(true);
+}
+
+TEST_CASE(merkle_tree)
+{
+    std::vector<Sha256Value> layer;
+    std::string file = RandomData(5 * piece_length + 1000);
+    CHECK_TRUE(FileTree(file, layer) == WholeTreeRoot(file));
+    CHECK_TRUE(layer.size() == 6);
+
+    std::string small = RandomData(BitMerkleTree::block_size + 1);
+    layer.clear();
+    CHECK_TRUE(FileTree(small, layer) == WholeTreeRoot(small));
+    CHECK_TRUE(layer.empty());
+
+    // uncles of every leaf lead to the root
+    std::vector<Sha256Value> leaves;
+    for (int i = 0; i < 11; ++i)
+        leaves.push_back(Sha256Value(reinterpret_cast<const char *>(&i), sizeof(i)));
+    Sha256Value root = BitMerkleTree::Root(&leaves[0], leaves.size(), 16);
+    for (std::size_t i = 0; i < 16; ++i)
+    {
+        std::vector<Sha256Value> proof;
+        BitMerkleTree::GetProof(leaves, 16, 0, i, 10, proof);
+        CHECK_TRUE(proof.size() == 4);
+
+        Sha256Value hash = i < leaves.size() ? leaves[i] : Sha256Value();
+        std::size_t index = i;
+        for (std::size_t p = 0; p < proof.size(); ++p, index /= 2)
+            hash = index % 2 ? BitMerkleTree::HashPair(proof[p], hash) :
+                               BitMerkleTree::HashPair(hash, proof[p]);
+        CHECK_TRUE(hash == root);
+    }
+}
+
+TEST_CASE(hybrid_torrent)
+{
+    std::string a = RandomData(3 * piece_length + 5000);
+    std::string b = RandomData(20000);
+    std::string torrent = MakeHybridTorrent(a, b, false);
+
+    MetainfoFile metainfo(torrent.data(), torrent.size());
+    CHECK_TRUE(metainfo.HasMerkleTrees());
+    CHECK_TRUE(metainfo.PiecesCount() == 5);
+    CHECK_TRUE(metainfo.GetFileCount() == 3);
+
+    // the last piece of a is padded, b is a file of one piece
+    MetainfoFile::MerklePiece piece;
+    CHECK_TRUE(metainfo.GetMerklePiece(3, &piece));
+    CHECK_TRUE(piece.data_length == 5000 && piece.first_leaf == 12 && piece.leaf_count == 4);
+    std::vector<Sha256Value> layer;
+    CHECK_TRUE(piece.pieces_root == FileTree(a, layer) && piece.hash == layer[3]);
+    std::vector<Sha256Value> leaves;
+    leaves.push_back(BitMerkleTree::HashBlock(a.data() + 3 * piece_length, 5000));
+    CHECK_TRUE(BitMerkleTree::Root(&leaves[0], 1, piece.leaf_count) == piece.hash);
+
+    CHECK_TRUE(metainfo.GetMerklePiece(4, &piece));
+    CHECK_TRUE(piece.data_length == b.size() && piece.first_leaf == 0 && piece.leaf_count == 2);
+    CHECK_TRUE(piece.hash == piece.pieces_root);
+
+    std::vector<std::size_t> file_indexes;
+    metainfo.FindMerkleFiles(piece.pieces_root, &file_indexes);
+    CHECK_TRUE(file_indexes.size() == 1 && file_indexes[0] == piece.file_index);
+    MetainfoFile::MerkleFile file;
+    CHECK_TRUE(metainfo.GetMerkleFile(piece.file_index, &file));
+    CHECK_TRUE(file.first_piece == 4 && file.piece_count == 1);
+    CHECK_TRUE(file.pieces_root == piece.pieces_root);
+    file_indexes.clear();
+    metainfo.FindMerkleFiles(Sha256Value(), &file_indexes);
+    CHECK_TRUE(file_indexes.empty());
+    CHECK_TRUE(!metainfo.GetMerkleFile(metainfo.GetMerkleFileCount(), &file));
+
+    layer.clear();
+    CHECK_TRUE(metainfo.GetMerklePiece(0, &piece));
+    CHECK_TRUE(metainfo.GetPieceLayer(piece.file_index, &layer) && layer.size() == 4);
+
+    // piece layers are not in the info, a wrong layer is refused
+    std::string corrupt = MakeHybridTorrent(a, b, true);
+    bool refused = false;
+    try
+    {
+        MetainfoFile corrupt_metainfo(corrupt.data(), corrupt.size());
+    }
+    catch (const MetainfoFileExeception&)
+    {
+        refused = true;
+    }
+    CHECK_TRUE(refused);
+}
+
+TEST_CASE(same_root_files)
+{
+    // files of the same content share the root, each is found by its
+    // own index and pieces
+    std::string a = RandomData(3 * piece_length + 5000);
+    std::string torrent = MakeHybridTorrent(a, a, false);
+    MetainfoFile metainfo(torrent.data(), torrent.size());
+    CHECK_TRUE(metainfo.GetMerkleFileCount() == 2);
+
+    MetainfoFile::MerklePiece first;
+    MetainfoFile::MerklePiece second;
+    CHECK_TRUE(metainfo.GetMerklePiece(1, &first));
+    CHECK_TRUE(metainfo.GetMerklePiece(5, &second));
+    CHECK_TRUE(first.pieces_root == second.pieces_root && first.hash == second.hash);
+    CHECK_TRUE(first.file_index == 0 && second.file_index == 1);
+
+    std::vector<std::size_t> file_indexes;
+    metainfo.FindMerkleFiles(first.pieces_root, &file_indexes);
+    std::sort(file_indexes.begin(), file_indexes.end());
+    CHECK_TRUE(file_indexes.size() == 2 && file_indexes[0] == 0 && file_indexes[1] == 1);
+
+    MetainfoFile::MerkleFile file;
+    CHECK_TRUE(metainfo.GetMerkleFile(1, &file));
+    CHECK_TRUE(file.first_piece == 4 && file.piece_count == 4);
+}
+
+TEST_CASE(benchmark)
+{
+    std::string data = RandomData(benchmark_size);
+    double gigabytes = benchmark_size / (1024.0 * 1024.0 * 1024.0);
+
+    for (int accelerated = 0; accelerated < 2; ++accelerated)
+    {
+        Sha256::EnableAcceleration(accelerated != 0);
+        if (accelerated && !Sha256::IsAccelerated())
+        {
+            std::cout << "SHA extensions are not supported" << std::endl;
+            break;
+        }
+
+        double begin = NowMillisecond();
+        for (std::size_t i = 0; i < benchmark_size; i += BitMerkleTree::block_size)
+            BitMerkleTree::HashBlock(data.data() + i, BitMerkleTree::block_size);
+        double time = NowMillisecond() - begin;
+        std::cout << (accelerated ? "SHA-256 extensions: " : "SHA-256 portable: ")
+                  << gigabytes * 1000.0 / time << "GB/s" << std::endl;
+    }
+
+    double begin = NowMillisecond();
+    for (std::size_t i = 0; i < benchmark_size; i += 1024 * 1024)
+        Sha1Value(data.data() + i, static_cast<std::size_t>(1024 * 1024));
+    double time = NowMillisecond() - begin;
+    std::cout << "SHA-1 pieces: " << gigabytes * 1000.0 / time << "GB/s" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
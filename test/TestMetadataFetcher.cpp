@@ -0,0 +1,288 @@
+#include "../core/BitMagnet.h"
+#include "../core/BitMetadataFetcher.h"
+#include "../core/BitNetProcessor.h"
+#include "../core/BitPeerConnection.h"
+#include "../core/BitUtMetadata.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../net/IoService.h"
+#include "../net/NetHelper.h"
+#include "../net/TimerService.h"
+#include "../net/WinSockIniter.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    const unsigned long loopback = 0x7F000001;
+    const unsigned short any_port = 0;
+    const std::size_t handshake_size = 68;
+    const char extended_message = 20;
+    // ut_metadata message id of the seeder, and of the fetcher which is
+    // sent in its extended handshake
+    const char seed_ut_metadata_id = 3;
+    const char fetch_ut_metadata_id = 1;
+
+    // an info dictionary of 2 metadata pieces
+    std::string MakeMetadata()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter info(writer);
+            info.Add("length", 1000LL * 256 * 1024);
+            info.Add("name", "TestMetadataFetcher.bin");
+            info.Add("piece length", 256LL * 1024);
+            info.Add("pieces", std::string(20 * 1000, 'x'));
+        }
+        return std::string(writer.GetData(), writer.GetSize());
+    }
+
+    // a connection accepted by the seeder, it answers the handshake and
+    // serves every requested metadata piece
+    class SeedConnection : private NotCopyable
+    {
+    public:
+        SeedConnection(const net::AsyncSocket& socket,
+                       const std::string& metadata)
+            : metadata_(metadata),
+              net_processor_(new NetProcessor(socket, this))
+        {
+            net_processor_->Receive();
+        }
+
+        ~SeedConnection()
+        {
+            net_processor_->ClearConnection();
+            net_processor_->Close();
+        }
+
+        void ProcessProtocol(const char *data, std::size_t size)
+        {
+            if (size == handshake_size && *data == 19)
+            {
+                ProcessHandshake(data);
+                return ;
+            }
+
+            unsigned long length_prefix = net::NetToHostl(
+                    *reinterpret_cast<const unsigned long *>(data));
+            data += sizeof(long);
+            if (length_prefix < 2 || data[0] != extended_message ||
+                data[1] != seed_ut_metadata_id)
+                return ;
+
+            UtMetadataMessage request;
+            if (ParseUtMetadataMessage(data + 2, length_prefix - 2, &request) &&
+                request.type == UtMetadataMessage::REQUEST)
+                SendPiece(request.piece);
+        }
+
+        void OnConnect() { }
+        void OnDisconnect() { }
+
+    private:
+        typedef BitNetProcessor<BitPeerConnection::PeerProtocolUnpackRuler,
+                                SeedConnection> NetProcessor;
+
+        void ProcessHandshake(const char *data)
+        {
+            // the handshake is sent back with the extension protocol bit
+            // and other peer id
+            std::string handshake(data, handshake_size);
+            handshake[1 + 19 + 5] |= 0x10;
+            handshake.replace(handshake_size - 20, 20, "-SD0001-000000000000");
+            net_processor_->Send(handshake.data(), handshake.size());
+
+            std::ostringstream oss;
+            oss << "d1:md11:ut_metadatai" << static_cast<int>(seed_ut_metadata_id)
+                << "ee13:metadata_sizei" << metadata_.size() << "ee";
+            SendExtended(0, oss.str());
+        }
+
+        void SendPiece(int piece)
+        {
+            std::size_t begin = piece * UtMetadataMessage::piece_size;
+            if (begin >= metadata_.size())
+                return ;
+
+            UtMetadataMessage data;
+            data.type = UtMetadataMessage::DATA;
+            data.piece = piece;
+            data.total_size = metadata_.size();
+            data.data = metadata_.data() + begin;
+            data.data_len = metadata_.size() - begin;
+            if (data.data_len > UtMetadataMessage::piece_size)
+                data.data_len = UtMetadataMessage::piece_size;
+            SendExtended(fetch_ut_metadata_id, EncodeUtMetadataMessage(data));
+        }
+
+        void SendExtended(char id, const std::string& payload)
+        {
+            std::string message(sizeof(int), '\0');
+            *reinterpret_cast<int *>(&message[0]) =
+                net::HostToNeti(static_cast<int>(payload.size() + 2));
+            message.push_back(extended_message);
+            message.push_back(id);
+            message += payload;
+            net_processor_->Send(message.data(), message.size());
+        }
+
+        std::string metadata_;
+        std::tr1::shared_ptr<NetProcessor> net_processor_;
+    };
+
+    // a peer of the swarm listens on loopback, and seeds the metadata
+    class TestSeeder : private NotCopyable
+    {
+    public:
+        TestSeeder(net::IoService& io_service, const std::string& metadata)
+            : io_service_(io_service),
+              metadata_(metadata),
+              listener_(net::Address(), net::Port(any_port), io_service),
+              accept_count_(0)
+        {
+            Accept();
+        }
+
+        ~TestSeeder()
+        {
+            listener_.Close();
+        }
+
+        unsigned short GetPort() const
+        {
+            return net::GetLocalPort(listener_.GetImplement());
+        }
+
+        int GetAcceptCount() const
+        {
+            return accept_count_;
+        }
+
+    private:
+        typedef std::tr1::shared_ptr<SeedConnection> ConnectionPtr;
+
+        void Accept()
+        {
+            listener_.AsyncAccept(
+                    std::tr1::bind(&TestSeeder::AcceptHandler, this,
+                        std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+        }
+
+        void AcceptHandler(bool success, net::BaseSocket peer_sock)
+        {
+            if (!success)
+                return ;
+
+            ++accept_count_;
+            net::AsyncSocket peer = net::MakeAsyncSocket(io_service_, peer_sock);
+            connections_.push_back(ConnectionPtr(new SeedConnection(peer, metadata_)));
+            Accept();
+        }
+
+        net::IoService& io_service_;
+        std::string metadata_;
+        net::AsyncListener listener_;
+        int accept_count_;
+        std::vector<ConnectionPtr> connections_;
+    };
+
+    // the net and timer services of a test case
+    class TestSwarm : private NotCopyable
+    {
+    public:
+        TestSwarm()
+        {
+            io_service_.AddService(&timer_service_);
+        }
+
+        net::IoService& GetIoService()
+        {
+            return io_service_;
+        }
+
+        void RunFor(const BitMetadataFetcher& fetcher, DWORD max_millisecond)
+        {
+            DWORD begin = ::GetTickCount();
+            while (!fetcher.IsComplete() &&
+                   ::GetTickCount() - begin < max_millisecond)
+            {
+                io_service_.Run();
+                ::Sleep(1);
+            }
+        }
+
+    private:
+        net::WinSockIniter sock_initer_;
+        net::IoService io_service_;
+        net::TimerService timer_service_;
+    };
+
+    MagnetLink MakeMagnet(const std::string& metadata)
+    {
+        MagnetLink magnet;
+        magnet.info_hash = Sha1Value(metadata.data(), metadata.size());
+        return magnet;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(fetch_from_seeders)
+{
+    TestSwarm swarm;
+    std::string metadata = MakeMetadata();
+    CHECK_TRUE(GetMetadataPieceCount(metadata.size()) == 2);
+
+    TestSeeder first(swarm.GetIoService(), metadata);
+    TestSeeder second(swarm.GetIoService(), metadata);
+    MagnetLink magnet = MakeMagnet(metadata);
+    magnet.peers.push_back(MagnetLink::PeerAddress(loopback, first.GetPort()));
+    magnet.peers.push_back(MagnetLink::PeerAddress(loopback, second.GetPort()));
+
+    BitMetadataFetcher fetcher(magnet, swarm.GetIoService());
+    swarm.RunFor(fetcher, 10000);
+    CHECK_TRUE(fetcher.IsComplete());
+    CHECK_TRUE(fetcher.GetMetadata() == metadata);
+}
+
+TEST_CASE(ban_wrong_metadata_seeder)
+{
+    TestSwarm swarm;
+    std::string metadata = MakeMetadata();
+    std::string wrong = metadata;
+    wrong[wrong.size() - 2] = 'y';
+
+    TestSeeder bad(swarm.GetIoService(), wrong);
+    TestSeeder good(swarm.GetIoService(), metadata);
+    MagnetLink magnet = MakeMagnet(metadata);
+    magnet.peers.push_back(MagnetLink::PeerAddress(loopback, bad.GetPort()));
+
+    // the bad seeder gives all pieces, the metadata is wrong, the
+    // seeder is banned and never connected again
+    BitMetadataFetcher fetcher(magnet, swarm.GetIoService());
+    swarm.RunFor(fetcher, 3000);
+    CHECK_TRUE(!fetcher.IsComplete());
+    CHECK_TRUE(bad.GetAcceptCount() == 1);
+
+    fetcher.AddPeer(loopback, bad.GetPort());
+    fetcher.AddPeer(loopback, good.GetPort());
+    swarm.RunFor(fetcher, 10000);
+    CHECK_TRUE(fetcher.IsComplete());
+    CHECK_TRUE(fetcher.GetMetadata() == metadata);
+    CHECK_TRUE(bad.GetAcceptCount() == 1);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include "../core/bencode/MetainfoFile.h"
+#include "../core/bencode/BenDecoder.h"
+#include "../core/bencode/BenTypes.h"
+#include "../core/BitException.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+using namespace bitwave::core::bentypes;
+
+// torrent_count torrents of file_count files are loaded and kept, as a
+// task keeps its torrent, memory held by MetainfoFile is compared with
+// the file buffer and decoded tokens kept before
+
+const int torrent_count = 1000;
+const int file_count = 1000;
+const char torrent_path[] = "TestMetainfoFile.torrent";
+
+std::size_t heap_size = 0;
+
+void * operator new (std::size_t size)
+{
+    std::size_t *p = static_cast<std::size_t *>(malloc(size + sizeof(std::size_t) * 2));
+    if (!p)
+        throw std::bad_alloc();
+    *p = size;
+    heap_size += size;
+    return p + 2;
+}
+
+void operator delete (void *ptr)
+{
+    if (!ptr)
+        return ;
+    std::size_t *p = static_cast<std::size_t *>(ptr) - 2;
+    heap_size -= *p;
+    free(p);
+}
+
+void * operator new [] (std::size_t size)
+{
+    return operator new (size);
+}
+
+void operator delete [] (void *ptr)
+{
+    operator delete (ptr);
+}
+
+namespace {
+
+    double NowMillisecond()
+    {
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    std::string MakeTorrent(int files, int pieces)
+    {
+        std::string torrent = "d8:announce27:http://tracker.sample.com/a"
+            "13:announce-listll27:http://tracker.sample.com/ael4:udp:ee"
+            "7:comment12:test torrent4:infod5:filesl";
+        char buf[128];
+        for (int i = 0; i < files; ++i)
+        {
+            sprintf(buf, "d6:lengthi%de4:pathl5:dir%02d14:file%06d.datee",
+                    i + 1, i % 10, i);
+            torrent += buf;
+        }
+        sprintf(buf, "e4:name6:sample12:piece lengthi262144e6:pieces%d:", pieces * 20);
+        torrent += buf;
+        for (int i = 0; i < pieces * 20; ++i)
+            torrent.push_back(static_cast<char>(i / 20));
+        return torrent + "7:privatei1eee";
+    }
+
+    // the file buffer and tokens a task kept before
+    struct DecodedTorrent
+    {
+        explicit DecodedTorrent(const std::string& torrent)
+            : buf(torrent.data(), torrent.size())
+        {
+            decoder.Decode(buf.iter_data(buf.begin()), buf.size());
+        }
+
+        BenTypesStreamBuf buf;
+        BenDecoder decoder;
+    };
+
+} // unnamed namespace
+
+TEST_CASE(multi_file)
+{
+    std::string torrent = MakeTorrent(3, 4);
+    MetainfoFile info(torrent.data(), torrent.size());
+
+    CHECK_TRUE(!info.IsSingleFile());
+    CHECK_TRUE(info.IsPrivate());
+    CHECK_TRUE(info.Name() == "sample");
+    CHECK_TRUE(info.PieceLength() == 262144);
+    CHECK_TRUE(info.PiecesCount() == 4);
+    CHECK_TRUE(info.Length() == 0);
+
+    for (std::size_t i = 0; i < info.PiecesCount(); ++i)
+    {
+        std::string sha1(20, static_cast<char>(i));
+        CHECK_TRUE(memcmp(info.GetPieceSha1(i).GetData(), sha1.data(), 20) == 0);
+    }
+
+    std::vector<std::vector<std::string> > tiers;
+    info.GetAnnounceTiers(&tiers);
+    CHECK_TRUE(tiers.size() == 2);
+    CHECK_TRUE(tiers[0].size() == 1 && tiers[1][0] == "udp:");
+    std::vector<std::string> announce;
+    info.GetAnnounce(&announce);
+    CHECK_TRUE(announce.size() == 2);
+
+    CHECK_TRUE(info.GetFileCount() == 3);
+    CHECK_TRUE(info.GetFileLength(2) == 3);
+    CHECK_TRUE(info.GetFilePath(1, '\\') == "sample\\dir01\\file000001.dat");
+    std::vector<std::string> path;
+    info.GetFilePath(0, &path);
+    CHECK_TRUE(path.size() == 3 && path[0] == "sample" && path[2] == "file000000.dat");
+
+    std::vector<MetainfoFile::FileInfo> files;
+    info.GetFiles(&files);
+    CHECK_TRUE(files.size() == 3);
+    CHECK_TRUE(files[2].length == 3 && files[2].path[1] == "dir02");
+
+    // the raw info value is the info dictionary of the torrent
+    BenDecoder decoder;
+    CHECK_TRUE(decoder.Decode(torrent.data(), torrent.size()));
+    BenNode raw = decoder.GetRoot().FindDictionary("info");
+    std::pair<const char *, const char *> value = info.GetRawInfoValue();
+    CHECK_TRUE(std::string(value.first, value.second) ==
+            std::string(raw.GetRawBegin(), raw.GetRawEnd()));
+}
+
+TEST_CASE(single_file)
+{
+    const char torrent[] = "d8:announce3:url4:infod6:lengthi1000e"
+        "4:name8:file.dat12:piece lengthi512e6:pieces40:"
+        "0123456789012345678901234567890123456789ee";
+    MetainfoFile info(torrent, sizeof(torrent) - 1);
+
+    CHECK_TRUE(info.IsSingleFile());
+    CHECK_TRUE(!info.IsPrivate());
+    CHECK_TRUE(info.Length() == 1000);
+    CHECK_TRUE(info.GetFileCount() == 1);
+    CHECK_TRUE(info.GetFileLength(0) == 1000);
+    CHECK_TRUE(info.GetFilePath(0, '\\') == "file.dat");
+    CHECK_TRUE(info.PiecesCount() == 2);
+
+    std::vector<std::vector<std::string> > tiers;
+    info.GetAnnounceTiers(&tiers);
+    CHECK_TRUE(tiers.size() == 1 && tiers[0][0] == "url");
+}
+
+TEST_CASE(invalid)
+{
+    const char *invalid[] = {
+        "", "le", "d4:infoi1ee", "d4:infod6:pieces3:abcee",
+        "d4:infod6:pieces20:01234567890123456789e",
+    };
+    for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        bool thrown = false;
+        try
+        {
+            MetainfoFile info(invalid[i], strlen(invalid[i]));
+        }
+        catch (const MetainfoFileExeception&)
+        {
+            thrown = true;
+        }
+        CHECK_TRUE(thrown);
+    }
+
+    bool thrown = false;
+    try
+    {
+        MetainfoFile info("no such file.torrent");
+    }
+    catch (const MetainfoFileExeception&)
+    {
+        thrown = true;
+    }
+    CHECK_TRUE(thrown);
+}
+
+TEST_CASE(mapped_file)
+{
+    std::string torrent = MakeTorrent(10, 10);
+    FILE *file = fopen(torrent_path, "wb");
+    CHECK_TRUE(file);
+    fwrite(torrent.data(), 1, torrent.size(), file);
+    fclose(file);
+
+    {
+        MetainfoFile info(torrent_path);
+        CHECK_TRUE(info.GetFileCount() == 10);
+        CHECK_TRUE(info.GetFilePath(9, '/') == "sample/dir09/file000009.dat");
+        CHECK_TRUE(info.PiecesCount() == 10);
+    }
+    remove(torrent_path);
+}
+
+TEST_CASE(benchmark)
+{
+    std::string torrent = MakeTorrent(file_count, 4000);
+
+    std::size_t base = heap_size;
+    double begin = NowMillisecond();
+    std::vector<DecodedTorrent *> decoded;
+    for (int i = 0; i < torrent_count; ++i)
+        decoded.push_back(new DecodedTorrent(torrent));
+    double decoded_time = NowMillisecond() - begin;
+    std::size_t decoded_memory = heap_size - base;
+    for (std::size_t i = 0; i < decoded.size(); ++i)
+        delete decoded[i];
+
+    base = heap_size;
+    begin = NowMillisecond();
+    std::vector<MetainfoFile *> compact;
+    for (int i = 0; i < torrent_count; ++i)
+        compact.push_back(new MetainfoFile(torrent.data(), torrent.size()));
+    double compact_time = NowMillisecond() - begin;
+    std::size_t compact_memory = heap_size - base;
+    for (std::size_t i = 0; i < compact.size(); ++i)
+        delete compact[i];
+
+    std::cout << torrent_count << " torrents of " << torrent.size() << " bytes and "
+              << file_count << " files" << std::endl;
+    std::cout << "buffer and tokens: " << decoded_time << "ms, held "
+              << decoded_memory / 1024 << "KB" << std::endl;
+    std::cout << "MetainfoFile: " << compact_time << "ms, held "
+              << compact_memory / 1024 << "KB" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "../core/BitData.h"
+#include "../core/BitPex.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../core/bencode/BenTypes.h"
+#include "../net/NetHelper.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <string.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    const char torrent_file[] = "TestPex.torrent";
+    const unsigned long first_ip = 0x0A000001;
+    const unsigned short pex_port = 6881;
+
+    typedef std::vector<BitData::PeerListenInfo> PeerList;
+
+    // a peer which keeps the sent messages
+    class TestPeer : public BitPexPeer
+    {
+    public:
+        TestPeer()
+            : supported(true)
+        {
+        }
+
+        virtual bool GetListenInfo(unsigned long *ip, unsigned short *port) const
+        {
+            *ip = first_ip;
+            *port = pex_port;
+            return true;
+        }
+
+        virtual bool SendExtensionMessage(const BitExtension *extension,
+                                          const std::string& payload)
+        {
+            if (!supported)
+                return false;
+            messages.push_back(payload);
+            return true;
+        }
+
+        // the peer supports ut_pex
+        bool supported;
+        std::vector<std::string> messages;
+    };
+
+    std::tr1::shared_ptr<BitData> MakeBitData()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            bentypes::BenDictionaryWriter info(torrent.Key("info"));
+            info.Add("length", 32 * 1024);
+            info.Add("name", "TestPex.bin");
+            info.Add("piece length", 32 * 1024);
+            info.Add("pieces", std::string(20, 'x'));
+        }
+
+        {
+            std::ofstream fs(torrent_file, std::ios_base::out | std::ios_base::binary);
+            fs.write(writer.GetData(), writer.GetSize());
+        }
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        ::DeleteFileA(torrent_file);
+        return bitdata;
+    }
+
+    // count peers of ips from first_ip, the first one is the peer itself
+    PeerList MakePeers(std::size_t count)
+    {
+        PeerList peers;
+        for (std::size_t i = 1; i <= count; ++i)
+            peers.push_back(BitData::PeerListenInfo(first_ip + i, pex_port));
+        return peers;
+    }
+
+    std::string CompactPeers(const PeerList& peers)
+    {
+        std::string compact;
+        for (std::size_t i = 0; i < peers.size(); ++i)
+        {
+            unsigned int ip = net::HostToNeti(
+                    static_cast<unsigned int>(peers[i].ip));
+            unsigned short port = net::HostToNets(peers[i].port);
+            compact.append(reinterpret_cast<const char *>(&ip), sizeof(ip));
+            compact.append(reinterpret_cast<const char *>(&port), sizeof(port));
+        }
+        return compact;
+    }
+
+    // a ut_pex message of the added peers
+    std::string PexMessage(const PeerList& added)
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter message(writer);
+            message.Add("added", CompactPeers(added));
+            message.Add("added.f", std::string(added.size(), '\0'));
+            message.Add("dropped", std::string());
+        }
+        return writer.GetString();
+    }
+
+    // peers of the compact string of key in the message, an empty list
+    // when the message or key is invalid
+    PeerList ParsePeers(const std::string& message, const char *key)
+    {
+        using namespace bentypes;
+        PeerList peers;
+        BenTypesStreamBuf buf(message.data(), message.size());
+        std::tr1::shared_ptr<BenType> object = GetBenObject(buf);
+        BenDictionary *dict = dynamic_cast<BenDictionary *>(object.get());
+        BenString *compact = dict ? dict->ValueBenTypeCast<BenString>(key) : 0;
+        if (!compact || compact->length() % 6 != 0)
+            return peers;
+
+        for (std::size_t i = 0; i < compact->length(); i += 6)
+        {
+            unsigned int ip = 0;
+            unsigned short port = 0;
+            memcpy(&ip, compact->data() + i, sizeof(ip));
+            memcpy(&port, compact->data() + i + sizeof(ip), sizeof(port));
+            peers.push_back(BitData::PeerListenInfo(
+                        net::NetToHosti(ip), net::NetToHosts(port)));
+        }
+        return peers;
+    }
+
+    bool SamePeers(const PeerList& left, const PeerList& right)
+    {
+        if (left.size() != right.size())
+            return false;
+        for (std::size_t i = 0; i < left.size(); ++i)
+        {
+            if (left[i].ip != right[i].ip || left[i].port != right[i].port)
+                return false;
+        }
+        return true;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(receive_added)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    TestPeer peer;
+    BitUtPex ut_pex(&peer, bitdata);
+
+    // peers of ip 0 or port 0 are not added
+    PeerList added = MakePeers(3);
+    added.push_back(BitData::PeerListenInfo(0, pex_port));
+    added.push_back(BitData::PeerListenInfo(first_ip + 10, 0));
+    std::string message = PexMessage(added);
+    ut_pex.Receive(message.data(), message.size(), 1000);
+
+    BitData::ListenInfoSet& unused = bitdata->GetUnusedListenInfo();
+    CHECK_TRUE(unused.size() == 3);
+    for (std::size_t i = 0; i < 3; ++i)
+        CHECK_TRUE(unused.count(added[i]) == 1);
+
+    // an invalid message is ignored
+    const char invalid[] = "d5:addedi1e";
+    ut_pex.Receive(invalid, sizeof(invalid) - 1, 100000);
+    CHECK_TRUE(unused.size() == 3);
+}
+
+TEST_CASE(receive_cap)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    TestPeer peer;
+    BitUtPex ut_pex(&peer, bitdata);
+
+    // only the first 50 peers of a message are added
+    PeerList added = MakePeers(60);
+    std::string message = PexMessage(added);
+    ut_pex.Receive(message.data(), message.size(), 0);
+
+    BitData::ListenInfoSet& unused = bitdata->GetUnusedListenInfo();
+    CHECK_TRUE(unused.size() == 50);
+    CHECK_TRUE(unused.count(added[49]) == 1);
+    CHECK_TRUE(unused.count(added[50]) == 0);
+}
+
+TEST_CASE(receive_interval)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    TestPeer peer;
+    BitUtPex ut_pex(&peer, bitdata);
+    PeerList added = MakePeers(3);
+    BitData::ListenInfoSet& unused = bitdata->GetUnusedListenInfo();
+
+    // messages of the peer faster than 30 seconds are ignored
+    std::string message = PexMessage(PeerList(1, added[0]));
+    ut_pex.Receive(message.data(), message.size(), 1000);
+    CHECK_TRUE(unused.size() == 1);
+
+    message = PexMessage(PeerList(1, added[1]));
+    ut_pex.Receive(message.data(), message.size(), 1000 + 29999);
+    CHECK_TRUE(unused.size() == 1);
+
+    message = PexMessage(PeerList(1, added[2]));
+    ut_pex.Receive(message.data(), message.size(), 1000 + 30000);
+    CHECK_TRUE(unused.size() == 2);
+    CHECK_TRUE(unused.count(added[2]) == 1);
+}
+
+TEST_CASE(send_delta)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    TestPeer peer;
+    BitUtPex ut_pex(&peer, bitdata);
+    PeerList peers = MakePeers(3);
+
+    // the peer itself is not sent to it
+    BitData::ListenInfoSet connected;
+    connected.insert(BitData::PeerListenInfo(first_ip, pex_port));
+    connected.insert(peers[0]);
+    connected.insert(peers[1]);
+    ut_pex.SendDelta(connected, 0);
+    CHECK_TRUE(peer.messages.size() == 1);
+    CHECK_TRUE(SamePeers(ParsePeers(peer.messages[0], "added"),
+                         PeerList(peers.begin(), peers.begin() + 2)));
+    CHECK_TRUE(ParsePeers(peer.messages[0], "dropped").empty());
+
+    // a message is sent at most every minute
+    connected.erase(peers[0]);
+    connected.insert(peers[2]);
+    ut_pex.SendDelta(connected, 59999);
+    CHECK_TRUE(peer.messages.size() == 1);
+
+    // only the changes since the last message are sent
+    ut_pex.SendDelta(connected, 60000);
+    CHECK_TRUE(peer.messages.size() == 2);
+    CHECK_TRUE(SamePeers(ParsePeers(peer.messages[1], "added"),
+                         PeerList(1, peers[2])));
+    CHECK_TRUE(SamePeers(ParsePeers(peer.messages[1], "dropped"),
+                         PeerList(1, peers[0])));
+
+    // nothing is sent without changes
+    ut_pex.SendDelta(connected, 120000);
+    CHECK_TRUE(peer.messages.size() == 2);
+}
+
+TEST_CASE(send_cap)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    TestPeer peer;
+    BitUtPex ut_pex(&peer, bitdata);
+    PeerList peers = MakePeers(60);
+    BitData::ListenInfoSet connected(peers.begin(), peers.end());
+
+    // the peer does not support ut_pex, the peers are still not sent
+    peer.supported = false;
+    ut_pex.SendDelta(connected, 0);
+    CHECK_TRUE(peer.messages.empty());
+
+    // at most 50 added peers in a message, the others are in the next
+    peer.supported = true;
+    ut_pex.SendDelta(connected, 0);
+    CHECK_TRUE(peer.messages.size() == 1);
+    CHECK_TRUE(SamePeers(ParsePeers(peer.messages[0], "added"),
+                         PeerList(peers.begin(), peers.begin() + 50)));
+
+    ut_pex.SendDelta(connected, 60000);
+    CHECK_TRUE(peer.messages.size() == 2);
+    CHECK_TRUE(SamePeers(ParsePeers(peer.messages[1], "added"),
+                         PeerList(peers.begin() + 50, peers.end())));
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
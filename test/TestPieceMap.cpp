@@ -0,0 +1,255 @@
+#include "../core/BitPieceMap.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// the word kernels and the AVX2 kernels are checked against piece by
+// piece results, sizes are around the word and the vector boundaries,
+// then the whole map operations are benchmarked
+
+class Stopwatch
+{
+public:
+    Stopwatch()
+    {
+        ::QueryPerformanceFrequency(&frequency_);
+        ::QueryPerformanceCounter(&begin_);
+    }
+
+    // nanoseconds per iteration
+    double Elapsed(std::size_t iterations) const
+    {
+        LARGE_INTEGER end;
+        ::QueryPerformanceCounter(&end);
+        return static_cast<double>(end.QuadPart - begin_.QuadPart) *
+            1000000000.0 / frequency_.QuadPart / iterations;
+    }
+
+private:
+    LARGE_INTEGER frequency_;
+    LARGE_INTEGER begin_;
+};
+
+void RandomMark(BitPieceMap& map, std::size_t piece_count, int percent)
+{
+    for (std::size_t i = 0; i < piece_count; ++i)
+    {
+        if (rand() % 100 < percent)
+            map.MarkPiece(i);
+    }
+}
+
+// the old byte by byte union + difference + intersection, as a baseline
+std::size_t ByteAndNotOr(const std::vector<char>& need,
+                         const std::vector<char>& downloaded,
+                         const std::vector<char>& downloading,
+                         const std::vector<char>& candidate,
+                         std::vector<char>& result)
+{
+    std::size_t first = need.size();
+    for (std::size_t i = 0; i < need.size(); ++i)
+    {
+        result[i] = downloaded[i] | downloading[i];
+        result[i] = need[i] & ~result[i];
+        result[i] = result[i] & candidate[i];
+        if (result[i] && first == need.size())
+            first = i;
+    }
+    return first;
+}
+
+struct FusedMaps
+{
+    explicit FusedMaps(std::size_t piece_count)
+        : include(piece_count),
+          exclude1(piece_count),
+          exclude2(piece_count),
+          mask(piece_count),
+          result(piece_count)
+    {
+        RandomMark(include, piece_count, 90);
+        RandomMark(exclude1, piece_count, 60);
+        RandomMark(exclude2, piece_count, 60);
+        RandomMark(mask, piece_count, 50);
+    }
+
+    bool Expected(std::size_t i) const
+    {
+        return include.IsPieceMark(i) && !exclude1.IsPieceMark(i) &&
+               !exclude2.IsPieceMark(i) && mask.IsPieceMark(i);
+    }
+
+    BitPieceMap include;
+    BitPieceMap exclude1;
+    BitPieceMap exclude2;
+    BitPieceMap mask;
+    BitPieceMap result;
+};
+
+TEST_CASE(fused_operations)
+{
+    const std::size_t sizes[] = {
+        1, 7, 8, 63, 64, 65, 255, 256, 257, 511, 1000, 4099
+    };
+
+    srand(2);
+    for (int accelerated = 0; accelerated < 2; ++accelerated)
+    {
+        BitPieceMap::EnableAcceleration(accelerated != 0);
+        for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        {
+            std::size_t piece_count = sizes[s];
+            FusedMaps maps(piece_count);
+
+            std::size_t expected_count = 0;
+            std::size_t marked_count = 0;
+            for (std::size_t i = 0; i < piece_count; ++i)
+            {
+                expected_count += maps.Expected(i) ? 1 : 0;
+                marked_count += maps.include.IsPieceMark(i) ? 1 : 0;
+            }
+            CHECK_TRUE(maps.include.Count() == marked_count);
+
+            BitPieceMap::AndNotOr(maps.include, maps.exclude1, maps.exclude2,
+                    maps.mask, maps.result);
+            bool same = true;
+            for (std::size_t i = 0; i < piece_count; ++i)
+                same = same && maps.result.IsPieceMark(i) == maps.Expected(i);
+            CHECK_TRUE(same);
+
+            CHECK_TRUE(BitPieceMap::CountAndNotOr(maps.include, maps.exclude1,
+                        maps.exclude2, maps.mask) == expected_count);
+
+            // find first from every position, sparse result is left in
+            // the last vector to pass the skipped vectors
+            for (int sparse = 0; sparse < 2; ++sparse)
+            {
+                if (sparse)
+                {
+                    maps.mask.Clear();
+                    maps.mask.MarkPiece(piece_count - 1);
+                    maps.include.MarkPiece(piece_count - 1);
+                    maps.exclude1.UnMarkPiece(piece_count - 1);
+                    maps.exclude2.UnMarkPiece(piece_count - 1);
+                }
+
+                same = true;
+                for (std::size_t begin = 0; begin <= piece_count; ++begin)
+                {
+                    std::size_t expected = begin;
+                    while (expected < piece_count && !maps.Expected(expected))
+                        ++expected;
+
+                    std::size_t index = piece_count;
+                    bool found = BitPieceMap::FindFirstAndNotOr(maps.include,
+                            maps.exclude1, maps.exclude2, maps.mask, begin, &index);
+                    same = same && found == (expected < piece_count) &&
+                           (!found || index == expected);
+                }
+                CHECK_TRUE(same);
+            }
+        }
+    }
+    BitPieceMap::EnableAcceleration(true);
+}
+
+void Benchmark(std::size_t piece_count)
+{
+    BitPieceMap need(piece_count);
+    BitPieceMap downloaded(piece_count);
+    BitPieceMap downloading(piece_count);
+    BitPieceMap candidate(piece_count);
+    BitPieceMap result(piece_count);
+
+    // nearly complete download, only the last piece is selectable,
+    // which is the worst case of find first
+    RandomMark(need, piece_count, 100);
+    RandomMark(downloaded, piece_count, 90);
+    RandomMark(downloading, piece_count, 100);
+    downloading.UnMarkPiece(piece_count - 1);
+    downloaded.UnMarkPiece(piece_count - 1);
+    RandomMark(candidate, piece_count, 50);
+    candidate.MarkPiece(piece_count - 1);
+
+    std::size_t iterations = 100000000 / piece_count;
+    std::size_t sink = 0;
+
+    std::vector<char> bytes[5];
+    BitPieceMap *maps[4] = { &need, &downloaded, &downloading, &candidate };
+    for (int i = 0; i < 4; ++i)
+    {
+        bytes[i].resize(need.GetMapSize());
+        maps[i]->ToBitfield(&bytes[i][0]);
+    }
+    bytes[4].resize(need.GetMapSize());
+
+    std::cout << piece_count << " pieces:" << std::endl;
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < iterations; ++i)
+            sink += ByteAndNotOr(bytes[0], bytes[1], bytes[2], bytes[3], bytes[4]);
+        std::cout << "\tbyte loop and-not-or:   " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < iterations; ++i)
+            BitPieceMap::AndNotOr(need, downloaded, downloading, candidate, result);
+        std::cout << "\tAndNotOr:               " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        std::size_t index = 0;
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            BitPieceMap::FindFirstAndNotOr(need, downloaded, downloading,
+                    candidate, 0, &index);
+            sink += index;
+        }
+        std::cout << "\tFindFirstAndNotOr:      " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < iterations; ++i)
+            sink += BitPieceMap::CountAndNotOr(need, downloaded, downloading, candidate);
+        std::cout << "\tCountAndNotOr:          " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < iterations; ++i)
+            sink += downloaded.Count();
+        std::cout << "\tCount:                  " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        std::size_t size = need.GetMapSize();
+        for (std::size_t i = 0; i < iterations; ++i)
+            BitPieceMap::Union(downloaded, downloading, 0, size, result);
+        std::cout << "\tUnion (byte range):     " << watch.Elapsed(iterations) << "ns" << std::endl;
+    }
+
+    if (sink == 0)
+        std::cout << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+
+    std::cout << "AVX2: " << (BitPieceMap::IsAccelerated() ? "yes" : "no") << std::endl;
+    srand(1);
+    Benchmark(1000);
+    Benchmark(100000);
+    Benchmark(1000000);
+    return 0;
+}
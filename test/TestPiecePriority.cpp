@@ -0,0 +1,107 @@
+#include "../core/BitData.h"
+#include "../core/BitDownloadingInfo.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <fstream>
+#include <memory>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // files a.bin of 1.5 pieces, empty.bin of zero length in the middle
+    // of piece 1, and c.bin of 2.5 pieces, the task has 4 pieces
+    const char torrent_file[] = "TestPiecePriority.torrent";
+    const long long piece_length = 32 * 1024;
+    const std::size_t piece_count = 4;
+
+    void AddFile(bentypes::BenWriter& writer, const char *name, long long length)
+    {
+        bentypes::BenDictionaryWriter file(writer);
+        file.Add("length", length);
+        file.Key("path").BeginList();
+        writer.WriteString(name);
+        writer.End();
+    }
+
+    std::tr1::shared_ptr<BitData> MakeBitData()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            bentypes::BenDictionaryWriter info(torrent.Key("info"));
+            info.Key("files").BeginList();
+            AddFile(writer, "a.bin", piece_length + piece_length / 2);
+            AddFile(writer, "empty.bin", 0);
+            AddFile(writer, "c.bin", 2 * piece_length + piece_length / 2);
+            writer.End();
+            info.Add("name", "TestPiecePriority");
+            info.Add("piece length", piece_length);
+            info.Add("pieces", std::string(20 * piece_count, 'x'));
+        }
+
+        {
+            std::ofstream fs(torrent_file, std::ios_base::out | std::ios_base::binary);
+            fs.write(writer.GetData(), writer.GetSize());
+        }
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        ::DeleteFileA(torrent_file);
+        return bitdata;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(zero_length_file)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    CHECK_TRUE(bitdata->GetPieceCount() == piece_count);
+
+    // the empty file borders piece 1, it must not raise its priority
+    bitdata->SetFilePriority(0, PRIORITY_SKIP);
+    bitdata->SetFilePriority(1, PRIORITY_HIGH);
+    bitdata->SetFilePriority(2, PRIORITY_LOW);
+
+    BitDownloadingInfo info(bitdata);
+    CHECK_TRUE(info.GetNeedDownload(PRIORITY_HIGH).Count() == 0);
+    CHECK_TRUE(!info.GetNeedDownload().IsPieceMark(0));
+    for (std::size_t i = 1; i < piece_count; ++i)
+        CHECK_TRUE(info.GetNeedDownload(PRIORITY_LOW).IsPieceMark(i));
+}
+
+TEST_CASE(piece_priority_override)
+{
+    std::tr1::shared_ptr<BitData> bitdata = MakeBitData();
+    bitdata->SelectAllFile(true);
+
+    // the priorities are kept per piece, setting them again and again
+    // never grows the list
+    for (int i = 0; i < 100; ++i)
+    {
+        bitdata->SetPiecePriority(0, 1, PRIORITY_HIGH);
+        bitdata->SetPiecePriority(2, 100, PRIORITY_SKIP);
+    }
+    CHECK_TRUE(bitdata->GetPiecePriorities().size() == piece_count);
+
+    // the later range overrides the earlier one
+    bitdata->SetPiecePriority(3, 4, PRIORITY_LOW);
+    bitdata->SetPiecePriority(5, 3, PRIORITY_HIGH);
+
+    BitDownloadingInfo info(bitdata);
+    CHECK_TRUE(info.GetNeedDownload(PRIORITY_HIGH).IsPieceMark(0));
+    CHECK_TRUE(info.GetNeedDownload(PRIORITY_NORMAL).IsPieceMark(1));
+    CHECK_TRUE(!info.GetNeedDownload().IsPieceMark(2));
+    CHECK_TRUE(info.GetNeedDownload(PRIORITY_LOW).IsPieceMark(3));
+    CHECK_TRUE(info.GetNeedDownload().Count() == 3);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include "../core/BitPieceMap.h"
+#include "../core/BitPieceAvailability.h"
+#include "../core/BitPieceIndexSearcher.h"
+#include "../base/ScopePtr.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// a simple swarm simulation: one seed and leechers connected to each other,
+// every round each peer uploads upload_slots pieces at most, and each
+// leecher asks random peers for download_slots pieces. Pieces completed in
+// a round are announced to all peers at the end of the round.
+struct SimPeer
+{
+    SimPeer(std::size_t piece_count, bool rarest_first)
+        : have(piece_count),
+          downloading(piece_count),
+          need(piece_count),
+          availability(piece_count),
+          have_count(0),
+          upload_left(0),
+          complete_round(0)
+    {
+        for (std::size_t i = 0; i < piece_count; ++i)
+            need.MarkPiece(i);
+
+        if (rarest_first)
+            searcher.Reset(CreateRarestFirstPieceIndexSearcher(availability));
+        else
+            searcher.Reset(CreateLinearPieceIndexSearcher());
+    }
+
+    BitPieceMap have;
+    BitPieceMap downloading;
+    BitPieceMap need;
+    BitPieceAvailability availability;
+    ScopePtr<BitPieceIndexSearcher> searcher;
+    std::size_t have_count;
+    std::size_t upload_left;
+    std::size_t complete_round;
+    std::vector<std::size_t> arriving;
+};
+
+typedef std::tr1::shared_ptr<SimPeer> SimPeerPtr;
+
+void Simulate(std::size_t piece_count, std::size_t leecher_count,
+              std::size_t seed_slots, std::size_t upload_slots,
+              std::size_t download_slots, bool rarest_first)
+{
+    srand(1);
+    std::vector<SimPeerPtr> peers;
+    for (std::size_t i = 0; i <= leecher_count; ++i)
+        peers.push_back(SimPeerPtr(new SimPeer(piece_count, rarest_first)));
+
+    // peers[0] is the seed
+    for (std::size_t i = 0; i < piece_count; ++i)
+        peers[0]->have.MarkPiece(i);
+    peers[0]->have_count = piece_count;
+    for (std::size_t i = 1; i < peers.size(); ++i)
+        peers[i]->availability.IncreasePieceMap(peers[0]->have);
+
+    LARGE_INTEGER frequency, begin, end;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&begin);
+
+    std::size_t round = 0;
+    std::size_t complete = 0;
+    long long picks = 0;
+    while (complete < leecher_count && round < 100000)
+    {
+        ++round;
+        peers[0]->upload_left = seed_slots;
+        for (std::size_t i = 1; i < peers.size(); ++i)
+            peers[i]->upload_left = upload_slots;
+
+        for (std::size_t i = 1; i < peers.size(); ++i)
+        {
+            SimPeer& peer = *peers[i];
+            if (peer.complete_round)
+                continue;
+
+            for (std::size_t slot = 0, tries = 0;
+                    slot < download_slots && tries < peers.size(); ++tries)
+            {
+                std::size_t from = rand() % peers.size();
+                if (from == i || peers[from]->upload_left == 0)
+                    continue;
+
+                std::size_t piece_index = 0;
+                ++picks;
+                if (peer.searcher->Search(peer.have, peer.downloading, peer.need,
+                            peers[from]->have, &piece_index))
+                {
+                    peer.downloading.MarkPiece(piece_index);
+                    peer.arriving.push_back(piece_index);
+                    --peers[from]->upload_left;
+                    ++slot;
+                }
+            }
+        }
+
+        for (std::size_t i = 1; i < peers.size(); ++i)
+        {
+            SimPeer& peer = *peers[i];
+            for (std::size_t k = 0; k < peer.arriving.size(); ++k)
+            {
+                std::size_t piece_index = peer.arriving[k];
+                peer.downloading.UnMarkPiece(piece_index);
+                peer.have.MarkPiece(piece_index);
+                ++peer.have_count;
+
+                // HAVE message to all other peers
+                for (std::size_t j = 1; j < peers.size(); ++j)
+                {
+                    if (j != i)
+                        peers[j]->availability.IncreasePiece(piece_index);
+                }
+            }
+            peer.arriving.clear();
+
+            if (!peer.complete_round && peer.have_count == piece_count)
+            {
+                peer.complete_round = round;
+                ++complete;
+            }
+        }
+    }
+
+    ::QueryPerformanceCounter(&end);
+    double ms = static_cast<double>(end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+
+    std::size_t total_rounds = 0;
+    for (std::size_t i = 1; i < peers.size(); ++i)
+        total_rounds += peers[i]->complete_round;
+
+    std::cout << (rarest_first ? "rarest first: " : "linear:       ")
+        << "swarm complete round " << round
+        << ", average complete round "
+        << static_cast<double>(total_rounds) / leecher_count
+        << ", " << picks << " picks in " << ms << "ms" << std::endl;
+}
+
+// pieces the picker removed are downloaded, they fail a recheck and are
+// restored, then they are picked again
+TEST_CASE(restore_removed_pieces)
+{
+    const std::size_t piece_count = 100;
+    const std::size_t lost_count = 80;
+    BitPieceMap downloaded(piece_count);
+    BitPieceMap downloading(piece_count);
+    BitPieceMap need(piece_count);
+    BitPieceMap candidate(piece_count);
+    BitPieceAvailability availability(piece_count);
+    for (std::size_t i = 0; i < piece_count; ++i)
+    {
+        need.MarkPiece(i);
+        candidate.MarkPiece(i);
+        for (std::size_t count = 0; count <= i % 3; ++count)
+            availability.IncreasePiece(i);
+        if (i < lost_count)
+            downloaded.MarkPiece(i);
+    }
+
+    ScopePtr<BitPieceIndexSearcher> searcher(
+            CreateRarestFirstPieceIndexSearcher(availability));
+    std::size_t piece_index = 0;
+    std::size_t picked = 0;
+    while (searcher->Search(downloaded, downloading, need, candidate, &piece_index))
+    {
+        CHECK_TRUE(piece_index >= lost_count);
+        downloading.MarkPiece(piece_index);
+        ++picked;
+    }
+    CHECK_TRUE(picked == piece_count - lost_count);
+
+    std::size_t removed = 0;
+    for (std::size_t i = 0; i < lost_count; ++i)
+    {
+        if (availability.IsPieceRemoved(i))
+            ++removed;
+    }
+    CHECK_TRUE(removed > 0);
+
+    for (std::size_t i = 0; i < lost_count; ++i)
+    {
+        downloaded.UnMarkPiece(i);
+        availability.RestorePiece(i);
+        CHECK_TRUE(!availability.IsPieceRemoved(i));
+    }
+
+    // every piece is in the bucket of its availability
+    for (std::size_t count = 0; count < availability.GetBucketCount(); ++count)
+    {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        availability.GetBucketRange(count, begin, end);
+        for (; begin < end; ++begin)
+            CHECK_TRUE(availability.GetAvailability(
+                        availability.GetPieceAt(begin)) == count);
+    }
+
+    picked = 0;
+    while (searcher->Search(downloaded, downloading, need, candidate, &piece_index))
+    {
+        CHECK_TRUE(piece_index < lost_count);
+        downloading.MarkPiece(piece_index);
+        ++picked;
+    }
+    CHECK_TRUE(picked == lost_count);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+
+    const std::size_t piece_count = 2000;
+    const std::size_t leecher_count = 50;
+
+    std::cout << piece_count << " pieces, " << leecher_count
+        << " leechers, poorly seeded (seed uploads 2 pieces per round)" << std::endl;
+    Simulate(piece_count, leecher_count, 2, 4, 4, false);
+    Simulate(piece_count, leecher_count, 2, 4, 4, true);
+
+    std::cout << piece_count << " pieces, " << leecher_count
+        << " leechers, well seeded (seed uploads 50 pieces per round)" << std::endl;
+    Simulate(piece_count, leecher_count, 50, 4, 4, false);
+    Simulate(piece_count, leecher_count, 50, 4, 4, true);
+
+    return 0;
+}
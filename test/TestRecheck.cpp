@@ -0,0 +1,200 @@
+#include "../core/BitData.h"
+#include "../core/BitRecheck.h"
+#include "../core/BitHashPool.h"
+#include "../core/BitTorrentMaker.h"
+#include "../core/BitDownloadingInfo.h"
+#include "../base/StringConv.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// a torrent of two files is made, then a piece of the first file is
+// corrupted and the second file is deleted, the recheck results
+// are applied to a downloaded piece map as BitTask does
+
+const char check_path[] = "TestRecheckData";
+const char check_torrent[] = "TestRecheckData.torrent";
+const std::size_t check_piece_length = 16 * 1024;
+
+void WriteCheckFile(const std::string& path, std::size_t size, char seed)
+{
+    std::string data(size, '\0');
+    for (std::size_t i = 0; i < size; ++i)
+        data[i] = static_cast<char>(seed + i * 7 + i / 251);
+
+    std::ofstream fs(path.c_str(), std::ios_base::out | std::ios_base::binary);
+    fs.write(data.data(), data.size());
+}
+
+TEST_CASE(recheck_piece_map)
+{
+    // a.bin is pieces 0-3, b.bin is pieces 3-5
+    ::CreateDirectoryA(check_path, 0);
+    std::string a = std::string(check_path) + "\\a.bin";
+    std::string b = std::string(check_path) + "\\b.bin";
+    WriteCheckFile(a, 3 * check_piece_length + 100, 1);
+    WriteCheckFile(b, 2 * check_piece_length + 7, 2);
+
+    BitHashPool hash_pool;
+    {
+        BitTorrentMaker maker(check_path, hash_pool);
+        maker.SetPieceLength(check_piece_length);
+        maker.Start();
+        while (!maker.IsComplete())
+            ::Sleep(10);
+        maker.SaveTorrentFile(check_torrent);
+    }
+
+    {
+        std::fstream fs(a.c_str(), std::ios_base::in | std::ios_base::out |
+                std::ios_base::binary);
+        fs.seekp(check_piece_length + 10);
+        fs.put('x');
+    }
+    ::DeleteFileA(b.c_str());
+
+    std::tr1::shared_ptr<BitData> bitdata(new BitData(check_torrent));
+    bitdata->SetBasePath(".");
+    bitdata->SelectAllFile(true);
+    CHECK_TRUE(bitdata->GetPieceCount() == 6);
+
+    // all pieces were downloaded before the recheck
+    BitDownloadingInfo info(bitdata);
+    for (std::size_t i = 0; i < bitdata->GetPieceCount(); ++i)
+        info.MarkDownloadComplete(i);
+
+    BitRecheck recheck(bitdata, hash_pool);
+    recheck.Start();
+    while (!recheck.IsComplete())
+        ::Sleep(10);
+
+    BitRecheck::PieceIndexList ok;
+    BitRecheck::PieceIndexList failed;
+    recheck.GetCheckedPieces(ok);
+    recheck.GetFailedPieces(failed);
+    CHECK_TRUE(ok.size() == 2);
+    CHECK_TRUE(failed.size() == 4);
+    CHECK_TRUE(recheck.GetFailedCount() == 4);
+
+    for (std::size_t i = 0; i < ok.size(); ++i)
+        info.MarkDownloadComplete(ok[i]);
+    for (std::size_t i = 0; i < failed.size(); ++i)
+        CHECK_TRUE(info.MarkRecheckFailed(failed[i]));
+
+    // piece 1 is corrupted, piece 3 to 5 lost b.bin
+    const BitPieceMap& downloaded = info.GetDownloaded();
+    CHECK_TRUE(downloaded.Count() == 2);
+    CHECK_TRUE(downloaded.IsPieceMark(0));
+    CHECK_TRUE(!downloaded.IsPieceMark(1));
+    CHECK_TRUE(downloaded.IsPieceMark(2));
+    CHECK_TRUE(!downloaded.IsPieceMark(3));
+    CHECK_TRUE(!downloaded.IsPieceMark(4));
+    CHECK_TRUE(!downloaded.IsPieceMark(5));
+    CHECK_TRUE(!info.MarkRecheckFailed(1));
+
+    ::DeleteFileA(a.c_str());
+    ::DeleteFileA(check_torrent);
+    ::RemoveDirectoryA(check_path);
+}
+
+// run with data not in system file cache, recheck read through the cache,
+// then read all files again with FILE_FLAG_NO_BUFFERING as the disk bound
+double ReadAllFiles(const std::tr1::shared_ptr<BitData>& bitdata, long long& total)
+{
+    const DWORD buffer_size = 4 * 1024 * 1024;
+    char *buffer = static_cast<char *>(::VirtualAlloc(0, buffer_size,
+                MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+
+    LARGE_INTEGER frequency, begin, end;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&begin);
+
+    total = 0;
+    const BitData::DownloadFiles& files = bitdata->GetFilesInfo();
+    for (BitData::DownloadFiles::const_iterator it = files.begin();
+            it != files.end(); ++it)
+    {
+        std::wstring path = UTF8ToUnicode(bitdata->GetBasePath() + it->file_path);
+        HANDLE file = ::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                0, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        if (file == INVALID_HANDLE_VALUE)
+            continue;
+
+        DWORD bytes = 0;
+        while (::ReadFile(file, buffer, buffer_size, &bytes, 0) && bytes > 0)
+            total += bytes;
+        ::CloseHandle(file);
+    }
+
+    ::QueryPerformanceCounter(&end);
+    ::VirtualFree(buffer, 0, MEM_RELEASE);
+
+    double seconds = static_cast<double>(end.QuadPart - begin.QuadPart) / frequency.QuadPart;
+    return total / seconds / (1024.0 * 1024.0 * 1024.0);
+}
+
+int main(int argc, const char **argv)
+{
+    TestCollector.RunCases();
+
+    if (argc < 3)
+    {
+        std::cout << "TestRecheck torrent download_path [io_budget_MB]" << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(ANSIToUTF8(argv[1])));
+        bitdata->SetBasePath(ANSIToUTF8(argv[2]));
+        bitdata->SelectAllFile(true);
+
+        BitHashPool hash_pool;
+        BitRecheck recheck(bitdata, hash_pool);
+        if (argc > 3)
+            recheck.SetIoBudget(_atoi64(argv[3]) * 1024 * 1024);
+
+        std::size_t ok_count = 0;
+        BitRecheck::PieceIndexList pieces;
+
+        recheck.Start();
+        while (!recheck.IsComplete())
+        {
+            ::Sleep(1000);
+            recheck.GetCheckedPieces(pieces);
+            ok_count += pieces.size();
+            pieces.clear();
+            std::cout << "checked: " << recheck.GetCheckedCount() << "/"
+                << recheck.GetPieceCount() << " "
+                << recheck.GetThroughput() << "GB/s" << std::endl;
+        }
+
+        recheck.GetCheckedPieces(pieces);
+        ok_count += pieces.size();
+        double recheck_speed = recheck.GetThroughput();
+
+        long long total = 0;
+        double read_speed = ReadAllFiles(bitdata, total);
+
+        std::cout << "hash threads: " << hash_pool.GetThreadCount() << std::endl;
+        std::cout << "pieces ok: " << ok_count << "/" << recheck.GetPieceCount() << std::endl;
+        std::cout << "recheck: " << recheck_speed << "GB/s" << std::endl;
+        std::cout << "sequential read: " << read_speed << "GB/s ("
+            << total << " bytes)" << std::endl;
+        if (read_speed > 0.0)
+            std::cout << "disk utilization: " << recheck_speed / read_speed * 100.0
+                << "%" << std::endl;
+    }
+    catch (const BaseException& be)
+    {
+        std::cout << be.what() << std::endl;
+    }
+
+    return 0;
+}
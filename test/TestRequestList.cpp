@@ -0,0 +1,251 @@
+#include "../core/BitRequestList.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+class Stopwatch
+{
+public:
+    Stopwatch()
+    {
+        ::QueryPerformanceFrequency(&frequency_);
+        ::QueryPerformanceCounter(&begin_);
+    }
+
+    // nanoseconds per operation
+    double Elapsed(std::size_t operations) const
+    {
+        LARGE_INTEGER end;
+        ::QueryPerformanceCounter(&end);
+        return static_cast<double>(end.QuadPart - begin_.QuadPart) *
+            1000000000.0 / frequency_.QuadPart / operations;
+    }
+
+private:
+    LARGE_INTEGER frequency_;
+    LARGE_INTEGER begin_;
+};
+
+const int block_size = 16 * 1024;
+const int blocks_per_piece = 16;
+
+struct Request
+{
+    int index;
+    int begin;
+    int length;
+
+    friend bool operator == (const Request& left, const Request& right)
+    {
+        return left.index == right.index &&
+               left.begin == right.begin &&
+               left.length == right.length;
+    }
+};
+
+std::vector<Request> MakeRequests(std::size_t count)
+{
+    std::vector<Request> requests(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        requests[i].index = static_cast<int>(i / blocks_per_piece);
+        requests[i].begin = static_cast<int>(i % blocks_per_piece) * block_size;
+        requests[i].length = block_size;
+    }
+    return requests;
+}
+
+// random operations compare with std::list
+TEST_CASE(check_with_list)
+{
+    srand(1);
+    std::vector<Request> requests = MakeRequests(4096);
+    BitRequestList lists[2];
+    std::list<Request> refs[2];
+
+    for (int round = 0; round < 200000; ++round)
+    {
+        int which = rand() % 2;
+        BitRequestList& list = lists[which];
+        std::list<Request>& ref = refs[which];
+        const Request& r = requests[rand() % requests.size()];
+
+        switch (rand() % 4)
+        {
+        case 0:
+            list.AddRequest(r.index, r.begin, r.length);
+            ref.push_back(r);
+            break;
+        case 1:
+            list.DelRequest(r.index, r.begin, r.length);
+            ref.remove(r);
+            break;
+        case 2:
+            {
+                BitRequestList::Iterator it = list.FindRequest(r.index, r.begin, r.length);
+                std::list<Request>::iterator rit = std::find(ref.begin(), ref.end(), r);
+                CHECK_TRUE((it == list.End()) == (rit == ref.end()));
+                if (it != list.End())
+                {
+                    lists[1 - which].Splice(list, it);
+                    refs[1 - which].splice(refs[1 - which].end(), ref, rit);
+                }
+            }
+            break;
+        case 3:
+            if (!ref.empty())
+            {
+                list.Erase(list.Begin());
+                ref.pop_front();
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < 2; ++i)
+    {
+        CHECK_TRUE(lists[i].Size() == refs[i].size());
+        std::list<Request>::iterator rit = refs[i].begin();
+        for (BitRequestList::Iterator it = lists[i].Begin();
+                it != lists[i].End(); ++it, ++rit)
+        {
+            CHECK_TRUE(it->index == rit->index && it->begin == rit->begin);
+            CHECK_TRUE(lists[i].IsExistRequest(it->index, it->begin, it->length));
+        }
+    }
+}
+
+// splice a range of a list to its own tail
+TEST_CASE(self_splice)
+{
+    std::vector<Request> requests = MakeRequests(4);
+    BitRequestList list;
+    for (std::size_t i = 0; i < requests.size(); ++i)
+        list.AddRequest(requests[i].index, requests[i].begin, requests[i].length);
+
+    // ends at the tail already, nothing moves
+    BitRequestList::Iterator second = list.Begin();
+    ++second;
+    list.Splice(list, second, list.End());
+    CHECK_TRUE(list.Size() == 4);
+    CHECK_TRUE(list.Begin()->begin == 0);
+
+    // the first two move behind the others
+    BitRequestList::Iterator third = second;
+    ++third;
+    list.Splice(list, list.Begin(), third);
+    CHECK_TRUE(list.Size() == 4);
+    int expect[] = { 2, 3, 0, 1 };
+    int i = 0;
+    for (BitRequestList::Iterator it = list.Begin(); it != list.End(); ++it, ++i)
+    {
+        CHECK_TRUE(it->begin == expect[i] * block_size);
+        CHECK_TRUE(list.IsExistRequest(it->index, it->begin, it->length));
+    }
+}
+
+// the old BitRequestList, std::list and linear find, return the count of
+// requests found
+std::size_t BenchmarkStdList(const std::vector<Request>& requests,
+                      const std::vector<std::size_t>& order)
+{
+    std::list<Request> list(requests.begin(), requests.end());
+    std::list<Request> other;
+    std::size_t count = order.size();
+    std::size_t found = 0;
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+            found += std::find(list.begin(), list.end(), requests[order[i]]) != list.end();
+        std::cout << "\tstd::list find:          " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::list<Request>::iterator it =
+                std::find(list.begin(), list.end(), requests[order[i]]);
+            other.splice(other.end(), list, it);
+        }
+        std::cout << "\tstd::list find + splice: " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+            other.remove(requests[order[i]]);
+        std::cout << "\tstd::list find + erase:  " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+    return found;
+}
+
+std::size_t BenchmarkRequestList(const std::vector<Request>& requests,
+                          const std::vector<std::size_t>& order)
+{
+    BitRequestList list;
+    BitRequestList other;
+    std::size_t count = order.size();
+    for (std::size_t i = 0; i < count; ++i)
+        list.AddRequest(requests[i].index, requests[i].begin, requests[i].length);
+
+    std::size_t found = 0;
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Request& r = requests[order[i]];
+            found += list.IsExistRequest(r.index, r.begin, r.length);
+        }
+        std::cout << "\tBitRequestList find:          " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Request& r = requests[order[i]];
+            other.Splice(list, list.FindRequest(r.index, r.begin, r.length));
+        }
+        std::cout << "\tBitRequestList find + splice: " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+
+    {
+        Stopwatch watch;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Request& r = requests[order[i]];
+            other.DelRequest(r.index, r.begin, r.length);
+        }
+        std::cout << "\tBitRequestList find + erase:  " << watch.Elapsed(count) << "ns" << std::endl;
+    }
+    return found;
+}
+
+TEST_CASE(benchmark)
+{
+    const std::size_t count = 10000;
+    std::vector<Request> requests = MakeRequests(count);
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; ++i)
+        order[i] = i;
+    std::random_shuffle(order.begin(), order.end());
+
+    std::cout << count << " requests, random order:" << std::endl;
+    CHECK_TRUE(BenchmarkStdList(requests, order) == count);
+    CHECK_TRUE(BenchmarkRequestList(requests, order) == count);
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
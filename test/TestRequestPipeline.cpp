@@ -0,0 +1,351 @@
+#include "../core/BitRequestPipeline.h"
+#include "../net/WinSockIniter.h"
+#include "../thread/Event.h"
+#include "../thread/Mutex.h"
+#include "../thread/Thread.h"
+#include <Winsock2.h>
+#include <Windows.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// loopback benchmark of per peer throughput vs rtt: a piece server
+// limited to link_rate, a delay proxy adds rtt / 2 in each direction,
+// and a client keeps requests outstanding with fixed or adaptive depth.
+
+const int block_size = 16 * 1024;
+const int request_size = 17;
+const int piece_header_size = 13;
+const double link_rate = 32.0 * 1024 * 1024;
+const DWORD run_millisecond = 6000;
+
+DWORD Now()
+{
+    LARGE_INTEGER frequency, counter;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&counter);
+    return static_cast<DWORD>(counter.QuadPart * 1000 / frequency.QuadPart);
+}
+
+bool SendAll(SOCKET s, const char *data, int len)
+{
+    while (len > 0)
+    {
+        int sent = ::send(s, data, len, 0);
+        if (sent <= 0)
+            return false;
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool RecvAll(SOCKET s, char *data, int len)
+{
+    while (len > 0)
+    {
+        int received = ::recv(s, data, len, 0);
+        if (received <= 0)
+            return false;
+        data += received;
+        len -= received;
+    }
+    return true;
+}
+
+SOCKET Listen(unsigned short *port)
+{
+    SOCKET s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    ::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    ::listen(s, 1);
+
+    int len = sizeof(addr);
+    ::getsockname(s, reinterpret_cast<sockaddr *>(&addr), &len);
+    *port = ::ntohs(addr.sin_port);
+    return s;
+}
+
+SOCKET Connect(unsigned short port)
+{
+    SOCKET s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+    addr.sin_port = ::htons(port);
+    ::connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+
+    BOOL no_delay = TRUE;
+    ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY,
+            reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+    return s;
+}
+
+// answer every request with a PIECE message, paced to link_rate
+class PieceServer : private NotCopyable
+{
+public:
+    PieceServer()
+        : listener_(Listen(&port_)),
+          thread_(std::tr1::bind(&PieceServer::Serve, this))
+    {
+    }
+
+    ~PieceServer()
+    {
+        thread_.Join();
+        ::closesocket(listener_);
+    }
+
+    unsigned short GetPort() const { return port_; }
+
+private:
+    unsigned Serve()
+    {
+        SOCKET s = ::accept(listener_, 0, 0);
+        std::vector<char> piece(piece_header_size + block_size);
+        char request[request_size];
+
+        double link_free = Now();
+        while (RecvAll(s, request, request_size))
+        {
+            link_free += block_size * 1000.0 / link_rate;
+            double wait = link_free - Now();
+            if (wait >= 1.0)
+                ::Sleep(static_cast<DWORD>(wait));
+            else if (wait < -100.0)
+                link_free = Now();
+
+            memcpy(&piece[5], &request[5], 8);
+            if (!SendAll(s, &piece[0], static_cast<int>(piece.size())))
+                break;
+        }
+
+        ::closesocket(s);
+        return 0;
+    }
+
+    unsigned short port_;
+    SOCKET listener_;
+    Thread thread_;
+};
+
+// forward data of one direction after delay milliseconds
+class DelayPipe : private NotCopyable
+{
+public:
+    DelayPipe(SOCKET from, SOCKET to, DWORD delay)
+        : from_(from),
+          to_(to),
+          delay_(delay),
+          reader_(std::tr1::bind(&DelayPipe::ReadLoop, this)),
+          writer_(std::tr1::bind(&DelayPipe::WriteLoop, this))
+    {
+    }
+
+    ~DelayPipe()
+    {
+        reader_.Join();
+        writer_.Join();
+    }
+
+private:
+    struct Chunk
+    {
+        DWORD due;
+        std::vector<char> data;     // empty data is the end of stream
+    };
+
+    unsigned ReadLoop()
+    {
+        std::vector<char> buffer(64 * 1024);
+        for (;;)
+        {
+            int received = ::recv(from_, &buffer[0],
+                    static_cast<int>(buffer.size()), 0);
+
+            Chunk chunk;
+            chunk.due = Now() + delay_;
+            if (received > 0)
+                chunk.data.assign(buffer.begin(), buffer.begin() + received);
+
+            {
+                SpinlocksMutexLocker locker(mutex_);
+                chunks_.push_back(chunk);
+            }
+            event_.SetEvent();
+
+            if (received <= 0)
+                return 0;
+        }
+    }
+
+    unsigned WriteLoop()
+    {
+        for (;;)
+        {
+            Chunk chunk;
+            bool has_chunk = false;
+            {
+                SpinlocksMutexLocker locker(mutex_);
+                if (!chunks_.empty())
+                {
+                    chunk = chunks_.front();
+                    chunks_.pop_front();
+                    has_chunk = true;
+                }
+            }
+
+            if (!has_chunk)
+            {
+                event_.Wait(10);
+                continue;
+            }
+
+            DWORD now = Now();
+            if (static_cast<int>(chunk.due - now) > 0)
+                ::Sleep(chunk.due - now);
+
+            if (chunk.data.empty() ||
+                !SendAll(to_, &chunk.data[0], static_cast<int>(chunk.data.size())))
+            {
+                ::shutdown(to_, SD_SEND);
+                return 0;
+            }
+        }
+    }
+
+    SOCKET from_;
+    SOCKET to_;
+    DWORD delay_;
+    SpinlocksMutex mutex_;
+    AutoResetEvent event_;
+    std::deque<Chunk> chunks_;
+    Thread reader_;
+    Thread writer_;
+};
+
+class DelayProxy : private NotCopyable
+{
+public:
+    DelayProxy(unsigned short server_port, DWORD rtt)
+        : listener_(Listen(&port_)),
+          server_port_(server_port),
+          rtt_(rtt),
+          thread_(std::tr1::bind(&DelayProxy::Run, this))
+    {
+    }
+
+    ~DelayProxy()
+    {
+        thread_.Join();
+        ::closesocket(listener_);
+    }
+
+    unsigned short GetPort() const { return port_; }
+
+private:
+    unsigned Run()
+    {
+        SOCKET client = ::accept(listener_, 0, 0);
+        SOCKET server = Connect(server_port_);
+        {
+            DelayPipe upstream(client, server, rtt_ / 2);
+            DelayPipe downstream(server, client, rtt_ - rtt_ / 2);
+        }
+        ::closesocket(client);
+        ::closesocket(server);
+        return 0;
+    }
+
+    unsigned short port_;
+    SOCKET listener_;
+    unsigned short server_port_;
+    DWORD rtt_;
+    Thread thread_;
+};
+
+// MB/s of the second half of the run
+double RunClient(unsigned short port, bool adaptive, std::size_t *last_depth)
+{
+    SOCKET s = Connect(port);
+    BitRequestPipeline pipeline;
+    std::deque<NormalTimeType> request_times;
+    std::vector<char> piece(piece_header_size + block_size);
+    char request[request_size] = { 0, 0, 0, 13, 6 };
+
+    DWORD begin = Now();
+    DWORD measure_begin = begin + run_millisecond / 2;
+    long long measure_bytes = 0;
+    int index = 0;
+
+    while (Now() - begin < run_millisecond)
+    {
+        std::size_t depth = adaptive ? pipeline.GetDepth() : 3;
+        while (request_times.size() < depth)
+        {
+            int net_index = ::htonl(index++);
+            memcpy(&request[5], &net_index, sizeof(net_index));
+            if (!SendAll(s, request, request_size))
+                break;
+            request_times.push_back(time_traits<NormalTimeType>::now());
+        }
+
+        if (!RecvAll(s, &piece[0], static_cast<int>(piece.size())))
+            break;
+
+        pipeline.BlockArrived(block_size, request_times.front());
+        request_times.pop_front();
+        if (static_cast<int>(Now() - measure_begin) >= 0)
+            measure_bytes += block_size;
+    }
+
+    ::shutdown(s, SD_SEND);
+    while (RecvAll(s, &piece[0], static_cast<int>(piece.size())))
+        ;
+    ::closesocket(s);
+
+    *last_depth = adaptive ? pipeline.GetDepth() : 3;
+    return measure_bytes * 2000.0 / run_millisecond / (1024 * 1024);
+}
+
+double Run(DWORD rtt, bool adaptive, std::size_t *last_depth)
+{
+    PieceServer server;
+    DelayProxy proxy(server.GetPort(), rtt);
+    return RunClient(proxy.GetPort(), adaptive, last_depth);
+}
+
+int main()
+{
+    net::WinSockIniter initer;
+    DWORD rtts[] = { 1, 10, 25, 50, 100, 200 };
+
+    std::cout << "link " << link_rate / (1024 * 1024) << "MB/s, depth bounds "
+        << BitRequestPipeline::GetMinDepth() << "-"
+        << BitRequestPipeline::GetMaxDepth() << std::endl;
+
+    for (std::size_t i = 0; i < sizeof(rtts) / sizeof(rtts[0]); ++i)
+    {
+        std::size_t fixed_depth = 0;
+        std::size_t adaptive_depth = 0;
+        double fixed = Run(rtts[i], false, &fixed_depth);
+        double adaptive = Run(rtts[i], true, &adaptive_depth);
+
+        std::cout << "rtt " << rtts[i] << "ms:\tfixed 3: " << fixed
+            << "MB/s\tadaptive: " << adaptive << "MB/s (depth "
+            << adaptive_depth << ")" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+#include "../protocol/Response.h"
+#include "../protocol/ResponseParser.h"
+#include "../protocol/HttpException.h"
+#include "../net/StreamUnpacker.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+
+// a tracker response of compact peers arrives in receive_size pieces, it
+// is unpacked by the resumable ResponseUnpackRuler, and by the
+// ContentLocator of the unpack ruler before it, which parses the buffered
+// data from the beginning on every piece
+
+const std::size_t receive_size = 2048;
+const int peer_count = 10000;
+const int run_count = 20;
+
+double NowMillisecond()
+{
+    LARGE_INTEGER frequency, counter;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&counter);
+    return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+class Unpacker : public net::StreamUnpacker<http::ResponseUnpackRuler>
+{
+public:
+    std::vector<std::string> packs;
+
+private:
+    virtual void OnUnpackOne(const char *data, std::size_t size)
+    {
+        packs.push_back(std::string(data, size));
+    }
+};
+
+// the ContentLocator unpack ruler before ResponseParser, it knows only
+// Content-Length, it is the baseline of the benchmark
+namespace old {
+
+    // an exception class of construct StatusLine
+    class InvalidateStatusLine {};
+
+    class StatusLine
+    {
+    public:
+        StatusLine(const char *begin, const char *end)
+            : status_line_data_len_(0),
+              status_code_(0),
+              http_version_(0),
+              reason_phrase_()
+        {
+            ParseData(begin, end);
+        }
+
+        int GetStatusLineLength() const
+        {
+            return status_line_data_len_;
+        }
+
+        int GetStatusCode() const
+        {
+            return status_code_;
+        }
+
+        int GetStatusCodeType() const
+        {
+            return status_code_ / 100;
+        }
+
+        double GetHttpVersion() const
+        {
+            return http_version_;
+        }
+
+        std::string GetReasonPhrase() const
+        {
+            return reason_phrase_;
+        }
+
+    private:
+        void ParseData(const char *begin, const char *end)
+        {
+            assert(begin && end);
+            const char *pp = begin;
+            const char *ptr = begin;
+            PointerTo(ptr, end, ' ');
+
+            ParseHttpVersion(pp, ptr);
+
+            pp = ++ptr;
+            PointerTo(ptr, end, ' ');
+
+            ParseStatusCode(pp, ptr);
+
+            pp = ++ptr;
+            PointerTo(ptr, end, '\r');
+
+            ParseReasonPhrase(pp, ptr);
+
+            if (++ptr == end || *ptr++ != '\n')
+                throw InvalidateStatusLine();
+
+            status_line_data_len_ = ptr - begin;
+        }
+
+        void PointerTo(const char *&ptr, const char *end, char c)
+        {
+            for (; ptr != end && *ptr != c; ++ptr);
+            if (ptr == end)
+                throw InvalidateStatusLine();
+        }
+
+        void ParseHttpVersion(const char *begin, const char *end)
+        {
+            const char http[] = "HTTP/";
+            const char *result = std::search(begin, end, http, http + sizeof(http) - 1);
+            if (result == end)
+                throw InvalidateStatusLine();
+
+            http_version_ = atof(std::string(result + sizeof(http) - 1, end).c_str());
+        }
+
+        void ParseStatusCode(const char *begin, const char *end)
+        {
+            status_code_ = atoi(std::string(begin, end).c_str());
+        }
+
+        void ParseReasonPhrase(const char *begin, const char *end)
+        {
+            reason_phrase_.assign(begin, end);
+        }
+
+        int status_line_data_len_;
+        int status_code_;
+        double http_version_;
+        std::string reason_phrase_;
+    };
+
+    // an exception class of ContentLocator
+    class CanNotLocateContent {};
+
+    class ContentLocator
+    {
+    public:
+        ContentLocator(const char *stream, std::size_t size)
+            : content_begin_pos_(0),
+              content_length_(0),
+              response_length_(0)
+        {
+            ParseContent(stream, size);
+        }
+
+        const char * GetContentBeginPos() const
+        {
+            return content_begin_pos_;
+        }
+
+        std::size_t GetContentLength() const
+        {
+            return content_length_;
+        }
+
+        std::size_t GetResponseLength() const
+        {
+            return response_length_;
+        }
+
+    private:
+        void ParseContent(const char *stream, std::size_t size)
+        {
+            assert(stream && size > 0);
+            StatusLine status_line(stream, stream + size);
+            std::size_t status_line_len = status_line.GetStatusLineLength();
+            if (size - status_line_len <= 0)
+                throw CanNotLocateContent();
+
+            const char CRLF[] = "\r\n";
+            const char d_CRLF[] = "\r\n\r\n";
+            const char content_len[] = "Content-Length";
+
+            // from StatusLine's \r\n to end
+            const char *begin = stream + status_line_len - (sizeof(CRLF) - 1);
+            const char *end = stream + size;
+
+            const char *head_end_pos = std::search(begin, end, d_CRLF, d_CRLF + sizeof(d_CRLF) - 1);
+            if (head_end_pos == end)
+                throw CanNotLocateContent();
+
+            const char *content_len_pos = std::search(begin, end, content_len, content_len + sizeof(content_len) - 1);
+            if (content_len_pos != end)
+            {
+                const char *len_begin = std::find(content_len_pos, end, ':') + 1;
+                const char *len_end = std::search(len_begin, end, CRLF, CRLF + sizeof(CRLF) - 1);
+                content_length_ = atoi(std::string(len_begin, len_end).c_str());
+            }
+
+            response_length_ = status_line_len + (head_end_pos - begin) + content_length_ + sizeof(d_CRLF) - sizeof(CRLF);
+            if (response_length_ > size)
+                throw CanNotLocateContent();
+
+            content_begin_pos_ = stream + response_length_ - content_length_;
+        }
+
+        const char *content_begin_pos_;
+        std::size_t content_length_;
+        std::size_t response_length_;
+    };
+
+    class ResponseUnpackRuler
+    {
+    public:
+        static bool CanUnpack(const char *stream,
+                std::size_t size, std::size_t *pack_len)
+        {
+            try
+            {
+                ContentLocator checker(stream, size);
+                *pack_len = checker.GetResponseLength();
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+    };
+
+    class Unpacker : public net::StreamUnpacker<ResponseUnpackRuler>
+    {
+    public:
+        std::vector<std::string> packs;
+
+    private:
+        virtual void OnUnpackOne(const char *data, std::size_t size)
+        {
+            packs.push_back(std::string(data, size));
+        }
+    };
+
+} // namespace old
+
+std::string Content(const std::string& response)
+{
+    http::Response r(response.data(), response.size());
+    return std::string(r.GetContentBufPointer() ? r.GetContentBufPointer() : "",
+            r.GetContentSize());
+}
+
+std::string MakeTrackerResponse(bool chunked)
+{
+    std::string content = "d8:intervali1800e5:peers";
+    char length[16];
+    sprintf(length, "%d:", peer_count * 6);
+    content += length;
+    for (int i = 0; i < peer_count * 6; ++i)
+        content.push_back(static_cast<char>(i));
+    content += "e";
+
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+    if (!chunked)
+    {
+        sprintf(length, "%u", static_cast<unsigned>(content.size()));
+        return response + "Content-Length: " + length + "\r\n\r\n" + content;
+    }
+
+    response += "Transfer-Encoding: chunked\r\n\r\n";
+    for (std::size_t i = 0; i < content.size(); i += 1000)
+    {
+        std::string chunk = content.substr(i, 1000);
+        sprintf(length, "%x", static_cast<unsigned>(chunk.size()));
+        response += std::string(length) + "\r\n" + chunk + "\r\n";
+    }
+    return response + "0\r\n\r\n";
+}
+
+TEST_CASE(parser)
+{
+    // every split point of a chunked response with mixed case headers
+    const char chunked[] =
+        "HTTP/1.1 200 OK\r\n"
+        "transfer-ENCODING: Chunked\r\n"
+        "CONNECTION: Keep-Alive\r\n"
+        "\r\n"
+        "5;ext=1\r\nhello\r\n"
+        "6\r\n world\r\n"
+        "0\r\n"
+        "X-Trailer: 1\r\n"
+        "\r\n";
+    std::size_t size = sizeof(chunked) - 1;
+    for (std::size_t split = 0; split <= size; ++split)
+    {
+        http::ResponseParser parser;
+        std::size_t used = parser.Parse(chunked, split);
+        CHECK_TRUE(used == split);
+        CHECK_TRUE(!parser.IsError());
+        CHECK_TRUE(parser.IsComplete() == (split == size));
+        used = parser.Parse(chunked + split, size - split);
+        CHECK_TRUE(used == size - split);
+        CHECK_TRUE(parser.IsComplete());
+        CHECK_TRUE(parser.GetParsedLength() == size);
+        CHECK_TRUE(std::string(&parser.GetContent()[0], parser.GetContent().size()) ==
+                "hello world");
+        CHECK_TRUE(parser.GetHeader("Transfer-Encoding") == "Chunked");
+        CHECK_TRUE(parser.IsKeepAlive());
+    }
+
+    // one byte at a time, data after the response is not parsed
+    const char length[] =
+        "HTTP/1.0 200 OK\r\nContent-Length: 3\r\n\r\nabcHTTP/1.1";
+    http::ResponseParser parser;
+    std::size_t parsed = 0;
+    for (std::size_t i = 0; i < sizeof(length) - 1; ++i)
+        parsed += parser.Parse(length + i, 1);
+    CHECK_TRUE(parser.IsComplete());
+    CHECK_TRUE(parsed == sizeof(length) - 1 - 8);
+    CHECK_TRUE(parser.GetStatusCode() == 200);
+    CHECK_TRUE(!parser.IsKeepAlive());
+
+    // interim response, no content response and invalid responses
+    const char interim[] =
+        "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 204 No Content\r\n\r\n";
+    parser.Reset();
+    CHECK_TRUE(parser.Parse(interim, sizeof(interim) - 1) == sizeof(interim) - 1);
+    CHECK_TRUE(parser.IsComplete() && parser.GetStatusCode() == 204);
+
+    const char *invalid[] = {
+        "ICY 200 OK\r\n\r\n",
+        "HTTP/1.1 abc\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nno colon\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: x\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nab\r\n",
+    };
+    for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        parser.Reset();
+        parser.Parse(invalid[i], strlen(invalid[i]));
+        CHECK_TRUE(parser.IsError());
+    }
+
+    // a too long header line
+    parser.Reset();
+    std::string long_line = "HTTP/1.1 200 OK\r\nX: " +
+        std::string(http::ResponseParser::max_line_length, 'x');
+    parser.Parse(long_line.data(), long_line.size());
+    CHECK_TRUE(parser.IsError());
+}
+
+TEST_CASE(unpacker)
+{
+    // pipelined responses in pieces of every size, then an invalid one
+    std::string first = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfirst";
+    std::string second = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "6\r\nsecond\r\n0\r\n\r\n";
+    std::string stream = first + second;
+    for (std::size_t piece = 1; piece <= stream.size(); ++piece)
+    {
+        Unpacker unpacker;
+        for (std::size_t i = 0; i < stream.size(); i += piece)
+            unpacker.StreamDataArrive(stream.data() + i,
+                    std::min(piece, stream.size() - i));
+        CHECK_TRUE(unpacker.packs.size() == 2);
+        CHECK_TRUE(unpacker.packs[0] == first);
+        CHECK_TRUE(unpacker.packs[1] == second);
+        CHECK_TRUE(Content(unpacker.packs[0]) == "first");
+        CHECK_TRUE(Content(unpacker.packs[1]) == "second");
+    }
+
+    const char garbage[] = "garbage\r\n";
+    Unpacker unpacker;
+    unpacker.StreamDataArrive(garbage, sizeof(garbage) - 1);
+    CHECK_TRUE(unpacker.packs.size() == 1);
+    bool thrown = false;
+    try
+    {
+        http::Response(unpacker.packs[0].data(), unpacker.packs[0].size());
+    }
+    catch (const http::ResponseException&)
+    {
+        thrown = true;
+    }
+    CHECK_TRUE(thrown);
+}
+
+TEST_CASE(content_to_end)
+{
+    // no Content-Length and not chunked, content is to the close of the
+    // connection
+    const char response[] =
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n"
+        "d8:intervali900e5:peers0:e";
+    std::size_t size = sizeof(response) - 1;
+    http::ResponseParser parser;
+    CHECK_TRUE(parser.Parse(response, 20) == 20);
+    CHECK_TRUE(parser.Parse(response + 20, size - 20) == size - 20);
+    CHECK_TRUE(!parser.IsComplete() && !parser.IsError());
+    parser.EndOfStream();
+    CHECK_TRUE(parser.IsComplete());
+    CHECK_TRUE(std::string(&parser.GetContent()[0], parser.GetContent().size()) ==
+            "d8:intervali900e5:peers0:e");
+    CHECK_TRUE(!parser.IsKeepAlive());
+
+    // the stream ends in the middle of a response of Content-Length
+    const char truncated[] = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc";
+    parser.Reset();
+    parser.Parse(truncated, sizeof(truncated) - 1);
+    parser.EndOfStream();
+    CHECK_TRUE(parser.IsError());
+
+    // the unpacker gives the response at the end of the stream
+    Unpacker unpacker;
+    for (std::size_t i = 0; i < size; i += 7)
+        unpacker.StreamDataArrive(response + i, std::min<std::size_t>(7, size - i));
+    CHECK_TRUE(unpacker.packs.empty());
+    unpacker.StreamEnd();
+    CHECK_TRUE(unpacker.packs.size() == 1);
+    CHECK_TRUE(Content(unpacker.packs[0]) == "d8:intervali900e5:peers0:e");
+
+    Unpacker truncated_unpacker;
+    truncated_unpacker.StreamDataArrive(truncated, sizeof(truncated) - 1);
+    truncated_unpacker.StreamEnd();
+    CHECK_TRUE(truncated_unpacker.packs.empty());
+}
+
+template<typename UnpackerType>
+double UnpackTime(const std::string& response, std::size_t *packs)
+{
+    double begin = NowMillisecond();
+    for (int run = 0; run < run_count; ++run)
+    {
+        UnpackerType unpacker;
+        for (std::size_t i = 0; i < response.size(); i += receive_size)
+            unpacker.StreamDataArrive(response.data() + i,
+                    std::min(receive_size, response.size() - i));
+        *packs = unpacker.packs.size();
+    }
+    return (NowMillisecond() - begin) / run_count;
+}
+
+TEST_CASE(benchmark)
+{
+    // the ContentLocator knows no chunked response, it is compared with
+    // the response of Content-Length
+    std::string response = MakeTrackerResponse(false);
+    std::size_t packs = 0;
+    double resumable = UnpackTime<Unpacker>(response, &packs);
+    CHECK_TRUE(packs == 1);
+    double locator = UnpackTime<old::Unpacker>(response, &packs);
+    CHECK_TRUE(packs == 1);
+
+    std::string chunked = MakeTrackerResponse(true);
+    double resumable_chunked = UnpackTime<Unpacker>(chunked, &packs);
+    CHECK_TRUE(packs == 1);
+
+    std::cout << "content-length response of " << response.size() << " bytes in "
+              << receive_size << " bytes pieces: resumable " << resumable
+              << "ms, content locator " << locator << "ms" << std::endl;
+    std::cout << "chunked response of " << chunked.size() << " bytes: resumable "
+              << resumable_chunked << "ms" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "../core/BitTokenBucket.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // 10 Gbit/s aggregate: a global limit of 1250MB/s over 8 tasks of 200MB/s
+    // and 64 peers of each task, 16KB blocks are consumed as fast as possible
+    // round robin, the transferred bytes are compared with the limit
+
+    const long long global_rate = 10LL * 1000 * 1000 * 1000 / 8;
+    const long long task_rate = 200LL * 1000 * 1000;
+    const int task_count = 8;
+    const int peers_per_task = 64;
+    const int block_size = 16 * 1024;
+    const DWORD run_millisecond = 3000;
+
+    double NowMillisecond()
+    {
+        LARGE_INTEGER frequency, counter;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    struct Result
+    {
+        double rate;            // bytes per second transferred
+        double consume_ns;      // nanoseconds per Consume call
+    };
+
+    Result Run(long long global, long long task, long long peer)
+    {
+        BitTokenBucket global_bucket;
+        global_bucket.SetRate(global);
+
+        std::vector<BitTokenBucket *> tasks;
+        std::vector<BitTokenBucket *> peers;
+        for (int i = 0; i < task_count; ++i)
+        {
+            tasks.push_back(new BitTokenBucket(&global_bucket));
+            tasks.back()->SetRate(task);
+            for (int j = 0; j < peers_per_task; ++j)
+            {
+                peers.push_back(new BitTokenBucket(tasks.back()));
+                peers.back()->SetRate(peer);
+            }
+        }
+
+        // the buckets start full, skip the first burst
+        double begin = NowMillisecond();
+        while (NowMillisecond() - begin < 1000.0)
+        {
+            for (std::size_t i = 0; i < peers.size(); ++i)
+                peers[i]->Consume(block_size);
+        }
+
+        long long bytes = 0;
+        long long calls = 0;
+        begin = NowMillisecond();
+        double elapsed = 0.0;
+        while ((elapsed = NowMillisecond() - begin) < run_millisecond)
+        {
+            for (std::size_t i = 0; i < peers.size(); ++i, ++calls)
+            {
+                if (peers[i]->Consume(block_size))
+                    bytes += block_size;
+            }
+        }
+
+        for (std::size_t i = 0; i < peers.size(); ++i)
+            delete peers[i];
+        for (std::size_t i = 0; i < tasks.size(); ++i)
+            delete tasks[i];
+
+        Result result;
+        result.rate = bytes * 1000.0 / elapsed;
+        result.consume_ns = elapsed * 1000000.0 / calls;
+        return result;
+    }
+
+    // the rate is within 2% of the expected one
+    bool Report(const char *name, long long expect, const Result& result)
+    {
+        double error = (result.rate - expect) * 100.0 / expect;
+        std::cout << name << ": expect " << expect / 1000000 << "MB/s, got "
+            << result.rate / 1000000 << "MB/s, error " << error << "%, "
+            << result.consume_ns << "ns per consume" << std::endl;
+        return fabs(error) < 2.0;
+    }
+
+} // unnamed namespace
+
+// a peer limited by its own bucket under an unlimited task, the tokens
+// of a request which is gone without data are given back
+TEST_CASE(refund)
+{
+    BitTokenBucket task_bucket;
+    BitTokenBucket peer_bucket(&task_bucket);
+    peer_bucket.SetRate(1, block_size);
+    CHECK_TRUE(!task_bucket.IsLimited());
+    CHECK_TRUE(peer_bucket.IsLimited());
+
+    // the full burst and one block of debt
+    CHECK_TRUE(peer_bucket.Consume(2 * block_size));
+    CHECK_TRUE(!peer_bucket.Consume(block_size));
+
+    peer_bucket.Refund(2 * block_size);
+    CHECK_TRUE(peer_bucket.Consume(block_size));
+
+    // refunds never save more than the burst
+    peer_bucket.Refund(10 * block_size);
+    CHECK_TRUE(peer_bucket.Consume(2 * block_size));
+    CHECK_TRUE(!peer_bucket.Consume(block_size));
+}
+
+// global is the bottleneck
+TEST_CASE(global_limit)
+{
+    CHECK_TRUE(Report("global limit", global_rate,
+                Run(global_rate, task_rate, 0)));
+}
+
+// tasks are the bottleneck
+TEST_CASE(task_limit)
+{
+    CHECK_TRUE(Report("task limit", task_count * task_rate / 2,
+                Run(global_rate, task_rate / 2, 0)));
+}
+
+// peers are the bottleneck
+TEST_CASE(peer_limit)
+{
+    long long peer_rate = 1000 * 1000;
+    CHECK_TRUE(Report("peer limit", task_count * peers_per_task * peer_rate,
+                Run(global_rate, task_rate, peer_rate)));
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "../core/BitData.h"
+#include "../core/BitRecheck.h"
+#include "../core/BitHashPool.h"
+#include "../core/BitTorrentMaker.h"
+#include "../base/StringConv.h"
+#include <Windows.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+// make a torrent of a large directory and report the hash throughput,
+// then the made torrent is rechecked against the same files, all pieces
+// should be ok
+
+const char torrent_file[] = "TestTorrentMaker.torrent";
+
+int main(int argc, const char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "TestTorrentMaker path [piece_length_KB]" << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        std::string path = ANSIToUTF8(argv[1]);
+        BitHashPool hash_pool;
+
+        {
+            BitTorrentMaker maker(path, hash_pool);
+            if (argc > 2)
+                maker.SetPieceLength(atoi(argv[2]) * 1024);
+
+            std::vector<std::vector<std::string> > tiers(1,
+                    std::vector<std::string>(1, "http://tracker.sample.com/announce"));
+            maker.SetAnnounceTiers(tiers);
+
+            maker.Start();
+            while (!maker.IsComplete())
+            {
+                ::Sleep(1000);
+                std::cout << "hashed: " << maker.GetHashedCount() << "/"
+                    << maker.GetPieceCount() << " "
+                    << maker.GetThroughput() << "GB/s" << std::endl;
+            }
+
+            maker.SaveTorrentFile(torrent_file);
+            std::cout << "hash threads: " << hash_pool.GetThreadCount() << std::endl;
+            std::cout << "total length: " << maker.GetTotalLength() << " bytes, "
+                << maker.GetPieceCount() << " pieces of "
+                << maker.GetPieceLength() << " bytes" << std::endl;
+            std::cout << "make torrent: " << maker.GetThroughput() << "GB/s" << std::endl;
+        }
+
+        // files of the torrent are in the parent directory of path
+        std::string base_path;
+        std::string::size_type slash = path.find_last_of('\\');
+        if (slash != std::string::npos)
+            base_path = path.substr(0, slash);
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        bitdata->SetBasePath(base_path);
+        bitdata->SelectAllFile(true);
+
+        BitRecheck recheck(bitdata, hash_pool);
+        recheck.Start();
+        std::size_t ok_count = 0;
+        BitRecheck::PieceIndexList pieces;
+        while (!recheck.IsComplete())
+        {
+            ::Sleep(100);
+            recheck.GetCheckedPieces(pieces);
+            ok_count += pieces.size();
+            pieces.clear();
+        }
+        recheck.GetCheckedPieces(pieces);
+        ok_count += pieces.size();
+
+        std::cout << "recheck pieces ok: " << ok_count << "/"
+            << recheck.GetPieceCount() << std::endl;
+    }
+    catch (const BaseException& be)
+    {
+        std::cout << be.what() << std::endl;
+    }
+
+    return 0;
+}
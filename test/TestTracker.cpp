@@ -1,6 +1,7 @@
 #include "../core/BitCreator.h"
 #include "../core/BitController.h"
 #include "../core/BitData.h"
+#include "../core/BitHttpTracker.h"
 #include "../core/BitPeerData.h"
 #include "../core/BitRepository.h"
 #include "../core/BitTask.h"
@@ -48,11 +49,13 @@ int main(int argc, char **argv)
     BitRepository repository;
     BitController bit_controller;
     BitNewTaskCreator bit_creator(bit_controller, io_service);
+    BitHttpTracker http_tracker(io_service);
 
     BitService::io_service = &io_service;
     BitService::repository = &repository;
     BitService::controller = &bit_controller;
     BitService::new_task_creator = &bit_creator;
+    BitService::http_tracker = &http_tracker;
 
     repository.SetListenPort(6881);
 
@@ -0,0 +1,178 @@
+#include "../core/BitTrackerTiers.h"
+#include "../protocol/URI.h"
+#include "../unittest/UnitTest.h"
+#include <algorithm>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    BitTrackerTiers::Tiers MakeTiers()
+    {
+        // tier 0: a0 a1 a2, tier 1: b0 b1, tier 2: c0
+        BitTrackerTiers::Tiers tiers(3);
+        tiers[0].push_back("http://a0/announce");
+        tiers[0].push_back("http://a1/announce");
+        tiers[0].push_back("http://a2/announce");
+        tiers[1].push_back("http://b0/announce");
+        tiers[1].push_back("http://b1/announce");
+        tiers[2].push_back("udp://c0:6969/announce");
+        return tiers;
+    }
+
+    std::vector<std::string> Announces(BitTrackerTiers& tiers, NormalTimeType now)
+    {
+        std::vector<std::string> urls;
+        tiers.GetAnnounces(now, &urls);
+        return urls;
+    }
+
+} // unnamed namespace
+
+TEST_CASE(shuffle_and_dedupe)
+{
+    BitTrackerTiers::Tiers source = MakeTiers();
+    source[1].push_back("http://a0/announce");
+    source.push_back(std::vector<std::string>());
+
+    BitTrackerTiers tiers(source);
+    BitTrackerTiers::Tiers result;
+    tiers.GetTiers(&result);
+
+    // duplicated url and empty tier are removed, urls stay in their tier
+    CHECK_TRUE(result.size() == 3);
+    CHECK_TRUE(result[1].size() == 2);
+    std::sort(result[0].begin(), result[0].end());
+    CHECK_TRUE(result[0] == MakeTiers()[0]);
+}
+
+TEST_CASE(failover_in_order)
+{
+    BitTrackerTiers tiers(MakeTiers());
+    BitTrackerTiers::Tiers order;
+    tiers.GetTiers(&order);
+
+    // every tracker fails, they are tried one by one, tier by tier
+    std::vector<std::string> tried;
+    for (int i = 0; i < 6; ++i)
+    {
+        std::vector<std::string> urls = Announces(tiers, 0);
+        CHECK_TRUE(urls.size() == 1);
+        // one announce at a time
+        CHECK_TRUE(Announces(tiers, 0).empty());
+        tried.push_back(urls[0]);
+        tiers.OnAnnounced(urls[0], false, 0, 0);
+    }
+
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < order.size(); ++i)
+        expected.insert(expected.end(), order[i].begin(), order[i].end());
+    CHECK_TRUE(tried == expected);
+
+    // all trackers are in backoff
+    CHECK_TRUE(Announces(tiers, 1000).empty());
+    CHECK_TRUE(Announces(tiers, BitTrackerTiers::retry_backoff).size() == 1);
+}
+
+TEST_CASE(promote)
+{
+    BitTrackerTiers tiers(MakeTiers());
+    BitTrackerTiers::Tiers order;
+    tiers.GetTiers(&order);
+
+    std::vector<std::string> urls = Announces(tiers, 0);
+    tiers.OnAnnounced(urls[0], false, 0, 0);
+    urls = Announces(tiers, 0);
+    CHECK_TRUE(urls[0] == order[0][1]);
+    tiers.OnAnnounced(urls[0], true, 1800, 0);
+
+    // the tracker answers is the first of its tier
+    BitTrackerTiers::Tiers result;
+    tiers.GetTiers(&result);
+    CHECK_TRUE(result[0][0] == order[0][1]);
+    CHECK_TRUE(result[0][1] == order[0][0]);
+
+    // the next announce is after the interval, to the promoted tracker
+    CHECK_TRUE(Announces(tiers, 1800 * 1000 - 1).empty());
+    urls = Announces(tiers, 1800 * 1000);
+    CHECK_TRUE(urls.size() == 1 && urls[0] == order[0][1]);
+
+    // interval is not less than min_interval
+    tiers.OnAnnounced(urls[0], true, 1, 1800 * 1000);
+    CHECK_TRUE(Announces(tiers, 1800 * 1000 + 1000).empty());
+
+    // announce now, such as the task is completed
+    tiers.AnnounceNow();
+    CHECK_TRUE(Announces(tiers, 1800 * 1000 + 1000).size() == 1);
+}
+
+TEST_CASE(backoff)
+{
+    BitTrackerTiers::Tiers source(1);
+    source[0].push_back("http://a0/announce");
+    BitTrackerTiers tiers(source);
+
+    NormalTimeType now = 0;
+    NormalTimeType backoff = BitTrackerTiers::retry_backoff;
+    for (int i = 0; i < 12; ++i)
+    {
+        std::vector<std::string> urls = Announces(tiers, now);
+        CHECK_TRUE(urls.size() == 1);
+        tiers.OnAnnounced(urls[0], false, 0, now);
+
+        CHECK_TRUE(Announces(tiers, now + backoff - 1).empty());
+        now += backoff;
+        backoff = std::min(backoff * 2, BitTrackerTiers::max_backoff);
+    }
+
+    // the time wraps around
+    now = static_cast<NormalTimeType>(-1000);
+    std::vector<std::string> urls = Announces(tiers, now);
+    CHECK_TRUE(urls.size() == 1);
+    tiers.OnAnnounced(urls[0], true, 60, now);
+    CHECK_TRUE(Announces(tiers, now + 59 * 1000).empty());
+    CHECK_TRUE(Announces(tiers, now + 60 * 1000).size() == 1);
+}
+
+TEST_CASE(all_tiers)
+{
+    BitTrackerTiers::Tiers source;
+    for (int i = 0; i < 6; ++i)
+    {
+        source.push_back(std::vector<std::string>());
+        source.back().push_back(std::string("http://t") +
+                static_cast<char>('0' + i) + "/announce");
+    }
+
+    BitTrackerTiers tiers(source);
+    tiers.SetAnnounceToAllTiers(true);
+    CHECK_TRUE(tiers.IsAnnounceToAllTiers());
+
+    // at most max_parallel tiers announce at the same time
+    std::vector<std::string> urls = Announces(tiers, 0);
+    CHECK_TRUE(urls.size() == BitTrackerTiers::max_parallel);
+    CHECK_TRUE(Announces(tiers, 0).empty());
+
+    tiers.OnAnnounced(urls[0], true, 1800, 0);
+    std::vector<std::string> next = Announces(tiers, 0);
+    CHECK_TRUE(next.size() == 1 && next[0] == source[4][0]);
+}
+
+TEST_CASE(tracker_url_port)
+{
+    // trackers are connected on the port of their urls
+    http::URI uri("udp://tracker.sample.com:6969/announce");
+    CHECK_TRUE(uri.GetHost() == "tracker.sample.com");
+    CHECK_TRUE(uri.GetPort() == "6969");
+    CHECK_TRUE(uri.GetQueryString() == "/announce");
+
+    http::URI no_port("http://www.sample.com/announce");
+    CHECK_TRUE(no_port.GetPort().empty());
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include "../core/BitUdpSocket.h"
+#include "../core/BitUdpTracker.h"
+#include "../net/IoService.h"
+#include "../net/TimerService.h"
+#include "../net/WinSockIniter.h"
+#include "../sha1/NetSha1Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <string.h>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+const unsigned long loopback = 0x7F000001;
+const unsigned long long fake_connection_id = 0x0123456789ABCDEFULL;
+
+unsigned long ReadInt32(const char *data)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    return (static_cast<unsigned long>(p[0]) << 24) |
+        (static_cast<unsigned long>(p[1]) << 16) |
+        (static_cast<unsigned long>(p[2]) << 8) | p[3];
+}
+
+void AppendInt32(std::string& buf, unsigned long value)
+{
+    buf.push_back(static_cast<char>(value >> 24));
+    buf.push_back(static_cast<char>(value >> 16));
+    buf.push_back(static_cast<char>(value >> 8));
+    buf.push_back(static_cast<char>(value));
+}
+
+// a local udp tracker stand-in, it answers every announce with one peer
+// of which ip is the first 4 bytes of the info hash
+class FakeTracker : public BitUdpSocket::Receiver
+{
+public:
+    explicit FakeTracker(BitUdpSocket *socket)
+        : connect_count(0),
+          announce_count(0),
+          drop_count(0),
+          socket_(socket)
+    {
+        socket_->AddReceiver(this);
+    }
+
+    ~FakeTracker()
+    {
+        socket_->RemoveReceiver(this);
+    }
+
+    virtual bool OnDatagram(const char *data, std::size_t len,
+                            unsigned long ip, unsigned short port)
+    {
+        if (drop_count > 0)
+        {
+            --drop_count;
+            return true;
+        }
+
+        std::string reply;
+        if (len == 16 && ReadInt32(data + 8) == UdpTrackerResponse::CONNECT)
+        {
+            ++connect_count;
+            AppendInt32(reply, UdpTrackerResponse::CONNECT);
+            reply.append(data + 12, 4);
+            AppendInt32(reply, static_cast<unsigned long>(fake_connection_id >> 32));
+            AppendInt32(reply, static_cast<unsigned long>(fake_connection_id));
+        }
+        else if (len == 98 && ReadInt32(data + 8) == UdpTrackerResponse::ANNOUNCE)
+        {
+            ++announce_count;
+            bool valid = ReadInt32(data) == (fake_connection_id >> 32) &&
+                ReadInt32(data + 4) == (fake_connection_id & 0xFFFFFFFF);
+            // info hash of 0 bytes is not on the tracker
+            bool known = data[16] != 0;
+            if (valid && known)
+            {
+                AppendInt32(reply, UdpTrackerResponse::ANNOUNCE);
+                reply.append(data + 12, 4);
+                AppendInt32(reply, 1800);
+                AppendInt32(reply, 1);
+                AppendInt32(reply, 2);
+                reply.append(data + 16, 4);
+                reply.append(data + 96, 2);
+            }
+            else
+            {
+                AppendInt32(reply, UdpTrackerResponse::ERROR_ACTION);
+                reply.append(data + 12, 4);
+                reply += valid ? "torrent not found" : "bad connection id";
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        socket_->SendTo(reply.data(), reply.size(), ip, port);
+        return true;
+    }
+
+    int connect_count;
+    int announce_count;
+    // datagrams to drop
+    int drop_count;
+
+private:
+    BitUdpSocket *socket_;
+};
+
+struct AnnounceResult
+{
+    AnnounceResult()
+        : done(false),
+          success(false)
+    {
+    }
+
+    bool done;
+    bool success;
+    UdpTrackerResponse response;
+};
+
+void OnAnnounce(AnnounceResult *result, bool success,
+                const UdpTrackerResponse& response)
+{
+    result->done = true;
+    result->success = success;
+    result->response = response;
+}
+
+int done_count = 0;
+int success_count = 0;
+
+void CountAnnounce(bool success, const UdpTrackerResponse& response)
+{
+    if (success && response.peers.size() == 1)
+        ++success_count;
+    ++done_count;
+}
+
+void RunUntil(net::IoService& io_service, const bool *done, DWORD max_millisecond)
+{
+    DWORD begin = ::GetTickCount();
+    while (!*done && ::GetTickCount() - begin < max_millisecond)
+    {
+        io_service.Run();
+        ::Sleep(1);
+    }
+}
+
+UdpAnnounceRequest MakeRequest(unsigned long first_word, unsigned short port)
+{
+    char bytes[20] = { 0 };
+    bytes[0] = static_cast<char>(first_word >> 24);
+    bytes[1] = static_cast<char>(first_word >> 16);
+    bytes[2] = static_cast<char>(first_word >> 8);
+    bytes[3] = static_cast<char>(first_word);
+
+    UdpAnnounceRequest request;
+    request.info_hash = NetStreamToSha1Value(bytes);
+    request.peer_id = "-BW0001-000000000000";
+    request.left = 100;
+    request.event = UdpAnnounceRequest::STARTED;
+    request.port = port;
+    return request;
+}
+
+TEST_CASE(protocol)
+{
+    std::string connect = EncodeUdpConnectRequest(0x11223344);
+    CHECK_TRUE(connect.size() == 16);
+    CHECK_TRUE(ReadInt32(connect.data()) == 0x417);
+    CHECK_TRUE(ReadInt32(connect.data() + 4) == 0x27101980);
+    CHECK_TRUE(ReadInt32(connect.data() + 12) == 0x11223344);
+
+    UdpAnnounceRequest request = MakeRequest(0x0A000001, 6881);
+    std::string announce = EncodeUdpAnnounceRequest(fake_connection_id, 7, request);
+    CHECK_TRUE(announce.size() == 98);
+    CHECK_TRUE(ReadInt32(announce.data() + 8) == UdpTrackerResponse::ANNOUNCE);
+    CHECK_TRUE(ReadInt32(announce.data() + 16) == 0x0A000001);
+    CHECK_TRUE(memcmp(announce.data() + 36, request.peer_id.data(), 20) == 0);
+    CHECK_TRUE(ReadInt32(announce.data() + 80) == UdpAnnounceRequest::STARTED);
+    CHECK_TRUE(ReadInt32(announce.data() + 92) == 0xFFFFFFFF);
+
+    std::string reply;
+    AppendInt32(reply, UdpTrackerResponse::ANNOUNCE);
+    AppendInt32(reply, 7);
+    AppendInt32(reply, 900);
+    AppendInt32(reply, 3);
+    AppendInt32(reply, 4);
+    reply.append("\x7F\x00\x00\x01\x1A\xE1", 6);
+
+    UdpTrackerResponse response;
+    CHECK_TRUE(ParseUdpTrackerResponse(reply.data(), reply.size(), &response));
+    CHECK_TRUE(response.action == UdpTrackerResponse::ANNOUNCE);
+    CHECK_TRUE(response.transaction == 7 && response.interval == 900);
+    CHECK_TRUE(response.leechers == 3 && response.seeders == 4);
+    CHECK_TRUE(response.peers.size() == 1);
+    CHECK_TRUE(response.peers[0] == UdpEndpoint(loopback, 6881));
+
+    CHECK_TRUE(!ParseUdpTrackerResponse(reply.data(), 7, &response));
+}
+
+TEST_CASE(announce)
+{
+    net::WinSockIniter sock_initer;
+    net::IoService io_service;
+    net::TimerService timer_service;
+    io_service.AddService(&timer_service);
+
+    BitUdpSocket tracker_socket(io_service, 0);
+    BitUdpSocket client_socket(io_service, 0);
+    FakeTracker fake_tracker(&tracker_socket);
+    // retransmit after 200ms in test
+    BitUdpTracker client(io_service, &client_socket, 200);
+    UdpEndpoint tracker(loopback, tracker_socket.GetLocalPort());
+
+    // the first announce connects
+    AnnounceResult first;
+    client.Announce(tracker, MakeRequest(0x0A000001, 6881),
+            std::tr1::bind(OnAnnounce, &first,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    RunUntil(io_service, &first.done, 5000);
+    CHECK_TRUE(first.success);
+    CHECK_TRUE(first.response.interval == 1800);
+    CHECK_TRUE(first.response.peers.size() == 1);
+    CHECK_TRUE(first.response.peers[0] == UdpEndpoint(0x0A000001, 6881));
+    CHECK_TRUE(fake_tracker.connect_count == 1);
+
+    // the connection id is cached
+    AnnounceResult second;
+    client.Announce(tracker, MakeRequest(0x0A000002, 6882),
+            std::tr1::bind(OnAnnounce, &second,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    RunUntil(io_service, &second.done, 5000);
+    CHECK_TRUE(second.success);
+    CHECK_TRUE(fake_tracker.connect_count == 1);
+
+    // lost datagrams are sent again
+    fake_tracker.drop_count = 2;
+    AnnounceResult retransmit;
+    client.Announce(tracker, MakeRequest(0x0A000003, 6883),
+            std::tr1::bind(OnAnnounce, &retransmit,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    RunUntil(io_service, &retransmit.done, 10000);
+    CHECK_TRUE(retransmit.success);
+
+    // an error of the tracker fails the announce
+    AnnounceResult error;
+    client.Announce(tracker, MakeRequest(0, 6884),
+            std::tr1::bind(OnAnnounce, &error,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2));
+    RunUntil(io_service, &error.done, 5000);
+    CHECK_TRUE(!error.success);
+    CHECK_TRUE(error.response.error == "torrent not found");
+
+    // announces per second, at most window announces are in flight
+    const int benchmark_count = 20000;
+    const int window = 256;
+    int sent = 0;
+    done_count = 0;
+    success_count = 0;
+    DWORD begin = ::GetTickCount();
+    while (done_count < benchmark_count && ::GetTickCount() - begin < 60000)
+    {
+        while (sent < benchmark_count && sent - done_count < window)
+        {
+            client.Announce(tracker, MakeRequest(0x0B000000 + sent, 6881),
+                    CountAnnounce);
+            ++sent;
+        }
+        io_service.Run();
+    }
+    DWORD elapsed = ::GetTickCount() - begin;
+    CHECK_TRUE(success_count == benchmark_count);
+
+    std::cout << benchmark_count << " announces in " << elapsed << "ms, "
+        << benchmark_count * 1000.0 / (elapsed ? elapsed : 1)
+        << " announces per second, " << fake_tracker.connect_count
+        << " connects" << std::endl;
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}
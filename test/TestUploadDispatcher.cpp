@@ -0,0 +1,241 @@
+#include "../core/BitData.h"
+#include "../core/BitCache.h"
+#include "../core/BitService.h"
+#include "../core/BitHashPool.h"
+#include "../core/BitTokenBucket.h"
+#include "../core/BitDownloadingInfo.h"
+#include "../core/BitUploadDispatcher.h"
+#include "../core/BitUploadScheduler.h"
+#include "../core/bencode/BenEncoder.h"
+#include "../sha256/Sha256Value.h"
+#include "../unittest/UnitTest.h"
+#include <Windows.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bitwave;
+using namespace bitwave::core;
+
+namespace {
+
+    // a task of 4 pieces which are not downloaded, reads of the cache
+    // fail at once, so uploads are served without disk
+    const char torrent_file[] = "TestUploadDispatcher.torrent";
+    const long long piece_length = 256 * 1024;
+    const std::size_t piece_count = 4;
+    const int block_size = 16 * 1024;
+
+    class TestPeer : public BitUploadPeer
+    {
+    public:
+        explicit TestPeer(int weight)
+            : weight_(weight),
+              uploaded_(0)
+        {
+        }
+
+        virtual int GetUploadWeight() const
+        {
+            return weight_;
+        }
+
+        virtual BitTokenBucket& GetUploadLimiter()
+        {
+            return limiter_;
+        }
+
+        // the block is not read, the served bytes are counted
+        virtual bool UploadBlock(int index, int begin, int length,
+                                 bool read_ok, const char *block)
+        {
+            uploaded_ += length;
+            return true;
+        }
+
+        long long GetUploaded() const
+        {
+            return uploaded_;
+        }
+
+    private:
+        int weight_;
+        long long uploaded_;
+        BitTokenBucket limiter_;
+    };
+
+    typedef std::tr1::shared_ptr<TestPeer> TestPeerPtr;
+
+    std::tr1::shared_ptr<BitData> MakeBitData()
+    {
+        DefaultBufferCache cache;
+        bentypes::BenWriter writer(cache);
+        {
+            bentypes::BenDictionaryWriter torrent(writer);
+            torrent.Add("announce", "http://tracker.sample.com/announce");
+            bentypes::BenDictionaryWriter info(torrent.Key("info"));
+            info.Add("length", piece_length * piece_count);
+            info.Add("name", "TestUploadDispatcher.bin");
+            info.Add("piece length", piece_length);
+            info.Add("pieces", std::string(20 * piece_count, 'x'));
+        }
+
+        {
+            std::ofstream fs(torrent_file, std::ios_base::out | std::ios_base::binary);
+            fs.write(writer.GetData(), writer.GetSize());
+        }
+
+        std::tr1::shared_ptr<BitData> bitdata(new BitData(torrent_file));
+        bitdata->SetBasePath(".");
+        ::DeleteFileA(torrent_file);
+        return bitdata;
+    }
+
+    // the services and the cache of one task
+    class TestTask
+    {
+    public:
+        TestTask()
+            : bitdata_(MakeBitData()),
+              info_(bitdata_)
+        {
+            BitService::hash_pool = &hash_pool_;
+            BitService::upload_scheduler = &scheduler_;
+            cache_.reset(new BitCache(bitdata_, &info_));
+            limiter_.reset(new BitTokenBucket);
+            dispatcher_.reset(new BitUploadDispatcher(cache_, limiter_));
+        }
+
+        ~TestTask()
+        {
+            dispatcher_.reset();
+            BitService::upload_scheduler = 0;
+            BitService::hash_pool = 0;
+        }
+
+        BitUploadDispatcher& GetDispatcher()
+        {
+            return *dispatcher_;
+        }
+
+        BitCache& GetCache()
+        {
+            return *cache_;
+        }
+
+    private:
+        BitHashPool hash_pool_;
+        BitUploadScheduler scheduler_;
+        std::tr1::shared_ptr<BitData> bitdata_;
+        BitDownloadingInfo info_;
+        std::tr1::shared_ptr<BitCache> cache_;
+        std::tr1::shared_ptr<BitTokenBucket> limiter_;
+        std::tr1::shared_ptr<BitUploadDispatcher> dispatcher_;
+    };
+
+    void PendingBlocks(BitUploadDispatcher& dispatcher,
+                       const TestPeerPtr& peer, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            int begin = (i * block_size) % piece_length;
+            dispatcher.PendingUpload(peer, 0, begin, block_size);
+        }
+    }
+
+} // unnamed namespace
+
+TEST_CASE(weighted_fairness)
+{
+    TestTask task;
+    BitUploadDispatcher& dispatcher = task.GetDispatcher();
+
+    // both peers have more requests than they can be served
+    TestPeerPtr light(new TestPeer(1));
+    TestPeerPtr heavy(new TestPeer(3));
+    PendingBlocks(dispatcher, light, 100);
+    PendingBlocks(dispatcher, heavy, 300);
+
+    // the peers are served 1 : 3 blocks by their weights
+    for (int i = 0; i < 200; ++i)
+        CHECK_TRUE(dispatcher.ServeOne() == block_size);
+    CHECK_TRUE(light->GetUploaded() == 50 * block_size);
+    CHECK_TRUE(heavy->GetUploaded() == 150 * block_size);
+
+    // a gone peer is dropped, the other one gets all, a serve of no
+    // upload ends each turn of it
+    light.reset();
+    for (int i = 0; i < 200; ++i)
+        dispatcher.ServeOne();
+    CHECK_TRUE(heavy->GetUploaded() == 300 * block_size);
+    CHECK_TRUE(!dispatcher.HasPending());
+}
+
+TEST_CASE(invalid_request)
+{
+    CHECK_TRUE(BitUploadDispatcher::IsValidRequest(0, block_size, piece_length));
+    CHECK_TRUE(BitUploadDispatcher::IsValidRequest(
+                piece_length - 1, 1, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(0, 0, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(0, -1, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(-1, 1, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(
+                0, block_size + 1, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(
+                piece_length - block_size / 2, block_size, piece_length));
+    CHECK_TRUE(!BitUploadDispatcher::IsValidRequest(
+                0x7FFFFFFF, block_size, piece_length));
+
+    TestTask task;
+    BitUploadDispatcher& dispatcher = task.GetDispatcher();
+
+    // an oversized request would never fit in the deficit of a turn
+    TestPeerPtr peer(new TestPeer(1));
+    dispatcher.PendingUpload(peer, 0, 0, 1024 * 1024);
+    dispatcher.PendingUpload(peer, 0, 0, 0);
+    CHECK_TRUE(!dispatcher.HasPending());
+    CHECK_TRUE(dispatcher.ServeOne() == 0);
+
+    // the requests after it are served, one a turn
+    PendingBlocks(dispatcher, peer, 2);
+    std::size_t served = 0;
+    for (int i = 0; i < 4; ++i)
+        served += dispatcher.ServeOne();
+    CHECK_TRUE(served == 2 * block_size);
+    CHECK_TRUE(peer->GetUploaded() == 2 * block_size);
+    CHECK_TRUE(!dispatcher.HasPending());
+}
+
+// leaves of pieces hashed for hash requests are kept for the recent
+// 64 pieces
+TEST_CASE(piece_leaves)
+{
+    TestTask task;
+    BitCache& cache = task.GetCache();
+
+    std::vector<Sha256Value> leaves;
+    CHECK_TRUE(!cache.GetPieceLeaves(0, leaves));
+
+    for (std::size_t i = 0; i <= 64; ++i)
+    {
+        char hash[32] = { static_cast<char>(i) };
+        cache.AddPieceLeaves(i, std::vector<Sha256Value>(2,
+                    StreamToSha256Value(hash)));
+    }
+
+    CHECK_TRUE(!cache.GetPieceLeaves(0, leaves));
+    for (std::size_t i = 1; i <= 64; ++i)
+    {
+        char hash[32] = { static_cast<char>(i) };
+        bool kept = cache.GetPieceLeaves(i, leaves);
+        CHECK_TRUE(kept);
+        CHECK_TRUE(leaves.size() == 2 && leaves[1] == StreamToSha256Value(hash));
+    }
+}
+
+int main()
+{
+    TestCollector.RunCases();
+    return 0;
+}